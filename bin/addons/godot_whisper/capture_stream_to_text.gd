@@ -10,47 +10,82 @@ func _get_configuration_warnings():
 	else:
 		return []
 
+## The distil-whisper models are published by their authors, not next to the other ggml models.
+const DISTIL_MODEL_URLS = {
+	"distil-medium.en": "https://huggingface.co/distil-whisper/distil-medium.en/resolve/main/ggml-medium-32-2.en.bin",
+	"distil-large-v2": "https://huggingface.co/distil-whisper/distil-large-v2/resolve/main/ggml-large-32-2.en.bin",
+	"distil-large-v3": "https://huggingface.co/distil-whisper/distil-large-v3-ggml/resolve/main/ggml-distil-large-v3.bin",
+}
+
+var _downloader: ModelDownloader
+
 func _do_download():
+	DirAccess.make_dir_recursive_absolute("res://addons/godot_whisper/models")
+	var file_path = "res://addons/godot_whisper/models/gglm-" + language_model_to_download + ".bin"
+	var url = "https://huggingface.co/ggerganov/whisper.cpp/resolve/main/ggml-" + language_model_to_download + ".bin?download=true"
+	if DISTIL_MODEL_URLS.has(language_model_to_download):
+		url = DISTIL_MODEL_URLS[language_model_to_download] + "?download=true"
+	print("Downloading file from " + url)
+	# Several range requests at once, resumed where a previous download stopped and checked against the published SHA1.
+	if _downloader == null:
+		_downloader = ModelDownloader.new()
+		_downloader.completed.connect(self._model_download_completed)
+	if _downloader.is_downloading():
+		push_warning("Already downloading a model.")
+		return
+	if _downloader.start(url, file_path, ModelDownloader.get_model_sha1(language_model_to_download)) == OK:
+		return
 	var http_request = HTTPRequest.new()
 	add_child(http_request)
 	http_request.use_threads = true
-	DirAccess.make_dir_recursive_absolute("res://addons/godot_whisper/models")
-	var file_path = "res://addons/godot_whisper/models/gglm-" + language_model_to_download + ".bin"
 	http_request.request_completed.connect(self._http_request_completed.bind(file_path))
 	http_request.download_file = file_path
-	var url = "https://huggingface.co/ggerganov/whisper.cpp/resolve/main/ggml-" + language_model_to_download + ".bin?download=true"
-	print("Downloading file from " + url)
-	# Perform a GET request. The URL below returns JSON as of writing.
 	var error = http_request.request(url)
 	if error != OK:
 		push_error("An error occurred in the HTTP request.")
 
+func _model_download_completed(error: int, file_path: String):
+	if error != OK:
+		push_error("Can't downloaded: " + error_string(error))
+		return
+	_check_downloaded_model(file_path)
+
 # Called when the HTTP request is completed.
 func _http_request_completed(result, response_code, headers, body, file_path):
 	if result != HTTPRequest.RESULT_SUCCESS:
 		push_error("Can't downloaded.")
 		return
-	ResourceLoader.load(file_path, "WhisperResource", 2)
+	_check_downloaded_model(file_path)
+
+func _check_downloaded_model(file_path: String):
+	var model: WhisperResource = ResourceLoader.load(file_path, "WhisperResource", 2)
+	if model != null and model.get_model_info().get("distilled", false) != DISTIL_MODEL_URLS.has(language_model_to_download):
+		push_error("The downloaded file is not the " + language_model_to_download + " model.")
+		return
 	print("Download successful. Check " + file_path + ". If file is not there, alt tab or restart editor.")
 
-## The record bus has to have a AudioEffectCapture at index specified by [member audio_effect_capture_index]
+## The record bus has to have a AudioEffectCapture or an [AudioEffectWhisperCapture] at index specified by [member audio_effect_capture_index]. The latter feeds the audio from the audio thread, without polling.
 @export var record_bus := "Record"
 ## The index where the [AudioEffectCapture] is located at in the [member record_bus]
 @export var audio_effect_capture_index := 0
+## Record the default input device with a [MicrophoneCapture] at 16 kHz mono instead of the [member record_bus], where the platform has one. Falls back to the bus otherwise.
+@export var native_capture := false
 ## Download the model specified in the [member language_model_to_download]
 @export var download := false:
 	set(x):
 		_do_download()
 	get:
 		return false
-## What language model to download.
-@export_enum("tiny.en", "tiny", "base.en", "base", "small.en", "small", "medium.en", "medium", "large-v1", "large-v2", "large-v3") var language_model_to_download = "tiny.en"
+## What language model to download. The distil ones decode several times faster, as [member SpeechToText.draft_model] of the model they were distilled from or on their own with [method SpeechToText.apply_streaming_preset].
+@export_enum("tiny.en", "tiny", "base.en", "base", "small.en", "small", "medium.en", "medium", "large-v1", "large-v2", "large-v3", "distil-medium.en", "distil-large-v2", "distil-large-v3") var language_model_to_download = "tiny.en"
 
 @onready var _idx = AudioServer.get_bus_index(record_bus)
 @onready var _effect_capture := AudioServer.get_bus_effect(_idx, audio_effect_capture_index) as AudioEffectCapture
 
 var _last_index = 0
 
+var _microphone: MicrophoneCapture
+
 var _speech_to_text_singleton: SpeechToText:
 	get:
 		return Engine.get_singleton("SpeechToText")
@@ -69,6 +104,13 @@ var _speech_to_text_singleton: SpeechToText:
 	set(val):
 		_speech_to_text_singleton.language_model = val
 
+## Load the language model in the editor as soon as it is set. Otherwise the editor only loads it on [method start_listen], so opening the scene stays fast.
+@export var load_model_in_editor := false :
+	get:
+		return _speech_to_text_singleton.load_model_in_editor
+	set(val):
+		_speech_to_text_singleton.load_model_in_editor = val
+
 ## If we should use gpu for transcribing.
 @export var use_gpu := true :
 	get:
@@ -100,6 +142,20 @@ var _speech_to_text_singleton: SpeechToText:
 	set(val):
 		_speech_to_text_singleton.n_threads = val
 
+## Quality of the converter used to resample the captured audio to 16 kHz. Whisper does not need the sinc best quality.
+@export_enum("Sinc Best","Sinc Medium","Sinc Fastest","Zero Order Hold","Linear") var resampler_quality: int = 2 :
+	get:
+		return _speech_to_text_singleton.resampler_quality
+	set(val):
+		_speech_to_text_singleton.resampler_quality = val
+
+## Commit text as soon as a stable split point is found and only decode the remaining audio, with the committed text as prompt.
+@export var incremental_decoding := false :
+	get:
+		return _speech_to_text_singleton.incremental_decoding
+	set(val):
+		_speech_to_text_singleton.incremental_decoding = val
+
 @export var speed_up := false :
 	get:
 		return _speech_to_text_singleton.speed_up
@@ -122,7 +178,11 @@ var _speech_to_text_singleton: SpeechToText:
 func _ready():
 	if Engine.is_editor_hint():
 		return
-	_add_timer()
+	if native_capture and MicrophoneCapture.is_supported():
+		_microphone = MicrophoneCapture.new()
+	# AudioEffectWhisperCapture and MicrophoneCapture feed SpeechToText by themselves.
+	elif _effect_capture != null:
+		_add_timer()
 	_speech_to_text_singleton.connect("update_transcribed_msgs", self._update_transcribed_msgs_func)
 
 func _add_timer():
@@ -146,58 +206,25 @@ func _on_timer_timeout():
 	else:
 		_effect_capture.clear_buffer()
 
-func _remove_special_characters(message: String, is_partial: bool):
-	var special_characters = [ \
-		{ "start": "[", "end": "]" }, \
-		{ "start": "<", "end": ">" }]
-	for special_character in special_characters:
-		while(message.find(special_character["start"]) != -1):
-			var begin_character := message.find(special_character["start"])
-			var end_character := message.find(special_character["end"])
-			if end_character != -1:
-				message = message.substr(0, begin_character) + message.substr(end_character + 1)
-
-	message = message.trim_suffix("{SPLIT}")
-	
-	var hallucinatory_character = [". you."]
-	for special_character in hallucinatory_character:
-		while(message.find(special_character) != -1):
-			var begin_character := message.find(special_character)
-			var end_character = begin_character + len(special_character)
-			message = message.substr(0, begin_character) + message.substr(end_character + 1)
-	return message
-
-func _update_transcribed_msgs_func(process_time_ms: int, transcribed_msgs: Array):
-	for transcribed_msg  in transcribed_msgs:
-		var cur_text = _remove_special_characters(transcribed_msg["text"], transcribed_msg["is_partial"])
-		if transcribed_msg["is_partial"]==false:
-			if cur_text.ends_with("?") or cur_text.ends_with(",") or cur_text.ends_with("."):
-				pass
-			else:
-				cur_text = cur_text + "."
-		
-		if(cur_text.length()<=1):
-			cur_text = ""
-		
-		var split_character := cur_text.find("{SPLIT}")
-		var first_text = ""
-		var second_text = ""
-		if split_character!=-1:
-			first_text = cur_text.substr(0, split_character)
-			second_text = cur_text.substr(split_character+7)
-		else:
-			first_text = cur_text
-		
-		if transcribed_msg["is_partial"]==false:
-			if second_text!="":
-				update_transcribed_msg.emit(_last_index, transcribed_msg["is_partial"], first_text, process_time_ms)
-				update_transcribed_msg.emit(_last_index+1, true, second_text, process_time_ms)
-			else:
-				update_transcribed_msg.emit(_last_index, transcribed_msg["is_partial"], first_text, process_time_ms)
-		else:
-			update_transcribed_msg.emit(_last_index, transcribed_msg["is_partial"], first_text+second_text, process_time_ms)
-		if transcribed_msg["is_partial"]==false:
-			_last_index+=1
+func _update_transcribed_msgs_func(process_time_ms: int, transcription_results: Array):
+	for result: TranscriptionResult in transcription_results:
+		if result.partial:
+			var partial_text = result.text
+			if partial_text.length() <= 1:
+				partial_text = ""
+			update_transcribed_msg.emit(_last_index, true, partial_text, process_time_ms)
+			continue
+		var committed_text = result.committed_text
+		if not (committed_text.ends_with("?") or committed_text.ends_with(",") or committed_text.ends_with(".")):
+			committed_text = committed_text + "."
+		if committed_text.length() <= 1:
+			committed_text = ""
+		update_transcribed_msg.emit(_last_index, false, committed_text, process_time_ms)
+		_last_index += 1
+		# The tentative text stays in the buffer and is decoded again, show it as the next partial.
+		var tentative_text = result.tentative_text
+		if tentative_text.length() > 1:
+			update_transcribed_msg.emit(_last_index, true, tentative_text, process_time_ms)
 
 ## Is the transcribing thread running? Start it with [method start_listen]
 var is_running = false
@@ -205,11 +232,15 @@ var is_running = false
 ## Starts listening to audio and transcribing.
 func start_listen():
 	_speech_to_text_singleton.start_listen()
+	if _microphone != null and not _microphone.is_capturing():
+		_microphone.start()
 	is_running = true
 	
 ## Stop listening to audio and transcribing.
 func stop_listen():
 	is_running = false
+	if _microphone != null:
+		_microphone.stop()
 	_speech_to_text_singleton.stop_listen()
 	
 
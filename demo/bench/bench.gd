@@ -0,0 +1,302 @@
+## Replays audio files through a SpeechToTextStream for every model, n_threads
+## and use_gpu setting given on the command line, at real time and unthrottled
+## speed, and writes one SpeechToTextBenchmark report per run. Run it with
+## `scons bench` or headless:
+##   godot --headless --path demo res://bench/bench.tscn -- --models=res://addons/godot_whisper/models/gglm-tiny.en.bin --threads=2,4 --gpu=false,true
+## Every option takes a comma separated list:
+##   --audio     WAV files or .sttrec recordings of SpeechToTextStream.start_recording, res://jfk.wav by default
+##   --models    whisper models, the tiny.en model the demo downloads by default
+##   --threads   n_threads, 4 by default
+##   --gpu       use_gpu, false by default
+##   --modes     realtime and unthrottled, both by default, or simulated, the pace of
+##               realtime on a clock that skips the waits, see SpeechToTextBenchmark.simulated
+##   --output    where the JSON reports go, user://bench.json by default
+##   --suites    streams, the runs above, kernels, the ingest and mel kernels
+##               timed by SpeechToTextBenchmark.run_kernel_benchmarks, accuracy,
+##               the reference transcripts of whisper.cpp's tests, and load, many
+##               concurrent streams at real time, streams by default
+##   --kernel_output  where the kernel timings go, user://kernels.json by default
+##   --kernel_min_ms  how long each kernel case runs, 200 by default
+##   --references     the <lang>-<n>-ref.txt transcripts and the <lang>-<n>-16khz.wav files
+##                    tests/run-tests.sh downloads next to them, thirdparty/whisper.cpp/tests by default
+##   --accuracy_output  where the accuracy reports go, user://accuracy.json by default
+##   --max_wer   fail the accuracy suite when a run has a higher word error rate, off by default
+##   --load_streams  how many concurrent streams each step of the load suite runs, fed
+##                   from --audio in turn, 1,2,4,8,16,32 by default
+##   --load_budget_ms  the 95th percentile of time_to_final_ms a step must stay within, 2000 by default
+##   --load_output   where the load steps go, user://load.json by default
+extends Node
+
+var options := {
+	"audio": "res://jfk.wav",
+	"models": "res://addons/godot_whisper/models/gglm-tiny.en.bin",
+	"threads": "4",
+	"gpu": "false",
+	"modes": "realtime,unthrottled",
+	"output": "user://bench.json",
+	"suites": "streams",
+	"kernel_output": "user://kernels.json",
+	"kernel_min_ms": "200",
+	"references": ProjectSettings.globalize_path("res://").path_join("../thirdparty/whisper.cpp/tests").simplify_path(),
+	"accuracy_output": "user://accuracy.json",
+	"max_wer": "",
+	"load_streams": "1,2,4,8,16,32",
+	"load_budget_ms": "2000",
+	"load_output": "user://load.json",
+}
+
+## Whisper's code and the SpeechToText.language of the samples run-tests.sh downloads, by file prefix.
+const REFERENCE_LANGUAGES := {
+	"en": ["en", 1], "de": ["de", 3], "es": ["es", 4], "ru": ["ru", 5],
+	"jp": ["ja", 8], "pt": ["pt", 9], "it": ["it", 16],
+}
+
+
+func _ready():
+	for arg in OS.get_cmdline_user_args():
+		var pair: PackedStringArray = arg.trim_prefix("--").split("=", true, 1)
+		if pair.size() != 2 or not options.has(pair[0]):
+			push_error("Unknown bench option " + arg)
+			get_tree().quit(1)
+			return
+		options[pair[0]] = pair[1]
+	var suites: PackedStringArray = options["suites"].split(",")
+	var failed := false
+	if suites.has("streams"):
+		var streams_ok: bool = await _run_streams()
+		failed = failed or not streams_ok
+	if suites.has("kernels"):
+		failed = failed or not _run_kernels()
+	if suites.has("accuracy"):
+		var accuracy_ok: bool = await _run_accuracy()
+		failed = failed or not accuracy_ok
+	if suites.has("load"):
+		var load_ok: bool = await _run_load()
+		failed = failed or not load_ok
+	get_tree().quit(1 if failed else 0)
+
+
+func _run_streams() -> bool:
+	var reports := []
+	var failed := false
+	for model_path in options["models"].split(","):
+		var model = load(model_path)
+		if model == null:
+			push_error("Cannot load the model " + model_path)
+			failed = true
+			continue
+		for gpu in options["gpu"].split(","):
+			for threads in options["threads"].split(","):
+				SpeechToText.language_model = model
+				SpeechToText.use_gpu = gpu == "true"
+				SpeechToText.n_threads = threads.to_int()
+				var load_start := Time.get_ticks_usec()
+				SpeechToText.load_model()
+				var load_ms := (Time.get_ticks_usec() - load_start) / 1000.0
+				for audio_path in options["audio"].split(","):
+					for mode in options["modes"].split(","):
+						var report := await _run(audio_path, mode)
+						if report.is_empty():
+							failed = true
+							continue
+						report["model"] = model_path
+						report["use_gpu"] = SpeechToText.use_gpu
+						report["n_threads"] = SpeechToText.n_threads
+						report["load_ms"] = load_ms
+						report["audio"] = audio_path
+						failed = failed or report["timed_out"]
+						reports.append(report)
+						print("%s %s gpu=%s threads=%d %s: RTF %.3f, first partial %.0f ms, final %.0f ms, p50/p90/p99 %.0f/%.0f/%.0f ms, mel/encode/decode %.0f/%.0f/%.0f ms, peak RSS %.1f MiB" % [
+							model_path.get_file(), audio_path.get_file(), gpu, report["n_threads"], mode,
+							report["real_time_factor"], report["time_to_first_partial_ms"], report["time_to_final_ms"],
+							report["latency_p50_ms"], report["latency_p90_ms"], report["latency_p99_ms"],
+							report["mel_ms"], report["encode_ms"], report["decode_ms"],
+							report["peak_memory_usage"] / 1048576.0])
+	return _write(options["output"], reports) and not failed
+
+
+## The mel kernels use the model the stream runs loaded last, or the first one of --models.
+func _run_kernels() -> bool:
+	if SpeechToText.language_model == null:
+		var model = load(options["models"].split(",")[0])
+		if model != null:
+			SpeechToText.language_model = model
+			SpeechToText.n_threads = options["threads"].split(",")[0].to_int()
+			SpeechToText.load_model()
+	var results := SpeechToTextBenchmark.run_kernel_benchmarks(options["kernel_min_ms"].to_int())
+	for result in results:
+		print("%s %s %d Hz %d ms: %.0f ns per call, %.2f ns per sample" % [
+			result["kernel"], result["variant"], result["sample_rate"], result["chunk_ms"],
+			result["ns_per_call"], result["ns_per_sample"]])
+	return _write(options["kernel_output"], results)
+
+
+## Every reference sample through the stream in each of --modes and through transcribe_file_async,
+## with the word error rate of each next to its latency and real time factor.
+func _run_accuracy() -> bool:
+	var dir := DirAccess.open(options["references"])
+	if dir == null:
+		push_error("Cannot open the references in " + options["references"])
+		return false
+	var cases: Array[String] = []
+	for file in dir.get_files():
+		if file.ends_with("-ref.txt"):
+			cases.append(file.trim_suffix("-ref.txt"))
+	cases.sort()
+	var max_wer: float = options["max_wer"].to_float() if not options["max_wer"].is_empty() else INF
+	var reports := []
+	var failed := false
+	for model_path in options["models"].split(","):
+		var model = load(model_path)
+		if model == null:
+			push_error("Cannot load the model " + model_path)
+			failed = true
+			continue
+		SpeechToText.language_model = model
+		SpeechToText.use_gpu = options["gpu"].split(",")[0] == "true"
+		SpeechToText.n_threads = options["threads"].split(",")[0].to_int()
+		SpeechToText.load_model()
+		var english_only: bool = model_path.get_file().contains(".en.")
+		for case in cases:
+			var lang: String = case.get_slice("-", 0)
+			var audio_path: String = options["references"].path_join(case + "-16khz.wav")
+			if (english_only and lang != "en") or not REFERENCE_LANGUAGES.has(lang):
+				continue
+			if not FileAccess.file_exists(audio_path):
+				print("Skipping %s, run thirdparty/whisper.cpp/tests/run-tests.sh once to download its audio" % case)
+				continue
+			var reference := FileAccess.get_file_as_string(options["references"].path_join(case + "-ref.txt"))
+			SpeechToText.language = REFERENCE_LANGUAGES[lang][1]
+			var runs := []
+			for mode in options["modes"].split(","):
+				var report := await _run(audio_path, mode)
+				if report.is_empty():
+					failed = true
+					continue
+				report["path"] = "stream_" + mode
+				runs.append(report)
+			var offline := await _run_offline(audio_path, REFERENCE_LANGUAGES[lang][0])
+			if offline.is_empty():
+				failed = true
+			else:
+				offline["audio_seconds"] = runs[0]["audio_seconds"] if not runs.is_empty() else 0.0
+				offline["real_time_factor"] = offline["wall_seconds"] / offline["audio_seconds"] if offline["audio_seconds"] > 0.0 else 0.0
+				runs.append(offline)
+			for report in runs:
+				report.merge(SpeechToTextBenchmark.score_transcript(reference, report["text"]))
+				report["model"] = model_path
+				report["case"] = case
+				failed = failed or report.get("timed_out", false) or report["wer"] > max_wer
+				reports.append(report)
+				print("%s %s %s: WER %.3f (%d/%d/%d of %d words), RTF %.3f, final %.0f ms" % [
+					model_path.get_file(), case, report["path"], report["wer"],
+					report["substitutions"], report["deletions"], report["insertions"], report["reference_words"],
+					report["real_time_factor"], report.get("time_to_final_ms", -1.0)])
+	return _write(options["accuracy_output"], reports) and not failed
+
+
+func _run_offline(audio_path: String, lang: String) -> Dictionary:
+	var start := Time.get_ticks_usec()
+	var job: TranscriptionJob = SpeechToText.transcribe_file_async(audio_path, { "language": lang })
+	if job == null:
+		return {}
+	var completed: Array = await job.completed
+	if not completed[0]:
+		return {}
+	var text := ""
+	for result in completed[1]:
+		text += result.get_text()
+	return {
+		"path": "offline",
+		"wall_seconds": (Time.get_ticks_usec() - start) / 1000000.0,
+		"text": text.strip_edges(),
+	}
+
+
+## Ramps up the number of streams fed at real time, with the first model, n_threads and use_gpu,
+## until the 95th percentile of their time to final exceeds --load_budget_ms. The last step within
+## the budget is what the machine sustains.
+func _run_load() -> bool:
+	var model = load(options["models"].split(",")[0])
+	if model == null:
+		push_error("Cannot load the model " + options["models"].split(",")[0])
+		return false
+	SpeechToText.language_model = model
+	SpeechToText.use_gpu = options["gpu"].split(",")[0] == "true"
+	SpeechToText.n_threads = options["threads"].split(",")[0].to_int()
+	SpeechToText.load_model()
+	var audio_paths: PackedStringArray = options["audio"].split(",")
+	var budget_ms: float = options["load_budget_ms"].to_float()
+	var steps := []
+	var failed := false
+	var capacity := 0
+	for count_text in options["load_streams"].split(","):
+		var count := count_text.to_int()
+		var runs := []
+		var benchmarks := []
+		for i in count:
+			var benchmark := SpeechToTextBenchmark.new()
+			benchmark.realtime = true
+			benchmark.finished.connect(func(report: Dictionary): runs.append(report))
+			if benchmark.start(SpeechToText.create_stream(), audio_paths[i % audio_paths.size()]) != OK:
+				failed = true
+				continue
+			benchmarks.append(benchmark)
+		while runs.size() < benchmarks.size():
+			await get_tree().process_frame
+		var finals := []
+		var lags := []
+		var waiting_max := 0.0
+		var timed_out := false
+		for report in runs:
+			timed_out = timed_out or report["timed_out"]
+			finals.append(report["time_to_final_ms"] if report["time_to_final_ms"] >= 0.0 else INF)
+			lags.append(report["lag_p95_ms"])
+			waiting_max = maxf(waiting_max, report["waiting_streams_max"])
+		var step := {
+			"streams": count,
+			"time_to_final_p95_ms": _percentile(finals, 0.95),
+			"lag_p95_ms": _percentile(lags, 0.95),
+			"waiting_streams_max": waiting_max,
+			"timed_out": timed_out,
+			"runs": runs,
+		}
+		step["within_budget"] = not timed_out and not runs.is_empty() and step["time_to_final_p95_ms"] <= budget_ms
+		steps.append(step)
+		print("%d streams: final p95 %.0f ms, lag p95 %.0f ms (per stream %s), at most %d waiting for a worker%s" % [
+			count, step["time_to_final_p95_ms"], step["lag_p95_ms"],
+			", ".join(lags.map(func(lag): return "%.0f" % lag)), waiting_max,
+			"" if step["within_budget"] else ", over the %.0f ms budget" % budget_ms])
+		if not step["within_budget"]:
+			break
+		capacity = count
+	print("%d streams within the %.0f ms budget" % [capacity, budget_ms])
+	return _write(options["load_output"], steps) and not failed
+
+
+func _percentile(values: Array, percentile: float) -> float:
+	if values.is_empty():
+		return 0.0
+	var sorted := values.duplicate()
+	sorted.sort()
+	return sorted[clampi(ceili(percentile * sorted.size()) - 1, 0, sorted.size() - 1)]
+
+
+func _write(path: String, data: Array) -> bool:
+	var file := FileAccess.open(path, FileAccess.WRITE)
+	if file == null:
+		push_error("Cannot write " + path)
+		return false
+	file.store_string(JSON.stringify(data, "\t"))
+	print("Written to " + ProjectSettings.globalize_path(path))
+	return true
+
+
+func _run(audio_path: String, mode: String) -> Dictionary:
+	var benchmark := SpeechToTextBenchmark.new()
+	benchmark.realtime = mode == "realtime"
+	benchmark.simulated = mode == "simulated"
+	var stream: SpeechToTextStream = SpeechToText.create_stream()
+	if benchmark.start(stream, audio_path) != OK:
+		return {}
+	return await benchmark.finished
@@ -0,0 +1,908 @@
+/**
+ * Headless transcription server, built with `scons server`. It runs the
+ * Godot independent half of the addon, the same VAD, speech segmenter and
+ * endpoint policy a SpeechToTextStream queues its audio with, on any number
+ * of streams, and decodes their utterances on a fixed pool of workers that
+ * encode the ready streams in one batch.
+ *
+ *   POST   /streams/<id>/audio?rate=48000   16-bit little endian mono PCM, opens the stream
+ *   GET    /streams/<id>/results?wait_ms=   committed utterances since the last call, waits up to wait_ms for one
+ *   DELETE /streams/<id>                    forgets the stream and the audio it still holds
+ *   POST   /inference                       the endpoint of the whisper.cpp server, a WAV "file" and the optional "stream" it continues
+ *   GET    /load                            queue depth, busy workers and real time factor, for the clients to balance on
+ *
+ * A stream is decoded with the text of its previous utterance as prompt, so
+ * a client keeps sending one stream to the same node.
+ *
+ * Each stream commits whole utterances, the partial passes of the addon are
+ * not run here.
+ *
+ * With --numa on a Linux machine with several NUMA nodes, every worker and
+ * the ggml threads it starts run on the CPUs of one node, and every stream
+ * belongs to a node: its state is allocated there and only that node's
+ * workers decode it. --numa-replicate also loads a copy of the weights on
+ * each node, so no matrix multiplication reads across the interconnect.
+ *
+ * With --gpus, each CUDA device gets its own copy of the weights, and the
+ * workers and streams are spread over the devices the same way.
+ */
+
+#include "endpoint_policy.h"
+#include "polyphase_decimator.h"
+#include "speech_segmenter.h"
+#include "vad_engine.h"
+#include "voice_activity_detector.h"
+
+#include "audio_sample_convert.h"
+
+#include <whisper.cpp/whisper.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "httplib.h"
+#include "json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+
+#ifdef GODOT_WHISPER_TRACE
+// whisper.cpp reports its zones to the host, the server does not record them.
+extern "C" void godot_whisper_trace_begin(const char *p_name) {}
+extern "C" void godot_whisper_trace_end() {}
+#endif
+
+static const int sample_rate = WHISPER_SAMPLE_RATE;
+/* An utterance still going on is committed at this length, whisper sees 30 s at most. */
+static const int max_utterance_ms = 14000;
+/* whisper_full skips buffers shorter than a second, shorter utterances are padded with silence. */
+static const int min_utterance_samples = WHISPER_SAMPLE_RATE + WHISPER_SAMPLE_RATE / 100;
+/* The longest a results request waits for an utterance, and an inference request for its text. */
+static const int max_wait_ms = 30000;
+/* Prompt tokens a stream keeps of its previous utterance. */
+static const int max_prompt_tokens = 64;
+/* Streams nothing was sent to for this long are forgotten, the clients of /inference never close theirs. */
+static const uint64_t session_idle_msec = 10 * 60 * 1000;
+/* Each decode moves the real time factor this much. */
+static const double rtf_smoothing = 0.1;
+
+struct ServerOptions {
+	std::string model;
+	std::string host = "127.0.0.1";
+	int port = 8090;
+	int threads = 4; // per decode
+	int workers = 1;
+	int max_batch = 4;
+	std::string language = "en";
+	bool use_gpu = true;
+	float speech_threshold = 0.5f;
+	int pre_roll_ms = 200;
+	int hang_over_ms = 300;
+	int endpoint_silence_ms = 400;
+	float freq_thold = 200.0f;
+	bool numa = false;
+	bool numa_replicate = false;
+	std::vector<int> gpus; // CUDA devices with a copy of the weights each, empty for the first one
+};
+
+static uint64_t _now_msec() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Encoder positions for p_samples, rounded up like SpeechToText::_audio_ctx_for_samples with its default settings. */
+static int _audio_ctx_for_samples(whisper_context *p_context, size_t p_samples) {
+	const int samples_per_ctx = 2 * WHISPER_HOP_LENGTH;
+	const int granularity = 64;
+	int audio_ctx = int((p_samples + samples_per_ctx - 1) / samples_per_ctx);
+	audio_ctx = ((audio_ctx + granularity - 1) / granularity) * granularity;
+	return std::max(128, std::min(audio_ctx, whisper_n_audio_ctx(p_context)));
+}
+
+/** The CPUs of each NUMA node, empty when there is only one or they cannot be told apart. */
+static std::vector<std::vector<int>> _read_numa_nodes() {
+	std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+	for (int node = 0;; node++) {
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!file || !std::getline(file, list)) {
+			break;
+		}
+		// Ranges like 0-15,32-47.
+		std::vector<int> cpus;
+		size_t start = 0;
+		while (start < list.size()) {
+			size_t end = list.find(',', start);
+			end = end == std::string::npos ? list.size() : end;
+			const std::string range = list.substr(start, end - start);
+			const size_t dash = range.find('-');
+			const int first = std::atoi(range.c_str());
+			const int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+			for (int cpu = first; cpu <= last && !range.empty(); cpu++) {
+				cpus.push_back(cpu);
+			}
+			start = end + 1;
+		}
+		if (!cpus.empty()) {
+			nodes.push_back(std::move(cpus));
+		}
+	}
+#endif
+	if (nodes.size() < 2) {
+		nodes.clear();
+	}
+	return nodes;
+}
+
+/**
+ * Keeps the calling thread on p_cpus while it lives. The threads it starts
+ * inherit them, the ggml threads of a decode among them, and the pages it
+ * first writes are placed on their node.
+ */
+class NodeBinding {
+#if defined(__linux__)
+	cpu_set_t previous;
+	bool is_bound = false;
+#endif
+
+public:
+	explicit NodeBinding(const std::vector<int> &p_cpus) {
+#if defined(__linux__)
+		if (p_cpus.empty() || pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) != 0) {
+			return;
+		}
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int cpu : p_cpus) {
+			if (cpu < CPU_SETSIZE) {
+				CPU_SET(cpu, &cpus);
+			}
+		}
+		is_bound = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+		if (!is_bound) {
+			fprintf(stderr, "Failed to bind a thread to its NUMA node\n");
+		}
+#endif
+	}
+
+	~NodeBinding() {
+#if defined(__linux__)
+		if (is_bound) {
+			pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+		}
+#endif
+	}
+};
+
+struct Utterance {
+	std::vector<float> samples;
+	uint64_t start_position = 0; // 16 kHz samples since the stream was opened
+	uint64_t end_position = 0;
+	std::shared_ptr<std::promise<std::string>> reply; // of an inference request, nothing goes to the results then
+};
+
+/** One player's audio, between the HTTP handlers that feed and read it and the worker that decodes it. */
+struct StreamSession {
+	std::mutex mutex;
+	std::condition_variable result_cond;
+
+	std::unique_ptr<VadEngine> vad;
+	SpeechSegmenter segmenter;
+	EndpointPolicy endpoint;
+	PolyphaseDecimator decimator;
+	int input_rate = 0;
+	uint64_t endpoint_pause_count = 0;
+	uint64_t endpoint_voiced_frames = 0;
+	uint64_t input_position = 0; // 16 kHz samples pushed so far
+
+	std::vector<float> converted;
+	std::vector<float> resampled;
+	std::vector<float> probabilities;
+	std::vector<float> voiced;
+	std::vector<SpeechSegmenter::Segment> segments;
+
+	Utterance current;
+	std::deque<Utterance> ready;
+	uint64_t ready_msec = 0; // when the oldest ready utterance was committed
+
+	json results = json::array();
+	uint64_t result_serial = 0;
+
+	/* Only touched by the worker decoding the stream, the scheduler never hands it to two. */
+	whisper_context *context = nullptr; // the weights state was made with, the copy of its group
+	whisper_state *state = nullptr;
+	int group = 0; // only the workers of this group decode it
+	std::vector<whisper_token> prompt_tokens; // of the previous utterance
+	bool is_busy = false; // guarded by the scheduler mutex
+	bool is_closed = false;
+	uint64_t active_msec = 0; // guarded by the scheduler mutex, when audio was last sent
+
+	~StreamSession() {
+		if (state != nullptr) {
+			whisper_free_state(state);
+		}
+	}
+};
+
+class StreamServer {
+	ServerOptions options;
+	/*
+	 * The workers and streams are split in groups, one per GPU of --gpus or
+	 * NUMA node of --numa, the larger count of the two. Group g decodes with
+	 * the copy of the weights g % contexts.size() on the CPUs of node
+	 * g % nodes.size().
+	 */
+	std::vector<whisper_context *> contexts; // one per GPU, or per NUMA node with --numa-replicate, else one for all
+	std::vector<std::vector<int>> nodes; // the CPUs of the NUMA nodes the workers are spread over, empty without --numa
+	int n_groups = 1;
+	int next_group = 0;
+
+	const std::vector<int> &_get_cpus(int p_group) const;
+
+	std::map<std::string, std::shared_ptr<StreamSession>> sessions;
+	std::vector<std::thread> workers;
+	int busy_workers = 0;
+	double rtf = 0.0; // smoothed decode time over audio time
+	uint64_t inference_serial = 0;
+	uint64_t swept_msec = 0; // when the idle streams were last looked for
+	bool is_stopping = false;
+	std::mutex mutex;
+	std::condition_variable work_cond;
+
+	std::shared_ptr<StreamSession> _open(const std::string &p_id);
+	void _commit(StreamSession &p_session);
+	void _pick_batch(int p_group, std::vector<std::shared_ptr<StreamSession>> &r_batch);
+	void _decode(StreamSession &p_session, Utterance &p_utterance, int p_audio_ctx);
+	void _worker(int p_group);
+
+public:
+	bool load(const ServerOptions &p_options);
+	void start();
+	void stop();
+
+	/** Returns false when p_rate cannot be brought to 16 kHz, the stream is not opened then. */
+	bool push(const std::string &p_id, const int16_t *p_samples, size_t p_count, int p_rate);
+	/** The results committed since the last call, waits up to p_wait_ms for the first one. Empty when there is no such stream. */
+	json take_results(const std::string &p_id, int p_wait_ms);
+	bool close(const std::string &p_id);
+	/** Decode p_samples at 16 kHz as the next utterance of p_id, a one-off stream when empty. Returns false when it failed or timed out. */
+	bool infer(const std::string &p_id, std::vector<float> &&p_samples, std::string &r_text);
+	json get_load();
+
+	~StreamServer() { stop(); }
+};
+
+bool StreamServer::load(const ServerOptions &p_options) {
+	options = p_options;
+	nodes.clear();
+	if (options.numa) {
+		nodes = _read_numa_nodes();
+		if (nodes.empty()) {
+			fprintf(stderr, "No NUMA nodes to spread the workers over, --numa is ignored\n");
+		}
+		// A node without a worker would never decode its streams.
+		nodes.resize(std::min(nodes.size(), size_t(std::max(1, options.workers))));
+	}
+	std::vector<int> gpus = options.use_gpu ? options.gpus : std::vector<int>();
+	const int n_gpus = whisper_gpu_device_count();
+	for (const int gpu : gpus) {
+		if (gpu < 0 || gpu >= n_gpus) {
+			fprintf(stderr, "No GPU %d, there are %d\n", gpu, n_gpus);
+			return false;
+		}
+	}
+	// A GPU without a worker would hold its weights for nothing.
+	gpus.resize(std::min(gpus.size(), size_t(std::max(1, options.workers))));
+	if (!gpus.empty()) {
+		contexts.assign(gpus.size(), nullptr);
+	} else {
+		contexts.assign(options.numa_replicate && !nodes.empty() ? nodes.size() : 1, nullptr);
+	}
+	n_groups = int(std::max(contexts.size(), std::max<size_t>(nodes.size(), 1)));
+	// Each copy is loaded by a thread of its node, so the pages of the ones in host memory are placed there.
+	std::vector<std::thread> loaders;
+	for (size_t i = 0; i < contexts.size(); i++) {
+		loaders.emplace_back([&, i] {
+			NodeBinding binding(contexts.size() > 1 ? _get_cpus(int(i)) : std::vector<int>());
+			whisper_context_params context_params = whisper_context_default_params();
+			context_params.use_gpu = options.use_gpu;
+			context_params.gpu_device = gpus.empty() ? 0 : gpus[i];
+			contexts[i] = whisper_init_from_file_with_params(options.model.c_str(), context_params);
+		});
+	}
+	for (std::thread &loader : loaders) {
+		loader.join();
+	}
+	for (whisper_context *context : contexts) {
+		if (context == nullptr) {
+			return false;
+		}
+	}
+	if (!gpus.empty()) {
+		printf("Workers on %zu GPUs, the weights on each\n", gpus.size());
+	}
+	if (!nodes.empty()) {
+		printf("Workers on %zu NUMA nodes, %s\n", nodes.size(), contexts.size() > 1 ? "the weights on each" : "one copy of the weights");
+	}
+	return true;
+}
+
+const std::vector<int> &StreamServer::_get_cpus(int p_group) const {
+	static const std::vector<int> any_cpu;
+	return nodes.empty() ? any_cpu : nodes[p_group % nodes.size()];
+}
+
+void StreamServer::start() {
+	is_stopping = false;
+	for (int i = 0; i < std::max(1, options.workers); i++) {
+		workers.emplace_back(&StreamServer::_worker, this, i % n_groups);
+	}
+}
+
+void StreamServer::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_stopping = true;
+	}
+	work_cond.notify_all();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+	sessions.clear();
+	for (whisper_context *context : contexts) {
+		if (context != nullptr) {
+			whisper_free(context);
+		}
+	}
+	contexts.clear();
+}
+
+/* With mutex held. */
+std::shared_ptr<StreamSession> StreamServer::_open(const std::string &p_id) {
+	const uint64_t now = _now_msec();
+	if (now - swept_msec > session_idle_msec / 10) {
+		swept_msec = now;
+		for (auto it = sessions.begin(); it != sessions.end();) {
+			if (it->first != p_id && !it->second->is_busy && now - it->second->active_msec > session_idle_msec) {
+				it = sessions.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	std::shared_ptr<StreamSession> &session = sessions[p_id];
+	if (session) {
+		session->active_msec = now;
+		return session;
+	}
+	session = std::make_shared<StreamSession>();
+	session->active_msec = now;
+	session->group = next_group;
+	next_group = (next_group + 1) % n_groups;
+	session->context = contexts[session->group % contexts.size()];
+	{
+		// The buffers of the state are first written here, on the CPUs of its node.
+		NodeBinding binding(_get_cpus(session->group));
+		session->state = whisper_init_state(session->context);
+	}
+	session->vad = VadEngine::create(VadEngine::MODE_ADAPTIVE, sample_rate);
+	session->vad->set_high_pass(options.freq_thold);
+	session->segmenter.setup(sample_rate, VoiceActivityDetector::FRAME_MS);
+	session->segmenter.set_threshold(options.speech_threshold);
+	session->segmenter.set_pre_roll_ms(options.pre_roll_ms);
+	session->segmenter.set_hang_over_ms(options.hang_over_ms);
+	session->endpoint.set_min_silence_ms(options.endpoint_silence_ms);
+	return session;
+}
+
+/* With the session mutex held, hands the utterance so far to the workers. */
+void StreamServer::_commit(StreamSession &p_session) {
+	if (p_session.current.samples.empty()) {
+		return;
+	}
+	if (p_session.ready.empty()) {
+		p_session.ready_msec = _now_msec();
+	}
+	p_session.ready.push_back(std::move(p_session.current));
+	p_session.current = Utterance();
+}
+
+bool StreamServer::push(const std::string &p_id, const int16_t *p_samples, size_t p_count, int p_rate) {
+	if (p_rate != sample_rate && !PolyphaseDecimator::supports(p_rate, sample_rate)) {
+		return false;
+	}
+	std::shared_ptr<StreamSession> session;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (is_stopping) {
+			return false;
+		}
+		session = _open(p_id);
+	}
+	bool has_ready = false;
+	{
+		std::lock_guard<std::mutex> lock(session->mutex);
+		StreamSession &s = *session;
+		s.converted.resize(p_count);
+		audio_s16_to_f32(p_samples, p_count, s.converted.data());
+		const float *samples = s.converted.data();
+		size_t count = p_count;
+		if (p_rate != sample_rate) {
+			if (s.input_rate != p_rate) {
+				s.decimator.setup(p_rate, sample_rate);
+			}
+			s.resampled.resize(size_t(p_count) * sample_rate / p_rate + 2);
+			count = s.decimator.process(s.converted.data(), p_count, s.resampled.data(), s.resampled.size());
+			samples = s.resampled.data();
+		}
+		s.input_rate = p_rate;
+
+		// The same steps as SpeechToTextStream::_ingest_speech, only the voiced runs make it into an utterance.
+		s.probabilities.clear();
+		s.vad->process(samples, count, false, s.probabilities);
+		s.voiced.clear();
+		s.segments.clear();
+		s.segmenter.process(samples, count, s.probabilities.data(), s.probabilities.size(), s.voiced, s.segments);
+		if (s.segmenter.get_pause_count() != s.endpoint_pause_count) {
+			s.endpoint_pause_count = s.segmenter.get_pause_count();
+			s.endpoint.observe_pause(s.segmenter.get_last_pause_ms());
+		}
+		if (!s.voiced.empty()) {
+			if (s.current.samples.empty()) {
+				s.current.start_position = s.segments.empty() ? s.input_position : s.segments.front().input_position;
+			}
+			s.current.samples.insert(s.current.samples.end(), s.voiced.begin(), s.voiced.end());
+			s.current.end_position = s.input_position + count;
+		}
+		s.input_position += count;
+		const bool is_endpoint = s.segmenter.get_voiced_frames() != s.endpoint_voiced_frames && s.segmenter.get_silence_ms() >= s.endpoint.get_silence_ms();
+		if (is_endpoint) {
+			s.endpoint_voiced_frames = s.segmenter.get_voiced_frames();
+		}
+		if (is_endpoint || s.current.samples.size() >= size_t(max_utterance_ms) * sample_rate / 1000) {
+			_commit(s);
+		}
+		has_ready = !s.ready.empty();
+	}
+	if (has_ready) {
+		work_cond.notify_one();
+	}
+	return true;
+}
+
+json StreamServer::take_results(const std::string &p_id, int p_wait_ms) {
+	std::shared_ptr<StreamSession> session;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = sessions.find(p_id);
+		if (it == sessions.end()) {
+			return json();
+		}
+		session = it->second;
+	}
+	std::unique_lock<std::mutex> lock(session->mutex);
+	session->result_cond.wait_for(lock, std::chrono::milliseconds(std::clamp(p_wait_ms, 0, max_wait_ms)), [&] { return !session->results.empty() || session->is_closed; });
+	json results = std::move(session->results);
+	session->results = json::array();
+	return results;
+}
+
+bool StreamServer::close(const std::string &p_id) {
+	std::shared_ptr<StreamSession> session;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = sessions.find(p_id);
+		if (it == sessions.end()) {
+			return false;
+		}
+		session = it->second;
+		sessions.erase(it);
+	}
+	// A worker decoding it keeps the session alive until its pass is over.
+	std::lock_guard<std::mutex> lock(session->mutex);
+	session->is_closed = true;
+	session->ready.clear();
+	session->result_cond.notify_all();
+	return true;
+}
+
+bool StreamServer::infer(const std::string &p_id, std::vector<float> &&p_samples, std::string &r_text) {
+	std::shared_ptr<StreamSession> session;
+	std::string id = p_id;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (is_stopping) {
+			return false;
+		}
+		if (id.empty()) {
+			// Not a name the clients can give, they are taken from the URL path.
+			id = "#" + std::to_string(inference_serial++);
+		}
+		session = _open(id);
+	}
+	std::future<std::string> reply;
+	{
+		std::lock_guard<std::mutex> lock(session->mutex);
+		Utterance utterance;
+		utterance.samples = std::move(p_samples);
+		utterance.reply = std::make_shared<std::promise<std::string>>();
+		reply = utterance.reply->get_future();
+		if (session->ready.empty()) {
+			session->ready_msec = _now_msec();
+		}
+		session->ready.push_back(std::move(utterance));
+	}
+	work_cond.notify_one();
+	const bool answered = reply.wait_for(std::chrono::milliseconds(max_wait_ms)) == std::future_status::ready;
+	if (p_id.empty()) {
+		close(id);
+	}
+	if (!answered) {
+		return false;
+	}
+	try {
+		r_text = reply.get();
+	} catch (const std::future_error &) {
+		// The stream was closed before its turn, or the decode failed.
+		return false;
+	}
+	return true;
+}
+
+json StreamServer::get_load() {
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t queue_depth = 0;
+	for (const auto &entry : sessions) {
+		std::lock_guard<std::mutex> session_lock(entry.second->mutex);
+		queue_depth += entry.second->ready.size();
+	}
+	return json({
+			{ "streams", sessions.size() },
+			{ "queue_depth", queue_depth },
+			{ "busy_workers", busy_workers },
+			{ "workers", workers.size() },
+			{ "rtf", rtf },
+			{ "gpu", options.use_gpu },
+			{ "gpus", options.use_gpu ? (options.gpus.empty() ? 1 : contexts.size()) : 0 },
+			{ "numa_nodes", nodes.size() },
+	});
+}
+
+/** 16-bit PCM mono of a RIFF file at 16 kHz or a rate PolyphaseDecimator takes, as 16 kHz floats. */
+static bool _read_wav(const std::string &p_data, std::vector<float> &r_samples) {
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(p_data.data());
+	const auto read_le = [&](size_t p_offset, int p_bytes) {
+		uint32_t value = 0;
+		for (int i = 0; i < p_bytes; i++) {
+			value |= uint32_t(data[p_offset + i]) << (8 * i);
+		}
+		return value;
+	};
+	if (p_data.size() < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0) {
+		return false;
+	}
+	int rate = 0;
+	bool is_pcm16_mono = false;
+	for (size_t offset = 12; offset + 8 <= p_data.size();) {
+		const uint32_t chunk_size = read_le(offset + 4, 4);
+		const size_t body = offset + 8;
+		if (memcmp(data + offset, "fmt ", 4) == 0 && body + 16 <= p_data.size()) {
+			is_pcm16_mono = read_le(body, 2) == 1 && read_le(body + 2, 2) == 1 && read_le(body + 14, 2) == 16;
+			rate = int(read_le(body + 4, 4));
+		} else if (memcmp(data + offset, "data", 4) == 0) {
+			if (!is_pcm16_mono || (rate != sample_rate && !PolyphaseDecimator::supports(rate, sample_rate))) {
+				return false;
+			}
+			const size_t count = std::min<size_t>(chunk_size, p_data.size() - body) / sizeof(int16_t);
+			std::vector<int16_t> pcm(count);
+			memcpy(pcm.data(), data + body, count * sizeof(int16_t));
+			std::vector<float> converted(count);
+			audio_s16_to_f32(pcm.data(), count, converted.data());
+			if (rate == sample_rate) {
+				r_samples = std::move(converted);
+				return true;
+			}
+			PolyphaseDecimator decimator;
+			decimator.setup(rate, sample_rate);
+			r_samples.resize(count * sample_rate / rate + 2);
+			r_samples.resize(decimator.process(converted.data(), count, r_samples.data(), r_samples.size()));
+			return true;
+		}
+		offset = body + chunk_size + (chunk_size & 1);
+	}
+	return false;
+}
+
+/* With mutex held. Like TranscriptionScheduler, the streams of p_group that waited the longest go first, at most max_batch of them. */
+void StreamServer::_pick_batch(int p_group, std::vector<std::shared_ptr<StreamSession>> &r_batch) {
+	std::vector<std::pair<uint64_t, std::shared_ptr<StreamSession>>> candidates;
+	for (const auto &entry : sessions) {
+		const std::shared_ptr<StreamSession> &session = entry.second;
+		if (session->is_busy || session->group != p_group) {
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(session->mutex);
+		if (!session->ready.empty()) {
+			candidates.emplace_back(session->ready_msec, session);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+	for (size_t i = 0; i < candidates.size() && int(r_batch.size()) < std::max(1, options.max_batch); i++) {
+		candidates[i].second->is_busy = true;
+		r_batch.push_back(candidates[i].second);
+	}
+}
+
+void StreamServer::_decode(StreamSession &p_session, Utterance &p_utterance, int p_audio_ctx) {
+	whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+	params.n_threads = options.threads;
+	params.language = options.language.c_str();
+	params.no_context = true;
+	params.single_segment = false;
+	params.print_progress = false;
+	params.print_realtime = false;
+	params.print_special = false;
+	params.print_timestamps = false;
+	params.audio_ctx = p_audio_ctx;
+	params.prompt_tokens = p_session.prompt_tokens.data();
+	params.prompt_n_tokens = p_session.prompt_tokens.size();
+	const uint64_t started = _now_msec();
+	whisper_context *context = p_session.context;
+	if (whisper_full_with_state(context, p_session.state, params, p_utterance.samples.data(), p_utterance.samples.size()) != 0) {
+		fprintf(stderr, "Failed to decode an utterance\n");
+		return;
+	}
+	const double decode_rtf = double(_now_msec() - started) * sample_rate / (1000.0 * p_utterance.samples.size());
+	std::string text;
+	p_session.prompt_tokens.clear();
+	const int n_segments = whisper_full_n_segments_from_state(p_session.state);
+	for (int i = 0; i < n_segments; i++) {
+		text += whisper_full_get_segment_text_from_state(p_session.state, i);
+		const int n_tokens = whisper_full_n_tokens_from_state(p_session.state, i);
+		for (int j = 0; j < n_tokens; j++) {
+			const whisper_token token = whisper_full_get_token_id_from_state(p_session.state, i, j);
+			if (token < whisper_token_eot(context)) {
+				p_session.prompt_tokens.push_back(token);
+			}
+		}
+	}
+	if (int(p_session.prompt_tokens.size()) > max_prompt_tokens) {
+		p_session.prompt_tokens.erase(p_session.prompt_tokens.begin(), p_session.prompt_tokens.end() - max_prompt_tokens);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		rtf = rtf > 0.0 ? rtf + (decode_rtf - rtf) * rtf_smoothing : decode_rtf;
+	}
+	if (p_utterance.reply) {
+		p_utterance.reply->set_value(text);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(p_session.mutex);
+	if (p_session.is_closed) {
+		return;
+	}
+	p_session.results.push_back({
+			{ "id", p_session.result_serial++ },
+			{ "text", text },
+			{ "start_ms", p_utterance.start_position * 1000 / sample_rate },
+			{ "end_ms", p_utterance.end_position * 1000 / sample_rate },
+	});
+	p_session.result_cond.notify_all();
+}
+
+void StreamServer::_worker(int p_group) {
+	NodeBinding binding(_get_cpus(p_group));
+	std::vector<std::shared_ptr<StreamSession>> batch;
+	std::vector<Utterance> utterances;
+	std::vector<whisper_state *> states;
+	std::vector<const float *> samples;
+	std::vector<int> n_samples;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		batch.clear();
+		_pick_batch(p_group, batch);
+		if (batch.empty()) {
+			if (is_stopping) {
+				return;
+			}
+			work_cond.wait(lock);
+			continue;
+		}
+		utterances.clear();
+		for (const std::shared_ptr<StreamSession> &session : batch) {
+			std::lock_guard<std::mutex> session_lock(session->mutex);
+			utterances.push_back(std::move(session->ready.front()));
+			session->ready.pop_front();
+			session->ready_msec = _now_msec();
+		}
+		busy_workers++;
+		lock.unlock();
+
+		states.clear();
+		samples.clear();
+		n_samples.clear();
+		// The streams of a group share its weights.
+		whisper_context *context = batch[0]->context;
+		int audio_ctx = 0;
+		for (size_t i = 0; i < batch.size(); i++) {
+			if (utterances[i].samples.size() < size_t(min_utterance_samples)) {
+				utterances[i].samples.resize(min_utterance_samples, 0.0f);
+			}
+			states.push_back(batch[i]->state);
+			samples.push_back(utterances[i].samples.data());
+			n_samples.push_back(utterances[i].samples.size());
+			audio_ctx = std::max(audio_ctx, _audio_ctx_for_samples(context, utterances[i].samples.size()));
+		}
+		// whisper_full only reuses the batched encoding with the audio_ctx it was made with.
+		if (states.size() > 1 && whisper_encode_batch_with_states(context, states.data(), samples.data(), n_samples.data(), states.size(), audio_ctx, options.threads) != 0) {
+			// Every stream encodes on its own in whisper_full then.
+			fprintf(stderr, "Failed to encode the batch\n");
+		}
+		for (size_t i = 0; i < batch.size(); i++) {
+			_decode(*batch[i], utterances[i], audio_ctx);
+		}
+
+		lock.lock();
+		busy_workers--;
+		for (const std::shared_ptr<StreamSession> &session : batch) {
+			session->is_busy = false;
+		}
+	}
+}
+
+static void _print_usage(const char *p_program, const ServerOptions &p_defaults) {
+	fprintf(stderr, "usage: %s -m MODEL [options]\n", p_program);
+	fprintf(stderr, "  -m, --model PATH        ggml model file\n");
+	fprintf(stderr, "  --host HOST             address to listen on (default %s)\n", p_defaults.host.c_str());
+	fprintf(stderr, "  --port PORT             port to listen on (default %d)\n", p_defaults.port);
+	fprintf(stderr, "  -t, --threads N         threads per decode (default %d)\n", p_defaults.threads);
+	fprintf(stderr, "  --workers N             decoding workers (default %d)\n", p_defaults.workers);
+	fprintf(stderr, "  --max-batch N           streams encoded in one pass (default %d)\n", p_defaults.max_batch);
+	fprintf(stderr, "  -l, --language LANG     spoken language, auto to detect it (default %s)\n", p_defaults.language.c_str());
+	fprintf(stderr, "  --endpoint-silence MS   silence that ends an utterance at least (default %d)\n", p_defaults.endpoint_silence_ms);
+	fprintf(stderr, "  --no-gpu                decode on the CPU\n");
+	fprintf(stderr, "  --numa                  keep each worker and its streams on one NUMA node (Linux)\n");
+	fprintf(stderr, "  --numa-replicate        --numa with a copy of the weights on every node\n");
+	fprintf(stderr, "  --gpus LIST             CUDA devices to spread the streams over, e.g. 0,1, or all\n");
+}
+
+static bool _parse_options(int argc, char **argv, ServerOptions &r_options) {
+	const ServerOptions defaults;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+		if ((arg == "-m" || arg == "--model") && has_value) {
+			r_options.model = argv[++i];
+		} else if (arg == "--host" && has_value) {
+			r_options.host = argv[++i];
+		} else if (arg == "--port" && has_value) {
+			r_options.port = std::atoi(argv[++i]);
+		} else if ((arg == "-t" || arg == "--threads") && has_value) {
+			r_options.threads = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--workers" && has_value) {
+			r_options.workers = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--max-batch" && has_value) {
+			r_options.max_batch = std::max(1, std::atoi(argv[++i]));
+		} else if ((arg == "-l" || arg == "--language") && has_value) {
+			r_options.language = argv[++i];
+		} else if (arg == "--endpoint-silence" && has_value) {
+			r_options.endpoint_silence_ms = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "--no-gpu") {
+			r_options.use_gpu = false;
+		} else if (arg == "--gpus" && has_value) {
+			const std::string list = argv[++i];
+			r_options.gpus.clear();
+			if (list == "all") {
+				for (int gpu = 0; gpu < whisper_gpu_device_count(); gpu++) {
+					r_options.gpus.push_back(gpu);
+				}
+			} else {
+				for (size_t start = 0; start < list.size();) {
+					const size_t end = std::min(list.find(',', start), list.size());
+					r_options.gpus.push_back(std::atoi(list.substr(start, end - start).c_str()));
+					start = end + 1;
+				}
+			}
+		} else if (arg == "--numa") {
+			r_options.numa = true;
+		} else if (arg == "--numa-replicate") {
+			r_options.numa = true;
+			r_options.numa_replicate = true;
+		} else {
+			_print_usage(argv[0], defaults);
+			return false;
+		}
+	}
+	if (r_options.model.empty()) {
+		_print_usage(argv[0], defaults);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	ServerOptions options;
+	if (!_parse_options(argc, argv, options)) {
+		return 1;
+	}
+	StreamServer server;
+	if (!server.load(options)) {
+		fprintf(stderr, "Failed to load the model %s\n", options.model.c_str());
+		return 1;
+	}
+	server.start();
+
+	httplib::Server http;
+	// A results request blocks its thread for the wait, the pool has room for one per stream.
+	http.new_task_queue = [] { return new httplib::ThreadPool(64); };
+	http.Post(R"(/streams/([\w.-]+)/audio)", [&](const httplib::Request &req, httplib::Response &res) {
+		const int rate = req.has_param("rate") ? std::atoi(req.get_param_value("rate").c_str()) : sample_rate;
+		const size_t count = req.body.size() / sizeof(int16_t);
+		std::vector<int16_t> pcm(count);
+		memcpy(pcm.data(), req.body.data(), count * sizeof(int16_t));
+		if (!server.push(req.matches[1], pcm.data(), count, rate)) {
+			res.status = 400;
+			res.set_content(json({ { "error", "unsupported sample rate" } }).dump(), "application/json");
+			return;
+		}
+		res.status = 204;
+	});
+	http.Get(R"(/streams/([\w.-]+)/results)", [&](const httplib::Request &req, httplib::Response &res) {
+		const int wait_ms = req.has_param("wait_ms") ? std::atoi(req.get_param_value("wait_ms").c_str()) : 0;
+		const json results = server.take_results(req.matches[1], wait_ms);
+		if (results.is_null()) {
+			res.status = 404;
+			return;
+		}
+		res.set_content(json({ { "results", results } }).dump(), "application/json");
+	});
+	http.Delete(R"(/streams/([\w.-]+))", [&](const httplib::Request &req, httplib::Response &res) {
+		res.status = server.close(req.matches[1]) ? 204 : 404;
+	});
+	http.Post("/inference", [&](const httplib::Request &req, httplib::Response &res) {
+		std::vector<float> samples;
+		if (!req.has_file("file") || !_read_wav(req.get_file_value("file").content, samples)) {
+			res.status = 400;
+			res.set_content(json({ { "error", "expected a 16-bit mono WAV file" } }).dump(), "application/json");
+			return;
+		}
+		const std::string stream = req.has_file("stream") ? req.get_file_value("stream").content : std::string();
+		std::string text;
+		if (!server.infer(stream, std::move(samples), text)) {
+			res.status = 503;
+			res.set_content(json({ { "error", "failed to decode" } }).dump(), "application/json");
+			return;
+		}
+		res.set_content(json({ { "text", text } }).dump(), "application/json");
+	});
+	http.Get("/load", [&](const httplib::Request &, httplib::Response &res) {
+		res.set_content(server.get_load().dump(), "application/json");
+	});
+
+	printf("Listening on %s:%d\n", options.host.c_str(), options.port);
+	const bool ok = http.listen(options.host, options.port);
+	server.stop();
+	if (!ok) {
+		fprintf(stderr, "Failed to listen on %s:%d\n", options.host.c_str(), options.port);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,137 @@
+#include "audio_downmix.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DOWNMIX_SSE2
+#if defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#define DOWNMIX_AVX2
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DOWNMIX_NEON
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define DOWNMIX_WASM
+#endif
+
+using namespace godot;
+
+typedef void (*downmix_kernel)(const float *p_src, size_t p_frames, float *p_dst);
+
+/* Mono frames downmixed on the stack per step of the fused decimator, a multiple of 3 and of every vector width. */
+static const size_t decimate_block_frames = 192;
+
+static void _downmix_scalar(const float *p_src, size_t p_frames, float *p_dst) {
+	for (size_t i = 0; i < p_frames; i++) {
+		p_dst[i] = (p_src[2 * i] + p_src[2 * i + 1]) * 0.5f;
+	}
+}
+
+#if defined(DOWNMIX_SSE2)
+static void _downmix_sse2(const float *p_src, size_t p_frames, float *p_dst) {
+	const __m128 half = _mm_set1_ps(0.5f);
+	size_t i = 0;
+	for (; i + 4 <= p_frames; i += 4) {
+		const __m128 a = _mm_loadu_ps(p_src + 2 * i);
+		const __m128 b = _mm_loadu_ps(p_src + 2 * i + 4);
+		const __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		const __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_ps(p_dst + i, _mm_mul_ps(_mm_add_ps(left, right), half));
+	}
+	_downmix_scalar(p_src + 2 * i, p_frames - i, p_dst + i);
+}
+#endif
+
+#if defined(DOWNMIX_AVX2)
+__attribute__((target("avx2"))) static void _downmix_avx2(const float *p_src, size_t p_frames, float *p_dst) {
+	const __m256 half = _mm256_set1_ps(0.5f);
+	size_t i = 0;
+	for (; i + 8 <= p_frames; i += 8) {
+		const __m256 a = _mm256_loadu_ps(p_src + 2 * i);
+		const __m256 b = _mm256_loadu_ps(p_src + 2 * i + 8);
+		// The shuffles work per 128-bit lane, the result holds frames 0-1, 4-5, 2-3, 6-7.
+		const __m256 left = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		const __m256 right = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		const __m256 mono = _mm256_mul_ps(_mm256_add_ps(left, right), half);
+		_mm256_storeu_ps(p_dst + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(mono), _MM_SHUFFLE(3, 1, 2, 0))));
+	}
+	_downmix_sse2(p_src + 2 * i, p_frames - i, p_dst + i);
+}
+#endif
+
+#if defined(DOWNMIX_NEON)
+static void _downmix_neon(const float *p_src, size_t p_frames, float *p_dst) {
+	size_t i = 0;
+	for (; i + 4 <= p_frames; i += 4) {
+		const float32x4x2_t stereo = vld2q_f32(p_src + 2 * i);
+		vst1q_f32(p_dst + i, vmulq_n_f32(vaddq_f32(stereo.val[0], stereo.val[1]), 0.5f));
+	}
+	_downmix_scalar(p_src + 2 * i, p_frames - i, p_dst + i);
+}
+#endif
+
+#if defined(DOWNMIX_WASM)
+static void _downmix_wasm(const float *p_src, size_t p_frames, float *p_dst) {
+	const v128_t half = wasm_f32x4_splat(0.5f);
+	size_t i = 0;
+	for (; i + 4 <= p_frames; i += 4) {
+		const v128_t a = wasm_v128_load(p_src + 2 * i);
+		const v128_t b = wasm_v128_load(p_src + 2 * i + 4);
+		const v128_t left = wasm_i32x4_shuffle(a, b, 0, 2, 4, 6);
+		const v128_t right = wasm_i32x4_shuffle(a, b, 1, 3, 5, 7);
+		wasm_v128_store(p_dst + i, wasm_f32x4_mul(wasm_f32x4_add(left, right), half));
+	}
+	_downmix_scalar(p_src + 2 * i, p_frames - i, p_dst + i);
+}
+#endif
+
+struct downmix_kernels {
+	downmix_kernel downmix;
+	const char *name;
+};
+
+static downmix_kernels _select_kernels() {
+#if defined(DOWNMIX_AVX2)
+	if (__builtin_cpu_supports("avx2")) {
+		return { _downmix_avx2, "avx2" };
+	}
+#endif
+#if defined(DOWNMIX_SSE2)
+	return { _downmix_sse2, "sse2" };
+#elif defined(DOWNMIX_NEON)
+	return { _downmix_neon, "neon" };
+#elif defined(DOWNMIX_WASM)
+	return { _downmix_wasm, "wasm-simd" };
+#else
+	return { _downmix_scalar, "scalar" };
+#endif
+}
+
+static const downmix_kernels &_get_kernels() {
+	static const downmix_kernels kernels = _select_kernels();
+	return kernels;
+}
+
+void audio_downmix_stereo(const float *p_src, size_t p_frames, float *p_dst) {
+	_get_kernels().downmix(p_src, p_frames, p_dst);
+}
+
+void audio_downmix_decimate3(const float *p_src, size_t p_frames, float *p_dst) {
+	const downmix_kernel downmix = _get_kernels().downmix;
+	float mono[decimate_block_frames];
+	for (size_t done = 0; done < p_frames; done += decimate_block_frames) {
+		const size_t count = MIN(decimate_block_frames, p_frames - done);
+		downmix(p_src + 2 * done, count, mono);
+		float *dst = p_dst + done / 3;
+		for (size_t i = 0; i + 3 <= count; i += 3) {
+			dst[i / 3] = (mono[i] + mono[i + 1] + mono[i + 2]) * (1.0f / 3.0f);
+		}
+	}
+}
+
+const char *audio_downmix_get_kernel_name() {
+	return _get_kernels().name;
+}
@@ -0,0 +1,24 @@
+#ifndef AUDIO_DOWNMIX_H
+#define AUDIO_DOWNMIX_H
+
+#include <cstddef>
+
+/**
+ * Stereo to mono kernels for the ingest path. p_src holds interleaved
+ * left/right float frames, as laid out by a PackedVector2Array. The widest
+ * vector unit of the CPU is picked on first use.
+ */
+
+/** Average the channels of p_frames frames into p_dst. */
+void audio_downmix_stereo(const float *p_src, size_t p_frames, float *p_dst);
+
+/**
+ * Average the channels and every 3 frames in one go, the cheap 48 kHz to
+ * 16 kHz path. p_frames must be a multiple of 3, p_dst receives p_frames / 3.
+ */
+void audio_downmix_decimate3(const float *p_src, size_t p_frames, float *p_dst);
+
+/** Name of the kernel set in use, e.g. "avx2", for diagnostics. */
+const char *audio_downmix_get_kernel_name();
+
+#endif // AUDIO_DOWNMIX_H
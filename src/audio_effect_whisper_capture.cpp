@@ -0,0 +1,82 @@
+#include "audio_effect_whisper_capture.h"
+#include "audio_downmix.h"
+#include "speech_to_text.h"
+
+#include <godot_cpp/classes/audio_server.hpp>
+
+#include <cstring>
+
+void AudioEffectWhisperCaptureInstance::_process(const void *p_src_buffer, AudioFrame *p_dst_buffer, int32_t p_frame_count) {
+	const AudioFrame *src = static_cast<const AudioFrame *>(p_src_buffer);
+	if (p_dst_buffer != src) {
+		memcpy(p_dst_buffer, src, size_t(p_frame_count) * sizeof(AudioFrame));
+	}
+	Ref<SpeechToTextStream> target = base->get_stream();
+	if (target.is_null() || !target->is_listening() || p_frame_count <= 0) {
+		return;
+	}
+	// AudioFrame is a pair of floats, the same interleaved layout the ingest path reads.
+	static_assert(sizeof(AudioFrame) == 2 * sizeof(float), "AudioFrame must hold two floats");
+	target->_ingest_stereo(reinterpret_cast<const float *>(src), p_frame_count, false);
+}
+
+void AudioEffectWhisperCapture::set_stream(const Ref<SpeechToTextStream> &p_stream) {
+	MutexLock lock(stream_mutex);
+	stream = p_stream;
+}
+
+Ref<SpeechToTextStream> AudioEffectWhisperCapture::get_stream() {
+	{
+		MutexLock lock(stream_mutex);
+		if (stream.is_valid()) {
+			return stream;
+		}
+	}
+	SpeechToText *speech_to_text = SpeechToText::get_singleton();
+	return speech_to_text ? speech_to_text->get_default_stream() : Ref<SpeechToTextStream>();
+}
+
+Ref<AudioEffectInstance> AudioEffectWhisperCapture::_instantiate() {
+	Ref<AudioEffectWhisperCaptureInstance> instance;
+	instance.instantiate();
+	instance->base = Ref<AudioEffectWhisperCapture>(this);
+	return instance;
+}
+
+void AudioEffectWhisperCapture::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_stream"), &AudioEffectWhisperCapture::get_stream);
+	ClassDB::bind_method(D_METHOD("set_stream", "stream"), &AudioEffectWhisperCapture::set_stream);
+}
+
+void AudioEffectWhisperReferenceInstance::_process(const void *p_src_buffer, AudioFrame *p_dst_buffer, int32_t p_frame_count) {
+	const AudioFrame *src = static_cast<const AudioFrame *>(p_src_buffer);
+	if (p_dst_buffer != src) {
+		memcpy(p_dst_buffer, src, size_t(p_frame_count) * sizeof(AudioFrame));
+	}
+	SpeechToText *speech_to_text = SpeechToText::get_singleton();
+	if (!speech_to_text || p_frame_count <= 0) {
+		return;
+	}
+	const uint32_t frames = uint32_t(p_frame_count);
+	const uint32_t mix_rate = uint32_t(AudioServer::get_singleton()->get_mix_rate());
+	if (mono_scratch.size() < frames) {
+		mono_scratch.resize(frames);
+	}
+	audio_downmix_stereo(reinterpret_cast<const float *>(src), frames, mono_scratch.data());
+	if (mix_rate == SpeechToText::SPEECH_SETTING_SAMPLE_RATE) {
+		speech_to_text->echo_reference.write(mono_scratch.data(), frames);
+		return;
+	}
+	const uint32_t capacity = AudioResampler::get_max_output_frames(frames, mix_rate, SpeechToText::SPEECH_SETTING_SAMPLE_RATE);
+	if (resample_scratch.size() < capacity) {
+		resample_scratch.resize(capacity);
+	}
+	const uint32_t resampled = resampler.process(mono_scratch.data(), frames, mix_rate, SpeechToText::SPEECH_SETTING_SAMPLE_RATE, resample_scratch.data(), capacity);
+	speech_to_text->echo_reference.write(resample_scratch.data(), resampled);
+}
+
+Ref<AudioEffectInstance> AudioEffectWhisperReference::_instantiate() {
+	Ref<AudioEffectWhisperReferenceInstance> instance;
+	instance.instantiate();
+	return instance;
+}
@@ -0,0 +1,89 @@
+#ifndef AUDIO_EFFECT_WHISPER_CAPTURE_H
+#define AUDIO_EFFECT_WHISPER_CAPTURE_H
+
+#include "audio_resampler.h"
+#include "speech_to_text_stream.h"
+
+#include <godot_cpp/classes/audio_effect.hpp>
+#include <godot_cpp/classes/audio_effect_instance.hpp>
+#include <godot_cpp/classes/audio_frame.hpp>
+#include <godot_cpp/classes/mutex.hpp>
+
+#include <vector>
+
+using namespace godot;
+
+class AudioEffectWhisperCapture;
+
+class AudioEffectWhisperCaptureInstance : public AudioEffectInstance {
+	GDCLASS(AudioEffectWhisperCaptureInstance, AudioEffectInstance);
+
+	friend class AudioEffectWhisperCapture;
+
+	Ref<AudioEffectWhisperCapture> base;
+
+protected:
+	static void _bind_methods() {}
+
+public:
+	virtual void _process(const void *p_src_buffer, AudioFrame *p_dst_buffer, int32_t p_frame_count) override;
+};
+
+/**
+ * Bus effect that feeds the audio passing through it to a SpeechToTextStream
+ * from the audio thread, as it is mixed. The audio itself passes unchanged.
+ * Replaces polling an AudioEffectCapture from a script.
+ */
+class AudioEffectWhisperCapture : public AudioEffect {
+	GDCLASS(AudioEffectWhisperCapture, AudioEffect);
+
+	friend class AudioEffectWhisperCaptureInstance;
+
+	Ref<SpeechToTextStream> stream;
+	Mutex stream_mutex; // the audio thread reads stream while scripts may set it
+
+protected:
+	static void _bind_methods();
+
+public:
+	/** Null feeds the stream behind the SpeechToText add_audio_buffer/start_listen methods. */
+	void set_stream(const Ref<SpeechToTextStream> &p_stream);
+	Ref<SpeechToTextStream> get_stream();
+
+	virtual Ref<AudioEffectInstance> _instantiate() override;
+};
+
+class AudioEffectWhisperReferenceInstance : public AudioEffectInstance {
+	GDCLASS(AudioEffectWhisperReferenceInstance, AudioEffectInstance);
+
+	friend class AudioEffectWhisperReference;
+
+	/* Audio thread only. */
+	AudioResampler resampler;
+	std::vector<float> mono_scratch;
+	std::vector<float> resample_scratch;
+
+protected:
+	static void _bind_methods() {}
+
+public:
+	virtual void _process(const void *p_src_buffer, AudioFrame *p_dst_buffer, int32_t p_frame_count) override;
+};
+
+/**
+ * Bus effect that hands what the game plays to the echo cancellation of the
+ * streams, see SpeechToText.echo_cancellation. Goes last on the Master bus,
+ * the bus the microphone is captured from must not be sent there. The audio
+ * itself passes unchanged.
+ */
+class AudioEffectWhisperReference : public AudioEffect {
+	GDCLASS(AudioEffectWhisperReference, AudioEffect);
+
+protected:
+	static void _bind_methods() {}
+
+public:
+	virtual Ref<AudioEffectInstance> _instantiate() override;
+};
+
+#endif // AUDIO_EFFECT_WHISPER_CAPTURE_H
@@ -0,0 +1,91 @@
+#define DR_WAV_IMPLEMENTATION
+#include "audio_file_reader.h"
+#include "audio_downmix.h"
+
+#include <whisper.cpp/whisper.h>
+#include <godot_cpp/core/error_macros.hpp>
+
+#include <cstring>
+
+AudioFileReader::~AudioFileReader() {
+	close();
+}
+
+size_t AudioFileReader::_on_read(void *p_reader, void *p_buffer, size_t p_bytes) {
+	AudioFileReader *reader = static_cast<AudioFileReader *>(p_reader);
+	const PackedByteArray bytes = reader->file->get_buffer(p_bytes);
+	memcpy(p_buffer, bytes.ptr(), bytes.size());
+	return bytes.size();
+}
+
+drwav_bool32 AudioFileReader::_on_seek(void *p_reader, int p_offset, drwav_seek_origin p_origin) {
+	AudioFileReader *reader = static_cast<AudioFileReader *>(p_reader);
+	const int64_t position = (p_origin == drwav_seek_origin_start ? 0 : int64_t(reader->file->get_position())) + p_offset;
+	if (position < 0 || position > int64_t(reader->file->get_length())) {
+		return DRWAV_FALSE;
+	}
+	reader->file->seek(position);
+	return DRWAV_TRUE;
+}
+
+bool AudioFileReader::open(const String &p_path) {
+	close();
+	file = FileAccess::open(p_path, FileAccess::READ);
+	ERR_FAIL_COND_V_MSG(file.is_null(), false, vformat("Cannot open \"%s\".", p_path));
+	if (!drwav_init(&wav, &AudioFileReader::_on_read, &AudioFileReader::_on_seek, this, nullptr)) {
+		file.unref();
+		ERR_FAIL_V_MSG(false, vformat("\"%s\" is not a WAV file dr_wav can decode.", p_path));
+	}
+	is_wav_open = true;
+	// Nothing waits for the result in real time, so the resampler can afford a better filter.
+	resampler.set_quality(SRC_SINC_MEDIUM_QUALITY);
+	resampler.reset();
+	return true;
+}
+
+void AudioFileReader::close() {
+	if (is_wav_open) {
+		drwav_uninit(&wav);
+		is_wav_open = false;
+	}
+	file.unref();
+}
+
+size_t AudioFileReader::read_block(std::vector<float> &r_pcmf32) {
+	if (!is_wav_open) {
+		return 0;
+	}
+	const uint32_t channels = wav.channels;
+	const size_t size_before = r_pcmf32.size();
+	// The resampler may hold back a whole block at the start, read on until something comes out.
+	while (r_pcmf32.size() == size_before) {
+		block.resize(size_t(BLOCK_FRAMES) * channels);
+		const uint32_t frames = drwav_read_pcm_frames_f32(&wav, BLOCK_FRAMES, block.data());
+		if (frames == 0) {
+			break;
+		}
+		mono.resize(frames);
+		if (channels == 2) {
+			audio_downmix_stereo(block.data(), frames, mono.data());
+		} else {
+			for (uint32_t i = 0; i < frames; i++) {
+				float sum = 0.0f;
+				for (uint32_t c = 0; c < channels; c++) {
+					sum += block[size_t(i) * channels + c];
+				}
+				mono[i] = sum / channels;
+			}
+		}
+		const uint32_t capacity = AudioResampler::get_max_output_frames(frames, wav.sampleRate, WHISPER_SAMPLE_RATE);
+		r_pcmf32.resize(size_before + capacity);
+		r_pcmf32.resize(size_before + resampler.process(mono.data(), frames, wav.sampleRate, WHISPER_SAMPLE_RATE, r_pcmf32.data() + size_before, capacity));
+	}
+	return r_pcmf32.size() - size_before;
+}
+
+uint64_t AudioFileReader::get_output_frames() const {
+	if (!is_wav_open || wav.sampleRate == 0) {
+		return 0;
+	}
+	return wav.totalPCMFrameCount * WHISPER_SAMPLE_RATE / wav.sampleRate;
+}
@@ -0,0 +1,50 @@
+#ifndef AUDIO_FILE_READER_H
+#define AUDIO_FILE_READER_H
+
+#include "audio_resampler.h"
+
+#include <whisper.cpp/examples/dr_wav.h>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <cstdint>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * Reads a WAV file through FileAccess in fixed size blocks and hands it out
+ * as 16 kHz mono, so a recording of any length only ever has one block and
+ * the resampler history in memory. Any format dr_wav decodes is accepted.
+ */
+class AudioFileReader {
+public:
+	/* Frames of the file decoded at once. */
+	static const uint32_t BLOCK_FRAMES = 4096;
+
+private:
+	Ref<FileAccess> file;
+	drwav wav;
+	bool is_wav_open = false;
+	AudioResampler resampler;
+	std::vector<float> block; // interleaved frames of the last block
+	std::vector<float> mono;
+
+	static size_t _on_read(void *p_reader, void *p_buffer, size_t p_bytes);
+	static drwav_bool32 _on_seek(void *p_reader, int p_offset, drwav_seek_origin p_origin);
+
+public:
+	bool open(const String &p_path);
+	void close();
+	_FORCE_INLINE_ bool is_open() const { return is_wav_open; }
+
+	/** Decode the next block and append it to r_pcmf32 as 16 kHz mono. Returns the frames appended, 0 once the file ended. */
+	size_t read_block(std::vector<float> &r_pcmf32);
+	/** Length of the whole file in 16 kHz frames. */
+	uint64_t get_output_frames() const;
+
+	AudioFileReader() {}
+	~AudioFileReader();
+};
+
+#endif // AUDIO_FILE_READER_H
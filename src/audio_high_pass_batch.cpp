@@ -0,0 +1,121 @@
+#include "audio_high_pass_batch.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HIGH_PASS_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define HIGH_PASS_NEON
+#endif
+
+using namespace godot;
+
+static const int group_lanes = 4;
+static const int max_groups = AUDIO_HIGH_PASS_MAX_LANES / group_lanes;
+
+/* Same recurrence and order of operations as VoiceActivityDetector::_filter_block. */
+static void _high_pass_scalar(AudioHighPassLane &p_lane, size_t p_begin) {
+	float y = p_lane.output;
+	for (size_t i = p_begin; i < p_lane.count; i++) {
+		y = p_lane.alpha * (y + p_lane.src[i] - y);
+		p_lane.dst[i] = y;
+	}
+	p_lane.output = y;
+}
+
+#if defined(HIGH_PASS_SSE2) || defined(HIGH_PASS_NEON)
+#if defined(HIGH_PASS_SSE2)
+typedef __m128 lane_vector;
+
+static inline lane_vector _load(const float *p_src) { return _mm_loadu_ps(p_src); }
+static inline void _store(float *p_dst, lane_vector p_value) { _mm_storeu_ps(p_dst, p_value); }
+static inline lane_vector _step(lane_vector p_y, lane_vector p_x, lane_vector p_alpha) { return _mm_mul_ps(p_alpha, _mm_sub_ps(_mm_add_ps(p_y, p_x), p_y)); }
+static inline void _transpose(lane_vector &r0, lane_vector &r1, lane_vector &r2, lane_vector &r3) { _MM_TRANSPOSE4_PS(r0, r1, r2, r3); }
+#else
+typedef float32x4_t lane_vector;
+
+static inline lane_vector _load(const float *p_src) { return vld1q_f32(p_src); }
+static inline void _store(float *p_dst, lane_vector p_value) { vst1q_f32(p_dst, p_value); }
+static inline lane_vector _step(lane_vector p_y, lane_vector p_x, lane_vector p_alpha) { return vmulq_f32(p_alpha, vsubq_f32(vaddq_f32(p_y, p_x), p_y)); }
+static inline void _transpose(lane_vector &r0, lane_vector &r1, lane_vector &r2, lane_vector &r3) {
+	const float32x4x2_t t01 = vtrnq_f32(r0, r1);
+	const float32x4x2_t t23 = vtrnq_f32(r2, r3);
+	r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+	r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+	r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+	r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+#endif
+
+void audio_high_pass_batch(AudioHighPassLane *p_lanes, int p_count) {
+	p_count = MIN(p_count, AUDIO_HIGH_PASS_MAX_LANES);
+	if (p_count <= 0) {
+		return;
+	}
+	size_t common = p_lanes[0].count;
+	for (int l = 1; l < p_count; l++) {
+		common = MIN(common, p_lanes[l].count);
+	}
+	common -= common % group_lanes;
+	const int groups = (p_count + group_lanes - 1) / group_lanes;
+	// Lanes past p_count read zeros and write to a sink, so every group is full.
+	const float zeros[group_lanes] = {};
+	float sink[group_lanes];
+	const float *src[AUDIO_HIGH_PASS_MAX_LANES];
+	float *dst[AUDIO_HIGH_PASS_MAX_LANES];
+	size_t stride[AUDIO_HIGH_PASS_MAX_LANES];
+	float alphas[AUDIO_HIGH_PASS_MAX_LANES];
+	float outputs[AUDIO_HIGH_PASS_MAX_LANES];
+	for (int l = 0; l < groups * group_lanes; l++) {
+		const bool is_lane = l < p_count;
+		src[l] = is_lane ? p_lanes[l].src : zeros;
+		dst[l] = is_lane ? p_lanes[l].dst : sink;
+		stride[l] = is_lane ? 1 : 0;
+		alphas[l] = is_lane ? p_lanes[l].alpha : 0.0f;
+		outputs[l] = is_lane ? p_lanes[l].output : 0.0f;
+	}
+	lane_vector alpha[max_groups];
+	lane_vector y[max_groups];
+	for (int g = 0; g < groups; g++) {
+		alpha[g] = _load(alphas + g * group_lanes);
+		y[g] = _load(outputs + g * group_lanes);
+	}
+	for (size_t i = 0; i < common; i += group_lanes) {
+		for (int g = 0; g < groups; g++) {
+			const int l = g * group_lanes;
+			// Rows are 4 samples of one lane, after the transpose 1 sample of 4 lanes.
+			lane_vector x0 = _load(src[l] + i * stride[l]);
+			lane_vector x1 = _load(src[l + 1] + i * stride[l + 1]);
+			lane_vector x2 = _load(src[l + 2] + i * stride[l + 2]);
+			lane_vector x3 = _load(src[l + 3] + i * stride[l + 3]);
+			_transpose(x0, x1, x2, x3);
+			x0 = y[g] = _step(y[g], x0, alpha[g]);
+			x1 = y[g] = _step(y[g], x1, alpha[g]);
+			x2 = y[g] = _step(y[g], x2, alpha[g]);
+			x3 = y[g] = _step(y[g], x3, alpha[g]);
+			_transpose(x0, x1, x2, x3);
+			_store(dst[l] + i * stride[l], x0);
+			_store(dst[l + 1] + i * stride[l + 1], x1);
+			_store(dst[l + 2] + i * stride[l + 2], x2);
+			_store(dst[l + 3] + i * stride[l + 3], x3);
+		}
+	}
+	for (int g = 0; g < groups; g++) {
+		_store(outputs + g * group_lanes, y[g]);
+	}
+	// The samples of the longer lanes, one lane at a time.
+	for (int l = 0; l < p_count; l++) {
+		p_lanes[l].output = outputs[l];
+		_high_pass_scalar(p_lanes[l], common);
+	}
+}
+#else
+void audio_high_pass_batch(AudioHighPassLane *p_lanes, int p_count) {
+	p_count = MIN(p_count, AUDIO_HIGH_PASS_MAX_LANES);
+	for (int l = 0; l < p_count; l++) {
+		_high_pass_scalar(p_lanes[l], 0);
+	}
+}
+#endif
@@ -0,0 +1,30 @@
+#ifndef AUDIO_HIGH_PASS_BATCH_H
+#define AUDIO_HIGH_PASS_BATCH_H
+
+#include <cstddef>
+
+/**
+ * The high-pass filter of VoiceActivityDetector for several streams at once,
+ * one stream per vector lane. The filter carries its output from sample to
+ * sample, so it does not vectorise along time the way the downmix and the
+ * absolute sums do. Across streams it does: 4 samples of 4 streams are
+ * transposed so that a vector holds one sample of each, the recurrence steps
+ * them together and the result is transposed back. Up to MAX_LANES streams
+ * are in flight per call, the independent vectors hide the latency of the
+ * recurrence. The output matches the scalar filter bit for bit.
+ */
+
+struct AudioHighPassLane {
+	const float *src = nullptr;
+	float *dst = nullptr; // may be src
+	size_t count = 0;
+	float alpha = 1.0f;
+	float output = 0.0f; // the last output before src, updated to the last one written
+};
+
+static const int AUDIO_HIGH_PASS_MAX_LANES = 16;
+
+/** Filter p_count lanes, at most AUDIO_HIGH_PASS_MAX_LANES. */
+void audio_high_pass_batch(AudioHighPassLane *p_lanes, int p_count);
+
+#endif // AUDIO_HIGH_PASS_BATCH_H
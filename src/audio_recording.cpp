@@ -0,0 +1,83 @@
+#include "audio_recording.h"
+
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+
+#include <cstring>
+
+const char *AudioRecording::EXTENSION = "sttrec";
+
+static const uint32_t recording_magic = 0x43525453; // "STRC"
+static const uint32_t recording_version = 1;
+/* Bytes of a chunk header: time, frame count and mix rate. */
+static const uint64_t chunk_header_size = 16;
+
+Error AudioRecording::start(const String &p_path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	file = FileAccess::open(p_path, FileAccess::WRITE);
+	ERR_FAIL_COND_V_MSG(file.is_null(), FileAccess::get_open_error(), vformat("Cannot write the recording \"%s\".", p_path));
+	file->store_32(recording_magic);
+	file->store_32(recording_version);
+	start_usec = Time::get_singleton()->get_ticks_usec();
+	recording = true;
+	return OK;
+}
+
+void AudioRecording::stop() {
+	std::lock_guard<std::mutex> lock(mutex);
+	recording = false;
+	if (file.is_valid()) {
+		file->close();
+		file.unref();
+	}
+}
+
+void AudioRecording::write(const PackedVector2Array &p_frames, uint32_t p_mix_rate) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (file.is_null()) {
+		return;
+	}
+	const int64_t count = p_frames.size();
+	if (frame_bytes.size() < count * 2 * int64_t(sizeof(float))) {
+		frame_bytes.resize(count * 2 * sizeof(float));
+	}
+	float *dst = reinterpret_cast<float *>(frame_bytes.ptrw());
+#ifdef REAL_T_IS_DOUBLE
+	for (int64_t i = 0; i < count; i++) {
+		dst[2 * i] = float(p_frames[i].x);
+		dst[2 * i + 1] = float(p_frames[i].y);
+	}
+#else
+	memcpy(dst, p_frames.ptr(), count * 2 * sizeof(float));
+#endif
+	file->store_64(Time::get_singleton()->get_ticks_usec() - start_usec);
+	file->store_32(uint32_t(count));
+	file->store_32(p_mix_rate);
+	file->store_buffer(frame_bytes.slice(0, count * 2 * sizeof(float)));
+}
+
+Error AudioRecording::load(const String &p_path, std::vector<Chunk> &r_chunks) {
+	r_chunks.clear();
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::READ);
+	ERR_FAIL_COND_V_MSG(file.is_null(), ERR_FILE_CANT_OPEN, vformat("Cannot open the recording \"%s\".", p_path));
+	ERR_FAIL_COND_V_MSG(file->get_32() != recording_magic || file->get_32() != recording_version, ERR_FILE_UNRECOGNIZED,
+			vformat("\"%s\" is not an audio recording of this version.", p_path));
+	const uint64_t length = file->get_length();
+	while (file->get_position() + chunk_header_size <= length) {
+		Chunk chunk;
+		chunk.usec = file->get_64();
+		const uint32_t count = file->get_32();
+		chunk.mix_rate = file->get_32();
+		ERR_FAIL_COND_V_MSG(chunk.mix_rate == 0 || file->get_position() + uint64_t(count) * 2 * sizeof(float) > length, ERR_FILE_CORRUPT,
+				vformat("\"%s\" is cut short or corrupt.", p_path));
+		const PackedByteArray bytes = file->get_buffer(int64_t(count) * 2 * sizeof(float));
+		const float *src = reinterpret_cast<const float *>(bytes.ptr());
+		chunk.frames.resize(count);
+		Vector2 *frames = chunk.frames.ptrw();
+		for (uint32_t i = 0; i < count; i++) {
+			frames[i] = Vector2(src[2 * i], src[2 * i + 1]);
+		}
+		r_chunks.push_back(std::move(chunk));
+	}
+	return OK;
+}
@@ -0,0 +1,58 @@
+#ifndef AUDIO_RECORDING_H
+#define AUDIO_RECORDING_H
+
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/packed_vector2_array.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * Records the audio a stream is given, every add_audio_buffer call with when
+ * it came and at which mix rate, so a session that lagged for a player can
+ * be fed again exactly as it was by SpeechToTextBenchmark. The file is the
+ * magic and version, then per call its microseconds since the recording
+ * started, its frame count and mix rate and its stereo frames as 32-bit
+ * floats, all little endian.
+ */
+class AudioRecording {
+public:
+	/* Extension SpeechToTextBenchmark replays as a recording instead of decoding it as WAV. */
+	static const char *EXTENSION;
+
+	struct Chunk {
+		uint64_t usec = 0; // since the recording started
+		uint32_t mix_rate = 0;
+		PackedVector2Array frames;
+	};
+
+private:
+	std::mutex mutex;
+	Ref<FileAccess> file;
+	uint64_t start_usec = 0;
+	PackedByteArray frame_bytes; // the frames of the last call as floats, only grows
+	std::atomic<bool> recording{ false };
+
+public:
+	/** Record into p_path from now on, replacing what it holds. */
+	Error start(const String &p_path);
+	/** Close the file, the calls after it are not recorded. */
+	void stop();
+	_FORCE_INLINE_ bool is_recording() const { return recording.load(std::memory_order_relaxed); }
+
+	/** Append one call of p_frames at p_mix_rate Hz, timed now. */
+	void write(const PackedVector2Array &p_frames, uint32_t p_mix_rate);
+
+	/** Every call recorded in p_path, in the order they came. */
+	static Error load(const String &p_path, std::vector<Chunk> &r_chunks);
+
+	~AudioRecording() { stop(); }
+};
+
+#endif // AUDIO_RECORDING_H
@@ -0,0 +1,108 @@
+#include "audio_resampler.h"
+
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <cstring>
+
+using namespace godot;
+
+bool AudioResampler::_ensure_state(uint32_t p_src_rate, uint32_t p_dst_rate) {
+	if (state != nullptr && src_rate == p_src_rate && dst_rate == p_dst_rate) {
+		return true;
+	}
+	if (state != nullptr) {
+		state = src_delete(state);
+	}
+	int error = 0;
+	state = src_new(quality == QUALITY_POLYPHASE ? SRC_SINC_FASTEST : quality, 1, &error);
+	if (state == nullptr) {
+		ERR_PRINT(String(src_strerror(error)));
+		return false;
+	}
+	src_rate = p_src_rate;
+	dst_rate = p_dst_rate;
+	return true;
+}
+
+void AudioResampler::set_quality(int p_quality) {
+	if (quality == p_quality) {
+		return;
+	}
+	quality = p_quality;
+	// Rebuilt with the new converter on the next process().
+	if (state != nullptr) {
+		state = src_delete(state);
+	}
+	src_rate = 0;
+	dst_rate = 0;
+	is_decimator_ready = false;
+}
+
+void AudioResampler::reset() {
+	if (state != nullptr) {
+		src_reset(state);
+	}
+	decimator.reset();
+}
+
+uint32_t AudioResampler::get_max_output_frames(uint32_t p_frames, uint32_t p_src_rate, uint32_t p_dst_rate) {
+	if (p_src_rate == p_dst_rate || p_src_rate == 0) {
+		return p_frames;
+	}
+	// The converter may flush a few frames of history on top of the ratio.
+	return uint32_t((uint64_t)p_frames * p_dst_rate / p_src_rate) + 16;
+}
+
+uint32_t AudioResampler::process(const float *p_src, uint32_t p_frames, uint32_t p_src_rate, uint32_t p_dst_rate, float *p_dst, uint32_t p_dst_capacity) {
+	if (p_src_rate == p_dst_rate) {
+		uint32_t frames = MIN(p_frames, p_dst_capacity);
+		memcpy(p_dst, p_src, static_cast<size_t>(frames) * sizeof(float));
+		return frames;
+	}
+	if (quality == QUALITY_POLYPHASE && PolyphaseDecimator::supports(p_src_rate, p_dst_rate)) {
+		if (!is_decimator_ready || src_rate != p_src_rate || dst_rate != p_dst_rate) {
+			is_decimator_ready = decimator.setup(p_src_rate, p_dst_rate);
+			src_rate = p_src_rate;
+			dst_rate = p_dst_rate;
+			if (state != nullptr) {
+				state = src_delete(state);
+			}
+		}
+		return decimator.process(p_src, p_frames, p_dst, p_dst_capacity);
+	}
+	if (!_ensure_state(p_src_rate, p_dst_rate)) {
+		return 0;
+	}
+	SRC_DATA src_data;
+	src_data.data_in = p_src;
+	src_data.data_out = p_dst;
+	src_data.input_frames = p_frames;
+	src_data.output_frames = p_dst_capacity;
+	src_data.src_ratio = (double)p_dst_rate / (double)p_src_rate;
+	src_data.end_of_input = 0;
+
+	uint32_t written = 0;
+	while (src_data.input_frames > 0 && src_data.output_frames > 0) {
+		int error = src_process(state, &src_data);
+		if (error != 0) {
+			ERR_PRINT(String(src_strerror(error)));
+			break;
+		}
+		if (src_data.input_frames_used == 0 && src_data.output_frames_gen == 0) {
+			break;
+		}
+		written += src_data.output_frames_gen;
+		src_data.data_in += src_data.input_frames_used;
+		src_data.input_frames -= src_data.input_frames_used;
+		src_data.data_out += src_data.output_frames_gen;
+		src_data.output_frames -= src_data.output_frames_gen;
+	}
+	return written;
+}
+
+AudioResampler::~AudioResampler() {
+	if (state != nullptr) {
+		src_delete(state);
+	}
+}
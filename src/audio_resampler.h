@@ -0,0 +1,48 @@
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include "polyphase_decimator.h"
+
+#include <libsamplerate/src/samplerate.h>
+
+#include <cstdint>
+
+/**
+ * Mono resampler that keeps a persistent libsamplerate converter between
+ * chunks, so the filter history carries over chunk edges and the converter is
+ * only rebuilt when the rates or the quality change.
+ */
+class AudioResampler {
+public:
+	/* Past the libsamplerate types: PolyphaseDecimator for 48 kHz and 44.1 kHz to 16 kHz, SRC_SINC_FASTEST otherwise. */
+	static const int QUALITY_POLYPHASE = SRC_LINEAR + 1;
+
+private:
+	SRC_STATE *state = nullptr;
+	PolyphaseDecimator decimator;
+	bool is_decimator_ready = false;
+	int quality = SRC_SINC_FASTEST;
+	uint32_t src_rate = 0;
+	uint32_t dst_rate = 0;
+
+	bool _ensure_state(uint32_t p_src_rate, uint32_t p_dst_rate);
+
+public:
+	/** One of the libsamplerate converter types (SRC_SINC_BEST_QUALITY ... SRC_LINEAR), or QUALITY_POLYPHASE. */
+	void set_quality(int p_quality);
+	int get_quality() const { return quality; }
+
+	/** Drop the filter history, e.g. when a new recording starts. */
+	void reset();
+
+	/** Upper bound of frames process() may write for p_frames input frames. */
+	static uint32_t get_max_output_frames(uint32_t p_frames, uint32_t p_src_rate, uint32_t p_dst_rate);
+
+	/** Resample p_frames mono frames into p_dst, returns the number of frames written. */
+	uint32_t process(const float *p_src, uint32_t p_frames, uint32_t p_src_rate, uint32_t p_dst_rate, float *p_dst, uint32_t p_dst_capacity);
+
+	AudioResampler() {}
+	~AudioResampler();
+};
+
+#endif // AUDIO_RESAMPLER_H
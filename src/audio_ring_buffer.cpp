@@ -0,0 +1,165 @@
+#include "audio_ring_buffer.h"
+#include "audio_sample_convert.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cstring>
+#include <thread>
+
+using namespace godot;
+
+void AudioRingBuffer::_copy_in(uint64_t p_pos, const float *p_src, size_t p_count) {
+	const size_t start = size_t(p_pos & mask);
+	const size_t first = MIN(p_count, capacity - start);
+	if (format == FORMAT_S16) {
+		audio_f32_to_s16(p_src, first, data_s16.data() + start);
+		audio_f32_to_s16(p_src + first, p_count - first, data_s16.data());
+		return;
+	}
+	memcpy(data.data() + start, p_src, first * sizeof(float));
+	if (first < p_count) {
+		memcpy(data.data(), p_src + first, (p_count - first) * sizeof(float));
+	}
+}
+
+void AudioRingBuffer::_copy_out(uint64_t p_pos, float *p_dst, size_t p_count) const {
+	const size_t start = size_t(p_pos & mask);
+	const size_t first = MIN(p_count, capacity - start);
+	if (format == FORMAT_S16) {
+		audio_s16_to_f32(data_s16.data() + start, first, p_dst);
+		audio_s16_to_f32(data_s16.data(), p_count - first, p_dst + first);
+		return;
+	}
+	memcpy(p_dst, data.data() + start, first * sizeof(float));
+	if (first < p_count) {
+		memcpy(p_dst + first, data.data(), (p_count - first) * sizeof(float));
+	}
+}
+
+void AudioRingBuffer::set_capacity(size_t p_frames, SampleFormat p_format) {
+	capacity = 1;
+	while (capacity < p_frames) {
+		capacity <<= 1;
+	}
+	format = p_format;
+	// The storage of the other format is released.
+	std::vector<float>(format == FORMAT_F32 ? capacity : 0, 0.0f).swap(data);
+	std::vector<int16_t>(format == FORMAT_S16 ? capacity : 0, 0).swap(data_s16);
+	mask = capacity - 1;
+	write_pos.store(0);
+	read_pos.store(0);
+	drop_mark = 0;
+}
+
+size_t AudioRingBuffer::write(const float *p_src, size_t p_count, OverflowPolicy p_policy, const std::atomic<bool> *p_keep_waiting) {
+	const size_t frames_limit = get_limit();
+	if (frames_limit == 0 || p_count == 0) {
+		return 0;
+	}
+	uint64_t w = write_pos.load(std::memory_order_relaxed);
+	size_t written = 0;
+
+	switch (p_policy) {
+		case OVERFLOW_DROP_OLDEST:
+		case OVERFLOW_DROP_TO_MARK: {
+			if (p_count > frames_limit) {
+				// Only the newest frames up to the limit can survive anyway.
+				dropped_frames.fetch_add(p_count - frames_limit, std::memory_order_relaxed);
+				p_src += p_count - frames_limit;
+				p_count = frames_limit;
+			}
+			// Push the consumer forward. If it is copying the region we are
+			// about to overwrite, its commit fails and it reads again.
+			uint64_t r = read_pos.load(std::memory_order_acquire);
+			while (w - r + p_count > frames_limit) {
+				uint64_t new_r = r + (w - r + p_count - frames_limit);
+				if (p_policy == OVERFLOW_DROP_TO_MARK) {
+					// Skip ahead to the mark when it is further than what has to go anyway.
+					new_r = MAX(new_r, MIN(drop_mark, w));
+				}
+				if (read_pos.compare_exchange_weak(r, new_r, std::memory_order_acq_rel)) {
+					dropped_frames.fetch_add(new_r - r, std::memory_order_relaxed);
+					break;
+				}
+			}
+			_copy_in(w, p_src, p_count);
+			write_pos.store(w + p_count, std::memory_order_release);
+			written = p_count;
+		} break;
+		case OVERFLOW_DROP_NEWEST: {
+			// The limit may have been lowered below what is queued.
+			const size_t queued = size_t(w - read_pos.load(std::memory_order_acquire));
+			const size_t free = queued < frames_limit ? frames_limit - queued : 0;
+			const size_t count = MIN(free, p_count);
+			_copy_in(w, p_src, count);
+			write_pos.store(w + count, std::memory_order_release);
+			dropped_frames.fetch_add(p_count - count, std::memory_order_relaxed);
+			written = count;
+		} break;
+		case OVERFLOW_BLOCK: {
+			while (written < p_count) {
+				const size_t queued = size_t(w - read_pos.load(std::memory_order_acquire));
+				const size_t free = queued < frames_limit ? frames_limit - queued : 0;
+				if (free == 0) {
+					if (p_keep_waiting == nullptr || !p_keep_waiting->load()) {
+						dropped_frames.fetch_add(p_count - written, std::memory_order_relaxed);
+						break;
+					}
+					std::this_thread::yield();
+					continue;
+				}
+				const size_t count = MIN(free, p_count - written);
+				_copy_in(w, p_src + written, count);
+				w += count;
+				write_pos.store(w, std::memory_order_release);
+				written += count;
+			}
+		} break;
+	}
+	return written;
+}
+
+size_t AudioRingBuffer::read(float *p_dst, size_t p_max, uint64_t *r_position) {
+	while (true) {
+		uint64_t r = read_pos.load(std::memory_order_acquire);
+		const uint64_t w = write_pos.load(std::memory_order_acquire);
+		const size_t count = MIN(MIN(size_t(w - r), capacity), p_max);
+		if (count == 0) {
+			return 0;
+		}
+		_copy_out(r, p_dst, count);
+		// Fails when the producer dropped the oldest frames meanwhile, the copy may be torn.
+		if (read_pos.compare_exchange_strong(r, r + count, std::memory_order_acq_rel)) {
+			if (r_position != nullptr) {
+				*r_position = r;
+			}
+			return count;
+		}
+	}
+}
+
+size_t AudioRingBuffer::peek(float *p_dst, size_t p_max, uint64_t *r_position) const {
+	while (true) {
+		const uint64_t r = read_pos.load(std::memory_order_acquire);
+		const uint64_t w = write_pos.load(std::memory_order_acquire);
+		const size_t count = MIN(MIN(size_t(w - r), capacity), p_max);
+		if (count == 0) {
+			return 0;
+		}
+		_copy_out(r, p_dst, count);
+		// The copy is torn when the producer dropped the oldest frames meanwhile, it then moved the read position.
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (read_pos.load(std::memory_order_relaxed) == r) {
+			if (r_position != nullptr) {
+				*r_position = r;
+			}
+			return count;
+		}
+	}
+}
+
+void AudioRingBuffer::clear() {
+	uint64_t r = read_pos.load(std::memory_order_acquire);
+	while (!read_pos.compare_exchange_weak(r, write_pos.load(std::memory_order_acquire), std::memory_order_acq_rel)) {
+	}
+}
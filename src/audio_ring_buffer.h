@@ -0,0 +1,93 @@
+#ifndef AUDIO_RING_BUFFER_H
+#define AUDIO_RING_BUFFER_H
+
+#include <godot_cpp/core/defs.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Bounded single-producer/single-consumer float queue with atomic read and
+ * write positions. The producer (audio ingest) never takes a lock; when the
+ * queue is full the overflow policy decides what is lost. FORMAT_S16 keeps
+ * the samples as 16-bit PCM, half the memory, and converts on the way in
+ * and out.
+ */
+class AudioRingBuffer {
+public:
+	enum OverflowPolicy {
+		OVERFLOW_DROP_OLDEST,
+		OVERFLOW_DROP_NEWEST,
+		OVERFLOW_BLOCK,
+		OVERFLOW_DROP_TO_MARK, // like OVERFLOW_DROP_OLDEST, but drops at least up to the drop mark
+	};
+
+	enum SampleFormat {
+		FORMAT_F32,
+		FORMAT_S16,
+	};
+
+private:
+	std::vector<float> data; // FORMAT_F32
+	std::vector<int16_t> data_s16; // FORMAT_S16
+	size_t capacity = 0;
+	SampleFormat format = FORMAT_F32;
+	uint64_t mask = 0;
+	// Monotonic positions, the slot is position & mask.
+	std::atomic<uint64_t> write_pos{ 0 };
+	std::atomic<uint64_t> read_pos{ 0 };
+	std::atomic<uint64_t> dropped_frames{ 0 };
+	std::atomic<size_t> limit{ 0 }; // 0 is the whole capacity
+	uint64_t drop_mark = 0; // producer side
+
+	void _copy_in(uint64_t p_pos, const float *p_src, size_t p_count);
+	void _copy_out(uint64_t p_pos, float *p_dst, size_t p_count) const;
+
+public:
+	/** Rounded up to a power of two. Not thread safe, call while neither side is active. */
+	void set_capacity(size_t p_frames, SampleFormat p_format = FORMAT_F32);
+	_FORCE_INLINE_ size_t get_capacity() const { return capacity; }
+	/** Bytes of the storage of either format. */
+	_FORCE_INLINE_ size_t get_memory() const { return data.capacity() * sizeof(float) + data_s16.capacity() * sizeof(int16_t); }
+	_FORCE_INLINE_ SampleFormat get_format() const { return format; }
+	/** Frames the queue holds at most, up to the capacity, 0 for all of it. Safe from any thread. */
+	_FORCE_INLINE_ void set_limit(size_t p_frames) { limit.store(p_frames, std::memory_order_relaxed); }
+	_FORCE_INLINE_ size_t get_limit() const {
+		const size_t frames = limit.load(std::memory_order_relaxed);
+		return frames > 0 && frames < capacity ? frames : capacity;
+	}
+
+	/** Frames ready to be read. Safe from both sides. */
+	_FORCE_INLINE_ size_t size() const { return size_t(write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_acquire)); }
+	_FORCE_INLINE_ uint64_t get_dropped_frames() const { return dropped_frames.load(std::memory_order_relaxed); }
+
+	/**
+	 * Producer side. Returns the number of frames queued. With OVERFLOW_BLOCK
+	 * the producer yields until the consumer makes room or p_keep_waiting
+	 * turns false, after which the remainder is dropped.
+	 */
+	size_t write(const float *p_src, size_t p_count, OverflowPolicy p_policy, const std::atomic<bool> *p_keep_waiting = nullptr);
+
+	/** Producer side. Position of the next frame write() queues, counted since set_capacity(). */
+	_FORCE_INLINE_ uint64_t get_write_position() const { return write_pos.load(std::memory_order_relaxed); }
+	/** Producer side. Where OVERFLOW_DROP_TO_MARK skips to, e.g. the start of the latest speech segment. */
+	_FORCE_INLINE_ void set_drop_mark(uint64_t p_position) { drop_mark = p_position; }
+
+	/**
+	 * Consumer side. Copies up to p_max frames to p_dst and returns how many
+	 * were read. r_position receives the write position of the first of them.
+	 */
+	size_t read(float *p_dst, size_t p_max, uint64_t *r_position = nullptr);
+
+	/** Consumer side. Same as read, but the frames stay queued. May run on another thread than read as long as the two never overlap. */
+	size_t peek(float *p_dst, size_t p_max, uint64_t *r_position = nullptr) const;
+
+	/** Consumer side. Discards everything currently queued. */
+	void clear();
+
+	AudioRingBuffer() {}
+};
+
+#endif // AUDIO_RING_BUFFER_H
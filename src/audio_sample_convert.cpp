@@ -0,0 +1,101 @@
+#include "audio_sample_convert.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CONVERT_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define CONVERT_WASM
+#endif
+
+static const float s16_scale = 32767.0f;
+
+static int16_t _to_s16(float p_sample) {
+	const float scaled = p_sample * s16_scale;
+	if (!(scaled > -32768.0f)) {
+		// NaN lands here too, like it does in the vector conversions.
+		return -32768;
+	}
+	return scaled >= 32767.0f ? 32767 : int16_t(std::lrintf(scaled));
+}
+
+void audio_f32_to_s16(const float *p_src, size_t p_count, int16_t *p_dst) {
+	size_t i = 0;
+#if defined(CONVERT_SSE2)
+	const __m128 scale = _mm_set1_ps(s16_scale);
+	for (; i + 8 <= p_count; i += 8) {
+		// Rounds to nearest, packs saturate to the int16 range.
+		const __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(p_src + i), scale));
+		const __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(p_src + i + 4), scale));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(p_dst + i), _mm_packs_epi32(a, b));
+	}
+#elif defined(CONVERT_NEON)
+	for (; i + 8 <= p_count; i += 8) {
+		const int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(p_src + i), s16_scale));
+		const int32x4_t b = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(p_src + i + 4), s16_scale));
+		vst1q_s16(p_dst + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+	}
+#elif defined(CONVERT_WASM)
+	const v128_t scale = wasm_f32x4_splat(s16_scale);
+	for (; i + 8 <= p_count; i += 8) {
+		const v128_t a = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(wasm_f32x4_mul(wasm_v128_load(p_src + i), scale)));
+		const v128_t b = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(wasm_f32x4_mul(wasm_v128_load(p_src + i + 4), scale)));
+		wasm_v128_store(p_dst + i, wasm_i16x8_narrow_i32x4(a, b));
+	}
+#endif
+	for (; i < p_count; i++) {
+		p_dst[i] = _to_s16(p_src[i]);
+	}
+}
+
+void audio_s16_to_f32(const int16_t *p_src, size_t p_count, float *p_dst) {
+	const float scale = 1.0f / s16_scale;
+	size_t i = 0;
+#if defined(CONVERT_SSE2)
+	const __m128 scale4 = _mm_set1_ps(scale);
+	for (; i + 8 <= p_count; i += 8) {
+		const __m128i s16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p_src + i));
+		// Sign extend by unpacking into the high halves and shifting back down.
+		const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s16, s16), 16);
+		const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s16, s16), 16);
+		_mm_storeu_ps(p_dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale4));
+		_mm_storeu_ps(p_dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale4));
+	}
+#elif defined(CONVERT_NEON)
+	for (; i + 8 <= p_count; i += 8) {
+		const int16x8_t s16 = vld1q_s16(p_src + i);
+		vst1q_f32(p_dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s16))), scale));
+		vst1q_f32(p_dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s16))), scale));
+	}
+#elif defined(CONVERT_WASM)
+	const v128_t scale4 = wasm_f32x4_splat(scale);
+	for (; i + 8 <= p_count; i += 8) {
+		const v128_t s16 = wasm_v128_load(p_src + i);
+		wasm_v128_store(p_dst + i, wasm_f32x4_mul(wasm_f32x4_convert_i32x4(wasm_i32x4_extend_low_i16x8(s16)), scale4));
+		wasm_v128_store(p_dst + i + 4, wasm_f32x4_mul(wasm_f32x4_convert_i32x4(wasm_i32x4_extend_high_i16x8(s16)), scale4));
+	}
+#endif
+	for (; i < p_count; i++) {
+		p_dst[i] = p_src[i] * scale;
+	}
+}
+
+void audio_s16_downmix_to_f32(const int16_t *p_src, size_t p_frames, int p_channels, float *p_dst) {
+	if (p_channels == 1) {
+		audio_s16_to_f32(p_src, p_frames, p_dst);
+		return;
+	}
+	const float scale = 1.0f / (s16_scale * p_channels);
+	for (size_t i = 0; i < p_frames; i++) {
+		int32_t sum = 0;
+		for (int channel = 0; channel < p_channels; channel++) {
+			sum += p_src[i * p_channels + channel];
+		}
+		p_dst[i] = sum * scale;
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef AUDIO_SAMPLE_CONVERT_H
+#define AUDIO_SAMPLE_CONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Float to 16-bit PCM and back, for audio kept as int16 to halve its memory.
+ * Floats are scaled by 32767 and saturate outside -1..1, 16-bit capture
+ * survives the round trip exactly.
+ */
+
+void audio_f32_to_s16(const float *p_src, size_t p_count, int16_t *p_dst);
+void audio_s16_to_f32(const int16_t *p_src, size_t p_count, float *p_dst);
+/** Average the p_channels interleaved channels of p_frames frames into p_dst. */
+void audio_s16_downmix_to_f32(const int16_t *p_src, size_t p_frames, int p_channels, float *p_dst);
+
+#endif // AUDIO_SAMPLE_CONVERT_H
@@ -0,0 +1,80 @@
+#include "audio_thread_priority.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <avrt.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#endif
+
+#if defined(_WIN32)
+
+bool AudioThreadPriority::raise(uint32_t p_period_usec, uint32_t p_computation_usec) {
+	if (raised) {
+		return true;
+	}
+	// MMCSS schedules the task by its category, the period is the one of the Pro Audio task in the registry.
+	DWORD task_index = 0;
+	mmcss_task = AvSetMmThreadCharacteristicsW(L"Pro Audio", &task_index);
+	raised = mmcss_task != nullptr;
+	return raised;
+}
+
+void AudioThreadPriority::lower() {
+	if (!raised) {
+		return;
+	}
+	AvRevertMmThreadCharacteristics(mmcss_task);
+	mmcss_task = nullptr;
+	raised = false;
+}
+
+#elif defined(__APPLE__)
+
+static uint32_t _usec_to_mach(uint32_t p_usec) {
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return uint32_t(uint64_t(p_usec) * 1000 * timebase.denom / timebase.numer);
+}
+
+bool AudioThreadPriority::raise(uint32_t p_period_usec, uint32_t p_computation_usec) {
+	if (raised) {
+		return true;
+	}
+	thread_time_constraint_policy_data_t policy;
+	policy.period = _usec_to_mach(p_period_usec);
+	policy.computation = _usec_to_mach(p_computation_usec);
+	// Done within the period it woke for, or the next chunk waits behind it.
+	policy.constraint = policy.period;
+	policy.preemptible = 1;
+	const mach_port_t thread = pthread_mach_thread_np(pthread_self());
+	raised = thread_policy_set(thread, THREAD_TIME_CONSTRAINT_POLICY, reinterpret_cast<thread_policy_t>(&policy), THREAD_TIME_CONSTRAINT_POLICY_COUNT) == KERN_SUCCESS;
+	return raised;
+}
+
+void AudioThreadPriority::lower() {
+	if (!raised) {
+		return;
+	}
+	thread_standard_policy_data_t policy;
+	const mach_port_t thread = pthread_mach_thread_np(pthread_self());
+	thread_policy_set(thread, THREAD_STANDARD_POLICY, reinterpret_cast<thread_policy_t>(&policy), THREAD_STANDARD_POLICY_COUNT);
+	raised = false;
+}
+
+#else
+
+/* Linux only gives real-time scheduling to privileged processes, a game does not ask for it. */
+bool AudioThreadPriority::raise(uint32_t p_period_usec, uint32_t p_computation_usec) {
+	return false;
+}
+
+void AudioThreadPriority::lower() {
+}
+
+#endif
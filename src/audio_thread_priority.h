@@ -0,0 +1,31 @@
+#ifndef AUDIO_THREAD_PRIORITY_H
+#define AUDIO_THREAD_PRIORITY_H
+
+#include <cstdint>
+
+/**
+ * Puts the calling thread in the class the platform gives its audio
+ * threads, for the front-end thread of the streams with realtime_ingest, so
+ * the ingest keeps its pace while game threads load every core. MMCSS "Pro
+ * Audio" on Windows, the time constraint policy on Apple platforms, which
+ * wants the period the thread wakes at and the share of it that it computes.
+ * Elsewhere the thread keeps the priority it has. The inference threads
+ * never go through this.
+ */
+class AudioThreadPriority {
+#if defined(_WIN32)
+	void *mmcss_task = nullptr;
+#endif
+	bool raised = false;
+
+public:
+	/** Raise the calling thread, false when the platform has no such class or refused it. */
+	bool raise(uint32_t p_period_usec, uint32_t p_computation_usec);
+	/** Back to the priority the thread had, on the thread that raised it. */
+	void lower();
+	bool is_raised() const { return raised; }
+
+	~AudioThreadPriority() { lower(); }
+};
+
+#endif // AUDIO_THREAD_PRIORITY_H
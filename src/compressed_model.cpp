@@ -0,0 +1,97 @@
+#include "compressed_model.h"
+
+#include <godot_cpp/core/error_macros.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+bool CompressedModelReader::read_header(const Ref<FileAccess> &p_file, CompressedModelHeader &r_header) {
+	p_file->seek(0);
+	if (p_file->get_buffer((uint8_t *)&r_header, sizeof(r_header)) != sizeof(r_header)) {
+		return false;
+	}
+	return r_header.magic == COMPRESSED_MODEL_MAGIC && r_header.version == COMPRESSED_MODEL_VERSION;
+}
+
+bool CompressedModelReader::open(const String &p_path) {
+	std::unique_ptr<Cursor> cursor = std::make_unique<Cursor>();
+	cursor->file = FileAccess::open(p_path, FileAccess::READ);
+	ERR_FAIL_COND_V_MSG(cursor->file.is_null(), false, "Cannot open whisper model " + p_path);
+	CompressedModelHeader header;
+	if (!read_header(cursor->file, header)) {
+		return false;
+	}
+	frames.resize(header.frame_count);
+	cursor->file->seek(header.frame_table_offset);
+	const uint64_t table_size = uint64_t(header.frame_count) * sizeof(CompressedModelFrame);
+	ERR_FAIL_COND_V_MSG(cursor->file->get_buffer((uint8_t *)frames.data(), table_size) != table_size, false, "Truncated compressed whisper model: " + p_path);
+	// The frames follow each other in the model, from its start to its end.
+	uint64_t offset = 0;
+	for (const CompressedModelFrame &frame : frames) {
+		ERR_FAIL_COND_V_MSG(frame.model_offset != offset, false, "Invalid frame table in compressed whisper model: " + p_path);
+		offset += frame.model_size;
+	}
+	ERR_FAIL_COND_V_MSG(offset != header.model_size, false, "Invalid frame table in compressed whisper model: " + p_path);
+	path = p_path;
+	model_size = header.model_size;
+	cursors.push_back(std::move(cursor));
+	return true;
+}
+
+int CompressedModelReader::_find_frame(uint64_t p_offset) const {
+	if (p_offset >= model_size) {
+		return -1;
+	}
+	const auto next = std::upper_bound(frames.begin(), frames.end(), p_offset, [](uint64_t p_value, const CompressedModelFrame &p_frame) {
+		return p_value < p_frame.model_offset;
+	});
+	return int(next - frames.begin()) - 1;
+}
+
+size_t CompressedModelReader::read_at(uint64_t p_offset, void *p_output, size_t p_size) {
+	std::unique_ptr<Cursor> cursor;
+	{
+		std::lock_guard<std::mutex> lock(cursors_mutex);
+		if (!cursors.empty()) {
+			cursor = std::move(cursors.back());
+			cursors.pop_back();
+		}
+	}
+	if (cursor == nullptr) {
+		cursor = std::make_unique<Cursor>();
+		cursor->file = FileAccess::open(path, FileAccess::READ);
+		ERR_FAIL_COND_V_MSG(cursor->file.is_null(), 0, "Cannot open whisper model " + path);
+	}
+
+	size_t done = 0;
+	while (done < p_size) {
+		const int index = _find_frame(p_offset + done);
+		if (index < 0) {
+			break;
+		}
+		const CompressedModelFrame &frame = frames[index];
+		if (cursor->frame != index) {
+			cursor->frame = -1;
+			cursor->file->seek(frame.file_offset);
+			const PackedByteArray compressed = cursor->file->get_buffer(frame.file_size);
+			if (compressed.size() != int64_t(frame.file_size)) {
+				ERR_PRINT("Truncated compressed whisper model: " + path);
+				break;
+			}
+			cursor->data = compressed.decompress(frame.model_size, FileAccess::COMPRESSION_ZSTD);
+			if (cursor->data.size() != int64_t(frame.model_size)) {
+				ERR_PRINT("Corrupt frame in compressed whisper model: " + path);
+				break;
+			}
+			cursor->frame = index;
+		}
+		const uint64_t begin = p_offset + done - frame.model_offset;
+		const size_t run = size_t(MIN(uint64_t(p_size - done), uint64_t(frame.model_size) - begin));
+		memcpy((uint8_t *)p_output + done, cursor->data.ptr() + begin, run);
+		done += run;
+	}
+
+	std::lock_guard<std::mutex> lock(cursors_mutex);
+	cursors.push_back(std::move(cursor));
+	return done;
+}
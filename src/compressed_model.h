@@ -0,0 +1,80 @@
+#ifndef COMPRESSED_MODEL_H
+#define COMPRESSED_MODEL_H
+
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace godot;
+
+/*
+ * Layout of a whisper model ResourceImporterWhisper compressed, little endian. A CompressedModelHeader,
+ * the zstd frames, then frame_count CompressedModelFrame at frame_table_offset. The frames hold the model
+ * in order: one for the hyperparameters, the mel filters and the vocabulary, then per tensor one for its
+ * header and its data in frames of at most COMPRESSED_MODEL_FRAME_BYTES, so the bytes of a tensor are read
+ * without decompressing those of another one.
+ */
+
+#define COMPRESSED_MODEL_MAGIC 0x54535a57u // "WZST" in little endian
+#define COMPRESSED_MODEL_VERSION 1u
+#define COMPRESSED_MODEL_FRAME_BYTES (4u << 20)
+
+struct CompressedModelHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t model_size; // of the model, decompressed
+	uint64_t frame_table_offset;
+	uint32_t frame_count;
+	uint32_t reserved;
+	/* The first bytes of the model, its magic and hyperparameters, for WhisperResource::read_model_info. */
+	uint8_t model_header[48];
+};
+
+struct CompressedModelFrame {
+	uint64_t model_offset;
+	uint64_t file_offset;
+	uint32_t model_size;
+	uint32_t file_size;
+};
+
+/**
+ * Reads a compressed model at the offsets of the model it holds, for the
+ * whisper_context_params::read_at of WhisperResource::load_context. Each
+ * read only decompresses the frames it overlaps. Thread safe: every thread
+ * reads through a file of its own and keeps the last frame it decompressed,
+ * so the parallel loader decompresses on all of its threads while they copy
+ * the tensors to the device.
+ */
+class CompressedModelReader {
+	struct Cursor {
+		Ref<FileAccess> file;
+		int frame = -1;
+		PackedByteArray data; // of frame, decompressed
+	};
+
+	String path;
+	uint64_t model_size = 0;
+	std::vector<CompressedModelFrame> frames;
+
+	std::mutex cursors_mutex;
+	std::vector<std::unique_ptr<Cursor>> cursors;
+
+	/* The frame holding p_offset of the model, -1 past its end. */
+	int _find_frame(uint64_t p_offset) const;
+
+public:
+	/** The header of a compressed model at the start of p_file, false when it is none. */
+	static bool read_header(const Ref<FileAccess> &p_file, CompressedModelHeader &r_header);
+
+	bool open(const String &p_path);
+	uint64_t get_model_size() const { return model_size; }
+	/** Up to p_size bytes of the model from p_offset, short at its end or when a frame is corrupt. */
+	size_t read_at(uint64_t p_offset, void *p_output, size_t p_size);
+};
+
+#endif // COMPRESSED_MODEL_H
@@ -0,0 +1,257 @@
+#include "echo_canceller.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <chrono>
+#include <cstring>
+
+using namespace godot;
+
+/* Input and reference further apart than about 200 ms, clock drift or a stall, align them again. */
+static const uint64_t max_drift_samples = 3200;
+/* A reference not written for 200 ms is gone, the Master bus went silent or the effect was removed. */
+static const uint64_t reference_timeout_usec = 200000;
+/* Step size of the normalized update, and the -60 dBFS floor of the reference power it is divided by per bin. */
+static const float adaptation_step = 0.5f;
+static const float power_floor = NoiseSuppressor::FRAME_SAMPLES * 1e-6f;
+/* Mean square of a reference block the filter adapts on, -60 dBFS. */
+static const float reference_gate = 1e-6f;
+/* Per block, the reference power and the energies are smoothed over about 25 ms. */
+static const float power_smoothing = 0.3f;
+/* While the error is louder than the echo, i.e. the player speaks too, the step shrinks to this share at least. */
+static const float double_talk_share = 0.25f;
+/* A filter whose output is this much louder than its input diverged. */
+static const float divergence_ratio = 2.0f;
+/* Gain of the blocks that are only echo, -15 dB as for noise suppression. */
+static const float suppression_floor = 0.178f;
+
+static uint64_t _get_steady_usec() {
+	return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+EchoReference::EchoReference() {
+	memset(ring, 0, sizeof(ring));
+}
+
+void EchoReference::write(const float *p_samples, size_t p_count) {
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t position = written.load(std::memory_order_relaxed);
+	if (p_count > size_t(CAPACITY)) {
+		// Only the last CAPACITY samples would be kept anyway.
+		position += p_count - CAPACITY;
+		p_samples += p_count - CAPACITY;
+		p_count = CAPACITY;
+	}
+	size_t done = 0;
+	while (done < p_count) {
+		const size_t offset = size_t(position % CAPACITY);
+		const size_t run = MIN(p_count - done, size_t(CAPACITY) - offset);
+		memcpy(ring + offset, p_samples + done, run * sizeof(float));
+		done += run;
+		position += run;
+	}
+	written.store(position, std::memory_order_release);
+	write_usec.store(_get_steady_usec(), std::memory_order_relaxed);
+}
+
+void EchoReference::read(uint64_t p_position, float *p_dst, size_t p_count) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const uint64_t end = written.load(std::memory_order_relaxed);
+	const uint64_t begin = end > uint64_t(CAPACITY) ? end - CAPACITY : 0;
+	for (size_t i = 0; i < p_count; i++) {
+		const uint64_t position = p_position + i;
+		p_dst[i] = position >= begin && position < end ? ring[position % CAPACITY] : 0.0f;
+	}
+}
+
+bool EchoReference::is_live(uint64_t p_usec) const {
+	return get_write_position() > 0 && _get_steady_usec() - write_usec.load(std::memory_order_relaxed) <= p_usec;
+}
+
+EchoCanceller::EchoCanceller() {
+	reset();
+}
+
+void EchoCanceller::reset() {
+	memset(input, 0, sizeof(input));
+	memset(reference, 0, sizeof(reference));
+	memset(output, 0, sizeof(output));
+	fill = 0;
+	is_synced = false;
+	reference_position = 0;
+	_reset_filter();
+}
+
+void EchoCanceller::_reset_filter() {
+	memset(reference_re, 0, sizeof(reference_re));
+	memset(reference_im, 0, sizeof(reference_im));
+	memset(weight_re, 0, sizeof(weight_re));
+	memset(weight_im, 0, sizeof(weight_im));
+	memset(reference_power, 0, sizeof(reference_power));
+	newest_partition = 0;
+	next_constrained = 0;
+	input_energy = 0.0f;
+	echo_energy = 0.0f;
+	error_energy = 0.0f;
+	suppress_gain = 1.0f;
+}
+
+void EchoCanceller::process(float *p_samples, size_t p_count, EchoReference &p_reference) {
+	if (p_count == 0) {
+		return;
+	}
+	if (p_reference.is_live(reference_timeout_usec)) {
+		const uint64_t written = p_reference.get_write_position();
+		// Where the input starts if it ends with the reference, the echo in it is older than that.
+		const uint64_t expected = written > p_count ? written - p_count : 0;
+		const uint64_t drift = reference_position > expected ? reference_position - expected : expected - reference_position;
+		if (!is_synced || drift > max_drift_samples) {
+			// The filter learned the delay of the old alignment, it would only add echo now.
+			reference_position = expected;
+			_reset_filter();
+			is_synced = true;
+		}
+	} else {
+		is_synced = false;
+	}
+	if (reference_scratch.size() < p_count) {
+		reference_scratch.resize(p_count);
+	}
+	if (is_synced) {
+		p_reference.read(reference_position, reference_scratch.data(), p_count);
+		reference_position += p_count;
+	} else {
+		memset(reference_scratch.data(), 0, p_count * sizeof(float));
+	}
+	for (size_t i = 0; i < p_count; i++) {
+		const float sample = p_samples[i];
+		p_samples[i] = output[fill];
+		input[fill] = sample;
+		reference[BLOCK_SAMPLES + fill] = reference_scratch[i];
+		if (++fill < BLOCK_SAMPLES) {
+			continue;
+		}
+		if (is_synced) {
+			_cancel_block();
+		} else {
+			// Same delay as the cancelled path, so a reference coming and going does not shift the audio.
+			memcpy(output, input, sizeof(output));
+		}
+		memmove(reference, reference + BLOCK_SAMPLES, BLOCK_SAMPLES * sizeof(float));
+		fill = 0;
+	}
+}
+
+void EchoCanceller::_cancel_block() {
+	float re[FFT_SAMPLES];
+	float im[FFT_SAMPLES];
+
+	// The newest reference frame becomes partition 0, the oldest one is dropped.
+	newest_partition = (newest_partition + PARTITIONS - 1) % PARTITIONS;
+	memcpy(re, reference, sizeof(re));
+	memset(im, 0, sizeof(im));
+	NoiseSuppressor::fft(re, im, false);
+	for (int k = 0; k < BINS; k++) {
+		reference_re[newest_partition][k] = re[k];
+		reference_im[newest_partition][k] = im[k];
+		reference_power[k] += (re[k] * re[k] + im[k] * im[k] - reference_power[k]) * power_smoothing;
+	}
+
+	// Echo predicted for this block, by overlap-save: the second half of the circular convolution.
+	float echo_re[BINS] = {};
+	float echo_im[BINS] = {};
+	for (int p = 0; p < PARTITIONS; p++) {
+		const int slot = (newest_partition + p) % PARTITIONS;
+		for (int k = 0; k < BINS; k++) {
+			echo_re[k] += weight_re[p][k] * reference_re[slot][k] - weight_im[p][k] * reference_im[slot][k];
+			echo_im[k] += weight_re[p][k] * reference_im[slot][k] + weight_im[p][k] * reference_re[slot][k];
+		}
+	}
+	for (int k = 0; k < BINS; k++) {
+		re[k] = echo_re[k];
+		im[k] = echo_im[k];
+		// The mirrored bin of a real signal.
+		if (k > 0 && k < FFT_SAMPLES / 2) {
+			re[FFT_SAMPLES - k] = echo_re[k];
+			im[FFT_SAMPLES - k] = -echo_im[k];
+		}
+	}
+	NoiseSuppressor::fft(re, im, true);
+	const float scale = 1.0f / FFT_SAMPLES;
+	float error[BLOCK_SAMPLES];
+	float block_input = 0.0f;
+	float block_echo = 0.0f;
+	float block_error = 0.0f;
+	float block_reference = 0.0f;
+	for (int i = 0; i < BLOCK_SAMPLES; i++) {
+		const float echo = re[BLOCK_SAMPLES + i] * scale;
+		error[i] = input[i] - echo;
+		block_input += input[i] * input[i];
+		block_echo += echo * echo;
+		block_error += error[i] * error[i];
+		block_reference += reference[BLOCK_SAMPLES + i] * reference[BLOCK_SAMPLES + i];
+	}
+	input_energy += (block_input - input_energy) * power_smoothing;
+	echo_energy += (block_echo - echo_energy) * power_smoothing;
+	error_energy += (block_error - error_energy) * power_smoothing;
+
+	if (error_energy > divergence_ratio * input_energy && input_energy > reference_gate * BLOCK_SAMPLES) {
+		// Diverged, e.g. after the speakers or the microphone changed. Start over and let this block through.
+		_reset_filter();
+		memcpy(output, input, sizeof(output));
+		return;
+	}
+
+	if (block_reference > reference_gate * BLOCK_SAMPLES) {
+		// The error spectrum, zero padded in front as overlap-save wants it.
+		memset(re, 0, BLOCK_SAMPLES * sizeof(float));
+		memcpy(re + BLOCK_SAMPLES, error, sizeof(error));
+		memset(im, 0, sizeof(im));
+		NoiseSuppressor::fft(re, im, false);
+		// Full steps while the error is mostly echo, smaller ones while the player speaks over the game.
+		const float share = CLAMP((echo_energy + double_talk_share * input_energy) / MAX(error_energy, 1e-12f), 0.0f, 1.0f);
+		const float step = adaptation_step * share / PARTITIONS;
+		for (int p = 0; p < PARTITIONS; p++) {
+			const int slot = (newest_partition + p) % PARTITIONS;
+			for (int k = 0; k < BINS; k++) {
+				const float gain = step / (reference_power[k] + power_floor);
+				const float xr = reference_re[slot][k];
+				const float xi = reference_im[slot][k];
+				// Conjugate of the reference times the error.
+				weight_re[p][k] += gain * (xr * re[k] + xi * im[k]);
+				weight_im[p][k] += gain * (xr * im[k] - xi * re[k]);
+			}
+		}
+		// The unconstrained update lets the filters of the partitions grow past their block, one of them is cut back per block.
+		float wre[FFT_SAMPLES];
+		float wim[FFT_SAMPLES];
+		for (int k = 0; k < BINS; k++) {
+			wre[k] = weight_re[next_constrained][k];
+			wim[k] = weight_im[next_constrained][k];
+			if (k > 0 && k < FFT_SAMPLES / 2) {
+				wre[FFT_SAMPLES - k] = wre[k];
+				wim[FFT_SAMPLES - k] = -wim[k];
+			}
+		}
+		NoiseSuppressor::fft(wre, wim, true);
+		for (int i = 0; i < FFT_SAMPLES; i++) {
+			wre[i] = i < BLOCK_SAMPLES ? wre[i] * scale : 0.0f;
+			wim[i] = 0.0f;
+		}
+		NoiseSuppressor::fft(wre, wim, false);
+		for (int k = 0; k < BINS; k++) {
+			weight_re[next_constrained][k] = wre[k];
+			weight_im[next_constrained][k] = wim[k];
+		}
+		next_constrained = (next_constrained + 1) % PARTITIONS;
+	}
+
+	// What the filter could not predict, e.g. the distortion of small speakers, is taken out while the echo dominates.
+	const float target = CLAMP(1.0f - echo_energy / MAX(input_energy, 1e-12f), suppression_floor, 1.0f);
+	// Ramped over the block, a step in the gain would click.
+	for (int i = 0; i < BLOCK_SAMPLES; i++) {
+		const float gain = suppress_gain + (target - suppress_gain) * (i + 1) / BLOCK_SAMPLES;
+		output[i] = error[i] * gain;
+	}
+	suppress_gain = target;
+}
@@ -0,0 +1,109 @@
+#ifndef ECHO_CANCELLER_H
+#define ECHO_CANCELLER_H
+
+#include "noise_suppressor.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * The last seconds of what the game played, as 16 kHz mono, for the echo
+ * cancellers of the streams to subtract from the microphone. Written by
+ * AudioEffectWhisperReference on the Master bus from the audio thread, read by
+ * the producer of every stream. Positions count the samples written since the
+ * start, a read of samples not written yet or already overwritten gets silence.
+ */
+class EchoReference {
+public:
+	static const int CAPACITY = 2 * 16000;
+
+private:
+	std::mutex mutex;
+	float ring[CAPACITY];
+	std::atomic<uint64_t> written{ 0 };
+	std::atomic<uint64_t> write_usec{ 0 }; // steady clock of the last write
+
+public:
+	void write(const float *p_samples, size_t p_count);
+	void read(uint64_t p_position, float *p_dst, size_t p_count);
+
+	uint64_t get_write_position() const { return written.load(std::memory_order_acquire); }
+	/** Whether the Master bus fed the reference within p_usec. Godot skips the effects of a bus once it is silent. */
+	bool is_live(uint64_t p_usec) const;
+
+	EchoReference();
+};
+
+/**
+ * Acoustic echo cancellation of the 16 kHz mono input against what the game
+ * played, so music and effects leaking from the speakers into the microphone
+ * do not keep the VAD triggered. A partitioned block frequency domain adaptive
+ * filter over 8 ms blocks models the path from the speakers to the microphone
+ * for up to TAIL_MS, the echo it predicts from the reference is subtracted,
+ * and a gain per block takes out what is left of it while the game is louder
+ * than the player. The filter adapts slower while both speak and starts over
+ * when it diverges or the reference drifts away from the input. Processed
+ * audio is delayed by LATENCY_SAMPLES.
+ */
+class EchoCanceller {
+public:
+	static const int BLOCK_SAMPLES = NoiseSuppressor::HOP_SAMPLES;
+	static const int LATENCY_SAMPLES = BLOCK_SAMPLES;
+	static const int PARTITIONS = 40;
+	static const int TAIL_MS = PARTITIONS * BLOCK_SAMPLES / 16;
+
+private:
+	static const int FFT_SAMPLES = NoiseSuppressor::FRAME_SAMPLES;
+	static const int BINS = FFT_SAMPLES / 2 + 1;
+
+	bool enabled = false;
+	bool is_synced = false;
+	uint64_t reference_position = 0; // of the reference sample matching the next input sample
+
+	float input[BLOCK_SAMPLES];
+	float reference[FFT_SAMPLES]; // the last two blocks of the reference, the second is being filled
+	float output[BLOCK_SAMPLES]; // handed out while the next block fills
+	int fill = 0;
+
+	/* Spectra of the last PARTITIONS reference frames, newest at newest_partition, and the filter applied to each. */
+	float reference_re[PARTITIONS][BINS];
+	float reference_im[PARTITIONS][BINS];
+	float weight_re[PARTITIONS][BINS];
+	float weight_im[PARTITIONS][BINS];
+	int newest_partition = 0;
+	int next_constrained = 0; // the partition whose filter is cut back to BLOCK_SAMPLES next
+	float reference_power[BINS]; // per bin, smoothed over a few blocks
+
+	/* Smoothed block energies of the input, the predicted echo and what is left. */
+	float input_energy = 0.0f;
+	float echo_energy = 0.0f;
+	float error_energy = 0.0f;
+	float suppress_gain = 1.0f;
+
+	std::vector<float> reference_scratch; // the reference of the input of one process(), only grows
+
+	void _reset_filter();
+	void _cancel_block();
+
+public:
+	void set_enabled(bool p_enabled) { enabled = p_enabled; }
+	bool is_enabled() const { return enabled; }
+
+	/** Drop the filter, the alignment to the reference and the delayed audio, e.g. when a new recording starts. */
+	void reset();
+
+	/**
+	 * Cancel the echo of p_reference in p_count samples, in place. The input is
+	 * taken to end about when the reference does, the filter finds the delay
+	 * of the speakers and the microphone within TAIL_MS. Without a live
+	 * reference the audio only goes through the delay.
+	 */
+	void process(float *p_samples, size_t p_count, EchoReference &p_reference);
+
+	EchoCanceller();
+};
+
+#endif // ECHO_CANCELLER_H
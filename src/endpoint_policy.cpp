@@ -0,0 +1,48 @@
+#include "endpoint_policy.h"
+
+#include <godot_cpp/core/math.hpp>
+
+using namespace godot;
+
+/* Pauses between words of conversational speech, until the speaker's own are measured. */
+static const float initial_pause_ms = 200.0f;
+/* Each new pause moves the mean this much, about the last ten pauses count. */
+static const float pause_smoothing = 0.1f;
+/* An utterance ends after this many typical pauses of silence. */
+static const float pauses_per_endpoint = 2.5f;
+/* The longest silence the adaptive policy waits for, what a segment took to close before it. */
+static const int max_adaptive_silence_ms = 1000;
+
+EndpointPolicy::EndpointPolicy() {
+	reset();
+}
+
+void EndpointPolicy::set_min_silence_ms(int p_min_silence_ms) {
+	min_silence_ms = MAX(0, p_min_silence_ms);
+}
+
+void EndpointPolicy::set_trigger_ms(int p_trigger_ms) {
+	trigger_ms = MAX(100, p_trigger_ms);
+}
+
+void EndpointPolicy::reset() {
+	pause_ms = initial_pause_ms;
+}
+
+void EndpointPolicy::set_pause_ms(float p_pause_ms) {
+	pause_ms = CLAMP(p_pause_ms, 0.0f, float(max_adaptive_silence_ms));
+}
+
+void EndpointPolicy::observe_pause(int p_pause_ms) {
+	if (p_pause_ms <= 0 || p_pause_ms >= get_silence_ms()) {
+		return;
+	}
+	pause_ms += (p_pause_ms - pause_ms) * pause_smoothing;
+}
+
+int EndpointPolicy::get_silence_ms() const {
+	if (!adaptive) {
+		return min_silence_ms;
+	}
+	return CLAMP(int(pause_ms * pauses_per_endpoint), min_silence_ms, MAX(min_silence_ms, max_adaptive_silence_ms));
+}
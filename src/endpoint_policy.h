@@ -0,0 +1,44 @@
+#ifndef ENDPOINT_POLICY_H
+#define ENDPOINT_POLICY_H
+
+/**
+ * Decides when an utterance is over, from the silence SpeechSegmenter saw
+ * after the last voiced frame. The silence that ends an utterance is at
+ * least the minimum and, when adaptive, follows the speaking rate: it is a
+ * few times the typical pause inside the speaker's sentences, so a fast
+ * speaker is closed soon after the last word and a slow one is not cut in
+ * the middle of a thought. Also holds the queued audio that starts a pass.
+ */
+class EndpointPolicy {
+	int min_silence_ms = 400;
+	int trigger_ms = 1000;
+	bool adaptive = true;
+
+	float pause_ms = 0.0f; // running mean of the pauses inside utterances
+
+public:
+	/** Silence is never shorter than p_min_silence_ms. */
+	void set_min_silence_ms(int p_min_silence_ms);
+	int get_min_silence_ms() const { return min_silence_ms; }
+	void set_adaptive(bool p_adaptive) { adaptive = p_adaptive; }
+	bool is_adaptive() const { return adaptive; }
+	/** Queued audio that makes the stream ready for a pass. */
+	void set_trigger_ms(int p_trigger_ms);
+	int get_trigger_ms() const { return trigger_ms; }
+
+	/** Forget the speaking rate, e.g. when another speaker starts. */
+	void reset();
+	/** The typical pause measured so far, to resume a stream on another node. */
+	float get_pause_ms() const { return pause_ms; }
+	void set_pause_ms(float p_pause_ms);
+
+	/** Speech went on after a pause of p_pause_ms. Pauses that were long enough to end the utterance are ignored. */
+	void observe_pause(int p_pause_ms);
+
+	/** Silence after the last voiced frame that ends the utterance. */
+	int get_silence_ms() const;
+
+	EndpointPolicy();
+};
+
+#endif // ENDPOINT_POLICY_H
@@ -0,0 +1,42 @@
+#include "frame_budget.h"
+
+#include <godot_cpp/core/math.hpp>
+
+using namespace godot;
+
+/* A frame this much over its target missed it, the jitter of vsync is not a miss. */
+static const float missed_frame_ratio = 1.2f;
+/* Longer frames are stalls of the main thread, e.g. loading a scene, not frames in flight. */
+static const int64_t stall_usec = 250000;
+/* Frames on time for this long give a thread back. */
+static const int64_t recover_usec = 1000000;
+
+void FrameBudget::set_max_threads(int p_max_threads) {
+	max_threads = MAX(0, p_max_threads);
+	thread_cap = max_threads;
+	on_time_usec = 0;
+}
+
+void FrameBudget::set_idle(bool p_idle) {
+	if (idle && !p_idle) {
+		// Frames count against inference again from the start of the budget.
+		on_time_usec = 0;
+	}
+	idle = p_idle;
+}
+
+void FrameBudget::observe_frame(int64_t p_frame_usec, int64_t p_target_usec) {
+	if (max_threads == 0 || idle || p_frame_usec <= 0 || p_frame_usec >= stall_usec) {
+		return;
+	}
+	if (p_frame_usec > p_target_usec * missed_frame_ratio) {
+		thread_cap = MAX(1, thread_cap - 1);
+		on_time_usec = 0;
+		return;
+	}
+	on_time_usec += p_frame_usec;
+	if (on_time_usec >= recover_usec) {
+		thread_cap = MIN(max_threads, thread_cap + 1);
+		on_time_usec = 0;
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef FRAME_BUDGET_H
+#define FRAME_BUDGET_H
+
+#include <cstdint>
+
+/**
+ * Threads inference may take while the game draws frames, from the frame
+ * timing. Starts at the budget; a frame that misses its target takes one
+ * thread away, down to one, and a second of frames on time gives one back.
+ * While idle, e.g. paused or on a loading screen, there is no cap and
+ * inference takes all its threads. Main thread only.
+ */
+class FrameBudget {
+	int max_threads = 0;
+	bool idle = false;
+
+	int thread_cap = 0;
+	int64_t on_time_usec = 0; // frames on time since the cap last changed
+
+public:
+	/** Threads while frames are in flight, 0 for no cap. */
+	void set_max_threads(int p_max_threads);
+	int get_max_threads() const { return max_threads; }
+	/** No cap while p_idle. */
+	void set_idle(bool p_idle);
+	bool is_idle() const { return idle; }
+
+	/** A frame took p_frame_usec, it should have taken p_target_usec. */
+	void observe_frame(int64_t p_frame_usec, int64_t p_target_usec);
+
+	/** Threads inference may take now, 0 for no cap. */
+	int get_thread_cap() const { return idle ? 0 : thread_cap; }
+};
+
+#endif // FRAME_BUDGET_H
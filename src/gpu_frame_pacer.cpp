@@ -0,0 +1,24 @@
+#include "gpu_frame_pacer.h"
+
+#include <chrono>
+
+std::mutex GpuFramePacer::mutex;
+std::condition_variable GpuFramePacer::frame_cond;
+uint64_t GpuFramePacer::frame = 0;
+
+/* Longest wait for a frame, e.g. while the window is minimized and does not draw. */
+static const std::chrono::milliseconds max_frame_wait(100);
+
+void GpuFramePacer::notify_frame() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frame++;
+	}
+	frame_cond.notify_all();
+}
+
+void GpuFramePacer::wait_for_frame(void *p_user_data) {
+	std::unique_lock<std::mutex> lock(mutex);
+	const uint64_t current = frame;
+	frame_cond.wait_for(lock, max_frame_wait, [current]() { return frame != current; });
+}
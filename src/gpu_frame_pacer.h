@@ -0,0 +1,27 @@
+#ifndef GPU_FRAME_PACER_H
+#define GPU_FRAME_PACER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Frame boundaries for the GPU submissions of inference. The main thread
+ * tells it when a frame was drawn, and whisper waits for the next one
+ * between two submissions of a split graph, so the render queue gets the
+ * GPU at the start of each frame and inference fills the time after it.
+ * Safe to call from any thread.
+ */
+class GpuFramePacer {
+	static std::mutex mutex;
+	static std::condition_variable frame_cond;
+	static uint64_t frame;
+
+public:
+	/** A frame was drawn, wakes the submissions waiting for it. */
+	static void notify_frame();
+	/** whisper_gpu_yield_callback, returns after the next frame or, when no frames are drawn, a timeout. */
+	static void wait_for_frame(void *p_user_data);
+};
+
+#endif // GPU_FRAME_PACER_H
@@ -0,0 +1,47 @@
+#ifndef HOST_BACKEND_TENSORS_H
+#define HOST_BACKEND_TENSORS_H
+
+#include <whisper.cpp/ggml.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/* Shared by the ggml backends of the host, RenderingDeviceCompute and WebGPUCompute, which keep the tensors in host memory. */
+
+/* Bytes from the first element of p_tensor to the end of its last one. */
+inline size_t host_backend_tensor_span(const ggml_tensor *p_tensor) {
+	size_t span = ggml_type_size(p_tensor->type);
+	for (int i = 0; i < GGML_MAX_DIMS; i++) {
+		span += size_t(p_tensor->ne[i] - 1) * p_tensor->nb[i];
+	}
+	return span;
+}
+
+inline bool host_backend_is_view_op(const ggml_tensor *p_node) {
+	switch (p_node->op) {
+		case GGML_OP_NONE:
+		case GGML_OP_VIEW:
+		case GGML_OP_RESHAPE:
+		case GGML_OP_PERMUTE:
+		case GGML_OP_TRANSPOSE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Rows of p_tensor are contiguous and its strides are whole elements that fit the kernels' 32 bit indices. */
+inline bool host_backend_has_element_strides(const ggml_tensor *p_tensor) {
+	const size_t type_size = ggml_type_size(p_tensor->type);
+	if (ggml_blck_size(p_tensor->type) != 1 || p_tensor->nb[0] != type_size || host_backend_tensor_span(p_tensor) / type_size >= UINT32_MAX / 2) {
+		return false;
+	}
+	for (int i = 1; i < GGML_MAX_DIMS; i++) {
+		if (p_tensor->nb[i] % type_size != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif // HOST_BACKEND_TENSORS_H
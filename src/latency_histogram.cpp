@@ -0,0 +1,85 @@
+#include "latency_histogram.h"
+
+#include <godot_cpp/core/math.hpp>
+#include <godot_cpp/variant/packed_float64_array.hpp>
+#include <godot_cpp/variant/packed_int64_array.hpp>
+#include <godot_cpp/variant/variant.hpp>
+
+#include <limits>
+
+static const double bucket_edges_ms[LatencyHistogram::BUCKETS - 1] = {
+	10, 15, 20, 30, 50, 75, 100, 150, 200, 300, 500, 750, 1000, 1500, 2000, 3000, 5000, 7500, 10000
+};
+
+double LatencyHistogram::get_bucket_edge_ms(int p_bucket) {
+	return p_bucket < BUCKETS - 1 ? bucket_edges_ms[p_bucket] : std::numeric_limits<double>::infinity();
+}
+
+void LatencyHistogram::add(uint64_t p_usec) {
+	const double ms = p_usec / 1000.0;
+	int bucket = 0;
+	while (bucket < BUCKETS - 1 && ms > bucket_edges_ms[bucket]) {
+		bucket++;
+	}
+	counts[bucket].fetch_add(1, std::memory_order_relaxed);
+	total_usec.fetch_add(p_usec, std::memory_order_relaxed);
+	uint64_t max = max_usec.load(std::memory_order_relaxed);
+	while (p_usec > max && !max_usec.compare_exchange_weak(max, p_usec, std::memory_order_relaxed)) {
+	}
+}
+
+void LatencyHistogram::reset() {
+	for (std::atomic<uint64_t> &count : counts) {
+		count.store(0, std::memory_order_relaxed);
+	}
+	total_usec.store(0, std::memory_order_relaxed);
+	max_usec.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::get_percentile_ms(double p_fraction) const {
+	uint64_t snapshot[BUCKETS];
+	uint64_t count = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		snapshot[i] = counts[i].load(std::memory_order_relaxed);
+		count += snapshot[i];
+	}
+	if (count == 0) {
+		return 0.0;
+	}
+	const double max_ms = max_usec.load(std::memory_order_relaxed) / 1000.0;
+	const double rank = CLAMP(p_fraction, 0.0, 1.0) * count;
+	uint64_t below = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		if (snapshot[i] > 0 && below + snapshot[i] >= rank) {
+			const double low = i > 0 ? bucket_edges_ms[i - 1] : 0.0;
+			// The last bucket has no upper edge, the largest latency seen closes it.
+			const double high = MIN(i < BUCKETS - 1 ? bucket_edges_ms[i] : max_ms, max_ms);
+			return low + (high - low) * (rank - below) / snapshot[i];
+		}
+		below += snapshot[i];
+	}
+	return max_ms;
+}
+
+Dictionary LatencyHistogram::to_dictionary() const {
+	PackedFloat64Array edges;
+	PackedInt64Array bucket_counts;
+	uint64_t count = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		const uint64_t bucket_count = counts[i].load(std::memory_order_relaxed);
+		edges.push_back(get_bucket_edge_ms(i));
+		bucket_counts.push_back(int64_t(bucket_count));
+		count += bucket_count;
+	}
+	Dictionary ret;
+	ret["bucket_ms"] = edges;
+	ret["counts"] = bucket_counts;
+	ret["count"] = int64_t(count);
+	ret["mean_ms"] = count > 0 ? total_usec.load(std::memory_order_relaxed) / 1000.0 / count : 0.0;
+	ret["max_ms"] = max_usec.load(std::memory_order_relaxed) / 1000.0;
+	ret["p50_ms"] = get_percentile_ms(0.5);
+	ret["p90_ms"] = get_percentile_ms(0.9);
+	ret["p95_ms"] = get_percentile_ms(0.95);
+	ret["p99_ms"] = get_percentile_ms(0.99);
+	return ret;
+}
@@ -0,0 +1,39 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <godot_cpp/variant/dictionary.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+using namespace godot;
+
+/**
+ * Counts of latencies in fixed buckets, from 10 ms to 10 s roughly half an
+ * octave apart, for the time from the capture of a sample to the delivery of
+ * the result it was decoded into. Any thread may add or read, the counts are
+ * not taken as one snapshot.
+ */
+class LatencyHistogram {
+public:
+	static const int BUCKETS = 20; // the last one holds everything above the last edge
+
+private:
+	std::atomic<uint64_t> counts[BUCKETS] = {};
+	std::atomic<uint64_t> total_usec{ 0 };
+	std::atomic<uint64_t> max_usec{ 0 };
+
+public:
+	/** Upper edge of bucket p_bucket in milliseconds, infinity for the last one. */
+	static double get_bucket_edge_ms(int p_bucket);
+
+	void add(uint64_t p_usec);
+	void reset();
+
+	/** Percentile p_fraction (0 to 1) in milliseconds, interpolated within its bucket. 0 while empty. */
+	double get_percentile_ms(double p_fraction) const;
+	/** bucket_ms (upper edges), counts, count, mean_ms, max_ms, p50_ms, p90_ms, p95_ms and p99_ms. */
+	Dictionary to_dictionary() const;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,60 @@
+#include "lock_metrics.h"
+
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/variant.hpp>
+
+using namespace godot;
+
+std::atomic<LockSite *> LockSite::sites{ nullptr };
+
+static void _update_max(std::atomic<uint64_t> &r_max, uint64_t p_value) {
+	uint64_t current = r_max.load(std::memory_order_relaxed);
+	while (p_value > current && !r_max.compare_exchange_weak(current, p_value, std::memory_order_relaxed)) {
+	}
+}
+
+LockSite::LockSite(const char *p_mutex_name, const char *p_name, const char *p_wait_zone) :
+		mutex_name(p_mutex_name), name(p_name), wait_zone(p_wait_zone) {
+	next = sites.load(std::memory_order_relaxed);
+	while (!sites.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed)) {
+	}
+}
+
+void LockSite::record(uint64_t p_wait_ns, uint64_t p_hold_ns, bool p_contended) {
+	acquisitions.fetch_add(1, std::memory_order_relaxed);
+	if (p_contended) {
+		contended.fetch_add(1, std::memory_order_relaxed);
+	}
+	wait_ns.fetch_add(p_wait_ns, std::memory_order_relaxed);
+	hold_ns.fetch_add(p_hold_ns, std::memory_order_relaxed);
+	_update_max(max_wait_ns, p_wait_ns);
+	_update_max(max_hold_ns, p_hold_ns);
+}
+
+Array LockSite::get_all() {
+	Array ret;
+	for (LockSite *site = sites.load(std::memory_order_acquire); site != nullptr; site = site->next) {
+		Dictionary entry;
+		entry["mutex"] = site->mutex_name;
+		entry["site"] = site->name;
+		entry["acquisitions"] = site->acquisitions.load(std::memory_order_relaxed);
+		entry["contended"] = site->contended.load(std::memory_order_relaxed);
+		entry["wait_ms"] = site->wait_ns.load(std::memory_order_relaxed) / 1000000.0;
+		entry["max_wait_ms"] = site->max_wait_ns.load(std::memory_order_relaxed) / 1000000.0;
+		entry["hold_ms"] = site->hold_ns.load(std::memory_order_relaxed) / 1000000.0;
+		entry["max_hold_ms"] = site->max_hold_ns.load(std::memory_order_relaxed) / 1000000.0;
+		ret.push_back(entry);
+	}
+	return ret;
+}
+
+void LockSite::reset_all() {
+	for (LockSite *site = sites.load(std::memory_order_acquire); site != nullptr; site = site->next) {
+		site->acquisitions.store(0, std::memory_order_relaxed);
+		site->contended.store(0, std::memory_order_relaxed);
+		site->wait_ns.store(0, std::memory_order_relaxed);
+		site->max_wait_ns.store(0, std::memory_order_relaxed);
+		site->hold_ns.store(0, std::memory_order_relaxed);
+		site->max_hold_ns.store(0, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef LOCK_METRICS_H
+#define LOCK_METRICS_H
+
+#include "trace.h"
+
+#include <godot_cpp/variant/array.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * Contention counters of a mutex the main thread shares with the workers,
+ * one set per call site that locks it: how often the site locked, how often
+ * the mutex was taken by another thread at that moment, and how long the
+ * site waited for it and then held it, in total and at most. Each site
+ * registers itself the first time it runs, SpeechToText.get_lock_metrics()
+ * reports all of them.
+ */
+class LockSite {
+	std::atomic<uint64_t> acquisitions{ 0 };
+	std::atomic<uint64_t> contended{ 0 };
+	std::atomic<uint64_t> wait_ns{ 0 };
+	std::atomic<uint64_t> max_wait_ns{ 0 };
+	std::atomic<uint64_t> hold_ns{ 0 };
+	std::atomic<uint64_t> max_hold_ns{ 0 };
+	LockSite *next = nullptr;
+
+	static std::atomic<LockSite *> sites;
+
+public:
+	const char *const mutex_name;
+	const char *const name;
+	const char *const wait_zone; // trace zone of the wait, the sites of one mutex share it
+
+	_FORCE_INLINE_ static uint64_t now_ns() {
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	void record(uint64_t p_wait_ns, uint64_t p_hold_ns, bool p_contended);
+
+	/** One Dictionary per site that locked so far. */
+	static godot::Array get_all();
+	static void reset_all();
+
+	LockSite(const char *p_mutex_name, const char *p_name, const char *p_wait_zone);
+};
+
+/* Locks p_mutex for the enclosing scope and records the wait and hold time at p_site. */
+template <typename M>
+class MeteredLock {
+	M &mutex;
+	LockSite &site;
+	uint64_t locked_ns = 0;
+	uint64_t wait_ns = 0;
+	bool contended = false;
+
+public:
+	_FORCE_INLINE_ MeteredLock(M &p_mutex, LockSite &p_site) :
+			mutex(p_mutex), site(p_site) {
+		const uint64_t start_ns = LockSite::now_ns();
+		if (!mutex.try_lock()) {
+			contended = true;
+#ifdef GODOT_WHISPER_TRACE
+			TraceZone zone(site.wait_zone);
+#endif
+			mutex.lock();
+		}
+		locked_ns = LockSite::now_ns();
+		wait_ns = locked_ns - start_ns;
+	}
+	_FORCE_INLINE_ ~MeteredLock() {
+		const uint64_t hold_ns = LockSite::now_ns() - locked_ns;
+		mutex.unlock();
+		site.record(wait_ns, hold_ns, contended);
+	}
+};
+
+#define LOCK_CONCAT_INNER(m_a, m_b) m_a##m_b
+#define LOCK_CONCAT(m_a, m_b) LOCK_CONCAT_INNER(m_a, m_b)
+/* Lock m_mutex until the end of the enclosing scope, counted at the call site m_site, a string literal. */
+#define METERED_LOCK(m_mutex, m_site) \
+	static LockSite LOCK_CONCAT(lock_site_, __LINE__)(#m_mutex, m_site, #m_mutex " wait"); \
+	MeteredLock<std::remove_reference_t<decltype(m_mutex)>> LOCK_CONCAT(metered_lock_, __LINE__)(m_mutex, LOCK_CONCAT(lock_site_, __LINE__))
+
+#endif // LOCK_METRICS_H
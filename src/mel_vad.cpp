@@ -0,0 +1,104 @@
+#include "mel_vad.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cmath>
+
+using namespace godot;
+
+/* The tail of the window starts speech when its bands rise this much faster than over the whole window, and by at least flux_onset_min log10 per band and frame. */
+static const float flux_onset_ratio = 2.0f;
+static const float flux_onset_min = 0.05f;
+
+MelVad::MelVad() {
+	setup(1000);
+}
+
+void MelVad::setup(int p_window_ms) {
+	frame_energy.assign(MAX(1, p_window_ms / FRAME_MS), 0.0f);
+	frame_flux.assign(frame_energy.size(), 0.0f);
+	reset();
+}
+
+void MelVad::reset() {
+	frame_count = 0;
+	next_offset = -1;
+	previous_frame.clear();
+}
+
+void MelVad::push(whisper_context *p_context, whisper_state *p_state) {
+	int n_frames = 0;
+	int n_mel = 0;
+	int64_t offset = 0;
+	const float *frames = whisper_get_mel_cache_with_state(p_state, &n_frames, &n_mel, &offset);
+	if (frames == nullptr) {
+		return;
+	}
+	if (p_context != context || int(filter_peaks.size()) != n_mel) {
+		filter_centers.resize(n_mel);
+		filter_peaks.resize(n_mel);
+		whisper_get_mel_filters(p_context, filter_centers.data(), filter_peaks.data(), n_mel);
+		context = p_context;
+		// Bands of another model do not line up with the last frame.
+		previous_frame.clear();
+	}
+	int first = 0;
+	if (next_offset >= 0) {
+		// Each pass converts the whole buffer, only the frames after the last one seen are new.
+		first = int(MAX(int64_t(0), (next_offset - offset + WHISPER_HOP_LENGTH - 1) / WHISPER_HOP_LENGTH));
+	}
+	// Parseval over the Hann windowed frame: the bands sum the power of the one-sided spectrum, the mean of the squared window is 3/8.
+	const double power_to_mean_square = 2.0 / (double(WHISPER_N_FFT) * WHISPER_N_FFT * 0.375);
+	for (int i = first; i < n_frames; i++) {
+		const float *frame = frames + size_t(i) * n_mel;
+		double power = 0.0;
+		float flux = 0.0f;
+		int bands = 0;
+		for (int j = 0; j < n_mel; j++) {
+			if (filter_centers[j] < cutoff || filter_peaks[j] <= 0.0f) {
+				continue;
+			}
+			// The triangles scaled to a peak of 1 sum to 1 over the bins they cover, so this is the power of the bins of the band.
+			power += std::pow(10.0, double(frame[j])) / filter_peaks[j];
+			if (!previous_frame.empty()) {
+				flux += MAX(0.0f, frame[j] - previous_frame[j]);
+			}
+			bands++;
+		}
+		// Mean absolute amplitude of noise like audio is sqrt(2 / pi) of its RMS.
+		const float energy = float(std::sqrt(power * power_to_mean_square) * 0.7979);
+		const size_t slot = frame_count % frame_energy.size();
+		frame_energy[slot] = energy;
+		frame_flux[slot] = bands > 0 ? flux / bands : 0.0f;
+		frame_count++;
+		previous_frame.assign(frame, frame + n_mel);
+	}
+	next_offset = MAX(next_offset, offset + int64_t(n_frames) * WHISPER_HOP_LENGTH);
+}
+
+float MelVad::_mean(const std::vector<float> &p_ring, int p_ms) const {
+	const int frames = MIN(uint64_t(p_ms / FRAME_MS), MIN(frame_count, uint64_t(p_ring.size())));
+	if (frames <= 0) {
+		return 0.0f;
+	}
+	float sum = 0.0f;
+	for (int i = 1; i <= frames; i++) {
+		sum += p_ring[(frame_count - i) % p_ring.size()];
+	}
+	return sum / frames;
+}
+
+bool MelVad::is_speech_ending(int p_window_ms, int p_last_ms, float p_vad_thold) const {
+	const float energy_all = get_energy(p_window_ms);
+	const float energy_last = p_last_ms > 0 ? get_energy(p_last_ms) : 0.0f;
+	if ((energy_all < 0.0001f && energy_last < 0.0001f) == false || energy_last > p_vad_thold * energy_all) {
+		return false;
+	}
+	if (p_last_ms > 0) {
+		const float flux_last = get_flux(p_last_ms);
+		if (flux_last > flux_onset_min && flux_last > flux_onset_ratio * get_flux(p_window_ms)) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef MEL_VAD_H
+#define MEL_VAD_H
+
+#include <whisper.cpp/whisper.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Same decisions as VoiceActivityDetector, made from the mel frames whisper
+ * already computed for the pass instead of a second walk over the samples.
+ * The mel frames are 10 ms apart like the frames of the detector. Their band
+ * energies above the high-pass cutoff are turned back into the mean absolute
+ * amplitude the detector measures, so vad_thold and the silence level mean
+ * the same with either. Spectral flux, how much the bands rose since the
+ * previous frame, keeps a speech onset in the last frames from reading as
+ * the end of speech.
+ */
+class MelVad {
+public:
+	static const int FRAME_MS = 10;
+
+private:
+	std::vector<float> frame_energy; // ring of mean absolute amplitudes
+	std::vector<float> frame_flux; // ring of the mean rise of the log10 bands
+	uint64_t frame_count = 0; // frames completed so far, the slot is frame_count % size
+	int64_t next_offset = -1; // mel cache position of the next new frame, -1 takes the first one seen
+
+	float cutoff = 0.0f;
+	/* Of the filters of the context the frames come from. */
+	whisper_context *context = nullptr;
+	std::vector<float> filter_centers;
+	std::vector<float> filter_peaks;
+	std::vector<float> previous_frame; // log10 bands of the last frame, for the flux
+
+	float _mean(const std::vector<float> &p_ring, int p_ms) const;
+
+public:
+	/** Keeps p_window_ms of frames. Drops the history. */
+	void setup(int p_window_ms);
+	/** Bands centered below p_cutoff Hz are left out, like the high-pass of the detector. 0 keeps all of them. */
+	void set_high_pass(float p_cutoff) { cutoff = p_cutoff; }
+
+	/** Drop the frame history, e.g. when the buffer is dropped. */
+	void reset();
+
+	/** Take in the frames of the last whisper_pcm_to_mel_cached_with_state() call on p_state that were not seen yet. */
+	void push(whisper_context *p_context, whisper_state *p_state);
+
+	/** Mean absolute amplitude of the last p_ms of frames, 0 with none. */
+	float get_energy(int p_ms) const { return _mean(frame_energy, p_ms); }
+	/** Mean spectral flux of the last p_ms of frames, in log10 per band. */
+	float get_flux(int p_ms) const { return _mean(frame_flux, p_ms); }
+
+	/** VoiceActivityDetector::is_speech_ending() on the mel frames, and the last p_last_ms do not start speech. */
+	bool is_speech_ending(int p_window_ms, int p_last_ms, float p_vad_thold) const;
+
+	MelVad();
+};
+
+#endif // MEL_VAD_H
@@ -0,0 +1,106 @@
+#include "metrics_history.h"
+
+#include <godot_cpp/classes/json.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/packed_string_array.hpp>
+
+Dictionary MetricsHistory::_to_dictionary(const Record &p_record) {
+	Dictionary ret;
+	ret["usec"] = p_record.usec;
+	ret["stream_id"] = p_record.stream_id;
+	ret["audio_seconds"] = p_record.audio_seconds;
+	ret["audio_ctx"] = p_record.audio_ctx;
+	ret["tokens"] = p_record.tokens;
+	ret["fallbacks"] = p_record.fallbacks;
+	ret["waiting_streams"] = p_record.waiting_streams;
+	ret["thermal_state"] = p_record.thermal_state;
+	ret["quality_level"] = p_record.quality_level;
+	ret["pass_ms"] = p_record.pass_ms;
+	ret["resample_ms"] = p_record.resample_ms;
+	ret["vad_ms"] = p_record.vad_ms;
+	ret["queue_wait_ms"] = p_record.queue_wait_ms;
+	ret["mel_ms"] = p_record.mel_ms;
+	ret["encode_ms"] = p_record.encode_ms;
+	ret["decode_ms"] = p_record.decode_ms;
+	ret["sample_ms"] = p_record.sample_ms;
+	return ret;
+}
+
+void MetricsHistory::set_capacity(int p_capacity) {
+	std::lock_guard<std::mutex> lock(mutex);
+	capacity = size_t(MAX(0, p_capacity));
+	records.clear();
+	records.shrink_to_fit();
+	next = 0;
+}
+
+void MetricsHistory::add(const Record &p_record) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (capacity > 0) {
+		if (records.size() < capacity) {
+			records.push_back(p_record);
+		} else {
+			records[next] = p_record;
+			next = (next + 1) % capacity;
+		}
+	}
+	if (log.is_valid()) {
+		log->store_line(JSON::stringify(_to_dictionary(p_record)));
+	}
+}
+
+void MetricsHistory::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	records.clear();
+	next = 0;
+}
+
+Array MetricsHistory::to_array() {
+	std::lock_guard<std::mutex> lock(mutex);
+	Array ret;
+	for (size_t i = 0; i < records.size(); i++) {
+		ret.push_back(_to_dictionary(records[(next + i) % records.size()]));
+	}
+	return ret;
+}
+
+Error MetricsHistory::export_file(const String &p_path) {
+	const Array history = to_array();
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::WRITE);
+	ERR_FAIL_COND_V_MSG(file.is_null(), FileAccess::get_open_error(), vformat("Cannot write the metrics \"%s\".", p_path));
+	if (p_path.get_extension().to_lower() != "csv") {
+		file->store_string(JSON::stringify(history, "\t"));
+		return OK;
+	}
+	const Array columns = _to_dictionary(Record()).keys();
+	file->store_line(String(",").join(PackedStringArray(columns)));
+	for (int i = 0; i < history.size(); i++) {
+		const Dictionary record = history[i];
+		PackedStringArray row;
+		for (int j = 0; j < columns.size(); j++) {
+			row.push_back(String(record[columns[j]]));
+		}
+		file->store_line(String(",").join(row));
+	}
+	return OK;
+}
+
+Error MetricsHistory::start_log(const String &p_path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	log = FileAccess::open(p_path, FileAccess::WRITE);
+	ERR_FAIL_COND_V_MSG(log.is_null(), FileAccess::get_open_error(), vformat("Cannot write the metrics log \"%s\".", p_path));
+	return OK;
+}
+
+void MetricsHistory::stop_log() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (log.is_valid()) {
+		log->close();
+		log.unref();
+	}
+}
+
+bool MetricsHistory::is_logging() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return log.is_valid();
+}
@@ -0,0 +1,75 @@
+#ifndef METRICS_HISTORY_H
+#define METRICS_HISTORY_H
+
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/variant/array.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * The last passes of every stream, one record each, so a QA session can be
+ * looked at after the fact instead of only through the Performance monitors
+ * while it runs. The records are kept in a ring of a fixed size, the oldest
+ * is replaced by the next pass. A log file gets every record as a line of
+ * JSON as it is added, however many the ring holds.
+ */
+class MetricsHistory {
+public:
+	struct Record {
+		uint64_t usec = 0; // Time ticks when the pass finished
+		uint64_t stream_id = 0;
+		double audio_seconds = 0.0; // new audio the pass decoded
+		int audio_ctx = 0;
+		int tokens = 0; // sampled by all decoders
+		int fallbacks = 0;
+		int waiting_streams = 0; // ready streams without a worker when the pass finished
+		int thermal_state = 0; // ThermalMonitor::ThermalState
+		int quality_level = 0; // SpeechToTextStream::QualityLevel of the pass
+		double pass_ms = 0.0;
+		double resample_ms = 0.0;
+		double vad_ms = 0.0;
+		double queue_wait_ms = 0.0;
+		double mel_ms = 0.0;
+		double encode_ms = 0.0;
+		double decode_ms = 0.0;
+		double sample_ms = 0.0;
+	};
+
+private:
+	std::mutex mutex;
+	std::vector<Record> records;
+	size_t capacity = 512;
+	size_t next = 0; // where the next record goes once the ring is full
+	Ref<FileAccess> log;
+
+	static Dictionary _to_dictionary(const Record &p_record);
+
+public:
+	/** Keep the last p_capacity records, 0 keeps none. Drops the records kept so far. */
+	void set_capacity(int p_capacity);
+	int get_capacity() const { return int(capacity); }
+
+	/** Called by the pass once its stage times are in. */
+	void add(const Record &p_record);
+	void clear();
+
+	/** The records kept, oldest first, one Dictionary each. */
+	Array to_array();
+	/** The records kept as CSV when p_path ends in .csv, otherwise as a JSON array. */
+	Error export_file(const String &p_path);
+
+	/** Append every record from now on to p_path as a line of JSON, replacing what it holds. */
+	Error start_log(const String &p_path);
+	void stop_log();
+	bool is_logging();
+
+	~MetricsHistory() { stop_log(); }
+};
+
+#endif // METRICS_HISTORY_H
@@ -0,0 +1,451 @@
+#include "microphone_capture.h"
+#include "speech_to_text.h"
+
+#include <atomic>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <audioclient.h>
+#include <mmdeviceapi.h>
+#include <mmreg.h>
+
+#include <future>
+#include <thread>
+#elif defined(__ANDROID__)
+#include <aaudio/AAudio.h>
+#include <dlfcn.h>
+#elif defined(__APPLE__)
+#include <AudioToolbox/AudioToolbox.h>
+#endif
+
+/* Audio handed to the stream per callback, short enough for the VAD to see speech end in time. */
+static const int capture_period_ms = 20;
+
+#if defined(_WIN32)
+
+/**
+ * Event driven WASAPI capture in shared mode. The audio engine converts the
+ * mix format of the device to mono float at the requested rate. The client
+ * lives on the capture thread, which owns its COM apartment.
+ */
+class MicrophoneBackend {
+	MicrophoneCapture *owner = nullptr;
+	int rate = 0;
+	std::thread thread;
+	std::atomic<bool> running{ false };
+	std::vector<float> silence; // stands in for the buffers the engine flags as silent, only grows
+
+	void _run(std::promise<Error> *p_opened);
+
+public:
+	Error open(MicrophoneCapture *p_owner, int p_rate, int &r_rate);
+	void close();
+	~MicrophoneBackend() { close(); }
+};
+
+Error MicrophoneBackend::open(MicrophoneCapture *p_owner, int p_rate, int &r_rate) {
+	owner = p_owner;
+	rate = p_rate;
+	running.store(true);
+	std::promise<Error> opened;
+	std::future<Error> result = opened.get_future();
+	thread = std::thread(&MicrophoneBackend::_run, this, &opened);
+	const Error err = result.get();
+	if (err != OK) {
+		close();
+	}
+	r_rate = rate;
+	return err;
+}
+
+void MicrophoneBackend::_run(std::promise<Error> *p_opened) {
+	const HRESULT com = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	IMMDeviceEnumerator *enumerator = nullptr;
+	IMMDevice *device = nullptr;
+	IAudioClient *client = nullptr;
+	IAudioCaptureClient *capture = nullptr;
+	HANDLE event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+	HRESULT hr = event != nullptr ? S_OK : E_FAIL;
+	if (SUCCEEDED(hr)) {
+		hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator), reinterpret_cast<void **>(&enumerator));
+	}
+	if (SUCCEEDED(hr)) {
+		hr = enumerator->GetDefaultAudioEndpoint(eCapture, eConsole, &device);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, reinterpret_cast<void **>(&client));
+	}
+	if (SUCCEEDED(hr)) {
+		WAVEFORMATEX format = {};
+		format.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+		format.nChannels = 1;
+		format.nSamplesPerSec = DWORD(rate);
+		format.wBitsPerSample = 32;
+		format.nBlockAlign = sizeof(float);
+		format.nAvgBytesPerSec = DWORD(rate) * sizeof(float);
+		// In 100 ns units, the engine buffer holds a few periods.
+		const REFERENCE_TIME buffer_duration = REFERENCE_TIME(capture_period_ms) * 4 * 10000;
+		hr = client->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY, buffer_duration, 0, &format, nullptr);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = client->SetEventHandle(event);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = client->GetService(__uuidof(IAudioCaptureClient), reinterpret_cast<void **>(&capture));
+	}
+	if (SUCCEEDED(hr)) {
+		hr = client->Start();
+	}
+	if (device != nullptr) {
+		device->Release();
+	}
+	if (enumerator != nullptr) {
+		enumerator->Release();
+	}
+	// The privacy settings refuse the microphone with E_ACCESSDENIED.
+	p_opened->set_value(SUCCEEDED(hr) ? OK : (hr == E_ACCESSDENIED ? ERR_UNAUTHORIZED : ERR_CANT_OPEN));
+
+	while (SUCCEEDED(hr) && running.load()) {
+		if (WaitForSingleObject(event, capture_period_ms * 10) != WAIT_OBJECT_0) {
+			continue;
+		}
+		UINT32 packet_frames = 0;
+		while (SUCCEEDED(capture->GetNextPacketSize(&packet_frames)) && packet_frames > 0) {
+			BYTE *data = nullptr;
+			UINT32 frames = 0;
+			DWORD flags = 0;
+			if (FAILED(capture->GetBuffer(&data, &frames, &flags, nullptr, nullptr))) {
+				break;
+			}
+			if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+				if (silence.size() < frames) {
+					silence.resize(frames, 0.0f);
+				}
+				owner->_capture(silence.data(), frames, rate);
+			} else {
+				owner->_capture(reinterpret_cast<const float *>(data), frames, rate);
+			}
+			capture->ReleaseBuffer(frames);
+		}
+	}
+
+	if (client != nullptr) {
+		client->Stop();
+	}
+	if (capture != nullptr) {
+		capture->Release();
+	}
+	if (client != nullptr) {
+		client->Release();
+	}
+	if (event != nullptr) {
+		CloseHandle(event);
+	}
+	if (SUCCEEDED(com)) {
+		CoUninitialize();
+	}
+}
+
+void MicrophoneBackend::close() {
+	running.store(false);
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+#elif defined(__ANDROID__)
+
+/* AAudio is only there from Android 8 on, it is looked up at runtime so the library still loads on older versions. */
+struct AAudioApi {
+	aaudio_result_t (*create_stream_builder)(AAudioStreamBuilder **) = nullptr;
+	void (*set_direction)(AAudioStreamBuilder *, aaudio_direction_t) = nullptr;
+	void (*set_sample_rate)(AAudioStreamBuilder *, int32_t) = nullptr;
+	void (*set_channel_count)(AAudioStreamBuilder *, int32_t) = nullptr;
+	void (*set_format)(AAudioStreamBuilder *, aaudio_format_t) = nullptr;
+	void (*set_input_preset)(AAudioStreamBuilder *, int32_t) = nullptr; // Android 9, optional
+	void (*set_data_callback)(AAudioStreamBuilder *, AAudioStream_dataCallback, void *) = nullptr;
+	aaudio_result_t (*open_stream)(AAudioStreamBuilder *, AAudioStream **) = nullptr;
+	aaudio_result_t (*delete_builder)(AAudioStreamBuilder *) = nullptr;
+	aaudio_result_t (*request_start)(AAudioStream *) = nullptr;
+	aaudio_result_t (*request_stop)(AAudioStream *) = nullptr;
+	aaudio_result_t (*close)(AAudioStream *) = nullptr;
+	int32_t (*get_sample_rate)(AAudioStream *) = nullptr;
+	bool loaded = false;
+};
+
+template <typename T>
+static bool _load_symbol(void *p_library, const char *p_name, T &r_function) {
+	r_function = reinterpret_cast<T>(dlsym(p_library, p_name));
+	return r_function != nullptr;
+}
+
+static const AAudioApi &_get_aaudio() {
+	static const AAudioApi api = []() {
+		AAudioApi loaded_api;
+		void *library = dlopen("libaaudio.so", RTLD_NOW);
+		if (library == nullptr) {
+			return loaded_api;
+		}
+		loaded_api.loaded = _load_symbol(library, "AAudio_createStreamBuilder", loaded_api.create_stream_builder) &&
+				_load_symbol(library, "AAudioStreamBuilder_setDirection", loaded_api.set_direction) &&
+				_load_symbol(library, "AAudioStreamBuilder_setSampleRate", loaded_api.set_sample_rate) &&
+				_load_symbol(library, "AAudioStreamBuilder_setChannelCount", loaded_api.set_channel_count) &&
+				_load_symbol(library, "AAudioStreamBuilder_setFormat", loaded_api.set_format) &&
+				_load_symbol(library, "AAudioStreamBuilder_setDataCallback", loaded_api.set_data_callback) &&
+				_load_symbol(library, "AAudioStreamBuilder_openStream", loaded_api.open_stream) &&
+				_load_symbol(library, "AAudioStreamBuilder_delete", loaded_api.delete_builder) &&
+				_load_symbol(library, "AAudioStream_requestStart", loaded_api.request_start) &&
+				_load_symbol(library, "AAudioStream_requestStop", loaded_api.request_stop) &&
+				_load_symbol(library, "AAudioStream_close", loaded_api.close) &&
+				_load_symbol(library, "AAudioStream_getSampleRate", loaded_api.get_sample_rate);
+		_load_symbol(library, "AAudioStreamBuilder_setInputPreset", loaded_api.set_input_preset);
+		return loaded_api;
+	}();
+	return api;
+}
+
+/**
+ * AAudio input stream with a data callback. AAudio converts to the
+ * requested rate where it can, otherwise the stream opens at the rate of the
+ * device and the ingest path resamples. Needs the RECORD_AUDIO permission.
+ */
+class MicrophoneBackend {
+	MicrophoneCapture *owner = nullptr;
+	AAudioStream *stream = nullptr;
+	int rate = 0;
+
+	static aaudio_data_callback_result_t _data(AAudioStream *p_stream, void *p_user, void *p_audio, int32_t p_frames);
+
+public:
+	Error open(MicrophoneCapture *p_owner, int p_rate, int &r_rate);
+	void close();
+	~MicrophoneBackend() { close(); }
+};
+
+aaudio_data_callback_result_t MicrophoneBackend::_data(AAudioStream *p_stream, void *p_user, void *p_audio, int32_t p_frames) {
+	MicrophoneBackend *backend = static_cast<MicrophoneBackend *>(p_user);
+	if (p_frames > 0) {
+		backend->owner->_capture(static_cast<const float *>(p_audio), uint32_t(p_frames), backend->rate);
+	}
+	return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+Error MicrophoneBackend::open(MicrophoneCapture *p_owner, int p_rate, int &r_rate) {
+	const AAudioApi &api = _get_aaudio();
+	if (!api.loaded) {
+		return ERR_UNAVAILABLE;
+	}
+	owner = p_owner;
+	AAudioStreamBuilder *builder = nullptr;
+	if (api.create_stream_builder(&builder) != AAUDIO_OK) {
+		return ERR_CANT_OPEN;
+	}
+	api.set_direction(builder, AAUDIO_DIRECTION_INPUT);
+	api.set_sample_rate(builder, p_rate);
+	api.set_channel_count(builder, 1);
+	api.set_format(builder, AAUDIO_FORMAT_PCM_FLOAT);
+	if (api.set_input_preset != nullptr) {
+		// Tuned for recognizers: no noise suppression or gain control of the platform on top of ours.
+		api.set_input_preset(builder, AAUDIO_INPUT_PRESET_VOICE_RECOGNITION);
+	}
+	api.set_data_callback(builder, &MicrophoneBackend::_data, this);
+	const aaudio_result_t opened = api.open_stream(builder, &stream);
+	api.delete_builder(builder);
+	if (opened != AAUDIO_OK) {
+		stream = nullptr;
+		return ERR_CANT_OPEN;
+	}
+	rate = api.get_sample_rate(stream);
+	if (api.request_start(stream) != AAUDIO_OK) {
+		close();
+		return ERR_CANT_OPEN;
+	}
+	r_rate = rate;
+	return OK;
+}
+
+void MicrophoneBackend::close() {
+	if (stream == nullptr) {
+		return;
+	}
+	const AAudioApi &api = _get_aaudio();
+	api.request_stop(stream);
+	// Waits for a callback in progress.
+	api.close(stream);
+	stream = nullptr;
+}
+
+#elif defined(__APPLE__)
+
+/**
+ * AudioQueue input on the default device. The queue converts the device
+ * format to mono float at the requested rate and calls back on a thread of
+ * its own, a few short buffers are kept in flight.
+ */
+class MicrophoneBackend {
+	static const int BUFFER_COUNT = 3;
+
+	MicrophoneCapture *owner = nullptr;
+	AudioQueueRef queue = nullptr;
+	int rate = 0;
+	std::atomic<bool> running{ false };
+
+	static void _input(void *p_user, AudioQueueRef p_queue, AudioQueueBufferRef p_buffer, const AudioTimeStamp *p_start_time, UInt32 p_packets, const AudioStreamPacketDescription *p_packet_descriptions);
+
+public:
+	Error open(MicrophoneCapture *p_owner, int p_rate, int &r_rate);
+	void close();
+	~MicrophoneBackend() { close(); }
+};
+
+void MicrophoneBackend::_input(void *p_user, AudioQueueRef p_queue, AudioQueueBufferRef p_buffer, const AudioTimeStamp *p_start_time, UInt32 p_packets, const AudioStreamPacketDescription *p_packet_descriptions) {
+	MicrophoneBackend *backend = static_cast<MicrophoneBackend *>(p_user);
+	if (!backend->running.load()) {
+		return;
+	}
+	const uint32_t frames = p_buffer->mAudioDataByteSize / sizeof(float);
+	if (frames > 0) {
+		backend->owner->_capture(static_cast<const float *>(p_buffer->mAudioData), frames, backend->rate);
+	}
+	AudioQueueEnqueueBuffer(p_queue, p_buffer, 0, nullptr);
+}
+
+Error MicrophoneBackend::open(MicrophoneCapture *p_owner, int p_rate, int &r_rate) {
+	owner = p_owner;
+	rate = p_rate;
+	AudioStreamBasicDescription format = {};
+	format.mSampleRate = p_rate;
+	format.mFormatID = kAudioFormatLinearPCM;
+	format.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+	format.mBytesPerPacket = sizeof(float);
+	format.mFramesPerPacket = 1;
+	format.mBytesPerFrame = sizeof(float);
+	format.mChannelsPerFrame = 1;
+	format.mBitsPerChannel = 32;
+	OSStatus status = AudioQueueNewInput(&format, &MicrophoneBackend::_input, this, nullptr, nullptr, 0, &queue);
+	if (status != noErr) {
+		queue = nullptr;
+		return ERR_CANT_OPEN;
+	}
+	const UInt32 buffer_bytes = UInt32(p_rate * capture_period_ms / 1000) * sizeof(float);
+	for (int i = 0; i < BUFFER_COUNT && status == noErr; i++) {
+		AudioQueueBufferRef buffer = nullptr;
+		status = AudioQueueAllocateBuffer(queue, buffer_bytes, &buffer);
+		if (status == noErr) {
+			status = AudioQueueEnqueueBuffer(queue, buffer, 0, nullptr);
+		}
+	}
+	running.store(true);
+	if (status == noErr) {
+		status = AudioQueueStart(queue, nullptr);
+	}
+	if (status != noErr) {
+		close();
+		return ERR_CANT_OPEN;
+	}
+	r_rate = rate;
+	return OK;
+}
+
+void MicrophoneBackend::close() {
+	running.store(false);
+	if (queue == nullptr) {
+		return;
+	}
+	// Synchronous, no callback runs once it returns. Disposing frees the buffers too.
+	AudioQueueStop(queue, true);
+	AudioQueueDispose(queue, true);
+	queue = nullptr;
+}
+
+#else
+
+/* No native backend, Linux and the web feed the streams through the record bus. */
+class MicrophoneBackend {
+public:
+	Error open(MicrophoneCapture *p_owner, int p_rate, int &r_rate) { return ERR_UNAVAILABLE; }
+	void close() {}
+};
+
+#endif
+
+bool MicrophoneCapture::is_supported() {
+#if defined(_WIN32) || defined(__APPLE__)
+	return true;
+#elif defined(__ANDROID__)
+	return _get_aaudio().loaded;
+#else
+	return false;
+#endif
+}
+
+void MicrophoneCapture::_capture(const float *p_samples, uint32_t p_frames, int p_rate) {
+	if (!target->is_listening()) {
+		return;
+	}
+	// Same producer side as the audio thread, so the blocking overflow policy drops the newest audio instead of waiting.
+	target->_ingest_mono(p_samples, p_frames, uint32_t(p_rate), false);
+}
+
+void MicrophoneCapture::set_stream(const Ref<SpeechToTextStream> &p_stream) {
+	MutexLock lock(stream_mutex);
+	stream = p_stream;
+}
+
+Ref<SpeechToTextStream> MicrophoneCapture::get_stream() {
+	{
+		MutexLock lock(stream_mutex);
+		if (stream.is_valid()) {
+			return stream;
+		}
+	}
+	SpeechToText *speech_to_text = SpeechToText::get_singleton();
+	return speech_to_text ? speech_to_text->get_default_stream() : Ref<SpeechToTextStream>();
+}
+
+Error MicrophoneCapture::start() {
+	ERR_FAIL_COND_V_MSG(backend != nullptr, ERR_ALREADY_IN_USE, "The microphone is already being captured.");
+	ERR_FAIL_COND_V_MSG(!is_supported(), ERR_UNAVAILABLE, "No native microphone capture on this platform, use an AudioEffectWhisperCapture on the record bus.");
+	target = get_stream();
+	ERR_FAIL_COND_V(target.is_null(), ERR_UNCONFIGURED);
+	backend.reset(new MicrophoneBackend);
+	int rate = 0;
+	const Error err = backend->open(this, SpeechToText::SPEECH_SETTING_SAMPLE_RATE, rate);
+	if (err != OK) {
+		backend.reset();
+		target.unref();
+		ERR_FAIL_V_MSG(err, "Could not open the input device.");
+	}
+	sample_rate = rate;
+	return OK;
+}
+
+void MicrophoneCapture::stop() {
+	if (backend == nullptr) {
+		return;
+	}
+	// Joins the capture thread, target is not read after this.
+	backend.reset();
+	target.unref();
+	sample_rate = 0;
+}
+
+MicrophoneCapture::MicrophoneCapture() {
+}
+
+MicrophoneCapture::~MicrophoneCapture() {
+	stop();
+}
+
+void MicrophoneCapture::_bind_methods() {
+	ClassDB::bind_static_method("MicrophoneCapture", D_METHOD("is_supported"), &MicrophoneCapture::is_supported);
+	ClassDB::bind_method(D_METHOD("get_stream"), &MicrophoneCapture::get_stream);
+	ClassDB::bind_method(D_METHOD("set_stream", "stream"), &MicrophoneCapture::set_stream);
+	ClassDB::bind_method(D_METHOD("start"), &MicrophoneCapture::start);
+	ClassDB::bind_method(D_METHOD("stop"), &MicrophoneCapture::stop);
+	ClassDB::bind_method(D_METHOD("is_capturing"), &MicrophoneCapture::is_capturing);
+	ClassDB::bind_method(D_METHOD("get_sample_rate"), &MicrophoneCapture::get_sample_rate);
+}
@@ -0,0 +1,60 @@
+#ifndef MICROPHONE_CAPTURE_H
+#define MICROPHONE_CAPTURE_H
+
+#include "speech_to_text_stream.h"
+
+#include <godot_cpp/classes/mutex.hpp>
+#include <godot_cpp/classes/ref_counted.hpp>
+
+#include <memory>
+
+using namespace godot;
+
+class MicrophoneBackend;
+
+/**
+ * Opens the default input device of the platform itself and feeds it to a
+ * SpeechToTextStream from the capture thread of the device, at 16 kHz mono
+ * where the device or the platform converter gives that. Godot's mixer, the
+ * record bus and the resampler stay out of the way. WASAPI on Windows, an
+ * AudioQueue on macOS and iOS, AAudio on Android 8 and later. Elsewhere
+ * start() fails and the record bus is still the way in.
+ */
+class MicrophoneCapture : public RefCounted {
+	GDCLASS(MicrophoneCapture, RefCounted);
+
+	friend class MicrophoneBackend;
+
+	Ref<SpeechToTextStream> stream;
+	Mutex stream_mutex;
+	/* Fed by the capture thread, fixed from start() to stop(). */
+	Ref<SpeechToTextStream> target;
+	std::unique_ptr<MicrophoneBackend> backend;
+	int sample_rate = 0;
+
+	/** Called on the capture thread with p_frames mono frames at p_rate Hz. */
+	void _capture(const float *p_samples, uint32_t p_frames, int p_rate);
+
+protected:
+	static void _bind_methods();
+
+public:
+	/** Whether this platform has a native capture backend. */
+	static bool is_supported();
+
+	/** Null feeds the stream behind the SpeechToText add_audio_buffer/start_listen methods. Taken by the next start(). */
+	void set_stream(const Ref<SpeechToTextStream> &p_stream);
+	Ref<SpeechToTextStream> get_stream();
+
+	/** Open the default input device and start feeding the stream. Audio is only taken while the stream is listening. */
+	Error start();
+	void stop();
+	bool is_capturing() const { return backend != nullptr; }
+	/** Rate the device delivers at, 16000 unless it could not be opened at that rate. 0 when not capturing. */
+	int get_sample_rate() const { return sample_rate; }
+
+	MicrophoneCapture();
+	~MicrophoneCapture();
+};
+
+#endif // MICROPHONE_CAPTURE_H
@@ -0,0 +1,462 @@
+#include "model_downloader.h"
+#include "resource_importer_whisper.h"
+
+#include <godot_cpp/classes/config_file.hpp>
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/classes/tls_options.hpp>
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+
+/* Sleep between two polls of a connection. */
+static const int poll_interval_usec = 1000;
+/* A connection that sends nothing for this long is dropped, and its chunk asked for again. */
+static const uint64_t stall_timeout_usec = 30000000;
+/* Tries of a chunk, a second apart, before the download fails. */
+static const int chunk_attempts = 3;
+static const int retry_delay_usec = 1000000;
+static const int max_redirects = 8;
+/* Read from a connection, and from the part file to hash, at a time. */
+static const int64_t read_bytes = 1 << 18;
+
+/* The SHA1s of whisper.cpp's models/README.md, what extra/sha-all.sh prints for the files on Hugging Face. */
+static const char *const model_sha1s[][2] = {
+	{ "tiny", "bd577a113a864445d4c299885e0cb97d4ba92b5f" },
+	{ "tiny.en", "c78c86eb1a8faa21b369bcd33207cc90d64ae9df" },
+	{ "base", "465707469ff3a37a2b9b8d8f89f2f99de7299dac" },
+	{ "base.en", "137c40403d78fd54d454da0f9bd998f78703390c" },
+	{ "small", "55356645c2b361a969dfd0ef2c5a50d530afd8d5" },
+	{ "small.en", "db8a495a91d927739e50b3fc1cc4c6b8f6c2d022" },
+	{ "medium", "fd9727b6e1217c2f614f9b698455c4ffd82463b4" },
+	{ "medium.en", "8c30f0e44ce9560643ebd10bbe50cd20eafd3723" },
+	{ "large-v1", "b1caaf735c4cc1429223d5a74f0f4d0b9b59a299" },
+	{ "large-v2", "0f4c8e34f21cf1a914c59d8b3ce882345ad349d6" },
+	{ "large-v3", "ad82bf6a9043ceed055076d0fd39f5f186ff8062" },
+};
+
+String ModelDownloader::get_model_sha1(const String &p_model) {
+	for (const auto &model : model_sha1s) {
+		if (p_model == model[0]) {
+			return model[1];
+		}
+	}
+	return String();
+}
+
+bool ModelDownloader::_parse_url(const String &p_url, Url &r_url) {
+	String rest;
+	if (p_url.begins_with("https://")) {
+		r_url.tls = true;
+		rest = p_url.substr(8);
+	} else if (p_url.begins_with("http://")) {
+		r_url.tls = false;
+		rest = p_url.substr(7);
+	} else {
+		return false;
+	}
+	const int slash = rest.find("/");
+	const String authority = slash >= 0 ? rest.substr(0, slash) : rest;
+	r_url.path = slash >= 0 ? rest.substr(slash) : String("/");
+	const int colon = authority.rfind(":");
+	r_url.host = colon >= 0 ? authority.substr(0, colon) : authority;
+	r_url.port = colon >= 0 ? authority.substr(colon + 1).to_int() : (r_url.tls ? 443 : 80);
+	return !r_url.host.is_empty() && r_url.port > 0;
+}
+
+static String _get_header(const PackedStringArray &p_headers, const String &p_name) {
+	const String prefix = p_name.to_lower() + ":";
+	for (int i = 0; i < p_headers.size(); i++) {
+		if (p_headers[i].to_lower().begins_with(prefix)) {
+			return p_headers[i].substr(prefix.length()).strip_edges();
+		}
+	}
+	return String();
+}
+
+/* For the bytes p_begin to p_end, the whole file when p_end is before p_begin. */
+static PackedStringArray _request_headers(int64_t p_begin, int64_t p_end) {
+	PackedStringArray headers;
+	headers.push_back("User-Agent: godot-whisper");
+	headers.push_back("Accept: */*");
+	// The sizes and offsets are of the file, not of a compressed body.
+	headers.push_back("Accept-Encoding: identity");
+	if (p_end >= p_begin) {
+		headers.push_back(vformat("Range: bytes=%d-%d", p_begin, p_end));
+	}
+	return headers;
+}
+
+void ModelDownloader::_fail(Error p_error) {
+	int expected = OK;
+	error.compare_exchange_strong(expected, int(p_error));
+	stopping = true;
+}
+
+bool ModelDownloader::_poll_while(const Ref<HTTPClient> &p_client, HTTPClient::Status p_status) {
+	Time *time = Time::get_singleton();
+	const uint64_t deadline_usec = time->get_ticks_usec() + stall_timeout_usec;
+	while (p_client->get_status() == p_status) {
+		if (stopping.load(std::memory_order_relaxed) || time->get_ticks_usec() > deadline_usec) {
+			return false;
+		}
+		p_client->poll();
+		OS::get_singleton()->delay_usec(poll_interval_usec);
+	}
+	return true;
+}
+
+bool ModelDownloader::_connect(const Ref<HTTPClient> &p_client, const Url &p_url) {
+	p_client->close();
+	if (p_client->connect_to_host(p_url.host, p_url.port, p_url.tls ? TLSOptions::client() : Ref<TLSOptions>()) != OK) {
+		return false;
+	}
+	if (!_poll_while(p_client, HTTPClient::STATUS_RESOLVING) || !_poll_while(p_client, HTTPClient::STATUS_CONNECTING)) {
+		return false;
+	}
+	return p_client->get_status() == HTTPClient::STATUS_CONNECTED;
+}
+
+Error ModelDownloader::_probe() {
+	Ref<HTTPClient> client;
+	client.instantiate();
+	String location = source_url;
+	for (int redirects = 0; redirects <= max_redirects; redirects++) {
+		// Hugging Face answers resolve/main with a redirect to its CDN, or to a path on the same host.
+		Url next = url;
+		if (location.begins_with("/")) {
+			next.path = location;
+		} else {
+			ERR_FAIL_COND_V_MSG(!_parse_url(location, next), ERR_INVALID_PARAMETER, "Cannot download a whisper model from " + location);
+		}
+		url = next;
+		// The first byte tells whether the server serves ranges, and the size of the file.
+		if (!_connect(client, url) || client->request(HTTPClient::METHOD_GET, url.path, _request_headers(0, 0)) != OK || !_poll_while(client, HTTPClient::STATUS_REQUESTING)) {
+			client->close();
+			return stopping ? ERR_SKIP : ERR_CANT_CONNECT;
+		}
+		const int code = client->get_response_code();
+		const PackedStringArray headers = client->get_response_headers();
+		const int64_t body_length = client->get_response_body_length();
+		client->close();
+		if (code == 301 || code == 302 || code == 303 || code == 307 || code == 308) {
+			location = _get_header(headers, "Location");
+			ERR_FAIL_COND_V_MSG(location.is_empty(), ERR_INVALID_DATA, "Cannot download a whisper model from " + source_url + ", a redirect has no location.");
+			continue;
+		}
+		int64_t total = 0;
+		if (code == HTTPClient::RESPONSE_PARTIAL_CONTENT) {
+			// bytes 0-0/<size>
+			const String range = _get_header(headers, "Content-Range");
+			const int slash = range.rfind("/");
+			total = slash >= 0 ? range.substr(slash + 1).to_int() : 0;
+			ranges = true;
+		} else if (code == HTTPClient::RESPONSE_OK) {
+			total = body_length;
+			ranges = false;
+		} else {
+			ERR_FAIL_V_MSG(ERR_FILE_NOT_FOUND, vformat("Cannot download a whisper model from %s, the server answered %d.", source_url, code));
+		}
+		ERR_FAIL_COND_V_MSG(total <= 0, ERR_INVALID_DATA, "Cannot download a whisper model from " + source_url + ", the server does not tell its size.");
+		total_bytes = total;
+		return OK;
+	}
+	ERR_FAIL_V_MSG(ERR_INVALID_DATA, "Cannot download a whisper model from " + source_url + ", too many redirects.");
+}
+
+bool ModelDownloader::_load_state() {
+	chunk_states.assign(size_t(chunk_count), CHUNK_MISSING);
+	if (!ranges || !FileAccess::file_exists(part_file) || !FileAccess::file_exists(state_file)) {
+		return false;
+	}
+	Ref<ConfigFile> state;
+	state.instantiate();
+	if (state->load(state_file) != OK) {
+		return false;
+	}
+	// The chunks are only of use for the same file, cut the same way.
+	if (String(state->get_value("download", "url", String())) != source_url || int64_t(state->get_value("download", "size", 0)) != total_bytes.load() || int64_t(state->get_value("download", "chunk_bytes", 0)) != chunk_bytes) {
+		return false;
+	}
+	const PackedByteArray done = state->get_value("download", "chunks", PackedByteArray());
+	if (done.size() != chunk_count) {
+		return false;
+	}
+	int64_t bytes = 0;
+	for (int i = 0; i < chunk_count; i++) {
+		if (done[i] == CHUNK_DONE) {
+			chunk_states[i] = CHUNK_DONE;
+			bytes += _chunk_size(i);
+		}
+	}
+	downloaded_bytes = bytes;
+	return true;
+}
+
+void ModelDownloader::_save_state() {
+	if (!ranges) {
+		return;
+	}
+	PackedByteArray done;
+	done.resize(chunk_count);
+	for (int i = 0; i < chunk_count; i++) {
+		done.set(i, chunk_states[i] == CHUNK_DONE ? CHUNK_DONE : CHUNK_MISSING);
+	}
+	Ref<ConfigFile> state;
+	state.instantiate();
+	state->set_value("download", "url", source_url);
+	state->set_value("download", "size", total_bytes.load());
+	state->set_value("download", "chunk_bytes", chunk_bytes);
+	state->set_value("download", "chunks", done);
+	state->save(state_file);
+}
+
+int ModelDownloader::_claim_chunk() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = 0; i < chunk_count; i++) {
+		if (chunk_states[i] == CHUNK_MISSING) {
+			chunk_states[i] = CHUNK_CLAIMED;
+			return i;
+		}
+	}
+	return -1;
+}
+
+Error ModelDownloader::_fetch_chunk(const Ref<HTTPClient> &p_client, const Ref<FileAccess> &p_file, int p_chunk) {
+	const int64_t begin = int64_t(p_chunk) * chunk_bytes;
+	const int64_t size = _chunk_size(p_chunk);
+	// Connections are kept alive from one chunk to the next.
+	if (p_client->get_status() != HTTPClient::STATUS_CONNECTED && !_connect(p_client, url)) {
+		return ERR_CANT_CONNECT;
+	}
+	const PackedStringArray headers = ranges ? _request_headers(begin, begin + size - 1) : _request_headers(0, -1);
+	if (p_client->request(HTTPClient::METHOD_GET, url.path, headers) != OK || !_poll_while(p_client, HTTPClient::STATUS_REQUESTING)) {
+		p_client->close();
+		return ERR_CANT_CONNECT;
+	}
+	if (p_client->get_status() != HTTPClient::STATUS_BODY || p_client->get_response_code() != (ranges ? HTTPClient::RESPONSE_PARTIAL_CONTENT : HTTPClient::RESPONSE_OK)) {
+		p_client->close();
+		return ERR_CANT_CONNECT;
+	}
+
+	p_file->seek(uint64_t(begin));
+	Time *time = Time::get_singleton();
+	uint64_t data_usec = time->get_ticks_usec();
+	int64_t received = 0;
+	while (received < size && p_client->get_status() == HTTPClient::STATUS_BODY && !stopping.load(std::memory_order_relaxed)) {
+		p_client->poll();
+		PackedByteArray data = p_client->read_response_body_chunk();
+		if (data.is_empty()) {
+			if (time->get_ticks_usec() - data_usec > stall_timeout_usec) {
+				break;
+			}
+			OS::get_singleton()->delay_usec(poll_interval_usec);
+			continue;
+		}
+		if (received + data.size() > size) {
+			data.resize(size - received);
+		}
+		p_file->store_buffer(data);
+		if (p_file->get_error() != OK) {
+			return ERR_FILE_CANT_WRITE;
+		}
+		received += data.size();
+		downloaded_bytes.fetch_add(data.size(), std::memory_order_relaxed);
+		data_usec = time->get_ticks_usec();
+	}
+	if (received < size) {
+		// Asked for again from the start, by this connection or another one.
+		downloaded_bytes.fetch_sub(received, std::memory_order_relaxed);
+		p_client->close();
+		return ERR_CANT_CONNECT;
+	}
+	// The hash reads it back through another file.
+	p_file->flush();
+	return p_file->get_error() == OK ? OK : ERR_FILE_CANT_WRITE;
+}
+
+void ModelDownloader::_fetch() {
+	Ref<HTTPClient> client;
+	client.instantiate();
+	client->set_read_chunk_size(int32_t(read_bytes));
+	const Ref<FileAccess> file = FileAccess::open(part_file, FileAccess::READ_WRITE);
+	if (file.is_null()) {
+		_fail(ERR_FILE_CANT_WRITE);
+		return;
+	}
+	while (!stopping.load(std::memory_order_relaxed)) {
+		const int chunk = _claim_chunk();
+		if (chunk < 0) {
+			break;
+		}
+		Error err = ERR_CANT_CONNECT;
+		for (int attempt = 0; attempt < chunk_attempts && !stopping.load(std::memory_order_relaxed); attempt++) {
+			if (attempt > 0) {
+				OS::get_singleton()->delay_usec(retry_delay_usec);
+			}
+			err = _fetch_chunk(client, file, chunk);
+			if (err != ERR_CANT_CONNECT) {
+				break;
+			}
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		if (err != OK) {
+			chunk_states[chunk] = CHUNK_MISSING;
+			lock.unlock();
+			_fail(err);
+			break;
+		}
+		chunk_states[chunk] = CHUNK_DONE;
+		_save_state();
+		lock.unlock();
+		_hash_done_chunks();
+		call_deferred("emit_signal", "progress_changed", get_downloaded_bytes(), get_total_bytes());
+	}
+	client->close();
+}
+
+void ModelDownloader::_hash_done_chunks() {
+	if (hashing.is_null()) {
+		return;
+	}
+	// One connection at a time, the others keep downloading meanwhile.
+	std::lock_guard<std::mutex> hash_lock(hash_mutex);
+	while (!stopping.load(std::memory_order_relaxed)) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (hashed_chunks >= chunk_count || chunk_states[hashed_chunks] != CHUNK_DONE) {
+				return;
+			}
+		}
+		hash_file->seek(uint64_t(hashed_chunks) * uint64_t(chunk_bytes));
+		int64_t remaining = _chunk_size(hashed_chunks);
+		while (remaining > 0) {
+			const PackedByteArray data = hash_file->get_buffer(MIN(remaining, read_bytes));
+			if (data.is_empty()) {
+				_fail(ERR_FILE_CANT_READ);
+				return;
+			}
+			hashing->update(data);
+			remaining -= data.size();
+		}
+		hashed_chunks++;
+	}
+}
+
+void ModelDownloader::_run() {
+	Error err = _probe();
+	if (err == OK) {
+		chunk_bytes = ranges ? CHUNK_BYTES : total_bytes.load();
+		chunk_count = int((total_bytes.load() + chunk_bytes - 1) / chunk_bytes);
+		if (!_load_state()) {
+			downloaded_bytes = 0;
+			// Created empty, the chunks are written at their offsets.
+			err = FileAccess::open(part_file, FileAccess::WRITE).is_valid() ? OK : ERR_FILE_CANT_WRITE;
+			std::lock_guard<std::mutex> lock(mutex);
+			_save_state();
+		}
+	}
+	if (err == OK && !sha1.is_empty()) {
+		hashing.instantiate();
+		hashing->start(HashingContext::HASH_SHA1);
+		hash_file = FileAccess::open(part_file, FileAccess::READ);
+		hashed_chunks = 0;
+		err = hash_file.is_valid() ? OK : ERR_FILE_CANT_READ;
+	}
+	if (err == OK) {
+		const int count = ranges ? MIN(get_connections(), chunk_count) : 1;
+		for (int i = 1; i < count; i++) {
+			fetchers.emplace_back(&ModelDownloader::_fetch, this);
+		}
+		// What a previous download left is hashed again while the rest comes in.
+		_hash_done_chunks();
+		_fetch();
+		for (std::thread &fetcher : fetchers) {
+			fetcher.join();
+		}
+		fetchers.clear();
+		_hash_done_chunks();
+		err = Error(error.load());
+	}
+	if (err == OK && hashing.is_valid()) {
+		const String hash = hashed_chunks == chunk_count ? hashing->finish().hex_encode() : String();
+		if (hash != sha1.to_lower()) {
+			ERR_PRINT(vformat("The whisper model downloaded from %s has the SHA1 %s instead of %s.", source_url, hash, sha1));
+			DirAccess::remove_absolute(part_file);
+			DirAccess::remove_absolute(state_file);
+			err = ERR_FILE_CORRUPT;
+		}
+	}
+	hash_file.unref();
+	hashing.unref();
+	if (err == OK) {
+		// Aligned or quantized into the target in one pass, the part is kept for another try when that fails.
+		err = ResourceImporterWhisper::write_model(part_file, target_file, quantization);
+		if (err == OK) {
+			DirAccess::remove_absolute(part_file);
+			DirAccess::remove_absolute(state_file);
+		}
+	}
+	running.store(false, std::memory_order_release);
+	if (!cancelled.load()) {
+		call_deferred("emit_signal", "completed", int(err), target_file);
+	}
+}
+
+Error ModelDownloader::start(const String &p_url, const String &p_target_file, const String &p_sha1, int p_quantization) {
+	ERR_FAIL_COND_V_MSG(is_downloading(), ERR_BUSY, "Already downloading a whisper model, cancel() it first.");
+	Url parsed;
+	ERR_FAIL_COND_V_MSG(!_parse_url(p_url, parsed), ERR_INVALID_PARAMETER, "Cannot download a whisper model from " + p_url);
+	ERR_FAIL_COND_V(p_target_file.is_empty(), ERR_INVALID_PARAMETER);
+	ERR_FAIL_INDEX_V(p_quantization, ResourceImporterWhisper::QUANTIZATION_Q8_0 + 1, ERR_INVALID_PARAMETER);
+	if (thread.joinable()) {
+		thread.join();
+	}
+	DirAccess::make_dir_recursive_absolute(p_target_file.get_base_dir());
+
+	source_url = p_url;
+	url = parsed;
+	target_file = p_target_file;
+	part_file = p_target_file + String(".part");
+	state_file = part_file + String(".cfg");
+	sha1 = p_sha1.strip_edges();
+	quantization = p_quantization;
+	ranges = true;
+	chunk_count = 0;
+	total_bytes = 0;
+	downloaded_bytes = 0;
+	stopping = false;
+	cancelled = false;
+	error = OK;
+	running = true;
+	thread = std::thread(&ModelDownloader::_run, this);
+	return OK;
+}
+
+void ModelDownloader::cancel() {
+	cancelled = true;
+	stopping = true;
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+ModelDownloader::~ModelDownloader() {
+	cancel();
+}
+
+void ModelDownloader::_bind_methods() {
+	ClassDB::bind_static_method("ModelDownloader", D_METHOD("get_model_sha1", "model"), &ModelDownloader::get_model_sha1);
+	ClassDB::bind_method(D_METHOD("get_connections"), &ModelDownloader::get_connections);
+	ClassDB::bind_method(D_METHOD("set_connections", "connections"), &ModelDownloader::set_connections);
+	ClassDB::bind_method(D_METHOD("start", "url", "target_file", "sha1", "quantization"), &ModelDownloader::start, DEFVAL(String()), DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("cancel"), &ModelDownloader::cancel);
+	ClassDB::bind_method(D_METHOD("is_downloading"), &ModelDownloader::is_downloading);
+	ClassDB::bind_method(D_METHOD("get_downloaded_bytes"), &ModelDownloader::get_downloaded_bytes);
+	ClassDB::bind_method(D_METHOD("get_total_bytes"), &ModelDownloader::get_total_bytes);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "connections", PROPERTY_HINT_RANGE, "1,16"), "set_connections", "get_connections");
+
+	ADD_SIGNAL(MethodInfo("progress_changed", PropertyInfo(Variant::INT, "downloaded_bytes"), PropertyInfo(Variant::INT, "total_bytes")));
+	ADD_SIGNAL(MethodInfo("completed", PropertyInfo(Variant::INT, "error"), PropertyInfo(Variant::STRING, "file")));
+}
@@ -0,0 +1,129 @@
+#ifndef MODEL_DOWNLOADER_H
+#define MODEL_DOWNLOADER_H
+
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/hashing_context.hpp>
+#include <godot_cpp/classes/http_client.hpp>
+#include <godot_cpp/classes/ref_counted.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * Downloads a ggml whisper model over several HTTP range requests at once and
+ * writes it straight to the file it is loaded from, aligned and optionally
+ * quantized the way ResourceImporterWhisper imports it, e.g. to user:// on a
+ * machine that never runs the editor. The model comes in CHUNK_BYTES at a time
+ * into <target>.part and the chunks that are done are kept in
+ * <target>.part.cfg, so a download that was cancelled or cut off resumes with
+ * the chunks still missing. Given the SHA1 extra/sha-all.sh prints, the chunks
+ * are hashed in file order as they complete and the model is only written when
+ * it matches. Servers that ignore ranges get a single connection, without
+ * resume.
+ */
+class ModelDownloader : public RefCounted {
+	GDCLASS(ModelDownloader, RefCounted);
+
+public:
+	static const int64_t CHUNK_BYTES = 8 << 20;
+
+private:
+	enum ChunkState : uint8_t {
+		CHUNK_MISSING,
+		CHUNK_CLAIMED,
+		CHUNK_DONE,
+	};
+
+	struct Url {
+		bool tls = false;
+		String host;
+		int port = 80;
+		String path;
+	};
+
+	std::atomic<int> connections{ 4 };
+
+	/* Fixed from start() until the download thread finished. */
+	String source_url;
+	Url url; // after the redirects
+	String target_file;
+	String part_file;
+	String state_file;
+	String sha1;
+	int quantization = 0;
+	bool ranges = true; // false when the server sends the whole file to a range request
+	int64_t chunk_bytes = CHUNK_BYTES;
+	int chunk_count = 0;
+	std::thread thread;
+	std::vector<std::thread> fetchers;
+
+	std::mutex mutex;
+	std::vector<uint8_t> chunk_states; // ChunkState
+	std::atomic<int64_t> total_bytes{ 0 };
+	std::atomic<int64_t> downloaded_bytes{ 0 };
+	std::atomic<bool> running{ false };
+	std::atomic<bool> stopping{ false };
+	std::atomic<bool> cancelled{ false };
+	std::atomic<int> error{ OK };
+
+	/* The chunks before hashed_chunks went into the hash, in file order. */
+	std::mutex hash_mutex;
+	Ref<HashingContext> hashing;
+	Ref<FileAccess> hash_file;
+	int hashed_chunks = 0;
+
+	static bool _parse_url(const String &p_url, Url &r_url);
+	int64_t _chunk_size(int p_chunk) const { return MIN(chunk_bytes, total_bytes.load(std::memory_order_relaxed) - int64_t(p_chunk) * chunk_bytes); }
+	/* Stop every connection, the first error is the one completed reports. */
+	void _fail(Error p_error);
+	/* Poll while the client is in p_status, false when stopping or when it stalled. */
+	bool _poll_while(const Ref<HTTPClient> &p_client, HTTPClient::Status p_status);
+	bool _connect(const Ref<HTTPClient> &p_client, const Url &p_url);
+	/* Follow the redirects of source_url to the file and learn its size and whether ranges are served. */
+	Error _probe();
+	/* The chunks a previous download of the same file left, false when it has to start over. */
+	bool _load_state();
+	void _save_state();
+	int _claim_chunk();
+	/* Read a chunk into the part file at its offset. ERR_CANT_CONNECT when it is worth asking again. */
+	Error _fetch_chunk(const Ref<HTTPClient> &p_client, const Ref<FileAccess> &p_file, int p_chunk);
+	void _fetch();
+	void _hash_done_chunks();
+	void _run();
+
+protected:
+	static void _bind_methods();
+
+public:
+	/** The SHA1 of the model of whisper.cpp's models/README.md by name, e.g. "base.en", empty for the others. */
+	static String get_model_sha1(const String &p_model);
+
+	/** Range requests in flight at once. */
+	_FORCE_INLINE_ void set_connections(int p_connections) { connections = CLAMP(p_connections, 1, 16); }
+	_FORCE_INLINE_ int get_connections() const { return connections.load(std::memory_order_relaxed); }
+
+	/**
+	 * Download the model at p_url, following redirects, and write it to
+	 * p_target_file with the ResourceImporterWhisper quantization
+	 * p_quantization. A .ggml target keeps the model info next to it. Without
+	 * p_sha1 the model is not verified. completed is emitted once it is
+	 * written or failed, the .part file is kept for the next start() unless
+	 * it did not match p_sha1.
+	 */
+	Error start(const String &p_url, const String &p_target_file, const String &p_sha1 = String(), int p_quantization = 0);
+	/** Stop the download and wait for its connections, without completed. The next start() of the same target resumes it. */
+	void cancel();
+	bool is_downloading() const { return running.load(std::memory_order_acquire); }
+	int64_t get_downloaded_bytes() const { return downloaded_bytes.load(std::memory_order_relaxed); }
+	/** Size of the model, 0 until the server told it. */
+	int64_t get_total_bytes() const { return total_bytes.load(std::memory_order_relaxed); }
+
+	~ModelDownloader();
+};
+
+#endif // MODEL_DOWNLOADER_H
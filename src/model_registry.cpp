@@ -0,0 +1,81 @@
+#include "model_registry.h"
+
+#include <godot_cpp/core/error_macros.hpp>
+
+std::mutex ModelRegistry::mutex;
+std::vector<ModelRegistry::Entry> ModelRegistry::entries;
+
+std::string ModelRegistry::_get_key(const Ref<WhisperResource> &p_model, const whisper_context_params &p_params) {
+	// The resource path is part of it, Core ML states look for their encoder next to it.
+	// The backend of the host by its init function, RenderingDevice or WebGPU.
+	const String key = vformat("%s|%s|%s%s%s%s%s%s", p_model->get_file(), p_model->get_path(), p_params.use_gpu ? vformat("gpu%d", p_params.gpu_device) : String("cpu"), p_params.repack_weights ? "|repacked" : "",
+			p_params.use_gpu && p_params.backend_init ? vformat("|host_backend%x", int64_t(uintptr_t(p_params.backend_init))) : String(), p_params.lock_model_memory ? "|locked" : "", p_params.use_huge_pages ? "|huge_pages" : "", p_params.mmap_path ? "|mapped" : "");
+	return key.utf8().get_data();
+}
+
+whisper_context *ModelRegistry::acquire_loaded(const Ref<WhisperResource> &p_model, const whisper_context_params &p_params) {
+	ERR_FAIL_COND_V(p_model.is_null(), nullptr);
+	const std::string key = _get_key(p_model, p_params);
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Entry &entry : entries) {
+		if (entry.key == key) {
+			entry.refs++;
+			return entry.context;
+		}
+	}
+	return nullptr;
+}
+
+whisper_context *ModelRegistry::acquire(const Ref<WhisperResource> &p_model, const whisper_context_params &p_params, const Callable &p_progress) {
+	whisper_context *context = acquire_loaded(p_model, p_params);
+	if (context != nullptr) {
+		return context;
+	}
+	// Loaded without the lock, it takes seconds and other models may be acquired meanwhile.
+	context = p_model->load_context(p_params, p_progress);
+	if (context == nullptr) {
+		return nullptr;
+	}
+	const std::string key = _get_key(p_model, p_params);
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Entry &entry : entries) {
+		if (entry.key == key) {
+			// Another thread loaded the same model at the same time, keep the first one.
+			entry.refs++;
+			whisper_free(context);
+			return entry.context;
+		}
+	}
+	entries.push_back({ key, context, 1 });
+	return context;
+}
+
+void ModelRegistry::release(whisper_context *p_context) {
+	if (p_context == nullptr) {
+		return;
+	}
+	whisper_context *freed_context = nullptr;
+	bool is_found = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].context != p_context) {
+				continue;
+			}
+			is_found = true;
+			if (--entries[i].refs == 0) {
+				freed_context = p_context;
+				entries.erase(entries.begin() + i);
+			}
+			break;
+		}
+	}
+	ERR_FAIL_COND_MSG(!is_found, "Released a whisper context the model registry does not hold.");
+	// Outside the lock, freeing the weights of a GPU context is not instant either.
+	whisper_free(freed_context);
+}
+
+int ModelRegistry::get_loaded_count() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return int(entries.size());
+}
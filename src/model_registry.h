@@ -0,0 +1,40 @@
+#ifndef MODEL_REGISTRY_H
+#define MODEL_REGISTRY_H
+
+#include "resource_whisper.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Loaded whisper contexts, shared by everything that asks for the same
+ * model file with the same context parameters: the main and draft model of
+ * SpeechToText, and a reload of the weights that are already in memory.
+ * Every acquire is paired with a release, and the weights are freed with the
+ * last release. Safe to call from any thread.
+ */
+class ModelRegistry {
+	struct Entry {
+		std::string key;
+		whisper_context *context = nullptr;
+		int refs = 0;
+	};
+
+	static std::mutex mutex;
+	static std::vector<Entry> entries;
+
+	static std::string _get_key(const Ref<WhisperResource> &p_model, const whisper_context_params &p_params);
+
+public:
+	/** The shared context of p_model, loaded with p_progress when nobody holds it yet. nullptr on failure. */
+	static whisper_context *acquire(const Ref<WhisperResource> &p_model, const whisper_context_params &p_params, const Callable &p_progress = Callable());
+	/** As acquire, but nullptr instead of loading the model. */
+	static whisper_context *acquire_loaded(const Ref<WhisperResource> &p_model, const whisper_context_params &p_params);
+	/** Drop one reference to p_context, nullptr is ignored. */
+	static void release(whisper_context *p_context);
+	/** Models in memory, every one counted once however many users share it. */
+	static int get_loaded_count();
+};
+
+#endif // MODEL_REGISTRY_H
@@ -0,0 +1,238 @@
+#include "noise_suppressor.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cmath>
+#include <cstring>
+
+using namespace godot;
+
+/* Hops the first noise floor is averaged over, about 200 ms. */
+static const int noise_warmup_hops = 25;
+/* Per hop, the power the floor tracks is smoothed over about 30 ms, a single quiet frame does not pull it down. */
+static const float power_smoothing = 0.3f;
+/* Per hop, the floor follows quieter frames with a time constant of about 80 ms and rises at most 0.25%, doubling in about 2 s. */
+static const float noise_fall = 0.1f;
+static const float noise_rise = 1.0025f;
+/* Decision-directed a priori SNR smoothing of Ephraim and Malah. */
+static const float snr_smoothing = 0.98f;
+/* Gain of the bins that are only noise, -15 dB. Lower floors sound watery and make whisper hallucinate more, not less. */
+static const float suppression_floor = 0.178f;
+
+/* Gain control: RMS speech is brought to, -20 dBFS, and the quietest hop RMS that counts as speech, -46 dBFS. */
+static const float agc_target_rms = 0.1f;
+static const float agc_gate_rms = 0.005f;
+static const float agc_min_gain = 0.25f;
+static const float agc_max_gain = 10.0f;
+/* Per hop, loud speech pulls the gain down within a few hops and quiet speech raises it over about a second. */
+static const float agc_attack = 0.2f;
+static const float agc_release = 0.01f;
+
+struct FftTables {
+	int bitrev[NoiseSuppressor::FRAME_SAMPLES];
+	float cos_table[NoiseSuppressor::FRAME_SAMPLES / 2];
+	float sin_table[NoiseSuppressor::FRAME_SAMPLES / 2];
+	float window[NoiseSuppressor::FRAME_SAMPLES]; // square root of a periodic Hann, analysis and synthesis together sum to 1 at half overlap
+};
+
+static const FftTables &_get_fft_tables() {
+	static const FftTables tables = []() {
+		FftTables ret;
+		const int n = NoiseSuppressor::FRAME_SAMPLES;
+		int bits = 0;
+		while ((1 << bits) < n) {
+			bits++;
+		}
+		for (int i = 0; i < n; i++) {
+			int reversed = 0;
+			for (int bit = 0; bit < bits; bit++) {
+				reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+			}
+			ret.bitrev[i] = reversed;
+			ret.window[i] = std::sqrt(0.5 - 0.5 * std::cos(2.0 * Math_PI * i / n));
+		}
+		for (int i = 0; i < n / 2; i++) {
+			ret.cos_table[i] = std::cos(2.0 * Math_PI * i / n);
+			ret.sin_table[i] = std::sin(2.0 * Math_PI * i / n);
+		}
+		return ret;
+	}();
+	return tables;
+}
+
+void NoiseSuppressor::fft(float *p_re, float *p_im, bool p_inverse) {
+	const FftTables &tables = _get_fft_tables();
+	const int n = NoiseSuppressor::FRAME_SAMPLES;
+	for (int i = 0; i < n; i++) {
+		const int j = tables.bitrev[i];
+		if (i < j) {
+			SWAP(p_re[i], p_re[j]);
+			SWAP(p_im[i], p_im[j]);
+		}
+	}
+	for (int len = 2; len <= n; len <<= 1) {
+		const int half = len / 2;
+		const int step = n / len;
+		for (int i = 0; i < n; i += len) {
+			for (int j = 0; j < half; j++) {
+				const float wr = tables.cos_table[j * step];
+				const float wi = p_inverse ? tables.sin_table[j * step] : -tables.sin_table[j * step];
+				const int a = i + j;
+				const int b = a + half;
+				const float vr = p_re[b] * wr - p_im[b] * wi;
+				const float vi = p_re[b] * wi + p_im[b] * wr;
+				p_re[b] = p_re[a] - vr;
+				p_im[b] = p_im[a] - vi;
+				p_re[a] += vr;
+				p_im[a] += vi;
+			}
+		}
+	}
+}
+
+NoiseSuppressor::NoiseSuppressor() {
+	reset();
+}
+
+void NoiseSuppressor::reset() {
+	memset(input, 0, sizeof(input));
+	memset(overlap, 0, sizeof(overlap));
+	memset(output, 0, sizeof(output));
+	fill = 0;
+	for (int k = 0; k < BINS; k++) {
+		noise[k] = 0.0f;
+		smoothed[k] = 0.0f;
+		last_gain[k] = 1.0f;
+		last_snr[k] = 1.0f;
+	}
+	hops = 0;
+	agc_gain = 1.0f;
+}
+
+void NoiseSuppressor::get_state(float *r_state) const {
+	float *dst = r_state;
+	memcpy(dst, input, sizeof(input));
+	dst += FRAME_SAMPLES;
+	memcpy(dst, overlap, sizeof(overlap));
+	dst += FRAME_SAMPLES;
+	memcpy(dst, output, sizeof(output));
+	dst += HOP_SAMPLES;
+	memcpy(dst, smoothed, sizeof(smoothed));
+	dst += BINS;
+	memcpy(dst, noise, sizeof(noise));
+	dst += BINS;
+	memcpy(dst, last_gain, sizeof(last_gain));
+	dst += BINS;
+	memcpy(dst, last_snr, sizeof(last_snr));
+	dst += BINS;
+	*dst++ = float(fill);
+	// Past the warmup the count does not matter anymore, and a float holds it exactly.
+	*dst++ = float(MIN(hops, noise_warmup_hops));
+	*dst++ = agc_gain;
+}
+
+void NoiseSuppressor::set_state(const float *p_state) {
+	const float *src = p_state;
+	memcpy(input, src, sizeof(input));
+	src += FRAME_SAMPLES;
+	memcpy(overlap, src, sizeof(overlap));
+	src += FRAME_SAMPLES;
+	memcpy(output, src, sizeof(output));
+	src += HOP_SAMPLES;
+	memcpy(smoothed, src, sizeof(smoothed));
+	src += BINS;
+	memcpy(noise, src, sizeof(noise));
+	src += BINS;
+	memcpy(last_gain, src, sizeof(last_gain));
+	src += BINS;
+	memcpy(last_snr, src, sizeof(last_snr));
+	src += BINS;
+	fill = CLAMP(int(src[0]), 0, HOP_SAMPLES - 1);
+	hops = CLAMP(int(src[1]), 0, noise_warmup_hops);
+	agc_gain = src[2];
+}
+
+void NoiseSuppressor::process(float *p_samples, size_t p_count) {
+	for (size_t i = 0; i < p_count; i++) {
+		const float sample = p_samples[i];
+		p_samples[i] = output[fill];
+		input[HOP_SAMPLES + fill] = sample;
+		if (++fill < HOP_SAMPLES) {
+			continue;
+		}
+		if (suppress) {
+			_suppress_hop();
+		} else {
+			// Same delay as the filtered path, so toggling suppression does not shift the audio.
+			memcpy(output, input, sizeof(output));
+		}
+		if (auto_gain) {
+			_gain_hop();
+		}
+		memmove(input, input + HOP_SAMPLES, HOP_SAMPLES * sizeof(float));
+		fill = 0;
+	}
+}
+
+void NoiseSuppressor::_suppress_hop() {
+	const FftTables &tables = _get_fft_tables();
+	float re[FRAME_SAMPLES];
+	float im[FRAME_SAMPLES];
+	for (int i = 0; i < FRAME_SAMPLES; i++) {
+		re[i] = input[i] * tables.window[i];
+		im[i] = 0.0f;
+	}
+	fft(re, im, false);
+	for (int k = 0; k < BINS; k++) {
+		const float power = re[k] * re[k] + im[k] * im[k];
+		smoothed[k] += (power - smoothed[k]) * power_smoothing;
+		if (hops < noise_warmup_hops) {
+			noise[k] += (power - noise[k]) / (hops + 1);
+		} else if (smoothed[k] < noise[k]) {
+			noise[k] += (smoothed[k] - noise[k]) * noise_fall;
+		} else {
+			noise[k] = MIN(smoothed[k], noise[k] * noise_rise);
+		}
+		noise[k] = MAX(noise[k], 1e-12f);
+		const float snr = power / noise[k];
+		const float prior_snr = snr_smoothing * last_gain[k] * last_gain[k] * last_snr[k] + (1.0f - snr_smoothing) * MAX(snr - 1.0f, 0.0f);
+		const float gain = MAX(prior_snr / (1.0f + prior_snr), suppression_floor);
+		last_gain[k] = gain;
+		last_snr[k] = snr;
+		re[k] *= gain;
+		im[k] *= gain;
+		// The mirrored bin of a real signal.
+		if (k > 0 && k < FRAME_SAMPLES / 2) {
+			re[FRAME_SAMPLES - k] *= gain;
+			im[FRAME_SAMPLES - k] *= gain;
+		}
+	}
+	fft(re, im, true);
+	const float scale = 1.0f / FRAME_SAMPLES;
+	for (int i = 0; i < FRAME_SAMPLES; i++) {
+		overlap[i] += re[i] * tables.window[i] * scale;
+	}
+	memcpy(output, overlap, sizeof(output));
+	memmove(overlap, overlap + HOP_SAMPLES, HOP_SAMPLES * sizeof(float));
+	memset(overlap + HOP_SAMPLES, 0, HOP_SAMPLES * sizeof(float));
+	hops++;
+}
+
+void NoiseSuppressor::_gain_hop() {
+	float sum = 0.0f;
+	for (int i = 0; i < HOP_SAMPLES; i++) {
+		sum += output[i] * output[i];
+	}
+	const float rms = std::sqrt(sum / HOP_SAMPLES);
+	float target = agc_gain;
+	if (rms > agc_gate_rms) {
+		const float desired = CLAMP(agc_target_rms / rms, agc_min_gain, agc_max_gain);
+		target += (desired - agc_gain) * (desired < agc_gain ? agc_attack : agc_release);
+	}
+	// Ramped over the hop, a step in the gain would click.
+	for (int i = 0; i < HOP_SAMPLES; i++) {
+		const float gain = agc_gain + (target - agc_gain) * (i + 1) / HOP_SAMPLES;
+		output[i] = CLAMP(output[i] * gain, -1.0f, 1.0f);
+	}
+	agc_gain = target;
+}
@@ -0,0 +1,72 @@
+#ifndef NOISE_SUPPRESSOR_H
+#define NOISE_SUPPRESSOR_H
+
+#include <cstddef>
+
+/**
+ * Streaming clean up of the 16 kHz mono input, before the VAD and whisper
+ * see it. Noise suppression is a Wiener filter over 16 ms frames with half
+ * overlap, against a per bin noise floor that falls with the quietest frames
+ * right away and only rises over seconds, so steady fan, hum or room noise is
+ * taken out while speech is not. Gain control then brings speech to a fixed
+ * level, frames too quiet to be speech do not move it. Audio that goes
+ * through either stage is delayed by LATENCY_SAMPLES.
+ */
+class NoiseSuppressor {
+public:
+	static const int FRAME_SAMPLES = 256;
+	static const int HOP_SAMPLES = FRAME_SAMPLES / 2;
+	static const int LATENCY_SAMPLES = FRAME_SAMPLES;
+
+private:
+	static const int BINS = FRAME_SAMPLES / 2 + 1;
+
+public:
+	/** Floats of get_state(), the delayed audio, the noise floor and the gains. */
+	static const int STATE_SIZE = 2 * FRAME_SAMPLES + HOP_SAMPLES + 4 * BINS + 3;
+
+private:
+	bool suppress = false;
+	bool auto_gain = false;
+
+	float input[FRAME_SAMPLES]; // the last frame, its second half is being filled
+	float overlap[FRAME_SAMPLES]; // overlap-add of the filtered frames
+	float output[HOP_SAMPLES]; // handed out while the next hop fills
+	int fill = 0;
+
+	float smoothed[BINS]; // power per bin, smoothed over a few hops
+	float noise[BINS]; // power of the noise floor per bin
+	float last_gain[BINS];
+	float last_snr[BINS];
+	int hops = 0; // since the reset, the noise floor is the mean of the first ones
+
+	float agc_gain = 1.0f;
+
+	void _suppress_hop();
+	void _gain_hop();
+
+public:
+	void set_noise_suppression(bool p_enabled) { suppress = p_enabled; }
+	bool is_noise_suppression() const { return suppress; }
+	void set_auto_gain(bool p_enabled) { auto_gain = p_enabled; }
+	bool is_auto_gain() const { return auto_gain; }
+	bool is_active() const { return suppress || auto_gain; }
+
+	/** In place radix-2 FFT of FRAME_SAMPLES points, the inverse is not scaled. EchoCanceller runs on the same tables. */
+	static void fft(float *p_re, float *p_im, bool p_inverse);
+
+	/** Drop the noise floor, the gain and the delayed audio, e.g. when a new recording starts. */
+	void reset();
+
+	/** The state as STATE_SIZE floats to r_state, to resume a stream on another node. */
+	void get_state(float *r_state) const;
+	/** Back to a get_state(), the enabled stages are kept. */
+	void set_state(const float *p_state);
+
+	/** Clean p_count samples in place. The first LATENCY_SAMPLES after a reset come out as silence. */
+	void process(float *p_samples, size_t p_count);
+
+	NoiseSuppressor();
+};
+
+#endif // NOISE_SUPPRESSOR_H
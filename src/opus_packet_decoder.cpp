@@ -0,0 +1,65 @@
+#include "opus_packet_decoder.h"
+
+#ifdef GODOT_WHISPER_OPUS
+#include <opus/opus.h>
+#endif
+
+/* Whisper's rate, one of the rates Opus decodes to natively. */
+static const int opus_sample_rate = 16000;
+
+bool OpusPacketDecoder::is_available() {
+#ifdef GODOT_WHISPER_OPUS
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool OpusPacketDecoder::setup() {
+#ifdef GODOT_WHISPER_OPUS
+	if (decoder == nullptr) {
+		int error = OPUS_OK;
+		decoder = opus_decoder_create(opus_sample_rate, 1, &error);
+		if (error != OPUS_OK) {
+			decoder = nullptr;
+		}
+	}
+	return decoder != nullptr;
+#else
+	return false;
+#endif
+}
+
+void OpusPacketDecoder::reset() {
+#ifdef GODOT_WHISPER_OPUS
+	if (decoder != nullptr) {
+		opus_decoder_ctl(decoder, OPUS_RESET_STATE);
+	}
+#endif
+	last_frames = opus_sample_rate / 50;
+}
+
+int OpusPacketDecoder::decode(const uint8_t *p_packet, size_t p_size, float *p_dst) {
+#ifdef GODOT_WHISPER_OPUS
+	if (!setup()) {
+		return -1;
+	}
+	if (p_packet == nullptr || p_size == 0) {
+		// Packet loss concealment, extrapolated from the state of the last packet.
+		return opus_decode_float(decoder, nullptr, 0, p_dst, last_frames, 0);
+	}
+	const int frames = opus_decode_float(decoder, p_packet, int(p_size), p_dst, MAX_FRAMES, 0);
+	if (frames > 0) {
+		last_frames = frames;
+	}
+	return frames < 0 ? -1 : frames;
+#else
+	return -1;
+#endif
+}
+
+OpusPacketDecoder::~OpusPacketDecoder() {
+#ifdef GODOT_WHISPER_OPUS
+	opus_decoder_destroy(decoder);
+#endif
+}
@@ -0,0 +1,45 @@
+#ifndef OPUS_PACKET_DECODER_H
+#define OPUS_PACKET_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct OpusDecoder;
+
+/**
+ * libopus decoder of one voice stream, set up for 16 kHz mono output. Opus
+ * decodes any packet straight to that rate, whatever it was encoded at, so
+ * its output goes to the queue without the resampler or a downmix. Only
+ * compiled in with opus=yes, without it setup() fails.
+ */
+class OpusPacketDecoder {
+public:
+	/* Frames of the longest packet, 120 ms at 16 kHz. */
+	static const int MAX_FRAMES = 1920;
+
+private:
+	OpusDecoder *decoder = nullptr;
+	int last_frames = 320; // of the last packet, a lost one is concealed with as many, 20 ms until one is seen
+
+public:
+	/** Whether the library was built with libopus. */
+	static bool is_available();
+
+	/** Create the decoder on first use. Returns false without libopus or when it fails. */
+	bool setup();
+	/** Drop the decoder state, e.g. when another talk spurt or speaker starts. */
+	void reset();
+
+	/**
+	 * Decode one packet into p_dst, MAX_FRAMES long. A null or empty packet
+	 * conceals one lost packet. Returns the frames written, -1 on a bad packet.
+	 */
+	int decode(const uint8_t *p_packet, size_t p_size, float *p_dst);
+
+	OpusPacketDecoder() {}
+	~OpusPacketDecoder();
+	OpusPacketDecoder(const OpusPacketDecoder &) = delete;
+	OpusPacketDecoder &operator=(const OpusPacketDecoder &) = delete;
+};
+
+#endif // OPUS_PACKET_DECODER_H
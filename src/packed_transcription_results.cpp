@@ -0,0 +1,138 @@
+#include "packed_transcription_results.h"
+
+#include <godot_cpp/core/error_macros.hpp>
+
+#include <cstring>
+
+void PackedTranscriptionResults::_append_text(const String &p_text) {
+	if (p_text.is_empty()) {
+		return;
+	}
+	const CharString utf8 = p_text.utf8();
+	text_scratch.append(utf8.get_data(), utf8.length());
+}
+
+void PackedTranscriptionResults::set_results(const Ref<TranscriptionResult> *p_results, int p_count) {
+	count = p_count;
+	int64_t token_count = 0;
+	for (int i = 0; i < count; i++) {
+		token_count += p_results[i]->get_token_ids().size();
+	}
+
+	// Sized once and written through ptrw(), every push_back would be a call into the engine.
+	flags.resize(count);
+	result_times.resize(int64_t(count) * 2);
+	committed_token_counts.resize(count);
+	delta_prefix_lengths.resize(count);
+	token_offsets.resize(int64_t(count) + 1);
+	token_ids.resize(token_count);
+	token_times.resize(token_count * 2);
+	token_probabilities.resize(token_count);
+	text_offsets.resize(int64_t(count) * TEXT_FIELDS + 1);
+	text_scratch.clear();
+
+	int32_t *flags_w = flags.ptrw();
+	double *result_times_w = result_times.ptrw();
+	int32_t *committed_w = committed_token_counts.ptrw();
+	int32_t *delta_w = delta_prefix_lengths.ptrw();
+	int32_t *token_offsets_w = token_offsets.ptrw();
+	int32_t *token_ids_w = token_ids.ptrw();
+	float *token_times_w = token_times.ptrw();
+	float *probabilities_w = token_probabilities.ptrw();
+	int32_t *text_offsets_w = text_offsets.ptrw();
+
+	int64_t token = 0;
+	for (int i = 0; i < count; i++) {
+		const Ref<TranscriptionResult> &result = p_results[i];
+		flags_w[i] = (result->is_partial() ? FLAG_PARTIAL : 0) |
+				(result->is_delta() ? FLAG_DELTA : 0) |
+				(result->is_repetition_aborted() ? FLAG_REPETITION_ABORTED : 0);
+		result_times_w[i * 2 + 0] = result->get_start_time();
+		result_times_w[i * 2 + 1] = result->get_end_time();
+		committed_w[i] = result->get_committed_token_count();
+		delta_w[i] = result->is_delta() ? result->get_delta_prefix_length() : 0;
+
+		token_offsets_w[i] = int32_t(token);
+		const PackedInt32Array ids = result->get_token_ids();
+		const PackedFloat32Array starts = result->get_token_start_times();
+		const PackedFloat32Array ends = result->get_token_end_times();
+		const PackedFloat32Array probabilities = result->get_token_probabilities();
+		const int64_t n = ids.size();
+		if (n > 0) {
+			memcpy(token_ids_w + token, ids.ptr(), n * sizeof(int32_t));
+		}
+		// Streamed partials have tokens but no times.
+		const float *starts_r = starts.ptr();
+		const float *ends_r = ends.ptr();
+		const float *probabilities_r = probabilities.ptr();
+		for (int64_t j = 0; j < n; j++) {
+			token_times_w[(token + j) * 2 + 0] = j < starts.size() ? starts_r[j] : 0.0f;
+			token_times_w[(token + j) * 2 + 1] = j < ends.size() ? ends_r[j] : 0.0f;
+			probabilities_w[token + j] = j < probabilities.size() ? probabilities_r[j] : 0.0f;
+		}
+		token += n;
+
+		int32_t *offsets = text_offsets_w + i * TEXT_FIELDS;
+		offsets[TEXT_COMMITTED] = int32_t(text_scratch.size());
+		_append_text(result->get_committed_text());
+		offsets[TEXT_TENTATIVE] = int32_t(text_scratch.size());
+		_append_text(result->is_delta() ? result->get_delta_text() : result->get_tentative_text());
+		offsets[TEXT_TRANSLATED] = int32_t(text_scratch.size());
+		_append_text(result->get_translated_text());
+		offsets[TEXT_LANGUAGE] = int32_t(text_scratch.size());
+		_append_text(result->get_language());
+	}
+	token_offsets_w[count] = int32_t(token);
+	text_offsets_w[int64_t(count) * TEXT_FIELDS] = int32_t(text_scratch.size());
+
+	text_utf8.resize(text_scratch.size());
+	if (!text_scratch.empty()) {
+		memcpy(text_utf8.ptrw(), text_scratch.data(), text_scratch.size());
+	}
+}
+
+String PackedTranscriptionResults::get_text(int p_result, int p_field) const {
+	ERR_FAIL_INDEX_V(p_result, count, String());
+	ERR_FAIL_INDEX_V(p_field, TEXT_FIELDS, String());
+	const int64_t index = int64_t(p_result) * TEXT_FIELDS + p_field;
+	const int32_t begin = text_offsets[index];
+	const int32_t end = text_offsets[index + 1];
+	return String::utf8((const char *)text_utf8.ptr() + begin, end - begin);
+}
+
+void PackedTranscriptionResults::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("clear"), &PackedTranscriptionResults::clear);
+	ClassDB::bind_method(D_METHOD("get_count"), &PackedTranscriptionResults::get_count);
+	ClassDB::bind_method(D_METHOD("get_flags"), &PackedTranscriptionResults::get_flags);
+	ClassDB::bind_method(D_METHOD("get_result_times"), &PackedTranscriptionResults::get_result_times);
+	ClassDB::bind_method(D_METHOD("get_committed_token_counts"), &PackedTranscriptionResults::get_committed_token_counts);
+	ClassDB::bind_method(D_METHOD("get_delta_prefix_lengths"), &PackedTranscriptionResults::get_delta_prefix_lengths);
+	ClassDB::bind_method(D_METHOD("get_token_offsets"), &PackedTranscriptionResults::get_token_offsets);
+	ClassDB::bind_method(D_METHOD("get_token_ids"), &PackedTranscriptionResults::get_token_ids);
+	ClassDB::bind_method(D_METHOD("get_token_times"), &PackedTranscriptionResults::get_token_times);
+	ClassDB::bind_method(D_METHOD("get_token_probabilities"), &PackedTranscriptionResults::get_token_probabilities);
+	ClassDB::bind_method(D_METHOD("get_text_utf8"), &PackedTranscriptionResults::get_text_utf8);
+	ClassDB::bind_method(D_METHOD("get_text_offsets"), &PackedTranscriptionResults::get_text_offsets);
+	ClassDB::bind_method(D_METHOD("get_text", "result", "field"), &PackedTranscriptionResults::get_text);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "count"), "", "get_count");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "flags"), "", "get_flags");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT64_ARRAY, "result_times"), "", "get_result_times");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "committed_token_counts"), "", "get_committed_token_counts");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "delta_prefix_lengths"), "", "get_delta_prefix_lengths");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "token_offsets"), "", "get_token_offsets");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "token_ids"), "", "get_token_ids");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "token_times"), "", "get_token_times");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "token_probabilities"), "", "get_token_probabilities");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_BYTE_ARRAY, "text_utf8"), "", "get_text_utf8");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "text_offsets"), "", "get_text_offsets");
+
+	BIND_ENUM_CONSTANT(TEXT_COMMITTED);
+	BIND_ENUM_CONSTANT(TEXT_TENTATIVE);
+	BIND_ENUM_CONSTANT(TEXT_TRANSLATED);
+	BIND_ENUM_CONSTANT(TEXT_LANGUAGE);
+	BIND_ENUM_CONSTANT(TEXT_FIELDS);
+
+	BIND_ENUM_CONSTANT(FLAG_PARTIAL);
+	BIND_ENUM_CONSTANT(FLAG_DELTA);
+	BIND_ENUM_CONSTANT(FLAG_REPETITION_ABORTED);
+}
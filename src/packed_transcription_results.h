@@ -0,0 +1,93 @@
+#ifndef PACKED_TRANSCRIPTION_RESULTS_H
+#define PACKED_TRANSCRIPTION_RESULTS_H
+
+#include "transcription_result.h"
+
+#include <godot_cpp/classes/ref_counted.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/packed_float32_array.hpp>
+#include <godot_cpp/variant/packed_float64_array.hpp>
+#include <godot_cpp/variant/packed_int32_array.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <string>
+
+using namespace godot;
+
+/**
+ * A batch of transcription results laid out in packed arrays, for languages
+ * where every Object, Array and String that crosses from a Variant costs, e.g.
+ * C#. Result i has the tokens from token_offsets[i] to token_offsets[i + 1],
+ * two token_times (start and end) per token, two result_times and its texts
+ * as UTF-8 in text_utf8: TEXT_FIELDS of them from
+ * text_offsets[i * TEXT_FIELDS], each ending where the next one starts.
+ * Filled again by every SpeechToTextStream.poll_packed_results() and
+ * update_transcribed_packed, which keep the storage of the arrays.
+ */
+class PackedTranscriptionResults : public RefCounted {
+	GDCLASS(PackedTranscriptionResults, RefCounted);
+
+public:
+	enum TextField {
+		TEXT_COMMITTED,
+		TEXT_TENTATIVE, // delta_text for a delta
+		TEXT_TRANSLATED,
+		TEXT_LANGUAGE,
+		TEXT_FIELDS,
+	};
+
+	enum ResultFlag {
+		FLAG_PARTIAL = 1,
+		FLAG_DELTA = 2,
+		FLAG_REPETITION_ABORTED = 4,
+	};
+
+private:
+	int count = 0;
+	PackedInt32Array flags;
+	PackedFloat64Array result_times;
+	PackedInt32Array committed_token_counts;
+	PackedInt32Array delta_prefix_lengths;
+	PackedInt32Array token_offsets;
+	PackedInt32Array token_ids;
+	PackedFloat32Array token_times;
+	PackedFloat32Array token_probabilities;
+	PackedByteArray text_utf8;
+	PackedInt32Array text_offsets;
+	std::string text_scratch; // text_utf8 while it is laid out
+
+	void _append_text(const String &p_text);
+
+protected:
+	static void _bind_methods();
+
+public:
+	/** Replace the batch with p_count results. */
+	void set_results(const Ref<TranscriptionResult> *p_results, int p_count);
+	void clear() { set_results(nullptr, 0); }
+
+	_FORCE_INLINE_ int get_count() const { return count; }
+	/** ResultFlag bits per result. */
+	_FORCE_INLINE_ PackedInt32Array get_flags() const { return flags; }
+	/** start_time and end_time of each result, in seconds. */
+	_FORCE_INLINE_ PackedFloat64Array get_result_times() const { return result_times; }
+	_FORCE_INLINE_ PackedInt32Array get_committed_token_counts() const { return committed_token_counts; }
+	/** In characters of the text, like TranscriptionResult.delta_prefix_length. 0 unless FLAG_DELTA. */
+	_FORCE_INLINE_ PackedInt32Array get_delta_prefix_lengths() const { return delta_prefix_lengths; }
+	/** count + 1 entries, the tokens of result i end where those of i + 1 start. */
+	_FORCE_INLINE_ PackedInt32Array get_token_offsets() const { return token_offsets; }
+	_FORCE_INLINE_ PackedInt32Array get_token_ids() const { return token_ids; }
+	/** Start and end of each token, 0 for the tokens of streamed partials. */
+	_FORCE_INLINE_ PackedFloat32Array get_token_times() const { return token_times; }
+	_FORCE_INLINE_ PackedFloat32Array get_token_probabilities() const { return token_probabilities; }
+	_FORCE_INLINE_ PackedByteArray get_text_utf8() const { return text_utf8; }
+	/** count * TEXT_FIELDS + 1 byte offsets into text_utf8. */
+	_FORCE_INLINE_ PackedInt32Array get_text_offsets() const { return text_offsets; }
+	/** One text of a result as a String, for scripts that do not mind building it. */
+	String get_text(int p_result, int p_field) const;
+};
+
+VARIANT_ENUM_CAST(PackedTranscriptionResults::TextField);
+VARIANT_ENUM_CAST(PackedTranscriptionResults::ResultFlag);
+
+#endif // PACKED_TRANSCRIPTION_RESULTS_H
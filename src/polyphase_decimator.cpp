@@ -0,0 +1,145 @@
+#include "polyphase_decimator.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define POLYPHASE_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define POLYPHASE_NEON
+#endif
+
+using namespace godot;
+
+/* Half amplitude point of the low-pass. Whisper's mel bank ends at 8 kHz, the transition band sits right below it. */
+static const double cutoff_hz = 7200.0;
+/* Kaiser window shape, about 60 dB of stop band attenuation. */
+static const double kaiser_beta = 6.0;
+
+static float _dot(const float *p_a, const float *p_b, int p_count) {
+	int i = 0;
+	float sum = 0.0f;
+#if defined(POLYPHASE_SSE2)
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	for (; i + 8 <= p_count; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(p_a + i), _mm_loadu_ps(p_b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(p_a + i + 4), _mm_loadu_ps(p_b + i + 4)));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(POLYPHASE_NEON)
+	float32x4_t acc0 = vdupq_n_f32(0.0f);
+	float32x4_t acc1 = vdupq_n_f32(0.0f);
+	for (; i + 8 <= p_count; i += 8) {
+		acc0 = vmlaq_f32(acc0, vld1q_f32(p_a + i), vld1q_f32(p_b + i));
+		acc1 = vmlaq_f32(acc1, vld1q_f32(p_a + i + 4), vld1q_f32(p_b + i + 4));
+	}
+	const float32x4_t acc = vaddq_f32(acc0, acc1);
+	sum = (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#endif
+	for (; i < p_count; i++) {
+		sum += p_a[i] * p_b[i];
+	}
+	return sum;
+}
+
+/* Zeroth order modified Bessel function of the first kind, for the Kaiser window. */
+static double _bessel_i0(double p_x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (p_x / (2.0 * k)) * (p_x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+static PolyphaseDecimator::Filter _design_filter(int p_up, int p_down, double p_src_rate) {
+	PolyphaseDecimator::Filter filter;
+	filter.up = p_up;
+	filter.down = p_down;
+	const int taps = PolyphaseDecimator::TAPS;
+	const int length = taps * p_up;
+	const double fc = cutoff_hz / (p_src_rate * p_up); // relative to the upsampled rate
+	const double center = (length - 1) / 2.0;
+	std::vector<double> prototype(length);
+	for (int j = 0; j < length; j++) {
+		const double x = j - center;
+		const double sinc = x == 0.0 ? 2.0 * fc : sin(2.0 * Math_PI * fc * x) / (Math_PI * x);
+		const double r = 2.0 * x / (length - 1);
+		prototype[j] = sinc * _bessel_i0(kaiser_beta * sqrt(MAX(0.0, 1.0 - r * r))) / _bessel_i0(kaiser_beta);
+	}
+	filter.taps.resize(length);
+	for (int p = 0; p < p_up; p++) {
+		double sum = 0.0;
+		for (int k = 0; k < taps; k++) {
+			sum += prototype[p + k * p_up];
+		}
+		// Every phase gets unit gain, so DC passes unchanged whatever the phase.
+		for (int k = 0; k < taps; k++) {
+			filter.taps[p * taps + (taps - 1 - k)] = float(prototype[p + k * p_up] / sum);
+		}
+	}
+	return filter;
+}
+
+const PolyphaseDecimator::Filter *PolyphaseDecimator::_get_filter(uint32_t p_src_rate, uint32_t p_dst_rate) {
+	if (p_dst_rate != 16000) {
+		return nullptr;
+	}
+	if (p_src_rate == 48000) {
+		static const Filter filter_48000 = _design_filter(1, 3, 48000.0);
+		return &filter_48000;
+	}
+	if (p_src_rate == 44100) {
+		static const Filter filter_44100 = _design_filter(160, 441, 44100.0);
+		return &filter_44100;
+	}
+	return nullptr;
+}
+
+bool PolyphaseDecimator::supports(uint32_t p_src_rate, uint32_t p_dst_rate) {
+	return (p_src_rate == 48000 || p_src_rate == 44100) && p_dst_rate == 16000;
+}
+
+bool PolyphaseDecimator::setup(uint32_t p_src_rate, uint32_t p_dst_rate) {
+	filter = supports(p_src_rate, p_dst_rate) ? _get_filter(p_src_rate, p_dst_rate) : nullptr;
+	reset();
+	return filter != nullptr;
+}
+
+void PolyphaseDecimator::reset() {
+	work.assign(TAPS - 1, 0.0f);
+	phase = 0;
+	next_frame = 0;
+}
+
+uint32_t PolyphaseDecimator::process(const float *p_src, uint32_t p_frames, float *p_dst, uint32_t p_dst_capacity) {
+	if (filter == nullptr) {
+		return 0;
+	}
+	const size_t history = TAPS - 1;
+	work.resize(history + p_frames);
+	memcpy(work.data() + history, p_src, size_t(p_frames) * sizeof(float));
+
+	uint32_t written = 0;
+	while (next_frame < p_frames && written < p_dst_capacity) {
+		// The window ends at input frame next_frame.
+		p_dst[written++] = _dot(filter->taps.data() + size_t(phase) * TAPS, work.data() + next_frame, TAPS);
+		phase += filter->down;
+		next_frame += phase / filter->up;
+		phase %= filter->up;
+	}
+	// Outputs that did not fit are dropped rather than delayed.
+	next_frame = next_frame < p_frames ? 0 : next_frame - p_frames;
+
+	memmove(work.data(), work.data() + p_frames, history * sizeof(float));
+	work.resize(history);
+	return written;
+}
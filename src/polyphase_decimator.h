@@ -0,0 +1,47 @@
+#ifndef POLYPHASE_DECIMATOR_H
+#define POLYPHASE_DECIMATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Rational L/M resampler for the rates Godot mixes at, 48 kHz (1/3) and
+ * 44.1 kHz (160/441), down to 16 kHz. The low-pass is a Kaiser windowed
+ * sinc computed once per ratio and split into L phases, so every output
+ * frame is a single dot product over the input history.
+ */
+class PolyphaseDecimator {
+public:
+	/* Taps per phase, in input frames. */
+	static const int TAPS = 96;
+
+	struct Filter {
+		int up = 1; // L
+		int down = 1; // M
+		std::vector<float> taps; // up phases of TAPS taps, each reversed to run forward over the input
+	};
+
+private:
+	const Filter *filter = nullptr;
+	std::vector<float> work; // TAPS - 1 frames of history followed by the chunk being processed
+	int phase = 0; // position of the next output between two input frames, in 1/up steps
+	size_t next_frame = 0; // newest input frame of the next output, counted from the chunk start
+
+	static const Filter *_get_filter(uint32_t p_src_rate, uint32_t p_dst_rate);
+
+public:
+	/** Whether p_src_rate to p_dst_rate has a precomputed filter. */
+	static bool supports(uint32_t p_src_rate, uint32_t p_dst_rate);
+
+	/** Select the filter for the rates and drop the history. Returns false when unsupported. */
+	bool setup(uint32_t p_src_rate, uint32_t p_dst_rate);
+	void reset();
+
+	/** Resample p_frames mono frames into p_dst, returns the number of frames written. */
+	uint32_t process(const float *p_src, uint32_t p_frames, float *p_dst, uint32_t p_dst_capacity);
+
+	PolyphaseDecimator() {}
+};
+
+#endif // POLYPHASE_DECIMATOR_H
@@ -1,9 +1,20 @@
 #include "register_types.h"
 
+#include "audio_effect_whisper_capture.h"
+#include "microphone_capture.h"
+#include "model_downloader.h"
+#include "packed_transcription_results.h"
+#include "resource_importer_whisper.h"
 #include "resource_loader_whisper.h"
 #include "resource_whisper.h"
+#include "shared_memory_capture.h"
 #include "speech_to_text.h"
+#include "speech_to_text_benchmark.h"
+#include "speech_to_text_stream.h"
+#include "transcription_job.h"
+#include "transcription_result.h"
 
+#include <godot_cpp/classes/editor_plugin_registration.hpp>
 #include <godot_cpp/classes/resource_loader.hpp>
 
 static Ref<ResourceFormatLoaderWhisper> whisper_loader;
@@ -11,12 +22,30 @@ static Ref<ResourceFormatLoaderWhisper> whisper_loader;
 static SpeechToText *SpeechToTextPtr;
 
 void initialize_whisper_module(ModuleInitializationLevel p_level) {
+	if (p_level == MODULE_INITIALIZATION_LEVEL_EDITOR) {
+		GDREGISTER_CLASS(ResourceImporterWhisper);
+		GDREGISTER_CLASS(WhisperEditorPlugin);
+		EditorPlugins::add_by_type<WhisperEditorPlugin>();
+		return;
+	}
 	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
 		return;
 	}
 	GDREGISTER_CLASS(SpeechToText);
+	GDREGISTER_CLASS(SpeechToTextStream);
+	GDREGISTER_CLASS(TranscriptionResult);
+	GDREGISTER_CLASS(PackedTranscriptionResults);
+	GDREGISTER_CLASS(TranscriptionJob);
+	GDREGISTER_CLASS(SpeechToTextBenchmark);
+	GDREGISTER_CLASS(AudioEffectWhisperCaptureInstance);
+	GDREGISTER_CLASS(AudioEffectWhisperCapture);
+	GDREGISTER_CLASS(AudioEffectWhisperReferenceInstance);
+	GDREGISTER_CLASS(AudioEffectWhisperReference);
+	GDREGISTER_CLASS(MicrophoneCapture);
+	GDREGISTER_CLASS(SharedMemoryCapture);
 	GDREGISTER_CLASS(WhisperResource);
 	GDREGISTER_CLASS(ResourceFormatLoaderWhisper);
+	GDREGISTER_CLASS(ModelDownloader);
 	whisper_loader.instantiate();
 	ResourceLoader::get_singleton()->add_resource_format_loader(whisper_loader);
 
@@ -25,6 +54,10 @@ void initialize_whisper_module(ModuleInitializationLevel p_level) {
 }
 
 void uninitialize_whisper_module(ModuleInitializationLevel p_level) {
+	if (p_level == MODULE_INITIALIZATION_LEVEL_EDITOR) {
+		EditorPlugins::remove_by_type<WhisperEditorPlugin>();
+		return;
+	}
 	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
 		return;
 	}
@@ -0,0 +1,227 @@
+#include "remote_inference.h"
+#include "audio_sample_convert.h"
+
+#include <godot_cpp/classes/json.hpp>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/classes/tls_options.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+
+#include <cstring>
+
+/* Sleep between two polls of the connection. */
+static const int poll_interval_usec = 500;
+/* A node is given this long to report its load, picking one takes at most half the budget. */
+static const uint64_t load_timeout_usec = 250000;
+/* Real time factor of a node that did not decode anything yet, so its queue still counts. */
+static const double min_rtf = 0.01;
+
+static void _write_le(uint8_t *p_dst, uint32_t p_value, int p_bytes) {
+	for (int i = 0; i < p_bytes; i++) {
+		p_dst[i] = uint8_t(p_value >> (8 * i));
+	}
+}
+
+bool RemoteInference::_parse_url(const std::string &p_url) {
+	const String address = String::utf8(p_url.c_str());
+	String rest = address;
+	tls = false;
+	if (address.begins_with("https://")) {
+		tls = true;
+		rest = address.substr(8);
+	} else if (address.begins_with("http://")) {
+		rest = address.substr(7);
+	}
+	const int slash = rest.find("/");
+	const String authority = slash >= 0 ? rest.substr(0, slash) : rest;
+	path = slash >= 0 ? rest.substr(slash) : String("/inference");
+	const int colon = authority.rfind(":");
+	host = colon >= 0 ? authority.substr(0, colon) : authority;
+	port = colon >= 0 ? authority.substr(colon + 1).to_int() : (tls ? 443 : 80);
+	return !host.is_empty() && port > 0;
+}
+
+bool RemoteInference::_poll_while(HTTPClient::Status p_status, uint64_t p_deadline_usec) {
+	Time *time = Time::get_singleton();
+	while (client->get_status() == p_status) {
+		if (time->get_ticks_usec() > p_deadline_usec) {
+			return false;
+		}
+		client->poll();
+		OS::get_singleton()->delay_usec(poll_interval_usec);
+	}
+	return true;
+}
+
+bool RemoteInference::_connect(uint64_t p_deadline_usec) {
+	if (client.is_valid() && client->get_status() == HTTPClient::STATUS_CONNECTED) {
+		return true;
+	}
+	if (client.is_null()) {
+		client.instantiate();
+	}
+	client->close();
+	if (client->connect_to_host(host, port, tls ? TLSOptions::client() : Ref<TLSOptions>()) != OK) {
+		return false;
+	}
+	if (!_poll_while(HTTPClient::STATUS_RESOLVING, p_deadline_usec) || !_poll_while(HTTPClient::STATUS_CONNECTING, p_deadline_usec)) {
+		return false;
+	}
+	return client->get_status() == HTTPClient::STATUS_CONNECTED;
+}
+
+bool RemoteInference::_request(const std::string &p_url, HTTPClient::Method p_method, const String &p_path, const PackedStringArray &p_headers, const PackedByteArray &p_body, uint64_t p_deadline_usec, PackedByteArray &r_response) {
+	if (p_url != url) {
+		close();
+		if (!_parse_url(p_url)) {
+			return false;
+		}
+		url = p_url;
+	}
+	if (!_connect(p_deadline_usec)) {
+		close();
+		return false;
+	}
+	if (client->request_raw(p_method, p_path.is_empty() ? path : p_path, p_headers, p_body) != OK || !_poll_while(HTTPClient::STATUS_REQUESTING, p_deadline_usec)) {
+		close();
+		return false;
+	}
+	if (client->get_status() != HTTPClient::STATUS_BODY || client->get_response_code() != 200) {
+		close();
+		return false;
+	}
+	r_response.clear();
+	Time *time = Time::get_singleton();
+	while (client->get_status() == HTTPClient::STATUS_BODY) {
+		if (time->get_ticks_usec() > p_deadline_usec) {
+			close();
+			return false;
+		}
+		client->poll();
+		const PackedByteArray chunk = client->read_response_body_chunk();
+		if (chunk.is_empty()) {
+			OS::get_singleton()->delay_usec(poll_interval_usec);
+		} else {
+			r_response.append_array(chunk);
+		}
+	}
+	return true;
+}
+
+double RemoteInference::_query_load(const std::string &p_url, uint64_t p_deadline_usec) {
+	PackedByteArray response;
+	if (!_request(p_url, HTTPClient::METHOD_GET, "/load", PackedStringArray(), PackedByteArray(), p_deadline_usec, response)) {
+		return -1.0;
+	}
+	const Variant reply = JSON::parse_string(response.get_string_from_utf8());
+	if (reply.get_type() != Variant::DICTIONARY) {
+		return -1.0;
+	}
+	const Dictionary load = reply;
+	const double workers = MAX(1.0, double(load.get("workers", 1)));
+	const double queued = double(load.get("queue_depth", 0)) + double(load.get("busy_workers", 0));
+	// The utterances ahead of it are shared by the workers, then it is decoded itself.
+	return (queued / workers + 1.0) * MAX(min_rtf, double(load.get("rtf", 0.0)));
+}
+
+std::string RemoteInference::_pick_node(const std::string &p_urls, uint64_t p_deadline_usec) {
+	PackedStringArray urls;
+	const PackedStringArray parts = String::utf8(p_urls.c_str()).split(",", false);
+	for (int i = 0; i < parts.size(); i++) {
+		if (!parts[i].strip_edges().is_empty()) {
+			urls.push_back(parts[i].strip_edges());
+		}
+	}
+	if (urls.size() <= 1) {
+		return urls.is_empty() ? std::string() : std::string(urls[0].utf8().get_data());
+	}
+	Time *time = Time::get_singleton();
+	const uint64_t pick_deadline_usec = time->get_ticks_usec() + (p_deadline_usec - MIN(p_deadline_usec, time->get_ticks_usec())) / 2;
+	// Without any load reported, streams are spread over the nodes by their name.
+	int best = int(uint32_t(stream_id.hash()) % uint32_t(urls.size()));
+	double best_load = -1.0;
+	for (int i = 0; i < urls.size(); i++) {
+		const uint64_t deadline_usec = MIN(pick_deadline_usec, time->get_ticks_usec() + load_timeout_usec);
+		const double load = _query_load(urls[i].utf8().get_data(), deadline_usec);
+		if (load >= 0.0 && (best_load < 0.0 || load < best_load)) {
+			best = i;
+			best_load = load;
+		}
+	}
+	return urls[best].utf8().get_data();
+}
+
+void RemoteInference::_build_body(const float *p_samples, size_t p_count, const String &p_boundary) {
+	// whisper.cpp's server ignores the stream, bin/whisper_stream_server continues its context.
+	const CharString head = ("--" + p_boundary + "\r\nContent-Disposition: form-data; name=\"response-format\"\r\n\r\njson\r\n" +
+			"--" + p_boundary + "\r\nContent-Disposition: form-data; name=\"stream\"\r\n\r\n" + stream_id + "\r\n" +
+			"--" + p_boundary + "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"speech.wav\"\r\nContent-Type: audio/wav\r\n\r\n")
+									.utf8();
+	const CharString tail = ("\r\n--" + p_boundary + "--\r\n").utf8();
+	const uint32_t data_bytes = uint32_t(p_count * sizeof(int16_t));
+	const int wav_header_bytes = 44;
+	body.resize(head.length() + wav_header_bytes + data_bytes + tail.length());
+	uint8_t *dst = body.ptrw();
+	memcpy(dst, head.get_data(), head.length());
+	dst += head.length();
+	// RIFF header of 16 kHz mono 16-bit PCM.
+	memcpy(dst, "RIFF", 4);
+	_write_le(dst + 4, 36 + data_bytes, 4);
+	memcpy(dst + 8, "WAVEfmt ", 8);
+	_write_le(dst + 16, 16, 4);
+	_write_le(dst + 20, 1, 2);
+	_write_le(dst + 22, 1, 2);
+	_write_le(dst + 24, 16000, 4);
+	_write_le(dst + 28, 16000 * sizeof(int16_t), 4);
+	_write_le(dst + 32, sizeof(int16_t), 2);
+	_write_le(dst + 34, 16, 2);
+	memcpy(dst + 36, "data", 4);
+	_write_le(dst + 40, data_bytes, 4);
+	dst += wav_header_bytes;
+	// Little endian like every platform Godot runs on.
+	audio_f32_to_s16(p_samples, p_count, reinterpret_cast<int16_t *>(dst));
+	dst += data_bytes;
+	memcpy(dst, tail.get_data(), tail.length());
+}
+
+bool RemoteInference::transcribe(const std::string &p_url, const float *p_samples, size_t p_count, int p_budget_ms, String &r_text) {
+	const uint64_t deadline_usec = Time::get_singleton()->get_ticks_usec() + uint64_t(p_budget_ms) * 1000;
+	if (p_url != nodes || node_url.empty()) {
+		nodes = p_url;
+		node_url = _pick_node(p_url, deadline_usec);
+	}
+	const String boundary = "godot-whisper-utterance";
+	_build_body(p_samples, p_count, boundary);
+	PackedStringArray headers;
+	headers.push_back("Content-Type: multipart/form-data; boundary=" + boundary);
+	PackedByteArray response;
+	if (!_request(node_url, HTTPClient::METHOD_POST, String(), headers, body, deadline_usec, response)) {
+		node_url.clear();
+		return false;
+	}
+	const Variant reply = JSON::parse_string(response.get_string_from_utf8());
+	if (reply.get_type() != Variant::DICTIONARY || !Dictionary(reply).has("text")) {
+		node_url.clear();
+		return false;
+	}
+	r_text = String(Dictionary(reply)["text"]).strip_edges();
+	return true;
+}
+
+void RemoteInference::close() {
+	if (client.is_valid()) {
+		client->close();
+	}
+}
+
+void RemoteInference::reset() {
+	close();
+	nodes.clear();
+	node_url.clear();
+	stream_id = String::num_int64(UtilityFunctions::randi(), 16) + String::num_int64(UtilityFunctions::randi(), 16);
+}
+
+RemoteInference::RemoteInference() {
+	reset();
+}
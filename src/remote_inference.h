@@ -0,0 +1,67 @@
+#ifndef REMOTE_INFERENCE_H
+#define REMOTE_INFERENCE_H
+
+#include <godot_cpp/classes/http_client.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/packed_string_array.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace godot;
+
+/**
+ * Client of the /inference endpoint of the whisper.cpp server
+ * (thirdparty/whisper.cpp/examples/server), for streams that offload their
+ * decoding. One utterance goes out as a 16 kHz 16-bit WAV in a multipart
+ * form and the "text" of the JSON reply comes back, over an HTTP/1.1
+ * connection kept alive between requests. Blocking with a deadline, a
+ * request that runs out of time is dropped together with its connection.
+ *
+ * Given several servers, the first request of a stream asks each one for
+ * its /load, as served by bin/whisper_stream_server, and goes to the least
+ * loaded. The stream stays on that node until a request to it fails, and
+ * names itself in every request so the node continues its context.
+ */
+class RemoteInference {
+	Ref<HTTPClient> client;
+	std::string url; // the connection is to this one
+	std::string nodes; // the list the node was picked from
+	std::string node_url; // of the stream, empty until the next request picks one
+	String stream_id;
+	String host;
+	int port = 80;
+	String path;
+	bool tls = false;
+	PackedByteArray body; // of the last request, reused
+
+	bool _parse_url(const std::string &p_url);
+	/* Poll while the client is in p_status, false once p_deadline_usec passed. */
+	bool _poll_while(HTTPClient::Status p_status, uint64_t p_deadline_usec);
+	bool _connect(uint64_t p_deadline_usec);
+	/* Connect to p_url when not yet, send the request to p_path, the path of p_url when empty, and read the reply. False unless it is a 200. */
+	bool _request(const std::string &p_url, HTTPClient::Method p_method, const String &p_path, const PackedStringArray &p_headers, const PackedByteArray &p_body, uint64_t p_deadline_usec, PackedByteArray &r_response);
+	/* How long the node at p_url would take for an utterance, in utterance lengths, negative when it does not report its load. */
+	double _query_load(const std::string &p_url, uint64_t p_deadline_usec);
+	std::string _pick_node(const std::string &p_urls, uint64_t p_deadline_usec);
+	void _build_body(const float *p_samples, size_t p_count, const String &p_boundary);
+
+public:
+	/**
+	 * Transcribe p_count samples at 16 kHz on the server at p_url, e.g.
+	 * http://127.0.0.1:8080/inference, or on the node of the stream among
+	 * several separated by commas. Returns false when it failed or did not
+	 * answer within p_budget_ms.
+	 */
+	bool transcribe(const std::string &p_url, const float *p_samples, size_t p_count, int p_budget_ms, String &r_text);
+	/** Drop the connection. */
+	void close();
+	/** Start a new stream, the next request picks a node and starts a new context there. */
+	void reset();
+
+	RemoteInference();
+};
+
+#endif // REMOTE_INFERENCE_H
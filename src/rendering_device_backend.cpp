@@ -0,0 +1,678 @@
+#include "rendering_device_backend.h"
+
+#include "host_backend_tensors.h"
+
+#include <godot_cpp/classes/rd_shader_source.hpp>
+#include <godot_cpp/classes/rd_shader_spirv.hpp>
+#include <godot_cpp/classes/rd_uniform.hpp>
+#include <godot_cpp/classes/rendering_server.hpp>
+#include <godot_cpp/core/math.hpp>
+#include <godot_cpp/core/memory.hpp>
+#include <godot_cpp/variant/typed_array.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+
+#include <cstring>
+#include <vector>
+
+std::mutex RenderingDeviceCompute::instance_mutex;
+std::weak_ptr<RenderingDeviceCompute> RenderingDeviceCompute::instance;
+
+/* The shape CLBlast offloads from, smaller products are faster on the CPU than the copies. */
+static const int64_t min_mul_mat_size = 32;
+/* soft_max and norm only make up for their copies on large activations, e.g. the attention of the encoder. */
+static const int64_t min_row_op_elements = 1 << 16;
+/* Workgroups along x of the row kernels, more rows go to y. */
+static const uint32_t max_groups_x = 65535;
+/* Scratch buffers grow to the next power of two from this. */
+static const uint32_t min_scratch_size = 1 << 16;
+
+static const char *mul_mat_shader = R"(
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+
+layout(set = 0, binding = 0, std430) restrict readonly buffer Src0 { SRC0_TYPE data[]; } src0;
+layout(set = 0, binding = 1, std430) restrict readonly buffer Src1 { float data[]; } src1;
+layout(set = 0, binding = 2, std430) restrict writeonly buffer Dst { float data[]; } dst;
+
+layout(push_constant, std430) uniform Params {
+	uint ne00; uint ne01; uint ne11; uint ne12;
+	uint r2; uint r3; uint nb01; uint nb02;
+	uint nb03; uint nb11; uint nb12; uint nb13;
+	uint off0; uint off1; uint pad0; uint pad1;
+} p;
+
+shared float tile0[16][17];
+shared float tile1[16][17];
+
+float load0(uint i) {
+#ifdef SRC0_F16
+	vec2 pair = unpackHalf2x16(src0.data[i >> 1]);
+	return (i & 1u) == 0u ? pair.x : pair.y;
+#else
+	return src0.data[i];
+#endif
+}
+
+void main() {
+	const uint lx = gl_LocalInvocationID.x;
+	const uint ly = gl_LocalInvocationID.y;
+	const uint row0 = gl_WorkGroupID.x * 16u;
+	const uint row1 = gl_WorkGroupID.y * 16u;
+	const uint i12 = gl_WorkGroupID.z % p.ne12;
+	const uint i13 = gl_WorkGroupID.z / p.ne12;
+	const uint base0 = p.off0 + (i12 / p.r2) * p.nb02 + (i13 / p.r3) * p.nb03;
+	const uint base1 = p.off1 + i12 * p.nb12 + i13 * p.nb13;
+	float sum = 0.0;
+	for (uint k0 = 0u; k0 < p.ne00; k0 += 16u) {
+		const uint k = k0 + lx;
+		tile0[ly][lx] = row0 + ly < p.ne01 && k < p.ne00 ? load0(base0 + (row0 + ly) * p.nb01 + k) : 0.0;
+		tile1[ly][lx] = row1 + ly < p.ne11 && k < p.ne00 ? src1.data[base1 + (row1 + ly) * p.nb11 + k] : 0.0;
+		barrier();
+		for (uint kk = 0u; kk < 16u; kk++) {
+			sum += tile0[lx][kk] * tile1[ly][kk];
+		}
+		barrier();
+	}
+	if (row0 + lx < p.ne01 && row1 + ly < p.ne11) {
+		dst.data[(gl_WorkGroupID.z * p.ne11 + row1 + ly) * p.ne01 + row0 + lx] = sum;
+	}
+}
+)";
+
+static const char *soft_max_shader = R"(
+layout(local_size_x = 128, local_size_y = 1, local_size_z = 1) in;
+
+layout(set = 0, binding = 0, std430) restrict readonly buffer Src0 { float data[]; } src0;
+layout(set = 0, binding = 1, std430) restrict readonly buffer Mask { float data[]; } mask;
+layout(set = 0, binding = 2, std430) restrict buffer Dst { float data[]; } dst;
+
+layout(push_constant, std430) uniform Params {
+	uint nc; uint nrows; uint ne11; uint has_mask;
+	uint nb01; uint nb11; uint off0; uint off1;
+	uint groups_x; float scale; uint pad0; uint pad1;
+} p;
+
+shared float reduce[128];
+
+void main() {
+	const uint row = gl_WorkGroupID.y * p.groups_x + gl_WorkGroupID.x;
+	if (row >= p.nrows) {
+		return;
+	}
+	const uint lid = gl_LocalInvocationID.x;
+	const uint src_row = p.off0 + row * p.nb01;
+	const uint mask_row = p.off1 + (row % p.ne11) * p.nb11;
+	const uint dst_row = row * p.nc;
+	const float minus_inf = uintBitsToFloat(0xff800000u);
+	float row_max = minus_inf;
+	for (uint i = lid; i < p.nc; i += 128u) {
+		float v = src0.data[src_row + i] * p.scale;
+		if (p.has_mask != 0u) {
+			v += mask.data[mask_row + i];
+		}
+		dst.data[dst_row + i] = v;
+		row_max = max(row_max, v);
+	}
+	reduce[lid] = row_max;
+	barrier();
+	for (uint s = 64u; s > 0u; s >>= 1u) {
+		if (lid < s) {
+			reduce[lid] = max(reduce[lid], reduce[lid + s]);
+		}
+		barrier();
+	}
+	row_max = reduce[0];
+	barrier();
+	float sum = 0.0;
+	for (uint i = lid; i < p.nc; i += 128u) {
+		const float v = dst.data[dst_row + i];
+		const float e = v == minus_inf ? 0.0 : exp(v - row_max);
+		dst.data[dst_row + i] = e;
+		sum += e;
+	}
+	reduce[lid] = sum;
+	barrier();
+	for (uint s = 64u; s > 0u; s >>= 1u) {
+		if (lid < s) {
+			reduce[lid] += reduce[lid + s];
+		}
+		barrier();
+	}
+	const float inv_sum = reduce[0] > 0.0 ? 1.0 / reduce[0] : 0.0;
+	for (uint i = lid; i < p.nc; i += 128u) {
+		dst.data[dst_row + i] *= inv_sum;
+	}
+}
+)";
+
+static const char *norm_shader = R"(
+layout(local_size_x = 128, local_size_y = 1, local_size_z = 1) in;
+
+layout(set = 0, binding = 0, std430) restrict readonly buffer Src0 { float data[]; } src0;
+layout(set = 0, binding = 1, std430) restrict writeonly buffer Dst { float data[]; } dst;
+
+layout(push_constant, std430) uniform Params {
+	uint ne00; uint nrows; uint off0; uint groups_x;
+	float eps; uint pad0; uint pad1; uint pad2;
+} p;
+
+shared float reduce[128];
+
+float row_sum(float value) {
+	const uint lid = gl_LocalInvocationID.x;
+	reduce[lid] = value;
+	barrier();
+	for (uint s = 64u; s > 0u; s >>= 1u) {
+		if (lid < s) {
+			reduce[lid] += reduce[lid + s];
+		}
+		barrier();
+	}
+	const float sum = reduce[0];
+	barrier();
+	return sum;
+}
+
+void main() {
+	const uint row = gl_WorkGroupID.y * p.groups_x + gl_WorkGroupID.x;
+	if (row >= p.nrows) {
+		return;
+	}
+	const uint lid = gl_LocalInvocationID.x;
+	const uint src_row = p.off0 + row * p.ne00;
+	const uint dst_row = row * p.ne00;
+	float sum = 0.0;
+	for (uint i = lid; i < p.ne00; i += 128u) {
+		sum += src0.data[src_row + i];
+	}
+	const float mean = row_sum(sum) / float(p.ne00);
+	float sum2 = 0.0;
+	for (uint i = lid; i < p.ne00; i += 128u) {
+		const float v = src0.data[src_row + i] - mean;
+		sum2 += v * v;
+	}
+	const float scale = inversesqrt(row_sum(sum2) / float(p.ne00) + p.eps);
+	for (uint i = lid; i < p.ne00; i += 128u) {
+		dst.data[dst_row + i] = (src0.data[src_row + i] - mean) * scale;
+	}
+}
+)";
+
+struct MulMatPushConstant {
+	uint32_t ne00, ne01, ne11, ne12;
+	uint32_t r2, r3, nb01, nb02;
+	uint32_t nb03, nb11, nb12, nb13;
+	uint32_t off0, off1, pad0, pad1;
+};
+
+struct SoftMaxPushConstant {
+	uint32_t nc, nrows, ne11, has_mask;
+	uint32_t nb01, nb11, off0, off1;
+	uint32_t groups_x;
+	float scale;
+	uint32_t pad0, pad1;
+};
+
+struct NormPushConstant {
+	uint32_t ne00, nrows, off0, groups_x;
+	float eps;
+	uint32_t pad0, pad1, pad2;
+};
+
+bool RenderingDeviceCompute::supports_op(const ggml_tensor *p_node) {
+	if (p_node->type != GGML_TYPE_F32 || !ggml_is_contiguous(p_node)) {
+		return false;
+	}
+	const ggml_tensor *src0 = p_node->src[0];
+	const ggml_tensor *src1 = p_node->src[1];
+	switch (p_node->op) {
+		case GGML_OP_MUL_MAT:
+			return (src0->type == GGML_TYPE_F32 || src0->type == GGML_TYPE_F16) && src1->type == GGML_TYPE_F32 &&
+					host_backend_has_element_strides(src0) && host_backend_has_element_strides(src1) &&
+					src0->ne[0] >= min_mul_mat_size && src0->ne[1] >= min_mul_mat_size && src1->ne[1] >= min_mul_mat_size &&
+					src1->ne[2] % src0->ne[2] == 0 && src1->ne[3] % src0->ne[3] == 0 && src1->ne[2] * src1->ne[3] <= max_groups_x;
+		case GGML_OP_SOFT_MAX:
+			return src0->type == GGML_TYPE_F32 && ggml_is_contiguous(src0) && ggml_nelements(src0) >= min_row_op_elements &&
+					(src1 == nullptr || (src1->type == GGML_TYPE_F32 && src1->ne[0] == src0->ne[0] && host_backend_has_element_strides(src1)));
+		case GGML_OP_NORM:
+			return src0->type == GGML_TYPE_F32 && ggml_is_contiguous(src0) && ggml_nelements(src0) >= min_row_op_elements;
+		default:
+			return false;
+	}
+}
+
+bool RenderingDeviceCompute::_init() {
+	RenderingServer *rendering_server = RenderingServer::get_singleton();
+	device = rendering_server ? rendering_server->create_local_rendering_device() : nullptr;
+	if (device == nullptr) {
+		return false;
+	}
+	const char *bodies[KERNEL_MAX] = { mul_mat_shader, mul_mat_shader, soft_max_shader, norm_shader };
+	const char *defines[KERNEL_MAX] = { "#define SRC0_TYPE float\n", "#define SRC0_TYPE uint\n#define SRC0_F16\n", "", "" };
+	for (int i = 0; i < KERNEL_MAX; i++) {
+		Ref<RDShaderSource> source;
+		source.instantiate();
+		source->set_language(RenderingDevice::SHADER_LANGUAGE_GLSL);
+		source->set_stage_source(RenderingDevice::SHADER_STAGE_COMPUTE, String("#version 450\n") + defines[i] + bodies[i]);
+		Ref<RDShaderSPIRV> spirv = device->shader_compile_spirv_from_source(source);
+		if (spirv.is_null() || !spirv->get_stage_compile_error(RenderingDevice::SHADER_STAGE_COMPUTE).is_empty()) {
+			ERR_PRINT("Failed to compile the RenderingDevice compute kernels: " + (spirv.is_valid() ? spirv->get_stage_compile_error(RenderingDevice::SHADER_STAGE_COMPUTE) : String()));
+			return false;
+		}
+		shaders[i] = device->shader_create_from_spirv(spirv);
+		pipelines[i] = shaders[i].is_valid() ? device->compute_pipeline_create(shaders[i]) : RID();
+		if (!pipelines[i].is_valid()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void RenderingDeviceCompute::_invalidate(uintptr_t p_begin, uintptr_t p_end) {
+	auto it = uploads.upper_bound(p_begin);
+	if (it != uploads.begin()) {
+		--it;
+	}
+	while (it != uploads.end() && it->first < p_end) {
+		if (it->first + it->second.size <= p_begin) {
+			++it;
+			continue;
+		}
+		if (it->second.buffer.is_valid()) {
+			device->free_rid(it->second.buffer);
+		}
+		it = uploads.erase(it);
+	}
+}
+
+void RenderingDeviceCompute::track_upload(const void *p_data, size_t p_size) {
+	const uintptr_t begin = uintptr_t(p_data);
+	std::lock_guard<std::mutex> lock(mutex);
+	_invalidate(begin, begin + p_size);
+	uploads[begin].size = p_size;
+}
+
+void RenderingDeviceCompute::invalidate(const void *p_data, size_t p_size) {
+	std::lock_guard<std::mutex> lock(mutex);
+	_invalidate(uintptr_t(p_data), uintptr_t(p_data) + p_size);
+}
+
+RID RenderingDeviceCompute::_get_scratch(ScratchSlot p_slot, size_t p_size) {
+	Scratch &slot = scratch[p_slot];
+	if (slot.size < p_size) {
+		if (slot.buffer.is_valid()) {
+			device->free_rid(slot.buffer);
+		}
+		slot.size = MAX(min_scratch_size, uint32_t(next_power_of_2(uint32_t(p_size))));
+		slot.buffer = device->storage_buffer_create(slot.size);
+	}
+	return slot.buffer;
+}
+
+RID RenderingDeviceCompute::_bind_source(const ggml_tensor *p_tensor, ScratchSlot p_slot, uint32_t &r_offset) {
+	const size_t type_size = ggml_type_size(p_tensor->type);
+	const uintptr_t begin = uintptr_t(p_tensor->data);
+	const uintptr_t end = begin + host_backend_tensor_span(p_tensor);
+	auto it = uploads.upper_bound(begin);
+	if (it != uploads.begin() && (--it)->first <= begin && end <= it->first + it->second.size) {
+		Upload &upload = it->second;
+		if (!upload.buffer.is_valid()) {
+			PackedByteArray data;
+			data.resize((upload.size + 3) & ~size_t(3));
+			memcpy(data.ptrw(), reinterpret_cast<const void *>(it->first), upload.size);
+			upload.buffer = device->storage_buffer_create(data.size(), data);
+		}
+		if (upload.buffer.is_valid()) {
+			r_offset = uint32_t((begin - it->first) / type_size);
+			return upload.buffer;
+		}
+	}
+	// Written by the graph, e.g. the activations or the KV cache, copied for this kernel only.
+	const uintptr_t aligned = begin & ~uintptr_t(3);
+	const size_t size = (end - aligned + 3) & ~size_t(3);
+	PackedByteArray data;
+	data.resize(size);
+	memcpy(data.ptrw(), reinterpret_cast<const void *>(aligned), end - aligned);
+	const RID buffer = _get_scratch(p_slot, size);
+	device->buffer_update(buffer, 0, size, data);
+	r_offset = uint32_t((begin - aligned) / type_size);
+	return buffer;
+}
+
+void RenderingDeviceCompute::_dispatch(Kernel p_kernel, const RID *p_buffers, int p_count, const void *p_push_constant, uint32_t p_push_size, uint32_t p_x, uint32_t p_y, uint32_t p_z) {
+	TypedArray<RDUniform> uniforms;
+	for (int i = 0; i < p_count; i++) {
+		Ref<RDUniform> uniform;
+		uniform.instantiate();
+		uniform->set_uniform_type(RenderingDevice::UNIFORM_TYPE_STORAGE_BUFFER);
+		uniform->set_binding(i);
+		uniform->add_id(p_buffers[i]);
+		uniforms.push_back(uniform);
+	}
+	const RID uniform_set = device->uniform_set_create(uniforms, shaders[p_kernel], 0);
+	PackedByteArray push_constant;
+	push_constant.resize(p_push_size);
+	memcpy(push_constant.ptrw(), p_push_constant, p_push_size);
+	const int64_t list = device->compute_list_begin();
+	device->compute_list_bind_compute_pipeline(list, pipelines[p_kernel]);
+	device->compute_list_bind_uniform_set(list, uniform_set, 0);
+	device->compute_list_set_push_constant(list, push_constant, p_push_size);
+	device->compute_list_dispatch(list, p_x, p_y, p_z);
+	device->compute_list_end();
+	device->submit();
+	device->sync();
+	device->free_rid(uniform_set);
+}
+
+void RenderingDeviceCompute::_read_result(const RID &p_buffer, ggml_tensor *p_dst) {
+	const size_t size = ggml_nbytes(p_dst);
+	const PackedByteArray data = device->buffer_get_data(p_buffer, 0, size);
+	ERR_FAIL_COND(size_t(data.size()) < size);
+	memcpy(p_dst->data, data.ptr(), size);
+	_invalidate(uintptr_t(p_dst->data), uintptr_t(p_dst->data) + size);
+}
+
+void RenderingDeviceCompute::_mul_mat(ggml_tensor *p_node) {
+	const ggml_tensor *src0 = p_node->src[0];
+	const ggml_tensor *src1 = p_node->src[1];
+	const size_t size0 = ggml_type_size(src0->type);
+	const size_t size1 = ggml_type_size(src1->type);
+	MulMatPushConstant push = {};
+	push.ne00 = uint32_t(src0->ne[0]);
+	push.ne01 = uint32_t(src0->ne[1]);
+	push.ne11 = uint32_t(src1->ne[1]);
+	push.ne12 = uint32_t(src1->ne[2]);
+	push.r2 = uint32_t(src1->ne[2] / src0->ne[2]);
+	push.r3 = uint32_t(src1->ne[3] / src0->ne[3]);
+	push.nb01 = uint32_t(src0->nb[1] / size0);
+	push.nb02 = uint32_t(src0->nb[2] / size0);
+	push.nb03 = uint32_t(src0->nb[3] / size0);
+	push.nb11 = uint32_t(src1->nb[1] / size1);
+	push.nb12 = uint32_t(src1->nb[2] / size1);
+	push.nb13 = uint32_t(src1->nb[3] / size1);
+	RID buffers[3];
+	buffers[0] = _bind_source(src0, SCRATCH_SRC0, push.off0);
+	buffers[1] = _bind_source(src1, SCRATCH_SRC1, push.off1);
+	buffers[2] = _get_scratch(SCRATCH_DST, ggml_nbytes(p_node));
+	const Kernel kernel = src0->type == GGML_TYPE_F16 ? KERNEL_MUL_MAT_F16 : KERNEL_MUL_MAT_F32;
+	_dispatch(kernel, buffers, 3, &push, sizeof(push), (push.ne01 + 15) / 16, (push.ne11 + 15) / 16, uint32_t(src1->ne[2] * src1->ne[3]));
+	_read_result(buffers[2], p_node);
+}
+
+void RenderingDeviceCompute::_soft_max(ggml_tensor *p_node) {
+	const ggml_tensor *src0 = p_node->src[0];
+	const ggml_tensor *src1 = p_node->src[1];
+	SoftMaxPushConstant push = {};
+	push.nc = uint32_t(src0->ne[0]);
+	push.nrows = uint32_t(ggml_nrows(src0));
+	push.nb01 = uint32_t(src0->nb[1] / sizeof(float));
+	push.groups_x = MIN(push.nrows, max_groups_x);
+	memcpy(&push.scale, p_node->op_params, sizeof(float));
+	RID buffers[3];
+	buffers[0] = _bind_source(src0, SCRATCH_SRC0, push.off0);
+	buffers[2] = _get_scratch(SCRATCH_DST, ggml_nbytes(p_node));
+	if (src1 != nullptr) {
+		push.has_mask = 1;
+		push.ne11 = uint32_t(src1->ne[1]);
+		push.nb11 = uint32_t(src1->nb[1] / sizeof(float));
+		buffers[1] = _bind_source(src1, SCRATCH_SRC1, push.off1);
+	} else {
+		push.ne11 = 1;
+		buffers[1] = buffers[0];
+	}
+	_dispatch(KERNEL_SOFT_MAX, buffers, 3, &push, sizeof(push), push.groups_x, (push.nrows + push.groups_x - 1) / push.groups_x, 1);
+	_read_result(buffers[2], p_node);
+}
+
+void RenderingDeviceCompute::_norm(ggml_tensor *p_node) {
+	const ggml_tensor *src0 = p_node->src[0];
+	NormPushConstant push = {};
+	push.ne00 = uint32_t(src0->ne[0]);
+	push.nrows = uint32_t(ggml_nrows(src0));
+	push.groups_x = MIN(push.nrows, max_groups_x);
+	memcpy(&push.eps, p_node->op_params, sizeof(float));
+	RID buffers[2];
+	buffers[0] = _bind_source(src0, SCRATCH_SRC0, push.off0);
+	buffers[1] = _get_scratch(SCRATCH_DST, ggml_nbytes(p_node));
+	_dispatch(KERNEL_NORM, buffers, 2, &push, sizeof(push), push.groups_x, (push.nrows + push.groups_x - 1) / push.groups_x, 1);
+	_read_result(buffers[1], p_node);
+}
+
+void RenderingDeviceCompute::compute(ggml_tensor *p_node) {
+	std::lock_guard<std::mutex> lock(mutex);
+	switch (p_node->op) {
+		case GGML_OP_MUL_MAT:
+			_mul_mat(p_node);
+			break;
+		case GGML_OP_SOFT_MAX:
+			_soft_max(p_node);
+			break;
+		case GGML_OP_NORM:
+			_norm(p_node);
+			break;
+		default:
+			ERR_PRINT("The RenderingDevice backend has no kernel for this node.");
+			break;
+	}
+}
+
+RenderingDeviceCompute::~RenderingDeviceCompute() {
+	if (device == nullptr) {
+		return;
+	}
+	for (const auto &entry : uploads) {
+		if (entry.second.buffer.is_valid()) {
+			device->free_rid(entry.second.buffer);
+		}
+	}
+	for (const Scratch &slot : scratch) {
+		if (slot.buffer.is_valid()) {
+			device->free_rid(slot.buffer);
+		}
+	}
+	for (int i = 0; i < KERNEL_MAX; i++) {
+		if (pipelines[i].is_valid()) {
+			device->free_rid(pipelines[i]);
+		}
+		if (shaders[i].is_valid()) {
+			device->free_rid(shaders[i]);
+		}
+	}
+	memdelete(device);
+}
+
+/* The ggml side: a host memory buffer type that tells the device which ranges the host wrote, and a backend that runs the nodes the device has no kernel for on the CPU. */
+
+static const size_t buffer_alignment = 64;
+
+struct RenderingDeviceBufferContext {
+	void *data = nullptr;
+	std::shared_ptr<RenderingDeviceCompute> compute;
+};
+
+struct RenderingDeviceBackendContext {
+	std::shared_ptr<RenderingDeviceCompute> compute;
+	ggml_backend_t cpu = nullptr;
+};
+
+static void _buffer_free(ggml_backend_buffer_t p_buffer) {
+	RenderingDeviceBufferContext *context = (RenderingDeviceBufferContext *)p_buffer->context;
+	// The memory may come back as another buffer, whose tensors were not uploaded.
+	context->compute->invalidate(context->data, p_buffer->size);
+#ifdef _WIN32
+	_aligned_free(context->data);
+#else
+	free(context->data);
+#endif
+	delete context;
+}
+
+static void *_buffer_get_base(ggml_backend_buffer_t p_buffer) {
+	return (uint8_t *)((RenderingDeviceBufferContext *)p_buffer->context)->data;
+}
+
+static void _buffer_set_tensor(ggml_backend_buffer_t p_buffer, ggml_tensor *p_tensor, const void *p_data, size_t p_offset, size_t p_size) {
+	memcpy((uint8_t *)p_tensor->data + p_offset, p_data, p_size);
+	((RenderingDeviceBufferContext *)p_buffer->context)->compute->track_upload((uint8_t *)p_tensor->data + p_offset, p_size);
+}
+
+static void _buffer_get_tensor(ggml_backend_buffer_t p_buffer, const ggml_tensor *p_tensor, void *p_data, size_t p_offset, size_t p_size) {
+	memcpy(p_data, (const uint8_t *)p_tensor->data + p_offset, p_size);
+}
+
+static void _buffer_clear(ggml_backend_buffer_t p_buffer, uint8_t p_value) {
+	RenderingDeviceBufferContext *context = (RenderingDeviceBufferContext *)p_buffer->context;
+	memset(context->data, p_value, p_buffer->size);
+	context->compute->invalidate(context->data, p_buffer->size);
+}
+
+static const ggml_backend_buffer_i buffer_interface = {
+	/* .free_buffer     = */ _buffer_free,
+	/* .get_base        = */ _buffer_get_base,
+	/* .init_tensor     = */ nullptr,
+	/* .set_tensor      = */ _buffer_set_tensor,
+	/* .get_tensor      = */ _buffer_get_tensor,
+	/* .cpy_tensor_from = */ nullptr,
+	/* .cpy_tensor_to   = */ nullptr,
+	/* .clear           = */ _buffer_clear,
+};
+
+static ggml_backend_buffer_t _buffer_type_alloc_buffer(ggml_backend_buffer_type_t p_buffer_type, size_t p_size) {
+	RenderingDeviceCompute *compute = (RenderingDeviceCompute *)p_buffer_type->context;
+	RenderingDeviceBufferContext *context = new RenderingDeviceBufferContext;
+	// Same as the CPU buffers, aligned for the SIMD kernels of the nodes left to the CPU.
+	const size_t size = MAX(size_t(1), (p_size + buffer_alignment - 1) / buffer_alignment * buffer_alignment);
+#ifdef _WIN32
+	context->data = _aligned_malloc(size, buffer_alignment);
+#else
+	context->data = aligned_alloc(buffer_alignment, size);
+#endif
+	if (context->data == nullptr) {
+		delete context;
+		return nullptr;
+	}
+	context->compute = compute->get_shared();
+	return ggml_backend_buffer_init(p_buffer_type, buffer_interface, context, p_size);
+}
+
+static size_t _buffer_type_get_alignment(ggml_backend_buffer_type_t p_buffer_type) {
+	return buffer_alignment;
+}
+
+static const char *_backend_get_name(ggml_backend_t p_backend) {
+	return "RenderingDevice";
+}
+
+static bool _buffer_type_supports_backend(ggml_backend_buffer_type_t p_buffer_type, ggml_backend_t p_backend) {
+	return ggml_backend_is_cpu(p_backend) || p_backend->iface.get_name == _backend_get_name;
+}
+
+static bool _buffer_type_is_host(ggml_backend_buffer_type_t p_buffer_type) {
+	return true;
+}
+
+static void _backend_free(ggml_backend_t p_backend) {
+	RenderingDeviceBackendContext *context = (RenderingDeviceBackendContext *)p_backend->context;
+	ggml_backend_free(context->cpu);
+	delete context;
+	delete p_backend;
+}
+
+static ggml_backend_buffer_type_t _backend_get_default_buffer_type(ggml_backend_t p_backend) {
+	return ((RenderingDeviceBackendContext *)p_backend->context)->compute->get_buffer_type();
+}
+
+/* Nodes [p_begin, p_end) of p_graph on the CPU. */
+static void _compute_on_cpu(RenderingDeviceBackendContext *p_context, ggml_cgraph *p_graph, int p_begin, int p_end) {
+	ggml_cgraph view = ggml_graph_view(p_graph, p_begin, p_end);
+	for (int i = p_begin; i < p_end; i++) {
+		if (p_graph->nodes[i]->op == GGML_OP_MUL_MAT) {
+			// The device is the GPU of this backend, CLBlast would open another context.
+			ggml_mul_mat_set_offload(p_graph->nodes[i], false);
+		}
+	}
+	ggml_backend_graph_compute(p_context->cpu, &view);
+	for (int i = p_begin; i < p_end; i++) {
+		const ggml_tensor *node = p_graph->nodes[i];
+		if (!host_backend_is_view_op(node)) {
+			p_context->compute->invalidate(node->data, host_backend_tensor_span(node));
+		}
+	}
+}
+
+static bool _backend_graph_compute(ggml_backend_t p_backend, ggml_cgraph *p_graph) {
+	RenderingDeviceBackendContext *context = (RenderingDeviceBackendContext *)p_backend->context;
+	int cpu_begin = 0;
+	for (int i = 0; i < p_graph->n_nodes; i++) {
+		ggml_tensor *node = p_graph->nodes[i];
+		if (!RenderingDeviceCompute::supports_op(node)) {
+			continue;
+		}
+		if (cpu_begin < i) {
+			_compute_on_cpu(context, p_graph, cpu_begin, i);
+		}
+		context->compute->compute(node);
+		cpu_begin = i + 1;
+	}
+	if (cpu_begin < p_graph->n_nodes) {
+		_compute_on_cpu(context, p_graph, cpu_begin, p_graph->n_nodes);
+	}
+	return true;
+}
+
+static bool _backend_supports_op(ggml_backend_t p_backend, const ggml_tensor *p_node) {
+	// What the device has no kernel for runs on the CPU.
+	return ggml_backend_supports_op(((RenderingDeviceBackendContext *)p_backend->context)->cpu, p_node);
+}
+
+static const ggml_backend_i backend_interface = {
+	/* .get_name                = */ _backend_get_name,
+	/* .free                    = */ _backend_free,
+	/* .get_default_buffer_type = */ _backend_get_default_buffer_type,
+	/* .set_tensor_async        = */ nullptr,
+	/* .get_tensor_async        = */ nullptr,
+	/* .cpy_tensor_from_async   = */ nullptr,
+	/* .cpy_tensor_to_async     = */ nullptr,
+	/* .synchronize             = */ nullptr,
+	/* .graph_plan_create       = */ nullptr,
+	/* .graph_plan_free         = */ nullptr,
+	/* .graph_plan_compute      = */ nullptr,
+	/* .graph_compute           = */ _backend_graph_compute,
+	/* .supports_op             = */ _backend_supports_op,
+};
+
+std::shared_ptr<RenderingDeviceCompute> RenderingDeviceCompute::acquire() {
+	std::lock_guard<std::mutex> lock(instance_mutex);
+	std::shared_ptr<RenderingDeviceCompute> compute = instance.lock();
+	if (compute) {
+		return compute;
+	}
+	compute = std::make_shared<RenderingDeviceCompute>();
+	if (!compute->_init()) {
+		return nullptr;
+	}
+	compute->self = compute;
+	compute->buffer_type = {
+		/* .iface = */ {
+				/* .alloc_buffer     = */ _buffer_type_alloc_buffer,
+				/* .get_alignment    = */ _buffer_type_get_alignment,
+				/* .get_alloc_size   = */ nullptr,
+				/* .supports_backend = */ _buffer_type_supports_backend,
+				/* .is_host          = */ _buffer_type_is_host,
+		},
+		/* .context = */ compute.get(),
+	};
+	instance = compute;
+	return compute;
+}
+
+ggml_backend_t RenderingDeviceCompute::create_backend(int p_n_threads) {
+	std::shared_ptr<RenderingDeviceCompute> compute = acquire();
+	if (!compute) {
+		return nullptr;
+	}
+	RenderingDeviceBackendContext *context = new RenderingDeviceBackendContext;
+	context->compute = compute;
+	context->cpu = ggml_backend_cpu_init();
+	ggml_backend_cpu_set_n_threads(context->cpu, MAX(1, p_n_threads));
+	return new ggml_backend{ backend_interface, context };
+}
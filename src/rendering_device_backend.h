@@ -0,0 +1,103 @@
+#ifndef RENDERING_DEVICE_BACKEND_H
+#define RENDERING_DEVICE_BACKEND_H
+
+#include <godot_cpp/classes/rendering_device.hpp>
+#include <godot_cpp/variant/rid.hpp>
+
+#include <whisper.cpp/ggml-backend-impl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+using namespace godot;
+
+/**
+ * ggml backend on a local RenderingDevice, so whisper runs on the GPU the
+ * game already renders with instead of a second OpenCL context. The
+ * tensors stay in host memory like with the CPU backend. Matrix
+ * multiplications, soft_max and norm large enough to pay for the copies run
+ * as compute shaders, and the nodes in between run on ggml's CPU backend.
+ * Ranges written with ggml_backend_tensor_set, the weights among them, are
+ * copied to the device the first time a kernel reads them and stay there
+ * until the graph or the host writes them again. Every backend shares one
+ * device, its kernels run one at a time.
+ */
+class RenderingDeviceCompute {
+public:
+	enum Kernel {
+		KERNEL_MUL_MAT_F32,
+		KERNEL_MUL_MAT_F16,
+		KERNEL_SOFT_MAX,
+		KERNEL_NORM,
+		KERNEL_MAX,
+	};
+
+private:
+	/* A range the host wrote, and its copy on the device once a kernel read it. */
+	struct Upload {
+		size_t size = 0;
+		RID buffer;
+	};
+
+	enum ScratchSlot {
+		SCRATCH_SRC0,
+		SCRATCH_SRC1,
+		SCRATCH_DST,
+		SCRATCH_MAX,
+	};
+
+	struct Scratch {
+		RID buffer;
+		uint32_t size = 0;
+	};
+
+	RenderingDevice *device = nullptr;
+	RID shaders[KERNEL_MAX];
+	RID pipelines[KERNEL_MAX];
+	std::map<uintptr_t, Upload> uploads; // by host address, the ranges do not overlap
+	Scratch scratch[SCRATCH_MAX];
+	std::mutex mutex;
+	struct ggml_backend_buffer_type buffer_type;
+	std::weak_ptr<RenderingDeviceCompute> self;
+
+	static std::mutex instance_mutex;
+	static std::weak_ptr<RenderingDeviceCompute> instance;
+
+	bool _init();
+	/* With mutex held. */
+	void _invalidate(uintptr_t p_begin, uintptr_t p_end);
+	RID _get_scratch(ScratchSlot p_slot, size_t p_size);
+	/* Device buffer holding p_tensor, and the index of its first element in it. */
+	RID _bind_source(const ggml_tensor *p_tensor, ScratchSlot p_slot, uint32_t &r_offset);
+	void _dispatch(Kernel p_kernel, const RID *p_buffers, int p_count, const void *p_push_constant, uint32_t p_push_size, uint32_t p_x, uint32_t p_y, uint32_t p_z);
+	void _read_result(const RID &p_buffer, ggml_tensor *p_dst);
+	void _mul_mat(ggml_tensor *p_node);
+	void _soft_max(ggml_tensor *p_node);
+	void _norm(ggml_tensor *p_node);
+
+public:
+	/** Whether p_node runs on the device, the others are left to the CPU. */
+	static bool supports_op(const ggml_tensor *p_node);
+	/** Compute p_node, which supports_op() took, into its host memory. */
+	void compute(ggml_tensor *p_node);
+
+	/** The host wrote p_size bytes at p_data, which the kernels may keep on the device from now on. */
+	void track_upload(const void *p_data, size_t p_size);
+	/** The host or the CPU wrote p_size bytes at p_data, the device copies of them are stale. */
+	void invalidate(const void *p_data, size_t p_size);
+
+	ggml_backend_buffer_type_t get_buffer_type() { return &buffer_type; }
+	std::shared_ptr<RenderingDeviceCompute> get_shared() { return self.lock(); }
+
+	/** The device shared by the backends, created with the first one. Null without a RenderingDevice, e.g. with the Compatibility renderer or headless. */
+	static std::shared_ptr<RenderingDeviceCompute> acquire();
+	/** A ggml backend on the shared device, p_n_threads compute the nodes it has no kernel for. Null without a RenderingDevice. */
+	static ggml_backend_t create_backend(int p_n_threads);
+
+	~RenderingDeviceCompute();
+};
+
+#endif // RENDERING_DEVICE_BACKEND_H
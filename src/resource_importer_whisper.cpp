@@ -0,0 +1,363 @@
+#include "resource_importer_whisper.h"
+
+#include "compressed_model.h"
+#include "resource_whisper.h"
+
+#include <godot_cpp/classes/config_file.hpp>
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+
+#include <whisper.cpp/examples/common-ggml.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* Where the data of every tensor of an imported model starts in the file, the alignment whisper_context_params::mmap_path uses the weights in place at. */
+static const int64_t MODEL_ALIGNMENT = 32;
+
+/* Copies what comes before the tensors: the hyperparameters, the mel filters and the vocabulary. r_ftype is the ftype of the source, replaced by p_ftype unless it is negative. */
+static bool _copy_model_header(std::ifstream &src, std::ostream &dst, const std::string &p_src, int32_t p_ftype, int32_t &r_ftype) {
+	uint32_t magic = 0;
+	src.read((char *)&magic, sizeof(magic));
+	ERR_FAIL_COND_V_MSG(magic != GGML_FILE_MAGIC, false, String("Not a ggml whisper model: ") + p_src.c_str());
+	dst.write((const char *)&magic, sizeof(magic));
+
+	// n_vocab, n_audio_ctx, n_audio_state, n_audio_head, n_audio_layer, n_text_ctx, n_text_state, n_text_head, n_text_layer, n_mels, ftype
+	int32_t hparams[11];
+	src.read((char *)hparams, sizeof(hparams));
+	r_ftype = hparams[10] % GGML_QNT_VERSION_FACTOR;
+	if (p_ftype >= 0) {
+		hparams[10] = GGML_QNT_VERSION * GGML_QNT_VERSION_FACTOR + p_ftype;
+	}
+	dst.write((const char *)hparams, sizeof(hparams));
+
+	// Mel filters.
+	int32_t n_mel = 0;
+	int32_t n_fft = 0;
+	src.read((char *)&n_mel, sizeof(n_mel));
+	src.read((char *)&n_fft, sizeof(n_fft));
+	ERR_FAIL_COND_V(!src || n_mel < 0 || n_fft < 0, false);
+	dst.write((const char *)&n_mel, sizeof(n_mel));
+	dst.write((const char *)&n_fft, sizeof(n_fft));
+	std::vector<float> filters(size_t(n_mel) * n_fft);
+	src.read((char *)filters.data(), filters.size() * sizeof(float));
+	dst.write((const char *)filters.data(), filters.size() * sizeof(float));
+
+	// Vocabulary.
+	int32_t n_vocab = 0;
+	src.read((char *)&n_vocab, sizeof(n_vocab));
+	dst.write((const char *)&n_vocab, sizeof(n_vocab));
+	std::string word;
+	for (int i = 0; i < n_vocab && src; i++) {
+		uint32_t len = 0;
+		src.read((char *)&len, sizeof(len));
+		word.resize(len);
+		src.read(&word[0], len);
+		dst.write((const char *)&len, sizeof(len));
+		dst.write(word.data(), len);
+	}
+	ERR_FAIL_COND_V_MSG(!src, false, String("Truncated whisper model: ") + p_src.c_str());
+	return true;
+}
+
+/* Copies a model and quantizes its weights, ported from whisper_model_quantize of examples/quantize. */
+static bool _quantize_model(const std::string &p_src, const std::string &p_dst, ggml_ftype p_ftype) {
+	std::ifstream src(p_src, std::ios::binary);
+	ERR_FAIL_COND_V_MSG(!src, false, String("Cannot open whisper model ") + p_src.c_str());
+	std::ofstream dst(p_dst, std::ios::binary);
+	ERR_FAIL_COND_V_MSG(!dst, false, String("Cannot write quantized model ") + p_dst.c_str());
+
+	int32_t ftype_src = 0;
+	if (!_copy_model_header(src, dst, p_src, p_ftype, ftype_src)) {
+		return false;
+	}
+	ERR_FAIL_COND_V_MSG(ftype_src != GGML_FTYPE_ALL_F32 && ftype_src != GGML_FTYPE_MOSTLY_F16, false, String("The whisper model is already quantized, import it without quantization: ") + p_src.c_str());
+
+	// Same as examples/quantize, the biases of the convolutions and the positional embeddings keep their type.
+	const std::vector<std::string> to_skip = {
+		"encoder.conv1.bias",
+		"encoder.conv2.bias",
+		"encoder.positional_embedding",
+		"decoder.positional_embedding",
+	};
+	return ggml_common_quantize_0(src, dst, p_ftype, { ".*" }, to_skip);
+}
+
+/* Copies a model with the data of every tensor at MODEL_ALIGNMENT in the file. The names are padded with NULs, which whisper.cpp ignores. */
+static bool _align_model(const std::string &p_src, const std::string &p_dst) {
+	std::ifstream src(p_src, std::ios::binary);
+	ERR_FAIL_COND_V_MSG(!src, false, String("Cannot open whisper model ") + p_src.c_str());
+	std::ofstream dst(p_dst, std::ios::binary);
+	ERR_FAIL_COND_V_MSG(!dst, false, String("Cannot write whisper model ") + p_dst.c_str());
+
+	int32_t ftype = 0;
+	if (!_copy_model_header(src, dst, p_src, -1, ftype)) {
+		return false;
+	}
+
+	std::vector<char> data;
+	while (true) {
+		// n_dims, length, ttype
+		int32_t header[3];
+		src.read((char *)header, sizeof(header));
+		if (src.eof()) {
+			break;
+		}
+		const int32_t n_dims = header[0];
+		const int32_t length = header[1];
+		const int32_t ttype = header[2];
+		ERR_FAIL_COND_V_MSG(!src || n_dims < 0 || n_dims > 4 || length <= 0 || ttype < 0 || ttype >= GGML_TYPE_COUNT, false, String("Invalid tensor header in whisper model: ") + p_src.c_str());
+
+		int32_t ne[4] = { 1, 1, 1, 1 };
+		src.read((char *)ne, n_dims * sizeof(int32_t));
+		std::string name(length, '\0');
+		src.read(&name[0], length);
+		ERR_FAIL_COND_V_MSG(!src, false, String("Truncated whisper model: ") + p_src.c_str());
+
+		const int64_t data_offset = int64_t(dst.tellp()) + sizeof(header) + n_dims * sizeof(int32_t) + length;
+		const int64_t padding = (MODEL_ALIGNMENT - data_offset % MODEL_ALIGNMENT) % MODEL_ALIGNMENT;
+		header[1] = int32_t(length + padding);
+		name.resize(length + padding, '\0');
+		dst.write((const char *)header, sizeof(header));
+		dst.write((const char *)ne, n_dims * sizeof(int32_t));
+		dst.write(name.data(), name.size());
+
+		int64_t nelements = 1;
+		for (int i = 0; i < n_dims; i++) {
+			nelements *= ne[i];
+		}
+		// The data is copied a megabyte at a time, the weights of the large models are over a gigabyte.
+		int64_t remaining = nelements * int64_t(ggml_type_size(ggml_type(ttype))) / ggml_blck_size(ggml_type(ttype));
+		while (remaining > 0) {
+			data.resize(size_t(std::min<int64_t>(remaining, 1 << 20)));
+			src.read(data.data(), data.size());
+			ERR_FAIL_COND_V_MSG(!src, false, String("Truncated whisper model: ") + p_src.c_str());
+			dst.write(data.data(), data.size());
+			remaining -= data.size();
+		}
+	}
+	ERR_FAIL_COND_V_MSG(!dst, false, String("Cannot write whisper model ") + p_dst.c_str());
+	return true;
+}
+
+/* Appends p_size bytes of the model as the next zstd frame of a compressed model. */
+static void _write_frame(std::ofstream &dst, const char *p_data, size_t p_size, std::vector<CompressedModelFrame> &r_frames) {
+	PackedByteArray bytes;
+	bytes.resize(int64_t(p_size));
+	memcpy(bytes.ptrw(), p_data, p_size);
+	const PackedByteArray compressed = bytes.compress(FileAccess::COMPRESSION_ZSTD);
+	CompressedModelFrame frame;
+	frame.model_offset = r_frames.empty() ? 0 : r_frames.back().model_offset + r_frames.back().model_size;
+	frame.file_offset = uint64_t(dst.tellp());
+	frame.model_size = uint32_t(p_size);
+	frame.file_size = uint32_t(compressed.size());
+	dst.write((const char *)compressed.ptr(), compressed.size());
+	r_frames.push_back(frame);
+}
+
+/* Copies a model into a compressed model, see compressed_model.h. The header and the data of every tensor get their own frames. */
+static bool _compress_model(const std::string &p_src, const std::string &p_dst) {
+	std::ifstream src(p_src, std::ios::binary);
+	ERR_FAIL_COND_V_MSG(!src, false, String("Cannot open whisper model ") + p_src.c_str());
+	std::ofstream dst(p_dst, std::ios::binary);
+	ERR_FAIL_COND_V_MSG(!dst, false, String("Cannot write compressed model ") + p_dst.c_str());
+
+	CompressedModelHeader header = {};
+	header.magic = COMPRESSED_MODEL_MAGIC;
+	header.version = COMPRESSED_MODEL_VERSION;
+	src.read((char *)header.model_header, sizeof(header.model_header));
+	src.seekg(0);
+	// Written again once the frames are known.
+	dst.write((const char *)&header, sizeof(header));
+
+	std::vector<CompressedModelFrame> frames;
+	std::ostringstream model_header;
+	int32_t ftype = 0;
+	if (!_copy_model_header(src, model_header, p_src, -1, ftype)) {
+		return false;
+	}
+	const std::string model_header_bytes = model_header.str();
+	_write_frame(dst, model_header_bytes.data(), model_header_bytes.size(), frames);
+
+	std::vector<char> data;
+	while (true) {
+		// n_dims, length, ttype
+		int32_t tensor_header[3];
+		src.read((char *)tensor_header, sizeof(tensor_header));
+		if (src.eof()) {
+			break;
+		}
+		const int32_t n_dims = tensor_header[0];
+		const int32_t length = tensor_header[1];
+		const int32_t ttype = tensor_header[2];
+		ERR_FAIL_COND_V_MSG(!src || n_dims < 0 || n_dims > 4 || length <= 0 || ttype < 0 || ttype >= GGML_TYPE_COUNT, false, String("Invalid tensor header in whisper model: ") + p_src.c_str());
+
+		int32_t ne[4] = { 1, 1, 1, 1 };
+		src.read((char *)ne, n_dims * sizeof(int32_t));
+		std::string name(length, '\0');
+		src.read(&name[0], length);
+		ERR_FAIL_COND_V_MSG(!src, false, String("Truncated whisper model: ") + p_src.c_str());
+		std::string tensor_header_bytes((const char *)tensor_header, sizeof(tensor_header));
+		tensor_header_bytes.append((const char *)ne, n_dims * sizeof(int32_t));
+		tensor_header_bytes.append(name);
+		_write_frame(dst, tensor_header_bytes.data(), tensor_header_bytes.size(), frames);
+
+		int64_t nelements = 1;
+		for (int i = 0; i < n_dims; i++) {
+			nelements *= ne[i];
+		}
+		int64_t remaining = nelements * int64_t(ggml_type_size(ggml_type(ttype))) / ggml_blck_size(ggml_type(ttype));
+		while (remaining > 0) {
+			data.resize(size_t(std::min<int64_t>(remaining, COMPRESSED_MODEL_FRAME_BYTES)));
+			src.read(data.data(), data.size());
+			ERR_FAIL_COND_V_MSG(!src, false, String("Truncated whisper model: ") + p_src.c_str());
+			_write_frame(dst, data.data(), data.size(), frames);
+			remaining -= data.size();
+		}
+	}
+
+	header.model_size = frames.back().model_offset + frames.back().model_size;
+	header.frame_table_offset = uint64_t(dst.tellp());
+	header.frame_count = uint32_t(frames.size());
+	dst.write((const char *)frames.data(), frames.size() * sizeof(CompressedModelFrame));
+	dst.seekp(0);
+	dst.write((const char *)&header, sizeof(header));
+	ERR_FAIL_COND_V_MSG(!dst, false, String("Cannot write compressed model ") + p_dst.c_str());
+	return true;
+}
+
+String ResourceImporterWhisper::_get_importer_name() const {
+	return "whisper_model";
+}
+
+String ResourceImporterWhisper::_get_visible_name() const {
+	return "Whisper Model";
+}
+
+PackedStringArray ResourceImporterWhisper::_get_recognized_extensions() const {
+	PackedStringArray array;
+	array.push_back("bin");
+	return array;
+}
+
+String ResourceImporterWhisper::_get_save_extension() const {
+	return "ggml";
+}
+
+String ResourceImporterWhisper::_get_resource_type() const {
+	return "WhisperResource";
+}
+
+int32_t ResourceImporterWhisper::_get_preset_count() const {
+	return 1;
+}
+
+String ResourceImporterWhisper::_get_preset_name(int32_t p_preset_index) const {
+	return "Default";
+}
+
+TypedArray<Dictionary> ResourceImporterWhisper::_get_import_options(const String &p_path, int32_t p_preset_index) const {
+	TypedArray<Dictionary> options;
+	Dictionary quantization;
+	quantization["name"] = "quantization";
+	quantization["default_value"] = QUANTIZATION_NONE;
+	quantization["property_hint"] = PROPERTY_HINT_ENUM;
+	quantization["hint_string"] = "None,Q4_0,Q4_1,Q5_0,Q5_1,Q8_0";
+	options.push_back(quantization);
+	Dictionary compress;
+	compress["name"] = "compress";
+	compress["default_value"] = false;
+	options.push_back(compress);
+	return options;
+}
+
+bool ResourceImporterWhisper::_get_option_visibility(const String &p_path, const StringName &p_option_name, const Dictionary &p_options) const {
+	return true;
+}
+
+double ResourceImporterWhisper::_get_priority() const {
+	return 1.0;
+}
+
+int32_t ResourceImporterWhisper::_get_import_order() const {
+	return 0;
+}
+
+/* Saves what WhisperResource::get_model_info() returns for p_save_file, so the editor picks models without opening them. */
+static void _save_model_info(const String &p_save_file) {
+	const String info_path = WhisperResource::get_model_info_path(p_save_file);
+	const Dictionary info = WhisperResource::read_model_info(p_save_file);
+	if (info_path.is_empty() || info.is_empty()) {
+		return;
+	}
+	Ref<ConfigFile> cache;
+	cache.instantiate();
+	const Array keys = info.keys();
+	for (int i = 0; i < keys.size(); i++) {
+		cache->set_value("model", keys[i], info[keys[i]]);
+	}
+	cache->save(info_path);
+}
+
+/* Moves the model written at p_written_file to p_save_file and saves its info. */
+static Error _finish_import(const String &p_written_file, const String &p_save_file) {
+	const Error err = DirAccess::rename_absolute(p_written_file, p_save_file);
+	ERR_FAIL_COND_V_MSG(err != OK, err, "Cannot write whisper model " + p_save_file);
+	_save_model_info(p_save_file);
+	return OK;
+}
+
+Error ResourceImporterWhisper::write_model(const String &p_source_file, const String &p_save_file, int p_quantization, bool p_compress) {
+	ProjectSettings *project_settings = ProjectSettings::get_singleton();
+	const std::string src = project_settings->globalize_path(p_source_file).utf8().get_data();
+	// The import is written next to the file and renamed over it, the contexts that map the file keep reading the old one.
+	const String aligned_file = p_save_file + String(".aligned");
+	const std::string dst = project_settings->globalize_path(aligned_file).utf8().get_data();
+	// Compressed models are never mapped, they are not aligned.
+	bool (*write)(const std::string &, const std::string &) = p_compress ? &_compress_model : &_align_model;
+	if (p_quantization == QUANTIZATION_NONE) {
+		ERR_FAIL_COND_V_MSG(!write(src, dst), ERR_FILE_CORRUPT, "Cannot import whisper model " + p_source_file);
+		return _finish_import(aligned_file, p_save_file);
+	}
+
+	static const ggml_ftype ftypes[] = {
+		GGML_FTYPE_MOSTLY_F16,
+		GGML_FTYPE_MOSTLY_Q4_0,
+		GGML_FTYPE_MOSTLY_Q4_1,
+		GGML_FTYPE_MOSTLY_Q5_0,
+		GGML_FTYPE_MOSTLY_Q5_1,
+		GGML_FTYPE_MOSTLY_Q8_0,
+	};
+	ERR_FAIL_INDEX_V(p_quantization, int(sizeof(ftypes) / sizeof(ftypes[0])), ERR_INVALID_PARAMETER);
+
+	// Initializes the f16 tables ggml_quantize_chunk converts with.
+	ggml_init_params init_params = { 0, nullptr, false };
+	ggml_free(ggml_init(init_params));
+
+	// Quantized next to the import, then aligned or compressed into it.
+	const std::string quantized = dst + ".quantized";
+	const bool ok = _quantize_model(src, quantized, ftypes[p_quantization]) && write(quantized, dst);
+	std::remove(quantized.c_str());
+	ERR_FAIL_COND_V_MSG(!ok, ERR_FILE_CORRUPT, "Cannot quantize whisper model " + p_source_file);
+	return _finish_import(aligned_file, p_save_file);
+}
+
+Error ResourceImporterWhisper::_import(const String &p_source_file, const String &p_save_path, const Dictionary &p_options, const TypedArray<String> &p_platform_variants, const TypedArray<String> &p_gen_files) const {
+	return write_model(p_source_file, vformat("%s.%s", p_save_path, _get_save_extension()), p_options.get("quantization", QUANTIZATION_NONE), p_options.get("compress", false));
+}
+
+void WhisperEditorPlugin::_enter_tree() {
+	importer.instantiate();
+	add_import_plugin(importer);
+}
+
+void WhisperEditorPlugin::_exit_tree() {
+	remove_import_plugin(importer);
+	importer.unref();
+}
@@ -0,0 +1,65 @@
+#ifndef RESOURCE_IMPORTER_WHISPER_H
+#define RESOURCE_IMPORTER_WHISPER_H
+
+#include <godot_cpp/classes/editor_import_plugin.hpp>
+#include <godot_cpp/classes/editor_plugin.hpp>
+
+using namespace godot;
+
+/**
+ * Imports ggml whisper models, optionally quantizing the f16 or f32 weights
+ * the way whisper.cpp's examples/quantize does, and optionally compressing
+ * them into the zstd frames of compressed_model.h. The result is stored in
+ * .godot/imported and loaded as a WhisperResource.
+ */
+class ResourceImporterWhisper : public EditorImportPlugin {
+	GDCLASS(ResourceImporterWhisper, EditorImportPlugin);
+
+protected:
+	static void _bind_methods() {}
+
+public:
+	enum Quantization {
+		QUANTIZATION_NONE,
+		QUANTIZATION_Q4_0,
+		QUANTIZATION_Q4_1,
+		QUANTIZATION_Q5_0,
+		QUANTIZATION_Q5_1,
+		QUANTIZATION_Q8_0,
+	};
+
+	virtual String _get_importer_name() const override;
+	virtual String _get_visible_name() const override;
+	virtual PackedStringArray _get_recognized_extensions() const override;
+	virtual String _get_save_extension() const override;
+	virtual String _get_resource_type() const override;
+	virtual int32_t _get_preset_count() const override;
+	virtual String _get_preset_name(int32_t p_preset_index) const override;
+	virtual TypedArray<Dictionary> _get_import_options(const String &p_path, int32_t p_preset_index) const override;
+	virtual bool _get_option_visibility(const String &p_path, const StringName &p_option_name, const Dictionary &p_options) const override;
+	virtual double _get_priority() const override;
+	virtual int32_t _get_import_order() const override;
+	virtual Error _import(const String &p_source_file, const String &p_save_path, const Dictionary &p_options, const TypedArray<String> &p_platform_variants, const TypedArray<String> &p_gen_files) const override;
+
+	/**
+	 * Write the model at p_source_file to p_save_file the way the import does, aligned and with p_quantization,
+	 * or p_compress'ed, and save its info next to it. Also outside the editor, see ModelDownloader.
+	 */
+	static Error write_model(const String &p_source_file, const String &p_save_file, int p_quantization, bool p_compress = false);
+};
+
+/** Registers ResourceImporterWhisper with the editor. */
+class WhisperEditorPlugin : public EditorPlugin {
+	GDCLASS(WhisperEditorPlugin, EditorPlugin);
+
+	Ref<ResourceImporterWhisper> importer;
+
+protected:
+	static void _bind_methods() {}
+
+public:
+	virtual void _enter_tree() override;
+	virtual void _exit_tree() override;
+};
+
+#endif // RESOURCE_IMPORTER_WHISPER_H
@@ -9,6 +9,7 @@ Variant ResourceFormatLoaderWhisper::_load(const String &p_path, const String &o
 PackedStringArray ResourceFormatLoaderWhisper::_get_recognized_extensions() const {
 	PackedStringArray array;
 	array.push_back("bin");
+	array.push_back("ggml"); // ResourceImporterWhisper
 	return array;
 }
 bool ResourceFormatLoaderWhisper::_handles_type(const StringName &type) const {
@@ -16,7 +17,7 @@ bool ResourceFormatLoaderWhisper::_handles_type(const StringName &type) const {
 }
 String ResourceFormatLoaderWhisper::_get_resource_type(const String &p_path) const {
 	String el = p_path.get_extension().to_lower();
-	if (el == "bin") {
+	if (el == "bin" || el == "ggml") {
 		return "WhisperResource";
 	}
 	return "";
@@ -1,7 +1,19 @@
 #include "resource_whisper.h"
+#include "compressed_model.h"
 #include <iostream>
 
+#include <godot_cpp/classes/config_file.hpp>
 #include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/core/math.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 PackedByteArray WhisperResource::get_content() {
 	PackedByteArray content;
@@ -9,3 +21,312 @@ PackedByteArray WhisperResource::get_content() {
 	content = FileAccess::get_file_as_bytes(p_path);
 	return content;
 }
+
+void WhisperResource::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_model_info"), &WhisperResource::get_model_info);
+	ClassDB::bind_method(D_METHOD("get_streaming_preset"), &WhisperResource::get_streaming_preset);
+}
+
+/* The encoder depth of each model size, as whisper_model_load tells them apart. */
+static const char *_get_model_type(int32_t p_n_audio_layer) {
+	switch (p_n_audio_layer) {
+		case 4:
+			return "tiny";
+		case 6:
+			return "base";
+		case 12:
+			return "small";
+		case 24:
+			return "medium";
+		case 32:
+			return "large";
+		default:
+			return "unknown";
+	}
+}
+
+static String _get_quantization(int32_t p_ftype) {
+	switch (p_ftype) {
+		case GGML_FTYPE_ALL_F32:
+			return "f32";
+		case GGML_FTYPE_MOSTLY_F16:
+			return "f16";
+		case GGML_FTYPE_MOSTLY_Q4_0:
+			return "q4_0";
+		case GGML_FTYPE_MOSTLY_Q4_1:
+			return "q4_1";
+		case GGML_FTYPE_MOSTLY_Q5_0:
+			return "q5_0";
+		case GGML_FTYPE_MOSTLY_Q5_1:
+			return "q5_1";
+		case GGML_FTYPE_MOSTLY_Q8_0:
+			return "q8_0";
+		default:
+			return vformat("ftype_%d", p_ftype);
+	}
+}
+
+Dictionary WhisperResource::read_model_info(const String &p_path) {
+	Dictionary info;
+	Ref<FileAccess> file_access = FileAccess::open(p_path, FileAccess::READ);
+	ERR_FAIL_COND_V_MSG(file_access.is_null(), info, "Cannot open whisper model " + p_path);
+	// The magic, then n_vocab, n_audio_ctx, n_audio_state, n_audio_head, n_audio_layer, n_text_ctx, n_text_state, n_text_head, n_text_layer, n_mels, ftype
+	int32_t header[12];
+	// A compressed model keeps them uncompressed in its own header.
+	CompressedModelHeader compressed_header;
+	const bool compressed = CompressedModelReader::read_header(file_access, compressed_header);
+	static_assert(sizeof(header) == sizeof(compressed_header.model_header), "The compressed model keeps the whole header.");
+	if (compressed) {
+		memcpy(header, compressed_header.model_header, sizeof(header));
+	} else {
+		file_access->seek(0);
+		if (file_access->get_buffer((uint8_t *)header, sizeof(header)) != sizeof(header)) {
+			header[0] = 0;
+		}
+	}
+	if (uint32_t(header[0]) != GGML_FILE_MAGIC) {
+		ERR_FAIL_V_MSG(info, "Not a ggml whisper model: " + p_path);
+	}
+	static const char *names[] = { "n_vocab", "n_audio_ctx", "n_audio_state", "n_audio_head", "n_audio_layer", "n_text_ctx", "n_text_state", "n_text_head", "n_text_layer", "n_mels" };
+	for (int i = 0; i < 10; i++) {
+		info[names[i]] = header[i + 1];
+	}
+	const int32_t ftype = header[11] % GGML_QNT_VERSION_FACTOR;
+	info["ftype"] = ftype;
+	info["model_type"] = _get_model_type(header[5]);
+	info["quantization"] = _get_quantization(ftype);
+	// The English-only models have 51864 tokens, the multilingual ones 51865 and large-v3 51866.
+	info["multilingual"] = header[1] >= 51865;
+	// The same test as whisper_model_is_distilled, which keeps large-v3-turbo out.
+	info["distilled"] = (header[9] == 2 && header[5] > 2) || (header[9] == 4 && header[5] == 12);
+	info["file_size"] = int64_t(file_access->get_length());
+	info["compressed"] = compressed;
+	return info;
+}
+
+String WhisperResource::get_model_info_path(const String &p_file) {
+	return p_file.get_extension().to_lower() == "ggml" ? p_file.get_basename() + ".info.cfg" : String();
+}
+
+Dictionary WhisperResource::get_model_info() {
+	if (!model_info.is_empty() || file.is_empty()) {
+		return model_info;
+	}
+	const String info_path = get_model_info_path(file);
+	Ref<ConfigFile> cache;
+	cache.instantiate();
+	if (!info_path.is_empty() && FileAccess::file_exists(info_path) && cache->load(info_path) == OK && cache->has_section("model")) {
+		const PackedStringArray keys = cache->get_section_keys("model");
+		for (int i = 0; i < keys.size(); i++) {
+			model_info[keys[i]] = cache->get_value("model", keys[i]);
+		}
+		return model_info;
+	}
+	// Exported games only ship the model, the header is read instead.
+	model_info = read_model_info(file);
+	return model_info;
+}
+
+/*
+ * Chunk length distil-whisper recommends for long-form transcription, 15 s for distil-large-v2 and the
+ * English ones. distil-large-v3 was trained on whole 30 s windows and goes up to 25 s, it has the 128 mel
+ * bins of large-v3.
+ */
+static const int distil_chunk_ms = 15000;
+static const int distil_v3_chunk_ms = 25000;
+
+/*
+ * Streaming settings per model_type on a desktop CPU. The encoder of a pass costs about n_audio_layer *
+ * n_audio_state^2 per frame, 1 for tiny, 3 for base, 18 for small, 85 for medium and 220 for large, so the
+ * bigger models wait longer between passes and encode a shorter window to keep up with the audio, while tiny
+ * and base can afford the audio_ctx of 20 s and a pass every 500 ms. The decoder of the bigger models
+ * rarely needs the 32 tokens of a pass to commit.
+ */
+struct StreamingSizePreset {
+	const char *model_type;
+	int pass_trigger_ms;
+	int audio_ctx_max;
+	int max_tokens;
+};
+
+static const StreamingSizePreset streaming_size_presets[] = {
+	{ "tiny", 500, 1024, 32 },
+	{ "base", 700, 768, 32 },
+	{ "small", 1000, 768, 32 },
+	{ "medium", 1500, 640, 28 },
+	{ "large", 2000, 512, 24 },
+};
+
+/* Phones and machines with few cores encode several times slower, they get fewer and shorter passes. */
+static const int low_end_processor_count = 4;
+static const int low_end_audio_ctx_max = 512;
+
+static bool _is_low_end_platform() {
+	OS *os = OS::get_singleton();
+	return os->has_feature("mobile") || os->has_feature("web") || os->get_processor_count() <= low_end_processor_count;
+}
+
+Dictionary WhisperResource::get_streaming_preset() {
+	Dictionary preset;
+	const Dictionary info = get_model_info();
+	const String model_type = info.get("model_type", "unknown");
+	for (const StreamingSizePreset &size_preset : streaming_size_presets) {
+		if (model_type != size_preset.model_type) {
+			continue;
+		}
+		int pass_trigger_ms = size_preset.pass_trigger_ms;
+		int audio_ctx_max = size_preset.audio_ctx_max;
+		if (_is_low_end_platform()) {
+			pass_trigger_ms = pass_trigger_ms * 3 / 2;
+			audio_ctx_max = MIN(audio_ctx_max, low_end_audio_ctx_max);
+		}
+		preset["pass_trigger_ms"] = pass_trigger_ms;
+		preset["audio_ctx_max"] = audio_ctx_max;
+		preset["max_tokens"] = size_preset.max_tokens;
+		break;
+	}
+	if (!bool(info.get("distilled", false))) {
+		return preset;
+	}
+	preset["max_utterance_ms"] = int(info.get("n_mels", 80)) == 128 ? distil_v3_chunk_ms : distil_chunk_ms;
+	// The shallow decoder is what a beam would multiply, and it was distilled on greedy transcripts.
+	preset["sampling_strategy"] = int(WHISPER_SAMPLING_GREEDY);
+	return preset;
+}
+
+struct WhisperFileLoader {
+	FileAccess *file = nullptr;
+	String path;
+	uint64_t length = 0; // of the model, decompressed
+	Callable progress;
+	// Of compressed models, which are read at the offsets of the model, from position on.
+	std::unique_ptr<CompressedModelReader> compressed;
+	uint64_t position = 0;
+	std::atomic<uint64_t> bytes_read = { 0 };
+	std::atomic<int> last_percent = { -1 };
+
+	// Files of the threads reading the weights, each read seeks its own.
+	std::mutex files_mutex;
+	std::vector<Ref<FileAccess>> files;
+};
+
+static void _whisper_loader_report(WhisperFileLoader *p_loader, uint64_t p_read) {
+	uint64_t bytes_read = p_loader->bytes_read += p_read;
+	if (!p_loader->progress.is_valid() || p_loader->length == 0) {
+		return;
+	}
+	int percent = int(MIN(bytes_read, p_loader->length) * 100 / p_loader->length);
+	int last_percent = p_loader->last_percent;
+	// The weights are read on several threads, only one of them reports each step.
+	while (percent > last_percent) {
+		if (p_loader->last_percent.compare_exchange_weak(last_percent, percent)) {
+			p_loader->progress.call_deferred(percent / 100.0f);
+			return;
+		}
+	}
+}
+
+static size_t _whisper_loader_read(void *p_ctx, void *p_output, size_t p_read_size) {
+	WhisperFileLoader *loader = (WhisperFileLoader *)p_ctx;
+	uint64_t read = 0;
+	if (loader->compressed) {
+		read = loader->compressed->read_at(loader->position, p_output, p_read_size);
+		loader->position += read;
+	} else {
+		read = loader->file->get_buffer((uint8_t *)p_output, p_read_size);
+	}
+	_whisper_loader_report(loader, read);
+	return read;
+}
+
+static size_t _whisper_loader_read_at(void *p_ctx, size_t p_offset, void *p_output, size_t p_read_size) {
+	WhisperFileLoader *loader = (WhisperFileLoader *)p_ctx;
+	if (loader->compressed) {
+		const size_t read = loader->compressed->read_at(p_offset, p_output, p_read_size);
+		_whisper_loader_report(loader, read);
+		return read;
+	}
+	Ref<FileAccess> file;
+	{
+		std::lock_guard<std::mutex> lock(loader->files_mutex);
+		if (!loader->files.empty()) {
+			file = loader->files.back();
+			loader->files.pop_back();
+		}
+	}
+	if (file.is_null()) {
+		file = FileAccess::open(loader->path, FileAccess::READ);
+		ERR_FAIL_COND_V_MSG(file.is_null(), 0, "Cannot open whisper model " + loader->path);
+	}
+	file->seek(p_offset);
+	uint64_t read = file->get_buffer((uint8_t *)p_output, p_read_size);
+	{
+		std::lock_guard<std::mutex> lock(loader->files_mutex);
+		loader->files.push_back(file);
+	}
+	_whisper_loader_report(loader, read);
+	return read;
+}
+
+static bool _whisper_loader_eof(void *p_ctx) {
+	WhisperFileLoader *loader = (WhisperFileLoader *)p_ctx;
+	if (loader->compressed) {
+		return loader->position >= loader->length;
+	}
+	return loader->file->eof_reached();
+}
+
+static void _whisper_loader_close(void *p_ctx) {
+	// The file is owned by the Ref in load_context.
+}
+
+whisper_context *WhisperResource::load_context(whisper_context_params p_params, const Callable &p_progress) {
+	Ref<FileAccess> file_access = FileAccess::open(get_file(), FileAccess::READ);
+	ERR_FAIL_COND_V_MSG(file_access.is_null(), nullptr, "Cannot open whisper model " + get_file());
+
+	WhisperFileLoader file_loader;
+	file_loader.file = file_access.ptr();
+	file_loader.path = get_file();
+	file_loader.length = file_access->get_length();
+	file_loader.progress = p_progress;
+	CompressedModelHeader compressed_header;
+	if (CompressedModelReader::read_header(file_access, compressed_header)) {
+		file_loader.compressed = std::make_unique<CompressedModelReader>();
+		ERR_FAIL_COND_V(!file_loader.compressed->open(get_file()), nullptr);
+		file_loader.length = file_loader.compressed->get_model_size();
+	}
+	file_access->seek(0);
+
+	// Tensors are read straight from the file into their buffers, so the
+	// whole model is never held in memory twice.
+	whisper_model_loader loader;
+	loader.context = &file_loader;
+	loader.read = &_whisper_loader_read;
+	loader.eof = &_whisper_loader_eof;
+	loader.close = &_whisper_loader_close;
+	// The weights are read by several threads, each with its own file, so
+	// reading some overlaps copying others to the device. Those of a
+	// compressed model are decompressed by the same threads.
+	p_params.read_at = &_whisper_loader_read_at;
+	p_params.read_at_user_data = &file_loader;
+	// Only the files of the filesystem can be mapped, not the ones in a .pck. The
+	// import aligns the weights so they are used in place.
+	CharString mmap_path;
+	if (p_params.mmap_path != nullptr && !file_loader.compressed) {
+		const String global_path = ProjectSettings::get_singleton()->globalize_path(get_file());
+		Ref<FileAccess> global_file = global_path.is_absolute_path() ? FileAccess::open(global_path, FileAccess::READ) : Ref<FileAccess>();
+		if (global_file.is_valid() && global_file->get_length() == file_loader.length) {
+			mmap_path = global_path.utf8();
+		}
+	}
+	p_params.mmap_path = mmap_path.length() > 0 ? mmap_path.get_data() : nullptr;
+	// States are created separately with whisper_init_state, so several
+	// streams can share the weights.
+	whisper_context *context = whisper_init_with_params_no_state(&loader, p_params);
+	if (context != nullptr) {
+		// The states of Core ML builds look for the encoder next to the model file, the .bin rather than the import.
+		const String model_path = get_path().is_empty() ? get_file() : get_path();
+		whisper_ctx_set_path_model(context, ProjectSettings::get_singleton()->globalize_path(model_path).utf8().get_data());
+	}
+	return context;
+}
@@ -2,6 +2,9 @@
 #define WHISPER_RESOURCE_H
 
 #include <godot_cpp/classes/resource.hpp>
+#include <godot_cpp/variant/callable.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <whisper.cpp/whisper.h>
 
 using namespace godot;
 
@@ -9,12 +12,14 @@ class WhisperResource : public Resource {
 	GDCLASS(WhisperResource, Resource);
 
 protected:
-	static void _bind_methods() {}
+	static void _bind_methods();
 	String file;
+	Dictionary model_info; // read once per file
 
 public:
 	void set_file(const String &p_file) {
 		file = p_file;
+		model_info.clear();
 		emit_changed();
 	}
 
@@ -23,6 +28,31 @@ public:
 	}
 
 	PackedByteArray get_content();
+	/**
+	 * The hyperparameters of the model without loading it: n_vocab, n_audio_ctx, n_audio_state, n_audio_head,
+	 * n_audio_layer, n_text_ctx, n_text_state, n_text_head, n_text_layer, n_mels, ftype, model_type,
+	 * quantization, multilingual, distilled, compressed and file_size. From what the import saved next to it, else
+	 * from the 48 bytes of the ggml header. Empty when the file is not a whisper model.
+	 */
+	Dictionary get_model_info();
+	/**
+	 * SpeechToText settings the model streams best with on this device, by property name. Every model_type
+	 * gets the pass_trigger_ms, audio_ctx_max and max_tokens that keep its passes ahead of the audio, with
+	 * fewer and shorter passes on mobile, the web and machines of up to 4 cores. Distilled models also get
+	 * the chunk length they were trained to transcribe as max_utterance_ms, and greedy sampling. Empty for
+	 * an unknown model_type. See SpeechToText.apply_streaming_preset.
+	 */
+	Dictionary get_streaming_preset();
+	/** As get_model_info, read from the header of the model file at p_path. */
+	static Dictionary read_model_info(const String &p_path);
+	/** Where ResourceImporterWhisper saves the model info of the imported p_file, empty for files that were not imported. */
+	static String get_model_info_path(const String &p_file);
+	/**
+	 * Create a stateless whisper context streaming the model from the file. p_progress is deferred-called with 0..1.
+	 * Any p_params.mmap_path asks for the file to be mapped, it is replaced by the path of the file when it is on the
+	 * filesystem and unset otherwise.
+	 */
+	whisper_context *load_context(whisper_context_params p_params, const Callable &p_progress = Callable());
 	WhisperResource() {}
 	~WhisperResource() {}
 };
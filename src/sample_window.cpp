@@ -0,0 +1,53 @@
+#include "sample_window.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cstring>
+#include <utility>
+
+using namespace godot;
+
+void SampleWindow::reserve(size_t p_samples) {
+	if (storage.size() >= 2 * p_samples) {
+		return;
+	}
+	std::vector<float> grown(2 * p_samples);
+	if (count > 0) {
+		memcpy(grown.data(), data(), count * sizeof(float));
+	}
+	storage.swap(grown);
+	start = 0;
+}
+
+void SampleWindow::drop_front(size_t p_samples) {
+	p_samples = MIN(p_samples, count);
+	count -= p_samples;
+	// An empty run starts over at the front, so the next ones do not have to be moved there.
+	start = count > 0 ? start + p_samples : 0;
+}
+
+float *SampleWindow::reserve_back(size_t p_samples) {
+	if (start + count + p_samples > storage.size()) {
+		if (2 * (count + p_samples) > storage.size()) {
+			reserve(MAX(count + p_samples, storage.size()));
+		} else {
+			memmove(storage.data(), data(), count * sizeof(float));
+			start = 0;
+		}
+	}
+	return storage.data() + start + count;
+}
+
+void SampleWindow::assign(const float *p_samples, size_t p_count) {
+	clear();
+	if (p_count > 0) {
+		memcpy(reserve_back(p_count), p_samples, p_count * sizeof(float));
+		commit_back(p_count);
+	}
+}
+
+void SampleWindow::swap(SampleWindow &p_other) {
+	storage.swap(p_other.storage);
+	std::swap(start, p_other.start);
+	std::swap(count, p_other.count);
+}
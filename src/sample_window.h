@@ -0,0 +1,48 @@
+#ifndef SAMPLE_WINDOW_H
+#define SAMPLE_WINDOW_H
+
+#include <godot_cpp/core/defs.hpp>
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Contiguous run of samples that only grows at the end and is only trimmed
+ * at the front, e.g. the open segment of a stream. Trimming moves the start
+ * of the run, nothing is copied. Appending moves the run back to the front
+ * of the storage only once it reached the end; with storage for twice the
+ * run that is one copy per run length trimmed. The storage only grows.
+ */
+class SampleWindow {
+	std::vector<float> storage;
+	size_t start = 0;
+	size_t count = 0;
+
+public:
+	/** Room for runs of p_samples, so they never grow the storage. */
+	void reserve(size_t p_samples);
+
+	_FORCE_INLINE_ const float *data() const { return storage.data() + start; }
+	_FORCE_INLINE_ size_t size() const { return count; }
+	_FORCE_INLINE_ bool empty() const { return count == 0; }
+	/** Bytes of the storage, twice the longest run reserved. */
+	_FORCE_INLINE_ size_t get_memory() const { return storage.capacity() * sizeof(float); }
+	_FORCE_INLINE_ void clear() {
+		start = 0;
+		count = 0;
+	}
+
+	/** Drop the first p_samples, at most all of them. */
+	void drop_front(size_t p_samples);
+
+	/** Space for p_samples after the run, which commit_back() then adds to it. Valid until the next call that changes the window. */
+	float *reserve_back(size_t p_samples);
+	_FORCE_INLINE_ void commit_back(size_t p_samples) { count += p_samples; }
+
+	void assign(const float *p_samples, size_t p_count);
+	void swap(SampleWindow &p_other);
+
+	SampleWindow() {}
+};
+
+#endif // SAMPLE_WINDOW_H
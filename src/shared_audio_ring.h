@@ -0,0 +1,45 @@
+#ifndef SHARED_AUDIO_RING_H
+#define SHARED_AUDIO_RING_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the shared memory a process outside the game writes its capture to, e.g. a sandboxed voice
+ * client or an OBS plugin, for SharedMemoryCapture to read in place. Plain C, so the producer can include
+ * this header as it is.
+ *
+ * The producer creates the region, a POSIX shared memory object opened with shm_open("/<name>"), or on
+ * Windows a named file mapping such as "Local\<name>". It is SHARED_AUDIO_RING_DATA_OFFSET bytes of header
+ * followed by capacity_frames interleaved frames of channels samples, 32-bit floats in -1..1 or 16-bit
+ * signed integers, native endian.
+ *
+ * The producer fills in the header with magic still 0, then stores magic last. To append n frames, at
+ * most capacity_frames, it writes frame i to slot (write_frames + i) % capacity_frames and then stores
+ * write_frames + n to write_frames, with release order, e.g. __atomic_store_n(..., __ATOMIC_RELEASE)
+ * or InterlockedExchange64. write_frames only grows. The producer never waits for the reader: frames more
+ * than capacity_frames behind write_frames are overwritten, and the reader skips them.
+ */
+
+#define SHARED_AUDIO_RING_MAGIC 0x4d485357u /* "WSHM" in little endian */
+#define SHARED_AUDIO_RING_VERSION 1u
+#define SHARED_AUDIO_RING_DATA_OFFSET 128u
+
+enum SharedAudioRingFormat {
+	SHARED_AUDIO_RING_F32 = 0,
+	SHARED_AUDIO_RING_S16 = 1,
+};
+
+typedef struct SharedAudioRingHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t channels;
+	uint32_t format; /* SharedAudioRingFormat */
+	uint32_t capacity_frames;
+	uint8_t reserved0[40];
+	/* On its own cache line, the only field that changes after the producer set up the header. */
+	uint64_t write_frames;
+	uint8_t reserved1[56];
+} SharedAudioRingHeader;
+
+#endif // SHARED_AUDIO_RING_H
@@ -0,0 +1,310 @@
+#include "shared_memory_capture.h"
+#include "audio_downmix.h"
+#include "audio_sample_convert.h"
+#include "shared_audio_ring.h"
+#include "speech_to_text.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#define SHARED_MEMORY_SUPPORTED
+#elif (defined(__linux__) && !defined(__ANDROID__)) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SHARED_MEMORY_SUPPORTED
+#endif
+
+/* Frames handed to the stream per call at most, short enough for the VAD to see speech end in time. */
+static const int capture_period_ms = 20;
+/* Channels of a ring the reader downmixes, more is not a capture. */
+static const uint32_t max_channels = 8;
+
+static_assert(sizeof(SharedAudioRingHeader) == SHARED_AUDIO_RING_DATA_OFFSET, "The samples start right after the header.");
+static_assert(offsetof(SharedAudioRingHeader, write_frames) == 64, "write_frames is on its own cache line.");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The write position is shared with another process, its atomic must not take a lock.");
+
+/* The producer stores it with release order, the frames before it are in once it is seen. */
+static uint64_t _load_write_frames(const SharedAudioRingHeader *p_header) {
+	return reinterpret_cast<const std::atomic<uint64_t> *>(&p_header->write_frames)->load(std::memory_order_acquire);
+}
+
+/** The region of the ring, mapped read only. */
+class SharedAudioMapping {
+	const uint8_t *base = nullptr;
+	size_t size = 0;
+#if defined(_WIN32)
+	HANDLE handle = nullptr;
+#endif
+
+public:
+	Error open(const String &p_name);
+	void close();
+	const SharedAudioRingHeader *get_header() const { return reinterpret_cast<const SharedAudioRingHeader *>(base); }
+	const uint8_t *get_data() const { return base + SHARED_AUDIO_RING_DATA_OFFSET; }
+	size_t get_size() const { return size; }
+	~SharedAudioMapping() { close(); }
+};
+
+#if defined(_WIN32)
+
+/* A name without a namespace is taken from the session's, as the producer's CreateFileMapping does. */
+Error SharedAudioMapping::open(const String &p_name) {
+	const String name = p_name.contains("\\") ? p_name : "Local\\" + p_name;
+	const Char16String wide = name.utf16();
+	handle = OpenFileMappingW(FILE_MAP_READ, FALSE, reinterpret_cast<const wchar_t *>(wide.get_data()));
+	if (handle == nullptr) {
+		return ERR_FILE_NOT_FOUND;
+	}
+	void *view = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+	if (view == nullptr || VirtualQuery(view, &info, sizeof(info)) == 0) {
+		if (view != nullptr) {
+			UnmapViewOfFile(view);
+		}
+		CloseHandle(handle);
+		handle = nullptr;
+		return ERR_CANT_OPEN;
+	}
+	base = static_cast<const uint8_t *>(view);
+	// Whole pages, the mapping may be a little longer than the producer asked for.
+	size = info.RegionSize;
+	return OK;
+}
+
+void SharedAudioMapping::close() {
+	if (base != nullptr) {
+		UnmapViewOfFile(base);
+		base = nullptr;
+	}
+	if (handle != nullptr) {
+		CloseHandle(handle);
+		handle = nullptr;
+	}
+	size = 0;
+}
+
+#elif defined(SHARED_MEMORY_SUPPORTED)
+
+Error SharedAudioMapping::open(const String &p_name) {
+	const String name = p_name.begins_with("/") ? p_name : "/" + p_name;
+	const int fd = shm_open(name.utf8().get_data(), O_RDONLY, 0);
+	if (fd < 0) {
+		return ERR_FILE_NOT_FOUND;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+		::close(fd);
+		return ERR_CANT_OPEN;
+	}
+	void *view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping keeps the object alive.
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return ERR_CANT_OPEN;
+	}
+	base = static_cast<const uint8_t *>(view);
+	size = size_t(info.st_size);
+	return OK;
+}
+
+void SharedAudioMapping::close() {
+	if (base != nullptr) {
+		munmap(const_cast<uint8_t *>(base), size);
+		base = nullptr;
+	}
+	size = 0;
+}
+
+#else
+
+/* Android, iOS and the web have no shared memory between apps to open by name. */
+Error SharedAudioMapping::open(const String &p_name) {
+	(void)p_name;
+	return ERR_UNAVAILABLE;
+}
+
+void SharedAudioMapping::close() {
+}
+
+#endif
+
+bool SharedMemoryCapture::is_supported() {
+#ifdef SHARED_MEMORY_SUPPORTED
+	return true;
+#else
+	return false;
+#endif
+}
+
+void SharedMemoryCapture::set_stream(const Ref<SpeechToTextStream> &p_stream) {
+	MutexLock lock(stream_mutex);
+	stream = p_stream;
+}
+
+Ref<SpeechToTextStream> SharedMemoryCapture::get_stream() {
+	{
+		MutexLock lock(stream_mutex);
+		if (stream.is_valid()) {
+			return stream;
+		}
+	}
+	SpeechToText *speech_to_text = SpeechToText::get_singleton();
+	return speech_to_text ? speech_to_text->get_default_stream() : Ref<SpeechToTextStream>();
+}
+
+Error SharedMemoryCapture::start(const String &p_name) {
+	ERR_FAIL_COND_V_MSG(mapping != nullptr, ERR_ALREADY_IN_USE, "A shared memory ring is already being captured.");
+	ERR_FAIL_COND_V_MSG(!is_supported(), ERR_UNAVAILABLE, "No shared memory on this platform, feed the stream with add_audio_buffer.");
+	ERR_FAIL_COND_V_MSG(p_name.is_empty(), ERR_INVALID_PARAMETER, "The shared memory ring needs a name.");
+	std::unique_ptr<SharedAudioMapping> opened(new SharedAudioMapping);
+	const Error err = opened->open(p_name);
+	ERR_FAIL_COND_V_MSG(err != OK, err, vformat("Could not open the shared memory ring \"%s\", the producer creates it.", p_name));
+	ERR_FAIL_COND_V_MSG(opened->get_size() < SHARED_AUDIO_RING_DATA_OFFSET, ERR_FILE_CORRUPT, "The shared memory is smaller than the header of a ring.");
+	const SharedAudioRingHeader *header = opened->get_header();
+	// The producer stores the magic last, the fields before it are in once it is seen.
+	const uint32_t magic = reinterpret_cast<const std::atomic<uint32_t> *>(&header->magic)->load(std::memory_order_acquire);
+	ERR_FAIL_COND_V_MSG(magic != SHARED_AUDIO_RING_MAGIC, ERR_FILE_UNRECOGNIZED, "The shared memory holds no ring yet, or another kind of data.");
+	// The producer can write the header at any time, each field is read once and only the copy is checked and used.
+	const uint32_t ring_version = header->version;
+	const uint32_t ring_format = header->format;
+	const uint32_t ring_channels = header->channels;
+	const uint32_t ring_sample_rate = header->sample_rate;
+	const uint32_t ring_capacity = header->capacity_frames;
+	ERR_FAIL_COND_V_MSG(ring_version != SHARED_AUDIO_RING_VERSION, ERR_FILE_UNRECOGNIZED, vformat("Shared memory ring version %d is not supported, expected %d.", ring_version, SHARED_AUDIO_RING_VERSION));
+	ERR_FAIL_COND_V_MSG(ring_format != SHARED_AUDIO_RING_F32 && ring_format != SHARED_AUDIO_RING_S16, ERR_FILE_CORRUPT, "The samples of the ring are neither 32-bit floats nor 16-bit integers.");
+	ERR_FAIL_COND_V_MSG(ring_channels == 0 || ring_channels > max_channels, ERR_FILE_CORRUPT, vformat("A ring has 1 to %d channels.", max_channels));
+	ERR_FAIL_COND_V_MSG(ring_sample_rate == 0 || ring_capacity == 0, ERR_FILE_CORRUPT, "The ring has no sample rate or no room for frames.");
+	const size_t ring_frame_bytes = size_t(ring_channels) * (ring_format == SHARED_AUDIO_RING_F32 ? sizeof(float) : sizeof(int16_t));
+	ERR_FAIL_COND_V_MSG((opened->get_size() - SHARED_AUDIO_RING_DATA_OFFSET) / ring_frame_bytes < ring_capacity, ERR_FILE_CORRUPT, "The shared memory is smaller than the ring its header describes.");
+
+	target = get_stream();
+	ERR_FAIL_COND_V(target.is_null(), ERR_UNCONFIGURED);
+	mapping = std::move(opened);
+	sample_rate = int(ring_sample_rate);
+	channels = int(ring_channels);
+	capacity_frames = ring_capacity;
+	is_float = ring_format == SHARED_AUDIO_RING_F32;
+	frame_bytes = ring_frame_bytes;
+	dropped_frames.store(0, std::memory_order_relaxed);
+	mono_scratch.resize(size_t(sample_rate) * capture_period_ms / 1000 + 1);
+	running.store(true);
+	thread = std::thread(&SharedMemoryCapture::_run, this);
+	return OK;
+}
+
+void SharedMemoryCapture::stop() {
+	if (mapping == nullptr) {
+		return;
+	}
+	running.store(false);
+	if (thread.joinable()) {
+		thread.join();
+	}
+	// Target is not read after the join.
+	mapping.reset();
+	target.unref();
+	sample_rate = 0;
+	channels = 0;
+	capacity_frames = 0;
+	frame_bytes = 0;
+}
+
+void SharedMemoryCapture::_run() {
+	const SharedAudioRingHeader *header = mapping->get_header();
+	const uint64_t capacity = capacity_frames;
+	const uint64_t chunk_frames = mono_scratch.size();
+	// What the ring held before start() is old, the stream starts with the frames written from now on.
+	uint64_t read = _load_write_frames(header);
+	while (running.load(std::memory_order_relaxed)) {
+		const uint64_t written = _load_write_frames(header);
+		if (written < read) {
+			// The producer started over and counts from 0 again.
+			read = written;
+		}
+		if (written == read) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms.load(std::memory_order_relaxed)));
+			continue;
+		}
+		if (written - read > capacity) {
+			dropped_frames.fetch_add(written - capacity - read, std::memory_order_relaxed);
+			read = written - capacity;
+		}
+		while (read < written && running.load(std::memory_order_relaxed)) {
+			const uint32_t frames = uint32_t(MIN(written - read, chunk_frames));
+			_feed(read, frames);
+			read += frames;
+		}
+	}
+}
+
+void SharedMemoryCapture::_feed(uint64_t p_begin, uint32_t p_frames) {
+	const SharedAudioRingHeader *header = mapping->get_header();
+	const uint32_t capacity = capacity_frames;
+	// The one pass over the mapping, straight into the mono floats the stream takes.
+	uint32_t done = 0;
+	while (done < p_frames) {
+		const uint32_t slot = uint32_t((p_begin + done) % capacity);
+		const uint32_t run = MIN(p_frames - done, capacity - slot);
+		const uint8_t *src = mapping->get_data() + size_t(slot) * frame_bytes;
+		float *dst = mono_scratch.data() + done;
+		if (!is_float) {
+			audio_s16_downmix_to_f32(reinterpret_cast<const int16_t *>(src), run, channels, dst);
+		} else if (channels == 1) {
+			memcpy(dst, src, run * sizeof(float));
+		} else if (channels == 2) {
+			audio_downmix_stereo(reinterpret_cast<const float *>(src), run, dst);
+		} else {
+			const float *samples = reinterpret_cast<const float *>(src);
+			const float scale = 1.0f / channels;
+			for (uint32_t i = 0; i < run; i++) {
+				float sum = 0.0f;
+				for (int c = 0; c < channels; c++) {
+					sum += samples[size_t(i) * channels + c];
+				}
+				dst[i] = sum * scale;
+			}
+		}
+		done += run;
+	}
+	// A producer that lapped the reader meanwhile rewrote the oldest of them.
+	const uint64_t written = _load_write_frames(header);
+	const uint32_t overwritten = written > p_begin + capacity ? uint32_t(MIN(written - p_begin - capacity, uint64_t(p_frames))) : 0;
+	if (overwritten > 0) {
+		dropped_frames.fetch_add(overwritten, std::memory_order_relaxed);
+	}
+	if (overwritten == p_frames || !target->is_listening()) {
+		return;
+	}
+	// Same producer side as the audio thread, so the blocking overflow policy drops the newest audio instead of waiting.
+	target->_ingest_mono(mono_scratch.data() + overwritten, p_frames - overwritten, uint32_t(sample_rate), false);
+}
+
+SharedMemoryCapture::SharedMemoryCapture() {
+}
+
+SharedMemoryCapture::~SharedMemoryCapture() {
+	stop();
+}
+
+void SharedMemoryCapture::_bind_methods() {
+	ClassDB::bind_static_method("SharedMemoryCapture", D_METHOD("is_supported"), &SharedMemoryCapture::is_supported);
+	ClassDB::bind_method(D_METHOD("get_stream"), &SharedMemoryCapture::get_stream);
+	ClassDB::bind_method(D_METHOD("set_stream", "stream"), &SharedMemoryCapture::set_stream);
+	ClassDB::bind_method(D_METHOD("get_poll_ms"), &SharedMemoryCapture::get_poll_ms);
+	ClassDB::bind_method(D_METHOD("set_poll_ms", "poll_ms"), &SharedMemoryCapture::set_poll_ms);
+	ClassDB::bind_method(D_METHOD("start", "name"), &SharedMemoryCapture::start);
+	ClassDB::bind_method(D_METHOD("stop"), &SharedMemoryCapture::stop);
+	ClassDB::bind_method(D_METHOD("is_capturing"), &SharedMemoryCapture::is_capturing);
+	ClassDB::bind_method(D_METHOD("get_sample_rate"), &SharedMemoryCapture::get_sample_rate);
+	ClassDB::bind_method(D_METHOD("get_channels"), &SharedMemoryCapture::get_channels);
+	ClassDB::bind_method(D_METHOD("get_dropped_frames"), &SharedMemoryCapture::get_dropped_frames);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "poll_ms", PROPERTY_HINT_RANGE, "1,100"), "set_poll_ms", "get_poll_ms");
+}
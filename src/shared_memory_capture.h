@@ -0,0 +1,82 @@
+#ifndef SHARED_MEMORY_CAPTURE_H
+#define SHARED_MEMORY_CAPTURE_H
+
+#include "speech_to_text_stream.h"
+
+#include <godot_cpp/classes/mutex.hpp>
+#include <godot_cpp/classes/ref_counted.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace godot;
+
+class SharedAudioMapping;
+
+/**
+ * Feeds a SpeechToTextStream from the shared memory ring of another process,
+ * laid out as shared_audio_ring.h describes, so audio captured outside the
+ * game skips the sockets and add_audio_buffer. A thread of its own polls the
+ * ring every poll_ms and hands the new frames to the stream straight from the
+ * mapping, downmixed to mono. POSIX shared memory on Linux and macOS, named
+ * file mappings on Windows.
+ */
+class SharedMemoryCapture : public RefCounted {
+	GDCLASS(SharedMemoryCapture, RefCounted);
+
+	Ref<SpeechToTextStream> stream;
+	Mutex stream_mutex;
+	/* Fed by the reader thread, fixed from start() to stop(). */
+	Ref<SpeechToTextStream> target;
+	std::unique_ptr<SharedAudioMapping> mapping;
+	std::thread thread;
+	std::atomic<bool> running{ false };
+	std::atomic<int> poll_ms{ 5 };
+	int sample_rate = 0;
+	int channels = 0;
+	/* Of the header as start() validated it, the producer could change the header while capturing. */
+	uint32_t capacity_frames = 0;
+	bool is_float = false;
+	size_t frame_bytes = 0;
+	std::atomic<uint64_t> dropped_frames{ 0 };
+	std::vector<float> mono_scratch; // reader thread, one chunk downmixed
+
+	void _run();
+	/** Frames p_begin to p_begin + p_frames of the ring to the stream, those the producer overwrote meanwhile are skipped. */
+	void _feed(uint64_t p_begin, uint32_t p_frames);
+
+protected:
+	static void _bind_methods();
+
+public:
+	/** Whether this platform has shared memory to read from. */
+	static bool is_supported();
+
+	/** Null feeds the stream behind the SpeechToText add_audio_buffer/start_listen methods. Taken by the next start(). */
+	void set_stream(const Ref<SpeechToTextStream> &p_stream);
+	Ref<SpeechToTextStream> get_stream();
+	/** How long the reader sleeps when the ring has no new frames, the latency it adds at most. */
+	_FORCE_INLINE_ void set_poll_ms(int p_poll_ms) { poll_ms = CLAMP(p_poll_ms, 1, 100); }
+	_FORCE_INLINE_ int get_poll_ms() const { return poll_ms.load(std::memory_order_relaxed); }
+
+	/**
+	 * Open the ring p_name the producer created and start feeding the stream with the frames written from now
+	 * on. Audio is only taken while the stream is listening.
+	 */
+	Error start(const String &p_name);
+	void stop();
+	bool is_capturing() const { return mapping != nullptr; }
+	/** Of the ring, 0 when not capturing. */
+	int get_sample_rate() const { return sample_rate; }
+	int get_channels() const { return channels; }
+	/** Frames the producer overwrote before they were read, since start(). */
+	int64_t get_dropped_frames() const { return int64_t(dropped_frames.load(std::memory_order_relaxed)); }
+
+	SharedMemoryCapture();
+	~SharedMemoryCapture();
+};
+
+#endif // SHARED_MEMORY_CAPTURE_H
@@ -0,0 +1,11 @@
+#include "simulation_clock.h"
+
+#include <godot_cpp/classes/time.hpp>
+
+using namespace godot;
+
+std::atomic<uint64_t> SimulationClock::skipped_usec{ 0 };
+
+uint64_t SimulationClock::get_ticks_usec() {
+	return Time::get_singleton()->get_ticks_usec() + skipped_usec.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,27 @@
+#ifndef SIMULATION_CLOCK_H
+#define SIMULATION_CLOCK_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * The clock the streams and the scheduler time their policies with: the
+ * ticks of Time plus the waits a simulation skipped. A simulated
+ * SpeechToTextBenchmark jumps it over the gaps between the chunks of a replay
+ * once no pass runs, so it only moves with the compute of the passes and
+ * hours of audio replay in minutes. Without a simulation it is the ticks of
+ * Time. It never goes back.
+ */
+class SimulationClock {
+	static std::atomic<uint64_t> skipped_usec;
+
+public:
+	static uint64_t get_ticks_usec();
+	static uint64_t get_ticks_msec() { return get_ticks_usec() / 1000; }
+
+	/** Move the clock p_usec further ahead of the ticks of Time. */
+	static void advance(uint64_t p_usec) { skipped_usec.fetch_add(p_usec, std::memory_order_relaxed); }
+	static uint64_t get_skipped_usec() { return skipped_usec.load(std::memory_order_relaxed); }
+};
+
+#endif // SIMULATION_CLOCK_H
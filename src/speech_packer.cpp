@@ -0,0 +1,42 @@
+#include "speech_packer.h"
+#include "voice_activity_detector.h"
+
+#include <whisper.cpp/whisper.h>
+
+#include <algorithm>
+
+void SpeechPacker::setup(int p_vad_mode, float p_high_pass, float p_threshold, int p_pre_roll_ms, int p_hang_over_ms) {
+	vad = VadEngine::create(VadEngine::Mode(p_vad_mode), WHISPER_SAMPLE_RATE);
+	vad->set_high_pass(p_high_pass);
+	segmenter.setup(WHISPER_SAMPLE_RATE, VoiceActivityDetector::FRAME_MS);
+	segmenter.set_threshold(p_threshold);
+	segmenter.set_pre_roll_ms(p_pre_roll_ms);
+	segmenter.set_hang_over_ms(p_hang_over_ms);
+	runs.clear();
+	packed_samples = 0;
+}
+
+void SpeechPacker::process(const float *p_samples, size_t p_count, std::vector<float> &r_packed) {
+	probabilities.clear();
+	segments.clear();
+	vad->process(p_samples, p_count, false, probabilities);
+	const size_t size_before = r_packed.size();
+	segmenter.process(p_samples, p_count, probabilities.data(), probabilities.size(), r_packed, segments);
+	for (const SpeechSegmenter::Segment &segment : segments) {
+		runs.push_back({ packed_samples + (segment.offset - size_before), segment.input_position });
+	}
+	packed_samples += r_packed.size() - size_before;
+}
+
+double SpeechPacker::to_source_seconds(double p_packed_seconds) const {
+	const uint64_t packed_position = uint64_t(std::max(0.0, p_packed_seconds) * WHISPER_SAMPLE_RATE);
+	// The last run that starts at or before the position, a run is contiguous audio of the recording.
+	auto run = std::upper_bound(runs.begin(), runs.end(), packed_position, [](uint64_t p_position, const Run &p_run) {
+		return p_position < p_run.packed_position;
+	});
+	if (run == runs.begin()) {
+		return runs.empty() ? p_packed_seconds : double(runs.front().source_position) / WHISPER_SAMPLE_RATE;
+	}
+	--run;
+	return double(run->source_position + (packed_position - run->packed_position)) / WHISPER_SAMPLE_RATE;
+}
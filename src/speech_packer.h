@@ -0,0 +1,51 @@
+#ifndef SPEECH_PACKER_H
+#define SPEECH_PACKER_H
+
+#include "speech_segmenter.h"
+#include "vad_engine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Cuts the silence out of a long recording for an offline job, so the
+ * encoder runs on dense windows instead of 30 seconds that are mostly
+ * empty. The 16 kHz audio goes through a VadEngine and a SpeechSegmenter in
+ * one pass, in blocks as it is read. What is left are the voiced runs back
+ * to back, each with its pre-roll and hang-over, so the runs stay apart by
+ * a short silence the decoder sees as a pause. Times in the packed audio
+ * are mapped back to the recording from the start of each run.
+ */
+class SpeechPacker {
+	/* A voiced run, where it starts in the packed audio and in the recording. */
+	struct Run {
+		uint64_t packed_position;
+		uint64_t source_position;
+	};
+
+	std::unique_ptr<VadEngine> vad;
+	SpeechSegmenter segmenter;
+	std::vector<float> probabilities;
+	std::vector<SpeechSegmenter::Segment> segments;
+	std::vector<Run> runs;
+	uint64_t packed_samples = 0;
+
+public:
+	/** Start over with the VAD settings of the streams, p_vad_mode is a VadEngine::Mode. */
+	void setup(int p_vad_mode, float p_high_pass, float p_threshold, int p_pre_roll_ms, int p_hang_over_ms);
+
+	/** Append the voiced part of the next p_count samples of the recording to r_packed. */
+	void process(const float *p_samples, size_t p_count, std::vector<float> &r_packed);
+
+	/** Samples process() appended so far. */
+	_FORCE_INLINE_ uint64_t get_packed_samples() const { return packed_samples; }
+	/** Voiced runs so far. */
+	_FORCE_INLINE_ size_t get_run_count() const { return runs.size(); }
+
+	/** Recording time of p_packed_seconds of the packed audio. */
+	double to_source_seconds(double p_packed_seconds) const;
+};
+
+#endif // SPEECH_PACKER_H
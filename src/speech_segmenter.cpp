@@ -0,0 +1,96 @@
+#include "speech_segmenter.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cstring>
+
+using namespace godot;
+
+void SpeechSegmenter::setup(int p_sample_rate, int p_frame_ms) {
+	frame_ms = MAX(1, p_frame_ms);
+	frame_samples = MAX(1, p_sample_rate * frame_ms / 1000);
+	pre_roll.assign(size_t(pre_roll_frames) * frame_samples, 0.0f);
+	reset();
+}
+
+void SpeechSegmenter::set_pre_roll_ms(int p_pre_roll_ms) {
+	const int frames = MAX(0, p_pre_roll_ms / frame_ms);
+	if (frames == pre_roll_frames) {
+		return;
+	}
+	pre_roll_frames = frames;
+	pre_roll.assign(size_t(pre_roll_frames) * frame_samples, 0.0f);
+	pre_roll_start = 0;
+	pre_roll_size = 0;
+}
+
+void SpeechSegmenter::set_hang_over_ms(int p_hang_over_ms) {
+	hang_over_frames = MAX(0, p_hang_over_ms / frame_ms);
+}
+
+void SpeechSegmenter::reset() {
+	pending.clear();
+	pending_position = 0;
+	pre_roll_start = 0;
+	pre_roll_size = 0;
+	is_voiced = false;
+	hang_over_left = 0;
+	voiced_frames = 0;
+	silent_frames = 0;
+	last_pause_frames = 0;
+	pause_count = 0;
+}
+
+void SpeechSegmenter::_push_pre_roll(const float *p_frame) {
+	if (pre_roll.empty()) {
+		return;
+	}
+	// Whole frames in a ring of whole frames, so a frame never wraps.
+	const size_t end = (pre_roll_start + pre_roll_size) % pre_roll.size();
+	memcpy(pre_roll.data() + end, p_frame, frame_samples * sizeof(float));
+	if (pre_roll_size < pre_roll.size()) {
+		pre_roll_size += frame_samples;
+	} else {
+		pre_roll_start = (pre_roll_start + frame_samples) % pre_roll.size();
+	}
+}
+
+void SpeechSegmenter::process(const float *p_samples, size_t p_count, const float *p_probabilities, size_t p_frames, std::vector<float> &r_voiced, std::vector<Segment> &r_segments) {
+	pending.insert(pending.end(), p_samples, p_samples + p_count);
+	const size_t frames = MIN(p_frames, pending.size() / frame_samples);
+	for (size_t i = 0; i < frames; i++) {
+		const float *frame = pending.data() + i * frame_samples;
+		const uint64_t frame_position = pending_position + i * frame_samples;
+		if (p_probabilities[i] >= threshold) {
+			if (!is_voiced) {
+				is_voiced = true;
+				r_segments.push_back({ frame_position - pre_roll_size, r_voiced.size() });
+				for (size_t j = 0; j < pre_roll_size; j += frame_samples) {
+					const float *pre_roll_frame = pre_roll.data() + (pre_roll_start + j) % pre_roll.size();
+					r_voiced.insert(r_voiced.end(), pre_roll_frame, pre_roll_frame + frame_samples);
+				}
+				pre_roll_start = 0;
+				pre_roll_size = 0;
+			}
+			hang_over_left = hang_over_frames;
+			r_voiced.insert(r_voiced.end(), frame, frame + frame_samples);
+			if (silent_frames > 0 && voiced_frames > 0) {
+				last_pause_frames = silent_frames;
+				pause_count++;
+			}
+			voiced_frames++;
+			silent_frames = 0;
+		} else {
+			silent_frames++;
+			if (is_voiced && hang_over_left > 0) {
+				hang_over_left--;
+				r_voiced.insert(r_voiced.end(), frame, frame + frame_samples);
+			} else {
+				is_voiced = false;
+				_push_pre_roll(frame);
+			}
+		}
+	}
+	pending.erase(pending.begin(), pending.begin() + frames * frame_samples);
+	pending_position += frames * frame_samples;
+}
@@ -0,0 +1,80 @@
+#ifndef SPEECH_SEGMENTER_H
+#define SPEECH_SEGMENTER_H
+
+#include <godot_cpp/core/defs.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Cuts the incoming audio down to its voiced runs using the per-frame
+ * speech probabilities of a VadEngine. A run starts with up to pre-roll of
+ * the silence before it, so the first syllable is not clipped, and lasts
+ * until hang-over after the last voiced frame, so short pauses inside a
+ * sentence do not split it.
+ */
+class SpeechSegmenter {
+public:
+	/** Start of a voiced run in the output of process(). */
+	struct Segment {
+		uint64_t input_position; // first sample of the run, counted in input samples since reset()
+		size_t offset; // where the run starts in r_voiced
+	};
+
+private:
+	int frame_ms = 10;
+	int frame_samples = 160;
+	int pre_roll_frames = 0;
+	int hang_over_frames = 0;
+	float threshold = 0.5f;
+
+	std::vector<float> pending; // input not covered by a probability yet, less than a frame
+	uint64_t pending_position = 0; // input position of pending[0]
+	/* The latest silent frames, replayed when speech starts. */
+	std::vector<float> pre_roll;
+	size_t pre_roll_start = 0;
+	size_t pre_roll_size = 0;
+	bool is_voiced = false;
+	int hang_over_left = 0;
+	uint64_t voiced_frames = 0; // above the threshold since reset()
+	int silent_frames = 0; // below it since the last voiced frame
+	int last_pause_frames = 0; // of the latest silence speech resumed after
+	uint64_t pause_count = 0;
+
+	void _push_pre_roll(const float *p_frame);
+
+public:
+	/** Frames of p_frame_ms at p_sample_rate, must match the VAD. Drops the state. */
+	void setup(int p_sample_rate, int p_frame_ms);
+	/** Silence kept before a run. Changing it drops the silence kept so far. */
+	void set_pre_roll_ms(int p_pre_roll_ms);
+	_FORCE_INLINE_ int get_pre_roll_ms() const { return pre_roll_frames * frame_ms; }
+	/** Silence kept after a run. */
+	void set_hang_over_ms(int p_hang_over_ms);
+	_FORCE_INLINE_ int get_hang_over_ms() const { return hang_over_frames * frame_ms; }
+	_FORCE_INLINE_ void set_threshold(float p_threshold) { threshold = p_threshold; }
+
+	/** Frames above the threshold so far, changes whenever there was speech. */
+	_FORCE_INLINE_ uint64_t get_voiced_frames() const { return voiced_frames; }
+	/** Silence since the last voiced frame, hang-over included. */
+	_FORCE_INLINE_ int get_silence_ms() const { return silent_frames * frame_ms; }
+	/** The latest pause speech went on after, and how many there were, so a caller sees a new one. */
+	_FORCE_INLINE_ int get_last_pause_ms() const { return last_pause_frames * frame_ms; }
+	_FORCE_INLINE_ uint64_t get_pause_count() const { return pause_count; }
+	/** Input samples given to process() since reset(). */
+	_FORCE_INLINE_ uint64_t get_input_position() const { return pending_position + pending.size(); }
+
+	void reset();
+
+	/**
+	 * p_probabilities holds one value per frame completed by p_samples, as
+	 * returned by VadEngine::process() for the same samples. Appends the
+	 * voiced samples to r_voiced and one Segment per run that starts in them.
+	 */
+	void process(const float *p_samples, size_t p_count, const float *p_probabilities, size_t p_frames, std::vector<float> &r_voiced, std::vector<Segment> &r_segments);
+
+	SpeechSegmenter() {}
+};
+
+#endif // SPEECH_SEGMENTER_H
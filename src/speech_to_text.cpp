@@ -1,141 +1,469 @@
 #include "speech_to_text.h"
-#include <libsamplerate/src/samplerate.h>
+#include "gpu_frame_pacer.h"
+#include "lock_metrics.h"
+#include "model_registry.h"
+#include "rendering_device_backend.h"
+#include "trace.h"
+#include "webgpu_backend.h"
+#include "worker_pool_executor.h"
+#include <algorithm>
 #include <atomic>
-#include <cmath>
+#include <cstring>
 #include <godot_cpp/classes/audio_server.hpp>
+#include <godot_cpp/classes/config_file.hpp>
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/display_server.hpp>
+#include <godot_cpp/classes/engine.hpp>
+#include <godot_cpp/classes/performance.hpp>
 #include <godot_cpp/classes/project_settings.hpp>
+#include <godot_cpp/classes/reg_ex.hpp>
+#include <godot_cpp/classes/reg_ex_match.hpp>
+#include <godot_cpp/classes/rendering_server.hpp>
+#include <godot_cpp/classes/scene_tree.hpp>
+#include <godot_cpp/classes/scene_tree_timer.hpp>
 #include <godot_cpp/classes/time.hpp>
 #include <godot_cpp/core/error_macros.hpp>
 #include <godot_cpp/core/memory.hpp>
 #include <godot_cpp/variant/packed_vector2_array.hpp>
 #include <godot_cpp/variant/utility_functions.hpp>
+#include <iterator>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
-uint32_t _resample_audio_buffer(
-		const float *p_src, const uint32_t p_src_frame_count,
-		const uint32_t p_src_samplerate, const uint32_t p_target_samplerate,
-		float *p_dst) {
-	if (p_src_samplerate != p_target_samplerate) {
-		SRC_DATA src_data;
+#ifdef GGML_USE_CLBLAST
+#include <whisper.cpp/ggml-opencl.h>
+#endif
 
-		src_data.data_in = p_src;
-		src_data.data_out = p_dst;
+SpeechToText *SpeechToText::singleton = nullptr;
+
+SpeechToText *SpeechToText::get_singleton() {
+	return singleton;
+}
+
+#ifdef GGML_USE_CLBLAST
+static const char *opencl_cache_dir = "user://opencl_cache";
+
+/* Compiling the OpenCL and CLBlast kernels takes seconds on mobile GPUs, keep the binaries for the next run. */
+static void _set_opencl_cache_dir() {
+	const String dir = ProjectSettings::get_singleton()->globalize_path(opencl_cache_dir);
+	const Error err = DirAccess::make_dir_recursive_absolute(dir);
+	ERR_FAIL_COND_MSG(err != OK, vformat("Cannot create the OpenCL kernel cache \"%s\", kernels are compiled on every run.", dir));
+	ggml_cl_set_cache_dir(dir.utf8().get_data());
+}
+#endif
 
-		src_data.input_frames = p_src_frame_count;
-		src_data.src_ratio = (double)p_target_samplerate / (double)p_src_samplerate;
-		src_data.output_frames = int(p_src_frame_count * src_data.src_ratio);
+SpeechToText::SpeechToText() {
+	singleton = this;
+	ThreadAffinity::install();
+	_publish_params();
+#ifdef GGML_USE_CLBLAST
+	_set_opencl_cache_dir();
+#endif
+	_update_scheduler();
+	default_stream.instantiate();
+	default_stream->connect("update_transcribed_msgs", callable_mp(this, &SpeechToText::_on_default_stream_transcribed_msgs));
+	default_stream->connect("update_transcribed_packed", callable_mp(this, &SpeechToText::_on_default_stream_transcribed_packed));
+	// The Performance singleton is only there once the engine is set up.
+	call_deferred("_register_monitors");
+}
+
+static const char *monitor_ids[] = {
+	"whisper/queued_audio_seconds",
+	"whisper/buffered_audio_seconds",
+	"whisper/passes_per_second",
+	"whisper/real_time_factor",
+	"whisper/dropped_audio_seconds",
+	"whisper/backlog_warnings",
+	"whisper/model_memory_mib",
+	"whisper/state_memory_mib",
+	"whisper/repetition_aborts",
+	"whisper/waiting_streams",
+	"whisper/thermal_state",
+	"whisper/latency_p95_ms",
+};
 
-		src_data.end_of_input = 0;
-		int error = src_simple(&src_data, SRC_SINC_BEST_QUALITY, 1);
-		if (error != 0) {
-			ERR_PRINT(String(src_strerror(error)));
-			return 0;
+void SpeechToText::_register_monitors() {
+	Performance *performance = Performance::get_singleton();
+	if (performance == nullptr || are_monitors_registered) {
+		return;
+	}
+	const Callable monitors[] = {
+		callable_mp(this, &SpeechToText::_get_queued_audio_seconds),
+		callable_mp(this, &SpeechToText::_get_buffered_audio_seconds),
+		callable_mp(this, &SpeechToText::_get_passes_per_second),
+		callable_mp(this, &SpeechToText::_get_real_time_factor),
+		callable_mp(this, &SpeechToText::_get_dropped_audio_seconds),
+		callable_mp(this, &SpeechToText::_get_backlog_warnings),
+		callable_mp(this, &SpeechToText::_get_model_memory_mib),
+		callable_mp(this, &SpeechToText::_get_state_memory_mib),
+		callable_mp(this, &SpeechToText::_get_repetition_aborts),
+		callable_mp(this, &SpeechToText::_get_waiting_streams),
+		callable_mp(this, &SpeechToText::_get_thermal_state),
+		callable_mp(this, &SpeechToText::_get_latency_p95_ms),
+	};
+	for (size_t i = 0; i < std::size(monitor_ids); i++) {
+		if (!performance->has_custom_monitor(monitor_ids[i])) {
+			performance->add_custom_monitor(monitor_ids[i], monitors[i]);
 		}
-		return src_data.output_frames_gen;
-	} else {
-		memcpy(p_dst, p_src,
-				static_cast<size_t>(p_src_frame_count) * sizeof(float));
-		return p_src_frame_count;
 	}
+	monitor_window_usec = Time::get_singleton()->get_ticks_usec();
+	are_monitors_registered = true;
 }
 
-void _vector2_array_to_float_array(const uint32_t &p_mix_frame_count,
-		const Vector2 *p_process_buffer_in,
-		float *p_process_buffer_out) {
-	for (size_t i = 0; i < p_mix_frame_count; i++) {
-		p_process_buffer_out[i] = (p_process_buffer_in[i].x + p_process_buffer_in[i].y) / 2.0;
+void SpeechToText::_unregister_monitors() {
+	Performance *performance = Performance::get_singleton();
+	if (performance == nullptr || !are_monitors_registered) {
+		return;
 	}
+	for (const char *id : monitor_ids) {
+		if (performance->has_custom_monitor(id)) {
+			performance->remove_custom_monitor(id);
+		}
+	}
+	are_monitors_registered = false;
 }
 
-void high_pass_filter(std::vector<float> &data, float cutoff, float sample_rate) {
-	const float rc = 1.0f / (2.0f * Math_PI * cutoff);
-	const float dt = 1.0f / sample_rate;
-	const float alpha = dt / (rc + dt);
-
-	float y = data[0];
+/* Call with context_mutex held exclusively. */
+void SpeechToText::_update_model_memory() {
+	model_memory = (context_instance ? whisper_get_model_memory(context_instance) : 0) + (draft_context_instance ? whisper_get_model_memory(draft_context_instance) : 0);
+}
 
-	for (size_t i = 1; i < data.size(); i++) {
-		y = alpha * (y + data[i] - data[i - 1]);
-		data[i] = y;
+/* The rates only move once a second, the monitors are read every frame. */
+void SpeechToText::_update_monitor_rates() {
+	const uint64_t now = Time::get_singleton()->get_ticks_usec();
+	const uint64_t elapsed = now - monitor_window_usec;
+	if (elapsed < 1000000) {
+		return;
 	}
+	const uint64_t passes = monitor_passes.load(std::memory_order_relaxed);
+	const uint64_t pass_usec = monitor_pass_usec.load(std::memory_order_relaxed);
+	const uint64_t pass_samples = monitor_pass_samples.load(std::memory_order_relaxed);
+	monitor_passes_per_second = double(passes - monitor_window_passes) * 1000000.0 / elapsed;
+	// Decoding time per second of new audio, above 1 the streams fall behind.
+	const uint64_t window_samples = pass_samples - monitor_window_pass_samples;
+	monitor_real_time_factor = window_samples > 0 ? double(pass_usec - monitor_window_pass_usec) / 1000000.0 / (double(window_samples) / WHISPER_SAMPLE_RATE) : 0.0;
+	monitor_window_usec = now;
+	monitor_window_passes = passes;
+	monitor_window_pass_usec = pass_usec;
+	monitor_window_pass_samples = pass_samples;
 }
 
-/** Check if speech is ending. */
-bool vad_simple(std::vector<float> &pcmf32, int sample_rate, int last_ms, float vad_thold, float freq_thold, bool verbose) {
-	const int n_samples = pcmf32.size();
-	const int n_samples_last = (sample_rate * last_ms) / 1000;
+double SpeechToText::_get_queued_audio_seconds() {
+	MutexLock lock(streams_mutex);
+	uint64_t frames = 0;
+	for (const SpeechToTextStream *stream : streams) {
+		frames += stream->audio_queue.size();
+	}
+	return double(frames) / WHISPER_SAMPLE_RATE;
+}
 
-	if (n_samples_last >= n_samples) {
-		// not enough samples - assume no speech
-		return false;
+double SpeechToText::_get_buffered_audio_seconds() {
+	MutexLock lock(streams_mutex);
+	uint64_t frames = 0;
+	for (const SpeechToTextStream *stream : streams) {
+		frames += stream->buffered_frames.load(std::memory_order_relaxed);
 	}
+	return double(frames) / WHISPER_SAMPLE_RATE;
+}
+
+double SpeechToText::_get_passes_per_second() {
+	_update_monitor_rates();
+	return monitor_passes_per_second;
+}
+
+double SpeechToText::_get_real_time_factor() {
+	_update_monitor_rates();
+	return monitor_real_time_factor;
+}
 
-	if (freq_thold > 0.0f) {
-		high_pass_filter(pcmf32, freq_thold, sample_rate);
+double SpeechToText::_get_dropped_audio_seconds() {
+	MutexLock lock(streams_mutex);
+	uint64_t frames = 0;
+	for (const SpeechToTextStream *stream : streams) {
+		frames += stream->audio_queue.get_dropped_frames();
 	}
+	return double(frames) / WHISPER_SAMPLE_RATE;
+}
+
+uint64_t SpeechToText::_get_backlog_warnings() {
+	return backlog_warnings.load(std::memory_order_relaxed);
+}
 
-	float energy_all = 0.0f;
-	float energy_last = 0.0f;
+uint64_t SpeechToText::_get_repetition_aborts() {
+	return repetition_aborts.load(std::memory_order_relaxed);
+}
+
+int SpeechToText::_get_waiting_streams() {
+	return scheduler.get_waiting_streams();
+}
+
+int SpeechToText::_get_thermal_state() {
+	return ThermalMonitor::get_state();
+}
+
+double SpeechToText::_get_latency_p95_ms() {
+	return latency_histogram.get_percentile_ms(0.95);
+}
+
+Array SpeechToText::get_lock_metrics() {
+	return LockSite::get_all();
+}
+
+void SpeechToText::reset_lock_metrics() {
+	LockSite::reset_all();
+}
+
+double SpeechToText::_get_model_memory_mib() {
+	return model_memory.load(std::memory_order_relaxed) / 1048576.0;
+}
 
-	for (int i = 0; i < n_samples; i++) {
-		energy_all += fabsf(pcmf32[i]);
+/* audio_ctx the states can be capped at, in the steps of the default audio_ctx_granularity. */
+static const int budget_audio_ctx_steps[] = { 128, 256, 384, 512, 768, 1024, 1280, 1500 };
 
-		if (i >= n_samples - n_samples_last) {
-			energy_last += fabsf(pcmf32[i]);
+/* Not with context_mutex held. The states are measured by creating one per step, call it when the model or the budget change, not per pass. */
+void SpeechToText::_apply_memory_budget() {
+	int audio_ctx = 0;
+	if (memory_budget_mb > 0) {
+		std::shared_lock<std::shared_mutex> lock(context_mutex);
+		if (context_instance == nullptr) {
+			return;
+		}
+		uint64_t n_streams = 1;
+		uint64_t audio_memory = 0;
+		{
+			MutexLock streams_lock(streams_mutex);
+			n_streams = MAX(1, streams.size());
+			for (const SpeechToTextStream *stream : streams) {
+				audio_memory += stream->audio_memory.load(std::memory_order_relaxed);
+			}
 		}
+		// The prefetch state of pipelined encoding is as large as the main one.
+		const uint64_t states_per_stream = _get_params_snapshot()->pipelined_encoding ? 2 : 1;
+		const uint64_t budget = uint64_t(memory_budget_mb) * 1048576;
+		const int n_audio_ctx = whisper_n_audio_ctx(context_instance);
+		for (int step : budget_audio_ctx_steps) {
+			step = MIN(step, n_audio_ctx);
+			if (step <= audio_ctx) {
+				break;
+			}
+			uint64_t estimate = model_memory.load(std::memory_order_relaxed) + audio_memory;
+			estimate += n_streams * states_per_stream * whisper_estimate_state_memory(context_instance, step);
+			if (draft_context_instance) {
+				estimate += n_streams * whisper_estimate_state_memory(draft_context_instance, step);
+			}
+			if (estimate > budget) {
+				if (audio_ctx == 0) {
+					WARN_PRINT(vformat("memory_budget_mb of %d is below the %d MiB the smallest audio_ctx of %d needs, the states are sized for it anyway.", memory_budget_mb, int(estimate / 1048576), step));
+					audio_ctx = step;
+				}
+				break;
+			}
+			audio_ctx = step;
+		}
+		if (audio_ctx >= n_audio_ctx) {
+			// The full context fits, no cap.
+			audio_ctx = 0;
+		}
+	}
+	if (audio_ctx == budget_audio_ctx.load(std::memory_order_relaxed)) {
+		return;
 	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	budget_audio_ctx.store(audio_ctx, std::memory_order_relaxed);
+	_recreate_states();
+}
 
-	energy_all /= n_samples;
-	if (n_samples_last != 0) {
-		energy_last /= n_samples_last;
+void SpeechToText::set_memory_budget_mb(int p_megabytes) {
+	p_megabytes = MAX(0, p_megabytes);
+	if (p_megabytes == memory_budget_mb) {
+		return;
 	}
+	memory_budget_mb = p_megabytes;
+	_apply_memory_budget();
+}
 
-	if (verbose) {
-		fprintf(stderr, "%s: energy_all: %f, energy_last: %f, vad_thold: %f, freq_thold: %f\n", __func__, energy_all, energy_last, vad_thold, freq_thold);
+Dictionary SpeechToText::get_memory_usage() {
+	uint64_t kv_cache = 0;
+	uint64_t compute_buffers = 0;
+	uint64_t audio_buffers = 0;
+	{
+		MutexLock lock(streams_mutex);
+		for (const SpeechToTextStream *stream : streams) {
+			kv_cache += stream->kv_memory.load(std::memory_order_relaxed);
+			compute_buffers += stream->compute_memory.load(std::memory_order_relaxed);
+			audio_buffers += stream->mel_memory.load(std::memory_order_relaxed) + stream->audio_memory.load(std::memory_order_relaxed);
+		}
 	}
+	const uint64_t weights = model_memory.load(std::memory_order_relaxed);
+	Dictionary ret;
+	ret["weights"] = int64_t(weights);
+	ret["kv_cache"] = int64_t(kv_cache);
+	ret["compute_buffers"] = int64_t(compute_buffers);
+	ret["audio_buffers"] = int64_t(audio_buffers);
+	ret["total"] = int64_t(weights + kv_cache + compute_buffers + audio_buffers);
+	return ret;
+}
 
-	if ((energy_all < 0.0001f && energy_last < 0.0001f) == false || energy_last > vad_thold * energy_all) {
-		return false;
+double SpeechToText::_get_state_memory_mib() {
+	MutexLock lock(streams_mutex);
+	uint64_t bytes = 0;
+	for (const SpeechToTextStream *stream : streams) {
+		bytes += stream->state_memory.load(std::memory_order_relaxed);
 	}
-	return true;
+	return bytes / 1048576.0;
 }
 
-SpeechToText *SpeechToText::singleton = nullptr;
+Ref<SpeechToTextStream> SpeechToText::create_stream() {
+	Ref<SpeechToTextStream> stream;
+	stream.instantiate();
+	return stream;
+}
 
-SpeechToText *SpeechToText::get_singleton() {
-	return singleton;
+/**
+ * Feed one chunk to each of p_streams at once, e.g. the voice chat of every
+ * player once per frame. p_buffers holds, per stream, a PackedVector2Array at
+ * the mix rate as add_audio_buffer takes, or a PackedFloat32Array of mono
+ * samples at p_rate as add_audio_mono_f32 takes. The streams resample and
+ * clean up their chunks one after the other, then the high-pass filters of
+ * their VADs run together, up to AUDIO_HIGH_PASS_MAX_LANES streams at a time,
+ * and each stream goes on with its segmenter. Every stream ends up with the
+ * audio and the decisions its own add_audio_buffer would have made. The batch
+ * is the producer of all of them, none may be fed from another thread.
+ */
+void SpeechToText::add_audio_batch(const Array &p_streams, const Array &p_buffers, int p_rate) {
+	TRACE_ZONE("add_audio_batch");
+	ERR_FAIL_COND_MSG(p_streams.size() != p_buffers.size(), "There must be one buffer per stream.");
+	ERR_FAIL_COND_MSG(p_rate <= 0, "The sample rate must be positive.");
+	std::vector<SpeechToTextStream *> batch_streams;
+	std::vector<SpeechToTextStream::IngestChunk> chunks(p_streams.size());
+	// The mono chunks at 16 kHz are read in place until they are detected.
+	std::vector<PackedFloat32Array> mono_buffers;
+	batch_streams.reserve(p_streams.size());
+	for (int64_t i = 0; i < p_streams.size(); i++) {
+		SpeechToTextStream *stream = Object::cast_to<SpeechToTextStream>(p_streams[i]);
+		ERR_CONTINUE_MSG(stream == nullptr, vformat("Element %d of the streams is not a SpeechToTextStream.", i));
+		// Its scratch buffers hold one chunk at a time.
+		ERR_CONTINUE_MSG(std::find(batch_streams.begin(), batch_streams.end(), stream) != batch_streams.end(), vformat("Element %d of the streams is in the batch twice.", i));
+		SpeechToTextStream::IngestChunk &chunk = chunks[batch_streams.size()];
+		const Variant &buffer = p_buffers[i];
+		if (buffer.get_type() == Variant::PACKED_VECTOR2_ARRAY) {
+			const PackedVector2Array frames = buffer;
+			if (stream->recording.is_recording()) {
+				stream->recording.write(frames, AudioServer::get_singleton()->get_mix_rate());
+			}
+			stream->_add_audio_buffer(frames, 0, &chunk);
+		} else if (buffer.get_type() == Variant::PACKED_FLOAT32_ARRAY) {
+			mono_buffers.push_back(buffer);
+			stream->_ingest_mono(mono_buffers.back().ptr(), mono_buffers.back().size(), uint32_t(p_rate), true, &chunk);
+		} else {
+			ERR_CONTINUE_MSG(true, vformat("Element %d of the buffers is neither a PackedVector2Array nor a PackedFloat32Array.", i));
+		}
+		batch_streams.push_back(stream);
+	}
+
+	AudioHighPassLane lanes[AUDIO_HIGH_PASS_MAX_LANES];
+	int n_lanes = 0;
+	for (size_t i = 0; i < batch_streams.size(); i++) {
+		if (batch_streams[i]->_get_high_pass_lane(chunks[i], lanes[n_lanes]) && ++n_lanes == AUDIO_HIGH_PASS_MAX_LANES) {
+			audio_high_pass_batch(lanes, n_lanes);
+			n_lanes = 0;
+		}
+	}
+	audio_high_pass_batch(lanes, n_lanes);
+
+	for (size_t i = 0; i < batch_streams.size(); i++) {
+		if (chunks[i].settings) {
+			batch_streams[i]->_detect_speech(chunks[i], true);
+		}
+	}
 }
 
-SpeechToText::SpeechToText() {
-	singleton = this;
+void SpeechToText::_register_stream(SpeechToTextStream *p_stream) {
+	MutexLock lock(streams_mutex);
+	streams.push_back(p_stream);
+}
+
+void SpeechToText::_unregister_stream(SpeechToTextStream *p_stream) {
+	MutexLock lock(streams_mutex);
+	streams.erase(p_stream);
 }
 
-void SpeechToText::start_listen() {
-	if (this->worker == nullptr) {
-		this->worker = memnew(Thread);
+Ref<TranscriptionJob> SpeechToText::transcribe_async(const Variant &p_audio, const Dictionary &p_options) {
+	Ref<TranscriptionJob> job;
+	job.instantiate();
+	if (!job->_setup(p_audio, p_options)) {
+		return Ref<TranscriptionJob>();
 	}
+	_queue_job(job);
+	return job;
+}
 
-	if (this->is_running == false) {
-		this->is_running = true;
-		this->worker->start(callable_mp(this, &SpeechToText::run), Thread::Priority::PRIORITY_NORMAL);
-		t_last_iter = Time::get_singleton()->get_ticks_msec();
+Ref<TranscriptionJob> SpeechToText::transcribe_file_async(const String &p_path, const Dictionary &p_options) {
+	Ref<TranscriptionJob> job;
+	job.instantiate();
+	if (!job->_setup_file(p_path, p_options)) {
+		return Ref<TranscriptionJob>();
 	}
+	_queue_job(job);
+	return job;
+}
+
+Error SpeechToText::save_trace(const String &p_path, bool p_clear) {
+#ifdef GODOT_WHISPER_TRACE
+	return trace_save(p_path, p_clear);
+#else
+	ERR_FAIL_V_MSG(ERR_UNAVAILABLE, "Trace zones are not compiled in, build with tracing=yes.");
+#endif
+}
+
+void SpeechToText::_queue_job(const Ref<TranscriptionJob> &p_job) {
+	// The job needs the weights right away, they are loaded here rather than in the background.
+	_wake_from_hibernation(false);
+	// Apply pending model changes now rather than in the middle of the first window.
+	_reload_model_if_dirty();
+	p_job->self = p_job;
+	jobs.push_back(p_job.ptr());
+	scheduler.add_job(p_job.ptr());
 }
 
-void SpeechToText::stop_listen() {
-	this->is_running = false;
-	if (this->worker != nullptr) {
-		this->worker = nullptr;
+void SpeechToText::_unregister_job(TranscriptionJob *p_job) {
+	jobs.erase(p_job);
+	if (jobs.is_empty()) {
+		_schedule_hibernation();
 	}
 }
 
+void SpeechToText::_on_default_stream_transcribed_msgs(int p_process_time_ms, Array p_transcribed_msgs) {
+	emit_signal("update_transcribed_msgs", p_process_time_ms, p_transcribed_msgs);
+}
+
+void SpeechToText::_on_default_stream_transcribed_packed(int p_process_time_ms, const Ref<PackedTranscriptionResults> &p_results) {
+	emit_signal("update_transcribed_packed", p_process_time_ms, p_results);
+}
+
 void SpeechToText::set_language(int p_language) {
 	language = (Language)p_language;
+	// Passes in flight would finish in the old language.
+	cancel_passes();
 	params.language = language_to_code(language);
-	if (is_running) {
-		this->full_params.language = params.language.c_str();
+	_publish_params();
+	_update_vocab_subset();
+}
+
+void SpeechToText::set_allowed_languages(const PackedStringArray &p_languages) {
+	allowed_languages.clear();
+	params.allowed_lang_ids.clear();
+	for (int i = 0; i < p_languages.size(); i++) {
+		const int lang_id = whisper_lang_id(p_languages[i].utf8().get_data());
+		ERR_CONTINUE_MSG(lang_id < 0, vformat("Unknown language \"%s\".", p_languages[i]));
+		if (std::find(params.allowed_lang_ids.begin(), params.allowed_lang_ids.end(), lang_id) == params.allowed_lang_ids.end()) {
+			allowed_languages.push_back(p_languages[i]);
+			params.allowed_lang_ids.push_back(lang_id);
+		}
 	}
+	_publish_params();
 }
 
 int SpeechToText::get_language() {
@@ -350,349 +678,1971 @@ std::string SpeechToText::language_to_code(Language language) {
 }
 
 void SpeechToText::set_language_model(Ref<WhisperResource> p_model) {
+	if (p_model == model) {
+		return;
+	}
 	model = p_model;
-	load_model();
+	_queue_model_reload();
 }
 
-void SpeechToText::load_model() {
-	whisper_free(context_instance);
-	if (model.is_null()) {
+void SpeechToText::apply_streaming_preset() {
+	ERR_FAIL_COND_MSG(model.is_null(), "No language model to take the preset of.");
+	_apply_streaming_preset(false);
+}
+
+/* The defaults of the properties a streaming preset sets, a property still at its default was not set by hand. */
+static Dictionary _get_streaming_preset_defaults() {
+	const SpeechToTextParams defaults;
+	Dictionary values;
+	values["pass_trigger_ms"] = defaults.pass_trigger_ms;
+	values["audio_ctx_max"] = defaults.audio_ctx_max;
+	values["max_tokens"] = defaults.max_tokens;
+	values["max_utterance_ms"] = defaults.max_utterance_ms;
+	values["sampling_strategy"] = defaults.sampling_strategy;
+	return values;
+}
+
+void SpeechToText::_apply_streaming_preset(bool p_keep_overrides) {
+	const Dictionary preset = model->get_streaming_preset();
+	const Dictionary defaults = _get_streaming_preset_defaults();
+	const Array keys = preset.keys();
+	for (int i = 0; i < keys.size(); i++) {
+		const StringName key = keys[i];
+		if (p_keep_overrides) {
+			const Variant value = get(key);
+			const bool at_default = defaults.has(key) && value == defaults[key];
+			const bool at_preset = applied_streaming_preset.has(key) && value == applied_streaming_preset[key];
+			if (!at_default && !at_preset) {
+				continue;
+			}
+		}
+		set(key, preset[key]);
+		// What the setter clamped it to, for telling it apart from a value set by hand.
+		applied_streaming_preset[key] = get(key);
+	}
+}
+
+bool SpeechToText::_is_lazy_load() const {
+	return !load_model_in_editor && Engine::get_singleton()->is_editor_hint();
+}
+
+void SpeechToText::set_load_model_in_editor(bool p_load_model_in_editor) {
+	load_model_in_editor = p_load_model_in_editor;
+	if (load_model_in_editor && (is_reload_queued || is_draft_reload_queued)) {
+		call_deferred("_reload_model_if_dirty");
+	}
+}
+
+void SpeechToText::_queue_model_reload() {
+	// Merge several property changes in the same frame into a single reload.
+	if (!is_reload_queued) {
+		is_reload_queued = true;
+		// Opening a scene in the editor must not read the weights, they wait for start_listen or a transcription.
+		if (!_is_lazy_load()) {
+			call_deferred("_reload_model_if_dirty");
+		}
+	}
+}
+
+void SpeechToText::set_hibernate_after_seconds(float p_seconds) {
+	hibernate_after_seconds = MAX(0.0f, p_seconds);
+	_schedule_hibernation();
+}
+
+/* Main thread, after a stream stopped listening, the last job finished or a model loaded. The timer checks again, a stream may have started since. */
+void SpeechToText::_schedule_hibernation() {
+	last_listen_msec = Time::get_singleton()->get_ticks_msec();
+	if (hibernate_after_seconds <= 0.0f || is_hibernated) {
+		return;
+	}
+	SceneTree *tree = Object::cast_to<SceneTree>(Engine::get_singleton()->get_main_loop());
+	if (tree) {
+		tree->create_timer(hibernate_after_seconds)->connect("timeout", callable_mp(this, &SpeechToText::_check_hibernation));
+	}
+}
+
+void SpeechToText::_check_hibernation() {
+	if (hibernate_after_seconds <= 0.0f || is_hibernated || is_model_loading || !jobs.is_empty()) {
 		return;
 	}
-	PackedByteArray data = model->get_content();
-	if (data.is_empty()) {
+	{
+		MutexLock lock(streams_mutex);
+		for (const SpeechToTextStream *stream : streams) {
+			if (stream->is_running.load(std::memory_order_relaxed)) {
+				return;
+			}
+		}
+	}
+	const uint64_t idle_msec = Time::get_singleton()->get_ticks_msec() - last_listen_msec;
+	if (idle_msec + 1 < uint64_t(hibernate_after_seconds * 1000.0f)) {
+		// A later stop_listen scheduled a timer of its own.
 		return;
 	}
-	context_instance = whisper_init_from_buffer_with_params((void *)(data.ptr()), data.size(), context_parameters);
-	UtilityFunctions::print(whisper_print_system_info());
+	_hibernate();
 }
 
-void SpeechToText::set_use_gpu(bool use_gpu) {
-	context_parameters.use_gpu = use_gpu;
+void SpeechToText::_hibernate() {
+	cancel_passes();
+	{
+		std::unique_lock<std::shared_mutex> lock(context_mutex);
+		_recreate_states();
+	}
+	if (hibernate_release_weights && context_instance != nullptr) {
+		_swap_draft_context(nullptr);
+		_swap_context(nullptr);
+		loaded_model_file = String();
+		are_weights_hibernated = true;
+	}
+	is_hibernated = true;
+}
+
+/* Main thread, before a stream listens or a job is queued. The states come back with the first pass. */
+void SpeechToText::_wake_from_hibernation(bool p_async) {
+	last_listen_msec = Time::get_singleton()->get_ticks_msec();
+	if (!is_hibernated) {
+		return;
+	}
+	is_hibernated = false;
+	if (!are_weights_hibernated) {
+		return;
+	}
+	are_weights_hibernated = false;
+	is_draft_reload_queued = draft_model.is_valid();
+	if (p_async && model.is_valid() && !is_model_loading) {
+		// The stream queues its audio meanwhile, passes start once the context is swapped in.
+		load_model_async();
+	} else {
+		is_reload_queued = true;
+	}
+}
+
+void SpeechToText::_reload_model_if_dirty() {
+	if (is_draft_reload_queued) {
+		is_draft_reload_queued = false;
+		_load_draft_model();
+	}
+	if (!is_reload_queued) {
+		return;
+	}
+	if (is_model_loading) {
+		// Still queued, _finish_model_load() reloads once the load in flight is in.
+		return;
+	}
+	is_reload_queued = false;
+	const String file = model.is_valid() ? model->get_file() : String();
+	if (context_instance != nullptr && file == loaded_model_file && context_parameters.use_gpu == loaded_context_parameters.use_gpu &&
+			context_parameters.gpu_device == loaded_context_parameters.gpu_device &&
+			context_parameters.repack_weights == loaded_context_parameters.repack_weights &&
+			context_parameters.lock_model_memory == loaded_context_parameters.lock_model_memory &&
+			context_parameters.use_huge_pages == loaded_context_parameters.use_huge_pages &&
+			(context_parameters.mmap_path != nullptr) == (loaded_context_parameters.mmap_path != nullptr) &&
+			context_parameters.backend_init == loaded_context_parameters.backend_init) {
+		// Same weights with the same parameters are already loaded.
+		return;
+	}
+	if (context_instance != nullptr && model.is_valid()) {
+		// Hot swap, the streams decode with the old weights until the new ones are in.
+		load_model_async();
+		return;
+	}
 	load_model();
 }
 
-SpeechToText::~SpeechToText() {
-	singleton = nullptr;
-	stop_listen();
-	whisper_free(context_instance);
-}
-/** Add audio data in PCM f32 format. */
-void SpeechToText::add_audio_buffer(PackedVector2Array buffer) {
-	s_mutex.lock();
-	int buffer_len = buffer.size();
-	float *buffer_float = (float *)memalloc(sizeof(float) * buffer_len);
-	float *resampled_float = (float *)memalloc(sizeof(float) * buffer_len * SPEECH_SETTING_SAMPLE_RATE / AudioServer::get_singleton()->get_mix_rate());
-	_vector2_array_to_float_array(buffer_len, buffer.ptr(), buffer_float);
-	// Speaker frame.
-	int result_size = _resample_audio_buffer(
-			buffer_float, // Pointer to source buffer
-			buffer_len, // Size of source buffer * sizeof(float)
-			AudioServer::get_singleton()->get_mix_rate(), // Source sample rate
-			SPEECH_SETTING_SAMPLE_RATE, // Target sample rate
-			resampled_float);
-
-	std::vector<float> data(resampled_float, resampled_float + result_size);
-
-	const int vad_last_ms = 0;
-	const float vad_thold = params.vad_thold;
-	const float freq_thold = params.freq_thold;
-	bool is_empty_array = vad_simple(data, WHISPER_SAMPLE_RATE, vad_last_ms, vad_thold, freq_thold, false);
-
-	if (is_empty_array == false) {
-		s_queued_pcmf32.insert(s_queued_pcmf32.end(), data.begin(), data.end());
-	}
-	memfree(buffer_float);
-	memfree(resampled_float);
-	s_mutex.unlock();
-}
-
-/** Run Whisper in its own thread to not block the main thread. */
-void SpeechToText::run() {
-	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
-	whisper_full_params whisper_params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-	// See here for example https://github.com/ggerganov/whisper.cpp/blob/master/examples/stream/stream.cpp#L302
-	whisper_params.max_len = 0;
-	whisper_params.print_progress = false;
-	whisper_params.print_special = false;
-	whisper_params.print_realtime = false;
-	// This is set later on based on how much frames we can process
-	whisper_params.duration_ms = 0;
-	whisper_params.print_timestamps = false;
-	whisper_params.translate = speech_to_text_obj->params.translate;
-	whisper_params.single_segment = false;
-	whisper_params.no_timestamps = false;
-	whisper_params.token_timestamps = true;
-	whisper_params.max_tokens = speech_to_text_obj->params.max_tokens;
-	whisper_params.language = speech_to_text_obj->params.language.c_str();
-	whisper_params.n_threads = speech_to_text_obj->params.n_threads;
-	whisper_params.speed_up = speech_to_text_obj->params.speed_up;
-	whisper_params.prompt_tokens = nullptr;
-	whisper_params.prompt_n_tokens = 0;
-	whisper_params.suppress_non_speech_tokens = true;
-	whisper_params.suppress_blank = true;
-	whisper_params.entropy_thold = speech_to_text_obj->params.entropy_threshold;
-	whisper_params.temperature = 0.0;
-	whisper_params.no_context = true;
-
-	/**
-	 * Experimental optimization: Reduce audio_ctx to 15s (half of the chunk
-	 * size whisper is designed for) to speed up 2x.
-	 * https://github.com/ggerganov/whisper.cpp/issues/137#issuecomment-1318412267
-	 */
-	whisper_params.audio_ctx = 768;
-
-	speech_to_text_obj->full_params = whisper_params;
-
-	/* When more than this amount of audio received, run an iteration. */
-	const int trigger_ms = 400;
-	const int n_samples_trigger = (trigger_ms / 1000.0) * WHISPER_SAMPLE_RATE;
-	/**
-	 * When more than this amount of audio accumulates in the audio buffer,
-	 * force finalize current audio context and clear the buffer. Note that
-	 * VAD may finalize an iteration earlier.
-	 */
-	// This is recommended to be smaller than the time wparams.audio_ctx
-	// represents so an iteration can fit in one chunk.
-	const int iter_threshold_ms = trigger_ms * 35;
-	const int n_samples_iter_threshold = (iter_threshold_ms / 1000.0) * WHISPER_SAMPLE_RATE;
-
-	/**
-	 * ### Reminders
-	 *
-	 * - Note that whisper designed to process audio in 30-second chunks, and
-	 *   the execution time of processing smaller chunks may not be shorter.
-	 * - The design of trigger and threshold allows inputing audio data at
-	 *   arbitrary rates with zero config. Inspired by Assembly.ai's
-	 *   real-time transcription API
-	 *   (https://github.com/misraturp/Real-time-transcription-from-microphone/blob/main/speech_recognition.py)
-	 */
-
-	/* VAD parameters */
-	// The most recent 3s.
-	const int vad_window_s = 3;
-	const int n_samples_vad_window = WHISPER_SAMPLE_RATE * vad_window_s;
-	// In VAD, compare the energy of the last 500ms to that of the total 3s.
-	const int vad_last_ms = 500;
-	// Keep the last 0.5s of an iteration to the next one for better
-	// transcription at begin/end.
-	const int n_samples_keep_iter = WHISPER_SAMPLE_RATE * 0.5;
-	const float vad_thold = speech_to_text_obj->params.vad_thold;
-	const float freq_thold = speech_to_text_obj->params.freq_thold;
-
-	/* Audio buffer */
-	std::vector<float> pcmf32;
-
-	int empty_iter_count = 0;
-	bool need_close_segment = false;
-	/* Processing loop */
-	while (speech_to_text_obj->is_running) {
-		{
-			speech_to_text_obj->s_mutex.lock();
-			need_close_segment = false;
-			if (speech_to_text_obj->s_queued_pcmf32.size() < WHISPER_SAMPLE_RATE) {
-				empty_iter_count += 1;
-				if (empty_iter_count >= 20 && pcmf32.size() > 0) {
-					need_close_segment = true;
-					empty_iter_count = 0;
-				} else {
-					empty_iter_count = empty_iter_count % 20;
-					speech_to_text_obj->s_mutex.unlock();
-					OS::get_singleton()->delay_msec(50);
-					continue;
-				}
-			}
-			speech_to_text_obj->s_mutex.unlock();
+std::vector<uint8_t> SpeechToText::_compile_token_flags(whisper_context *p_context) {
+	std::vector<uint8_t> flags;
+	if (p_context == nullptr) {
+		return flags;
+	}
+	static const char *const split_punctuation[] = { ",", ".", "?", "!", "，", "。", "？", "！" };
+	const whisper_token token_eot = whisper_token_eot(p_context);
+	const whisper_token token_beg = whisper_token_beg(p_context);
+	// Only a speaker turn of tinydiarize models, the passes look at it with tdrz_enable alone.
+	const whisper_token token_solm = whisper_token_solm(p_context);
+	flags.resize(whisper_n_vocab(p_context), 0);
+	for (int id = 0; id < (int)flags.size(); id++) {
+		if (id >= token_eot) {
+			flags[id] |= TOKEN_SPECIAL;
+			flags[id] |= id >= token_beg ? TOKEN_TIMESTAMP : 0;
+			flags[id] |= id == token_solm ? TOKEN_SPEAKER_TURN : 0;
+			continue;
 		}
-		{
-			speech_to_text_obj->s_mutex.lock();
-			if (speech_to_text_obj->s_queued_pcmf32.size() > 2 * n_samples_iter_threshold) {
-				WARN_PRINT("Too much audio is going to be processed, result may not come out in real time");
+		const char *text = whisper_token_to_str(p_context, id);
+		for (const char *mark : split_punctuation) {
+			if (strcmp(text, mark) == 0) {
+				flags[id] |= TOKEN_SPLIT_PUNCTUATION;
+				break;
 			}
-			speech_to_text_obj->s_mutex.unlock();
-		}
-		{
-			speech_to_text_obj->s_mutex.lock();
-			pcmf32.insert(pcmf32.end(), speech_to_text_obj->s_queued_pcmf32.begin(), speech_to_text_obj->s_queued_pcmf32.end());
-			speech_to_text_obj->s_queued_pcmf32.clear();
-			speech_to_text_obj->s_mutex.unlock();
 		}
+		flags[id] |= strcmp(text, " you") == 0 ? TOKEN_YOU : 0;
+		flags[id] |= strcmp(text, ".") == 0 ? TOKEN_PERIOD : 0;
+	}
+	return flags;
+}
 
-		if (!speech_to_text_obj->context_instance) {
-			ERR_PRINT("Context instance is null");
-			continue;
+std::vector<whisper_token> SpeechToText::_compile_suppress_ids(whisper_context *p_context) const {
+	std::vector<whisper_token> ids;
+	if (p_context == nullptr || (suppressed_tokens.is_empty() && suppress_regex.is_empty())) {
+		return ids;
+	}
+	std::unordered_set<std::string> texts;
+	for (int i = 0; i < suppressed_tokens.size(); i++) {
+		texts.insert(suppressed_tokens[i].utf8().get_data());
+	}
+	Ref<RegEx> regex;
+	if (!suppress_regex.is_empty()) {
+		regex = RegEx::create_from_string(suppress_regex);
+		if (regex.is_null() || !regex->is_valid()) {
+			ERR_PRINT("Invalid suppress_regex: " + suppress_regex);
+			regex.unref();
 		}
-		float time_started = Time::get_singleton()->get_ticks_msec();
-		{
-			whisper_params.duration_ms = pcmf32.size() * 1000.0f / WHISPER_SAMPLE_RATE;
-			int ret = whisper_full(speech_to_text_obj->context_instance, speech_to_text_obj->full_params, pcmf32.data(), pcmf32.size());
-			if (ret != 0) {
-				ERR_PRINT("Failed to process audio, returned " + rtos(ret));
-				continue;
-			}
+	}
+	// Only text tokens, the special ones are handled by whisper itself.
+	const whisper_token token_eot = whisper_token_eot(p_context);
+	for (whisper_token id = 0; id < token_eot; id++) {
+		const char *text = whisper_token_to_str(p_context, id);
+		if (texts.count(text) > 0 || (regex.is_valid() && regex->search(String::utf8(text)).is_valid())) {
+			ids.push_back(id);
 		}
-		{
-			transcribed_msg msg;
-			/**
-			 * Simple VAD from the "stream" example in whisper.cpp
-			 * https://github.com/ggerganov/whisper.cpp/blob/231bebca7deaf32d268a8b207d15aa859e52dbbe/examples/stream/stream.cpp#L378
-			 */
-			bool speech_has_end = false;
-			/* Need enough accumulated audio to do VAD. */
-			if ((int)pcmf32.size() >= n_samples_vad_window) {
-				std::vector<float> pcmf32_window(pcmf32.end() - n_samples_vad_window, pcmf32.end());
-				speech_has_end = vad_simple(pcmf32_window, WHISPER_SAMPLE_RATE, vad_last_ms,
-						vad_thold, freq_thold, false);
-				if (speech_has_end) {
-					printf("speech end detected\n");
-				}
-			}
-			if (need_close_segment) {
-				if (vad_simple(pcmf32, WHISPER_SAMPLE_RATE, 0, vad_thold, freq_thold, false)) {
-					msg.text = "";
+	}
+	return ids;
+}
+
+void SpeechToText::_update_suppress_ids() {
+	std::vector<whisper_token> ids;
+	std::vector<whisper_token> draft_ids;
+	{
+		std::shared_lock<std::shared_mutex> lock(context_mutex);
+		ids = _compile_suppress_ids(context_instance);
+		draft_ids = _compile_suppress_ids(draft_context_instance);
+	}
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	suppress_ids = std::move(ids);
+	draft_suppress_ids = std::move(draft_ids);
+}
+
+std::vector<whisper_token> SpeechToText::_compile_prompt_ids(whisper_context *p_context, const String &p_prompt) const {
+	std::vector<whisper_token> ids;
+	if (p_context == nullptr || p_prompt.is_empty()) {
+		return ids;
+	}
+	ids.resize(whisper_n_text_ctx(p_context));
+	// Spelled the way it would follow text, with its leading space.
+	const CharString text = (" " + p_prompt.strip_edges()).utf8();
+	const int n_tokens = whisper_tokenize(p_context, text.get_data(), ids.data(), ids.size());
+	if (n_tokens < 0) {
+		ERR_PRINT("initial_prompt is longer than the text context, it is not used.");
+	}
+	ids.resize(MAX(0, n_tokens));
+	// whisper_full keeps half the text context for the prompt, the committed text needs room too.
+	const size_t max_prompt = whisper_n_text_ctx(p_context) / 4;
+	if (ids.size() > max_prompt) {
+		WARN_PRINT(vformat("initial_prompt is %d tokens, only the last %d are used.", int(ids.size()), int(max_prompt)));
+		ids.erase(ids.begin(), ids.end() - max_prompt);
+	}
+	return ids;
+}
+
+void SpeechToText::_update_prompt_ids() {
+	std::vector<whisper_token> ids;
+	{
+		std::shared_lock<std::shared_mutex> lock(context_mutex);
+		ids = _compile_prompt_ids(context_instance, initial_prompt);
+	}
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	initial_prompt_ids = std::move(ids);
+}
+
+void SpeechToText::set_initial_prompt(const String &p_initial_prompt) {
+	initial_prompt = p_initial_prompt;
+	_update_prompt_ids();
+}
+
+void SpeechToText::set_suppressed_tokens(const PackedStringArray &p_suppressed_tokens) {
+	suppressed_tokens = p_suppressed_tokens;
+	_update_suppress_ids();
+}
+
+void SpeechToText::set_suppress_regex(const String &p_suppress_regex) {
+	suppress_regex = p_suppress_regex;
+	_update_suppress_ids();
+}
+
+void SpeechToText::_compile_grammar() {
+	grammar_parser::parse_state state;
+	size_t start_rule_index = 0;
+	String error;
+	if (!grammar.is_empty()) {
+		// The parser prints what is wrong to stderr and returns no rules.
+		state = grammar_parser::parse(grammar.utf8().get_data());
+		if (state.rules.empty()) {
+			error = "Invalid grammar";
+		}
+		for (const std::vector<whisper_grammar_element> &rule : state.rules) {
+			for (const whisper_grammar_element &element : rule) {
+				// whisper_full asserts on references to rules that were never defined.
+				if (element.type == WHISPER_GRETYPE_RULE_REF && (element.value >= state.rules.size() || state.rules[element.value].empty())) {
+					error = "The grammar references an undefined rule";
 				}
-				speech_has_end = true;
-			}
-			const int n_segments = whisper_full_n_segments(speech_to_text_obj->context_instance);
-			int64_t delete_target_t = 0;
-			bool find_delete_target_t = false;
-			int64_t target_index = 0;
-
-			int64_t half_t = 0;
-			if (n_segments > 0) {
-				const int cur_n_tokens = whisper_full_n_tokens(speech_to_text_obj->context_instance, n_segments - 1);
-				auto cur_last_token = whisper_full_get_token_data(speech_to_text_obj->context_instance, n_segments - 1, cur_n_tokens - 1);
-				half_t = cur_last_token.t1 * 1.0 / 2.0;
 			}
-			for (int i = 0; i < n_segments; ++i) {
-				const int n_tokens = whisper_full_n_tokens(speech_to_text_obj->context_instance, i);
-				for (int j = 0; j < n_tokens; j++) {
-					auto token = whisper_full_get_token_data(speech_to_text_obj->context_instance, i, j);
-					auto text = whisper_full_get_token_text(speech_to_text_obj->context_instance, i, j);
-					// Idea from https://github.com/yum-food/TaSTT/blob/dbb2f72792e2af3ff220313f84bf76a9a1ddbeb4/Scripts/transcribe_v2.py#L457C17-L462C25
-					if (find_delete_target_t == false) {
-						String cur_text = String(text);
-						if (cur_text.begins_with("[_TT_") || cur_text == "," || cur_text == "." || cur_text == "?" || cur_text == "!" || cur_text == "，" || cur_text == "。" || cur_text == "？" || cur_text == "！") {
-							if (token.t1 < half_t) {
-								delete_target_t = token.t1;
-								target_index = msg.text.size() + cur_text.length();
-								msg.text += text;
-							} else {
-								if (delete_target_t == 0) {
-									delete_target_t = token.t1;
-									msg.text += text;
-									if (speech_has_end == false) {
-										msg.text += "{SPLIT}";
-									}
-
-								} else {
-									if (speech_has_end == false) {
-										msg.text.insert(target_index, "{SPLIT}");
-									}
-									msg.text += text;
-								}
-								find_delete_target_t = true;
-							}
-						} else {
-							msg.text += text;
-						}
-					} else {
-						msg.text += text;
-					}
-				}
+		}
+		auto start_rule = state.symbol_ids.find(grammar_start_rule.utf8().get_data());
+		if (error.is_empty() && start_rule == state.symbol_ids.end()) {
+			error = vformat("The grammar has no rule \"%s\"", grammar_start_rule);
+		} else if (error.is_empty()) {
+			start_rule_index = start_rule->second;
+		}
+	}
+	if (!error.is_empty()) {
+		ERR_PRINT(error + ", decoding without it.");
+		state = grammar_parser::parse_state();
+	}
+	{
+		std::unique_lock<std::shared_mutex> lock(context_mutex);
+		grammar_state = std::move(state);
+		grammar_rules = grammar_state.c_rules();
+		grammar_start_rule_index = start_rule_index;
+	}
+	_update_vocab_subset();
+}
+
+/* Call with context_mutex held, the rules stay valid while it is. */
+void SpeechToText::_apply_grammar(whisper_full_params &r_params) const {
+	r_params.grammar_rules = grammar_rules.empty() ? nullptr : const_cast<const whisper_grammar_element **>(grammar_rules.data());
+	r_params.n_grammar_rules = grammar_rules.size();
+	r_params.i_start_rule = grammar_start_rule_index;
+	r_params.grammar_penalty = grammar_penalty;
+}
+
+void SpeechToText::set_grammar(const String &p_grammar) {
+	if (p_grammar == grammar) {
+		return;
+	}
+	grammar = p_grammar;
+	_compile_grammar();
+}
+
+void SpeechToText::set_grammar_start_rule(const String &p_grammar_start_rule) {
+	if (p_grammar_start_rule == grammar_start_rule) {
+		return;
+	}
+	grammar_start_rule = p_grammar_start_rule;
+	_compile_grammar();
+}
+
+void SpeechToText::set_grammar_penalty(float p_grammar_penalty) {
+	grammar_penalty = MAX(0.0f, p_grammar_penalty);
+}
+
+struct CodepointRange {
+	uint32_t first;
+	uint32_t last;
+};
+
+/* Every language keeps ASCII, Latin-1 punctuation, general punctuation and currency signs. */
+static const CodepointRange common_ranges[] = { { 0x0000, 0x007F }, { 0x00A0, 0x00BF }, { 0x2000, 0x206F }, { 0x20A0, 0x20CF } };
+
+struct LanguageScript {
+	const char *languages; // whisper codes, space separated
+	std::vector<CodepointRange> ranges;
+};
+
+/* Languages not listed here are written in the Latin script. */
+static const LanguageScript language_scripts[] = {
+	{ "sr", { { 0x00C0, 0x024F }, { 0x0300, 0x036F }, { 0x1E00, 0x1EFF } } },
+	{ "zh yue ja ko", { { 0x2E80, 0x2FDF }, { 0x3000, 0x303F }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xF900, 0xFAFF }, { 0xFF00, 0xFFEF }, { 0x20000, 0x2FFFF } } },
+	{ "zh yue", { { 0x3100, 0x312F } } },
+	{ "ja", { { 0x3040, 0x30FF }, { 0x31F0, 0x31FF } } },
+	{ "ko", { { 0x1100, 0x11FF }, { 0x3130, 0x318F }, { 0xAC00, 0xD7AF } } },
+	{ "ru uk be bg mk sr kk ba tt tg mn", { { 0x0400, 0x052F } } },
+	{ "el", { { 0x0370, 0x03FF }, { 0x1F00, 0x1FFF } } },
+	{ "ar fa ur ps sd", { { 0x0600, 0x06FF }, { 0x0750, 0x077F }, { 0xFB50, 0xFDFF }, { 0xFE70, 0xFEFF } } },
+	{ "he yi", { { 0x0590, 0x05FF } } },
+	{ "hi mr ne sa", { { 0x0900, 0x097F } } },
+	{ "bn as", { { 0x0980, 0x09FF } } },
+	{ "pa", { { 0x0A00, 0x0A7F } } },
+	{ "gu", { { 0x0A80, 0x0AFF } } },
+	{ "ta", { { 0x0B80, 0x0BFF } } },
+	{ "te", { { 0x0C00, 0x0C7F } } },
+	{ "kn", { { 0x0C80, 0x0CFF } } },
+	{ "ml", { { 0x0D00, 0x0D7F } } },
+	{ "si", { { 0x0D80, 0x0DFF } } },
+	{ "th", { { 0x0E00, 0x0E7F } } },
+	{ "lo", { { 0x0E80, 0x0EFF } } },
+	{ "bo", { { 0x0F00, 0x0FFF } } },
+	{ "my", { { 0x1000, 0x109F } } },
+	{ "ka", { { 0x10A0, 0x10FF } } },
+	{ "hy", { { 0x0530, 0x058F } } },
+	{ "am", { { 0x1200, 0x139F } } },
+	{ "km", { { 0x1780, 0x17FF } } },
+};
+static const CodepointRange latin_ranges[] = { { 0x00C0, 0x024F }, { 0x0300, 0x036F }, { 0x1E00, 0x1EFF } };
+
+static bool _overlaps(const std::vector<CodepointRange> &p_ranges, uint32_t p_first, uint32_t p_last) {
+	for (const CodepointRange &range : p_ranges) {
+		if (range.first <= p_last && p_first <= range.last) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Whether every character of the token could be in p_ranges. Byte level tokens can hold part of a character:
+ * continuation bytes at the start finish one the token before began, and a lead byte at the end stands for all
+ * the characters it can start. Bytes that are not UTF-8 at all keep the token. */
+static bool _is_token_in_ranges(const char *p_text, const std::vector<CodepointRange> &p_ranges) {
+	const uint8_t *text = reinterpret_cast<const uint8_t *>(p_text);
+	size_t i = 0;
+	while ((text[i] & 0xC0) == 0x80) {
+		i++;
+	}
+	while (text[i] != 0) {
+		const uint8_t lead = text[i++];
+		int length = 0;
+		uint32_t codepoint = 0;
+		if (lead < 0x80) {
+			codepoint = lead;
+		} else if ((lead & 0xE0) == 0xC0) {
+			length = 1;
+			codepoint = lead & 0x1F;
+		} else if ((lead & 0xF0) == 0xE0) {
+			length = 2;
+			codepoint = lead & 0x0F;
+		} else if ((lead & 0xF8) == 0xF0) {
+			length = 3;
+			codepoint = lead & 0x07;
+		} else {
+			return true;
+		}
+		int read = 0;
+		while (read < length && (text[i] & 0xC0) == 0x80) {
+			codepoint = (codepoint << 6) | (text[i++] & 0x3F);
+			read++;
+		}
+		if (read < length && text[i] != 0) {
+			return true;
+		}
+		const int missing_bits = 6 * (length - read);
+		const uint32_t first = codepoint << missing_bits;
+		if (!_overlaps(p_ranges, first, first | ((1u << missing_bits) - 1))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Call with context_mutex held, it reads the grammar. */
+std::vector<whisper_token> SpeechToText::_compile_vocab_subset(whisper_context *p_context) const {
+	std::vector<whisper_token> ids;
+	if (p_context == nullptr || !prune_vocabulary) {
+		return ids;
+	}
+	std::vector<CodepointRange> script;
+	const std::string language_code = _get_params_snapshot()->language;
+	if (language_code != "auto") {
+		const std::string code = " " + language_code + " ";
+		script.assign(std::begin(common_ranges), std::end(common_ranges));
+		const size_t common = script.size();
+		for (const LanguageScript &entry : language_scripts) {
+			if ((" " + std::string(entry.languages) + " ").find(code) != std::string::npos) {
+				script.insert(script.end(), entry.ranges.begin(), entry.ranges.end());
 			}
-			if (delete_target_t != 0 && find_delete_target_t == false) {
-				msg.text.insert(target_index, "{SPLIT}");
-				find_delete_target_t = true;
+		}
+		if (script.size() == common) {
+			script.insert(script.end(), std::begin(latin_ranges), std::end(latin_ranges));
+		}
+	}
+	// The characters of the terminals of the grammar. A negated class can match almost anything, it leaves them all.
+	std::vector<CodepointRange> terminals;
+	bool negated = false;
+	for (const std::vector<whisper_grammar_element> &rule : grammar_state.rules) {
+		for (const whisper_grammar_element &element : rule) {
+			if (element.type == WHISPER_GRETYPE_CHAR_NOT) {
+				negated = true;
+			} else if (element.type == WHISPER_GRETYPE_CHAR || element.type == WHISPER_GRETYPE_CHAR_ALT) {
+				terminals.push_back({ element.value, element.value });
+			} else if (element.type == WHISPER_GRETYPE_CHAR_RNG_UPPER && !terminals.empty()) {
+				terminals.back().last = element.value;
 			}
+		}
+	}
+	if (negated) {
+		terminals.clear();
+	}
+	if (script.empty() && terminals.empty()) {
+		return ids;
+	}
+	const whisper_token token_eot = whisper_token_eot(p_context);
+	for (whisper_token id = 0; id < token_eot; id++) {
+		const char *text = whisper_token_to_str(p_context, id);
+		if ((script.empty() || _is_token_in_ranges(text, script)) && (terminals.empty() || _is_token_in_ranges(text, terminals))) {
+			ids.push_back(id);
+		}
+	}
+	if (ids.size() == size_t(token_eot)) {
+		// Nothing to prune, the whole projection is as fast without a copy of it.
+		ids.clear();
+	}
+	return ids;
+}
 
-			/**
-			 * Clear audio buffer when the size exceeds iteration threshold or
-			 * speech end is detected.
-			 */
-			if (pcmf32.size() > n_samples_iter_threshold * 0.66 || speech_has_end) {
-				const auto t_now = Time::get_singleton()->get_ticks_msec();
-				const auto t_diff = t_now - speech_to_text_obj->t_last_iter;
-				speech_to_text_obj->t_last_iter = t_now;
-				msg.is_partial = false;
-				/**
-				 * Keep the last few samples in the audio buffer, so the next
-				 * iteration has a smoother start.
-				 */
-				if (delete_target_t == 0 || speech_has_end) {
-					std::vector<float> last(pcmf32.end(), pcmf32.end());
-					pcmf32 = std::move(last);
-				} else {
-					int target_index = int(delete_target_t / 100.0 * WHISPER_SAMPLE_RATE);
-					if (target_index >= pcmf32.size()) {
-						std::vector<float> last(pcmf32.end(), pcmf32.end());
-						pcmf32 = std::move(last);
-					} else {
-						std::vector<float> last(pcmf32.begin() + target_index, pcmf32.end());
-						pcmf32 = std::move(last);
-					}
-				}
-			} else {
-				msg.is_partial = true;
-			}
-			float time_end = Time::get_singleton()->get_ticks_msec() - time_started;
-			speech_to_text_obj->s_mutex.lock();
-			s_transcribed_msgs.insert(s_transcribed_msgs.end(), std::move(msg));
-			std::vector<transcribed_msg> transcribed;
-			transcribed = std::move(s_transcribed_msgs);
-			s_transcribed_msgs.clear();
+/* Call with context_mutex held exclusively, it copies rows of the weights the decoders read. */
+void SpeechToText::_set_vocab_subset(whisper_context *p_context, const std::vector<whisper_token> &p_ids) {
+	if (p_context == nullptr) {
+		return;
+	}
+	if (whisper_ctx_set_vocab_subset(p_context, p_ids.empty() ? nullptr : p_ids.data(), p_ids.size()) != 0) {
+		ERR_PRINT("Failed to prune the vocabulary, decoding with all of it.");
+	}
+}
 
-			Array ret;
-			for (int i = 0; i < transcribed.size(); i++) {
-				Dictionary cur_transcribed_msg;
-				cur_transcribed_msg["is_partial"] = transcribed[i].is_partial;
-				cur_transcribed_msg["text"] = String::utf8(transcribed[i].text.c_str());
-				ret.push_back(cur_transcribed_msg);
-			};
-			speech_to_text_obj->call_deferred("emit_signal", "update_transcribed_msgs", time_end, ret);
-			speech_to_text_obj->s_mutex.unlock();
-		}
+void SpeechToText::_update_vocab_subset() {
+	std::vector<whisper_token> ids;
+	std::vector<whisper_token> draft_ids;
+	{
+		std::shared_lock<std::shared_mutex> lock(context_mutex);
+		ids = _compile_vocab_subset(context_instance);
+		draft_ids = _compile_vocab_subset(draft_context_instance);
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	_set_vocab_subset(context_instance, ids);
+	_set_vocab_subset(draft_context_instance, draft_ids);
+	_update_model_memory();
+}
+
+void SpeechToText::set_prune_vocabulary(bool p_prune_vocabulary) {
+	if (p_prune_vocabulary == prune_vocabulary) {
+		return;
 	}
+	prune_vocabulary = p_prune_vocabulary;
+	_update_vocab_subset();
 }
 
+void SpeechToText::_swap_context(whisper_context *p_context) {
+	if (p_context != nullptr && p_context == context_instance) {
+		// Acquired again from the registry, the states stay valid.
+		ModelRegistry::release(p_context);
+		return;
+	}
+	whisper_context *old_context = nullptr;
+	// Compiled before taking the lock, the vocabulary scan does not stall decoding.
+	std::vector<whisper_token> ids = _compile_suppress_ids(p_context);
+	std::vector<whisper_token> prompt_ids = _compile_prompt_ids(p_context, initial_prompt);
+	std::vector<uint8_t> flags = _compile_token_flags(p_context);
+	std::vector<whisper_token> subset_ids;
+	{
+		std::shared_lock<std::shared_mutex> lock(context_mutex);
+		subset_ids = _compile_vocab_subset(p_context);
+	}
+	// Do not wait for whole passes on the old weights.
+	cancel_passes();
+	{
+		// Streams hold context_mutex shared while they decode, so none of them
+		// sees a half initialised context and the old one is not freed under it.
+		std::unique_lock<std::shared_mutex> lock(context_mutex);
+		old_context = context_instance;
+		context_instance = p_context;
+		if (old_context != nullptr && p_context != nullptr && whisper_n_vocab(old_context) != whisper_n_vocab(p_context)) {
+			// The token ids the streams carry over mean other text in the new vocabulary.
+			_forget_stream_tokens();
+		}
+		// Changed while it was loading, or shared with a context loaded before the change.
+		_apply_state_parameters(p_context);
+		suppress_ids = std::move(ids);
+		initial_prompt_ids = std::move(prompt_ids);
+		token_flags = std::move(flags);
+		_set_vocab_subset(p_context, subset_ids);
+		_update_model_memory();
+		// The states are created from the old context, release them first.
+		_free_stream_states();
+	}
+	ModelRegistry::release(old_context);
+	// Another model needs other buffers for the same audio_ctx.
+	_apply_memory_budget();
+}
+
+/* Values of the kv_cache_type property. */
+static const ggml_type kv_cache_types[] = { GGML_TYPE_F16, GGML_TYPE_F32, GGML_TYPE_Q8_0 };
+
+/* Call with context_mutex held exclusively, context_parameters are what the states of p_context are created with. */
+void SpeechToText::_apply_state_parameters(whisper_context *p_context) {
+	if (p_context == nullptr) {
+		return;
+	}
+	whisper_ctx_set_kv_type(p_context, context_parameters.kv_type);
+	whisper_ctx_set_flash_attn(p_context, context_parameters.flash_attn);
+	whisper_ctx_set_quantize_activations(p_context, context_parameters.quantize_activations);
+	whisper_ctx_set_f16_activations(p_context, context_parameters.f16_activations);
+	whisper_ctx_set_gpu_mel(p_context, context_parameters.gpu_mel);
+	whisper_ctx_set_devices(p_context, context_parameters.encoder_device, context_parameters.decoder_device);
+	whisper_ctx_set_dtw(p_context, context_parameters.dtw_token_timestamps, context_parameters.dtw_aheads_preset);
+	whisper_ctx_set_max_audio_ctx(p_context, budget_audio_ctx.load(std::memory_order_relaxed));
+	_apply_gpu_submit_budget(p_context);
+	_apply_decoder_batching(p_context);
+}
+
+/* Applies to the passes in flight too, the contexts read it between two submissions. */
+void SpeechToText::_apply_gpu_submit_budget(whisper_context *p_context) {
+	if (p_context != nullptr) {
+		whisper_ctx_set_gpu_submit_budget(p_context, gpu_submit_budget_usec, gpu_frame_sync ? GpuFramePacer::wait_for_frame : nullptr, nullptr);
+	}
+}
+
+/* Applies to the passes in flight too, the contexts read it on every decoder step. */
+void SpeechToText::_apply_decoder_batching(whisper_context *p_context) {
+	if (p_context != nullptr) {
+		whisper_ctx_set_decode_batching(p_context, decoder_batch_size, decoder_batch_wait_usec);
+	}
+}
+
+void SpeechToText::set_decoder_batch_size(int p_decoder_batch_size) {
+	decoder_batch_size = CLAMP(p_decoder_batch_size, 1, 16);
+	std::shared_lock<std::shared_mutex> lock(context_mutex);
+	_apply_decoder_batching(context_instance);
+	_apply_decoder_batching(draft_context_instance);
+}
+
+void SpeechToText::set_decoder_batch_wait_usec(int p_usec) {
+	decoder_batch_wait_usec = MAX(0, p_usec);
+	std::shared_lock<std::shared_mutex> lock(context_mutex);
+	_apply_decoder_batching(context_instance);
+	_apply_decoder_batching(draft_context_instance);
+}
+
+void SpeechToText::_on_frame_post_draw() {
+	GpuFramePacer::notify_frame();
+}
+
+void SpeechToText::set_gpu_submit_budget_usec(int p_usec) {
+	gpu_submit_budget_usec = MAX(0, p_usec);
+	std::shared_lock<std::shared_mutex> lock(context_mutex);
+	_apply_gpu_submit_budget(context_instance);
+	_apply_gpu_submit_budget(draft_context_instance);
+}
+
+void SpeechToText::set_gpu_frame_sync(bool p_gpu_frame_sync) {
+	if (gpu_frame_sync == p_gpu_frame_sync) {
+		return;
+	}
+	gpu_frame_sync = p_gpu_frame_sync;
+	RenderingServer *rendering_server = RenderingServer::get_singleton();
+	const Callable on_frame = callable_mp(this, &SpeechToText::_on_frame_post_draw);
+	if (rendering_server && gpu_frame_sync) {
+		rendering_server->connect("frame_post_draw", on_frame);
+	} else if (rendering_server && rendering_server->is_connected("frame_post_draw", on_frame)) {
+		rendering_server->disconnect("frame_post_draw", on_frame);
+	}
+	std::shared_lock<std::shared_mutex> lock(context_mutex);
+	_apply_gpu_submit_budget(context_instance);
+	_apply_gpu_submit_budget(draft_context_instance);
+}
+
+/* Call with context_mutex held exclusively. The weights stay, only the states are created again. */
+void SpeechToText::_recreate_states() {
+	_apply_state_parameters(context_instance);
+	_apply_state_parameters(draft_context_instance);
+	_free_stream_states();
+	MutexLock streams_lock(streams_mutex);
+	for (SpeechToTextStream *stream : streams) {
+		whisper_free_state(stream->draft_state_instance);
+		stream->draft_state_instance = nullptr;
+		stream->_update_state_memory();
+	}
+}
+
+void SpeechToText::set_kv_cache_type(int p_kv_cache_type) {
+	ERR_FAIL_INDEX(p_kv_cache_type, (int)std::size(kv_cache_types));
+	if (kv_cache_types[p_kv_cache_type] == context_parameters.kv_type) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	// Under the lock, _swap_context reads it from the load thread.
+	context_parameters.kv_type = kv_cache_types[p_kv_cache_type];
+	_recreate_states();
+}
+
+void SpeechToText::set_flash_attention(bool p_flash_attention) {
+	if (p_flash_attention == context_parameters.flash_attn) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	context_parameters.flash_attn = p_flash_attention;
+	// The encoder graphs are measured when a state is created, the new ones are built with the other attention.
+	_recreate_states();
+}
+
+void SpeechToText::set_use_worker_thread_pool(bool p_use_worker_thread_pool) {
+	if (p_use_worker_thread_pool == scheduler.is_using_thread_pool()) {
+		return;
+	}
+	cancel_passes();
+	// Before the lock, the workers finish the passes in flight with it.
+	scheduler.set_use_thread_pool(p_use_worker_thread_pool);
+	WorkerPoolExecutor::set_enabled(p_use_worker_thread_pool);
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	// The ggml threads belong to the states, the new ones run their graphs on the pool or on threads again.
+	_recreate_states();
+}
+
+void SpeechToText::set_quantize_activations(bool p_quantize_activations) {
+	if (p_quantize_activations == context_parameters.quantize_activations) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	context_parameters.quantize_activations = p_quantize_activations;
+	// Like flash_attention, the measured encoder graphs hold the quantized copies or not.
+	_recreate_states();
+}
+
+void SpeechToText::set_f16_activations(bool p_f16_activations) {
+	if (p_f16_activations == context_parameters.f16_activations) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	context_parameters.f16_activations = p_f16_activations;
+	// The measured encoder graphs, and the size of their compute buffers, depend on the type of the activations.
+	_recreate_states();
+}
+
+void SpeechToText::set_gpu_mel(bool p_gpu_mel) {
+	if (p_gpu_mel == context_parameters.gpu_mel) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	context_parameters.gpu_mel = p_gpu_mel;
+	// The conv compute buffer is measured with the graph computing the mel from the samples.
+	_recreate_states();
+}
+
+void SpeechToText::set_encoder_device(int p_device) {
+	ERR_FAIL_INDEX(p_device, WHISPER_DEVICE_CPU + 1);
+	if (p_device == context_parameters.encoder_device) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	context_parameters.encoder_device = whisper_device(p_device);
+	// The placement is fixed when a state is created, the weights stay where they are.
+	_recreate_states();
+}
+
+void SpeechToText::set_decoder_device(int p_device) {
+	ERR_FAIL_INDEX(p_device, WHISPER_DEVICE_CPU + 1);
+	if (p_device == context_parameters.decoder_device) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	context_parameters.decoder_device = whisper_device(p_device);
+	_recreate_states();
+}
+
+void SpeechToText::set_dtw_word_timestamps(bool p_dtw_word_timestamps) {
+	if (p_dtw_word_timestamps == context_parameters.dtw_token_timestamps) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	context_parameters.dtw_token_timestamps = p_dtw_word_timestamps;
+	// The decoder buffer of a state only holds the weights of the alignment heads when it was measured with them.
+	_recreate_states();
+}
+
+void SpeechToText::set_alignment_heads_preset(int p_preset) {
+	ERR_FAIL_INDEX(p_preset, WHISPER_AHEADS_LARGE_V3 + 1);
+	if (p_preset == context_parameters.dtw_aheads_preset) {
+		return;
+	}
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	context_parameters.dtw_aheads_preset = whisper_alignment_heads_preset(p_preset);
+	if (context_parameters.dtw_token_timestamps) {
+		_recreate_states();
+	} else {
+		_apply_state_parameters(context_instance);
+		_apply_state_parameters(draft_context_instance);
+	}
+}
+
+/**
+ * Replace t0 and t1 of r_tokens, the text tokens whisper_full transcribed
+ * from the first p_n_samples of the mel of p_state, with their DTW
+ * alignment. False keeps the times whisper_full gave them.
+ */
+bool SpeechToText::_align_tokens(whisper_context *p_context, whisper_state *p_state, std::vector<whisper_token_data> &r_tokens, int p_n_samples, int p_n_threads) {
+	TRACE_ZONE("align_tokens");
+	if (r_tokens.empty()) {
+		return false;
+	}
+	std::vector<whisper_token> ids(r_tokens.size());
+	for (size_t i = 0; i < r_tokens.size(); i++) {
+		ids[i] = r_tokens[i].id;
+	}
+	std::vector<int64_t> t0(r_tokens.size());
+	std::vector<int64_t> t1(r_tokens.size());
+	if (whisper_full_align_tokens_dtw_with_state(p_context, p_state, ids.data(), ids.size(), p_n_samples, t0.data(), t1.data(), p_n_threads) != 0) {
+		return false;
+	}
+	for (size_t i = 0; i < r_tokens.size(); i++) {
+		r_tokens[i].t0 = t0[i];
+		r_tokens[i].t1 = t1[i];
+	}
+	return true;
+}
+
+int SpeechToText::get_kv_cache_type() const {
+	for (int i = 0; i < (int)std::size(kv_cache_types); i++) {
+		if (kv_cache_types[i] == context_parameters.kv_type) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+/* Call with context_mutex held exclusively. The committed text stays, only its tokens are dropped. */
+void SpeechToText::_forget_stream_tokens() {
+	MutexLock streams_lock(streams_mutex);
+	for (SpeechToTextStream *stream : streams) {
+		stream->committed_tokens.clear();
+		stream->draft_tokens.clear();
+		stream->segment_token_count = 0;
+	}
+}
+
+/* Call with context_mutex held exclusively, the streams create their states again on their next pass. */
+void SpeechToText::_free_stream_states() {
+	MutexLock streams_lock(streams_mutex);
+	for (SpeechToTextStream *stream : streams) {
+		whisper_free_state(stream->state_instance);
+		stream->state_instance = nullptr;
+		stream->state_encoder_offloaded = false;
+		// No pass runs under the exclusive lock, so neither does the encoder thread.
+		whisper_free_state(stream->prefetch_state_instance);
+		stream->prefetch_state_instance = nullptr;
+		stream->prefetch_encoder_offloaded = false;
+		stream->prefetch_stage.store(SpeechToTextStream::PREFETCH_IDLE, std::memory_order_relaxed);
+		stream->command_set.context = nullptr;
+		stream->wake_set.context = nullptr;
+		stream->_update_state_memory();
+	}
+	// Created with the same parameters, so they go too.
+	_free_job_states();
+}
+
+whisper_state *SpeechToText::_acquire_job_state(whisper_context *p_context, uint64_t &r_generation) {
+	{
+		MutexLock lock(job_states_mutex);
+		r_generation = job_state_generation.load(std::memory_order_relaxed);
+		for (size_t i = job_states.size(); i-- > 0;) {
+			if (job_states[i].context == p_context) {
+				whisper_state *state = job_states[i].state;
+				job_states.erase(job_states.begin() + i);
+				// Forget the last job, its cached mel and encoder output are keyed by position only.
+				whisper_reset_state(state);
+				return state;
+			}
+		}
+	}
+	// Windows of up to 30 s, memory_budget_mb only caps the states of the streams.
+	return whisper_init_state_with_max_audio_ctx(p_context, 0);
+}
+
+void SpeechToText::_release_job_state(whisper_context *p_context, whisper_state *p_state, uint64_t p_generation) {
+	if (p_state == nullptr) {
+		return;
+	}
+	{
+		MutexLock lock(job_states_mutex);
+		if (p_generation == job_state_generation.load(std::memory_order_relaxed) && int(job_states.size()) < job_state_pool_size) {
+			job_states.push_back({ p_state, p_context });
+			return;
+		}
+	}
+	whisper_free_state(p_state);
+}
+
+void SpeechToText::_free_job_states() {
+	std::vector<PooledJobState> freed;
+	{
+		MutexLock lock(job_states_mutex);
+		job_state_generation.fetch_add(1, std::memory_order_relaxed);
+		freed.swap(job_states);
+	}
+	for (const PooledJobState &pooled : freed) {
+		whisper_free_state(pooled.state);
+	}
+}
+
+void SpeechToText::set_job_state_pool_size(int p_size) {
+	p_size = MAX(0, p_size);
+	std::vector<PooledJobState> freed;
+	{
+		MutexLock lock(job_states_mutex);
+		job_state_pool_size = p_size;
+		while (int(job_states.size()) > p_size) {
+			freed.push_back(job_states.back());
+			job_states.pop_back();
+		}
+	}
+	for (const PooledJobState &pooled : freed) {
+		whisper_free_state(pooled.state);
+	}
+}
+
+void SpeechToText::set_openvino_encoder_path(const String &p_path) {
+	if (p_path == openvino_encoder_path) {
+		return;
+	}
+	openvino_encoder_path = p_path;
+	_update_openvino_encoder();
+}
+
+void SpeechToText::set_remote_inference_url(const String &p_url) {
+	remote_inference_url = p_url.strip_edges();
+	params.remote_inference_url = remote_inference_url.utf8().get_data();
+	_publish_params();
+}
+
+void SpeechToText::set_openvino_device(const String &p_device) {
+	if (p_device == openvino_device) {
+		return;
+	}
+	openvino_device = p_device;
+	_update_openvino_encoder();
+}
+
+void SpeechToText::_update_openvino_encoder() {
+	// OpenVINO reads the IR from the file system, not through the resource packs.
+	const String path = openvino_encoder_path.is_empty() ? String() : ProjectSettings::get_singleton()->globalize_path(openvino_encoder_path);
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	params.openvino_encoder_path = path.utf8().get_data();
+	params.openvino_device = openvino_device.utf8().get_data();
+	_publish_params();
+	// The encoder is compiled into every state.
+	_free_stream_states();
+}
+
+void SpeechToText::set_nnapi_encoder_path(const String &p_path) {
+	if (p_path == nnapi_encoder_path) {
+		return;
+	}
+	nnapi_encoder_path = p_path;
+	_update_nnapi_encoder();
+}
+
+void SpeechToText::set_nnapi_accelerator(const String &p_accelerator) {
+	if (p_accelerator == nnapi_accelerator) {
+		return;
+	}
+	nnapi_accelerator = p_accelerator;
+	_update_nnapi_encoder();
+}
+
+void SpeechToText::_update_nnapi_encoder() {
+	// Like OpenVINO, TensorFlow Lite reads the model from the file system.
+	const String path = nnapi_encoder_path.is_empty() ? String() : ProjectSettings::get_singleton()->globalize_path(nnapi_encoder_path);
+	cancel_passes();
+	std::unique_lock<std::shared_mutex> lock(context_mutex);
+	params.nnapi_encoder_path = path.utf8().get_data();
+	params.nnapi_accelerator = nnapi_accelerator.utf8().get_data();
+	_publish_params();
+	_free_stream_states();
+}
+
+void SpeechToText::set_draft_model(Ref<WhisperResource> p_model) {
+	if (p_model == draft_model) {
+		return;
+	}
+	draft_model = p_model;
+	if (_is_lazy_load()) {
+		is_draft_reload_queued = true;
+		return;
+	}
+	_load_draft_model();
+}
+
+void SpeechToText::_load_draft_model() {
+	is_draft_reload_queued = false;
+	whisper_context *new_context = draft_model.is_valid() ? ModelRegistry::acquire_loaded(draft_model, context_parameters) : nullptr;
+	if (new_context == nullptr) {
+		_swap_draft_context(nullptr);
+		if (draft_model.is_null()) {
+			return;
+		}
+		new_context = ModelRegistry::acquire(draft_model, context_parameters);
+		ERR_FAIL_NULL_MSG(new_context, "Failed to load the draft model.");
+	}
+	_swap_draft_context(new_context);
+}
+
+void SpeechToText::_swap_draft_context(whisper_context *p_context) {
+	if (p_context != nullptr && p_context == draft_context_instance) {
+		ModelRegistry::release(p_context);
+		return;
+	}
+	whisper_context *old_context = nullptr;
+	std::vector<whisper_token> ids = _compile_suppress_ids(p_context);
+	std::vector<uint8_t> flags = _compile_token_flags(p_context);
+	std::vector<whisper_token> subset_ids;
+	{
+		std::shared_lock<std::shared_mutex> lock(context_mutex);
+		subset_ids = _compile_vocab_subset(p_context);
+	}
+	cancel_passes();
+	{
+		std::unique_lock<std::shared_mutex> lock(context_mutex);
+		old_context = draft_context_instance;
+		draft_context_instance = p_context;
+		_apply_state_parameters(p_context);
+		draft_suppress_ids = std::move(ids);
+		draft_token_flags = std::move(flags);
+		_set_vocab_subset(p_context, subset_ids);
+		_update_model_memory();
+		MutexLock streams_lock(streams_mutex);
+		for (SpeechToTextStream *stream : streams) {
+			whisper_free_state(stream->draft_state_instance);
+			stream->draft_state_instance = nullptr;
+			stream->wake_set.context = nullptr;
+			stream->_update_state_memory();
+		}
+	}
+	ModelRegistry::release(old_context);
+	_apply_memory_budget();
+}
+
+void SpeechToText::load_model() {
+	ERR_FAIL_COND_MSG(is_model_loading, "A model is already being loaded in the background.");
+	is_reload_queued = false;
+	if (is_draft_reload_queued) {
+		_load_draft_model();
+	}
+	if (model.is_null()) {
+		_swap_context(nullptr);
+		loaded_model_file = String();
+		return;
+	}
+	// Weights already in memory, e.g. those of the draft model, are shared rather than loaded again.
+	whisper_context *new_context = ModelRegistry::acquire_loaded(model, context_parameters);
+	if (new_context == nullptr) {
+		// The old context is only released once the new one replaced it, both are in memory for the load.
+		new_context = ModelRegistry::acquire(model, context_parameters);
+		if (new_context == nullptr) {
+			_swap_context(nullptr);
+			loaded_model_file = String();
+			return;
+		}
+	}
+	_swap_context(new_context);
+	loaded_model_file = model->get_file();
+	loaded_context_parameters = context_parameters;
+	UtilityFunctions::print(whisper_print_system_info());
+	_auto_tune_threads(loaded_model_file, loaded_context_parameters.use_gpu);
+	_start_warmup();
+	_schedule_hibernation();
+}
+
+void SpeechToText::load_model_async() {
+	ERR_FAIL_COND_MSG(is_model_loading, "A model is already being loaded in the background.");
+	is_reload_queued = false;
+	if (is_draft_reload_queued) {
+		_load_draft_model();
+	}
+	if (model.is_null()) {
+		_swap_context(nullptr);
+		loaded_model_file = String();
+		return;
+	}
+	// The streams keep decoding with the old context, if any, until the new one is swapped in.
+	whisper_context *shared_context = ModelRegistry::acquire_loaded(model, context_parameters);
+	is_model_loading = true;
+	loading_model = model;
+	loading_context_parameters = context_parameters;
+	if (shared_context != nullptr) {
+		// Nothing to read, the weights are warm already. Still reported deferred like a load.
+		_swap_context(shared_context);
+		_auto_tune_threads(model->get_file(), context_parameters.use_gpu);
+		call_deferred("_finish_model_load", true);
+		return;
+	}
+	load_thread = memnew(Thread);
+	load_thread->start(callable_mp(this, &SpeechToText::_load_model_thread), Thread::Priority::PRIORITY_LOW);
+}
+
+void SpeechToText::_load_model_thread() {
+	whisper_context *new_context = ModelRegistry::acquire(loading_model, loading_context_parameters, callable_mp(this, &SpeechToText::_on_model_load_progress));
+	if (new_context == nullptr) {
+		// Like a failed load_model(), the old weights do not stand in for the model that was set.
+		_swap_context(nullptr);
+	} else {
+		// Passes on the old weights are aborted and decode their audio again on the new ones, the streams keep their queues.
+		_swap_context(new_context);
+		_auto_tune_threads(loading_model->get_file(), loading_context_parameters.use_gpu);
+		if (warmup_model) {
+			// Already off the main thread.
+			_warmup_context();
+		}
+	}
+	call_deferred("_finish_model_load", new_context != nullptr);
+}
+
+void SpeechToText::_on_model_load_progress(float p_progress) {
+	emit_signal("model_load_progress", p_progress);
+}
+
+void SpeechToText::_finish_model_load(bool p_success) {
+	if (load_thread != nullptr) {
+		load_thread->wait_to_finish();
+		memdelete(load_thread);
+		load_thread = nullptr;
+	}
+	if (p_success) {
+		loaded_model_file = loading_model->get_file();
+		loaded_context_parameters = loading_context_parameters;
+	} else {
+		loaded_model_file = String();
+	}
+	loading_model.unref();
+	is_model_loading = false;
+	if (is_reload_queued && !_is_lazy_load()) {
+		// The model was changed again while this one loaded.
+		call_deferred("_reload_model_if_dirty");
+	}
+	if (p_success) {
+		UtilityFunctions::print(whisper_print_system_info());
+		// The editor would save the preset into the scene as if it was set by hand.
+		if (auto_streaming_preset && model.is_valid() && model->get_file() == loaded_model_file && !Engine::get_singleton()->is_editor_hint()) {
+			_apply_streaming_preset(true);
+		}
+	}
+	emit_signal("model_loaded", p_success);
+	if (p_success) {
+		warmup_serial++;
+		emit_signal("model_ready");
+		_schedule_hibernation();
+	}
+}
+
+/** One silent pass per context on a throwaway state, any thread. */
+void SpeechToText::_warmup_context() {
+	std::shared_lock<std::shared_mutex> lock(context_mutex);
+	// Longer than the second whisper_full skips, and still quick to encode.
+	const std::vector<float> silence(2 * WHISPER_SAMPLE_RATE, 0.0f);
+	whisper_full_params warmup_params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+	warmup_params.print_progress = false;
+	warmup_params.print_special = false;
+	warmup_params.print_realtime = false;
+	warmup_params.print_timestamps = false;
+	warmup_params.no_context = true;
+	warmup_params.single_segment = true;
+	warmup_params.max_tokens = 4;
+	warmup_params.temperature_inc = 0.0f;
+	warmup_params.language = "en";
+	warmup_params.audio_ctx = _audio_ctx_for_samples(silence.size());
+	whisper_context *contexts[] = { context_instance, draft_context_instance };
+	for (whisper_context *context : contexts) {
+		if (context == nullptr) {
+			continue;
+		}
+		whisper_state *state = whisper_init_state(context);
+		ERR_CONTINUE_MSG(state == nullptr, "Failed to create whisper state");
+		warmup_params.n_threads = _get_threads_per_decode(context == draft_context_instance);
+		if (whisper_full_with_state(context, state, warmup_params, silence.data(), silence.size()) != 0) {
+			ERR_PRINT("Failed to warm up the model");
+		}
+		whisper_free_state(state);
+	}
+}
+
+/* Main thread, after load_model swapped the new context in. */
+void SpeechToText::_start_warmup() {
+	warmup_serial++;
+	if (warmup_thread != nullptr) {
+		warmup_thread->wait_to_finish();
+		memdelete(warmup_thread);
+		warmup_thread = nullptr;
+	}
+	if (!warmup_model) {
+		emit_signal("model_ready");
+		return;
+	}
+	warmup_thread = memnew(Thread);
+	warmup_thread->start(callable_mp(this, &SpeechToText::_warmup_thread).bind(warmup_serial), Thread::Priority::PRIORITY_LOW);
+}
+
+void SpeechToText::_warmup_thread(uint32_t p_serial) {
+	_warmup_context();
+	call_deferred("_finish_warmup", p_serial);
+}
+
+void SpeechToText::_finish_warmup(uint32_t p_serial) {
+	if (p_serial != warmup_serial) {
+		// A newer load joined this thread already.
+		return;
+	}
+	if (warmup_thread != nullptr) {
+		warmup_thread->wait_to_finish();
+		memdelete(warmup_thread);
+		warmup_thread = nullptr;
+	}
+	emit_signal("model_ready");
+}
+
+void SpeechToText::set_vad_mode(int p_vad_mode) {
+	ERR_FAIL_INDEX(p_vad_mode, VadEngine::MODE_ADAPTIVE + 1);
+	params.vad_mode = p_vad_mode;
+	_publish_params();
+}
+
+void SpeechToText::set_n_threads(int n_threads) {
+	params.n_threads = n_threads;
+	_publish_params();
+	_update_scheduler();
+}
+
+/* Thread counts calibrate_threads tries, up to the processor count. */
+static const int calibration_thread_counts[] = { 1, 2, 3, 4, 6, 8, 12, 16, 24, 32 };
+/* Audio of every encode, about what a pass decodes. */
+static const int calibration_seconds = 5;
+static const int calibration_runs = 2;
+static const char *calibration_cache_path = "user://whisper_threads.cfg";
+
+String SpeechToText::_get_calibration_key(const String &p_model_file, bool p_use_gpu) const {
+	OS *os = OS::get_singleton();
+	const String identity = vformat("%s|%s|%d|%s|%s|%d", os->get_model_name(), os->get_processor_name(), os->get_processor_count(), p_model_file, p_use_gpu ? "gpu" : "cpu", ThreadAffinity::get_core_class());
+	return identity.md5_text();
+}
+
+Dictionary SpeechToText::calibrate_threads() {
+	ERR_FAIL_COND_V_MSG(is_model_loading, Dictionary(), "The model is still loading.");
+	return _calibrate_threads(loaded_model_file, loaded_context_parameters.use_gpu);
+}
+
+/** Any thread, the result is applied on the main thread. */
+Dictionary SpeechToText::_calibrate_threads(const String &p_model_file, bool p_use_gpu) {
+	Dictionary timings;
+	int best_threads = 0;
+	double best_ms = 0.0;
+	{
+		std::shared_lock<std::shared_mutex> lock(context_mutex);
+		ERR_FAIL_NULL_V_MSG(context_instance, Dictionary(), "No model is loaded.");
+		whisper_state *state = whisper_init_state(context_instance);
+		ERR_FAIL_NULL_V_MSG(state, Dictionary(), "Failed to create whisper state");
+		// Quiet noise, the encoder does the same work for any audio.
+		std::vector<float> samples(calibration_seconds * WHISPER_SAMPLE_RATE);
+		uint32_t seed = 1;
+		for (float &sample : samples) {
+			seed = seed * 1664525u + 1013904223u;
+			sample = (float(seed >> 8) / float(1 << 23) - 1.0f) * 0.01f;
+		}
+		const float *samples_ptr = samples.data();
+		const int n_samples = samples.size();
+		const int audio_ctx = _audio_ctx_for_samples(samples.size());
+		const int max_threads = OS::get_singleton()->get_processor_count();
+		// The first encode allocates the graphs, it is not timed.
+		whisper_encode_batch_with_states(context_instance, &state, &samples_ptr, &n_samples, 1, audio_ctx, max_threads);
+		int slower_count = 0;
+		for (int n_threads : calibration_thread_counts) {
+			if (n_threads > max_threads) {
+				break;
+			}
+			double ms = -1.0;
+			for (int run = 0; run < calibration_runs; run++) {
+				const uint64_t started = Time::get_singleton()->get_ticks_usec();
+				if (whisper_encode_batch_with_states(context_instance, &state, &samples_ptr, &n_samples, 1, audio_ctx, n_threads) != 0) {
+					ms = -1.0;
+					break;
+				}
+				const double run_ms = (Time::get_singleton()->get_ticks_usec() - started) / 1000.0;
+				ms = ms < 0.0 ? run_ms : MIN(ms, run_ms);
+			}
+			if (ms < 0.0) {
+				break;
+			}
+			timings[n_threads] = ms;
+			if (best_threads == 0 || ms < best_ms) {
+				best_threads = n_threads;
+				best_ms = ms;
+				slower_count = 0;
+			} else if (++slower_count >= 2) {
+				// Past the cores that help, more threads only wait on each other.
+				break;
+			}
+		}
+		whisper_free_state(state);
+	}
+	ERR_FAIL_COND_V_MSG(best_threads == 0, Dictionary(), "Failed to encode with the loaded model.");
+	Ref<ConfigFile> cache;
+	cache.instantiate();
+	// A missing file is an empty cache.
+	cache->load(calibration_cache_path);
+	cache->set_value("n_threads", _get_calibration_key(p_model_file, p_use_gpu), best_threads);
+	cache->save(calibration_cache_path);
+	_apply_n_threads(best_threads);
+	Dictionary ret;
+	ret["n_threads"] = best_threads;
+	ret["timings_ms"] = timings;
+	return ret;
+}
+
+void SpeechToText::_auto_tune_threads(const String &p_model_file, bool p_use_gpu) {
+	if (!auto_tune_threads) {
+		return;
+	}
+	Ref<ConfigFile> cache;
+	cache.instantiate();
+	const String key = _get_calibration_key(p_model_file, p_use_gpu);
+	if (cache->load(calibration_cache_path) == OK && cache->has_section_key("n_threads", key)) {
+		_apply_n_threads(cache->get_value("n_threads", key));
+		return;
+	}
+	_calibrate_threads(p_model_file, p_use_gpu);
+}
+
+void SpeechToText::_apply_n_threads(int p_n_threads) {
+	if (OS::get_singleton()->get_thread_caller_id() == OS::get_singleton()->get_main_thread_id()) {
+		set_n_threads(p_n_threads);
+	} else {
+		call_deferred("set_n_threads", p_n_threads);
+	}
+}
+
+void SpeechToText::set_max_concurrent_decodes(int p_max_concurrent_decodes) {
+	ERR_FAIL_COND(p_max_concurrent_decodes < 0);
+	max_concurrent_decodes = p_max_concurrent_decodes;
+	_update_scheduler();
+}
+
+void SpeechToText::cancel_passes() {
+	cancel_generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SpeechToText::_update_scheduler() {
+	int workers = max_concurrent_decodes;
+	if (workers == 0) {
+		// Enough passes in parallel to use every core once, without oversubscribing them.
+		workers = OS::get_singleton()->get_processor_count() / MAX(1, params.n_threads);
+	}
+	scheduler.set_worker_count(MAX(1, workers));
+}
+
+void SpeechToText::_publish_params() {
+	// Readers keep the copy they loaded alive, the old one goes with the last of them.
+	std::atomic_store(&params_snapshot, std::shared_ptr<const SpeechToTextParams>(std::make_shared<SpeechToTextParams>(params)));
+}
+
+int SpeechToText::_get_threads_per_decode(bool p_draft) const {
+	// Split the cores between the concurrent passes instead of running workers * n_threads threads.
+	const int cores_per_worker = OS::get_singleton()->get_processor_count() / scheduler.get_worker_count();
+	const std::shared_ptr<const SpeechToTextParams> settings = _get_params_snapshot();
+	const int n_threads = p_draft && settings->draft_n_threads > 0 ? settings->draft_n_threads : settings->n_threads;
+	const int threads = CLAMP(cores_per_worker, 1, MAX(1, n_threads));
+	const int cap = frame_thread_cap.load(std::memory_order_relaxed);
+	return cap > 0 ? MIN(threads, cap) : threads;
+}
+
+void SpeechToText::set_frame_budget_threads(int p_threads) {
+	frame_budget.set_max_threads(p_threads);
+	frame_thread_cap.store(frame_budget.get_thread_cap(), std::memory_order_relaxed);
+	last_frame_usec = 0;
+	SceneTree *tree = Object::cast_to<SceneTree>(Engine::get_singleton()->get_main_loop());
+	if (tree == nullptr) {
+		return;
+	}
+	const Callable on_frame = callable_mp(this, &SpeechToText::_on_process_frame);
+	const bool connected = tree->is_connected("process_frame", on_frame);
+	if (frame_budget.get_max_threads() > 0 && !connected) {
+		tree->connect("process_frame", on_frame);
+	} else if (frame_budget.get_max_threads() == 0 && connected) {
+		tree->disconnect("process_frame", on_frame);
+	}
+}
+
+void SpeechToText::set_frame_budget_idle(bool p_idle) {
+	frame_budget_idle = p_idle;
+	frame_budget.set_idle(p_idle);
+	frame_thread_cap.store(frame_budget.get_thread_cap(), std::memory_order_relaxed);
+}
+
+/* Main thread, once per frame while there is a frame budget. */
+void SpeechToText::_on_process_frame() {
+	const uint64_t now_usec = Time::get_singleton()->get_ticks_usec();
+	const uint64_t frame_usec = last_frame_usec > 0 ? now_usec - last_frame_usec : 0;
+	last_frame_usec = now_usec;
+	SceneTree *tree = Object::cast_to<SceneTree>(Engine::get_singleton()->get_main_loop());
+	frame_budget.set_idle(frame_budget_idle || (tree && tree->is_paused()));
+	// The frame rate the game aims for, the refresh rate with vsync, else 60 fps.
+	double target_fps = Engine::get_singleton()->get_max_fps();
+	if (target_fps <= 0.0) {
+		target_fps = DisplayServer::get_singleton() ? DisplayServer::get_singleton()->screen_get_refresh_rate() : -1.0;
+	}
+	if (target_fps <= 0.0) {
+		target_fps = 60.0;
+	}
+	frame_budget.observe_frame(int64_t(frame_usec), int64_t(1000000.0 / target_fps));
+	frame_thread_cap.store(frame_budget.get_thread_cap(), std::memory_order_relaxed);
+}
+
+int SpeechToText::_audio_ctx_for_samples(size_t p_samples) const {
+	// The encoder has one position per two mel frames.
+	const int samples_per_ctx = 2 * WHISPER_HOP_LENGTH;
+	int audio_ctx = (p_samples + samples_per_ctx - 1) / samples_per_ctx;
+	const std::shared_ptr<const SpeechToTextParams> settings = _get_params_snapshot();
+	const int granularity = MAX(1, settings->audio_ctx_granularity);
+	audio_ctx = ((audio_ctx + granularity - 1) / granularity) * granularity;
+	audio_ctx = CLAMP(audio_ctx, settings->audio_ctx_min, settings->audio_ctx_max);
+	if (context_instance) {
+		audio_ctx = MIN(audio_ctx, whisper_n_audio_ctx(context_instance));
+	}
+	const int budget = budget_audio_ctx.load(std::memory_order_relaxed);
+	if (budget > 0) {
+		audio_ctx = MIN(audio_ctx, budget);
+	}
+	return audio_ctx;
+}
+
+void SpeechToText::set_use_gpu(bool use_gpu) {
+	if (context_parameters.use_gpu == use_gpu) {
+		return;
+	}
+	context_parameters.use_gpu = use_gpu;
+	_queue_model_reload();
+	if (_is_lazy_load()) {
+		is_draft_reload_queued = true;
+		return;
+	}
+	_load_draft_model();
+}
+
+void SpeechToText::set_gpu_device(int p_gpu_device) {
+	p_gpu_device = MAX(0, p_gpu_device);
+	if (context_parameters.gpu_device == p_gpu_device) {
+		return;
+	}
+	context_parameters.gpu_device = p_gpu_device;
+	_queue_model_reload();
+	if (_is_lazy_load()) {
+		is_draft_reload_queued = true;
+		return;
+	}
+	_load_draft_model();
+}
+
+void SpeechToText::set_repack_weights(bool p_repack_weights) {
+	if (context_parameters.repack_weights == p_repack_weights) {
+		return;
+	}
+	context_parameters.repack_weights = p_repack_weights;
+	_queue_model_reload();
+	if (_is_lazy_load()) {
+		is_draft_reload_queued = true;
+		return;
+	}
+	_load_draft_model();
+}
+
+void SpeechToText::set_lock_model_memory(bool p_lock_model_memory) {
+	if (context_parameters.lock_model_memory == p_lock_model_memory) {
+		return;
+	}
+	context_parameters.lock_model_memory = p_lock_model_memory;
+	_queue_model_reload();
+	if (_is_lazy_load()) {
+		is_draft_reload_queued = true;
+		return;
+	}
+	_load_draft_model();
+}
+
+void SpeechToText::set_use_huge_pages(bool p_use_huge_pages) {
+	if (context_parameters.use_huge_pages == p_use_huge_pages) {
+		return;
+	}
+	context_parameters.use_huge_pages = p_use_huge_pages;
+	_queue_model_reload();
+	if (_is_lazy_load()) {
+		is_draft_reload_queued = true;
+		return;
+	}
+	_load_draft_model();
+}
+
+void SpeechToText::set_map_model_file(bool p_map_model_file) {
+	if (is_map_model_file() == p_map_model_file) {
+		return;
+	}
+	// WhisperResource::load_context() puts the path of the file in its place.
+	context_parameters.mmap_path = p_map_model_file ? "" : nullptr;
+	_queue_model_reload();
+	if (_is_lazy_load()) {
+		is_draft_reload_queued = true;
+		return;
+	}
+	_load_draft_model();
+}
+
+static ggml_backend *_create_rendering_device_backend(void *p_n_threads) {
+	return RenderingDeviceCompute::create_backend(int(intptr_t(p_n_threads)));
+}
+
+static ggml_backend *_create_webgpu_backend(void *p_n_threads) {
+	return WebGPUCompute::create_backend(int(intptr_t(p_n_threads)));
+}
+
+void SpeechToText::_set_host_backend(ggml_backend *(*p_backend_init)(void *)) {
+	if (context_parameters.backend_init == p_backend_init) {
+		return;
+	}
+	context_parameters.backend_init = p_backend_init;
+	// The CPU threads of the nodes between the kernels, set once when the states are created.
+	context_parameters.backend_init_user_data = p_backend_init ? reinterpret_cast<void *>(intptr_t(_get_threads_per_decode())) : nullptr;
+	_queue_model_reload();
+	if (_is_lazy_load()) {
+		is_draft_reload_queued = true;
+		return;
+	}
+	_load_draft_model();
+}
+
+void SpeechToText::set_rendering_device_compute(bool p_rendering_device_compute) {
+	if (is_rendering_device_compute() != p_rendering_device_compute) {
+		_set_host_backend(p_rendering_device_compute ? _create_rendering_device_backend : nullptr);
+	}
+}
+
+bool SpeechToText::is_rendering_device_compute() {
+	return context_parameters.backend_init == _create_rendering_device_backend;
+}
+
+void SpeechToText::set_webgpu_compute(bool p_webgpu_compute) {
+	if (is_webgpu_compute() != p_webgpu_compute) {
+		_set_host_backend(p_webgpu_compute ? _create_webgpu_backend : nullptr);
+	}
+}
+
+bool SpeechToText::is_webgpu_compute() {
+	return context_parameters.backend_init == _create_webgpu_backend;
+}
+
+SpeechToText::~SpeechToText() {
+	_unregister_monitors();
+	if (load_thread != nullptr) {
+		load_thread->wait_to_finish();
+		memdelete(load_thread);
+		load_thread = nullptr;
+	}
+	if (warmup_thread != nullptr) {
+		warmup_thread->wait_to_finish();
+		memdelete(warmup_thread);
+		warmup_thread = nullptr;
+	}
+	{
+		// Streams still referenced from scripts must not decode once the context is gone.
+		MutexLock lock(streams_mutex);
+		for (SpeechToTextStream *stream : streams) {
+			stream->stop_listen();
+		}
+	}
+	for (TranscriptionJob *job : jobs) {
+		job->cancel();
+	}
+	scheduler.stop();
+	while (!jobs.is_empty()) {
+		TranscriptionJob *job = jobs[jobs.size() - 1];
+		scheduler.remove_job(job);
+		job->_finish(false);
+	}
+	_swap_context(nullptr);
+	_swap_draft_context(nullptr);
+	default_stream.unref();
+	singleton = nullptr;
+}
 void SpeechToText::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("add_audio_buffer", "buffer"), &SpeechToText::add_audio_buffer);
+	ClassDB::bind_method(D_METHOD("add_audio_mono_f32", "samples", "rate"), &SpeechToText::add_audio_mono_f32, DEFVAL(SPEECH_SETTING_SAMPLE_RATE));
+	ClassDB::bind_method(D_METHOD("add_audio_pcm16", "pcm", "rate", "channels"), &SpeechToText::add_audio_pcm16, DEFVAL(SPEECH_SETTING_SAMPLE_RATE), DEFVAL(1));
+	ClassDB::bind_method(D_METHOD("add_audio_opus", "packet"), &SpeechToText::add_audio_opus);
+	ClassDB::bind_method(D_METHOD("_register_monitors"), &SpeechToText::_register_monitors);
 	ClassDB::bind_method(D_METHOD("get_entropy_threshold"), &SpeechToText::get_entropy_threshold);
 	ClassDB::bind_method(D_METHOD("set_entropy_threshold", "entropy_threshold"), &SpeechToText::set_entropy_threshold);
+	ClassDB::bind_method(D_METHOD("is_no_fallback"), &SpeechToText::is_no_fallback);
+	ClassDB::bind_method(D_METHOD("set_no_fallback", "no_fallback"), &SpeechToText::set_no_fallback);
+	ClassDB::bind_method(D_METHOD("get_temperature_inc"), &SpeechToText::get_temperature_inc);
+	ClassDB::bind_method(D_METHOD("set_temperature_inc", "temperature_inc"), &SpeechToText::set_temperature_inc);
+	ClassDB::bind_method(D_METHOD("get_max_fallbacks"), &SpeechToText::get_max_fallbacks);
+	ClassDB::bind_method(D_METHOD("set_max_fallbacks", "max_fallbacks"), &SpeechToText::set_max_fallbacks);
+	ClassDB::bind_method(D_METHOD("get_sampling_strategy"), &SpeechToText::get_sampling_strategy);
+	ClassDB::bind_method(D_METHOD("set_sampling_strategy", "sampling_strategy"), &SpeechToText::set_sampling_strategy);
+	ClassDB::bind_method(D_METHOD("get_beam_size"), &SpeechToText::get_beam_size);
+	ClassDB::bind_method(D_METHOD("set_beam_size", "beam_size"), &SpeechToText::set_beam_size);
+	ClassDB::bind_method(D_METHOD("get_best_of"), &SpeechToText::get_best_of);
+	ClassDB::bind_method(D_METHOD("set_best_of", "best_of"), &SpeechToText::set_best_of);
+	ClassDB::bind_method(D_METHOD("get_decode_budget_ms"), &SpeechToText::get_decode_budget_ms);
+	ClassDB::bind_method(D_METHOD("set_decode_budget_ms", "decode_budget_ms"), &SpeechToText::set_decode_budget_ms);
+	ClassDB::bind_method(D_METHOD("get_repetition_limit"), &SpeechToText::get_repetition_limit);
+	ClassDB::bind_method(D_METHOD("set_repetition_limit", "repetition_limit"), &SpeechToText::set_repetition_limit);
 	ClassDB::bind_method(D_METHOD("is_translate"), &SpeechToText::is_translate);
 	ClassDB::bind_method(D_METHOD("set_translate", "translate"), &SpeechToText::set_translate);
+	ClassDB::bind_method(D_METHOD("get_remote_inference_url"), &SpeechToText::get_remote_inference_url);
+	ClassDB::bind_method(D_METHOD("set_remote_inference_url", "url"), &SpeechToText::set_remote_inference_url);
+	ClassDB::bind_method(D_METHOD("get_remote_latency_budget_ms"), &SpeechToText::get_remote_latency_budget_ms);
+	ClassDB::bind_method(D_METHOD("set_remote_latency_budget_ms", "budget_ms"), &SpeechToText::set_remote_latency_budget_ms);
+	ClassDB::bind_method(D_METHOD("get_remote_retry_seconds"), &SpeechToText::get_remote_retry_seconds);
+	ClassDB::bind_method(D_METHOD("set_remote_retry_seconds", "seconds"), &SpeechToText::set_remote_retry_seconds);
+	ClassDB::bind_method(D_METHOD("is_dual_translation"), &SpeechToText::is_dual_translation);
+	ClassDB::bind_method(D_METHOD("set_dual_translation", "dual_translation"), &SpeechToText::set_dual_translation);
+	ClassDB::bind_method(D_METHOD("is_token_timestamps"), &SpeechToText::is_token_timestamps);
+	ClassDB::bind_method(D_METHOD("set_token_timestamps", "token_timestamps"), &SpeechToText::set_token_timestamps);
+	ClassDB::bind_method(D_METHOD("is_speaker_turns"), &SpeechToText::is_speaker_turns);
+	ClassDB::bind_method(D_METHOD("set_speaker_turns", "speaker_turns"), &SpeechToText::set_speaker_turns);
+	ClassDB::bind_method(D_METHOD("is_incremental_decoding"), &SpeechToText::is_incremental_decoding);
+	ClassDB::bind_method(D_METHOD("set_incremental_decoding", "incremental_decoding"), &SpeechToText::set_incremental_decoding);
+	ClassDB::bind_method(D_METHOD("get_local_agreement"), &SpeechToText::get_local_agreement);
+	ClassDB::bind_method(D_METHOD("set_local_agreement", "passes"), &SpeechToText::set_local_agreement);
 	ClassDB::bind_method(D_METHOD("is_speed_up"), &SpeechToText::is_speed_up);
 	ClassDB::bind_method(D_METHOD("set_speed_up", "speed_up"), &SpeechToText::set_speed_up);
 	ClassDB::bind_method(D_METHOD("get_freq_thold"), &SpeechToText::get_freq_thold);
 	ClassDB::bind_method(D_METHOD("set_freq_thold", "freq_thold"), &SpeechToText::set_freq_thold);
 	ClassDB::bind_method(D_METHOD("get_vad_thold"), &SpeechToText::get_vad_thold);
 	ClassDB::bind_method(D_METHOD("set_vad_thold", "vad_thold"), &SpeechToText::set_vad_thold);
+	ClassDB::bind_method(D_METHOD("get_vad_mode"), &SpeechToText::get_vad_mode);
+	ClassDB::bind_method(D_METHOD("set_vad_mode", "vad_mode"), &SpeechToText::set_vad_mode);
+	ClassDB::bind_method(D_METHOD("get_speech_threshold"), &SpeechToText::get_speech_threshold);
+	ClassDB::bind_method(D_METHOD("set_speech_threshold", "speech_threshold"), &SpeechToText::set_speech_threshold);
+	ClassDB::bind_method(D_METHOD("get_speech_pre_roll_ms"), &SpeechToText::get_speech_pre_roll_ms);
+	ClassDB::bind_method(D_METHOD("set_speech_pre_roll_ms", "speech_pre_roll_ms"), &SpeechToText::set_speech_pre_roll_ms);
+	ClassDB::bind_method(D_METHOD("get_speech_hang_over_ms"), &SpeechToText::get_speech_hang_over_ms);
+	ClassDB::bind_method(D_METHOD("set_speech_hang_over_ms", "speech_hang_over_ms"), &SpeechToText::set_speech_hang_over_ms);
+	ClassDB::bind_method(D_METHOD("get_endpoint_silence_ms"), &SpeechToText::get_endpoint_silence_ms);
+	ClassDB::bind_method(D_METHOD("set_endpoint_silence_ms", "endpoint_silence_ms"), &SpeechToText::set_endpoint_silence_ms);
+	ClassDB::bind_method(D_METHOD("is_adaptive_endpointing"), &SpeechToText::is_adaptive_endpointing);
+	ClassDB::bind_method(D_METHOD("set_adaptive_endpointing", "adaptive_endpointing"), &SpeechToText::set_adaptive_endpointing);
+	ClassDB::bind_method(D_METHOD("get_pass_trigger_ms"), &SpeechToText::get_pass_trigger_ms);
+	ClassDB::bind_method(D_METHOD("set_pass_trigger_ms", "pass_trigger_ms"), &SpeechToText::set_pass_trigger_ms);
+	ClassDB::bind_method(D_METHOD("get_max_utterance_ms"), &SpeechToText::get_max_utterance_ms);
+	ClassDB::bind_method(D_METHOD("set_max_utterance_ms", "max_utterance_ms"), &SpeechToText::set_max_utterance_ms);
+	ClassDB::bind_method(D_METHOD("is_noise_suppression"), &SpeechToText::is_noise_suppression);
+	ClassDB::bind_method(D_METHOD("set_noise_suppression", "noise_suppression"), &SpeechToText::set_noise_suppression);
+	ClassDB::bind_method(D_METHOD("is_auto_gain"), &SpeechToText::is_auto_gain);
+	ClassDB::bind_method(D_METHOD("set_auto_gain", "auto_gain"), &SpeechToText::set_auto_gain);
+	ClassDB::bind_method(D_METHOD("is_echo_cancellation"), &SpeechToText::is_echo_cancellation);
+	ClassDB::bind_method(D_METHOD("set_echo_cancellation", "echo_cancellation"), &SpeechToText::set_echo_cancellation);
+	ClassDB::bind_method(D_METHOD("is_mel_vad"), &SpeechToText::is_mel_vad);
+	ClassDB::bind_method(D_METHOD("set_mel_vad", "mel_vad"), &SpeechToText::set_mel_vad);
 	ClassDB::bind_method(D_METHOD("get_max_tokens"), &SpeechToText::get_max_tokens);
 	ClassDB::bind_method(D_METHOD("set_max_tokens", "max_tokens"), &SpeechToText::set_max_tokens);
+	ClassDB::bind_method(D_METHOD("get_prompt_context_tokens"), &SpeechToText::get_prompt_context_tokens);
+	ClassDB::bind_method(D_METHOD("set_prompt_context_tokens", "prompt_context_tokens"), &SpeechToText::set_prompt_context_tokens);
 	ClassDB::bind_method(D_METHOD("get_n_threads"), &SpeechToText::get_n_threads);
 	ClassDB::bind_method(D_METHOD("set_n_threads", "n_threads"), &SpeechToText::set_n_threads);
+	ClassDB::bind_method(D_METHOD("get_kv_cache_type"), &SpeechToText::get_kv_cache_type);
+	ClassDB::bind_method(D_METHOD("set_kv_cache_type", "kv_cache_type"), &SpeechToText::set_kv_cache_type);
+	ClassDB::bind_method(D_METHOD("is_flash_attention"), &SpeechToText::is_flash_attention);
+	ClassDB::bind_method(D_METHOD("set_flash_attention", "flash_attention"), &SpeechToText::set_flash_attention);
+	ClassDB::bind_method(D_METHOD("is_quantize_activations"), &SpeechToText::is_quantize_activations);
+	ClassDB::bind_method(D_METHOD("set_quantize_activations", "quantize_activations"), &SpeechToText::set_quantize_activations);
+	ClassDB::bind_method(D_METHOD("is_f16_activations"), &SpeechToText::is_f16_activations);
+	ClassDB::bind_method(D_METHOD("set_f16_activations", "f16_activations"), &SpeechToText::set_f16_activations);
+	ClassDB::bind_method(D_METHOD("is_gpu_mel"), &SpeechToText::is_gpu_mel);
+	ClassDB::bind_method(D_METHOD("set_gpu_mel", "gpu_mel"), &SpeechToText::set_gpu_mel);
+	ClassDB::bind_method(D_METHOD("get_encoder_device"), &SpeechToText::get_encoder_device);
+	ClassDB::bind_method(D_METHOD("set_encoder_device", "device"), &SpeechToText::set_encoder_device);
+	ClassDB::bind_method(D_METHOD("get_decoder_device"), &SpeechToText::get_decoder_device);
+	ClassDB::bind_method(D_METHOD("set_decoder_device", "device"), &SpeechToText::set_decoder_device);
+	ClassDB::bind_method(D_METHOD("is_dtw_word_timestamps"), &SpeechToText::is_dtw_word_timestamps);
+	ClassDB::bind_method(D_METHOD("set_dtw_word_timestamps", "dtw_word_timestamps"), &SpeechToText::set_dtw_word_timestamps);
+	ClassDB::bind_method(D_METHOD("get_alignment_heads_preset"), &SpeechToText::get_alignment_heads_preset);
+	ClassDB::bind_method(D_METHOD("set_alignment_heads_preset", "preset"), &SpeechToText::set_alignment_heads_preset);
+	ClassDB::bind_method(D_METHOD("get_memory_budget_mb"), &SpeechToText::get_memory_budget_mb);
+	ClassDB::bind_method(D_METHOD("set_memory_budget_mb", "megabytes"), &SpeechToText::set_memory_budget_mb);
+	ClassDB::bind_method(D_METHOD("get_memory_usage"), &SpeechToText::get_memory_usage);
+	ClassDB::bind_method(D_METHOD("get_inference_cores"), &SpeechToText::get_inference_cores);
+	ClassDB::bind_method(D_METHOD("set_inference_cores", "inference_cores"), &SpeechToText::set_inference_cores);
+	ClassDB::bind_method(D_METHOD("is_using_worker_thread_pool"), &SpeechToText::is_using_worker_thread_pool);
+	ClassDB::bind_method(D_METHOD("set_use_worker_thread_pool", "use_worker_thread_pool"), &SpeechToText::set_use_worker_thread_pool);
+	ClassDB::bind_method(D_METHOD("get_performance_core_count"), &SpeechToText::get_performance_core_count);
+	ClassDB::bind_method(D_METHOD("is_auto_tune_threads"), &SpeechToText::is_auto_tune_threads);
+	ClassDB::bind_method(D_METHOD("set_auto_tune_threads", "auto_tune_threads"), &SpeechToText::set_auto_tune_threads);
+	ClassDB::bind_method(D_METHOD("calibrate_threads"), &SpeechToText::calibrate_threads);
+	ClassDB::bind_method(D_METHOD("get_max_concurrent_decodes"), &SpeechToText::get_max_concurrent_decodes);
+	ClassDB::bind_method(D_METHOD("cancel_passes"), &SpeechToText::cancel_passes);
+	ClassDB::bind_method(D_METHOD("is_restart_stale_passes"), &SpeechToText::is_restart_stale_passes);
+	ClassDB::bind_method(D_METHOD("set_restart_stale_passes", "restart_stale_passes"), &SpeechToText::set_restart_stale_passes);
+	ClassDB::bind_method(D_METHOD("is_adaptive_quality"), &SpeechToText::is_adaptive_quality);
+	ClassDB::bind_method(D_METHOD("set_adaptive_quality", "adaptive_quality"), &SpeechToText::set_adaptive_quality);
+	ClassDB::bind_method(D_METHOD("get_metrics_history_size"), &SpeechToText::get_metrics_history_size);
+	ClassDB::bind_method(D_METHOD("set_metrics_history_size", "size"), &SpeechToText::set_metrics_history_size);
+	ClassDB::bind_method(D_METHOD("get_metrics"), &SpeechToText::get_metrics);
+	ClassDB::bind_method(D_METHOD("clear_metrics"), &SpeechToText::clear_metrics);
+	ClassDB::bind_method(D_METHOD("get_latency_histogram"), &SpeechToText::get_latency_histogram);
+	ClassDB::bind_method(D_METHOD("reset_latency_histogram"), &SpeechToText::reset_latency_histogram);
+	ClassDB::bind_method(D_METHOD("export_metrics", "path"), &SpeechToText::export_metrics);
+	ClassDB::bind_method(D_METHOD("start_metrics_log", "path"), &SpeechToText::start_metrics_log);
+	ClassDB::bind_method(D_METHOD("stop_metrics_log"), &SpeechToText::stop_metrics_log);
+	ClassDB::bind_method(D_METHOD("is_metrics_logging"), &SpeechToText::is_metrics_logging);
+	ClassDB::bind_method(D_METHOD("get_lock_metrics"), &SpeechToText::get_lock_metrics);
+	ClassDB::bind_method(D_METHOD("reset_lock_metrics"), &SpeechToText::reset_lock_metrics);
+	ClassDB::bind_method(D_METHOD("get_thermal_state"), &SpeechToText::get_thermal_state);
+	ClassDB::bind_method(D_METHOD("get_thermal_headroom"), &SpeechToText::get_thermal_headroom);
+	ClassDB::bind_method(D_METHOD("get_encoder_batch_size"), &SpeechToText::get_encoder_batch_size);
+	ClassDB::bind_method(D_METHOD("set_encoder_batch_size", "encoder_batch_size"), &SpeechToText::set_encoder_batch_size);
+	ClassDB::bind_method(D_METHOD("get_decoder_batch_size"), &SpeechToText::get_decoder_batch_size);
+	ClassDB::bind_method(D_METHOD("set_decoder_batch_size", "decoder_batch_size"), &SpeechToText::set_decoder_batch_size);
+	ClassDB::bind_method(D_METHOD("get_decoder_batch_wait_usec"), &SpeechToText::get_decoder_batch_wait_usec);
+	ClassDB::bind_method(D_METHOD("set_decoder_batch_wait_usec", "usec"), &SpeechToText::set_decoder_batch_wait_usec);
+	ClassDB::bind_method(D_METHOD("set_max_concurrent_decodes", "max_concurrent_decodes"), &SpeechToText::set_max_concurrent_decodes);
+	ClassDB::bind_method(D_METHOD("get_caption_worker_budget"), &SpeechToText::get_caption_worker_budget);
+	ClassDB::bind_method(D_METHOD("set_caption_worker_budget", "workers"), &SpeechToText::set_caption_worker_budget);
+	ClassDB::bind_method(D_METHOD("get_background_worker_budget"), &SpeechToText::get_background_worker_budget);
+	ClassDB::bind_method(D_METHOD("set_background_worker_budget", "workers"), &SpeechToText::set_background_worker_budget);
+	ClassDB::bind_method(D_METHOD("get_job_state_pool_size"), &SpeechToText::get_job_state_pool_size);
+	ClassDB::bind_method(D_METHOD("set_job_state_pool_size", "size"), &SpeechToText::set_job_state_pool_size);
+	ClassDB::bind_method(D_METHOD("is_draft_previous_tokens"), &SpeechToText::is_draft_previous_tokens);
+	ClassDB::bind_method(D_METHOD("set_draft_previous_tokens", "draft_previous_tokens"), &SpeechToText::set_draft_previous_tokens);
+	ClassDB::bind_method(D_METHOD("is_dynamic_audio_ctx"), &SpeechToText::is_dynamic_audio_ctx);
+	ClassDB::bind_method(D_METHOD("set_dynamic_audio_ctx", "dynamic_audio_ctx"), &SpeechToText::set_dynamic_audio_ctx);
+	ClassDB::bind_method(D_METHOD("get_audio_ctx_granularity"), &SpeechToText::get_audio_ctx_granularity);
+	ClassDB::bind_method(D_METHOD("set_audio_ctx_granularity", "audio_ctx_granularity"), &SpeechToText::set_audio_ctx_granularity);
+	ClassDB::bind_method(D_METHOD("get_audio_ctx_min"), &SpeechToText::get_audio_ctx_min);
+	ClassDB::bind_method(D_METHOD("set_audio_ctx_min", "audio_ctx_min"), &SpeechToText::set_audio_ctx_min);
+	ClassDB::bind_method(D_METHOD("get_audio_ctx_max"), &SpeechToText::get_audio_ctx_max);
+	ClassDB::bind_method(D_METHOD("set_audio_ctx_max", "audio_ctx_max"), &SpeechToText::set_audio_ctx_max);
+	ClassDB::bind_method(D_METHOD("get_encoder_chunk_ms"), &SpeechToText::get_encoder_chunk_ms);
+	ClassDB::bind_method(D_METHOD("set_encoder_chunk_ms", "encoder_chunk_ms"), &SpeechToText::set_encoder_chunk_ms);
+	ClassDB::bind_method(D_METHOD("get_encoder_overlap_ms"), &SpeechToText::get_encoder_overlap_ms);
+	ClassDB::bind_method(D_METHOD("set_encoder_overlap_ms", "encoder_overlap_ms"), &SpeechToText::set_encoder_overlap_ms);
+	ClassDB::bind_method(D_METHOD("is_pipelined_encoding"), &SpeechToText::is_pipelined_encoding);
+	ClassDB::bind_method(D_METHOD("set_pipelined_encoding", "pipelined_encoding"), &SpeechToText::set_pipelined_encoding);
+	ClassDB::bind_method(D_METHOD("get_resampler_quality"), &SpeechToText::get_resampler_quality);
+	ClassDB::bind_method(D_METHOD("set_resampler_quality", "resampler_quality"), &SpeechToText::set_resampler_quality);
+	ClassDB::bind_method(D_METHOD("get_audio_queue_seconds"), &SpeechToText::get_audio_queue_seconds);
+	ClassDB::bind_method(D_METHOD("set_audio_queue_seconds", "audio_queue_seconds"), &SpeechToText::set_audio_queue_seconds);
+	ClassDB::bind_method(D_METHOD("get_audio_queue_overflow_policy"), &SpeechToText::get_audio_queue_overflow_policy);
+	ClassDB::bind_method(D_METHOD("set_audio_queue_overflow_policy", "audio_queue_overflow_policy"), &SpeechToText::set_audio_queue_overflow_policy);
+	ClassDB::bind_method(D_METHOD("get_max_backlog_seconds"), &SpeechToText::get_max_backlog_seconds);
+	ClassDB::bind_method(D_METHOD("set_max_backlog_seconds", "max_backlog_seconds"), &SpeechToText::set_max_backlog_seconds);
+	ClassDB::bind_method(D_METHOD("get_results_delivery"), &SpeechToText::get_results_delivery);
+	ClassDB::bind_method(D_METHOD("set_results_delivery", "results_delivery"), &SpeechToText::set_results_delivery);
+	ClassDB::bind_method(D_METHOD("poll_results", "max"), &SpeechToText::poll_results, DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("poll_packed_results", "results", "max"), &SpeechToText::poll_packed_results, DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("get_dropped_audio_frames"), &SpeechToText::get_dropped_audio_frames);
+	ClassDB::bind_method(D_METHOD("get_speech_probabilities"), &SpeechToText::get_speech_probabilities);
 
 	ClassDB::bind_method(D_METHOD("get_language"), &SpeechToText::get_language);
 	ClassDB::bind_method(D_METHOD("set_language", "language"), &SpeechToText::set_language);
+	ClassDB::bind_method(D_METHOD("get_language_pin_seconds"), &SpeechToText::get_language_pin_seconds);
+	ClassDB::bind_method(D_METHOD("set_language_pin_seconds", "language_pin_seconds"), &SpeechToText::set_language_pin_seconds);
+	ClassDB::bind_method(D_METHOD("get_allowed_languages"), &SpeechToText::get_allowed_languages);
+	ClassDB::bind_method(D_METHOD("set_allowed_languages", "languages"), &SpeechToText::set_allowed_languages);
+	ClassDB::bind_method(D_METHOD("get_language_pin_probability"), &SpeechToText::get_language_pin_probability);
+	ClassDB::bind_method(D_METHOD("set_language_pin_probability", "language_pin_probability"), &SpeechToText::set_language_pin_probability);
 	ClassDB::bind_method(D_METHOD("get_language_model"), &SpeechToText::get_language_model);
 	ClassDB::bind_method(D_METHOD("set_language_model", "model"), &SpeechToText::set_language_model);
+	ClassDB::bind_method(D_METHOD("apply_streaming_preset"), &SpeechToText::apply_streaming_preset);
+	ClassDB::bind_method(D_METHOD("set_auto_streaming_preset", "auto_streaming_preset"), &SpeechToText::set_auto_streaming_preset);
+	ClassDB::bind_method(D_METHOD("is_auto_streaming_preset"), &SpeechToText::is_auto_streaming_preset);
+	ClassDB::bind_method(D_METHOD("get_draft_model"), &SpeechToText::get_draft_model);
+	ClassDB::bind_method(D_METHOD("set_draft_model", "model"), &SpeechToText::set_draft_model);
+	ClassDB::bind_method(D_METHOD("get_suppressed_tokens"), &SpeechToText::get_suppressed_tokens);
+	ClassDB::bind_method(D_METHOD("set_suppressed_tokens", "suppressed_tokens"), &SpeechToText::set_suppressed_tokens);
+	ClassDB::bind_method(D_METHOD("get_suppress_regex"), &SpeechToText::get_suppress_regex);
+	ClassDB::bind_method(D_METHOD("set_suppress_regex", "suppress_regex"), &SpeechToText::set_suppress_regex);
+	ClassDB::bind_method(D_METHOD("get_initial_prompt"), &SpeechToText::get_initial_prompt);
+	ClassDB::bind_method(D_METHOD("set_initial_prompt", "initial_prompt"), &SpeechToText::set_initial_prompt);
+	ClassDB::bind_method(D_METHOD("get_grammar"), &SpeechToText::get_grammar);
+	ClassDB::bind_method(D_METHOD("set_grammar", "grammar"), &SpeechToText::set_grammar);
+	ClassDB::bind_method(D_METHOD("get_grammar_start_rule"), &SpeechToText::get_grammar_start_rule);
+	ClassDB::bind_method(D_METHOD("set_grammar_start_rule", "grammar_start_rule"), &SpeechToText::set_grammar_start_rule);
+	ClassDB::bind_method(D_METHOD("get_grammar_penalty"), &SpeechToText::get_grammar_penalty);
+	ClassDB::bind_method(D_METHOD("set_grammar_penalty", "grammar_penalty"), &SpeechToText::set_grammar_penalty);
+	ClassDB::bind_method(D_METHOD("is_prune_vocabulary"), &SpeechToText::is_prune_vocabulary);
+	ClassDB::bind_method(D_METHOD("set_prune_vocabulary", "prune_vocabulary"), &SpeechToText::set_prune_vocabulary);
+	ClassDB::bind_method(D_METHOD("get_draft_n_threads"), &SpeechToText::get_draft_n_threads);
+	ClassDB::bind_method(D_METHOD("set_draft_n_threads", "draft_n_threads"), &SpeechToText::set_draft_n_threads);
+	ClassDB::bind_method(D_METHOD("get_partial_encoder_layers"), &SpeechToText::get_partial_encoder_layers);
+	ClassDB::bind_method(D_METHOD("set_partial_encoder_layers", "partial_encoder_layers"), &SpeechToText::set_partial_encoder_layers);
+	ClassDB::bind_method(D_METHOD("get_openvino_encoder_path"), &SpeechToText::get_openvino_encoder_path);
+	ClassDB::bind_method(D_METHOD("set_openvino_encoder_path", "openvino_encoder_path"), &SpeechToText::set_openvino_encoder_path);
+	ClassDB::bind_method(D_METHOD("get_openvino_device"), &SpeechToText::get_openvino_device);
+	ClassDB::bind_method(D_METHOD("set_openvino_device", "openvino_device"), &SpeechToText::set_openvino_device);
+	ClassDB::bind_method(D_METHOD("get_nnapi_encoder_path"), &SpeechToText::get_nnapi_encoder_path);
+	ClassDB::bind_method(D_METHOD("set_nnapi_encoder_path", "nnapi_encoder_path"), &SpeechToText::set_nnapi_encoder_path);
+	ClassDB::bind_method(D_METHOD("get_nnapi_accelerator"), &SpeechToText::get_nnapi_accelerator);
+	ClassDB::bind_method(D_METHOD("set_nnapi_accelerator", "nnapi_accelerator"), &SpeechToText::set_nnapi_accelerator);
 	ClassDB::bind_method(D_METHOD("is_use_gpu"), &SpeechToText::is_use_gpu);
 	ClassDB::bind_method(D_METHOD("set_use_gpu", "use_gpu"), &SpeechToText::set_use_gpu);
+	ClassDB::bind_method(D_METHOD("get_gpu_device"), &SpeechToText::get_gpu_device);
+	ClassDB::bind_method(D_METHOD("set_gpu_device", "gpu_device"), &SpeechToText::set_gpu_device);
+	ClassDB::bind_method(D_METHOD("is_repack_weights"), &SpeechToText::is_repack_weights);
+	ClassDB::bind_method(D_METHOD("set_repack_weights", "repack_weights"), &SpeechToText::set_repack_weights);
+	ClassDB::bind_method(D_METHOD("is_lock_model_memory"), &SpeechToText::is_lock_model_memory);
+	ClassDB::bind_method(D_METHOD("set_lock_model_memory", "lock_model_memory"), &SpeechToText::set_lock_model_memory);
+	ClassDB::bind_method(D_METHOD("is_use_huge_pages"), &SpeechToText::is_use_huge_pages);
+	ClassDB::bind_method(D_METHOD("set_use_huge_pages", "use_huge_pages"), &SpeechToText::set_use_huge_pages);
+	ClassDB::bind_method(D_METHOD("is_map_model_file"), &SpeechToText::is_map_model_file);
+	ClassDB::bind_method(D_METHOD("set_map_model_file", "map_model_file"), &SpeechToText::set_map_model_file);
+	ClassDB::bind_method(D_METHOD("is_rendering_device_compute"), &SpeechToText::is_rendering_device_compute);
+	ClassDB::bind_method(D_METHOD("set_rendering_device_compute", "rendering_device_compute"), &SpeechToText::set_rendering_device_compute);
+	ClassDB::bind_method(D_METHOD("is_webgpu_compute"), &SpeechToText::is_webgpu_compute);
+	ClassDB::bind_method(D_METHOD("set_webgpu_compute", "webgpu_compute"), &SpeechToText::set_webgpu_compute);
+	ClassDB::bind_method(D_METHOD("get_gpu_submit_budget_usec"), &SpeechToText::get_gpu_submit_budget_usec);
+	ClassDB::bind_method(D_METHOD("set_gpu_submit_budget_usec", "usec"), &SpeechToText::set_gpu_submit_budget_usec);
+	ClassDB::bind_method(D_METHOD("is_gpu_frame_sync"), &SpeechToText::is_gpu_frame_sync);
+	ClassDB::bind_method(D_METHOD("set_gpu_frame_sync", "gpu_frame_sync"), &SpeechToText::set_gpu_frame_sync);
+	ClassDB::bind_method(D_METHOD("load_model"), &SpeechToText::load_model);
+	ClassDB::bind_method(D_METHOD("load_model_async"), &SpeechToText::load_model_async);
+	ClassDB::bind_method(D_METHOD("is_loading_model"), &SpeechToText::is_loading_model);
+	ClassDB::bind_method(D_METHOD("_finish_model_load", "success"), &SpeechToText::_finish_model_load);
+	ClassDB::bind_method(D_METHOD("_finish_warmup", "serial"), &SpeechToText::_finish_warmup);
+	ClassDB::bind_method(D_METHOD("is_warmup_model"), &SpeechToText::is_warmup_model);
+	ClassDB::bind_method(D_METHOD("set_warmup_model", "warmup_model"), &SpeechToText::set_warmup_model);
+	ClassDB::bind_method(D_METHOD("is_load_model_in_editor"), &SpeechToText::is_load_model_in_editor);
+	ClassDB::bind_method(D_METHOD("set_load_model_in_editor", "load_model_in_editor"), &SpeechToText::set_load_model_in_editor);
+	ClassDB::bind_method(D_METHOD("_reload_model_if_dirty"), &SpeechToText::_reload_model_if_dirty);
+	ClassDB::bind_method(D_METHOD("_schedule_hibernation"), &SpeechToText::_schedule_hibernation);
+	ClassDB::bind_method(D_METHOD("get_frame_budget_threads"), &SpeechToText::get_frame_budget_threads);
+	ClassDB::bind_method(D_METHOD("set_frame_budget_threads", "threads"), &SpeechToText::set_frame_budget_threads);
+	ClassDB::bind_method(D_METHOD("is_frame_budget_idle"), &SpeechToText::is_frame_budget_idle);
+	ClassDB::bind_method(D_METHOD("set_frame_budget_idle", "idle"), &SpeechToText::set_frame_budget_idle);
+	ClassDB::bind_method(D_METHOD("get_hibernate_after_seconds"), &SpeechToText::get_hibernate_after_seconds);
+	ClassDB::bind_method(D_METHOD("set_hibernate_after_seconds", "seconds"), &SpeechToText::set_hibernate_after_seconds);
+	ClassDB::bind_method(D_METHOD("is_hibernate_release_weights"), &SpeechToText::is_hibernate_release_weights);
+	ClassDB::bind_method(D_METHOD("set_hibernate_release_weights", "release"), &SpeechToText::set_hibernate_release_weights);
+	ClassDB::bind_method(D_METHOD("is_hibernating"), &SpeechToText::is_hibernating);
 	ClassDB::bind_method(D_METHOD("start_listen"), &SpeechToText::start_listen);
-	ClassDB::bind_method(D_METHOD("run"), &SpeechToText::run);
 	ClassDB::bind_method(D_METHOD("stop_listen"), &SpeechToText::stop_listen);
+	ClassDB::bind_method(D_METHOD("create_stream"), &SpeechToText::create_stream);
+	ClassDB::bind_method(D_METHOD("add_audio_batch", "streams", "buffers", "rate"), &SpeechToText::add_audio_batch, DEFVAL(SPEECH_SETTING_SAMPLE_RATE));
+	ClassDB::bind_method(D_METHOD("get_default_stream"), &SpeechToText::get_default_stream);
+	ClassDB::bind_method(D_METHOD("transcribe_async", "audio", "options"), &SpeechToText::transcribe_async, DEFVAL(Dictionary()));
+	ClassDB::bind_method(D_METHOD("transcribe_file_async", "path", "options"), &SpeechToText::transcribe_file_async, DEFVAL(Dictionary()));
+	ClassDB::bind_method(D_METHOD("get_transcript_cache_size"), &SpeechToText::get_transcript_cache_size);
+	ClassDB::bind_method(D_METHOD("set_transcript_cache_size", "size"), &SpeechToText::set_transcript_cache_size);
+	ClassDB::bind_method(D_METHOD("get_transcript_cache_directory"), &SpeechToText::get_transcript_cache_directory);
+	ClassDB::bind_method(D_METHOD("set_transcript_cache_directory", "directory"), &SpeechToText::set_transcript_cache_directory);
+	ClassDB::bind_method(D_METHOD("clear_transcript_cache", "files"), &SpeechToText::clear_transcript_cache, DEFVAL(false));
+	ClassDB::bind_method(D_METHOD("save_trace", "path", "clear"), &SpeechToText::save_trace, DEFVAL(true));
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "language", PROPERTY_HINT_ENUM, "Auto,English,Chinese,German,Spanish,Russian,Korean,French,Japanese,Portuguese,Turkish,Polish,Catalan,Dutch,Arabic,Swedish,Italian,Indonesian,Hindi,Finnish,Vietnamese,Hebrew,Ukrainian,Greek,Malay,Czech,Romanian,Danish,Hungarian,Tamil,Norwegian,Thai,Urdu,Croatian,Bulgarian,Lithuanian,Latin,Maori,Malayalam,Welsh,Slovak,Telugu,Persian,Latvian,Bengali,Serbian,Azerbaijani,Slovenian,Kannada,Estonian,Macedonian,Breton,Basque,Icelandic,Armenian,Nepali,Mongolian,Bosnian,Kazakh,Albanian,Swahili,Galician,Marathi,Punjabi,Sinhala,Khmer,Shona,Yoruba,Somali,Afrikaans,Occitan,Georgian,Belarusian,Tajik,Sindhi,Gujarati,Amharic,Yiddish,Lao,Uzbek,Faroese,Haitian_Creole,Pashto,Turkmen,Nynorsk,Maltese,Sanskrit,Luxembourgish,Myanmar,Tibetan,Tagalog,Malagasy,Assamese,Tatar,Hawaiian,Lingala,Hausa,Bashkir,Javanese,Sundanese,Cantonese"), "set_language", "get_language");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "language_pin_seconds", PROPERTY_HINT_RANGE, "0,30,0.5,or_greater"), "set_language_pin_seconds", "get_language_pin_seconds");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_STRING_ARRAY, "allowed_languages"), "set_allowed_languages", "get_allowed_languages");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "language_pin_probability", PROPERTY_HINT_RANGE, "0,1,0.01"), "set_language_pin_probability", "get_language_pin_probability");
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "language_model", PROPERTY_HINT_RESOURCE_TYPE, "WhisperResource"), "set_language_model", "get_language_model");
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "draft_model", PROPERTY_HINT_RESOURCE_TYPE, "WhisperResource"), "set_draft_model", "get_draft_model");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_STRING_ARRAY, "suppressed_tokens"), "set_suppressed_tokens", "get_suppressed_tokens");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "suppress_regex"), "set_suppress_regex", "get_suppress_regex");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "initial_prompt", PROPERTY_HINT_MULTILINE_TEXT), "set_initial_prompt", "get_initial_prompt");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "grammar", PROPERTY_HINT_MULTILINE_TEXT), "set_grammar", "get_grammar");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "grammar_start_rule"), "set_grammar_start_rule", "get_grammar_start_rule");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "grammar_penalty"), "set_grammar_penalty", "get_grammar_penalty");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "prune_vocabulary"), "set_prune_vocabulary", "is_prune_vocabulary");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "draft_n_threads", PROPERTY_HINT_RANGE, "0,32"), "set_draft_n_threads", "get_draft_n_threads");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "partial_encoder_layers", PROPERTY_HINT_RANGE, "0,32"), "set_partial_encoder_layers", "get_partial_encoder_layers");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_gpu"), "set_use_gpu", "is_use_gpu");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "gpu_device", PROPERTY_HINT_RANGE, "0,15"), "set_gpu_device", "get_gpu_device");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "repack_weights"), "set_repack_weights", "is_repack_weights");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "lock_model_memory"), "set_lock_model_memory", "is_lock_model_memory");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_huge_pages"), "set_use_huge_pages", "is_use_huge_pages");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "map_model_file"), "set_map_model_file", "is_map_model_file");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "rendering_device_compute"), "set_rendering_device_compute", "is_rendering_device_compute");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "webgpu_compute"), "set_webgpu_compute", "is_webgpu_compute");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "gpu_submit_budget_usec", PROPERTY_HINT_RANGE, "0,100000,100,suffix:us"), "set_gpu_submit_budget_usec", "get_gpu_submit_budget_usec");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "gpu_frame_sync"), "set_gpu_frame_sync", "is_gpu_frame_sync");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "openvino_encoder_path", PROPERTY_HINT_FILE, "*.xml"), "set_openvino_encoder_path", "get_openvino_encoder_path");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "openvino_device", PROPERTY_HINT_ENUM_SUGGESTION, "CPU,GPU,NPU"), "set_openvino_device", "get_openvino_device");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "nnapi_encoder_path", PROPERTY_HINT_FILE, "*.tflite"), "set_nnapi_encoder_path", "get_nnapi_encoder_path");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "nnapi_accelerator"), "set_nnapi_accelerator", "get_nnapi_accelerator");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "entropy_threshold"), "set_entropy_threshold", "get_entropy_threshold");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "no_fallback"), "set_no_fallback", "is_no_fallback");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "temperature_inc", PROPERTY_HINT_RANGE, "0,1,0.05"), "set_temperature_inc", "get_temperature_inc");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_fallbacks", PROPERTY_HINT_RANGE, "0,10"), "set_max_fallbacks", "get_max_fallbacks");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "sampling_strategy", PROPERTY_HINT_ENUM, "Greedy,Beam Search"), "set_sampling_strategy", "get_sampling_strategy");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "beam_size", PROPERTY_HINT_RANGE, "1,8"), "set_beam_size", "get_beam_size");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "best_of", PROPERTY_HINT_RANGE, "1,8"), "set_best_of", "get_best_of");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "decode_budget_ms", PROPERTY_HINT_RANGE, "0,10000,1,or_greater,suffix:ms"), "set_decode_budget_ms", "get_decode_budget_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "repetition_limit", PROPERTY_HINT_RANGE, "0,16"), "set_repetition_limit", "get_repetition_limit");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "translate"), "set_translate", "is_translate");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "remote_inference_url"), "set_remote_inference_url", "get_remote_inference_url");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "remote_latency_budget_ms", PROPERTY_HINT_RANGE, "100,30000,1,suffix:ms"), "set_remote_latency_budget_ms", "get_remote_latency_budget_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "remote_retry_seconds", PROPERTY_HINT_RANGE, "0,600,0.1,suffix:s"), "set_remote_retry_seconds", "get_remote_retry_seconds");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "dual_translation"), "set_dual_translation", "is_dual_translation");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "token_timestamps"), "set_token_timestamps", "is_token_timestamps");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "speaker_turns"), "set_speaker_turns", "is_speaker_turns");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "incremental_decoding"), "set_incremental_decoding", "is_incremental_decoding");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "local_agreement", PROPERTY_HINT_RANGE, "0,8"), "set_local_agreement", "get_local_agreement");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "draft_previous_tokens"), "set_draft_previous_tokens", "is_draft_previous_tokens");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "speed_up"), "set_speed_up", "is_speed_up");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "freq_thold"), "set_freq_thold", "get_freq_thold");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "vad_thold"), "set_vad_thold", "get_vad_thold");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "vad_mode", PROPERTY_HINT_ENUM, "Energy,Adaptive"), "set_vad_mode", "get_vad_mode");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "speech_threshold", PROPERTY_HINT_RANGE, "0,1,0.01"), "set_speech_threshold", "get_speech_threshold");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "speech_pre_roll_ms", PROPERTY_HINT_RANGE, "0,2000"), "set_speech_pre_roll_ms", "get_speech_pre_roll_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "speech_hang_over_ms", PROPERTY_HINT_RANGE, "0,2000"), "set_speech_hang_over_ms", "get_speech_hang_over_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "endpoint_silence_ms", PROPERTY_HINT_RANGE, "0,3000"), "set_endpoint_silence_ms", "get_endpoint_silence_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "adaptive_endpointing"), "set_adaptive_endpointing", "is_adaptive_endpointing");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "pass_trigger_ms", PROPERTY_HINT_RANGE, "100,10000"), "set_pass_trigger_ms", "get_pass_trigger_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_utterance_ms", PROPERTY_HINT_RANGE, "1000,30000"), "set_max_utterance_ms", "get_max_utterance_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "noise_suppression"), "set_noise_suppression", "is_noise_suppression");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "auto_gain"), "set_auto_gain", "is_auto_gain");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "echo_cancellation"), "set_echo_cancellation", "is_echo_cancellation");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "mel_vad"), "set_mel_vad", "is_mel_vad");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_tokens"), "set_max_tokens", "get_max_tokens");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "prompt_context_tokens", PROPERTY_HINT_RANGE, "0,224"), "set_prompt_context_tokens", "get_prompt_context_tokens");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "n_threads"), "set_n_threads", "get_n_threads");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "inference_cores", PROPERTY_HINT_ENUM, "Any,Performance"), "set_inference_cores", "get_inference_cores");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_worker_thread_pool"), "set_use_worker_thread_pool", "is_using_worker_thread_pool");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "kv_cache_type", PROPERTY_HINT_ENUM, "F16,F32,Q8_0"), "set_kv_cache_type", "get_kv_cache_type");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "flash_attention"), "set_flash_attention", "is_flash_attention");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "quantize_activations"), "set_quantize_activations", "is_quantize_activations");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "f16_activations"), "set_f16_activations", "is_f16_activations");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "gpu_mel"), "set_gpu_mel", "is_gpu_mel");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "encoder_device", PROPERTY_HINT_ENUM, "GPU,CPU"), "set_encoder_device", "get_encoder_device");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "decoder_device", PROPERTY_HINT_ENUM, "GPU,CPU"), "set_decoder_device", "get_decoder_device");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "dtw_word_timestamps"), "set_dtw_word_timestamps", "is_dtw_word_timestamps");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "alignment_heads_preset", PROPERTY_HINT_ENUM, "Auto,Upper Half,Tiny.en,Tiny,Base.en,Base,Small.en,Small,Medium.en,Medium,Large v1,Large v2,Large v3"), "set_alignment_heads_preset", "get_alignment_heads_preset");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "memory_budget_mb", PROPERTY_HINT_RANGE, "0,65536,1,or_greater,suffix:MiB"), "set_memory_budget_mb", "get_memory_budget_mb");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "auto_tune_threads"), "set_auto_tune_threads", "is_auto_tune_threads");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "warmup_model"), "set_warmup_model", "is_warmup_model");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "load_model_in_editor"), "set_load_model_in_editor", "is_load_model_in_editor");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "auto_streaming_preset"), "set_auto_streaming_preset", "is_auto_streaming_preset");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "frame_budget_threads", PROPERTY_HINT_RANGE, "0,32"), "set_frame_budget_threads", "get_frame_budget_threads");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "frame_budget_idle"), "set_frame_budget_idle", "is_frame_budget_idle");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "hibernate_after_seconds", PROPERTY_HINT_RANGE, "0,3600,0.1,or_greater,suffix:s"), "set_hibernate_after_seconds", "get_hibernate_after_seconds");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "hibernate_release_weights"), "set_hibernate_release_weights", "is_hibernate_release_weights");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_concurrent_decodes", PROPERTY_HINT_RANGE, "0,64"), "set_max_concurrent_decodes", "get_max_concurrent_decodes");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "caption_worker_budget", PROPERTY_HINT_RANGE, "0,64"), "set_caption_worker_budget", "get_caption_worker_budget");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "background_worker_budget", PROPERTY_HINT_RANGE, "0,64"), "set_background_worker_budget", "get_background_worker_budget");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "job_state_pool_size", PROPERTY_HINT_RANGE, "0,16"), "set_job_state_pool_size", "get_job_state_pool_size");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "restart_stale_passes"), "set_restart_stale_passes", "is_restart_stale_passes");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "adaptive_quality"), "set_adaptive_quality", "is_adaptive_quality");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "metrics_history_size", PROPERTY_HINT_RANGE, "0,65536,1,or_greater"), "set_metrics_history_size", "get_metrics_history_size");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "transcript_cache_size", PROPERTY_HINT_RANGE, "0,4096,1,or_greater"), "set_transcript_cache_size", "get_transcript_cache_size");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "transcript_cache_directory", PROPERTY_HINT_DIR), "set_transcript_cache_directory", "get_transcript_cache_directory");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "encoder_batch_size", PROPERTY_HINT_RANGE, "1,16"), "set_encoder_batch_size", "get_encoder_batch_size");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "decoder_batch_size", PROPERTY_HINT_RANGE, "1,16"), "set_decoder_batch_size", "get_decoder_batch_size");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "decoder_batch_wait_usec", PROPERTY_HINT_RANGE, "0,20000,100,suffix:us"), "set_decoder_batch_wait_usec", "get_decoder_batch_wait_usec");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "dynamic_audio_ctx"), "set_dynamic_audio_ctx", "is_dynamic_audio_ctx");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "audio_ctx_granularity", PROPERTY_HINT_RANGE, "1,1500"), "set_audio_ctx_granularity", "get_audio_ctx_granularity");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "audio_ctx_min", PROPERTY_HINT_RANGE, "1,1500"), "set_audio_ctx_min", "get_audio_ctx_min");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "audio_ctx_max", PROPERTY_HINT_RANGE, "1,1500"), "set_audio_ctx_max", "get_audio_ctx_max");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "encoder_chunk_ms", PROPERTY_HINT_RANGE, "0,30000"), "set_encoder_chunk_ms", "get_encoder_chunk_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "encoder_overlap_ms", PROPERTY_HINT_RANGE, "0,10000"), "set_encoder_overlap_ms", "get_encoder_overlap_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "pipelined_encoding"), "set_pipelined_encoding", "is_pipelined_encoding");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "resampler_quality", PROPERTY_HINT_ENUM, "Sinc Best,Sinc Medium,Sinc Fastest,Zero Order Hold,Linear,Polyphase"), "set_resampler_quality", "get_resampler_quality");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "audio_queue_seconds"), "set_audio_queue_seconds", "get_audio_queue_seconds");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "audio_queue_overflow_policy", PROPERTY_HINT_ENUM, "Drop Oldest,Drop Newest,Block,Skip To Latest Segment"), "set_audio_queue_overflow_policy", "get_audio_queue_overflow_policy");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "max_backlog_seconds"), "set_max_backlog_seconds", "get_max_backlog_seconds");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "results_delivery", PROPERTY_HINT_ENUM, "Signal,Poll,Packed Signal"), "set_results_delivery", "get_results_delivery");
 
-	ADD_SIGNAL(MethodInfo("update_transcribed_msgs", PropertyInfo(Variant::INT, "process_time_ms"), PropertyInfo(Variant::ARRAY, "transcribed_msgs")));
+	ADD_SIGNAL(MethodInfo("update_transcribed_msgs", PropertyInfo(Variant::INT, "process_time_ms"), PropertyInfo(Variant::ARRAY, "transcription_results", PROPERTY_HINT_ARRAY_TYPE, "TranscriptionResult")));
+	ADD_SIGNAL(MethodInfo("update_transcribed_packed", PropertyInfo(Variant::INT, "process_time_ms"), PropertyInfo(Variant::OBJECT, "results", PROPERTY_HINT_RESOURCE_TYPE, "PackedTranscriptionResults")));
+	ADD_SIGNAL(MethodInfo("model_load_progress", PropertyInfo(Variant::FLOAT, "progress")));
+	ADD_SIGNAL(MethodInfo("model_loaded", PropertyInfo(Variant::BOOL, "success")));
+	ADD_SIGNAL(MethodInfo("model_ready"));
 
 	BIND_CONSTANT(SPEECH_SETTING_SAMPLE_RATE);
 }
@@ -1,9 +1,23 @@
 #ifndef SPEECH_TO_TEXT_H
 #define SPEECH_TO_TEXT_H
 
+#include "audio_ring_buffer.h"
+#include "echo_canceller.h"
+#include "frame_budget.h"
+#include "latency_histogram.h"
+#include "metrics_history.h"
+#include "transcript_cache.h"
 #include "resource_whisper.h"
+#include "speech_to_text_params.h"
+#include "speech_to_text_stream.h"
+#include "thermal_monitor.h"
+#include "thread_affinity.h"
+#include "transcription_job.h"
+#include "transcription_scheduler.h"
+#include "vad_engine.h"
 
 #include <libsamplerate/src/samplerate.h>
+#include <whisper.cpp/examples/grammar-parser.h>
 #include <whisper.cpp/whisper.h>
 #include <godot_cpp/classes/mutex.hpp>
 #include <godot_cpp/classes/node.hpp>
@@ -14,18 +28,17 @@
 #include <godot_cpp/variant/array.hpp>
 #include <godot_cpp/variant/callable.hpp>
 #include <godot_cpp/variant/callable_method_pointer.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_string_array.hpp>
 
 #include <atomic>
+#include <memory>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 
 using namespace godot;
 
-struct transcribed_msg {
-	std::string text;
-	bool is_partial;
-};
-
 class SpeechToText : public Node {
 public:
 	enum Language {
@@ -137,29 +150,249 @@ public:
 private:
 	GDCLASS(SpeechToText, Node);
 
-	struct whisper_params {
-		int32_t n_threads = MIN(4, (int32_t)OS::get_singleton()->get_processor_count());
-		int32_t max_tokens = 32;
+	friend class SpeechToTextStream;
+	friend class TranscriptionJob;
+	friend class SpeechToTextBenchmark;
+	friend class AudioEffectWhisperReferenceInstance;
+
+	Language language = English;
+	Ref<WhisperResource> model;
+	SpeechToTextParams params; // written by the setters on the main thread only
+	/* What the streams, workers and jobs read instead of params, replaced as a whole after every change. */
+	std::shared_ptr<const SpeechToTextParams> params_snapshot;
+	void _publish_params();
+	std::shared_ptr<const SpeechToTextParams> _get_params_snapshot() const { return std::atomic_load(&params_snapshot); }
+	whisper_context_params context_parameters = whisper_context_default_params();
+	whisper_context *context_instance = nullptr; // weights only, shared by all streams
+	/* Smaller model the partial results are decoded with, see set_draft_model. Swapped under context_mutex too. */
+	Ref<WhisperResource> draft_model;
+	whisper_context *draft_context_instance = nullptr;
+	/* See set_gpu_submit_budget_usec, applied to the contexts with the state parameters. */
+	int gpu_submit_budget_usec = 0;
+	bool gpu_frame_sync = false;
+	void _apply_gpu_submit_budget(whisper_context *p_context);
+	void _on_frame_post_draw();
+	/* See set_decoder_batch_size, applied to the contexts with the state parameters. */
+	int decoder_batch_size = 1;
+	int decoder_batch_wait_usec = 2000;
+	void _apply_decoder_batching(whisper_context *p_context);
+
+	/* Tokens the sampler never picks, compiled per context from suppressed_tokens and suppress_regex. */
+	PackedStringArray suppressed_tokens;
+	/* See set_allowed_languages, published as SpeechToTextParams::allowed_lang_ids. */
+	PackedStringArray allowed_languages;
+	String suppress_regex;
+	std::vector<whisper_token> suppress_ids; // guarded by context_mutex like the contexts they index
+	std::vector<whisper_token> draft_suppress_ids;
+	std::vector<whisper_token> _compile_suppress_ids(whisper_context *p_context) const;
+	void _update_suppress_ids();
+
+	/* Per vocabulary id, what the postprocessing of a pass looks for, so it does not compare token texts. */
+	enum TokenFlags {
+		TOKEN_SPLIT_PUNCTUATION = 1 << 0, // ends a clause, the buffer may be split right after it
+		TOKEN_SPECIAL = 1 << 1, // eot and after, no text of its own
+		TOKEN_TIMESTAMP = 1 << 2,
+		TOKEN_SPEAKER_TURN = 1 << 3, // the tinydiarize solm token
+		TOKEN_YOU = 1 << 4, // " you", of the ". you." whisper makes of silence
+		TOKEN_PERIOD = 1 << 5,
+	};
+	std::vector<uint8_t> token_flags; // compiled with the context they index, guarded by context_mutex
+	std::vector<uint8_t> draft_token_flags;
+	static std::vector<uint8_t> _compile_token_flags(whisper_context *p_context);
+
+	/* Prompt every pass starts from, tokenized for the language model. The draft model only shares it with the same vocabulary. */
+	String initial_prompt;
+	std::vector<whisper_token> initial_prompt_ids; // guarded by context_mutex
+	std::vector<whisper_token> _compile_prompt_ids(whisper_context *p_context, const String &p_prompt) const;
+	void _update_prompt_ids();
 
-		float vad_thold = 0.3f;
-		float freq_thold = 200.0f;
+	/* GBNF grammar the decoder is constrained to, compiled once per change. Guarded by context_mutex, passes point into it. */
+	String grammar;
+	String grammar_start_rule = "root";
+	float grammar_penalty = 100.0f;
+	grammar_parser::parse_state grammar_state;
+	std::vector<const whisper_grammar_element *> grammar_rules; // empty without a grammar
+	size_t grammar_start_rule_index = 0;
+	void _compile_grammar();
+	void _apply_grammar(whisper_full_params &r_params) const;
 
-		bool speed_up = false;
-		bool translate = false;
-		bool no_fallback = false;
+	/* With prune_vocabulary, the text tokens the language and the grammar leave possible, set on the contexts as their vocabulary subset. */
+	bool prune_vocabulary = false;
+	std::vector<whisper_token> _compile_vocab_subset(whisper_context *p_context) const;
+	static void _set_vocab_subset(whisper_context *p_context, const std::vector<whisper_token> &p_ids);
+	void _update_vocab_subset();
+	// Streams decode under a shared lock, swapping the context takes it exclusively.
+	std::shared_mutex context_mutex;
 
-		std::string language = "en";
-		std::string model = "./addons/godot_whisper/models/ggml-tiny.en.bin";
+	/* Every live stream, so their states can be released before the context they were created from. */
+	Vector<SpeechToTextStream *> streams;
+	Mutex streams_mutex;
+	void _register_stream(SpeechToTextStream *p_stream);
+	void _unregister_stream(SpeechToTextStream *p_stream);
+	void _free_stream_states();
+	void _forget_stream_tokens();
+	void _apply_state_parameters(whisper_context *p_context);
+	void _recreate_states();
+	static bool _align_tokens(whisper_context *p_context, whisper_state *p_state, std::vector<whisper_token_data> &r_tokens, int p_n_samples, int p_n_threads);
 
-		float entropy_threshold = 2.8f;
+	/* Offline jobs not done yet, main thread only. */
+	Vector<TranscriptionJob *> jobs;
+	/*
+	 * Full size states the jobs are done with, handed to the next job instead of allocating
+	 * its KV caches and compute buffers again. Dropped with the states of the streams, the
+	 * generation then moves on so that states taken before are freed on release.
+	 */
+	struct PooledJobState {
+		whisper_state *state = nullptr;
+		whisper_context *context = nullptr;
 	};
-	Language language = English;
-	Ref<WhisperResource> model;
-	whisper_params params;
-	whisper_full_params full_params;
-	whisper_context_params context_parameters{ true };
-	whisper_context *context_instance = nullptr;
-	int t_last_iter;
+	std::vector<PooledJobState> job_states;
+	Mutex job_states_mutex;
+	std::atomic<uint64_t> job_state_generation{ 0 };
+	int job_state_pool_size = 2;
+	whisper_state *_acquire_job_state(whisper_context *p_context, uint64_t &r_generation);
+	void _release_job_state(whisper_context *p_context, whisper_state *p_state, uint64_t p_generation);
+	void _free_job_states();
+	void _queue_job(const Ref<TranscriptionJob> &p_job);
+	void _unregister_job(TranscriptionJob *p_job);
+
+	/* As set on the node, params holds the globalized path. */
+	String openvino_encoder_path;
+	String openvino_device = "CPU";
+	String remote_inference_url;
+	void _update_openvino_encoder();
+	String nnapi_encoder_path;
+	String nnapi_accelerator;
+	void _update_nnapi_encoder();
+
+	/* Stream used by the add_audio_buffer/start_listen/stop_listen methods of the singleton. */
+	Ref<SpeechToTextStream> default_stream;
+	void _on_default_stream_transcribed_msgs(int p_process_time_ms, Array p_transcribed_msgs);
+	void _on_default_stream_transcribed_packed(int p_process_time_ms, const Ref<PackedTranscriptionResults> &p_results);
+
+	/* Decoding workers shared by all streams, 0 sizes the pool from the core count and n_threads. */
+	TranscriptionScheduler scheduler;
+	int max_concurrent_decodes = 0;
+	void _update_scheduler();
+	int _get_threads_per_decode(bool p_draft = false) const;
+
+	/* Bumped to abort every pass in flight, see SpeechToTextStream::_abort_pass. */
+	std::atomic<uint32_t> cancel_generation{ 0 };
+	bool restart_stale_passes = false;
+	/* Streams that fall behind decode at a lower SpeechToTextStream::QualityLevel until they catch up. */
+	bool adaptive_quality = false;
+
+	int _audio_ctx_for_samples(size_t p_samples) const;
+
+	/* Largest audio_ctx the states are sized for under memory_budget_mb, 0 without a budget. Set under context_mutex, read by the passes. */
+	int memory_budget_mb = 0;
+	std::atomic<int> budget_audio_ctx{ 0 };
+	void _apply_memory_budget();
+
+	/* Counters behind the Performance monitors, bumped by the workers. */
+	std::atomic<uint64_t> monitor_passes{ 0 };
+	std::atomic<uint64_t> monitor_pass_usec{ 0 }; // wall time of the passes
+	std::atomic<uint64_t> monitor_pass_samples{ 0 }; // new audio the passes decoded
+	std::atomic<uint64_t> backlog_warnings{ 0 };
+	std::atomic<uint64_t> repetition_aborts{ 0 }; // passes and job windows stopped by repetition_limit
+	std::atomic<uint64_t> model_memory{ 0 }; // bytes of the weights of both contexts, set when they are swapped
+	/* One record per pass, added by the workers. */
+	MetricsHistory metrics_history;
+	/* From capture to delivery, of the results of every stream. */
+	LatencyHistogram latency_histogram;
+	/* Results of the offline jobs, looked up and stored by the workers. */
+	TranscriptCache transcript_cache;
+	/* What the Master bus played, written by AudioEffectWhisperReference, read by the echo cancellers of the streams. */
+	EchoReference echo_reference;
+	/* Rates over the last second, main thread only. */
+	uint64_t monitor_window_usec = 0;
+	uint64_t monitor_window_passes = 0;
+	uint64_t monitor_window_pass_usec = 0;
+	uint64_t monitor_window_pass_samples = 0;
+	double monitor_passes_per_second = 0.0;
+	double monitor_real_time_factor = 0.0;
+	bool are_monitors_registered = false;
+	void _register_monitors();
+	void _unregister_monitors();
+	void _update_model_memory();
+	void _update_monitor_rates();
+	double _get_queued_audio_seconds();
+	double _get_buffered_audio_seconds();
+	double _get_passes_per_second();
+	double _get_real_time_factor();
+	double _get_dropped_audio_seconds();
+	uint64_t _get_backlog_warnings();
+	uint64_t _get_repetition_aborts();
+	int _get_waiting_streams();
+	int _get_thermal_state();
+	double _get_latency_p95_ms();
+	double _get_model_memory_mib();
+	double _get_state_memory_mib();
+
+	/* Background model loading, see load_model_async. */
+	std::atomic<bool> is_model_loading = false;
+	Thread *load_thread = nullptr;
+	Ref<WhisperResource> loading_model;
+	whisper_context_params loading_context_parameters;
+	/* What the current context was loaded from, to skip reloading identical models. */
+	String loaded_model_file;
+	whisper_context_params loaded_context_parameters = whisper_context_default_params();
+	bool is_reload_queued = false;
+	bool is_draft_reload_queued = false; // set while the draft model waits for the lazy load
+	void _queue_model_reload();
+	void _reload_model_if_dirty();
+	/* Sets context_parameters.backend_init, rendering_device_compute and webgpu_compute exclude each other. */
+	void _set_host_backend(ggml_backend *(*p_backend_init)(void *));
+
+	/* See set_load_model_in_editor. */
+	bool load_model_in_editor = false;
+
+	/* See set_auto_streaming_preset. Main thread only. */
+	bool auto_streaming_preset = true;
+	Dictionary applied_streaming_preset; // the values the preset last set, by property name
+	void _apply_streaming_preset(bool p_keep_overrides);
+	bool _is_lazy_load() const;
+
+	/* Idle hibernation, see set_hibernate_after_seconds. Main thread only. */
+	float hibernate_after_seconds = 0.0f;
+	bool hibernate_release_weights = false;
+	bool is_hibernated = false;
+	bool are_weights_hibernated = false; // released by the hibernation, loaded again on wake
+	uint64_t last_listen_msec = 0; // when a stream last started or stopped listening, or the last job finished
+	void _schedule_hibernation();
+	void _check_hibernation();
+	void _hibernate();
+	void _wake_from_hibernation(bool p_async);
+
+	/* CPU budget while frames are in flight, see set_frame_budget_threads. The policy is main thread only, the workers read the cap. */
+	FrameBudget frame_budget;
+	bool frame_budget_idle = false;
+	std::atomic<int> frame_thread_cap{ 0 };
+	uint64_t last_frame_usec = 0;
+	void _on_process_frame();
+
+	/* Warmup pass after every load, see set_warmup_model. */
+	bool warmup_model = false;
+	Thread *warmup_thread = nullptr;
+	uint32_t warmup_serial = 0; // main thread only, a warmup of an older load does not emit model_ready
+	void _warmup_context();
+	void _start_warmup();
+	void _warmup_thread(uint32_t p_serial);
+	void _finish_warmup(uint32_t p_serial);
+
+	/* Thread count calibration, cached per device and model, see calibrate_threads. */
+	bool auto_tune_threads = false;
+	String _get_calibration_key(const String &p_model_file, bool p_use_gpu) const;
+	Dictionary _calibrate_threads(const String &p_model_file, bool p_use_gpu);
+	void _auto_tune_threads(const String &p_model_file, bool p_use_gpu);
+	void _apply_n_threads(int p_n_threads);
+
+	void _swap_context(whisper_context *p_context);
+	void _swap_draft_context(whisper_context *p_context);
+	void _load_draft_model();
+	void _load_model_thread();
+	void _on_model_load_progress(float p_progress);
+	void _finish_model_load(bool p_success);
 
 protected:
 	static void _bind_methods();
@@ -174,43 +407,414 @@ public:
 	int get_language();
 	void set_language_model(Ref<WhisperResource> p_model);
 	_FORCE_INLINE_ Ref<WhisperResource> get_language_model() { return model; }
-	_FORCE_INLINE_ void set_use_gpu(bool use_gpu);
+	/** Set the properties of the get_streaming_preset of the language model, including those set by hand. */
+	void apply_streaming_preset();
+	/**
+	 * Apply the get_streaming_preset of every language model that loads, outside the editor. A property that
+	 * is neither at its default nor at what the preset last set it to was chosen by hand and is kept, so any
+	 * of them can be overridden on top of the preset.
+	 */
+	_FORCE_INLINE_ void set_auto_streaming_preset(bool p_auto_streaming_preset) { auto_streaming_preset = p_auto_streaming_preset; }
+	_FORCE_INLINE_ bool is_auto_streaming_preset() { return auto_streaming_preset; }
+	/** Decode partial results with this model, the language model only decodes the passes that commit text. */
+	void set_draft_model(Ref<WhisperResource> p_model);
+	_FORCE_INLINE_ Ref<WhisperResource> get_draft_model() { return draft_model; }
+	/** Exact token texts, e.g. " you", that are masked out of the logits of every decoder step. */
+	void set_suppressed_tokens(const PackedStringArray &p_suppressed_tokens);
+	_FORCE_INLINE_ PackedStringArray get_suppressed_tokens() { return suppressed_tokens; }
+	/** Tokens whose text matches this regular expression are masked out too, empty matches none. */
+	void set_suppress_regex(const String &p_suppress_regex);
+	_FORCE_INLINE_ String get_suppress_regex() { return suppress_regex; }
+	/** Text the decoder is conditioned on before the committed text, e.g. names and terms of the domain. */
+	void set_initial_prompt(const String &p_initial_prompt);
+	_FORCE_INLINE_ String get_initial_prompt() { return initial_prompt; }
+	/** GBNF grammar every pass is constrained to, e.g. the text of one of the .gbnf files of whisper.cpp. Empty decodes freely. */
+	void set_grammar(const String &p_grammar);
+	_FORCE_INLINE_ String get_grammar() { return grammar; }
+	/** Rule of grammar the text starts with. */
+	void set_grammar_start_rule(const String &p_grammar_start_rule);
+	_FORCE_INLINE_ String get_grammar_start_rule() { return grammar_start_rule; }
+	/** Subtracted from the logits of the tokens the grammar does not allow, the higher the stricter. */
+	void set_grammar_penalty(float p_grammar_penalty);
+	_FORCE_INLINE_ float get_grammar_penalty() { return grammar_penalty; }
+	/** The decoders only compute the logits of the tokens the language and the grammar can produce, e.g. no Cyrillic or CJK for English. Costs a copy of their embedding rows. */
+	void set_prune_vocabulary(bool p_prune_vocabulary);
+	_FORCE_INLINE_ bool is_prune_vocabulary() { return prune_vocabulary; }
+
+	/** OpenVINO IR (.xml) of the encoder, every stream then runs its encoder on openvino_device. Needs a build with openvino=yes. */
+	void set_openvino_encoder_path(const String &p_path);
+	_FORCE_INLINE_ String get_openvino_encoder_path() { return openvino_encoder_path; }
+	/** OpenVINO device name, e.g. "CPU", "GPU" or "NPU". */
+	void set_openvino_device(const String &p_device);
+	_FORCE_INLINE_ String get_openvino_device() { return openvino_device; }
+	/** TensorFlow Lite model (.tflite) of the encoder, every stream then runs its encoder through NNAPI. Needs an Android build with nnapi=yes. */
+	void set_nnapi_encoder_path(const String &p_path);
+	_FORCE_INLINE_ String get_nnapi_encoder_path() { return nnapi_encoder_path; }
+	/** NNAPI device name, e.g. "qti-dsp" or "google-edgetpu". Empty lets NNAPI spread the encoder over the devices it has. */
+	void set_nnapi_accelerator(const String &p_accelerator);
+	_FORCE_INLINE_ String get_nnapi_accelerator() { return nnapi_accelerator; }
+
+	_FORCE_INLINE_ void set_draft_n_threads(int p_draft_n_threads) { params.draft_n_threads = MAX(0, p_draft_n_threads); _publish_params(); }
+	_FORCE_INLINE_ int get_draft_n_threads() { return params.draft_n_threads; }
+	/** Early exit of the encoder for partial results: only its first layers and the final layer norm run. Passes that commit text run all of them. */
+	_FORCE_INLINE_ void set_partial_encoder_layers(int p_partial_encoder_layers) { params.partial_encoder_layers = MAX(0, p_partial_encoder_layers); _publish_params(); }
+	_FORCE_INLINE_ int get_partial_encoder_layers() { return params.partial_encoder_layers; }
+	void set_use_gpu(bool use_gpu);
 	_FORCE_INLINE_ bool is_use_gpu() { return context_parameters.use_gpu; }
+	/** With use_gpu, the CUDA device of the model and of the states of the streams. Reloads the model. */
+	void set_gpu_device(int p_gpu_device);
+	_FORCE_INLINE_ int get_gpu_device() { return context_parameters.gpu_device; }
+	/** Interleave the q4_0 and q8_0 weights 4 rows at a time as they are loaded on the CPU. Reloads the model. */
+	void set_repack_weights(bool p_repack_weights);
+	_FORCE_INLINE_ bool is_repack_weights() { return context_parameters.repack_weights; }
+	void set_lock_model_memory(bool p_lock_model_memory);
+	_FORCE_INLINE_ bool is_lock_model_memory() { return context_parameters.lock_model_memory; }
+	void set_use_huge_pages(bool p_use_huge_pages);
+	_FORCE_INLINE_ bool is_use_huge_pages() { return context_parameters.use_huge_pages; }
+	/** Map the model file and use its aligned weights in place on the CPU and Metal backends, when the file is on the filesystem. Reloads the model. */
+	void set_map_model_file(bool p_map_model_file);
+	_FORCE_INLINE_ bool is_map_model_file() { return context_parameters.mmap_path != nullptr; }
+	/** With use_gpu, run the model on a RenderingDevice of the game's own GPU. Falls back to the other GPU backends without one. Reloads the model. */
+	void set_rendering_device_compute(bool p_rendering_device_compute);
+	bool is_rendering_device_compute();
+	/** With use_gpu, run the model on the browser's WebGPU in the web export, which has no RenderingDevice. Falls back to the CPU without WebGPU or threads. Reloads the model. */
+	void set_webgpu_compute(bool p_webgpu_compute);
+	bool is_webgpu_compute();
+	/** Split the GPU graphs into submissions of about p_usec each, so the render queue gets the GPU in between. 0 submits each graph at once. */
+	void set_gpu_submit_budget_usec(int p_usec);
+	_FORCE_INLINE_ int get_gpu_submit_budget_usec() { return gpu_submit_budget_usec; }
+	/** Between two of those submissions, wait until the next frame was drawn. */
+	void set_gpu_frame_sync(bool p_gpu_frame_sync);
+	_FORCE_INLINE_ bool is_gpu_frame_sync() { return gpu_frame_sync; }
+	/** KV cache of the stream states: 0 f16, 1 f32, 2 q8_0 keys with f16 values (CPU only, f16 on the GPU). */
+	void set_kv_cache_type(int p_kv_cache_type);
+	int get_kv_cache_type() const;
+	/** Encoder self-attention one query row at a time, without the full attention matrix of each head. CPU only, ignored on the GPU. */
+	void set_flash_attention(bool p_flash_attention);
+	_FORCE_INLINE_ bool is_flash_attention() { return context_parameters.flash_attn; }
+	/** Encoder matrix multiplications with quantized weights read activations quantized once by all the threads. CPU only, not with BLAS. */
+	void set_quantize_activations(bool p_quantize_activations);
+	_FORCE_INLINE_ bool is_quantize_activations() { return context_parameters.quantize_activations; }
+	/** Encoder layers keep their activations in F16 and sum in F32. CPU only with F16C or Armv8.2 FP16, not with BLAS. */
+	void set_f16_activations(bool p_f16_activations);
+	_FORCE_INLINE_ bool is_f16_activations() { return context_parameters.f16_activations; }
+	/** Metal states compute the mel spectrogram of a one-window whisper_full() in the encoder's conv graph. Ignored on the other backends. */
+	void set_gpu_mel(bool p_gpu_mel);
+	_FORCE_INLINE_ bool is_gpu_mel() { return context_parameters.gpu_mel; }
+	/** whisper_device of the encoder and of the decoder of the states: 0 where use_gpu puts them, 1 on the CPU. */
+	void set_encoder_device(int p_device);
+	_FORCE_INLINE_ int get_encoder_device() { return context_parameters.encoder_device; }
+	void set_decoder_device(int p_device);
+	_FORCE_INLINE_ int get_decoder_device() { return context_parameters.decoder_device; }
+	/** Word times of committed text from the cross-attention of the alignment heads, one more decoder run per committing pass. */
+	void set_dtw_word_timestamps(bool p_dtw_word_timestamps);
+	_FORCE_INLINE_ bool is_dtw_word_timestamps() { return context_parameters.dtw_token_timestamps; }
+	/** whisper_alignment_heads_preset, Auto picks the one of the model. */
+	void set_alignment_heads_preset(int p_preset);
+	_FORCE_INLINE_ int get_alignment_heads_preset() { return context_parameters.dtw_aheads_preset; }
+	/** Size the states for the largest audio_ctx whose weights, caches, compute and audio buffers stay under p_megabytes, 0 for no budget. */
+	void set_memory_budget_mb(int p_megabytes);
+	_FORCE_INLINE_ int get_memory_budget_mb() { return memory_budget_mb; }
+	/** Bytes held now: weights, kv_cache, compute_buffers, audio_buffers and their total. */
+	Dictionary get_memory_usage();
 	SpeechToText();
 	~SpeechToText();
 
-	std::atomic<bool> is_running;
-	std::vector<float> s_queued_pcmf32;
-	std::vector<transcribed_msg> s_transcribed_msgs;
-	Mutex s_mutex; // for accessing shared variables from both main thread and worker thread
-	Thread *worker;
-	void run();
-
-	_FORCE_INLINE_ void set_entropy_threshold(float entropy_threshold) { params.entropy_threshold = entropy_threshold; }
+	_FORCE_INLINE_ void set_entropy_threshold(float entropy_threshold) { params.entropy_threshold = entropy_threshold; _publish_params(); }
 	_FORCE_INLINE_ float get_entropy_threshold() { return params.entropy_threshold; }
 
-	_FORCE_INLINE_ void set_translate(bool translate) { params.translate = translate; }
+	/** Every fallback is a whole extra decode, no_fallback or max_fallbacks = 0 bounds a pass to one. */
+	_FORCE_INLINE_ void set_no_fallback(bool p_no_fallback) { params.no_fallback = p_no_fallback; _publish_params(); }
+	_FORCE_INLINE_ bool is_no_fallback() { return params.no_fallback; }
+	_FORCE_INLINE_ void set_temperature_inc(float p_temperature_inc) { params.temperature_inc = MAX(0.0f, p_temperature_inc); _publish_params(); }
+	_FORCE_INLINE_ float get_temperature_inc() { return params.temperature_inc; }
+	_FORCE_INLINE_ void set_max_fallbacks(int p_max_fallbacks) { params.max_fallbacks = MAX(0, p_max_fallbacks); _publish_params(); }
+	_FORCE_INLINE_ int get_max_fallbacks() { return params.max_fallbacks; }
+	/** Beam search keeps beam_size hypotheses per token, each of them costs about a greedy decode. */
+	_FORCE_INLINE_ void set_sampling_strategy(int p_strategy) { params.sampling_strategy = CLAMP(p_strategy, int(WHISPER_SAMPLING_GREEDY), int(WHISPER_SAMPLING_BEAM_SEARCH)); _publish_params(); }
+	_FORCE_INLINE_ int get_sampling_strategy() { return params.sampling_strategy; }
+	// whisper.cpp runs at most WHISPER_MAX_DECODERS = 8 decoders.
+	_FORCE_INLINE_ void set_beam_size(int p_beam_size) { params.beam_size = CLAMP(p_beam_size, 1, 8); _publish_params(); }
+	_FORCE_INLINE_ int get_beam_size() { return params.beam_size; }
+	_FORCE_INLINE_ void set_best_of(int p_best_of) { params.best_of = CLAMP(p_best_of, 1, 8); _publish_params(); }
+	_FORCE_INLINE_ int get_best_of() { return params.best_of; }
+	_FORCE_INLINE_ void set_decode_budget_ms(int p_budget_ms) { params.decode_budget_ms = MAX(0, p_budget_ms); _publish_params(); }
+	_FORCE_INLINE_ int get_decode_budget_ms() { return params.decode_budget_ms; }
+	_FORCE_INLINE_ void set_repetition_limit(int p_limit) { params.repetition_limit = p_limit > 1 ? p_limit : 0; _publish_params(); }
+	_FORCE_INLINE_ int get_repetition_limit() { return params.repetition_limit; }
+
+	/** Passes of a stream that pinned its language skip the detection, which runs the encoder once more. */
+	_FORCE_INLINE_ void set_language_pin_seconds(float p_seconds) { params.language_pin_seconds = MAX(0.0f, p_seconds); _publish_params(); }
+	_FORCE_INLINE_ float get_language_pin_seconds() { return params.language_pin_seconds; }
+	_FORCE_INLINE_ void set_language_pin_probability(float p_probability) { params.language_pin_probability = CLAMP(p_probability, 0.0f, 1.0f); _publish_params(); }
+	_FORCE_INLINE_ float get_language_pin_probability() { return params.language_pin_probability; }
+	/** With language auto, detect only among these language codes, e.g. "en" and "de". Empty detects among all of them, a single one is decoded with without detecting. */
+	void set_allowed_languages(const PackedStringArray &p_languages);
+	_FORCE_INLINE_ PackedStringArray get_allowed_languages() { return allowed_languages; }
+
+	_FORCE_INLINE_ void set_translate(bool translate) { params.translate = translate; _publish_params(); }
 	_FORCE_INLINE_ bool is_translate() { return params.translate; }
 
-	_FORCE_INLINE_ void set_speed_up(bool speed_up) { params.speed_up = speed_up; }
+	/** /inference endpoint of a whisper.cpp server, e.g. http://127.0.0.1:8080/inference. The streams send it their utterances and decode locally when it fails. */
+	void set_remote_inference_url(const String &p_url);
+	_FORCE_INLINE_ String get_remote_inference_url() { return remote_inference_url; }
+	/** A request not answered in this time is dropped and the utterance is decoded locally. */
+	_FORCE_INLINE_ void set_remote_latency_budget_ms(int p_budget_ms) { params.remote_latency_budget_ms = CLAMP(p_budget_ms, 100, 30000); _publish_params(); }
+	_FORCE_INLINE_ int get_remote_latency_budget_ms() { return params.remote_latency_budget_ms; }
+	/** How long a stream decodes locally after the server failed, before it tries it again. */
+	_FORCE_INLINE_ void set_remote_retry_seconds(float p_seconds) { params.remote_retry_seconds = MAX(0.0f, p_seconds); _publish_params(); }
+	_FORCE_INLINE_ float get_remote_retry_seconds() { return params.remote_retry_seconds; }
+	/** Fills TranscriptionResult.translated_text. Costs a second decode of committing passes, not a second encode. */
+	_FORCE_INLINE_ void set_dual_translation(bool p_dual_translation) { params.dual_translation = p_dual_translation; _publish_params(); }
+	_FORCE_INLINE_ bool is_dual_translation() { return params.dual_translation; }
+
+	/** Off skips the token level timing of every segment when nothing needs word timings. */
+	_FORCE_INLINE_ void set_token_timestamps(bool p_token_timestamps) { params.token_timestamps = p_token_timestamps; _publish_params(); }
+	_FORCE_INLINE_ bool is_token_timestamps() { return params.token_timestamps; }
+
+	/** Speaker turn markers of tinydiarize models. The marker is one more token, it costs no extra decoding. */
+	_FORCE_INLINE_ void set_speaker_turns(bool p_speaker_turns) { params.speaker_turns = p_speaker_turns; _publish_params(); }
+	_FORCE_INLINE_ bool is_speaker_turns() { return params.speaker_turns; }
+
+	_FORCE_INLINE_ void set_incremental_decoding(bool incremental_decoding) { params.incremental_decoding = incremental_decoding; _publish_params(); }
+	_FORCE_INLINE_ bool is_incremental_decoding() { return params.incremental_decoding; }
+
+	/** Commit the words that the last p_passes partial passes agree on at once and trim their audio, 0 turns it off. Needs token_timestamps. */
+	_FORCE_INLINE_ void set_local_agreement(int p_passes) { params.local_agreement = p_passes < 2 ? 0 : MIN(p_passes, 8); _publish_params(); }
+	_FORCE_INLINE_ int get_local_agreement() { return params.local_agreement; }
+
+	/** Time compress the mel 2x so the encoder runs over half the positions. Streams pick it up on start_listen(). */
+	_FORCE_INLINE_ void set_speed_up(bool speed_up) { params.speed_up = speed_up; _publish_params(); }
 	_FORCE_INLINE_ bool is_speed_up() { return params.speed_up; }
 
-	_FORCE_INLINE_ void set_freq_thold(float freq_thold) { params.freq_thold = freq_thold; }
+	_FORCE_INLINE_ void set_freq_thold(float freq_thold) { params.freq_thold = freq_thold; _publish_params(); }
 	_FORCE_INLINE_ float get_freq_thold() { return params.freq_thold; }
 
-	_FORCE_INLINE_ void set_vad_thold(float vad_thold) { params.vad_thold = vad_thold; }
+	_FORCE_INLINE_ void set_vad_thold(float vad_thold) { params.vad_thold = vad_thold; _publish_params(); }
 	_FORCE_INLINE_ float get_vad_thold() { return params.vad_thold; }
 
-	_FORCE_INLINE_ void set_max_tokens(int max_tokens) { params.max_tokens = max_tokens; }
+	void set_vad_mode(int p_vad_mode);
+	_FORCE_INLINE_ int get_vad_mode() { return params.vad_mode; }
+
+	_FORCE_INLINE_ void set_speech_threshold(float p_speech_threshold) { params.speech_threshold = p_speech_threshold; _publish_params(); }
+	_FORCE_INLINE_ float get_speech_threshold() { return params.speech_threshold; }
+
+	_FORCE_INLINE_ void set_speech_pre_roll_ms(int p_speech_pre_roll_ms) { params.speech_pre_roll_ms = MAX(0, p_speech_pre_roll_ms); _publish_params(); }
+	_FORCE_INLINE_ int get_speech_pre_roll_ms() { return params.speech_pre_roll_ms; }
+
+	_FORCE_INLINE_ void set_speech_hang_over_ms(int p_speech_hang_over_ms) { params.speech_hang_over_ms = MAX(0, p_speech_hang_over_ms); _publish_params(); }
+	_FORCE_INLINE_ int get_speech_hang_over_ms() { return params.speech_hang_over_ms; }
+
+	/** Silence that ends an utterance, at least. A segment is closed this long after the last word instead of after a second without a pass. */
+	_FORCE_INLINE_ void set_endpoint_silence_ms(int p_silence_ms) { params.endpoint_silence_ms = MAX(0, p_silence_ms); _publish_params(); }
+	_FORCE_INLINE_ int get_endpoint_silence_ms() { return params.endpoint_silence_ms; }
+	/** Wait longer for slow speakers, from the pauses inside their sentences. */
+	_FORCE_INLINE_ void set_adaptive_endpointing(bool p_adaptive) { params.adaptive_endpointing = p_adaptive; _publish_params(); }
+	_FORCE_INLINE_ bool is_adaptive_endpointing() { return params.adaptive_endpointing; }
+	_FORCE_INLINE_ void set_pass_trigger_ms(int p_trigger_ms) { params.pass_trigger_ms = CLAMP(p_trigger_ms, 100, 10000); _publish_params(); }
+	_FORCE_INLINE_ int get_pass_trigger_ms() { return params.pass_trigger_ms; }
+	/** Within the 30 s whisper decodes at once. */
+	_FORCE_INLINE_ void set_max_utterance_ms(int p_max_utterance_ms) { params.max_utterance_ms = CLAMP(p_max_utterance_ms, 1000, 30000); _publish_params(); }
+	_FORCE_INLINE_ int get_max_utterance_ms() { return params.max_utterance_ms; }
+
+	/** Take steady background noise out of the input before the VAD and whisper see it. Delays the audio by 16 ms. */
+	_FORCE_INLINE_ void set_noise_suppression(bool p_noise_suppression) { params.noise_suppression = p_noise_suppression; _publish_params(); }
+	_FORCE_INLINE_ bool is_noise_suppression() { return params.noise_suppression; }
+	/** Bring quiet and loud speakers to the same level before the VAD and whisper. Delays the audio by 16 ms too. */
+	_FORCE_INLINE_ void set_auto_gain(bool p_auto_gain) { params.auto_gain = p_auto_gain; _publish_params(); }
+	_FORCE_INLINE_ bool is_auto_gain() { return params.auto_gain; }
+	/** Cancel the echo of the game's own output in the input, with an AudioEffectWhisperReference on the Master bus. Delays the audio by 8 ms. */
+	_FORCE_INLINE_ void set_echo_cancellation(bool p_echo_cancellation) { params.echo_cancellation = p_echo_cancellation; _publish_params(); }
+	_FORCE_INLINE_ bool is_echo_cancellation() { return params.echo_cancellation; }
+
+	/** End of speech from the mel spectrogram whisper computes anyway, instead of a second pass over the samples. */
+	_FORCE_INLINE_ void set_mel_vad(bool p_mel_vad) { params.mel_vad = p_mel_vad; _publish_params(); }
+	_FORCE_INLINE_ bool is_mel_vad() { return params.mel_vad; }
+
+	_FORCE_INLINE_ void set_max_tokens(int max_tokens) { params.max_tokens = max_tokens; _publish_params(); }
 	_FORCE_INLINE_ int get_max_tokens() { return params.max_tokens; }
+	/** At most this many of the last committed tokens condition the next pass, 0 starts every segment without context. */
+	_FORCE_INLINE_ void set_prompt_context_tokens(int p_tokens) { params.prompt_context_tokens = CLAMP(p_tokens, 0, 224); _publish_params(); }
+	_FORCE_INLINE_ int get_prompt_context_tokens() { return params.prompt_context_tokens; }
 
-	_FORCE_INLINE_ void set_n_threads(int n_threads) { params.n_threads = n_threads; }
+	void set_n_threads(int n_threads);
 	_FORCE_INLINE_ int get_n_threads() { return params.n_threads; }
 
-	void add_audio_buffer(PackedVector2Array buffer);
-	void start_listen();
-	void stop_listen();
+	/** ThreadAffinity::CoreClass the decoding workers and their ggml threads run on. Keep n_threads at most get_performance_core_count() with Performance. */
+	_FORCE_INLINE_ void set_inference_cores(int p_core_class) { ThreadAffinity::set_core_class(CLAMP(p_core_class, (int)ThreadAffinity::CORES_ANY, (int)ThreadAffinity::CORES_PERFORMANCE)); }
+	_FORCE_INLINE_ int get_inference_cores() { return ThreadAffinity::get_core_class(); }
+	_FORCE_INLINE_ int get_performance_core_count() { return ThreadAffinity::get_performance_core_count(); }
+	/** Run the passes, and the ggml threads of their graphs and of the mel, as WorkerThreadPool tasks instead of on threads of their own. inference_cores has no effect then. */
+	void set_use_worker_thread_pool(bool p_use_worker_thread_pool);
+	_FORCE_INLINE_ bool is_using_worker_thread_pool() { return scheduler.is_using_thread_pool(); }
+
+	/**
+	 * Decode a silent clip on a background thread after every load, so kernel compilation, pipeline creation
+	 * and the first touch of the weights do not slow down the first pass. model_ready is emitted after it.
+	 */
+	_FORCE_INLINE_ void set_warmup_model(bool p_warmup_model) { warmup_model = p_warmup_model; }
+	_FORCE_INLINE_ bool is_warmup_model() { return warmup_model; }
+	/**
+	 * Free the states of every stream, their KV caches, compute buffers and mel, once no stream listened and no
+	 * job was queued for p_seconds. They are created again by the first pass after start_listen. 0 never hibernates.
+	 */
+	void set_hibernate_after_seconds(float p_seconds);
+	_FORCE_INLINE_ float get_hibernate_after_seconds() { return hibernate_after_seconds; }
+	/** Hibernation releases the weights too. start_listen loads them again in the background, a job before it starts. */
+	_FORCE_INLINE_ void set_hibernate_release_weights(bool p_release) { hibernate_release_weights = p_release; }
+	_FORCE_INLINE_ bool is_hibernate_release_weights() { return hibernate_release_weights; }
+	/**
+	 * Threads the streams decode with while the game draws frames, 0 for no cap. Frames that miss the target
+	 * frame time take threads away, down to one, and frames on time give them back. Paused, or with
+	 * frame_budget_idle, the passes take all of n_threads.
+	 */
+	void set_frame_budget_threads(int p_threads);
+	_FORCE_INLINE_ int get_frame_budget_threads() { return frame_budget.get_max_threads(); }
+	/** No frame budget while set, e.g. on a loading screen. */
+	void set_frame_budget_idle(bool p_idle);
+	_FORCE_INLINE_ bool is_frame_budget_idle() { return frame_budget_idle; }
+	/** From the hibernation until the next start_listen or transcription. */
+	_FORCE_INLINE_ bool is_hibernating() { return is_hibernated; }
+	/** In the editor, models are only loaded by start_listen, a transcription or load_model unless this is set. */
+	void set_load_model_in_editor(bool p_load_model_in_editor);
+	_FORCE_INLINE_ bool is_load_model_in_editor() { return load_model_in_editor; }
+
+	/** Look up or calibrate n_threads for the device and the model every time a model was loaded. */
+	_FORCE_INLINE_ void set_auto_tune_threads(bool p_auto_tune_threads) { auto_tune_threads = p_auto_tune_threads; }
+	_FORCE_INLINE_ bool is_auto_tune_threads() { return auto_tune_threads; }
+	/**
+	 * Time a short encode of the loaded model for 1 to get_processor_count() threads, set n_threads to the
+	 * fastest and cache it for the device and the model. Takes a few seconds, returns n_threads and the
+	 * timings_ms of each thread count tried.
+	 */
+	Dictionary calibrate_threads();
+
+	void set_max_concurrent_decodes(int p_max_concurrent_decodes);
+	_FORCE_INLINE_ int get_max_concurrent_decodes() { return max_concurrent_decodes; }
+	/** Workers the streams of SpeechToTextStream.PRIORITY_CAPTION and PRIORITY_BACKGROUND may take at once, 0 for all of them. */
+	_FORCE_INLINE_ void set_caption_worker_budget(int p_workers) { scheduler.set_class_budget(SpeechToTextStream::PRIORITY_CAPTION, p_workers); }
+	_FORCE_INLINE_ int get_caption_worker_budget() { return scheduler.get_class_budget(SpeechToTextStream::PRIORITY_CAPTION); }
+	_FORCE_INLINE_ void set_background_worker_budget(int p_workers) { scheduler.set_class_budget(SpeechToTextStream::PRIORITY_BACKGROUND, p_workers); }
+	_FORCE_INLINE_ int get_background_worker_budget() { return scheduler.get_class_budget(SpeechToTextStream::PRIORITY_BACKGROUND); }
+	/** States the finished jobs keep for the next ones, 0 creates one per job and window again. */
+	void set_job_state_pool_size(int p_size);
+	_FORCE_INLINE_ int get_job_state_pool_size() { return job_state_pool_size; }
+
+	/** Abort every pass in flight, the audio is decoded again by the next pass of each stream. */
+	void cancel_passes();
+	/** Restart a pass once when newer audio was queued while it was still running. */
+	_FORCE_INLINE_ void set_restart_stale_passes(bool p_restart_stale_passes) { restart_stale_passes = p_restart_stale_passes; }
+	_FORCE_INLINE_ bool is_restart_stale_passes() { return restart_stale_passes; }
+	/** Let streams that fall behind trade accuracy for latency, one QualityLevel at a time, and step back up once they keep up again. */
+	_FORCE_INLINE_ void set_adaptive_quality(bool p_adaptive_quality) { adaptive_quality = p_adaptive_quality; }
+	_FORCE_INLINE_ bool is_adaptive_quality() { return adaptive_quality; }
+
+	/** Passes get_metrics() keeps, the oldest is dropped for the next one. 0 keeps none. */
+	_FORCE_INLINE_ void set_metrics_history_size(int p_size) { metrics_history.set_capacity(p_size); }
+	_FORCE_INLINE_ int get_metrics_history_size() { return metrics_history.get_capacity(); }
+	/** One Dictionary per pass of the last metrics_history_size passes, oldest first. */
+	_FORCE_INLINE_ Array get_metrics() { return metrics_history.to_array(); }
+	_FORCE_INLINE_ void clear_metrics() { metrics_history.clear(); }
+	/** Latency of the results of all streams from the capture of their latest sample to their delivery, see SpeechToTextStream.get_latency_histogram(). */
+	_FORCE_INLINE_ Dictionary get_latency_histogram() { return latency_histogram.to_dictionary(); }
+	_FORCE_INLINE_ void reset_latency_histogram() { latency_histogram.reset(); }
+	/** Write get_metrics() to p_path, as CSV when it ends in .csv and as a JSON array otherwise. */
+	_FORCE_INLINE_ Error export_metrics(const String &p_path) { return metrics_history.export_file(p_path); }
+	/** Append the record of every pass to p_path as a line of JSON until stop_metrics_log(). */
+	_FORCE_INLINE_ Error start_metrics_log(const String &p_path) { return metrics_history.start_log(p_path); }
+	_FORCE_INLINE_ void stop_metrics_log() { metrics_history.stop_log(); }
+	_FORCE_INLINE_ bool is_metrics_logging() { return metrics_history.is_logging(); }
+	/** Per call site of the mutexes the streams share with the workers: acquisitions, contended ones, and the total and longest wait and hold in ms. */
+	Array get_lock_metrics();
+	void reset_lock_metrics();
+
+	/** 0 nominal, 1 fair, 2 serious or 3 critical, from the thermal status of Android and the thermalState of iOS and macOS. Always 0 elsewhere. */
+	_FORCE_INLINE_ int get_thermal_state() { return ThermalMonitor::get_state(); }
+	/** Android 12's forecast of the thermal headroom, 1 is where severe throttling starts. Negative where the platform does not tell. */
+	_FORCE_INLINE_ float get_thermal_headroom() { return ThermalMonitor::get_headroom(); }
+
+	/** Ready streams encoded together in one pass, 1 encodes every stream on its own. */
+	_FORCE_INLINE_ void set_encoder_batch_size(int p_encoder_batch_size) { scheduler.set_max_batch(p_encoder_batch_size); }
+	_FORCE_INLINE_ int get_encoder_batch_size() { return scheduler.get_max_batch(); }
+	/** Streams decoding at the same time whose decoder steps run as one graph on the CPU, 1 decodes every stream on its own. The streams of an encoder batch then decode in parallel. */
+	void set_decoder_batch_size(int p_decoder_batch_size);
+	_FORCE_INLINE_ int get_decoder_batch_size() { return decoder_batch_size; }
+	/** How long the first step waits for those of the other streams. */
+	void set_decoder_batch_wait_usec(int p_usec);
+	_FORCE_INLINE_ int get_decoder_batch_wait_usec() { return decoder_batch_wait_usec; }
+
+	_FORCE_INLINE_ void set_draft_previous_tokens(bool p_draft_previous_tokens) { params.draft_previous_tokens = p_draft_previous_tokens; _publish_params(); }
+	_FORCE_INLINE_ bool is_draft_previous_tokens() { return params.draft_previous_tokens; }
+
+	_FORCE_INLINE_ void set_dynamic_audio_ctx(bool dynamic_audio_ctx) { params.dynamic_audio_ctx = dynamic_audio_ctx; _publish_params(); }
+	_FORCE_INLINE_ bool is_dynamic_audio_ctx() { return params.dynamic_audio_ctx; }
+
+	_FORCE_INLINE_ void set_audio_ctx_granularity(int audio_ctx_granularity) { params.audio_ctx_granularity = audio_ctx_granularity; _publish_params(); }
+	_FORCE_INLINE_ int get_audio_ctx_granularity() { return params.audio_ctx_granularity; }
+
+	_FORCE_INLINE_ void set_audio_ctx_min(int audio_ctx_min) { params.audio_ctx_min = audio_ctx_min; _publish_params(); }
+	_FORCE_INLINE_ int get_audio_ctx_min() { return params.audio_ctx_min; }
+
+	_FORCE_INLINE_ void set_audio_ctx_max(int audio_ctx_max) { params.audio_ctx_max = audio_ctx_max; _publish_params(); }
+	_FORCE_INLINE_ int get_audio_ctx_max() { return params.audio_ctx_max; }
+
+	_FORCE_INLINE_ void set_encoder_chunk_ms(int p_encoder_chunk_ms) { params.encoder_chunk_ms = MAX(0, p_encoder_chunk_ms); _publish_params(); }
+	_FORCE_INLINE_ int get_encoder_chunk_ms() { return params.encoder_chunk_ms; }
+
+	_FORCE_INLINE_ void set_encoder_overlap_ms(int p_encoder_overlap_ms) { params.encoder_overlap_ms = MAX(0, p_encoder_overlap_ms); _publish_params(); }
+	_FORCE_INLINE_ int get_encoder_overlap_ms() { return params.encoder_overlap_ms; }
+
+	_FORCE_INLINE_ void set_pipelined_encoding(bool p_pipelined_encoding) { params.pipelined_encoding = p_pipelined_encoding; _publish_params(); }
+	_FORCE_INLINE_ bool is_pipelined_encoding() { return params.pipelined_encoding; }
+
+	_FORCE_INLINE_ void set_resampler_quality(int p_quality) { default_stream->set_resampler_quality(p_quality); }
+	_FORCE_INLINE_ int get_resampler_quality() { return default_stream->get_resampler_quality(); }
+
+	_FORCE_INLINE_ void set_audio_queue_seconds(float p_seconds) { default_stream->set_audio_queue_seconds(p_seconds); }
+	_FORCE_INLINE_ float get_audio_queue_seconds() { return default_stream->get_audio_queue_seconds(); }
+
+	_FORCE_INLINE_ void set_audio_queue_overflow_policy(int p_policy) { default_stream->set_audio_queue_overflow_policy(p_policy); }
+	_FORCE_INLINE_ int get_audio_queue_overflow_policy() { return default_stream->get_audio_queue_overflow_policy(); }
+
+	_FORCE_INLINE_ void set_max_backlog_seconds(float p_seconds) { default_stream->set_max_backlog_seconds(p_seconds); }
+	_FORCE_INLINE_ float get_max_backlog_seconds() { return default_stream->get_max_backlog_seconds(); }
+
+	/** SpeechToTextStream::ResultDelivery of the default stream, e.g. RESULTS_PACKED_SIGNAL for update_transcribed_packed. */
+	_FORCE_INLINE_ void set_results_delivery(int p_delivery) { default_stream->set_results_delivery(p_delivery); }
+	_FORCE_INLINE_ int get_results_delivery() { return default_stream->get_results_delivery(); }
+	_FORCE_INLINE_ Array poll_results(int p_max) { return default_stream->poll_results(p_max); }
+	_FORCE_INLINE_ int poll_packed_results(const Ref<PackedTranscriptionResults> &p_results, int p_max) { return default_stream->poll_packed_results(p_results, p_max); }
+
+	_FORCE_INLINE_ int64_t get_dropped_audio_frames() { return default_stream->get_dropped_audio_frames(); }
+	_FORCE_INLINE_ PackedFloat32Array get_speech_probabilities() { return default_stream->get_speech_probabilities(); }
+
+	_FORCE_INLINE_ void add_audio_buffer(PackedVector2Array buffer) { default_stream->add_audio_buffer(buffer); }
+	_FORCE_INLINE_ void add_audio_mono_f32(const PackedFloat32Array &p_samples, int p_rate) { default_stream->add_audio_mono_f32(p_samples, p_rate); }
+	_FORCE_INLINE_ void add_audio_pcm16(const PackedByteArray &p_pcm, int p_rate, int p_channels) { default_stream->add_audio_pcm16(p_pcm, p_rate, p_channels); }
+	_FORCE_INLINE_ Error add_audio_opus(const PackedByteArray &p_packet) { return default_stream->add_audio_opus(p_packet); }
+	_FORCE_INLINE_ void start_listen() { default_stream->start_listen(); }
+	_FORCE_INLINE_ void stop_listen() { default_stream->stop_listen(); }
+	Ref<SpeechToTextStream> create_stream();
+	_FORCE_INLINE_ Ref<SpeechToTextStream> get_default_stream() { return default_stream; }
+	/** One chunk for each of p_streams, their VAD filters run side by side across the vector lanes. */
+	void add_audio_batch(const Array &p_streams, const Array &p_buffers, int p_rate = SPEECH_SETTING_SAMPLE_RATE);
+	/** Queue a whole clip on the decoding workers, the job emits completed with one result per segment. */
+	Ref<TranscriptionJob> transcribe_async(const Variant &p_audio, const Dictionary &p_options = Dictionary());
+	/** Same for a WAV file, which is read and decoded a window at a time instead of loaded whole. */
+	Ref<TranscriptionJob> transcribe_file_async(const String &p_path, const Dictionary &p_options = Dictionary());
+	/** Transcripts of the jobs kept in memory, a clip submitted again with the same model and options is not decoded. 0 keeps none. */
+	_FORCE_INLINE_ void set_transcript_cache_size(int p_size) { transcript_cache.set_capacity(p_size); }
+	_FORCE_INLINE_ int get_transcript_cache_size() { return transcript_cache.get_capacity(); }
+	/** Directory every cached transcript is also saved to, e.g. "user://transcripts". Empty keeps them in memory only. */
+	_FORCE_INLINE_ void set_transcript_cache_directory(const String &p_directory) { transcript_cache.set_directory(p_directory); }
+	_FORCE_INLINE_ String get_transcript_cache_directory() { return transcript_cache.get_directory(); }
+	/** Drop the cached transcripts, with p_files also the ones saved to transcript_cache_directory. */
+	_FORCE_INLINE_ void clear_transcript_cache(bool p_files = false) { transcript_cache.clear(p_files); }
+	/** Write the trace zones recorded so far as Chrome trace JSON, ERR_UNAVAILABLE unless built with tracing=yes. */
+	Error save_trace(const String &p_path, bool p_clear = true);
 	void load_model();
+	void load_model_async();
+	_FORCE_INLINE_ bool is_loading_model() { return is_model_loading; }
 };
 
 #endif // SPEECH_TO_TEXT_H
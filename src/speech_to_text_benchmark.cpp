@@ -0,0 +1,614 @@
+#include "speech_to_text_benchmark.h"
+#include "audio_downmix.h"
+#include "audio_file_reader.h"
+#include "audio_recording.h"
+#include "audio_resampler.h"
+#include "audio_sample_convert.h"
+#include "noise_suppressor.h"
+#include "simulation_clock.h"
+#include "speech_to_text.h"
+#include "transcription_result.h"
+#include "vad_engine.h"
+#include "voice_activity_detector.h"
+#include <godot_cpp/classes/audio_server.hpp>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/time.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <shared_mutex>
+#include <string_view>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif !defined(__EMSCRIPTEN__)
+#include <sys/resource.h>
+#endif
+
+/* How often the feeder checks whether the stream is done after the last chunk. */
+static const int idle_poll_ms = 10;
+/* How often a simulation checks whether the main thread emitted the results. */
+static const int results_poll_usec = 1000;
+
+/* On the clock of the stream, which a simulated replay moves ahead. */
+static uint64_t _now_usec() {
+	return SimulationClock::get_ticks_usec();
+}
+
+static double _percentile(std::vector<double> p_values, double p_percentile) {
+	if (p_values.empty()) {
+		return -1.0;
+	}
+	std::sort(p_values.begin(), p_values.end());
+	const size_t index = size_t(std::ceil(p_percentile * p_values.size()));
+	return p_values[CLAMP(index, size_t(1), p_values.size()) - 1];
+}
+
+/* Chunk lengths and mix rates of the kernel benchmarks, from one audio callback to a whole second. */
+static const int kernel_chunk_ms[] = { 10, 20, 100, 1000 };
+static const int kernel_mix_rates[] = { 44100, 48000 };
+static const int kernel_mel_window_ms[] = { 1000, 10000, 30000 };
+
+/* Speech-like test signal, a few tones under noise so no kernel sees silence or denormals. */
+static std::vector<float> _make_signal(size_t p_samples) {
+	std::vector<float> signal(p_samples);
+	uint32_t seed = 12345;
+	for (size_t i = 0; i < p_samples; i++) {
+		seed = seed * 1664525 + 1013904223;
+		const float noise = (float(seed >> 8) / float(1 << 24)) - 0.5f;
+		signal[i] = 0.3f * std::sin(0.031f * i) + 0.2f * std::sin(0.173f * i) + 0.05f * noise;
+	}
+	return signal;
+}
+
+/* Call p_kernel over and over for at least p_min_usec and append its mean time per call to r_results. */
+template <typename F>
+static void _time_kernel(Array &r_results, const char *p_kernel, const String &p_variant, int p_sample_rate, int p_chunk_ms, size_t p_samples, uint64_t p_min_usec, F p_kernel_call) {
+	p_kernel_call(); // first touch of the buffers and the lazily built filters
+	uint64_t calls = 0;
+	uint64_t batch = 1;
+	const uint64_t start = _now_usec();
+	uint64_t elapsed = 0;
+	while (elapsed < p_min_usec || calls < 3) {
+		for (uint64_t i = 0; i < batch; i++) {
+			p_kernel_call();
+		}
+		calls += batch;
+		batch = MIN(batch * 2, uint64_t(1024));
+		elapsed = _now_usec() - start;
+	}
+	const double ns_per_call = double(elapsed) * 1000.0 / double(calls);
+	Dictionary result;
+	result["kernel"] = p_kernel;
+	result["variant"] = p_variant;
+	result["sample_rate"] = p_sample_rate;
+	result["chunk_ms"] = p_chunk_ms;
+	result["calls"] = calls;
+	result["ns_per_call"] = ns_per_call;
+	result["ns_per_sample"] = ns_per_call / double(MAX(p_samples, size_t(1)));
+	// Share of one core the kernel takes to keep up with live audio.
+	result["real_time_factor"] = ns_per_call / (double(p_chunk_ms) * 1000000.0);
+	r_results.push_back(result);
+}
+
+Array SpeechToTextBenchmark::run_kernel_benchmarks(int p_min_time_ms) {
+	const uint64_t min_usec = uint64_t(MAX(1, p_min_time_ms)) * 1000;
+	const int max_rate = kernel_mix_rates[std::size(kernel_mix_rates) - 1];
+	const int max_chunk_ms = kernel_chunk_ms[std::size(kernel_chunk_ms) - 1];
+	const std::vector<float> stereo = _make_signal(2 * size_t(max_rate) * max_chunk_ms / 1000);
+	std::vector<float> mono(stereo.size());
+	std::vector<float> output(stereo.size());
+	volatile float sink = 0.0f; // keeps the results of the VAD checks alive
+	Array results;
+
+	for (int rate : kernel_mix_rates) {
+		for (int chunk_ms : kernel_chunk_ms) {
+			const uint32_t frames = uint32_t(int64_t(rate) * chunk_ms / 1000);
+			_time_kernel(results, "downmix_stereo", audio_downmix_get_kernel_name(), rate, chunk_ms, frames, min_usec, [&]() {
+				audio_downmix_stereo(stereo.data(), frames, mono.data());
+			});
+			if (rate == 3 * WHISPER_SAMPLE_RATE) {
+				const uint32_t frames3 = frames - frames % 3;
+				_time_kernel(results, "downmix_decimate3", audio_downmix_get_kernel_name(), rate, chunk_ms, frames3, min_usec, [&]() {
+					audio_downmix_decimate3(stereo.data(), frames3, mono.data());
+				});
+			}
+			static const char *quality_names[] = { "sinc_best", "sinc_medium", "sinc_fastest", "zero_order_hold", "linear", "polyphase" };
+			for (int quality = SRC_SINC_BEST_QUALITY; quality <= AudioResampler::QUALITY_POLYPHASE; quality++) {
+				// One resampler for all calls, the filter history carries over like on a stream.
+				AudioResampler resampler;
+				resampler.set_quality(quality);
+				const uint32_t capacity = AudioResampler::get_max_output_frames(frames, rate, WHISPER_SAMPLE_RATE);
+				output.resize(MAX(output.size(), size_t(capacity)));
+				_time_kernel(results, "resample", quality_names[quality], rate, chunk_ms, frames, min_usec, [&]() {
+					resampler.process(stereo.data(), frames, rate, WHISPER_SAMPLE_RATE, output.data(), capacity);
+				});
+			}
+		}
+	}
+
+	// The VAD only ever sees the resampled audio.
+	const int vad_window_ms = 2000;
+	for (int chunk_ms : kernel_chunk_ms) {
+		const size_t samples = size_t(WHISPER_SAMPLE_RATE) * chunk_ms / 1000;
+		VoiceActivityDetector detector;
+		detector.setup(WHISPER_SAMPLE_RATE, vad_window_ms);
+		detector.set_high_pass(100.0f);
+		_time_kernel(results, "high_pass_filter", "100 Hz", WHISPER_SAMPLE_RATE, chunk_ms, samples, min_usec, [&]() {
+			sink = detector.push(stereo.data(), samples);
+		});
+		// Every queued sample of a 16-bit audio queue goes through both.
+		std::vector<int16_t> pcm16(samples);
+		_time_kernel(results, "sample_convert", "f32_to_s16", WHISPER_SAMPLE_RATE, chunk_ms, samples, min_usec, [&]() {
+			audio_f32_to_s16(stereo.data(), samples, pcm16.data());
+		});
+		_time_kernel(results, "sample_convert", "s16_to_f32", WHISPER_SAMPLE_RATE, chunk_ms, samples, min_usec, [&]() {
+			audio_s16_to_f32(pcm16.data(), samples, mono.data());
+		});
+		static const char *suppressor_names[] = { "noise_suppression", "auto_gain" };
+		for (int stage = 0; stage < 2; stage++) {
+			NoiseSuppressor suppressor;
+			suppressor.set_noise_suppression(stage == 0);
+			suppressor.set_auto_gain(stage == 1);
+			std::copy(stereo.begin(), stereo.begin() + samples, mono.begin());
+			// In place, the audio it works on changes from call to call like on a stream.
+			_time_kernel(results, "noise_suppressor", suppressor_names[stage], WHISPER_SAMPLE_RATE, chunk_ms, samples, min_usec, [&]() {
+				suppressor.process(mono.data(), samples);
+			});
+		}
+		static const char *mode_names[] = { "energy", "adaptive" };
+		std::vector<float> probabilities;
+		for (int mode = VadEngine::MODE_ENERGY; mode <= VadEngine::MODE_ADAPTIVE; mode++) {
+			std::unique_ptr<VadEngine> engine = VadEngine::create(VadEngine::Mode(mode), WHISPER_SAMPLE_RATE);
+			engine->set_high_pass(100.0f);
+			_time_kernel(results, "vad_engine", mode_names[mode], WHISPER_SAMPLE_RATE, chunk_ms, samples, min_usec, [&]() {
+				probabilities.clear();
+				sink = engine->process(stereo.data(), samples, false, probabilities);
+			});
+		}
+	}
+	{
+		VoiceActivityDetector detector;
+		detector.setup(WHISPER_SAMPLE_RATE, vad_window_ms);
+		detector.set_high_pass(100.0f);
+		detector.push(stereo.data(), size_t(WHISPER_SAMPLE_RATE) * vad_window_ms / 1000);
+		// Asked once per pass over the whole window.
+		_time_kernel(results, "vad_simple", "is_speech_ending", WHISPER_SAMPLE_RATE, vad_window_ms, size_t(WHISPER_SAMPLE_RATE) * vad_window_ms / 1000, min_usec, [&]() {
+			sink = detector.is_speech_ending(vad_window_ms, 1000, 0.6f);
+		});
+	}
+
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	if (speech_to_text_obj == nullptr) {
+		return results;
+	}
+	std::shared_lock<std::shared_mutex> context_lock(speech_to_text_obj->context_mutex);
+	whisper_context *context = speech_to_text_obj->context_instance;
+	// The mel spectrogram needs the filters of a model.
+	whisper_state *state = context != nullptr ? whisper_init_state(context) : nullptr;
+	if (state == nullptr) {
+		return results;
+	}
+	const int n_threads = speech_to_text_obj->_get_params_snapshot()->n_threads;
+	const int slide_ms = 1000;
+	const int max_window_ms = kernel_mel_window_ms[std::size(kernel_mel_window_ms) - 1];
+	const std::vector<float> pcmf32 = _make_signal(size_t(WHISPER_SAMPLE_RATE) * (max_window_ms + 16 * slide_ms) / 1000);
+	for (int window_ms : kernel_mel_window_ms) {
+		const int window = WHISPER_SAMPLE_RATE * window_ms / 1000;
+		_time_kernel(results, "mel", "full", WHISPER_SAMPLE_RATE, window_ms, window, min_usec, [&]() {
+			whisper_pcm_to_mel_with_state(context, state, pcmf32.data(), window, n_threads);
+		});
+		// A stream slides its window by about a second per pass, the overlap comes from the cache.
+		const int slide = WHISPER_SAMPLE_RATE * slide_ms / 1000;
+		int64_t offset = 0;
+		_time_kernel(results, "mel", "cached", WHISPER_SAMPLE_RATE, window_ms, window, min_usec, [&]() {
+			offset = offset + slide + window > int64_t(pcmf32.size()) ? 0 : offset + slide;
+			whisper_pcm_to_mel_cached_with_state(context, state, pcmf32.data() + offset, window, offset, n_threads);
+		});
+		// What speed_up adds to the mel, the encoder then runs over half the positions.
+		whisper_set_speed_up_with_state(state, true);
+		_time_kernel(results, "mel", "speed_up", WHISPER_SAMPLE_RATE, window_ms, window, min_usec, [&]() {
+			whisper_pcm_to_mel_with_state(context, state, pcmf32.data(), window, n_threads);
+		});
+		whisper_set_speed_up_with_state(state, false);
+	}
+	whisper_free_state(state);
+	return results;
+}
+
+/* Lowercased words of p_text, split at whitespace and punctuation. Apostrophes stay, "o'clock" is one word. */
+static std::vector<String> _split_words(const String &p_text) {
+	static const std::u32string_view separators = U".,!?;:\"()[]{}<>-_/*&%$#@+=~|\\¿¡«»“”„…—–";
+	std::vector<String> words;
+	const String text = p_text.to_lower();
+	String word;
+	for (int64_t i = 0; i <= text.length(); i++) {
+		const char32_t c = i < text.length() ? text[i] : U' ';
+		if (c <= U' ' || separators.find(c) != std::u32string_view::npos) {
+			if (!word.is_empty()) {
+				words.push_back(word);
+				word = String();
+			}
+			continue;
+		}
+		word += c;
+	}
+	return words;
+}
+
+Dictionary SpeechToTextBenchmark::score_transcript(const String &p_reference, const String &p_hypothesis) {
+	const std::vector<String> reference = _split_words(p_reference);
+	const std::vector<String> hypothesis = _split_words(p_hypothesis);
+	// Levenshtein over words, one row at a time, with the edits of each cell to tell them apart.
+	struct Cell {
+		int cost = 0;
+		int substitutions = 0;
+		int deletions = 0;
+		int insertions = 0;
+	};
+	std::vector<Cell> row(hypothesis.size() + 1);
+	for (size_t j = 1; j <= hypothesis.size(); j++) {
+		row[j] = { int(j), 0, 0, int(j) };
+	}
+	for (size_t i = 1; i <= reference.size(); i++) {
+		Cell diagonal = row[0];
+		row[0] = { int(i), 0, int(i), 0 };
+		for (size_t j = 1; j <= hypothesis.size(); j++) {
+			const Cell above = row[j];
+			Cell best = diagonal;
+			if (reference[i - 1] != hypothesis[j - 1]) {
+				best.cost++;
+				best.substitutions++;
+			}
+			if (above.cost + 1 < best.cost) {
+				best = above;
+				best.cost++;
+				best.deletions++;
+			}
+			if (row[j - 1].cost + 1 < best.cost) {
+				best = row[j - 1];
+				best.cost++;
+				best.insertions++;
+			}
+			diagonal = above;
+			row[j] = best;
+		}
+	}
+	const Cell &result = row[hypothesis.size()];
+	Dictionary score;
+	score["wer"] = reference.empty() ? (hypothesis.empty() ? 0.0 : 1.0) : double(result.cost) / double(reference.size());
+	score["substitutions"] = result.substitutions;
+	score["deletions"] = result.deletions;
+	score["insertions"] = result.insertions;
+	score["reference_words"] = int64_t(reference.size());
+	return score;
+}
+
+int64_t SpeechToTextBenchmark::get_peak_memory_usage() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return -1;
+	}
+	return counters.PeakWorkingSetSize;
+#elif defined(__EMSCRIPTEN__)
+	return -1;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return -1;
+	}
+#if defined(__APPLE__)
+	return usage.ru_maxrss;
+#else
+	// Linux and Android count kilobytes.
+	return int64_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+SpeechToTextBenchmark::~SpeechToTextBenchmark() {
+	if (feed_thread != nullptr) {
+		is_running = false;
+		feed_thread->wait_to_finish();
+		memdelete(feed_thread);
+		feed_thread = nullptr;
+	}
+	_stop();
+}
+
+/* The WAV file at p_path in chunk_ms chunks at the mix rate, or the calls of a recording as they came. */
+Error SpeechToTextBenchmark::_load_clip(const String &p_path) {
+	chunks.clear();
+	clip_seconds = 0.0;
+	if (p_path.get_extension() == AudioRecording::EXTENSION) {
+		std::vector<AudioRecording::Chunk> recorded;
+		const Error err = AudioRecording::load(p_path, recorded);
+		if (err != OK) {
+			return err;
+		}
+		ERR_FAIL_COND_V_MSG(recorded.empty(), ERR_FILE_CORRUPT, vformat("\"%s\" has no audio.", p_path));
+		for (AudioRecording::Chunk &chunk : recorded) {
+			clip_seconds += double(chunk.frames.size()) / chunk.mix_rate;
+			chunks.push_back({ chunk.usec, chunk.mix_rate, clip_seconds, std::move(chunk.frames) });
+		}
+		return OK;
+	}
+
+	AudioFileReader reader;
+	if (!reader.open(p_path)) {
+		return ERR_FILE_CANT_OPEN;
+	}
+	std::vector<float> pcmf32;
+	while (reader.read_block(pcmf32) > 0) {
+	}
+	reader.close();
+	ERR_FAIL_COND_V_MSG(pcmf32.empty(), ERR_FILE_CORRUPT, vformat("\"%s\" has no audio.", p_path));
+	clip_seconds = double(pcmf32.size()) / WHISPER_SAMPLE_RATE;
+
+	// Fed like a microphone, stereo at the mix rate, so the benchmark covers the ingest path of the stream too.
+	const uint32_t mix_rate = AudioServer::get_singleton()->get_mix_rate();
+	AudioResampler resampler;
+	resampler.set_quality(SRC_SINC_MEDIUM_QUALITY);
+	std::vector<float> mixed(AudioResampler::get_max_output_frames(pcmf32.size(), WHISPER_SAMPLE_RATE, mix_rate));
+	mixed.resize(resampler.process(pcmf32.data(), pcmf32.size(), WHISPER_SAMPLE_RATE, mix_rate, mixed.data(), mixed.size()));
+	const int64_t chunk_frames = MAX(1, int64_t(mix_rate) * chunk_ms / 1000);
+	for (int64_t offset = 0; offset < int64_t(mixed.size()); offset += chunk_frames) {
+		const int64_t end = MIN(offset + chunk_frames, int64_t(mixed.size()));
+		PackedVector2Array frames;
+		frames.resize(end - offset);
+		Vector2 *dst = frames.ptrw();
+		for (int64_t i = offset; i < end; i++) {
+			dst[i - offset] = Vector2(mixed[i], mixed[i]);
+		}
+		chunks.push_back({ uint64_t(offset) * 1000000 / mix_rate, mix_rate, double(end) / mix_rate, std::move(frames) });
+	}
+	return OK;
+}
+
+/* tail_seconds of silence in chunk_ms chunks after the clip, at the mix rate of its end. */
+void SpeechToTextBenchmark::_add_tail() {
+	clip_chunks = chunks.size();
+	const feed_chunk &last = chunks.back();
+	const uint32_t mix_rate = last.mix_rate;
+	const int64_t chunk_frames = MAX(1, int64_t(mix_rate) * chunk_ms / 1000);
+	const int64_t tail_frames = int64_t(tail_seconds * mix_rate);
+	const uint64_t tail_usec = last.due_usec + uint64_t(last.frames.size()) * 1000000 / mix_rate;
+	double end_seconds = clip_seconds;
+	for (int64_t offset = 0; offset < tail_frames; offset += chunk_frames) {
+		PackedVector2Array silence;
+		silence.resize(MIN(chunk_frames, tail_frames - offset));
+		silence.fill(Vector2());
+		end_seconds += double(silence.size()) / mix_rate;
+		chunks.push_back({ tail_usec + uint64_t(offset) * 1000000 / mix_rate, mix_rate, end_seconds, std::move(silence) });
+	}
+}
+
+Error SpeechToTextBenchmark::start(const Ref<SpeechToTextStream> &p_stream, const String &p_path) {
+	ERR_FAIL_COND_V_MSG(is_running || feed_thread != nullptr, ERR_BUSY, "A benchmark is already running.");
+	ERR_FAIL_COND_V(p_stream.is_null(), ERR_INVALID_PARAMETER);
+	ERR_FAIL_NULL_V(SpeechToText::get_singleton(), ERR_UNCONFIGURED);
+
+	const Error err = _load_clip(p_path);
+	if (err != OK) {
+		return err;
+	}
+	_add_tail();
+
+	feed_marks.clear();
+	clip_fed_usec = 0;
+	lags_ms.clear();
+	waiting_streams.clear();
+	latencies_ms.clear();
+	first_partial_usec = -1;
+	last_final_usec = -1;
+	process_ms = 0;
+	partial_count = 0;
+	final_count = 0;
+	text = String();
+	report = Dictionary();
+
+	stream = p_stream;
+	stream->stop_listen();
+	saved_overflow_policy = stream->get_audio_queue_overflow_policy();
+	if (!realtime && !simulated) {
+		// Nothing may be dropped when the whole clip arrives at once.
+		stream->set_audio_queue_overflow_policy(AudioRingBuffer::OVERFLOW_BLOCK);
+	}
+	stream->reset_timings();
+	stream->connect("update_transcribed_msgs", callable_mp(this, &SpeechToTextBenchmark::_on_transcribed_msgs));
+	stream->start_listen();
+
+	start_usec = _now_usec();
+	start_host_usec = Time::get_singleton()->get_ticks_usec();
+	is_running = true;
+	feed_thread = memnew(Thread);
+	feed_thread->start(callable_mp(this, &SpeechToTextBenchmark::_feed));
+	return OK;
+}
+
+/* Simulated: wait until the passes the input started, the segments it closes and their results are done. */
+void SpeechToTextBenchmark::_settle() {
+	SpeechToText::get_singleton()->scheduler.wait_until_quiet();
+	// The results are emitted by the main thread, with the latency of a frame.
+	while (is_running && stream->_has_queued_results()) {
+		OS::get_singleton()->delay_usec(results_poll_usec);
+	}
+}
+
+/* Until p_usec on the clock of the stream, which a simulation moves there once the stream has nothing left to do. */
+void SpeechToTextBenchmark::_wait_until(uint64_t p_usec) {
+	if (!simulated) {
+		const uint64_t now = _now_usec();
+		if (p_usec > now) {
+			OS::get_singleton()->delay_usec(p_usec - now);
+		}
+		return;
+	}
+	_settle();
+	const uint64_t now = _now_usec();
+	if (p_usec > now) {
+		SimulationClock::advance(p_usec - now);
+		// Segments that close on a timer close by then.
+		_settle();
+	}
+}
+
+void SpeechToTextBenchmark::_feed() {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	for (size_t i = 0; i < chunks.size() && is_running; i++) {
+		const feed_chunk &chunk = chunks[i];
+		if (realtime || simulated) {
+			_wait_until(start_usec + chunk.due_usec);
+		}
+		stream->_add_audio_buffer(chunk.frames, chunk.mix_rate);
+		const uint64_t fed_usec = _now_usec();
+		feed_mutex.lock();
+		feed_marks.push_back({ chunk.end_seconds, fed_usec });
+		feed_mutex.unlock();
+		if (i + 1 >= clip_chunks && clip_fed_usec.load() == 0) {
+			clip_fed_usec = fed_usec;
+		}
+		const uint64_t behind = stream->audio_queue.size() + stream->buffered_frames.load(std::memory_order_relaxed);
+		lags_ms.push_back(double(behind) * 1000.0 / WHISPER_SAMPLE_RATE);
+		waiting_streams.push_back(speech_to_text_obj->scheduler.get_waiting_streams());
+	}
+	// The stream is done once it decoded what it queued and closed the last segment.
+	const uint64_t timeout_usec = start_usec + uint64_t(timeout_seconds * 1000000.0f);
+	bool timed_out = false;
+	while (is_running && !speech_to_text_obj->scheduler.is_stream_idle(stream.ptr())) {
+		if (_now_usec() >= timeout_usec) {
+			timed_out = true;
+			break;
+		}
+		_wait_until(_now_usec() + idle_poll_ms * 1000);
+	}
+	if (is_running) {
+		// Deferred calls run in order, the results of the last pass are handled first.
+		call_deferred("_finish", timed_out);
+	}
+}
+
+/* When the input reached p_input_seconds, or the last chunk that was fed if it did not yet. */
+uint64_t SpeechToTextBenchmark::_get_feed_usec(double p_input_seconds) {
+	feed_mutex.lock();
+	uint64_t usec = start_usec;
+	auto mark = std::lower_bound(feed_marks.begin(), feed_marks.end(), p_input_seconds, [](const feed_mark &p_mark, double p_seconds) {
+		return p_mark.input_seconds < p_seconds;
+	});
+	if (mark != feed_marks.end()) {
+		usec = mark->usec;
+	} else if (!feed_marks.empty()) {
+		usec = feed_marks.back().usec;
+	}
+	feed_mutex.unlock();
+	return usec;
+}
+
+void SpeechToTextBenchmark::_on_transcribed_msgs(int p_process_time_ms, const Array &p_results) {
+	const uint64_t now = _now_usec();
+	process_ms += p_process_time_ms;
+	for (int i = 0; i < p_results.size(); i++) {
+		Ref<TranscriptionResult> result = p_results[i];
+		if (result.is_null()) {
+			continue;
+		}
+		latencies_ms.push_back(double(int64_t(now - _get_feed_usec(result->get_end_time()))) / 1000.0);
+		if (result->is_partial()) {
+			partial_count++;
+			if (first_partial_usec < 0 && !result->get_text().is_empty()) {
+				first_partial_usec = now;
+			}
+		} else {
+			final_count++;
+			last_final_usec = now;
+			text += result->get_committed_text();
+		}
+	}
+}
+
+void SpeechToTextBenchmark::_finish(bool p_timed_out) {
+	if (!is_running) {
+		return;
+	}
+	is_running = false;
+	feed_thread->wait_to_finish();
+	memdelete(feed_thread);
+	feed_thread = nullptr;
+	const Dictionary timings = stream->get_timings();
+	report["realtime"] = realtime;
+	report["simulated"] = simulated;
+	report["timed_out"] = p_timed_out;
+	report["audio_seconds"] = clip_seconds;
+	const int64_t end_usec = MAX(MAX(last_final_usec, first_partial_usec), int64_t(clip_fed_usec.load()));
+	const double wall_seconds = double(end_usec - int64_t(start_usec)) / 1000000.0;
+	report["wall_seconds"] = wall_seconds;
+	// Below wall_seconds when simulated, by the waits it skipped.
+	report["host_seconds"] = double(Time::get_singleton()->get_ticks_usec() - start_host_usec) / 1000000.0;
+	// Decoding time per second of audio, below 1 keeps up with a live speaker.
+	report["real_time_factor"] = double(process_ms) / 1000.0 / clip_seconds;
+	report["throughput"] = wall_seconds > 0.0 ? clip_seconds / wall_seconds : 0.0;
+	report["time_to_first_partial_ms"] = first_partial_usec < 0 ? -1.0 : double(first_partial_usec - int64_t(start_usec)) / 1000.0;
+	report["time_to_final_ms"] = last_final_usec < 0 ? -1.0 : double(last_final_usec - int64_t(clip_fed_usec.load())) / 1000.0;
+	report["latency_p50_ms"] = _percentile(latencies_ms, 0.5);
+	report["latency_p90_ms"] = _percentile(latencies_ms, 0.9);
+	report["latency_p99_ms"] = _percentile(latencies_ms, 0.99);
+	report["lag_p95_ms"] = _percentile(lags_ms, 0.95);
+	report["lag_max_ms"] = lags_ms.empty() ? 0.0 : *std::max_element(lags_ms.begin(), lags_ms.end());
+	report["waiting_streams_p95"] = _percentile(waiting_streams, 0.95);
+	report["waiting_streams_max"] = waiting_streams.empty() ? 0.0 : *std::max_element(waiting_streams.begin(), waiting_streams.end());
+	report["partials"] = partial_count;
+	report["finals"] = final_count;
+	report.merge(timings);
+	report["dropped_audio_frames"] = stream->get_dropped_audio_frames();
+	report["missed_deadlines"] = stream->get_missed_deadlines();
+	report["peak_memory_usage"] = get_peak_memory_usage();
+	report["text"] = text.strip_edges();
+	_stop();
+	emit_signal("finished", report);
+}
+
+void SpeechToTextBenchmark::_stop() {
+	if (stream.is_null()) {
+		return;
+	}
+	const Callable on_transcribed_msgs = callable_mp(this, &SpeechToTextBenchmark::_on_transcribed_msgs);
+	if (stream->is_connected("update_transcribed_msgs", on_transcribed_msgs)) {
+		stream->disconnect("update_transcribed_msgs", on_transcribed_msgs);
+	}
+	stream->stop_listen();
+	stream->set_audio_queue_overflow_policy(saved_overflow_policy);
+	stream.unref();
+}
+
+void SpeechToTextBenchmark::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("set_realtime", "realtime"), &SpeechToTextBenchmark::set_realtime);
+	ClassDB::bind_method(D_METHOD("is_realtime"), &SpeechToTextBenchmark::is_realtime);
+	ClassDB::bind_method(D_METHOD("set_simulated", "simulated"), &SpeechToTextBenchmark::set_simulated);
+	ClassDB::bind_method(D_METHOD("is_simulated"), &SpeechToTextBenchmark::is_simulated);
+	ClassDB::bind_method(D_METHOD("set_chunk_ms", "chunk_ms"), &SpeechToTextBenchmark::set_chunk_ms);
+	ClassDB::bind_method(D_METHOD("get_chunk_ms"), &SpeechToTextBenchmark::get_chunk_ms);
+	ClassDB::bind_method(D_METHOD("set_tail_seconds", "tail_seconds"), &SpeechToTextBenchmark::set_tail_seconds);
+	ClassDB::bind_method(D_METHOD("get_tail_seconds"), &SpeechToTextBenchmark::get_tail_seconds);
+	ClassDB::bind_method(D_METHOD("set_timeout_seconds", "timeout_seconds"), &SpeechToTextBenchmark::set_timeout_seconds);
+	ClassDB::bind_method(D_METHOD("get_timeout_seconds"), &SpeechToTextBenchmark::get_timeout_seconds);
+	ClassDB::bind_method(D_METHOD("start", "stream", "path"), &SpeechToTextBenchmark::start);
+	ClassDB::bind_method(D_METHOD("is_running"), &SpeechToTextBenchmark::is_running_benchmark);
+	ClassDB::bind_method(D_METHOD("get_report"), &SpeechToTextBenchmark::get_report);
+	ClassDB::bind_method(D_METHOD("_finish", "timed_out"), &SpeechToTextBenchmark::_finish);
+	ClassDB::bind_static_method("SpeechToTextBenchmark", D_METHOD("get_peak_memory_usage"), &SpeechToTextBenchmark::get_peak_memory_usage);
+	ClassDB::bind_static_method("SpeechToTextBenchmark", D_METHOD("run_kernel_benchmarks", "min_time_ms"), &SpeechToTextBenchmark::run_kernel_benchmarks, DEFVAL(200));
+	ClassDB::bind_static_method("SpeechToTextBenchmark", D_METHOD("score_transcript", "reference", "hypothesis"), &SpeechToTextBenchmark::score_transcript);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "realtime"), "set_realtime", "is_realtime");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "simulated"), "set_simulated", "is_simulated");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "chunk_ms", PROPERTY_HINT_RANGE, "1,1000"), "set_chunk_ms", "get_chunk_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "tail_seconds"), "set_tail_seconds", "get_tail_seconds");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "timeout_seconds"), "set_timeout_seconds", "get_timeout_seconds");
+
+	ADD_SIGNAL(MethodInfo("finished", PropertyInfo(Variant::DICTIONARY, "report")));
+}
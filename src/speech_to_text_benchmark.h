@@ -0,0 +1,130 @@
+#ifndef SPEECH_TO_TEXT_BENCHMARK_H
+#define SPEECH_TO_TEXT_BENCHMARK_H
+
+#include "speech_to_text_stream.h"
+
+#include <godot_cpp/classes/mutex.hpp>
+#include <godot_cpp/classes/ref_counted.hpp>
+#include <godot_cpp/classes/thread.hpp>
+#include <godot_cpp/variant/array.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_vector2_array.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * Replays a WAV file into a SpeechToTextStream, either at the pace of a
+ * microphone or as fast as the stream takes it, and measures how quickly
+ * the results come back. A recording of SpeechToTextStream.start_recording
+ * is replayed call by call instead, at the times and mix rates it was
+ * recorded with. The demo/bench scene runs it for every model and setting
+ * it is given, see `scons bench`. A simulated replay keeps the pace of the
+ * input on SimulationClock, which skips the waits once the stream is done with
+ * what it was given, so long recordings replay in a fraction of their length.
+ */
+class SpeechToTextBenchmark : public RefCounted {
+	GDCLASS(SpeechToTextBenchmark, RefCounted);
+
+	bool realtime = true;
+	bool simulated = false;
+	int chunk_ms = 20;
+	float tail_seconds = 1.5f; // silence after the clip, so the segmenter ends the last voiced run
+	float timeout_seconds = 120.0f;
+
+	Ref<SpeechToTextStream> stream;
+	int saved_overflow_policy = AudioRingBuffer::OVERFLOW_DROP_OLDEST;
+	/* One add_audio_buffer call of the feeder. */
+	struct feed_chunk {
+		uint64_t due_usec; // after the start, when fed in real time
+		uint32_t mix_rate;
+		double end_seconds; // of input once it is fed
+		PackedVector2Array frames;
+	};
+	std::vector<feed_chunk> chunks; // the clip, then its tail
+	size_t clip_chunks = 0;
+	double clip_seconds = 0.0;
+
+	/* Feeder side. */
+	Thread *feed_thread = nullptr;
+	std::atomic<bool> is_running = false;
+	/* When the input reached each chunk, to measure result latency against it. */
+	struct feed_mark {
+		double input_seconds;
+		uint64_t usec;
+	};
+	Mutex feed_mutex;
+	std::vector<feed_mark> feed_marks;
+	uint64_t start_usec = 0;
+	uint64_t start_host_usec = 0; // Time ticks, start_usec is on SimulationClock
+	std::atomic<uint64_t> clip_fed_usec{ 0 }; // 0 until the last sample of the clip was given to the stream
+	/* Sampled by the feeder after each chunk, read once it finished. */
+	std::vector<double> lags_ms; // audio the stream queued and buffered but did not decode yet
+	std::vector<double> waiting_streams; // of the scheduler, shared by all streams
+
+	/* Main thread side, from the results of the stream. */
+	std::vector<double> latencies_ms;
+	int64_t first_partial_usec = -1;
+	int64_t last_final_usec = -1;
+	int64_t process_ms = 0;
+	int partial_count = 0;
+	int final_count = 0;
+	String text;
+	Dictionary report;
+
+	uint64_t _get_feed_usec(double p_input_seconds);
+	Error _load_clip(const String &p_path);
+	void _add_tail();
+	void _settle();
+	void _wait_until(uint64_t p_usec);
+	void _feed();
+	void _on_transcribed_msgs(int p_process_time_ms, const Array &p_results);
+	void _finish(bool p_timed_out);
+	void _stop();
+
+protected:
+	static void _bind_methods();
+
+public:
+	/** Feed chunk_ms chunks at the pace of the clip, or all of them as fast as the stream queues them. */
+	_FORCE_INLINE_ void set_realtime(bool p_realtime) { realtime = p_realtime; }
+	_FORCE_INLINE_ bool is_realtime() const { return realtime; }
+	/** Keep the pace of realtime on a virtual clock, which only moves with the compute of the passes while they run. */
+	_FORCE_INLINE_ void set_simulated(bool p_simulated) { simulated = p_simulated; }
+	_FORCE_INLINE_ bool is_simulated() const { return simulated; }
+	_FORCE_INLINE_ void set_chunk_ms(int p_chunk_ms) { chunk_ms = CLAMP(p_chunk_ms, 1, 1000); }
+	_FORCE_INLINE_ int get_chunk_ms() const { return chunk_ms; }
+	_FORCE_INLINE_ void set_tail_seconds(float p_tail_seconds) { tail_seconds = MAX(0.0f, p_tail_seconds); }
+	_FORCE_INLINE_ float get_tail_seconds() const { return tail_seconds; }
+	/** The run is reported as timed out if the stream is still busy this long after it started. */
+	_FORCE_INLINE_ void set_timeout_seconds(float p_timeout_seconds) { timeout_seconds = MAX(1.0f, p_timeout_seconds); }
+	_FORCE_INLINE_ float get_timeout_seconds() const { return timeout_seconds; }
+
+	/** Restart p_stream and replay the WAV file or recording at p_path into it, finished is emitted with the report. */
+	Error start(const Ref<SpeechToTextStream> &p_stream, const String &p_path);
+	_FORCE_INLINE_ bool is_running_benchmark() const { return is_running; }
+	/** Which of the keys are filled is described in the README. Empty until finished was emitted. */
+	_FORCE_INLINE_ Dictionary get_report() const { return report; }
+
+	/** Largest resident set of the process so far in bytes, -1 where the platform does not tell. */
+	static int64_t get_peak_memory_usage();
+	/**
+	 * Time the ingest kernels (downmix, every resampler quality, the VAD high-pass and energy checks) over
+	 * 10 ms to 1 s chunks at 44.1 and 48 kHz, and the mel spectrogram of 1 to 30 second windows when a model
+	 * is loaded. Each case runs for at least p_min_time_ms and gets one Dictionary in the result.
+	 */
+	static Array run_kernel_benchmarks(int p_min_time_ms = 200);
+	/**
+	 * Word error rate of p_hypothesis against p_reference, both lowercased with the punctuation dropped. The
+	 * Dictionary has wer, the substitutions, deletions and insertions of the alignment and reference_words.
+	 */
+	static Dictionary score_transcript(const String &p_reference, const String &p_hypothesis);
+
+	SpeechToTextBenchmark() {}
+	~SpeechToTextBenchmark();
+};
+
+#endif // SPEECH_TO_TEXT_BENCHMARK_H
@@ -0,0 +1,111 @@
+#ifndef SPEECH_TO_TEXT_PARAMS_H
+#define SPEECH_TO_TEXT_PARAMS_H
+
+#include "vad_engine.h"
+
+#include <whisper.cpp/whisper.h>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/core/math.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * The settings of SpeechToText the streams and jobs decode with. The
+ * singleton publishes an immutable copy after every change, see
+ * SpeechToText::_get_params_snapshot(), and a pass keeps the copy it began
+ * with.
+ */
+struct SpeechToTextParams {
+	int32_t n_threads = MIN(4, (int32_t)OS::get_singleton()->get_processor_count());
+	int32_t max_tokens = 32;
+	/* Committed tokens of the stream fed back as prompt, the rolling context of the decoder. */
+	int32_t prompt_context_tokens = 0;
+
+	float vad_thold = 0.3f;
+	float freq_thold = 200.0f;
+	/* Chunks whose speech probability is below speech_threshold are not queued. */
+	int vad_mode = VadEngine::MODE_ENERGY;
+	float speech_threshold = 0.5f;
+	/* Silence kept before and after every voiced run. */
+	int speech_pre_roll_ms = 200;
+	int speech_hang_over_ms = 300;
+	/* Silence after the last voiced frame that closes the segment, see EndpointPolicy. */
+	int endpoint_silence_ms = 400;
+	bool adaptive_endpointing = true;
+	/* Queued audio that starts a pass, and the length of an open segment that is committed however it ends. */
+	int pass_trigger_ms = 1000;
+	int max_utterance_ms = 14000;
+	/* Clean up of the resampled input before the VAD, see NoiseSuppressor. */
+	bool noise_suppression = false;
+	/* Subtract what the Master bus played from the input before the VAD, see EchoCanceller. */
+	bool echo_cancellation = false;
+	/* Decide the end of speech from the mel frames of the passes instead of the samples. */
+	bool mel_vad = false;
+	bool auto_gain = false;
+
+	bool speed_up = false;
+	bool translate = false;
+	/* whisper.cpp servers the streams send their utterances to, separated by commas, empty decodes them locally. */
+	std::string remote_inference_url;
+	int remote_latency_budget_ms = 1500;
+	float remote_retry_seconds = 30.0f;
+	/* Passes that commit text also decode it translated to English, from the same encoder output. */
+	bool dual_translation = false;
+	bool no_fallback = false;
+	bool incremental_decoding = false;
+	/* Commit the words the last local_agreement passes start with alike, 0 leaves the commits to the VAD and the buffer length. */
+	int32_t local_agreement = 0;
+	/* Feed the previous result to the decoder as draft while the buffer only grows. */
+	bool draft_previous_tokens = true;
+	/* Time every token, without it the tokens get the times of their segment and passes split at segment ends only. */
+	bool token_timestamps = true;
+	/* Let tinydiarize models, e.g. small.en-tdrz, mark where the speaker changes. Other models do not emit the marker. */
+	bool speaker_turns = false;
+
+	/* Encoder context sized to the buffer, see _audio_ctx_for_samples. */
+	bool dynamic_audio_ctx = true;
+	int32_t audio_ctx_granularity = 64;
+	int32_t audio_ctx_min = 128;
+	int32_t audio_ctx_max = 768;
+	/* Chunked encoder with reuse of unchanged chunks, 0 encodes the buffer in one pass. */
+	int32_t encoder_chunk_ms = 0;
+	int32_t encoder_overlap_ms = 1000;
+	/* A stream encodes the audio of its next pass on a second state while the current one decodes. */
+	bool pipelined_encoding = false;
+	/* Threads of a pass decoded with the draft model, 0 uses n_threads. */
+	int32_t draft_n_threads = 0;
+	/* Encoder layers of the partial passes of the language model, the ones after them are skipped. 0 runs all of them. */
+	int32_t partial_encoder_layers = 0;
+	/* Encoder offloaded to OpenVINO, an empty path runs it with ggml. Guarded by context_mutex. */
+	std::string openvino_encoder_path;
+	std::string openvino_device = "CPU";
+	/* Encoder offloaded to NNAPI on Android, an empty path runs it with ggml. An empty accelerator lets NNAPI pick. Guarded by context_mutex. */
+	std::string nnapi_encoder_path;
+	std::string nnapi_accelerator;
+
+	std::string language = "en";
+	/* With language auto, a stream keeps the language detected with language_pin_probability for language_pin_seconds of speech. 0 detects on every pass. */
+	float language_pin_seconds = 3.0f;
+	float language_pin_probability = 0.8f;
+	/* The languages auto detection picks from, by whisper_lang_id(), empty for all of them. */
+	std::vector<int> allowed_lang_ids;
+	std::string model = "./addons/godot_whisper/models/ggml-tiny.en.bin";
+
+	float entropy_threshold = 2.8f;
+	/* A pass whose text fails entropy_threshold is decoded again with the temperature raised by temperature_inc, up to 1.0 and max_fallbacks times. */
+	float temperature_inc = 0.2f;
+	int32_t max_fallbacks = 5;
+	/* whisper_sampling_strategy of the streams, best_of decoders sample each fallback. Jobs can override all four. */
+	int sampling_strategy = WHISPER_SAMPLING_GREEDY;
+	int32_t beam_size = 5;
+	int32_t best_of = 5;
+	/* Past it a pass stops falling back and decodes on with its best decoder alone, 0 for no limit. */
+	int32_t decode_budget_ms = 0;
+	/* A decoder ending on this many copies of the same n-gram is stopped after the first, 0 lets it loop. */
+	int32_t repetition_limit = 4;
+};
+
+#endif // SPEECH_TO_TEXT_PARAMS_H
@@ -0,0 +1,2783 @@
+#include "speech_to_text_stream.h"
+#include "audio_downmix.h"
+#include "audio_sample_convert.h"
+#include "audio_thread_priority.h"
+#include "lock_metrics.h"
+#include "simulation_clock.h"
+#include "thermal_monitor.h"
+#include "speech_to_text.h"
+#include "thread_affinity.h"
+#include "trace.h"
+#include "transcription_result.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <godot_cpp/classes/audio_server.hpp>
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/engine.hpp>
+#include <godot_cpp/classes/scene_tree.hpp>
+#include <godot_cpp/classes/scene_tree_timer.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/core/memory.hpp>
+#include <godot_cpp/variant/utility_functions.hpp>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Grow p_buffer to at least p_size elements. Capacity grows geometrically and is never released. */
+void _grow_scratch(std::vector<float> &p_buffer, size_t p_size) {
+	if (p_buffer.capacity() < p_size) {
+		p_buffer.reserve(MAX(p_size, p_buffer.capacity() * 2));
+	}
+	if (p_buffer.size() < p_size) {
+		p_buffer.resize(p_size);
+	}
+}
+
+/* VAD parameters */
+// The most recent 3s.
+static const int vad_window_s = 3;
+static const int n_samples_vad_window = WHISPER_SAMPLE_RATE * vad_window_s;
+// In VAD, compare the energy of the last 500ms to that of the total 3s.
+static const int vad_last_ms = 500;
+
+// A pinned language is detected again once the mean token probability of a pass falls below this.
+static const float language_unpin_probability = 0.5f;
+
+// How often the encoder thread checks the queue, in case it missed the wakeup of the audio thread.
+static const int prefetch_poll_ms = 10;
+
+// Results poll_results() can fall behind by, a power of two.
+static const int polled_results_capacity = 64;
+
+// Voiced chunks whose capture time is kept, a minute or more of speech at the chunk sizes of the capture paths.
+static const size_t max_capture_markers = 4096;
+
+// How often the front-end thread checks its slots, in case it missed the wakeup of a caller.
+static const int frontend_poll_ms = 5;
+// Period and computation of the front-end thread as the real-time scheduler of Apple platforms wants them, a chunk of the capture paths or less.
+static const uint32_t frontend_period_usec = 10000;
+static const uint32_t frontend_computation_usec = 2500;
+
+// Layout of serialize_state(), restore_state() refuses the others.
+static const int stream_state_version = 1;
+
+/* Samples the encoder positions of p_samples cover, speed_up time compresses the mel 2x. */
+static size_t _encoded_samples(size_t p_samples, bool p_speed_up) {
+	return p_speed_up ? (p_samples + 1) / 2 : p_samples;
+}
+
+SpeechToTextStream::SpeechToTextStream() {
+	wake_threshold_frames = SpeechToText::SPEECH_SETTING_SAMPLE_RATE;
+	vad.setup(WHISPER_SAMPLE_RATE, vad_window_s * 1000);
+	mel_vad.setup(vad_window_s * 1000);
+	segmenter.setup(SpeechToText::SPEECH_SETTING_SAMPLE_RATE, VoiceActivityDetector::FRAME_MS);
+	audio_queue.set_capacity(audio_queue_seconds * SpeechToText::SPEECH_SETTING_SAMPLE_RATE, (AudioRingBuffer::SampleFormat)audio_queue_format);
+	polled_results.resize(polled_results_capacity);
+	if (SpeechToText::get_singleton()) {
+		SpeechToText::get_singleton()->_register_stream(this);
+	}
+}
+
+SpeechToTextStream::~SpeechToTextStream() {
+	stop_listen();
+	_stop_encoder_thread();
+	if (SpeechToText::get_singleton()) {
+		// Unregister before freeing, so a context swap cannot release the state a second time.
+		SpeechToText::get_singleton()->_unregister_stream(this);
+	}
+	whisper_free_state(state_instance);
+	whisper_free_state(draft_state_instance);
+	whisper_free_state(prefetch_state_instance);
+}
+
+void SpeechToTextStream::start_listen() {
+	SpeechToText *speech_to_text = SpeechToText::get_singleton();
+	ERR_FAIL_NULL(speech_to_text);
+	if (is_running) {
+		return;
+	}
+	speech_to_text->_wake_from_hibernation(true);
+	// Apply pending model changes now rather than at the end of the frame.
+	speech_to_text->_reload_model_if_dirty();
+	resampler.reset();
+	decimate_carry_frames = 0;
+	if (ingest_vad && !restored_ingest) {
+		ingest_vad->reset();
+	}
+	ingest_echo_canceller.reset();
+	if (!restored_ingest) {
+		ingest_suppressor.reset();
+		endpoint.reset();
+	}
+	const bool was_restored = restored_ingest;
+	restored_ingest = false;
+	opus_decoder.reset();
+	// A new stream to the servers, it may land on another node.
+	remote.reset();
+	segmenter.reset();
+	endpoint_voiced_frames = 0;
+	endpoint_pause_count = 0;
+	endpoint_pending.store(false, std::memory_order_relaxed);
+	{
+		METERED_LOCK(s_mutex, "start_listen");
+		s_segment_markers.clear();
+		s_capture_markers.clear();
+	}
+	if (audio_queue.get_capacity() < audio_queue_seconds * SpeechToText::SPEECH_SETTING_SAMPLE_RATE || audio_queue.get_format() != audio_queue_format) {
+		audio_queue.set_capacity(audio_queue_seconds * SpeechToText::SPEECH_SETTING_SAMPLE_RATE, (AudioRingBuffer::SampleFormat)audio_queue_format);
+	}
+	// The queued audio of a restored state was speech.
+	voiced_queue_end.store(was_restored ? audio_queue.get_write_position() : 0, std::memory_order_relaxed);
+	_update_audio_queue_limit();
+	_init_params();
+	// Asleep until a wake phrase is heard, when there are any.
+	awake_until_msec.store(0, std::memory_order_relaxed);
+	if (realtime_ingest) {
+		_start_frontend_thread();
+	}
+	is_running = true;
+	t_last_iter = SimulationClock::get_ticks_msec();
+	speech_to_text->scheduler.add_stream(this);
+}
+
+void SpeechToTextStream::stop_listen() {
+	// Also aborts the pass in flight at the next graph node, see _abort_pass().
+	const bool was_running = is_running.exchange(false);
+	// Also lets its chunk blocked on a full queue go.
+	_stop_frontend_thread();
+	if (SpeechToText::get_singleton()) {
+		// Waits for the aborted pass, so a new one cannot overlap it on restart.
+		SpeechToText::get_singleton()->scheduler.remove_stream(this);
+		if (was_running) {
+			// Deferred, streams are also stopped from destructors.
+			SpeechToText::get_singleton()->call_deferred("_schedule_hibernation");
+		}
+	}
+}
+
+void scored_phrases::set_texts(const PackedStringArray &p_phrases) {
+	texts.clear();
+	for (int i = 0; i < p_phrases.size(); i++) {
+		texts.push_back(p_phrases[i].utf8().get_data());
+	}
+	tokens.clear();
+	context = nullptr;
+}
+
+void scored_phrases::tokenize(whisper_context *p_context) {
+	if (context == p_context) {
+		return;
+	}
+	tokens.clear();
+	std::vector<whisper_token> buffer(whisper_n_text_ctx(p_context));
+	for (const std::string &text : texts) {
+		// The first token of a transcription comes with its leading space.
+		const int n_tokens = whisper_tokenize(p_context, (" " + text).c_str(), buffer.data(), buffer.size());
+		if (n_tokens < 0) {
+			ERR_PRINT(vformat("Phrase \"%s\" is too long, it is never recognized.", String::utf8(text.c_str())));
+		}
+		tokens.emplace_back(buffer.begin(), buffer.begin() + MAX(0, n_tokens));
+	}
+	context = p_context;
+}
+
+int scored_phrases::score(whisper_context *p_context, whisper_state *p_state, const whisper_full_params &p_params, int p_lang_id, bool p_add_eot, std::vector<float> &r_log_probs) const {
+	std::vector<const whisper_token *> sequences;
+	std::vector<int> n_tokens;
+	for (const std::vector<whisper_token> &phrase_tokens : tokens) {
+		sequences.push_back(phrase_tokens.data());
+		n_tokens.push_back(phrase_tokens.size());
+	}
+	r_log_probs.resize(sequences.size());
+	return whisper_score_sequences_with_state(p_context, p_state, p_params.audio_ctx, p_lang_id, sequences.data(), n_tokens.data(), sequences.size(), p_add_eot, r_log_probs.data(), p_params.n_threads);
+}
+
+void SpeechToTextStream::set_command_phrases(const PackedStringArray &p_phrases) {
+	METERED_LOCK(s_mutex, "set_command_phrases");
+	command_phrases = p_phrases;
+	phrases_changed = true;
+}
+
+PackedStringArray SpeechToTextStream::get_command_phrases() {
+	METERED_LOCK(s_mutex, "get_command_phrases");
+	return command_phrases;
+}
+
+void SpeechToTextStream::set_wake_phrases(const PackedStringArray &p_phrases) {
+	METERED_LOCK(s_mutex, "set_wake_phrases");
+	wake_phrases = p_phrases;
+	phrases_changed = true;
+}
+
+PackedStringArray SpeechToTextStream::get_wake_phrases() {
+	METERED_LOCK(s_mutex, "get_wake_phrases");
+	return wake_phrases;
+}
+
+bool SpeechToTextStream::is_awake() {
+	METERED_LOCK(s_mutex, "is_awake");
+	return wake_phrases.is_empty() || SimulationClock::get_ticks_msec() < awake_until_msec.load(std::memory_order_relaxed);
+}
+
+PackedFloat32Array SpeechToTextStream::get_speech_probabilities() {
+	PackedFloat32Array probabilities;
+	probabilities.resize(speech_probabilities.size());
+	for (size_t i = 0; i < speech_probabilities.size(); i++) {
+		probabilities.set(i, speech_probabilities[i]);
+	}
+	return probabilities;
+}
+
+void SpeechToTextStream::set_resampler_quality(int p_quality) {
+	ERR_FAIL_INDEX(p_quality, AudioResampler::QUALITY_POLYPHASE + 1);
+	resampler.set_quality(p_quality);
+}
+
+int SpeechToTextStream::get_resampler_quality() {
+	return resampler.get_quality();
+}
+
+void SpeechToTextStream::set_audio_queue_seconds(float p_seconds) {
+	ERR_FAIL_COND(p_seconds <= 0.0f);
+	audio_queue_seconds = p_seconds;
+	// Resizing is not safe while the worker reads, it is applied on the next start_listen otherwise.
+	if (!is_running) {
+		audio_queue.set_capacity(audio_queue_seconds * SpeechToText::SPEECH_SETTING_SAMPLE_RATE, (AudioRingBuffer::SampleFormat)audio_queue_format);
+	}
+	_update_audio_queue_limit();
+}
+
+void SpeechToTextStream::set_audio_queue_format(int p_format) {
+	ERR_FAIL_INDEX(p_format, AudioRingBuffer::FORMAT_S16 + 1);
+	audio_queue_format = p_format;
+	// Same as the capacity, the queue is only rebuilt while the worker does not read it.
+	if (!is_running) {
+		audio_queue.set_capacity(audio_queue_seconds * SpeechToText::SPEECH_SETTING_SAMPLE_RATE, (AudioRingBuffer::SampleFormat)audio_queue_format);
+	}
+}
+
+void SpeechToTextStream::set_max_backlog_seconds(float p_seconds) {
+	max_backlog_seconds = MAX(0.0f, p_seconds);
+	_update_audio_queue_limit();
+}
+
+/* The limit can change while listening, unlike the capacity. */
+void SpeechToTextStream::_update_audio_queue_limit() {
+	const float seconds = max_backlog_seconds > 0.0f ? MIN(max_backlog_seconds, audio_queue_seconds) : audio_queue_seconds;
+	audio_queue.set_limit(seconds * SpeechToText::SPEECH_SETTING_SAMPLE_RATE);
+}
+
+void SpeechToTextStream::set_audio_queue_overflow_policy(int p_policy) {
+	ERR_FAIL_INDEX(p_policy, AudioRingBuffer::OVERFLOW_DROP_TO_MARK + 1);
+	audio_queue_overflow_policy = p_policy;
+}
+
+/**
+ * Add audio data in PCM f32 format. This is the single producer of the audio
+ * queue and must always be called from the same thread.
+ */
+void SpeechToTextStream::add_audio_buffer(PackedVector2Array buffer) {
+	TRACE_ZONE("add_audio_buffer");
+	if (recording.is_recording()) {
+		recording.write(buffer, AudioServer::get_singleton()->get_mix_rate());
+	}
+	_add_audio_buffer(buffer, 0);
+}
+
+/* add_audio_buffer at p_mix_rate, the one of a recording SpeechToTextBenchmark replays. */
+void SpeechToTextStream::_add_audio_buffer(const PackedVector2Array &p_buffer, uint32_t p_mix_rate, IngestChunk *r_deferred) {
+#ifdef REAL_T_IS_DOUBLE
+	_grow_scratch(stereo_scratch, 2 * p_buffer.size());
+	for (int64_t i = 0; i < p_buffer.size(); i++) {
+		stereo_scratch[2 * i] = p_buffer[i].x;
+		stereo_scratch[2 * i + 1] = p_buffer[i].y;
+	}
+	_ingest_stereo(stereo_scratch.data(), p_buffer.size(), true, p_mix_rate, r_deferred);
+#else
+	_ingest_stereo(reinterpret_cast<const float *>(p_buffer.ptr()), p_buffer.size(), true, p_mix_rate, r_deferred);
+#endif
+}
+
+Error SpeechToTextStream::start_recording(const String &p_path) {
+	return recording.start(p_path);
+}
+
+void SpeechToTextStream::stop_recording() {
+	recording.stop();
+}
+
+static PackedFloat32Array _to_float_array(const float *p_samples, size_t p_count) {
+	PackedFloat32Array array;
+	array.resize(p_count);
+	if (p_count > 0) {
+		memcpy(array.ptrw(), p_samples, p_count * sizeof(float));
+	}
+	return array;
+}
+
+static Dictionary _detector_state_to_dictionary(const VoiceActivityDetector::State &p_state) {
+	Dictionary state;
+	state["frame_energy"] = _to_float_array(p_state.frame_energy.data(), p_state.frame_energy.size());
+	state["frame_count"] = int64_t(p_state.frame_count);
+	state["frame_acc"] = p_state.frame_acc;
+	state["frame_fill"] = p_state.frame_fill;
+	state["cutoff"] = p_state.cutoff;
+	state["prev_out"] = p_state.prev_out;
+	state["has_prev"] = p_state.has_prev;
+	return state;
+}
+
+static VoiceActivityDetector::State _dictionary_to_detector_state(const Dictionary &p_state) {
+	VoiceActivityDetector::State state;
+	const PackedFloat32Array frame_energy = p_state.get("frame_energy", PackedFloat32Array());
+	state.frame_energy.assign(frame_energy.ptr(), frame_energy.ptr() + frame_energy.size());
+	state.frame_count = uint64_t(MAX(int64_t(0), int64_t(p_state.get("frame_count", 0))));
+	state.frame_acc = p_state.get("frame_acc", 0.0f);
+	state.frame_fill = p_state.get("frame_fill", 0);
+	state.cutoff = p_state.get("cutoff", 0.0f);
+	state.prev_out = p_state.get("prev_out", 0.0f);
+	state.has_prev = p_state.get("has_prev", false);
+	return state;
+}
+
+static String _lang_code(int p_lang_id) {
+	return p_lang_id >= 0 ? String(whisper_lang_str(p_lang_id)) : String();
+}
+
+static int _lang_id(const String &p_code) {
+	return p_code.is_empty() ? -1 : whisper_lang_id(p_code.utf8().get_data());
+}
+
+/**
+ * Stopped streams only, a pass or the producer would change the state while it is read.
+ * The resampler and the echo canceller start over, their history is a few milliseconds
+ * the new node relearns. The mel frames and the encoding of the open segment are not
+ * part of it either, the first pass computes them again from its audio.
+ */
+PackedByteArray SpeechToTextStream::serialize_state() {
+	ERR_FAIL_COND_V_MSG(is_running, PackedByteArray(), "Stop the stream with stop_listen before serializing its state.");
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	ERR_FAIL_NULL_V(speech_to_text_obj, PackedByteArray());
+	Dictionary state;
+	state["version"] = stream_state_version;
+	state["audio"] = _to_float_array(pcmf32.data(), pcmf32.size());
+	PackedFloat32Array queued_audio;
+	queued_audio.resize(audio_queue.size());
+	queued_audio.resize(audio_queue.peek(queued_audio.ptrw(), queued_audio.size()));
+	state["queued_audio"] = queued_audio;
+	PackedInt32Array tokens;
+	tokens.resize(committed_tokens.size());
+	for (size_t i = 0; i < committed_tokens.size(); i++) {
+		tokens.set(i, committed_tokens[i]);
+	}
+	state["committed_tokens"] = tokens;
+	state["segment_token_count"] = int64_t(segment_token_count);
+	{
+		// Token ids only carry over to a model with the same vocabulary.
+		std::shared_lock<std::shared_mutex> lock(speech_to_text_obj->context_mutex);
+		state["n_vocab"] = speech_to_text_obj->context_instance ? whisper_n_vocab(speech_to_text_obj->context_instance) : 0;
+	}
+	state["language"] = _lang_code(pinned_lang_id);
+	state["language_probability"] = pinned_lang_prob;
+	state["candidate_language"] = _lang_code(candidate_lang_id);
+	state["candidate_seconds"] = candidate_seconds;
+	if (ingest_vad) {
+		VadEngine::State vad_state;
+		ingest_vad->get_state(vad_state);
+		Dictionary ingest;
+		ingest["mode"] = ingest_vad_mode;
+		ingest["detector"] = _detector_state_to_dictionary(vad_state.detector);
+		ingest["noise_floor_db"] = vad_state.noise_floor_db;
+		ingest["probability"] = vad_state.probability;
+		ingest["has_noise_floor"] = vad_state.has_noise_floor;
+		state["ingest_vad"] = ingest;
+	}
+	VoiceActivityDetector::State vad_state;
+	vad.get_state(vad_state);
+	state["vad"] = _detector_state_to_dictionary(vad_state);
+	if (ingest_suppressor.is_active()) {
+		PackedFloat32Array suppressor;
+		suppressor.resize(NoiseSuppressor::STATE_SIZE);
+		ingest_suppressor.get_state(suppressor.ptrw());
+		state["noise_suppressor"] = suppressor;
+	}
+	state["pause_ms"] = endpoint.get_pause_ms();
+	return UtilityFunctions::var_to_bytes(state);
+}
+
+Error SpeechToTextStream::restore_state(const PackedByteArray &p_state) {
+	ERR_FAIL_COND_V_MSG(is_running, ERR_BUSY, "Stop the stream with stop_listen before restoring a state.");
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	ERR_FAIL_NULL_V(speech_to_text_obj, ERR_UNCONFIGURED);
+	const Variant parsed = UtilityFunctions::bytes_to_var(p_state);
+	ERR_FAIL_COND_V_MSG(parsed.get_type() != Variant::DICTIONARY, ERR_INVALID_DATA, "Not a serialized stream state.");
+	const Dictionary state = parsed;
+	const int version = state.get("version", 0);
+	ERR_FAIL_COND_V_MSG(version != stream_state_version, ERR_INVALID_DATA, vformat("Stream state version %d is not supported, expected %d.", version, stream_state_version));
+	const PackedFloat32Array audio = state.get("audio", PackedFloat32Array());
+	const PackedFloat32Array queued_audio = state.get("queued_audio", PackedFloat32Array());
+	const PackedInt32Array tokens = state.get("committed_tokens", PackedInt32Array());
+	const int n_vocab = state.get("n_vocab", 0);
+
+	// The encoder thread may still hold an encoding of the old segment.
+	_finish_prefetch();
+	prefetch_stage.store(PREFETCH_IDLE, std::memory_order_relaxed);
+	if (audio_queue.get_capacity() < audio_queue_seconds * SpeechToText::SPEECH_SETTING_SAMPLE_RATE || audio_queue.get_format() != audio_queue_format) {
+		audio_queue.set_capacity(audio_queue_seconds * SpeechToText::SPEECH_SETTING_SAMPLE_RATE, (AudioRingBuffer::SampleFormat)audio_queue_format);
+	}
+	audio_queue.clear();
+	pcmf32.assign(audio.ptr(), audio.size());
+	pcmf32_end_position = audio_queue.get_write_position();
+	audio_queue.write(queued_audio.ptr(), queued_audio.size(), AudioRingBuffer::OVERFLOW_DROP_OLDEST);
+	// Results of passes over the old segment.
+	iter_tokens.clear();
+	draft_tokens.clear();
+	agreement_history.clear();
+
+	committed_tokens.clear();
+	segment_token_count = 0;
+	{
+		std::shared_lock<std::shared_mutex> lock(speech_to_text_obj->context_mutex);
+		committed_tokens.assign(tokens.ptr(), tokens.ptr() + tokens.size());
+		segment_token_count = MIN(size_t(MAX(int64_t(0), int64_t(state.get("segment_token_count", 0)))), committed_tokens.size());
+		// The ids go to the decoder as its prompt. Without a model yet, the next pass checks them.
+		committed_tokens_n_vocab = 0;
+		restored_n_vocab = n_vocab;
+		if (speech_to_text_obj->context_instance) {
+			_check_committed_tokens(speech_to_text_obj->context_instance);
+		}
+		// The cached mel frames and encoding belong to the old audio.
+		if (state_instance) {
+			whisper_reset_state(state_instance);
+		}
+		if (draft_state_instance) {
+			whisper_reset_state(draft_state_instance);
+		}
+	}
+	pinned_lang_id = _lang_id(state.get("language", String()));
+	pinned_lang_prob = pinned_lang_id >= 0 ? float(state.get("language_probability", 0.0f)) : 0.0f;
+	candidate_lang_id = _lang_id(state.get("candidate_language", String()));
+	candidate_seconds = candidate_lang_id >= 0 ? float(state.get("candidate_seconds", 0.0f)) : 0.0f;
+
+	const Dictionary ingest = state.get("ingest_vad", Dictionary());
+	const int mode = ingest.get("mode", -1);
+	if (mode == VadEngine::MODE_ENERGY || mode == VadEngine::MODE_ADAPTIVE) {
+		if (!ingest_vad || ingest_vad_mode != mode) {
+			ingest_vad = VadEngine::create((VadEngine::Mode)mode, SpeechToText::SPEECH_SETTING_SAMPLE_RATE);
+			ingest_vad_mode = mode;
+		}
+		VadEngine::State vad_state;
+		vad_state.detector = _dictionary_to_detector_state(ingest.get("detector", Dictionary()));
+		vad_state.noise_floor_db = ingest.get("noise_floor_db", 0.0f);
+		vad_state.probability = ingest.get("probability", 0.0f);
+		vad_state.has_noise_floor = ingest.get("has_noise_floor", false);
+		if (!ingest_vad->set_state(vad_state)) {
+			WARN_PRINT("The ingest VAD state does not fit this build, the VAD starts over.");
+			ingest_vad->reset();
+		}
+	} else if (ingest_vad) {
+		ingest_vad->reset();
+	}
+	vad.reset();
+	if (!vad.set_state(_dictionary_to_detector_state(state.get("vad", Dictionary())))) {
+		WARN_PRINT("The VAD state of the open segment does not fit this build, it starts over.");
+	}
+	const PackedFloat32Array suppressor = state.get("noise_suppressor", PackedFloat32Array());
+	ingest_suppressor.reset();
+	if (suppressor.size() == NoiseSuppressor::STATE_SIZE) {
+		// Active from the first chunk on, which would reset a suppressor turned on by it.
+		const std::shared_ptr<const SpeechToTextParams> ingest_settings = speech_to_text_obj->_get_params_snapshot();
+		ingest_suppressor.set_noise_suppression(ingest_settings->noise_suppression);
+		ingest_suppressor.set_auto_gain(ingest_settings->auto_gain);
+		ingest_suppressor.set_state(suppressor.ptr());
+	}
+	endpoint.reset();
+	endpoint.set_pause_ms(state.get("pause_ms", endpoint.get_pause_ms()));
+	restored_ingest = true;
+	return OK;
+}
+
+/**
+ * Add mono audio at p_rate Hz, e.g. network audio. At 16 kHz it skips the
+ * resampler and is read in place. Same single producer as add_audio_buffer.
+ */
+void SpeechToTextStream::add_audio_mono_f32(const PackedFloat32Array &p_samples, int p_rate) {
+	TRACE_ZONE("add_audio_mono_f32");
+	ERR_FAIL_COND_MSG(p_rate <= 0, "The sample rate must be positive.");
+	_ingest_mono(p_samples.ptr(), p_samples.size(), p_rate, true);
+}
+
+/**
+ * Add interleaved 16-bit little endian PCM with p_channels channels at
+ * p_rate Hz, the channels are averaged while converting. A trailing partial
+ * frame is ignored. Same single producer as add_audio_buffer.
+ */
+void SpeechToTextStream::add_audio_pcm16(const PackedByteArray &p_pcm, int p_rate, int p_channels) {
+	TRACE_ZONE("add_audio_pcm16");
+	ERR_FAIL_COND_MSG(p_rate <= 0, "The sample rate must be positive.");
+	ERR_FAIL_COND_MSG(p_channels <= 0, "There must be at least one channel.");
+	const uint32_t frames = p_pcm.size() / (2 * p_channels);
+	_grow_scratch(ingest_scratch, frames);
+	audio_s16_downmix_to_f32(reinterpret_cast<const int16_t *>(p_pcm.ptr()), frames, p_channels, ingest_scratch.data());
+	_ingest_mono(ingest_scratch.data(), frames, p_rate, true);
+}
+
+/**
+ * Add one Opus packet, e.g. of a voice chat, decoded by libopus straight to
+ * 16 kHz mono so it skips the resampler. An empty packet stands for a lost
+ * one and is concealed. Same single producer as add_audio_buffer.
+ */
+Error SpeechToTextStream::add_audio_opus(const PackedByteArray &p_packet) {
+	TRACE_ZONE("add_audio_opus");
+	ERR_FAIL_COND_V_MSG(!OpusPacketDecoder::is_available(), ERR_UNAVAILABLE, "Opus decoding is not compiled in, build with opus=yes.");
+	ERR_FAIL_COND_V_MSG(!opus_decoder.setup(), ERR_CANT_CREATE, "Could not create the Opus decoder.");
+	_grow_scratch(ingest_scratch, OpusPacketDecoder::MAX_FRAMES);
+	const int frames = opus_decoder.decode(p_packet.ptr(), p_packet.size(), ingest_scratch.data());
+	ERR_FAIL_COND_V_MSG(frames < 0, ERR_INVALID_DATA, "Could not decode the Opus packet.");
+	_ingest_mono(ingest_scratch.data(), frames, SpeechToText::SPEECH_SETTING_SAMPLE_RATE, true);
+	return OK;
+}
+
+/**
+ * Downmix and resample interleaved stereo frames at the mix rate, then hand
+ * them to _ingest_speech(). Runs on the thread that produces the audio, the
+ * audio thread for AudioEffectWhisperCapture, which passes p_may_block =
+ * false so the blocking overflow policy drops the newest audio instead.
+ */
+void SpeechToTextStream::_ingest_stereo(const float *p_stereo, uint32_t p_frames, bool p_may_block, uint32_t p_mix_rate, IngestChunk *r_deferred) {
+	TRACE_ZONE("ingest");
+	const uint32_t buffer_len = p_frames;
+	const uint32_t mix_rate = p_mix_rate != 0 ? p_mix_rate : uint32_t(AudioServer::get_singleton()->get_mix_rate());
+	const uint32_t resampled_capacity = AudioResampler::get_max_output_frames(buffer_len, mix_rate, SpeechToText::SPEECH_SETTING_SAMPLE_RATE);
+
+	if (r_deferred == nullptr && _hand_off(p_stereo, buffer_len, true, mix_rate, p_may_block)) {
+		return;
+	}
+
+	const uint64_t ingest_started = SimulationClock::get_ticks_usec();
+	// Downmix and resample into the producer side scratch, the worker never touches it.
+	_grow_scratch(resample_scratch, resampled_capacity);
+	float *resampled = resample_scratch.data();
+	uint32_t result_size = buffer_len;
+	if (mix_rate == SpeechToText::SPEECH_SETTING_SAMPLE_RATE) {
+		audio_downmix_stereo(p_stereo, buffer_len, resampled);
+	} else if (mix_rate == 3 * SpeechToText::SPEECH_SETTING_SAMPLE_RATE && (resampler.get_quality() == SRC_ZERO_ORDER_HOLD || resampler.get_quality() == SRC_LINEAR)) {
+		// The low quality converters do not filter either, averaging 3 frames while downmixing is cheaper and aliases less.
+		result_size = _downmix_decimate3(p_stereo, buffer_len, resampled);
+	} else {
+		_grow_scratch(ingest_scratch, buffer_len);
+		audio_downmix_stereo(p_stereo, buffer_len, ingest_scratch.data());
+		// Speaker frame.
+		result_size = resampler.process(
+				ingest_scratch.data(), // Pointer to source buffer
+				buffer_len, // Number of source frames
+				mix_rate, // Source sample rate
+				SpeechToText::SPEECH_SETTING_SAMPLE_RATE, // Target sample rate
+				resampled,
+				resampled_capacity);
+	}
+	_ingest_speech(resampled, result_size, ingest_started, p_may_block, r_deferred);
+}
+
+/** Resample mono frames at p_rate, the 16 kHz of whisper is queued as it is. */
+void SpeechToTextStream::_ingest_mono(const float *p_samples, uint32_t p_frames, uint32_t p_rate, bool p_may_block, IngestChunk *r_deferred) {
+	TRACE_ZONE("ingest");
+	if (r_deferred == nullptr && _hand_off(p_samples, p_frames, false, p_rate, p_may_block)) {
+		return;
+	}
+	const uint64_t ingest_started = SimulationClock::get_ticks_usec();
+	if (p_rate == SpeechToText::SPEECH_SETTING_SAMPLE_RATE) {
+		_ingest_speech(p_samples, p_frames, ingest_started, p_may_block, r_deferred);
+		return;
+	}
+	const uint32_t resampled_capacity = AudioResampler::get_max_output_frames(p_frames, p_rate, SpeechToText::SPEECH_SETTING_SAMPLE_RATE);
+	_grow_scratch(resample_scratch, resampled_capacity);
+	const uint32_t result_size = resampler.process(p_samples, p_frames, p_rate, SpeechToText::SPEECH_SETTING_SAMPLE_RATE, resample_scratch.data(), resampled_capacity);
+	_ingest_speech(resample_scratch.data(), result_size, ingest_started, p_may_block, r_deferred);
+}
+
+/**
+ * Echo cancellation, noise suppression, VAD and segmenter on 16 kHz mono
+ * samples, then queue the voiced runs. p_samples is either resample_scratch,
+ * cleaned in place, or the read only buffer of the caller, copied there only
+ * when it needs cleaning. With r_deferred the chunk stops before the VAD and
+ * is left there for _detect_speech().
+ */
+void SpeechToTextStream::_ingest_speech(const float *p_samples, uint32_t p_count, uint64_t p_ingest_started, bool p_may_block, IngestChunk *r_deferred) {
+	SpeechToText *speech_to_text = SpeechToText::get_singleton();
+	ERR_FAIL_NULL(speech_to_text);
+	const uint64_t vad_started = SimulationClock::get_ticks_usec();
+	ingest_resample_usec.fetch_add(vad_started - p_ingest_started, std::memory_order_relaxed);
+
+	// One snapshot for the whole chunk, a setting changed meanwhile applies to the next one.
+	const std::shared_ptr<const SpeechToTextParams> ingest_settings = speech_to_text->_get_params_snapshot();
+	const float *resampled = p_samples;
+	const uint32_t result_size = p_count;
+	const bool was_cancelling = ingest_echo_canceller.is_enabled();
+	ingest_echo_canceller.set_enabled(ingest_settings->echo_cancellation);
+	if (ingest_echo_canceller.is_enabled()) {
+		if (!was_cancelling) {
+			// The filter learned the speakers and the delay of an older recording.
+			ingest_echo_canceller.reset();
+		}
+		if (p_samples != resample_scratch.data()) {
+			_grow_scratch(resample_scratch, p_count);
+			memcpy(resample_scratch.data(), p_samples, p_count * sizeof(float));
+		}
+		// Before the noise floor is tracked, the game's output is not steady noise to it.
+		ingest_echo_canceller.process(resample_scratch.data(), result_size, speech_to_text->echo_reference);
+		resampled = resample_scratch.data();
+	}
+	const bool was_suppressing = ingest_suppressor.is_active();
+	ingest_suppressor.set_noise_suppression(ingest_settings->noise_suppression);
+	ingest_suppressor.set_auto_gain(ingest_settings->auto_gain);
+	if (ingest_suppressor.is_active()) {
+		if (!was_suppressing) {
+			// Noise floor and gain of an older recording would be wrong for this one.
+			ingest_suppressor.reset();
+		}
+		if (resampled != resample_scratch.data()) {
+			_grow_scratch(resample_scratch, p_count);
+			memcpy(resample_scratch.data(), p_samples, p_count * sizeof(float));
+		}
+		ingest_suppressor.process(resample_scratch.data(), result_size);
+		resampled = resample_scratch.data();
+	}
+
+	const int vad_mode = ingest_settings->vad_mode;
+	if (!ingest_vad || ingest_vad_mode != vad_mode) {
+		ingest_vad = VadEngine::create((VadEngine::Mode)vad_mode, SpeechToText::SPEECH_SETTING_SAMPLE_RATE);
+		ingest_vad_mode = vad_mode;
+	}
+	ingest_vad->set_high_pass(ingest_settings->freq_thold);
+	IngestChunk chunk;
+	chunk.samples = resampled;
+	chunk.count = result_size;
+	// A chunk of the front-end thread was captured when it was handed over, which the latency counts from.
+	chunk.ingest_started = frontend_captured_usec != 0 ? frontend_captured_usec : p_ingest_started;
+	chunk.settings = ingest_settings;
+	ingest_vad_usec.fetch_add(SimulationClock::get_ticks_usec() - vad_started, std::memory_order_relaxed);
+	if (r_deferred != nullptr) {
+		*r_deferred = std::move(chunk);
+		return;
+	}
+	_detect_speech(chunk, p_may_block);
+}
+
+/**
+ * Give the high-pass of the VAD on p_chunk to audio_high_pass_batch, which
+ * fills p_chunk.filtered. False when the detector filters it itself: the
+ * filter is off, or its first sample after a reset passes unchanged.
+ */
+bool SpeechToTextStream::_get_high_pass_lane(IngestChunk &p_chunk, AudioHighPassLane &r_lane) {
+	VoiceActivityDetector &detector = ingest_vad->get_detector();
+	if (p_chunk.count == 0 || !detector.can_filter_ahead()) {
+		return false;
+	}
+	_grow_scratch(vad_filter_scratch, p_chunk.count);
+	r_lane.src = p_chunk.samples;
+	r_lane.dst = vad_filter_scratch.data();
+	r_lane.count = p_chunk.count;
+	r_lane.alpha = detector.get_high_pass_alpha();
+	r_lane.output = detector.get_high_pass_output();
+	p_chunk.filtered = vad_filter_scratch.data();
+	return true;
+}
+
+/** VAD and segmenter on a cleaned chunk, then queue the voiced runs. */
+void SpeechToTextStream::_detect_speech(const IngestChunk &p_chunk, bool p_may_block) {
+	SpeechToText *speech_to_text = SpeechToText::get_singleton();
+	const uint64_t vad_started = SimulationClock::get_ticks_usec();
+	const SpeechToTextParams *ingest_settings = p_chunk.settings.get();
+	const float *resampled = p_chunk.samples;
+	const uint32_t result_size = p_chunk.count;
+
+	// Only the voiced runs are queued, whisper never decodes the silence around them.
+	speech_probabilities.clear();
+	if (p_chunk.filtered != nullptr) {
+		ingest_vad->process(p_chunk.filtered, result_size, true, speech_probabilities);
+	} else {
+		ingest_vad->process(resampled, result_size, false, speech_probabilities);
+	}
+
+	segmenter.set_threshold(ingest_settings->speech_threshold);
+	segmenter.set_pre_roll_ms(ingest_settings->speech_pre_roll_ms);
+	segmenter.set_hang_over_ms(ingest_settings->speech_hang_over_ms);
+	voiced_scratch.clear();
+	segment_scratch.clear();
+	const uint64_t voiced_before = segmenter.get_voiced_frames();
+	segmenter.process(resampled, result_size, speech_probabilities.data(), speech_probabilities.size(), voiced_scratch, segment_scratch);
+	ingest_vad_usec.fetch_add(SimulationClock::get_ticks_usec() - vad_started, std::memory_order_relaxed);
+
+	endpoint.set_min_silence_ms(ingest_settings->endpoint_silence_ms);
+	endpoint.set_adaptive(ingest_settings->adaptive_endpointing);
+	endpoint.set_trigger_ms(ingest_settings->pass_trigger_ms);
+	wake_threshold_frames.store(size_t(endpoint.get_trigger_ms()) * SpeechToText::SPEECH_SETTING_SAMPLE_RATE / 1000, std::memory_order_relaxed);
+	if (segmenter.get_pause_count() != endpoint_pause_count) {
+		endpoint_pause_count = segmenter.get_pause_count();
+		endpoint.observe_pause(segmenter.get_last_pause_ms());
+	}
+	// There was speech since the last end, and the silence after it is long enough to end it too.
+	const bool is_endpoint = segmenter.get_voiced_frames() != endpoint_voiced_frames && segmenter.get_silence_ms() >= endpoint.get_silence_ms();
+	if (is_endpoint) {
+		endpoint_voiced_frames = segmenter.get_voiced_frames();
+	}
+	if (voiced_scratch.empty()) {
+		if (is_endpoint) {
+			_signal_endpoint();
+		}
+		return;
+	}
+	const uint64_t queue_position = audio_queue.get_write_position();
+	// The clean up stages hand out what they were given that much earlier.
+	const int stage_delay = (ingest_echo_canceller.is_enabled() ? EchoCanceller::LATENCY_SAMPLES : 0) + (ingest_suppressor.is_active() ? NoiseSuppressor::LATENCY_SAMPLES : 0);
+	{
+		METERED_LOCK(s_mutex, "_ingest_speech");
+		for (const SpeechSegmenter::Segment &segment : segment_scratch) {
+			s_segment_markers.push_back({ queue_position + segment.offset, segment.input_position });
+		}
+		// The last sample of the chunk was captured when it was given to the stream.
+		s_capture_markers.push_back({ segmenter.get_input_position(), p_chunk.ingest_started - uint64_t(stage_delay) * 1000000 / SpeechToText::SPEECH_SETTING_SAMPLE_RATE });
+		if (s_capture_markers.size() > max_capture_markers) {
+			// Passes that lag this far behind only get a later capture time.
+			s_capture_markers.pop_front();
+		}
+	}
+	if (!segment_scratch.empty()) {
+		// A backlog over the limit skips to the latest voiced run with the Skip To Latest Segment policy.
+		audio_queue.set_drop_mark(queue_position + segment_scratch.back().offset);
+	}
+	AudioRingBuffer::OverflowPolicy policy = (AudioRingBuffer::OverflowPolicy)audio_queue_overflow_policy;
+	if (!p_may_block && policy == AudioRingBuffer::OVERFLOW_BLOCK) {
+		policy = AudioRingBuffer::OVERFLOW_DROP_NEWEST;
+	}
+	audio_queue.write(voiced_scratch.data(), voiced_scratch.size(), policy, &is_running);
+	if (segmenter.get_voiced_frames() != voiced_before) {
+		// Before the pass is woken up, it reads the queue up to here.
+		voiced_queue_end.store(audio_queue.get_write_position(), std::memory_order_release);
+	}
+	if (is_endpoint) {
+		// After the write, the tail of the utterance is queued by then.
+		_signal_endpoint();
+	}
+	if (audio_queue.size() >= wake_threshold_frames) {
+		speech_to_text->scheduler.notify_ready(this);
+		if (prefetch_stage.load(std::memory_order_relaxed) == PREFETCH_QUEUED) {
+			// Without encoder_mutex, the encoder thread polls for a wakeup it missed.
+			encoder_cond.notify_one();
+		}
+	}
+}
+
+void SpeechToTextStream::_signal_endpoint() {
+	endpoint_pending.store(true, std::memory_order_release);
+	SpeechToText::get_singleton()->scheduler.notify_endpoint(this);
+}
+
+/** Fused downmix and 3:1 decimation, the up to 2 frames left over are kept for the next chunk. */
+uint32_t SpeechToTextStream::_downmix_decimate3(const float *p_stereo, uint32_t p_frames, float *p_dst) {
+	uint32_t written = 0;
+	if (decimate_carry_frames > 0) {
+		const uint32_t take = MIN(3 - decimate_carry_frames, p_frames);
+		memcpy(decimate_carry + 2 * decimate_carry_frames, p_stereo, take * 2 * sizeof(float));
+		decimate_carry_frames += take;
+		p_stereo += 2 * take;
+		p_frames -= take;
+		if (decimate_carry_frames < 3) {
+			return 0;
+		}
+		audio_downmix_decimate3(decimate_carry, 3, p_dst);
+		decimate_carry_frames = 0;
+		written = 1;
+	}
+	const uint32_t whole_frames = p_frames / 3 * 3;
+	audio_downmix_decimate3(p_stereo, whole_frames, p_dst + written);
+	written += whole_frames / 3;
+	decimate_carry_frames = p_frames - whole_frames;
+	memcpy(decimate_carry, p_stereo + 2 * whole_frames, decimate_carry_frames * 2 * sizeof(float));
+	return written;
+}
+
+/* Input position of a sample of the queue, with s_mutex held. */
+uint64_t SpeechToTextStream::_get_input_position_locked(uint64_t p_queue_position) const {
+	for (auto it = s_segment_markers.rbegin(); it != s_segment_markers.rend(); ++it) {
+		if (it->queue_position <= p_queue_position) {
+			return it->input_position + (p_queue_position - it->queue_position);
+		}
+	}
+	return p_queue_position;
+}
+
+/** Input time in seconds of a sample of pcmf32. */
+double SpeechToTextStream::_get_input_time(size_t p_pcmf32_index) {
+	const uint64_t queue_position = pcmf32_end_position - pcmf32.size() + p_pcmf32_index;
+	uint64_t input_position;
+	{
+		METERED_LOCK(s_mutex, "_get_input_time");
+		input_position = _get_input_position_locked(queue_position);
+	}
+	return double(input_position) / WHISPER_SAMPLE_RATE;
+}
+
+/** Time ticks when a sample of pcmf32 was captured, from the chunk it came in with. 0 if unknown. */
+int64_t SpeechToTextStream::_get_capture_usec(size_t p_pcmf32_index) {
+	const uint64_t queue_position = pcmf32_end_position - pcmf32.size() + p_pcmf32_index;
+	METERED_LOCK(s_mutex, "_get_capture_usec");
+	if (s_capture_markers.empty()) {
+		return 0;
+	}
+	const uint64_t input_position = _get_input_position_locked(queue_position);
+	// The first chunk that ended at or after the sample brought it.
+	auto marker = std::lower_bound(s_capture_markers.begin(), s_capture_markers.end(), input_position, [](const capture_marker &p_marker, uint64_t p_position) {
+		return p_marker.input_position < p_position;
+	});
+	if (marker == s_capture_markers.end()) {
+		return int64_t(s_capture_markers.back().usec);
+	}
+	// Samples earlier in the chunk were captured earlier by their distance to its end.
+	const uint64_t before_end_usec = (marker->input_position - input_position) * 1000000 / WHISPER_SAMPLE_RATE;
+	return int64_t(marker->usec - MIN(before_end_usec, marker->usec));
+}
+
+/* Where a result reaches the script, the end of its latency. */
+void SpeechToTextStream::_mark_delivered(const Ref<TranscriptionResult> &p_result, uint64_t p_now) {
+	p_result->delivery_usec = int64_t(p_now);
+	if (p_result->capture_usec > 0 && p_now > uint64_t(p_result->capture_usec)) {
+		const uint64_t latency = p_now - uint64_t(p_result->capture_usec);
+		latency_histogram.add(latency);
+		SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+		if (speech_to_text_obj) {
+			speech_to_text_obj->latency_histogram.add(latency);
+		}
+	}
+}
+
+/**
+ * Adaptive quality: a stream steps one QualityLevel down when its passes take
+ * longer than the audio they decode or its queue backs up, and one back up
+ * after a few passes with plenty of headroom. A hot device holds the level
+ * at least at the one of its ThermalMonitor state, so the stream backs off
+ * before the throttled clocks make it fall behind.
+ */
+static const float quality_rtf_behind = 1.0f;
+static const float quality_rtf_headroom = 0.5f;
+static const float quality_rtf_smoothing = 0.3f; // weight of the newest pass
+static const int quality_backlog_ms = 2000;
+static const int quality_settle_passes = 2;
+static const int quality_headroom_passes = 4;
+/* Lowest QualityLevel per ThermalMonitor::ThermalState. */
+static const int quality_thermal_floor[] = {
+	SpeechToTextStream::QUALITY_FULL,
+	SpeechToTextStream::QUALITY_FIT_AUDIO_CTX,
+	SpeechToTextStream::QUALITY_NO_FALLBACK,
+	SpeechToTextStream::QUALITY_NO_PARTIALS,
+};
+
+/**
+ * ### Reminders
+ *
+ * - Note that whisper designed to process audio in 30-second chunks, and
+ *   the execution time of processing smaller chunks may not be shorter.
+ * - The design of trigger and threshold allows inputing audio data at
+ *   arbitrary rates with zero config. Inspired by Assembly.ai's
+ *   real-time transcription API
+ *   (https://github.com/misraturp/Real-time-transcription-from-microphone/blob/main/speech_recognition.py)
+ */
+
+/** Start the listening session over with the current settings. */
+void SpeechToTextStream::_init_params() {
+	settings = SpeechToText::get_singleton()->_get_params_snapshot();
+	_apply_settings();
+
+	pcmf32_mel_offset += pcmf32.size();
+	pcmf32.clear();
+	iter_tokens.clear();
+	committed_tokens.clear();
+	segment_token_count = 0;
+	draft_tokens.clear();
+	agreement_history.clear();
+	pinned_lang_id = -1;
+	candidate_lang_id = -1;
+	candidate_seconds = 0.0f;
+	pass_restart = false;
+	quality_level.store(QUALITY_FULL, std::memory_order_relaxed);
+	quality_rtf = 0.0f;
+	quality_settle_left = 0;
+	quality_headroom_count = 0;
+	quality_skipped_samples = 0;
+	reported_dropped_frames = audio_queue.get_dropped_frames();
+	vad.reset();
+	mel_vad.reset();
+}
+
+/** whisper_params from the settings snapshot, the same for every pass until a setting changes. */
+void SpeechToTextStream::_apply_settings() {
+	whisper_params = whisper_full_default_params(whisper_sampling_strategy(settings->sampling_strategy));
+	// See here for example https://github.com/ggerganov/whisper.cpp/blob/master/examples/stream/stream.cpp#L302
+	whisper_params.max_len = 0;
+	whisper_params.print_progress = false;
+	whisper_params.print_special = false;
+	whisper_params.print_realtime = false;
+	// This is set later on based on how much frames we can process
+	whisper_params.duration_ms = 0;
+	whisper_params.print_timestamps = false;
+	whisper_params.translate = settings->translate;
+	whisper_params.single_segment = false;
+	whisper_params.no_timestamps = false;
+	whisper_params.token_timestamps = settings->token_timestamps;
+	whisper_params.tdrz_enable = settings->speaker_turns;
+	whisper_params.max_tokens = settings->max_tokens;
+	whisper_params.language = settings->language.c_str();
+	whisper_params.n_threads = settings->n_threads;
+	whisper_params.speed_up = settings->speed_up;
+	whisper_params.prompt_tokens = nullptr;
+	whisper_params.prompt_n_tokens = 0;
+	whisper_params.suppress_non_speech_tokens = true;
+	whisper_params.suppress_blank = true;
+	whisper_params.entropy_thold = settings->entropy_threshold;
+	whisper_params.temperature = 0.0;
+	whisper_params.temperature_inc = settings->no_fallback ? 0.0f : settings->temperature_inc;
+	whisper_params.max_fallbacks = settings->max_fallbacks;
+	whisper_params.beam_search.beam_size = settings->beam_size;
+	whisper_params.greedy.best_of = settings->best_of;
+	whisper_params.decode_budget_ms = settings->decode_budget_ms;
+	whisper_params.repetition_limit = settings->repetition_limit;
+	// The contexts only have a subset with prune_vocabulary, for the language of the passes.
+	whisper_params.vocab_subset = true;
+	whisper_params.no_context = true;
+
+	/**
+	 * Experimental optimization: Reduce audio_ctx to 15s (half of the chunk
+	 * size whisper is designed for) to speed up 2x.
+	 * https://github.com/ggerganov/whisper.cpp/issues/137#issuecomment-1318412267
+	 * With dynamic_audio_ctx this is recomputed from the buffer length on
+	 * every iteration.
+	 */
+	whisper_params.audio_ctx = settings->audio_ctx_max;
+}
+
+/* Take the settings published since the last pass. Returns whether they changed. */
+bool SpeechToTextStream::_refresh_settings() {
+	std::shared_ptr<const SpeechToTextParams> latest = SpeechToText::get_singleton()->_get_params_snapshot();
+	if (latest == settings) {
+		return false;
+	}
+	settings = std::move(latest);
+	_apply_settings();
+	return true;
+}
+
+/** Step the quality level of the next pass, from the passes so far and p_backlog_frames of audio waiting in the queue. */
+void SpeechToTextStream::_update_quality_level(size_t p_backlog_frames) {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	int level = quality_level.load(std::memory_order_relaxed);
+	if (!speech_to_text_obj->adaptive_quality) {
+		if (level != QUALITY_FULL) {
+			quality_level.store(QUALITY_FULL, std::memory_order_relaxed);
+		}
+		return;
+	}
+	const int thermal_floor = quality_thermal_floor[ThermalMonitor::get_state()];
+	if (level < thermal_floor) {
+		quality_headroom_count = 0;
+		quality_settle_left = quality_settle_passes;
+		quality_level.store(thermal_floor, std::memory_order_relaxed);
+		return;
+	}
+	if (quality_settle_left > 0) {
+		quality_settle_left--;
+		return;
+	}
+	const bool has_draft_model = speech_to_text_obj->draft_context_instance != nullptr;
+	const bool is_behind = quality_rtf > quality_rtf_behind || p_backlog_frames > size_t(quality_backlog_ms) * WHISPER_SAMPLE_RATE / 1000;
+	const bool has_headroom = quality_rtf < quality_rtf_headroom && p_backlog_frames < wake_threshold_frames;
+	if (is_behind && level < QUALITY_MAX) {
+		level++;
+		if (level == QUALITY_DRAFT_MODEL && !has_draft_model) {
+			level++;
+		}
+	} else if (has_headroom && level > thermal_floor && ++quality_headroom_count >= quality_headroom_passes) {
+		level--;
+		if (level == QUALITY_DRAFT_MODEL && !has_draft_model) {
+			level--;
+		}
+	} else {
+		if (!has_headroom) {
+			quality_headroom_count = 0;
+		}
+		return;
+	}
+	quality_headroom_count = 0;
+	quality_settle_left = quality_settle_passes;
+	quality_level.store(level, std::memory_order_relaxed);
+}
+
+/* audio_ctx of QUALITY_FIT_AUDIO_CTX for p_n_samples, at most p_audio_ctx. */
+int SpeechToTextStream::_fit_audio_ctx(size_t p_n_samples, int p_audio_ctx, whisper_context *p_context) const {
+	const int samples_per_ctx = 2 * WHISPER_HOP_LENGTH;
+	const int granularity = MAX(1, settings->audio_ctx_granularity);
+	int audio_ctx = (p_n_samples + samples_per_ctx - 1) / samples_per_ctx;
+	audio_ctx = MAX(granularity, (audio_ctx + granularity - 1) / granularity * granularity);
+	const int max_audio_ctx = p_audio_ctx > 0 ? p_audio_ctx : whisper_n_audio_ctx(p_context);
+	return MIN(audio_ctx, max_audio_ctx);
+}
+
+/** Give up what the quality level says on pass_params, which p_context decodes. */
+void SpeechToTextStream::_apply_quality_level(whisper_context *p_context) {
+	const int level = quality_level.load(std::memory_order_relaxed);
+	if (level >= QUALITY_FIT_AUDIO_CTX) {
+		pass_params.audio_ctx = _fit_audio_ctx(_encoded_samples(pcmf32.size(), pass_params.speed_up), pass_params.audio_ctx, p_context);
+	}
+	if (level >= QUALITY_FEWER_TOKENS) {
+		pass_params.max_tokens = pass_params.max_tokens > 0 ? MAX(8, pass_params.max_tokens / 2) : 32;
+	}
+	if (level >= QUALITY_NO_FALLBACK) {
+		// Greedy without fallbacks is one decoder for the whole pass.
+		pass_params.temperature_inc = 0.0f;
+		pass_params.strategy = WHISPER_SAMPLING_GREEDY;
+	}
+}
+
+/* A state of the main model, with the OpenVINO or NNAPI encoder when one is set. Call with the context lock held. */
+whisper_state *SpeechToTextStream::_create_state(bool &r_encoder_offloaded) {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	// The context only holds the weights, the decoding buffers live in the state.
+	whisper_state *state = whisper_init_state(speech_to_text_obj->context_instance);
+	if (!state) {
+		ERR_PRINT("Failed to create whisper state");
+		return nullptr;
+	}
+	const std::string &openvino_path = settings->openvino_encoder_path;
+	if (!openvino_path.empty()) {
+		// Compiled blobs are cached, the first compile for a GPU or NPU takes a while.
+		const std::string cache_dir = (OS::get_singleton()->get_user_data_dir() + "/openvino_cache").utf8().get_data();
+		if (whisper_ctx_init_openvino_encoder_with_state(speech_to_text_obj->context_instance, state, openvino_path.c_str(), settings->openvino_device.c_str(), cache_dir.c_str()) != 0) {
+			ERR_PRINT(String("Failed to load the OpenVINO encoder ") + openvino_path.c_str() + ", encoding with ggml instead.");
+		}
+	}
+	const std::string &nnapi_path = settings->nnapi_encoder_path;
+	if (!nnapi_path.empty() && !whisper_is_encoder_external_with_state(state)) {
+		// NNAPI keeps the compilation for the device there, it has to exist.
+		const String cache_dir = OS::get_singleton()->get_user_data_dir() + "/nnapi_cache";
+		DirAccess::make_dir_recursive_absolute(cache_dir);
+		const char *accelerator = settings->nnapi_accelerator.empty() ? nullptr : settings->nnapi_accelerator.c_str();
+		if (whisper_ctx_init_nnapi_encoder_with_state(speech_to_text_obj->context_instance, state, nnapi_path.c_str(), accelerator, cache_dir.utf8().get_data()) != 0) {
+			ERR_PRINT(String("Failed to load the NNAPI encoder ") + nnapi_path.c_str() + ", encoding with ggml instead.");
+		}
+	}
+	// Builds with coreml=yes already loaded the .mlmodelc next to the model, when there is one.
+	r_encoder_offloaded = whisper_is_encoder_external_with_state(state);
+	return state;
+}
+
+/**
+ * Read the queued audio and set up the parameters of one decoding pass. The
+ * caller holds the context lock until _finish_pass() returns. Returns false
+ * when there is nothing to decode with.
+ */
+bool SpeechToTextStream::_begin_pass(bool p_close_segment) {
+	TRACE_ZONE("begin_pass");
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	_update_quality_level(audio_queue.size());
+	const uint64_t dropped_frames = audio_queue.get_dropped_frames();
+	if (dropped_frames > reported_dropped_frames) {
+		const float rate = SpeechToText::SPEECH_SETTING_SAMPLE_RATE;
+		call_deferred("emit_signal", "audio_dropped", (dropped_frames - reported_dropped_frames) / rate, dropped_frames / rate);
+		reported_dropped_frames = dropped_frames;
+	}
+	if (audio_queue.size() > 2 * _get_iter_threshold_samples()) {
+		WARN_PRINT("Too much audio is going to be processed, result may not come out in real time");
+		speech_to_text_obj->backlog_warnings.fetch_add(1, std::memory_order_relaxed);
+	}
+	// Properties set since the last pass apply from this one on, without a restart of the stream.
+	const bool settings_changed = _refresh_settings();
+	// A prefetch only fits when the last pass left pcmf32 as it was, the pass then takes the audio that was encoded.
+	bool use_prefetch = false;
+	if (prefetch_stage.load(std::memory_order_acquire) == PREFETCH_READY) {
+		prefetch_stage.store(PREFETCH_IDLE, std::memory_order_relaxed);
+		const size_t queued = audio_queue.size();
+		// A restart for staleness would throw it away right after it began.
+		const bool is_stale = speech_to_text_obj->restart_stale_passes && !pass_restart.load(std::memory_order_relaxed) && queued - prefetch_new_samples >= wake_threshold_frames;
+		use_prefetch = pcmf32.size() == prefetch_base_size && pcmf32_end_position == prefetch_base_end && queued >= prefetch_new_samples && !is_stale && !settings_changed;
+	}
+	if (p_close_segment) {
+		// Ends the utterance the producer saw end, a later one is flagged again.
+		endpoint_pending.store(false, std::memory_order_relaxed);
+	}
+	uint64_t read_position = 0;
+	// A backlog can make the segment longer, but the usual one never grows the storage.
+	pcmf32.reserve(_get_iter_threshold_samples());
+	const size_t n_read_max = MIN(audio_queue.size(), use_prefetch ? prefetch_new_samples : SIZE_MAX);
+	const size_t n_new_samples = audio_queue.read(pcmf32.reserve_back(n_read_max), n_read_max, &read_position);
+	pcmf32.commit_back(n_new_samples);
+	if (n_new_samples > 0) {
+		pcmf32_end_position = read_position + n_new_samples;
+	}
+	use_prefetch = use_prefetch && n_new_samples == prefetch_new_samples && read_position == prefetch_read_position;
+	pass_close_segment = p_close_segment;
+	{
+		METERED_LOCK(s_mutex, "_begin_pass");
+		if (phrases_changed) {
+			command_set.set_texts(command_phrases);
+			wake_set.set_texts(wake_phrases);
+			phrases_changed = false;
+		}
+	}
+	pass_wake = !wake_set.texts.empty() && SimulationClock::get_ticks_msec() >= awake_until_msec.load(std::memory_order_relaxed);
+	pass_command = !pass_wake && !command_set.texts.empty();
+	// Phrase passes and skipped partials decide before there is a mel, they keep the VAD on the samples.
+	const bool was_mel_vad = pass_mel_vad;
+	pass_mel_vad = settings->mel_vad && !pass_command && !pass_wake && quality_level.load(std::memory_order_relaxed) < QUALITY_NO_PARTIALS;
+	if (pass_mel_vad) {
+		// Fed once the mel of the pass is computed, until then it decides on the audio of the previous passes.
+		mel_vad.set_high_pass(settings->freq_thold);
+		if (!was_mel_vad) {
+			// The whole buffer is new to it then, the mel of the pass has all of it.
+			mel_vad.reset();
+		}
+	} else {
+		vad.set_high_pass(settings->freq_thold);
+		if (was_mel_vad) {
+			// Its frames are from before the passes on the mel, the window is taken in again.
+			vad.reset();
+			const size_t n_window = MIN(pcmf32.size(), size_t(n_samples_vad_window));
+			vad.push(pcmf32.data() + pcmf32.size() - n_window, n_window);
+		} else {
+			// Only the new samples go through the VAD, its filter state and frame energies carry over.
+			vad.push(pcmf32.data() + pcmf32.size() - n_new_samples, n_new_samples);
+		}
+	}
+	const bool may_commit = p_close_segment || pcmf32.size() > _get_iter_threshold_samples() * 0.66 || ((int)pcmf32.size() >= n_samples_vad_window && _is_speech_ending(settings->vad_thold));
+	if (!may_commit && !endpoint_pending.load(std::memory_order_acquire) && voiced_queue_end.load(std::memory_order_acquire) <= pcmf32_end_position - n_new_samples) {
+		// Only hang-over or silence came in, the partial would be the last one again. The audio stays for the next pass.
+		quality_skipped_samples += n_new_samples;
+		return false;
+	}
+
+	pass_remote = !settings->remote_inference_url.empty() && !pass_command && !pass_wake && SimulationClock::get_ticks_msec() >= remote_paused_until_msec;
+	if (pass_remote) {
+		if (!may_commit) {
+			// The server gets whole utterances, partial results would cost a round trip each.
+			return false;
+		}
+		// Nothing is computed locally, the local model is only needed once the server fails.
+		pass_time_started = SimulationClock::get_ticks_msec();
+		pass_new_samples = n_new_samples;
+		buffered_frames.store(pcmf32.size(), std::memory_order_relaxed);
+		return true;
+	}
+
+	if (!speech_to_text_obj->context_instance) {
+		if (!speech_to_text_obj->is_model_loading) {
+			ERR_PRINT("Context instance is null");
+		}
+		return false;
+	}
+	if ((pass_command || pass_wake) && !may_commit) {
+		// Phrases are matched once they were said, there are no partial results.
+		return false;
+	}
+	if (!may_commit && quality_level.load(std::memory_order_relaxed) >= QUALITY_NO_PARTIALS) {
+		// The audio stays in pcmf32 for the next pass that may commit it.
+		quality_skipped_samples += n_new_samples;
+		return false;
+	}
+	if (!state_instance) {
+		state_instance = _create_state(state_encoder_offloaded);
+		if (!state_instance) {
+			return false;
+		}
+	}
+	pass_time_started = SimulationClock::get_ticks_msec();
+	whisper_params.duration_ms = pcmf32.size() * 1000.0f / WHISPER_SAMPLE_RATE;
+	pass_params = whisper_params;
+	pass_params.language = settings->language.c_str();
+	pass_auto_language = settings->language == "auto";
+	pass_new_samples = n_new_samples;
+	buffered_frames.store(pcmf32.size(), std::memory_order_relaxed);
+	pass_language_pinned = false;
+	if (!pass_auto_language || settings->language_pin_seconds <= 0.0f) {
+		pinned_lang_id = -1;
+		candidate_lang_id = -1;
+		candidate_seconds = 0.0f;
+	} else if (pinned_lang_id >= 0) {
+		// No detection, which also keeps the pass batchable.
+		pass_params.language = whisper_lang_str(pinned_lang_id);
+		pass_language_pinned = true;
+	}
+	// settings keeps the ids alive for the pass.
+	pass_params.detect_lang_ids = settings->allowed_lang_ids.data();
+	pass_params.n_detect_lang_ids = settings->allowed_lang_ids.size();
+	if (pass_auto_language && !pass_language_pinned && settings->allowed_lang_ids.size() == 1) {
+		// Nothing to choose from.
+		pass_params.language = whisper_lang_str(settings->allowed_lang_ids[0]);
+	}
+	pass_params.n_threads = speech_to_text_obj->_get_threads_per_decode();
+	_check_committed_tokens(speech_to_text_obj->context_instance);
+	// Only the uncommitted tail is in pcmf32 in incremental mode, its committed text conditions the decoder instead.
+	const size_t n_context = MIN(committed_tokens.size(), MAX(size_t(settings->prompt_context_tokens), settings->incremental_decoding ? segment_token_count : size_t(0)));
+	const std::vector<whisper_token> &initial_ids = speech_to_text_obj->initial_prompt_ids;
+	// Both fit whisper_full's half of the text context, initial_prompt is at most a quarter of it.
+	const size_t n_initial = MIN(initial_ids.size(), size_t(whisper_n_text_ctx(speech_to_text_obj->context_instance) / 2) - n_context);
+	pass_prompt_tokens.assign(initial_ids.end() - n_initial, initial_ids.end());
+	pass_prompt_tokens.insert(pass_prompt_tokens.end(), committed_tokens.end() - n_context, committed_tokens.end());
+	if (!pass_prompt_tokens.empty()) {
+		// Prefilled in one batch before the first token is sampled.
+		pass_params.prompt_tokens = pass_prompt_tokens.data();
+		pass_params.prompt_n_tokens = pass_prompt_tokens.size();
+	}
+	if (settings->draft_previous_tokens && !draft_tokens.empty()) {
+		// The buffer only grew, so the last result is checked in one batch instead of decoded token by token.
+		pass_params.draft_tokens = draft_tokens.data();
+		pass_params.draft_n_tokens = draft_tokens.size();
+	}
+	if (settings->dynamic_audio_ctx) {
+		pass_params.audio_ctx = speech_to_text_obj->_audio_ctx_for_samples(_encoded_samples(pcmf32.size(), pass_params.speed_up));
+	}
+	pass_generation = speech_to_text_obj->cancel_generation.load(std::memory_order_relaxed);
+	pass_is_restart = pass_restart.exchange(false);
+	pass_params.abort_callback = &SpeechToTextStream::_abort_pass;
+	pass_params.abort_callback_user_data = this;
+	pass_params.encoder_begin_callback = &SpeechToTextStream::_encoder_begin;
+	pass_params.encoder_begin_callback_user_data = this;
+	pass_params.logits_filter_callback = nullptr;
+	pass_params.logits_filter_callback_user_data = nullptr;
+	// A pass that cannot commit text only reports a partial result, the draft model is good enough for it.
+	whisper_context *draft_context = speech_to_text_obj->draft_context_instance;
+	// The wake phrases are spotted with the draft model too, that runs whenever someone speaks.
+	pass_draft = draft_context != nullptr && (pass_wake || !may_commit);
+	if (draft_context != nullptr && may_commit && !pass_command && !pass_wake && quality_level.load(std::memory_order_relaxed) >= QUALITY_DRAFT_MODEL) {
+		// Committed tokens are fed back as prompt to the language model, so only with the same vocabulary.
+		pass_draft = whisper_n_vocab(draft_context) == whisper_n_vocab(speech_to_text_obj->context_instance);
+	}
+	if (pass_draft && !draft_state_instance) {
+		draft_state_instance = whisper_init_state(draft_context);
+		if (!draft_state_instance) {
+			ERR_PRINT("Failed to create the draft whisper state");
+			pass_draft = false;
+		}
+	}
+	_apply_quality_level(pass_draft ? draft_context : speech_to_text_obj->context_instance);
+	pass_params.no_timestamps = whisper_model_is_distilled(pass_draft ? draft_context : speech_to_text_obj->context_instance);
+	if (!may_commit && !pass_draft && !pass_command && !pass_wake) {
+		// The next pass that may commit encodes this audio again with all layers.
+		pass_params.encoder_layers = settings->partial_encoder_layers;
+	}
+	if (pass_draft ? whisper_is_encoder_external_with_state(draft_state_instance) : state_encoder_offloaded) {
+		// The Core ML and OpenVINO models have a fixed 30 second input.
+		pass_params.audio_ctx = 0;
+	}
+	// Characters, not tokens, so the draft model decodes with the same grammar.
+	speech_to_text_obj->_apply_grammar(pass_params);
+	const std::vector<whisper_token> &suppress_ids = pass_draft ? speech_to_text_obj->draft_suppress_ids : speech_to_text_obj->suppress_ids;
+	if (!suppress_ids.empty()) {
+		// The ids stay valid while the context lock is held, i.e. for the whole pass.
+		pass_params.logits_filter_callback = &SpeechToTextStream::_filter_logits;
+		pass_params.logits_filter_callback_user_data = (void *)&suppress_ids;
+	}
+	if (stream_tokens.load(std::memory_order_relaxed)) {
+		pass_params.new_token_callback = &SpeechToTextStream::_on_new_tokens;
+		pass_params.new_token_callback_user_data = this;
+		streamed_text_size = 0;
+	}
+	if (pass_draft) {
+		pass_params.n_threads = speech_to_text_obj->_get_threads_per_decode(true);
+		if (whisper_n_vocab(draft_context) != whisper_n_vocab(speech_to_text_obj->context_instance)) {
+			// Token ids only carry over between models with the same vocabulary.
+			pass_params.prompt_tokens = nullptr;
+			pass_params.prompt_n_tokens = 0;
+			pass_params.draft_tokens = nullptr;
+			pass_params.draft_n_tokens = 0;
+		}
+		whisper_set_speed_up_with_state(draft_state_instance, pass_params.speed_up);
+		if (whisper_pcm_to_mel_cached_with_state(draft_context, draft_state_instance, pcmf32.data(), pcmf32.size(), pcmf32_mel_offset, pass_params.n_threads) != 0) {
+			ERR_PRINT("Failed to compute the mel spectrogram");
+		}
+		if (pass_mel_vad) {
+			mel_vad.push(draft_context, draft_state_instance);
+		}
+		pass_pre_encoded = false;
+		if (pass_wake) {
+			wake_set.tokenize(draft_context);
+		}
+		return true;
+	}
+	if (use_prefetch && !pass_command && !pass_wake && pass_params.audio_ctx == prefetch_audio_ctx) {
+		// Same samples, the encoder thread already did the mel and the encoder.
+		pcmf32.swap(prefetch_pcmf32);
+		std::swap(state_instance, prefetch_state_instance);
+		std::swap(state_encoder_offloaded, prefetch_encoder_offloaded);
+		pass_pre_encoded = true;
+		if (pass_mel_vad) {
+			mel_vad.push(speech_to_text_obj->context_instance, state_instance);
+		}
+		return true;
+	}
+	// Only the frames of the new audio are computed, whisper_full and the batched encoder then reuse the mel.
+	whisper_set_speed_up_with_state(state_instance, pass_params.speed_up);
+	if (whisper_pcm_to_mel_cached_with_state(speech_to_text_obj->context_instance, state_instance, pcmf32.data(), pcmf32.size(), pcmf32_mel_offset, pass_params.n_threads) != 0) {
+		ERR_PRINT("Failed to compute the mel spectrogram");
+	}
+	if (pass_mel_vad) {
+		mel_vad.push(speech_to_text_obj->context_instance, state_instance);
+	}
+	pass_pre_encoded = false;
+	if (pass_command || pass_wake) {
+		(pass_wake ? wake_set : command_set).tokenize(speech_to_text_obj->context_instance);
+		return true;
+	}
+	// Chunks of the buffer that did not change since the last pass keep their encoder output.
+	const int samples_per_ctx = 2 * WHISPER_HOP_LENGTH;
+	const int chunk_ctx = settings->encoder_chunk_ms * WHISPER_SAMPLE_RATE / (1000 * samples_per_ctx);
+	if (chunk_ctx > 0 && pcmf32.size() >= WHISPER_SAMPLE_RATE && !state_encoder_offloaded) {
+		const int overlap_ctx = settings->encoder_overlap_ms * WHISPER_SAMPLE_RATE / (1000 * samples_per_ctx);
+		const int ret = whisper_encode_chunked_with_state(speech_to_text_obj->context_instance, state_instance, pcmf32.data(), pcmf32.size(), pass_params.audio_ctx, chunk_ctx, overlap_ctx, pass_params.n_threads);
+		if (ret != 0) {
+			ERR_PRINT("Failed to encode the audio in chunks, returned " + rtos(ret));
+		}
+		pass_pre_encoded = ret == 0;
+	}
+	return true;
+}
+
+/**
+ * Hand the encoder thread the buffer of the pass that just began, so it
+ * encodes the next one while this one decodes. Only for passes that leave
+ * pcmf32 as it is, since the next pass must start from the same samples.
+ * Returns whether the encoder thread took it, _finish_prefetch() must follow.
+ */
+bool SpeechToTextStream::_start_prefetch() {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	if (!settings->pipelined_encoding || pass_remote || pass_command || pass_wake || pass_close_segment || pcmf32.size() > _get_iter_threshold_samples() * 0.66) {
+		return false;
+	}
+	if (prefetch_stage.load(std::memory_order_relaxed) != PREFETCH_IDLE) {
+		return false;
+	}
+	if (!prefetch_state_instance) {
+		prefetch_state_instance = _create_state(prefetch_encoder_offloaded);
+		_update_state_memory();
+		if (!prefetch_state_instance) {
+			return false;
+		}
+	}
+	if (!encoder_thread.joinable()) {
+		encoder_thread = std::thread(&SpeechToTextStream::_encoder_loop, this);
+	}
+	prefetch_pcmf32.assign(pcmf32.data(), pcmf32.size());
+	prefetch_base_size = pcmf32.size();
+	prefetch_base_end = pcmf32_end_position;
+	prefetch_mel_offset = pcmf32_mel_offset;
+	prefetch_n_threads = speech_to_text_obj->_get_threads_per_decode();
+	prefetch_cancel.store(false, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(encoder_mutex);
+		prefetch_stage.store(PREFETCH_QUEUED, std::memory_order_release);
+	}
+	encoder_cond.notify_all();
+	return true;
+}
+
+/* Wait for the encoder thread before the pass gives up the context lock, the encoding it has going is kept. */
+void SpeechToTextStream::_finish_prefetch() {
+	TRACE_ZONE("prefetch_wait");
+	std::unique_lock<std::mutex> lock(encoder_mutex);
+	prefetch_cancel.store(true, std::memory_order_relaxed);
+	encoder_cond.notify_all();
+	encoder_cond.wait(lock, [this] { return prefetch_stage.load(std::memory_order_acquire) != PREFETCH_QUEUED; });
+}
+
+/* Encoder thread side, appends the queued audio to prefetch_pcmf32 and encodes it. Returns whether it did. */
+bool SpeechToTextStream::_encode_prefetch() {
+	TRACE_ZONE("prefetch_encode");
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	whisper_context *context = speech_to_text_obj->context_instance;
+	const size_t n_peek_max = audio_queue.size();
+	prefetch_new_samples = audio_queue.peek(prefetch_pcmf32.reserve_back(n_peek_max), n_peek_max, &prefetch_read_position);
+	prefetch_pcmf32.commit_back(prefetch_new_samples);
+	if (prefetch_new_samples == 0 || prefetch_pcmf32.size() < WHISPER_SAMPLE_RATE) {
+		return false;
+	}
+	// What _begin_pass() will decode the buffer with, a pass with another audio_ctx encodes again.
+	const size_t n_encoded_samples = _encoded_samples(prefetch_pcmf32.size(), whisper_params.speed_up);
+	int audio_ctx = settings->dynamic_audio_ctx ? speech_to_text_obj->_audio_ctx_for_samples(n_encoded_samples) : whisper_params.audio_ctx;
+	if (quality_level.load(std::memory_order_relaxed) >= QUALITY_FIT_AUDIO_CTX) {
+		audio_ctx = _fit_audio_ctx(n_encoded_samples, audio_ctx, context);
+	}
+	if (prefetch_encoder_offloaded) {
+		audio_ctx = 0;
+	}
+	prefetch_audio_ctx = audio_ctx;
+	whisper_set_speed_up_with_state(prefetch_state_instance, whisper_params.speed_up);
+	if (whisper_pcm_to_mel_cached_with_state(context, prefetch_state_instance, prefetch_pcmf32.data(), prefetch_pcmf32.size(), prefetch_mel_offset, prefetch_n_threads) != 0) {
+		ERR_PRINT("Failed to compute the mel spectrogram");
+		return false;
+	}
+	const int samples_per_ctx = 2 * WHISPER_HOP_LENGTH;
+	const int chunk_ctx = settings->encoder_chunk_ms * WHISPER_SAMPLE_RATE / (1000 * samples_per_ctx);
+	int ret;
+	if (chunk_ctx > 0 && !prefetch_encoder_offloaded) {
+		const int overlap_ctx = settings->encoder_overlap_ms * WHISPER_SAMPLE_RATE / (1000 * samples_per_ctx);
+		ret = whisper_encode_chunked_with_state(context, prefetch_state_instance, prefetch_pcmf32.data(), prefetch_pcmf32.size(), audio_ctx, chunk_ctx, overlap_ctx, prefetch_n_threads);
+	} else {
+		ret = whisper_encode_samples_with_state(context, prefetch_state_instance, prefetch_pcmf32.data(), prefetch_pcmf32.size(), audio_ctx, prefetch_n_threads);
+	}
+	if (ret != 0) {
+		ERR_PRINT("Failed to encode the next pass ahead, returned " + rtos(ret));
+		return false;
+	}
+	return true;
+}
+
+/**
+ * The encoder thread of a pipelined stream. It waits until the stream queued
+ * the audio of its next pass, or the pass in flight finished without it.
+ */
+void SpeechToTextStream::_encoder_loop() {
+	std::unique_lock<std::mutex> lock(encoder_mutex);
+	while (!encoder_exit) {
+		if (prefetch_stage.load(std::memory_order_acquire) != PREFETCH_QUEUED) {
+			encoder_cond.wait(lock);
+			continue;
+		}
+		if (!prefetch_cancel.load(std::memory_order_relaxed) && audio_queue.size() < wake_threshold_frames) {
+			encoder_cond.wait_for(lock, std::chrono::milliseconds(prefetch_poll_ms));
+			continue;
+		}
+		bool is_encoded = false;
+		if (audio_queue.size() >= wake_threshold_frames) {
+			lock.unlock();
+			ThreadAffinity::update_current_thread();
+			is_encoded = _encode_prefetch();
+			lock.lock();
+		}
+		prefetch_stage.store(is_encoded ? PREFETCH_READY : PREFETCH_IDLE, std::memory_order_release);
+		encoder_cond.notify_all();
+	}
+}
+
+bool SpeechToTextStream::_hand_off(const float *p_samples, uint32_t p_frames, bool p_is_stereo, uint32_t p_rate, bool p_may_block) {
+	if (!frontend_running.load(std::memory_order_acquire) || std::this_thread::get_id() == frontend_thread_id) {
+		return false;
+	}
+	const uint64_t head = frontend_head.load(std::memory_order_relaxed);
+	if (head - frontend_tail.load(std::memory_order_acquire) >= FRONTEND_SLOTS) {
+		// The front-end fell behind by every slot, the caller does not wait for it.
+		frontend_dropped_frames.fetch_add(p_frames, std::memory_order_relaxed);
+		return true;
+	}
+	FrontendChunk &chunk = frontend_chunks[head % FRONTEND_SLOTS];
+	const size_t count = size_t(p_frames) * (p_is_stereo ? 2 : 1);
+	_grow_scratch(chunk.samples, count);
+	memcpy(chunk.samples.data(), p_samples, count * sizeof(float));
+	chunk.frames = p_frames;
+	chunk.rate = p_rate;
+	chunk.is_stereo = p_is_stereo;
+	chunk.may_block = p_may_block;
+	chunk.captured_usec = SimulationClock::get_ticks_usec();
+	frontend_head.store(head + 1, std::memory_order_release);
+	frontend_cond.notify_one();
+	return true;
+}
+
+/**
+ * The front-end thread of realtime_ingest. It is the only producer of the
+ * stream while it runs, and ingests the chunks in the order they came.
+ */
+void SpeechToTextStream::_frontend_loop() {
+	AudioThreadPriority priority;
+	frontend_realtime.store(priority.raise(frontend_period_usec, frontend_computation_usec), std::memory_order_relaxed);
+	std::unique_lock<std::mutex> lock(frontend_mutex);
+	while (!frontend_exit) {
+		const uint64_t tail = frontend_tail.load(std::memory_order_relaxed);
+		if (frontend_head.load(std::memory_order_acquire) == tail) {
+			frontend_cond.wait_for(lock, std::chrono::milliseconds(frontend_poll_ms));
+			continue;
+		}
+		lock.unlock();
+		const FrontendChunk &chunk = frontend_chunks[tail % FRONTEND_SLOTS];
+		frontend_captured_usec = chunk.captured_usec;
+		if (chunk.is_stereo) {
+			_ingest_stereo(chunk.samples.data(), chunk.frames, chunk.may_block, chunk.rate);
+		} else {
+			_ingest_mono(chunk.samples.data(), chunk.frames, chunk.rate, chunk.may_block);
+		}
+		frontend_captured_usec = 0;
+		frontend_tail.store(tail + 1, std::memory_order_release);
+		lock.lock();
+	}
+	frontend_realtime.store(false, std::memory_order_relaxed);
+}
+
+void SpeechToTextStream::_start_frontend_thread() {
+	if (frontend_thread.joinable()) {
+		return;
+	}
+	// Chunks of an earlier listen are not ingested.
+	frontend_tail.store(frontend_head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	frontend_exit = false;
+	frontend_thread = std::thread(&SpeechToTextStream::_frontend_loop, this);
+	frontend_thread_id = frontend_thread.get_id();
+	frontend_running.store(true, std::memory_order_release);
+}
+
+void SpeechToTextStream::_stop_frontend_thread() {
+	if (!frontend_thread.joinable()) {
+		return;
+	}
+	frontend_running.store(false, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(frontend_mutex);
+		frontend_exit = true;
+	}
+	frontend_cond.notify_all();
+	frontend_thread.join();
+}
+
+void SpeechToTextStream::_stop_encoder_thread() {
+	if (!encoder_thread.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(encoder_mutex);
+		encoder_exit = true;
+	}
+	encoder_cond.notify_all();
+	encoder_thread.join();
+}
+
+/**
+ * Polled by ggml between graph nodes, possibly from several of its threads.
+ * Ends the pass early when the stream stopped, when SpeechToText::cancel_passes()
+ * was called, when it went stale or when the scheduler preempted it for a stream
+ * of a higher priority class. Only the last three run the stream again.
+ */
+bool SpeechToTextStream::_abort_pass(void *p_stream) {
+	SpeechToTextStream *stream = static_cast<SpeechToTextStream *>(p_stream);
+	if (!stream->is_running.load(std::memory_order_relaxed)) {
+		return true;
+	}
+	const SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	const bool is_cancelled = speech_to_text_obj->cancel_generation.load(std::memory_order_relaxed) != stream->pass_generation;
+	const bool is_stale = speech_to_text_obj->restart_stale_passes && !stream->pass_is_restart && stream->audio_queue.size() >= stream->wake_threshold_frames;
+	if (is_cancelled || is_stale || stream->pass_preempted.load(std::memory_order_relaxed)) {
+		stream->pass_restart.store(true, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+/* Same check before the encoder starts, a cancelled pass then never enters ggml. */
+bool SpeechToTextStream::_encoder_begin(whisper_context *p_context, whisper_state *p_state, void *p_stream) {
+	return !_abort_pass(p_stream);
+}
+
+/* Mask SpeechToText.suppressed_tokens and suppress_regex out of every decoder step. */
+void SpeechToTextStream::_filter_logits(whisper_context *p_context, whisper_state *p_state, const whisper_token_data *p_tokens, int p_n_tokens, float *p_logits, void *p_suppress_ids) {
+	const std::vector<whisper_token> &suppress_ids = *static_cast<const std::vector<whisper_token> *>(p_suppress_ids);
+	for (const whisper_token id : suppress_ids) {
+		p_logits[id] = -INFINITY;
+	}
+}
+
+void stage_timings::add(const stage_timings &p_timings) {
+	resample_ms += p_timings.resample_ms;
+	vad_ms += p_timings.vad_ms;
+	queue_wait_ms += p_timings.queue_wait_ms;
+	mel_ms += p_timings.mel_ms;
+	encode_ms += p_timings.encode_ms;
+	decode_ms += p_timings.decode_ms;
+	sample_ms += p_timings.sample_ms;
+	postprocess_ms += p_timings.postprocess_ms;
+	passes += p_timings.passes;
+}
+
+Dictionary stage_timings::to_dictionary() const {
+	Dictionary ret;
+	ret["passes"] = passes;
+	ret["resample_ms"] = resample_ms;
+	ret["vad_ms"] = vad_ms;
+	ret["queue_wait_ms"] = queue_wait_ms;
+	ret["mel_ms"] = mel_ms;
+	ret["encode_ms"] = encode_ms;
+	ret["decode_ms"] = decode_ms;
+	ret["sample_ms"] = sample_ms;
+	ret["postprocess_ms"] = postprocess_ms;
+	return ret;
+}
+
+/* Move the stage times of the pass, the batched or chunked encoding and the ingest since the last pass included, out of the state. */
+void SpeechToTextStream::_collect_timings(whisper_state *p_state) {
+	const whisper_timings timings = whisper_get_timings_from_state(p_state);
+	whisper_reset_timings_from_state(p_state);
+	stage_timings pass;
+	pass.resample_ms = ingest_resample_usec.exchange(0, std::memory_order_relaxed) / 1000.0;
+	pass.vad_ms = ingest_vad_usec.exchange(0, std::memory_order_relaxed) / 1000.0;
+	pass.queue_wait_ms = pass_queue_wait_ms;
+	pass.mel_ms = timings.mel_ms;
+	pass.encode_ms = timings.encode_ms;
+	pass.decode_ms = timings.decode_ms + timings.batchd_ms + timings.prompt_ms;
+	pass.sample_ms = timings.sample_ms;
+	pass.passes = 1;
+	{
+		METERED_LOCK(s_mutex, "_collect_timings");
+		s_last_timings = pass;
+		s_timings.add(pass);
+	}
+
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	const float pass_ms = MAX(0.0f, SimulationClock::get_ticks_msec() - pass_time_started);
+	// Skipped partial passes took audio in too, it counts towards the pass that decoded it.
+	const size_t decoded_samples = pass_new_samples + quality_skipped_samples;
+	quality_skipped_samples = 0;
+	if (decoded_samples >= WHISPER_SAMPLE_RATE / 10) {
+		const float pass_rtf = pass_ms / (1000.0f * decoded_samples / WHISPER_SAMPLE_RATE);
+		quality_rtf = quality_rtf > 0.0f ? quality_rtf + quality_rtf_smoothing * (pass_rtf - quality_rtf) : pass_rtf;
+	}
+	speech_to_text_obj->monitor_passes.fetch_add(1, std::memory_order_relaxed);
+	speech_to_text_obj->monitor_pass_usec.fetch_add(uint64_t(pass_ms) * 1000, std::memory_order_relaxed);
+	speech_to_text_obj->monitor_pass_samples.fetch_add(pass_new_samples, std::memory_order_relaxed);
+
+	MetricsHistory::Record record;
+	record.usec = SimulationClock::get_ticks_usec();
+	record.stream_id = get_instance_id();
+	record.audio_seconds = double(decoded_samples) / WHISPER_SAMPLE_RATE;
+	record.audio_ctx = pass_params.audio_ctx > 0 ? pass_params.audio_ctx : whisper_n_audio_ctx(speech_to_text_obj->context_instance);
+	record.tokens = timings.n_sample;
+	record.fallbacks = timings.n_fallback;
+	record.waiting_streams = speech_to_text_obj->scheduler.get_waiting_streams();
+	record.thermal_state = ThermalMonitor::get_state();
+	record.quality_level = quality_level.load(std::memory_order_relaxed);
+	record.pass_ms = pass_ms;
+	record.resample_ms = pass.resample_ms;
+	record.vad_ms = pass.vad_ms;
+	record.queue_wait_ms = pass.queue_wait_ms;
+	record.mel_ms = pass.mel_ms;
+	record.encode_ms = pass.encode_ms;
+	record.decode_ms = pass.decode_ms;
+	record.sample_ms = pass.sample_ms;
+	speech_to_text_obj->metrics_history.add(record);
+	// The compute buffers grow lazily, e.g. on the first batched encode.
+	_update_state_memory();
+	_update_audio_memory();
+}
+
+/* Call from the pass, or with context_mutex held exclusively. */
+void SpeechToTextStream::_update_state_memory() {
+	whisper_state_memory memory = {};
+	for (whisper_state *state : { state_instance, draft_state_instance, prefetch_state_instance }) {
+		if (state == nullptr) {
+			continue;
+		}
+		const whisper_state_memory state_breakdown = whisper_get_state_memory_breakdown(state);
+		memory.kv_self += state_breakdown.kv_self;
+		memory.kv_cross += state_breakdown.kv_cross;
+		memory.compute += state_breakdown.compute;
+		memory.mel += state_breakdown.mel;
+	}
+	kv_memory.store(memory.kv_self + memory.kv_cross, std::memory_order_relaxed);
+	compute_memory.store(memory.compute, std::memory_order_relaxed);
+	mel_memory.store(memory.mel, std::memory_order_relaxed);
+	state_memory.store(memory.kv_self + memory.kv_cross + memory.compute + memory.mel, std::memory_order_relaxed);
+}
+
+/* Call from the pass, the windows only grow there. */
+void SpeechToTextStream::_update_audio_memory() {
+	audio_memory.store(audio_queue.get_memory() + pcmf32.get_memory() + prefetch_pcmf32.get_memory(), std::memory_order_relaxed);
+}
+
+/**
+ * Length of the open segment that forces a commit, max_utterance_ms within
+ * what audio_ctx memory_budget_mb leaves room for. The VAD may commit
+ * earlier. Shorter than the 30 s of the encoder, so a segment fits in one.
+ */
+size_t SpeechToTextStream::_get_iter_threshold_samples() const {
+	const size_t n_samples_iter_threshold = size_t(settings->max_utterance_ms) * WHISPER_SAMPLE_RATE / 1000;
+	const int budget_audio_ctx = SpeechToText::get_singleton()->budget_audio_ctx.load(std::memory_order_relaxed);
+	if (budget_audio_ctx <= 0) {
+		return n_samples_iter_threshold;
+	}
+	// The encoder has one position per two mel frames, speed_up fits twice the audio in them.
+	const size_t budget_samples = size_t(budget_audio_ctx) * 2 * WHISPER_HOP_LENGTH * (whisper_params.speed_up ? 2 : 1);
+	return MIN(n_samples_iter_threshold, budget_samples);
+}
+
+void SpeechToTextStream::_add_postprocess_time(double p_ms) {
+	METERED_LOCK(s_mutex, "_add_postprocess_time");
+	s_last_timings.postprocess_ms = p_ms;
+	s_timings.postprocess_ms += p_ms;
+}
+
+Dictionary SpeechToTextStream::get_last_timings() {
+	stage_timings timings;
+	{
+		METERED_LOCK(s_mutex, "get_last_timings");
+		timings = s_last_timings;
+	}
+	return timings.to_dictionary();
+}
+
+Dictionary SpeechToTextStream::get_timings() {
+	stage_timings timings;
+	{
+		METERED_LOCK(s_mutex, "get_timings");
+		timings = s_timings;
+	}
+	return timings.to_dictionary();
+}
+
+void SpeechToTextStream::reset_timings() {
+	METERED_LOCK(s_mutex, "reset_timings");
+	s_last_timings = stage_timings();
+	s_timings = stage_timings();
+	latency_histogram.reset();
+}
+
+/**
+ * Language auto-detection cache. The language is pinned once it was detected
+ * with language_pin_probability over language_pin_seconds of new audio, and
+ * detected again when the decoder gets unsure of the text.
+ */
+void SpeechToTextStream::_update_pinned_language(int p_lang_id, float p_lang_prob, float p_mean_token_probability) {
+	if (pass_draft) {
+		// The draft model is less sure of both the language and the text, only the language model moves the cache.
+		return;
+	}
+	if (pinned_lang_id >= 0) {
+		if (p_mean_token_probability < language_unpin_probability) {
+			pinned_lang_id = -1;
+			candidate_lang_id = -1;
+			candidate_seconds = 0.0f;
+		}
+		return;
+	}
+	if (p_lang_prob < settings->language_pin_probability) {
+		candidate_lang_id = -1;
+		candidate_seconds = 0.0f;
+		return;
+	}
+	if (p_lang_id != candidate_lang_id) {
+		candidate_lang_id = p_lang_id;
+		candidate_seconds = 0.0f;
+	}
+	candidate_seconds += float(pass_new_samples) / WHISPER_SAMPLE_RATE;
+	if (candidate_seconds >= settings->language_pin_seconds) {
+		pinned_lang_id = candidate_lang_id;
+		pinned_lang_prob = p_lang_prob;
+	}
+}
+
+/**
+ * Text tokens at the start of p_tokens that the passes in agreement_history
+ * start with too, once it holds p_passes - 1 of them, cut back to the end of
+ * a word. The last token of the pass is never agreed on, the next pass may
+ * still extend its word.
+ */
+size_t SpeechToTextStream::_get_agreed_token_count(const std::string &p_text, const std::vector<whisper_token_data> &p_tokens, const std::vector<size_t> &p_token_ends, int p_passes) const {
+	if ((int)agreement_history.size() < p_passes - 1) {
+		return 0;
+	}
+	size_t n_agreed = p_tokens.empty() ? 0 : p_tokens.size() - 1;
+	for (size_t i = agreement_history.size() - (p_passes - 1); i < agreement_history.size(); i++) {
+		const std::vector<whisper_token> &previous = agreement_history[i];
+		size_t n = 0;
+		while (n < n_agreed && n < previous.size() && previous[n] == p_tokens[n].id) {
+			n++;
+		}
+		n_agreed = n;
+	}
+	// The text of token n_agreed starts right after that of the last agreed one.
+	while (n_agreed > 0 && p_text[p_token_ends[n_agreed - 1]] != ' ') {
+		n_agreed--;
+	}
+	return n_agreed;
+}
+
+/* Keep the text tokens of a partial pass for the next p_keep passes to agree with. */
+void SpeechToTextStream::_add_agreement_pass(const std::vector<whisper_token_data> &p_tokens, int p_keep) {
+	if (p_keep <= 0) {
+		agreement_history.clear();
+		return;
+	}
+	while ((int)agreement_history.size() >= p_keep) {
+		agreement_history.erase(agreement_history.begin());
+	}
+	std::vector<whisper_token> &ids = agreement_history.emplace_back();
+	ids.reserve(p_tokens.size());
+	for (const whisper_token_data &token : p_tokens) {
+		ids.push_back(token.id);
+	}
+}
+
+/** Decode the audio read by _begin_pass() and emit the result. */
+void SpeechToTextStream::_finish_pass() {
+	if (pass_wake) {
+		_finish_wake_pass();
+		return;
+	}
+	if (pass_command) {
+		_finish_command_pass();
+		return;
+	}
+	if (pass_remote) {
+		_finish_remote_pass();
+		return;
+	}
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	whisper_context *context = pass_draft ? speech_to_text_obj->draft_context_instance : speech_to_text_obj->context_instance;
+	whisper_state *state = pass_draft ? draft_state_instance : state_instance;
+	// The tokens of a draft pass are verified by the next pass of the language model when they share the vocabulary.
+	const bool tokens_carry_over = !pass_draft || whisper_n_vocab(context) == whisper_n_vocab(speech_to_text_obj->context_instance);
+	const bool incremental_decoding = settings->incremental_decoding;
+	const int local_agreement = settings->local_agreement;
+	const float vad_thold = settings->vad_thold;
+	const float time_started = pass_time_started;
+	{
+		TRACE_ZONE("whisper_full");
+		int ret = whisper_full_with_state(context, state, pass_params, pcmf32.data(), pcmf32.size());
+		_collect_timings(state);
+		if (pass_restart) {
+			// pcmf32 is kept, the next pass decodes it together with the newer audio.
+			return;
+		}
+		if (ret != 0) {
+			// A pass aborted by stop_listen() has nothing to report.
+			if (is_running) {
+				ERR_PRINT("Failed to process audio, returned " + rtos(ret));
+			}
+			return;
+		}
+	}
+	const uint64_t postprocess_started = SimulationClock::get_ticks_usec();
+	{
+		TRACE_ZONE("postprocess");
+		scratch.clear();
+		transcribed_msg &msg = scratch.msg;
+		/**
+		 * Simple VAD from the "stream" example in whisper.cpp
+		 * https://github.com/ggerganov/whisper.cpp/blob/231bebca7deaf32d268a8b207d15aa859e52dbbe/examples/stream/stream.cpp#L378
+		 */
+		bool speech_has_end = false;
+		/* Need enough accumulated audio to do VAD. */
+		if ((int)pcmf32.size() >= n_samples_vad_window) {
+			// pcmf32 is only ever trimmed at the front, so its last 3s are the last 3s the VAD saw.
+			speech_has_end = _is_speech_ending(vad_thold);
+			if (speech_has_end) {
+				printf("speech end detected\n");
+			}
+		}
+		if (pass_close_segment) {
+			// The VAD keeps at most the last 3s, which is what decides whether the segment ended silent.
+			if (_get_vad_energy(pcmf32.size() * 1000 / WHISPER_SAMPLE_RATE) < 0.0001f) {
+				msg.text = "";
+			}
+			speech_has_end = true;
+		}
+		const int n_segments = whisper_full_n_segments_from_state(state);
+		msg.start_time = _get_input_time(0);
+		msg.end_time = msg.start_time;
+		if (n_segments > 0) {
+			const int64_t t1 = whisper_full_get_segment_t1_from_state(state, n_segments - 1);
+			msg.end_time = _get_input_time(MIN(size_t(t1 * WHISPER_SAMPLE_RATE / 100), pcmf32.size()));
+		}
+		int64_t delete_target_t = 0;
+		bool find_delete_target_t = false;
+		int64_t target_index = 0;
+		// Byte offset of the split point in msg.text, if any.
+		size_t split_index = std::string::npos;
+		// Number of tokens before the split point, and whether it lies in the stable first half.
+		size_t split_n_tokens = 0;
+		bool has_stable_split = false;
+		// A speaker turn before half_t is kept as the split over the punctuation after it.
+		bool has_turn_split = false;
+		std::vector<int> &turn_token_indices = scratch.turn_token_indices;
+		std::vector<int64_t> &turn_times = scratch.turn_times;
+		iter_tokens.clear();
+		// Text tokens only, with the end of their text in msg.text.
+		const whisper_token token_eot = whisper_token_eot(context);
+		const std::vector<uint8_t> &token_flags = pass_draft ? speech_to_text_obj->draft_token_flags : speech_to_text_obj->token_flags;
+		const auto flags_of = [&](whisper_token p_id) -> uint8_t {
+			return p_id >= 0 && size_t(p_id) < token_flags.size() ? token_flags[p_id] : 0;
+		};
+		int bracket_depth = 0;
+		std::vector<whisper_token_data> &text_tokens = scratch.text_tokens;
+		std::vector<size_t> &text_token_ends = scratch.text_token_ends;
+		std::vector<size_t> &text_token_iter_ends = scratch.text_token_iter_ends;
+
+		// Without token timestamps only the segments are timed, the tokens get the times of their segment.
+		const bool has_token_times = pass_params.token_timestamps;
+		int64_t half_t = 0;
+		if (n_segments > 0) {
+			if (has_token_times) {
+				const int cur_n_tokens = whisper_full_n_tokens_from_state(state, n_segments - 1);
+				auto cur_last_token = whisper_full_get_token_data_from_state(state, n_segments - 1, cur_n_tokens - 1);
+				half_t = cur_last_token.t1 * 1.0 / 2.0;
+			} else {
+				half_t = whisper_full_get_segment_t1_from_state(state, n_segments - 1) / 2;
+			}
+		}
+		for (int i = 0; i < n_segments; ++i) {
+			const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+			const int64_t segment_t0 = whisper_full_get_segment_t0_from_state(state, i);
+			const int64_t segment_t1 = whisper_full_get_segment_t1_from_state(state, i);
+			for (int j = 0; j < n_tokens; j++) {
+				auto token = whisper_full_get_token_data_from_state(state, i, j);
+				if (!has_token_times) {
+					token.t0 = segment_t0;
+					token.t1 = segment_t1;
+				}
+				iter_tokens.push_back(token.id);
+				const uint8_t flags = flags_of(token.id);
+				const bool is_text = token.id < token_eot;
+				// ". you." is what whisper tends to make of silence, only the first period is kept.
+				if ((flags & SpeechToText::TOKEN_YOU) && j + 1 < n_tokens && !msg.text.empty() && msg.text.back() == '.') {
+					const whisper_token next_id = whisper_full_get_token_id_from_state(state, i, j + 1);
+					if (flags_of(next_id) & SpeechToText::TOKEN_PERIOD) {
+						iter_tokens.push_back(next_id);
+						j++;
+						continue;
+					}
+				}
+				// Special and timestamp tokens have no text of their own.
+				const size_t n_appended = is_text ? TranscriptionResult::append_token_text(msg.text, whisper_full_get_token_text_from_state(context, state, i, j), bracket_depth) : 0;
+				// Idea from https://github.com/yum-food/TaSTT/blob/dbb2f72792e2af3ff220313f84bf76a9a1ddbeb4/Scripts/transcribe_v2.py#L457C17-L462C25
+				// Only the end of a segment has a time of its own without token timestamps.
+				// A speaker turn is a split point either way, the next speaker starts a text of their own.
+				const bool is_turn = pass_params.tdrz_enable && (flags & SpeechToText::TOKEN_SPEAKER_TURN);
+				if (is_turn) {
+					turn_token_indices.push_back(text_tokens.size());
+					turn_times.push_back(token.t1);
+				}
+				const bool is_split_point = is_turn || (has_token_times ? (flags & (SpeechToText::TOKEN_TIMESTAMP | SpeechToText::TOKEN_SPLIT_PUNCTUATION)) != 0 : j + 1 == n_tokens);
+				if (find_delete_target_t == false && is_split_point) {
+					if (token.t1 < half_t) {
+						if (is_turn || !has_turn_split) {
+							delete_target_t = token.t1;
+							target_index = msg.text.size();
+							split_n_tokens = iter_tokens.size();
+							has_stable_split = true;
+							has_turn_split = has_turn_split || is_turn;
+						}
+					} else {
+						if (delete_target_t == 0) {
+							delete_target_t = token.t1;
+							split_n_tokens = iter_tokens.size();
+							if (speech_has_end == false) {
+								split_index = msg.text.size();
+							}
+						} else if (speech_has_end == false) {
+							split_index = target_index;
+						}
+						find_delete_target_t = true;
+					}
+				}
+				if (n_appended > 0) {
+					text_tokens.push_back(token);
+					text_token_ends.push_back(msg.text.size());
+					text_token_iter_ends.push_back(iter_tokens.size());
+				}
+			}
+		}
+		if (delete_target_t != 0 && find_delete_target_t == false) {
+			split_index = target_index;
+			find_delete_target_t = true;
+		}
+
+		/**
+		 * LocalAgreement: the words the last local_agreement passes start
+		 * with alike are final, they are committed and their audio trimmed
+		 * whatever the other splits say, so the buffer stays short. The
+		 * last agreed token only counts when its word ended, i.e. the next
+		 * token starts a word, and needs its own time to cut at.
+		 */
+		const size_t n_agreed = local_agreement >= 2 && tokens_carry_over && has_token_times && !speech_has_end ? _get_agreed_token_count(msg.text, text_tokens, text_token_ends, local_agreement) : 0;
+		const bool commit_agreed = n_agreed > 0 && !pass_draft;
+		if (commit_agreed) {
+			delete_target_t = text_tokens[n_agreed - 1].t1;
+			split_index = text_token_ends[n_agreed - 1];
+			split_n_tokens = text_token_iter_ends[n_agreed - 1];
+		}
+
+		/**
+		 * In incremental mode a split in the first half of the buffer is
+		 * considered stable and committed right away, so the next
+		 * iteration only decodes the tail.
+		 */
+		const bool commit_stable_prefix = incremental_decoding && has_stable_split && !speech_has_end && !pass_draft;
+		const bool is_committing = pcmf32.size() > _get_iter_threshold_samples() * 0.66 || speech_has_end || commit_stable_prefix || commit_agreed;
+		// Aligned once when the text leaves the buffer, partial passes keep the times whisper_full gave them.
+		if (is_committing && speech_to_text_obj->context_parameters.dtw_token_timestamps) {
+			SpeechToText::_align_tokens(context, state, text_tokens, pcmf32.size(), pass_params.n_threads);
+		}
+
+		// Times are mapped to input time before pcmf32 and the segment markers are trimmed.
+		Ref<TranscriptionResult> result;
+		result.instantiate();
+		result->start_time = msg.start_time;
+		result->end_time = msg.end_time;
+		result->capture_usec = _get_capture_usec(pcmf32.size());
+		result->token_ids.resize(text_tokens.size());
+		result->token_start_times.resize(text_tokens.size());
+		result->token_end_times.resize(text_tokens.size());
+		result->token_probabilities.resize(text_tokens.size());
+		float token_probability_sum = 0.0f;
+		for (size_t i = 0; i < text_tokens.size(); i++) {
+			result->token_ids.set(i, text_tokens[i].id);
+			result->token_start_times.set(i, _get_input_time(MIN(size_t(MAX(int64_t(0), text_tokens[i].t0) * WHISPER_SAMPLE_RATE / 100), pcmf32.size())));
+			result->token_end_times.set(i, _get_input_time(MIN(size_t(MAX(int64_t(0), text_tokens[i].t1) * WHISPER_SAMPLE_RATE / 100), pcmf32.size())));
+			result->token_probabilities.set(i, text_tokens[i].p);
+			token_probability_sum += text_tokens[i].p;
+		}
+		result->speaker_turn_token_indices.resize(turn_token_indices.size());
+		result->speaker_turn_times.resize(turn_times.size());
+		for (size_t i = 0; i < turn_times.size(); i++) {
+			result->speaker_turn_token_indices.set(i, turn_token_indices[i]);
+			result->speaker_turn_times.set(i, _get_input_time(MIN(size_t(MAX(int64_t(0), turn_times[i]) * WHISPER_SAMPLE_RATE / 100), pcmf32.size())));
+		}
+		result->language = whisper_lang_str(whisper_full_lang_id_from_state(state));
+		result->language_probability = whisper_full_lang_prob_from_state(state);
+		result->repetition_aborted = whisper_full_repetition_aborted_from_state(state);
+		if (result->repetition_aborted) {
+			speech_to_text_obj->repetition_aborts.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (pass_auto_language) {
+			if (pass_language_pinned) {
+				// Decoded with the pinned language, report how sure the detection that pinned it was.
+				result->language_probability = pinned_lang_prob;
+			}
+			_update_pinned_language(whisper_full_lang_id_from_state(state), result->language_probability, text_tokens.empty() ? 1.0f : token_probability_sum / text_tokens.size());
+		}
+		// The translation decode replaces the segments of the state, everything above is read from them first.
+		bool translation_is_text = false;
+		if (is_committing && settings->dual_translation && !pass_params.translate && whisper_is_multilingual(context)) {
+			const int lang_id = whisper_full_lang_id_from_state(state);
+			if (lang_id == whisper_lang_id("en")) {
+				translation_is_text = true;
+			} else {
+				result->translated_text = _translate_pass(context, state, lang_id, delete_target_t == 0 || speech_has_end ? 0 : delete_target_t);
+			}
+		}
+
+		/**
+		 * Clear audio buffer when the size exceeds iteration threshold or
+		 * speech end is detected.
+		 */
+		if (is_committing) {
+			if (tokens_carry_over) {
+				const size_t n_commit = delete_target_t == 0 || speech_has_end ? iter_tokens.size() : split_n_tokens;
+				for (size_t i = 0; i < n_commit; i++) {
+					// Special and timestamp tokens are not part of the prompt text.
+					if (iter_tokens[i] < token_eot) {
+						committed_tokens.push_back(iter_tokens[i]);
+						segment_token_count++;
+					}
+				}
+				const size_t max_prompt = whisper_n_text_ctx(context) / 2;
+				if (committed_tokens.size() > max_prompt) {
+					committed_tokens.erase(committed_tokens.begin(), committed_tokens.end() - max_prompt);
+				}
+			} else {
+				// The tokens of another vocabulary mean nothing to the language model.
+				committed_tokens.clear();
+			}
+			segment_token_count = speech_has_end || !incremental_decoding ? 0 : MIN(segment_token_count, committed_tokens.size());
+			const auto t_now = SimulationClock::get_ticks_msec();
+			t_last_iter = t_now;
+			msg.is_partial = false;
+			if (!msg.text.empty()) {
+				_stay_awake();
+			}
+			/**
+			 * Keep the last few samples in the audio buffer, so the next
+			 * iteration has a smoother start.
+			 */
+			const size_t n_samples_before_trim = pcmf32.size();
+			if (delete_target_t == 0 || speech_has_end) {
+				pcmf32.clear();
+			} else {
+				// Only the start of the window moves, the samples stay where they are.
+				pcmf32.drop_front(size_t(delete_target_t / 100.0 * WHISPER_SAMPLE_RATE));
+			}
+			pcmf32_mel_offset += n_samples_before_trim - pcmf32.size();
+			// The tokens of the last pass describe audio that is gone now, or their timestamps moved.
+			draft_tokens.clear();
+			agreement_history.clear();
+			_trim_segment_markers();
+		} else {
+			msg.is_partial = true;
+			if (tokens_carry_over) {
+				draft_tokens = iter_tokens;
+			} else {
+				draft_tokens.clear();
+			}
+			_add_agreement_pass(text_tokens, tokens_carry_over ? local_agreement - 1 : 0);
+		}
+		/**
+		 * The committed span is the text of the audio trimmed off pcmf32,
+		 * the rest is decoded again by the next pass.
+		 */
+		size_t n_committed_bytes = 0;
+		if (!msg.is_partial) {
+			n_committed_bytes = delete_target_t == 0 || speech_has_end ? msg.text.size() : MIN(split_index, msg.text.size());
+		}
+		result->partial = msg.is_partial;
+		result->committed_text = String::utf8(msg.text.data(), n_committed_bytes);
+		result->tentative_text = String::utf8(msg.text.data() + n_committed_bytes, msg.text.size() - n_committed_bytes);
+		if (translation_is_text) {
+			result->translated_text = result->committed_text;
+		}
+		for (size_t i = 0; i < text_tokens.size(); i++) {
+			if (text_token_ends[i] <= n_committed_bytes) {
+				result->committed_token_count = i + 1;
+			}
+		}
+		result->set_words_from_tokens(msg.text, text_token_ends);
+		float time_end = SimulationClock::get_ticks_msec() - time_started;
+		_add_postprocess_time((SimulationClock::get_ticks_usec() - postprocess_started) / 1000.0);
+		if (results_delivery.load(std::memory_order_relaxed) == RESULTS_POLL) {
+			if (!_push_polled_result(result)) {
+				dropped_results.fetch_add(1, std::memory_order_relaxed);
+				WARN_PRINT("poll_results() is not called often enough, a transcription result was dropped.");
+			}
+		} else {
+			_queue_result(time_end, result);
+		}
+	}
+}
+
+/**
+ * Send the buffer of a pass that may commit to the server and commit all of
+ * its text. When the server fails or misses remote_latency_budget_ms, the
+ * stream decodes locally for remote_retry_seconds and the buffer is kept
+ * for the next pass, which is flagged to close the segment like an
+ * endpoint. Returns whether the server answered.
+ */
+bool SpeechToTextStream::_finish_remote_pass() {
+	TRACE_ZONE("remote_pass");
+	String text;
+	if (!remote.transcribe(settings->remote_inference_url, pcmf32.data(), pcmf32.size(), settings->remote_latency_budget_ms, text)) {
+		remote_paused_until_msec = SimulationClock::get_ticks_msec() + uint64_t(settings->remote_retry_seconds * 1000.0f);
+		WARN_PRINT("The remote inference server failed or was too slow, decoding locally for " + rtos(settings->remote_retry_seconds) + " seconds.");
+		if (is_running) {
+			_signal_endpoint();
+		}
+		return false;
+	}
+	Ref<TranscriptionResult> result;
+	result.instantiate();
+	result->partial = false;
+	result->committed_text = text;
+	result->start_time = _get_input_time(0);
+	result->end_time = _get_input_time(pcmf32.size());
+	result->capture_usec = _get_capture_usec(pcmf32.size());
+	result->language = String::utf8(settings->language.c_str());
+	if (!text.is_empty()) {
+		_stay_awake();
+	}
+	// The server's tokens are not known here, the next local pass starts without a prompt.
+	committed_tokens.clear();
+	draft_tokens.clear();
+	agreement_history.clear();
+	segment_token_count = 0;
+	t_last_iter = SimulationClock::get_ticks_msec();
+	pcmf32_mel_offset += pcmf32.size();
+	pcmf32.clear();
+	_trim_segment_markers();
+	const float time_end = SimulationClock::get_ticks_msec() - pass_time_started;
+	if (results_delivery.load(std::memory_order_relaxed) == RESULTS_POLL) {
+		if (!_push_polled_result(result)) {
+			dropped_results.fetch_add(1, std::memory_order_relaxed);
+			WARN_PRINT("poll_results() is not called often enough, a transcription result was dropped.");
+		}
+	} else {
+		_queue_result(time_end, result);
+	}
+	return true;
+}
+
+/**
+ * Decode the buffer of a committing pass again, translated to English, from
+ * the encoder output the transcription left in p_state. Only the segments
+ * whose middle lies before p_split_t, in 10 ms, are kept, 0 keeps all, the
+ * audio after the split is translated by the pass that commits it.
+ */
+String SpeechToTextStream::_translate_pass(whisper_context *p_context, whisper_state *p_state, int p_lang_id, int64_t p_split_t) {
+	TRACE_ZONE("translate");
+	if (whisper_reuse_encoding_with_state(p_context, p_state, pcmf32.data(), pcmf32.size(), pass_params.n_threads) != 0) {
+		return String();
+	}
+	whisper_full_params params = pass_params;
+	params.translate = true;
+	// The language the transcription was decoded with, detecting it again would run the encoder again.
+	params.language = whisper_lang_str(p_lang_id);
+	params.detect_language = false;
+	// The prompt, the draft and the grammar are text of the spoken language, and so is the vocabulary subset.
+	params.prompt_tokens = nullptr;
+	params.prompt_n_tokens = 0;
+	params.draft_tokens = nullptr;
+	params.draft_n_tokens = 0;
+	params.grammar_rules = nullptr;
+	params.n_grammar_rules = 0;
+	params.vocab_subset = false;
+	params.new_token_callback = nullptr;
+	params.new_token_callback_user_data = nullptr;
+	// The split only needs the times of the segments.
+	params.token_timestamps = false;
+	params.tdrz_enable = false;
+	const int ret = whisper_full_with_state(p_context, p_state, params, pcmf32.data(), pcmf32.size());
+	const whisper_timings timings = whisper_get_timings_from_state(p_state);
+	whisper_reset_timings_from_state(p_state);
+	{
+		METERED_LOCK(s_mutex, "_translate_pass");
+		// Part of the pass that committed, not a pass of its own.
+		s_last_timings.decode_ms += timings.decode_ms + timings.batchd_ms + timings.prompt_ms;
+		s_last_timings.sample_ms += timings.sample_ms;
+		s_timings.decode_ms += timings.decode_ms + timings.batchd_ms + timings.prompt_ms;
+		s_timings.sample_ms += timings.sample_ms;
+	}
+	if (ret != 0) {
+		return String();
+	}
+	const whisper_token token_eot = whisper_token_eot(p_context);
+	std::string text;
+	int bracket_depth = 0;
+	const int n_segments = whisper_full_n_segments_from_state(p_state);
+	for (int i = 0; i < n_segments; i++) {
+		const int64_t segment_t0 = whisper_full_get_segment_t0_from_state(p_state, i);
+		const int64_t segment_t1 = whisper_full_get_segment_t1_from_state(p_state, i);
+		if (p_split_t > 0 && (segment_t0 + segment_t1) / 2 > p_split_t) {
+			break;
+		}
+		const int n_tokens = whisper_full_n_tokens_from_state(p_state, i);
+		for (int j = 0; j < n_tokens; j++) {
+			if (whisper_full_get_token_id_from_state(p_state, i, j) < token_eot) {
+				TranscriptionResult::append_token_text(text, whisper_full_get_token_text_from_state(p_context, p_state, i, j), bracket_depth);
+			}
+		}
+	}
+	return String::utf8(text.data(), text.size());
+}
+
+/* Called by whisper_full after every decoding step of a pass with stream_tokens, on its worker. */
+void SpeechToTextStream::_on_new_tokens(whisper_context *p_context, whisper_state *p_state, const whisper_token_data *p_tokens, int p_n_tokens, void *p_stream) {
+	SpeechToTextStream *stream = static_cast<SpeechToTextStream *>(p_stream);
+	const whisper_token token_eot = whisper_token_eot(p_context);
+	// Timestamp and special tokens add no text, the step is not worth a result.
+	if (p_n_tokens <= 0 || p_tokens[p_n_tokens - 1].id >= token_eot || !stream->is_running.load(std::memory_order_relaxed)) {
+		return;
+	}
+	std::string &text = stream->streamed_text;
+	text.clear();
+	int bracket_depth = 0;
+	for (int i = 0; i < p_n_tokens; i++) {
+		if (p_tokens[i].id < token_eot) {
+			TranscriptionResult::append_token_text(text, whisper_token_to_str(p_context, p_tokens[i].id), bracket_depth);
+		}
+	}
+	// Steps inside a bracketed annotation add nothing to report, a fallback that starts over does.
+	if (text.empty() || text.size() == stream->streamed_text_size) {
+		return;
+	}
+	stream->streamed_text_size = text.size();
+	Ref<TranscriptionResult> result;
+	result.instantiate();
+	result->partial = true;
+	result->start_time = stream->_get_input_time(0);
+	result->end_time = stream->_get_input_time(stream->pcmf32.size());
+	result->capture_usec = stream->_get_capture_usec(stream->pcmf32.size());
+	result->tentative_text = String::utf8(text.data(), text.size());
+	if (stream->results_delivery.load(std::memory_order_relaxed) == RESULTS_POLL) {
+		// The result of the pass must still fit, a streamed partial is not worth a drop.
+		stream->_push_polled_result(result, stream->polled_results.size() / 2);
+	} else {
+		stream->_queue_result(SimulationClock::get_ticks_msec() - stream->pass_time_started, result);
+	}
+}
+
+/* Pass side of the poll_results() ring, false when fewer than p_keep_free slots would be left. */
+bool SpeechToTextStream::_push_polled_result(const Ref<TranscriptionResult> &p_result, size_t p_keep_free) {
+	const uint64_t write = polled_write.load(std::memory_order_relaxed);
+	if (write - polled_read.load(std::memory_order_acquire) + p_keep_free >= polled_results.size()) {
+		return false;
+	}
+	polled_results[write & (polled_results.size() - 1)] = p_result;
+	polled_write.store(write + 1, std::memory_order_release);
+	return true;
+}
+
+/* Consumer side of the ring, polled_taken gets the results to deliver. */
+void SpeechToTextStream::_take_polled_results(int p_max) {
+	polled_taken.clear();
+	uint64_t read = polled_read.load(std::memory_order_relaxed);
+	const uint64_t write = polled_write.load(std::memory_order_acquire);
+	const uint64_t now = SimulationClock::get_ticks_usec();
+	while (read != write && (p_max <= 0 || int(polled_taken.size()) < p_max)) {
+		Ref<TranscriptionResult> &slot = polled_results[read & (polled_results.size() - 1)];
+		if (!slot->partial || read + 1 == write) {
+			_encode_delta(slot);
+			_mark_delivered(slot, now);
+			polled_taken.push_back(slot);
+		}
+		// Released here, so the pass never frees a result a script still holds.
+		slot.unref();
+		read++;
+	}
+	polled_read.store(read, std::memory_order_release);
+}
+
+Array SpeechToTextStream::poll_results(int p_max) {
+	_take_polled_results(p_max);
+	Array ret;
+	ret.resize(polled_taken.size());
+	for (size_t i = 0; i < polled_taken.size(); i++) {
+		ret[i] = polled_taken[i];
+	}
+	polled_taken.clear();
+	return ret;
+}
+
+int SpeechToTextStream::poll_packed_results(const Ref<PackedTranscriptionResults> &p_results, int p_max) {
+	ERR_FAIL_COND_V(p_results.is_null(), 0);
+	_take_polled_results(p_max);
+	p_results->set_results(polled_taken.data(), polled_taken.size());
+	const int taken = polled_taken.size();
+	polled_taken.clear();
+	return taken;
+}
+
+/**
+ * Where p_result is delivered, so a partial is encoded against the result
+ * the script actually got before it, not one _queue_result() replaced.
+ */
+void SpeechToTextStream::_encode_delta(const Ref<TranscriptionResult> &p_result) {
+	const String text = p_result->tentative_text;
+	if (p_result->partial && delta_partials.load(std::memory_order_relaxed)) {
+		const int n_max = MIN(text.length(), delivered_text.length());
+		const char32_t *a = text.ptr();
+		const char32_t *b = delivered_text.ptr();
+		int n = 0;
+		while (n < n_max && a[n] == b[n]) {
+			n++;
+		}
+		p_result->delta = true;
+		p_result->delta_prefix_length = n;
+		p_result->delta_text = text.substr(n);
+		p_result->tentative_text = String();
+	}
+	delivered_text = text;
+}
+
+/**
+ * Hand a result to the main thread. Passes of the same audio can finish
+ * faster than frames, so a partial still pending is replaced by whatever the
+ * next pass reports, and a single deferred call emits all that is pending.
+ */
+void SpeechToTextStream::_queue_result(float p_process_time_ms, const Ref<TranscriptionResult> &p_result) {
+	MutexLock lock(results_mutex);
+	if (!pending_results.empty() && pending_results.back()->partial) {
+		pending_results.pop_back();
+	}
+	pending_results.push_back(p_result);
+	pending_process_time_ms = p_process_time_ms;
+	if (!results_flush_queued) {
+		results_flush_queued = true;
+		call_deferred("_flush_results");
+	}
+}
+
+/* Whether results wait for the main thread to emit them. */
+bool SpeechToTextStream::_has_queued_results() {
+	MutexLock lock(results_mutex);
+	return results_flush_queued;
+}
+
+/* Main thread: emit the pending results, or wait for the rest of results_interval_ms on a timer. */
+void SpeechToTextStream::_flush_results() {
+	const uint64_t now = SimulationClock::get_ticks_msec();
+	if (results_interval_ms > 0 && last_results_msec > 0 && now < last_results_msec + results_interval_ms) {
+		SceneTree *tree = Object::cast_to<SceneTree>(Engine::get_singleton()->get_main_loop());
+		if (tree) {
+			tree->create_timer((last_results_msec + results_interval_ms - now) / 1000.0)->connect("timeout", callable_mp(this, &SpeechToTextStream::_flush_results));
+			return;
+		}
+	}
+	float process_time_ms = 0.0f;
+	results_mutex.lock();
+	flushed_results.swap(pending_results);
+	process_time_ms = pending_process_time_ms;
+	results_flush_queued = false;
+	results_mutex.unlock();
+	if (flushed_results.empty()) {
+		return;
+	}
+	last_results_msec = now;
+	const uint64_t delivered = SimulationClock::get_ticks_usec();
+	for (size_t i = 0; i < flushed_results.size(); i++) {
+		_encode_delta(flushed_results[i]);
+		_mark_delivered(flushed_results[i], delivered);
+	}
+	if (results_delivery.load(std::memory_order_relaxed) == RESULTS_PACKED_SIGNAL) {
+		// The same object every time, so a C# handler does not get a new wrapper per update.
+		if (packed_results.is_null()) {
+			packed_results.instantiate();
+		}
+		packed_results->set_results(flushed_results.data(), flushed_results.size());
+		flushed_results.clear();
+		emit_signal("update_transcribed_packed", process_time_ms, packed_results);
+		return;
+	}
+	Array ret;
+	ret.resize(flushed_results.size());
+	for (size_t i = 0; i < flushed_results.size(); i++) {
+		ret[i] = flushed_results[i];
+	}
+	// The storage goes back to pending_results on the next flush.
+	flushed_results.clear();
+	emit_signal("update_transcribed_msgs", process_time_ms, ret);
+}
+
+/* Markers before the start of what is left of pcmf32 are not needed any more, but the last of them is. */
+void SpeechToTextStream::_trim_segment_markers() {
+	const uint64_t pcmf32_start_position = pcmf32_end_position - pcmf32.size();
+	METERED_LOCK(s_mutex, "_trim_segment_markers");
+	// Chunks that ended before pcmf32 starts brought none of it.
+	const uint64_t input_start_position = _get_input_position_locked(pcmf32_start_position);
+	while (!s_capture_markers.empty() && s_capture_markers.front().input_position < input_start_position) {
+		s_capture_markers.pop_front();
+	}
+	while (s_segment_markers.size() > 1 && s_segment_markers[1].queue_position <= pcmf32_start_position) {
+		s_segment_markers.pop_front();
+	}
+}
+
+/* lang_id to score phrases with, -1 detects it like an auto-language pass would. */
+int SpeechToTextStream::_get_pass_lang_id() const {
+	if (pass_language_pinned) {
+		return pinned_lang_id;
+	}
+	return pass_auto_language ? -1 : whisper_lang_id(pass_params.language);
+}
+
+/* Whether the last vad_window_s of the buffer end in silence, from the VAD the pass fed. */
+bool SpeechToTextStream::_is_speech_ending(float p_vad_thold) const {
+	if (pass_mel_vad) {
+		return mel_vad.is_speech_ending(vad_window_s * 1000, vad_last_ms, p_vad_thold);
+	}
+	return vad.is_speech_ending(vad_window_s * 1000, vad_last_ms, p_vad_thold);
+}
+
+float SpeechToTextStream::_get_vad_energy(int p_ms) const {
+	return pass_mel_vad ? mel_vad.get_energy(p_ms) : vad.get_energy(p_ms);
+}
+
+/* Full transcription keeps running for wake_seconds after the last text, while there are wake phrases. */
+void SpeechToTextStream::_stay_awake() {
+	if (!wake_set.texts.empty()) {
+		awake_until_msec.store(SimulationClock::get_ticks_msec() + uint64_t(wake_seconds * 1000.0f), std::memory_order_relaxed);
+	}
+}
+
+/* Drop all of pcmf32, the next pass starts on new audio. */
+void SpeechToTextStream::_drop_buffer() {
+	pcmf32_mel_offset += pcmf32.size();
+	pcmf32.clear();
+	draft_tokens.clear();
+	agreement_history.clear();
+	// The text before the dropped audio still is the context of the next segment.
+	segment_token_count = 0;
+	_trim_segment_markers();
+}
+
+/**
+ * Command mode pass: every phrase is scored against the whole utterance and
+ * the most likely one is reported, then the utterance is dropped from pcmf32.
+ */
+void SpeechToTextStream::_finish_command_pass() {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	const float time_started = pass_time_started;
+	std::vector<float> log_probs;
+	int ret = 0;
+	{
+		TRACE_ZONE("score_commands");
+		ret = command_set.score(speech_to_text_obj->context_instance, state_instance, pass_params, _get_pass_lang_id(), true, log_probs);
+		_collect_timings(state_instance);
+	}
+	// The utterance is used up whatever it matched, the next command starts on new audio.
+	const bool is_silent = _get_vad_energy(pcmf32.size() * 1000 / WHISPER_SAMPLE_RATE) < 0.0001f;
+	_drop_buffer();
+	if (ret != 0) {
+		if (is_running) {
+			ERR_PRINT("Failed to score the command phrases, returned " + rtos(ret));
+		}
+		return;
+	}
+	if (is_silent) {
+		return;
+	}
+	const uint64_t postprocess_started = SimulationClock::get_ticks_usec();
+	// Softmax over the phrases, the confidence is the probability of the best one given that one of them was said.
+	int best = 0;
+	for (int i = 1; i < (int)log_probs.size(); i++) {
+		if (log_probs[i] > log_probs[best]) {
+			best = i;
+		}
+	}
+	double sum = 0.0;
+	for (float log_prob : log_probs) {
+		sum += std::exp(double(log_prob) - log_probs[best]);
+	}
+	const float confidence = 1.0 / sum;
+	_stay_awake();
+	_add_postprocess_time((SimulationClock::get_ticks_usec() - postprocess_started) / 1000.0);
+	float time_end = SimulationClock::get_ticks_msec() - time_started;
+	call_deferred("emit_signal", "command_recognized", time_end, String::utf8(command_set.texts[best].c_str()), best, confidence);
+}
+
+/**
+ * Pass of a sleeping stream: the utterance is only checked for the wake
+ * phrases. Without one it is dropped, with one it stays in pcmf32 and the
+ * next pass, now awake, transcribes it.
+ */
+void SpeechToTextStream::_finish_wake_pass() {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	whisper_context *context = pass_draft ? speech_to_text_obj->draft_context_instance : speech_to_text_obj->context_instance;
+	whisper_state *state = pass_draft ? draft_state_instance : state_instance;
+	std::vector<float> log_probs;
+	int ret = 0;
+	{
+		TRACE_ZONE("spot_wake_phrases");
+		// Without eot, the phrase only has to start the utterance, "hey godot, open the door" wakes too.
+		ret = wake_set.score(context, state, pass_params, _get_pass_lang_id(), false, log_probs);
+		_collect_timings(state);
+	}
+	if (ret != 0) {
+		if (is_running) {
+			ERR_PRINT("Failed to score the wake phrases, returned " + rtos(ret));
+		}
+		_drop_buffer();
+		return;
+	}
+	// Per token, so long and short phrases compare against the same threshold.
+	int best = -1;
+	float best_probability = 0.0f;
+	for (int i = 0; i < (int)log_probs.size(); i++) {
+		const size_t n_tokens = wake_set.tokens[i].size();
+		const float probability = n_tokens == 0 ? 0.0f : std::exp(log_probs[i] / n_tokens);
+		if (probability > best_probability) {
+			best = i;
+			best_probability = probability;
+		}
+	}
+	if (best < 0 || best_probability < wake_threshold) {
+		_drop_buffer();
+		return;
+	}
+	_stay_awake();
+	call_deferred("emit_signal", "keyword_detected", String::utf8(wake_set.texts[best].c_str()), best, best_probability);
+}
+
+void SpeechToTextStream::_check_committed_tokens(whisper_context *p_context) {
+	const int n_vocab = whisper_n_vocab(p_context);
+	if (committed_tokens_n_vocab == n_vocab) {
+		return;
+	}
+	const bool is_restored = committed_tokens_n_vocab == 0;
+	bool keep = is_restored && (restored_n_vocab == 0 || restored_n_vocab == n_vocab);
+	if (keep) {
+		// A stale or forged state could index past the token embedding.
+		const whisper_token token_eot = whisper_token_eot(p_context);
+		keep = std::all_of(committed_tokens.begin(), committed_tokens.end(), [token_eot](whisper_token p_token) { return p_token >= 0 && p_token < token_eot; });
+	}
+	if (!keep && !committed_tokens.empty()) {
+		if (is_restored) {
+			WARN_PRINT("The stream state comes from a model with another vocabulary, its committed context is dropped.");
+		}
+		// The tokens of another vocabulary mean nothing to this model.
+		committed_tokens.clear();
+		segment_token_count = 0;
+	}
+	committed_tokens_n_vocab = n_vocab;
+	restored_n_vocab = 0;
+}
+
+/**
+ * One decoding pass over the queued audio. Called by the scheduler on one of
+ * its workers, never for the same stream on two workers at once.
+ */
+void SpeechToTextStream::_process(bool p_close_segment) {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	ERR_FAIL_NULL(speech_to_text_obj);
+	TRACE_ZONE("process");
+	// Held for the whole iteration so the context can only be swapped between iterations.
+	std::shared_lock<std::shared_mutex> context_lock(speech_to_text_obj->context_mutex, std::defer_lock);
+	TRACE_LOCK(context_lock, "context_mutex wait");
+	if (_begin_pass(p_close_segment)) {
+		const bool is_prefetching = _start_prefetch();
+		_finish_pass();
+		if (is_prefetching) {
+			_finish_prefetch();
+		}
+	}
+}
+
+/**
+ * Same as _process() for several streams, with one encoder pass for all of
+ * them. Every buffer is padded to the largest audio_ctx of the batch.
+ */
+void SpeechToTextStream::_process_batch(SpeechToTextStream *const *p_streams, int p_count) {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	ERR_FAIL_NULL(speech_to_text_obj);
+	TRACE_ZONE("process_batch");
+	std::shared_lock<std::shared_mutex> context_lock(speech_to_text_obj->context_mutex, std::defer_lock);
+	TRACE_LOCK(context_lock, "context_mutex wait");
+	std::vector<SpeechToTextStream *> passes;
+	std::vector<whisper_state *> states;
+	std::vector<const float *> samples;
+	std::vector<int> n_samples;
+	int audio_ctx = 0;
+	for (int i = 0; i < p_count; i++) {
+		SpeechToTextStream *stream = p_streams[i];
+		if (!stream->_begin_pass(false)) {
+			continue;
+		}
+		passes.push_back(stream);
+		// whisper_full skips buffers shorter than a second, they are not worth encoding.
+		// A pass with fewer encoder layers would be encoded with all of them in the batch.
+		if (stream->pcmf32.size() >= WHISPER_SAMPLE_RATE && !stream->pass_remote && !stream->pass_pre_encoded && !stream->pass_draft && !stream->pass_command && !stream->pass_wake && !stream->state_encoder_offloaded && stream->pass_params.encoder_layers == 0) {
+			states.push_back(stream->state_instance);
+			samples.push_back(stream->pcmf32.data());
+			n_samples.push_back(stream->pcmf32.size());
+			const int stream_audio_ctx = stream->pass_params.audio_ctx > 0 ? stream->pass_params.audio_ctx : whisper_n_audio_ctx(speech_to_text_obj->context_instance);
+			audio_ctx = MAX(audio_ctx, stream_audio_ctx);
+		}
+	}
+	if (states.size() > 1) {
+		for (SpeechToTextStream *stream : passes) {
+			// whisper_full only reuses the batched encoding with the audio_ctx it was made with.
+			if (!stream->pass_remote && !stream->pass_pre_encoded && !stream->pass_draft && !stream->pass_command && !stream->pass_wake && !stream->state_encoder_offloaded && stream->pass_params.encoder_layers == 0) {
+				stream->pass_params.audio_ctx = audio_ctx;
+			}
+		}
+		int ret = whisper_encode_batch_with_states(speech_to_text_obj->context_instance, states.data(), samples.data(), n_samples.data(), states.size(), audio_ctx, speech_to_text_obj->_get_threads_per_decode());
+		if (ret != 0) {
+			// Every stream encodes on its own in whisper_full then.
+			ERR_PRINT("Failed to encode the batch, returned " + rtos(ret));
+		}
+	}
+	if (speech_to_text_obj->get_decoder_batch_size() <= 1 || passes.size() <= 1) {
+		for (SpeechToTextStream *stream : passes) {
+			stream->_finish_pass();
+		}
+		return;
+	}
+	// Decoding at the same time, the streams' decoder steps run as one graph, see whisper_ctx_set_decode_batching.
+	// The passes split the threads of the worker, a step of the group runs on the threads of all of them.
+	for (SpeechToTextStream *stream : passes) {
+		stream->pass_params.n_threads = MAX(1, stream->pass_params.n_threads / int(passes.size()));
+	}
+	void (*finish_pass)(void *, uint32_t) = [](void *p_passes, uint32_t p_index) {
+		static_cast<SpeechToTextStream **>(p_passes)[p_index]->_finish_pass();
+	};
+	speech_to_text_obj->scheduler.run_parallel(finish_pass, passes.data(), passes.size());
+}
+
+void SpeechToTextStream::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("add_audio_buffer", "buffer"), &SpeechToTextStream::add_audio_buffer);
+	ClassDB::bind_method(D_METHOD("add_audio_mono_f32", "samples", "rate"), &SpeechToTextStream::add_audio_mono_f32, DEFVAL(SpeechToText::SPEECH_SETTING_SAMPLE_RATE));
+	ClassDB::bind_method(D_METHOD("add_audio_pcm16", "pcm", "rate", "channels"), &SpeechToTextStream::add_audio_pcm16, DEFVAL(SpeechToText::SPEECH_SETTING_SAMPLE_RATE), DEFVAL(1));
+	ClassDB::bind_method(D_METHOD("add_audio_opus", "packet"), &SpeechToTextStream::add_audio_opus);
+	ClassDB::bind_method(D_METHOD("start_recording", "path"), &SpeechToTextStream::start_recording);
+	ClassDB::bind_method(D_METHOD("stop_recording"), &SpeechToTextStream::stop_recording);
+	ClassDB::bind_method(D_METHOD("is_recording"), &SpeechToTextStream::is_recording);
+	ClassDB::bind_method(D_METHOD("start_listen"), &SpeechToTextStream::start_listen);
+	ClassDB::bind_method(D_METHOD("serialize_state"), &SpeechToTextStream::serialize_state);
+	ClassDB::bind_method(D_METHOD("restore_state", "state"), &SpeechToTextStream::restore_state);
+	ClassDB::bind_method(D_METHOD("stop_listen"), &SpeechToTextStream::stop_listen);
+	ClassDB::bind_method(D_METHOD("is_listening"), &SpeechToTextStream::is_listening);
+	ClassDB::bind_method(D_METHOD("get_resampler_quality"), &SpeechToTextStream::get_resampler_quality);
+	ClassDB::bind_method(D_METHOD("set_resampler_quality", "resampler_quality"), &SpeechToTextStream::set_resampler_quality);
+	ClassDB::bind_method(D_METHOD("get_audio_queue_seconds"), &SpeechToTextStream::get_audio_queue_seconds);
+	ClassDB::bind_method(D_METHOD("set_audio_queue_seconds", "audio_queue_seconds"), &SpeechToTextStream::set_audio_queue_seconds);
+	ClassDB::bind_method(D_METHOD("get_audio_queue_format"), &SpeechToTextStream::get_audio_queue_format);
+	ClassDB::bind_method(D_METHOD("set_audio_queue_format", "audio_queue_format"), &SpeechToTextStream::set_audio_queue_format);
+	ClassDB::bind_method(D_METHOD("get_audio_queue_overflow_policy"), &SpeechToTextStream::get_audio_queue_overflow_policy);
+	ClassDB::bind_method(D_METHOD("set_audio_queue_overflow_policy", "audio_queue_overflow_policy"), &SpeechToTextStream::set_audio_queue_overflow_policy);
+	ClassDB::bind_method(D_METHOD("get_max_backlog_seconds"), &SpeechToTextStream::get_max_backlog_seconds);
+	ClassDB::bind_method(D_METHOD("set_max_backlog_seconds", "max_backlog_seconds"), &SpeechToTextStream::set_max_backlog_seconds);
+	ClassDB::bind_method(D_METHOD("get_dropped_audio_frames"), &SpeechToTextStream::get_dropped_audio_frames);
+	ClassDB::bind_method(D_METHOD("is_realtime_ingest"), &SpeechToTextStream::is_realtime_ingest);
+	ClassDB::bind_method(D_METHOD("set_realtime_ingest", "realtime_ingest"), &SpeechToTextStream::set_realtime_ingest);
+	ClassDB::bind_method(D_METHOD("is_ingest_thread_realtime"), &SpeechToTextStream::is_ingest_thread_realtime);
+	ClassDB::bind_method(D_METHOD("get_speech_probabilities"), &SpeechToTextStream::get_speech_probabilities);
+	ClassDB::bind_method(D_METHOD("get_max_latency_ms"), &SpeechToTextStream::get_max_latency_ms);
+	ClassDB::bind_method(D_METHOD("set_max_latency_ms", "max_latency_ms"), &SpeechToTextStream::set_max_latency_ms);
+	ClassDB::bind_method(D_METHOD("get_priority_class"), &SpeechToTextStream::get_priority_class);
+	ClassDB::bind_method(D_METHOD("set_priority_class", "priority_class"), &SpeechToTextStream::set_priority_class);
+	ClassDB::bind_method(D_METHOD("get_missed_deadlines"), &SpeechToTextStream::get_missed_deadlines);
+	ClassDB::bind_method(D_METHOD("get_last_timings"), &SpeechToTextStream::get_last_timings);
+	ClassDB::bind_method(D_METHOD("get_timings"), &SpeechToTextStream::get_timings);
+	ClassDB::bind_method(D_METHOD("reset_timings"), &SpeechToTextStream::reset_timings);
+	ClassDB::bind_method(D_METHOD("get_latency_histogram"), &SpeechToTextStream::get_latency_histogram);
+	ClassDB::bind_method(D_METHOD("get_results_interval_ms"), &SpeechToTextStream::get_results_interval_ms);
+	ClassDB::bind_method(D_METHOD("set_results_interval_ms", "results_interval_ms"), &SpeechToTextStream::set_results_interval_ms);
+	ClassDB::bind_method(D_METHOD("_flush_results"), &SpeechToTextStream::_flush_results);
+	ClassDB::bind_method(D_METHOD("get_results_delivery"), &SpeechToTextStream::get_results_delivery);
+	ClassDB::bind_method(D_METHOD("set_results_delivery", "results_delivery"), &SpeechToTextStream::set_results_delivery);
+	ClassDB::bind_method(D_METHOD("is_stream_tokens"), &SpeechToTextStream::is_stream_tokens);
+	ClassDB::bind_method(D_METHOD("set_stream_tokens", "stream_tokens"), &SpeechToTextStream::set_stream_tokens);
+	ClassDB::bind_method(D_METHOD("is_delta_partials"), &SpeechToTextStream::is_delta_partials);
+	ClassDB::bind_method(D_METHOD("set_delta_partials", "delta_partials"), &SpeechToTextStream::set_delta_partials);
+	ClassDB::bind_method(D_METHOD("poll_results", "max"), &SpeechToTextStream::poll_results, DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("poll_packed_results", "results", "max"), &SpeechToTextStream::poll_packed_results, DEFVAL(0));
+	ClassDB::bind_method(D_METHOD("get_dropped_results"), &SpeechToTextStream::get_dropped_results);
+	ClassDB::bind_method(D_METHOD("get_quality_level"), &SpeechToTextStream::get_quality_level);
+	ClassDB::bind_method(D_METHOD("get_command_phrases"), &SpeechToTextStream::get_command_phrases);
+	ClassDB::bind_method(D_METHOD("set_command_phrases", "command_phrases"), &SpeechToTextStream::set_command_phrases);
+	ClassDB::bind_method(D_METHOD("get_wake_phrases"), &SpeechToTextStream::get_wake_phrases);
+	ClassDB::bind_method(D_METHOD("set_wake_phrases", "wake_phrases"), &SpeechToTextStream::set_wake_phrases);
+	ClassDB::bind_method(D_METHOD("get_wake_threshold"), &SpeechToTextStream::get_wake_threshold);
+	ClassDB::bind_method(D_METHOD("set_wake_threshold", "wake_threshold"), &SpeechToTextStream::set_wake_threshold);
+	ClassDB::bind_method(D_METHOD("get_wake_seconds"), &SpeechToTextStream::get_wake_seconds);
+	ClassDB::bind_method(D_METHOD("set_wake_seconds", "wake_seconds"), &SpeechToTextStream::set_wake_seconds);
+	ClassDB::bind_method(D_METHOD("is_awake"), &SpeechToTextStream::is_awake);
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "resampler_quality", PROPERTY_HINT_ENUM, "Sinc Best,Sinc Medium,Sinc Fastest,Zero Order Hold,Linear,Polyphase"), "set_resampler_quality", "get_resampler_quality");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "audio_queue_seconds"), "set_audio_queue_seconds", "get_audio_queue_seconds");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "audio_queue_format", PROPERTY_HINT_ENUM, "Float 32,Int 16"), "set_audio_queue_format", "get_audio_queue_format");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "audio_queue_overflow_policy", PROPERTY_HINT_ENUM, "Drop Oldest,Drop Newest,Block,Skip To Latest Segment"), "set_audio_queue_overflow_policy", "get_audio_queue_overflow_policy");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "max_backlog_seconds"), "set_max_backlog_seconds", "get_max_backlog_seconds");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "realtime_ingest"), "set_realtime_ingest", "is_realtime_ingest");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "max_latency_ms"), "set_max_latency_ms", "get_max_latency_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "priority_class", PROPERTY_HINT_ENUM, "Interactive,Caption,Background"), "set_priority_class", "get_priority_class");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "results_interval_ms"), "set_results_interval_ms", "get_results_interval_ms");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "results_delivery", PROPERTY_HINT_ENUM, "Signal,Poll,Packed Signal"), "set_results_delivery", "get_results_delivery");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "stream_tokens"), "set_stream_tokens", "is_stream_tokens");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "delta_partials"), "set_delta_partials", "is_delta_partials");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_STRING_ARRAY, "command_phrases"), "set_command_phrases", "get_command_phrases");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_STRING_ARRAY, "wake_phrases"), "set_wake_phrases", "get_wake_phrases");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "wake_threshold", PROPERTY_HINT_RANGE, "0,1,0.01"), "set_wake_threshold", "get_wake_threshold");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "wake_seconds"), "set_wake_seconds", "get_wake_seconds");
+
+	BIND_ENUM_CONSTANT(QUALITY_FULL);
+	BIND_ENUM_CONSTANT(QUALITY_FIT_AUDIO_CTX);
+	BIND_ENUM_CONSTANT(QUALITY_FEWER_TOKENS);
+	BIND_ENUM_CONSTANT(QUALITY_NO_FALLBACK);
+	BIND_ENUM_CONSTANT(QUALITY_DRAFT_MODEL);
+	BIND_ENUM_CONSTANT(QUALITY_NO_PARTIALS);
+
+	BIND_ENUM_CONSTANT(RESULTS_SIGNAL);
+	BIND_ENUM_CONSTANT(RESULTS_POLL);
+	BIND_ENUM_CONSTANT(RESULTS_PACKED_SIGNAL);
+
+	BIND_ENUM_CONSTANT(PRIORITY_INTERACTIVE);
+	BIND_ENUM_CONSTANT(PRIORITY_CAPTION);
+	BIND_ENUM_CONSTANT(PRIORITY_BACKGROUND);
+
+	ADD_SIGNAL(MethodInfo("audio_dropped", PropertyInfo(Variant::FLOAT, "dropped_seconds"), PropertyInfo(Variant::FLOAT, "total_dropped_seconds")));
+	ADD_SIGNAL(MethodInfo("update_transcribed_msgs", PropertyInfo(Variant::INT, "process_time_ms"), PropertyInfo(Variant::ARRAY, "transcription_results", PROPERTY_HINT_ARRAY_TYPE, "TranscriptionResult")));
+	ADD_SIGNAL(MethodInfo("update_transcribed_packed", PropertyInfo(Variant::INT, "process_time_ms"), PropertyInfo(Variant::OBJECT, "results", PROPERTY_HINT_RESOURCE_TYPE, "PackedTranscriptionResults")));
+	ADD_SIGNAL(MethodInfo("command_recognized", PropertyInfo(Variant::INT, "process_time_ms"), PropertyInfo(Variant::STRING, "phrase"), PropertyInfo(Variant::INT, "index"), PropertyInfo(Variant::FLOAT, "confidence")));
+	ADD_SIGNAL(MethodInfo("keyword_detected", PropertyInfo(Variant::STRING, "phrase"), PropertyInfo(Variant::INT, "index"), PropertyInfo(Variant::FLOAT, "confidence")));
+}
@@ -0,0 +1,597 @@
+#ifndef SPEECH_TO_TEXT_STREAM_H
+#define SPEECH_TO_TEXT_STREAM_H
+
+#include "audio_high_pass_batch.h"
+#include "audio_recording.h"
+#include "audio_resampler.h"
+#include "audio_ring_buffer.h"
+#include "endpoint_policy.h"
+#include "mel_vad.h"
+#include "echo_canceller.h"
+#include "latency_histogram.h"
+#include "noise_suppressor.h"
+#include "opus_packet_decoder.h"
+#include "packed_transcription_results.h"
+#include "remote_inference.h"
+#include "sample_window.h"
+#include "speech_to_text_params.h"
+#include "speech_segmenter.h"
+#include "transcription_result.h"
+#include "vad_engine.h"
+#include "voice_activity_detector.h"
+
+#include <whisper.cpp/whisper.h>
+#include <godot_cpp/classes/mutex.hpp>
+#include <godot_cpp/classes/ref_counted.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/packed_float32_array.hpp>
+#include <godot_cpp/variant/packed_string_array.hpp>
+#include <godot_cpp/variant/packed_vector2_array.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace godot;
+
+/* Worker side text of one pass, handed to scripts as a TranscriptionResult. */
+struct transcribed_msg {
+	std::string text;
+	bool is_partial;
+	/* Seconds of audio given to add_audio_buffer since start_listen, silence cut by the segmenter included. */
+	double start_time = 0.0;
+	double end_time = 0.0;
+};
+
+/**
+ * Transients of the postprocessing of a pass. Cleared rather than freed, so
+ * once they grew to the size of a pass the next ones do not allocate them.
+ */
+struct pass_scratch {
+	transcribed_msg msg;
+	std::vector<whisper_token_data> text_tokens; // text tokens only
+	std::vector<size_t> text_token_ends; // end of the text of each of text_tokens in msg.text
+	std::vector<size_t> text_token_iter_ends; // iter_tokens up to and including each of text_tokens
+	std::vector<int> turn_token_indices; // index of the first text token after each speaker turn
+	std::vector<int64_t> turn_times; // end time of each turn token
+
+	void clear() {
+		msg.text.clear();
+		msg.is_partial = false;
+		msg.start_time = 0.0;
+		msg.end_time = 0.0;
+		text_tokens.clear();
+		text_token_ends.clear();
+		text_token_iter_ends.clear();
+		turn_token_indices.clear();
+		turn_times.clear();
+	}
+};
+
+/* Milliseconds spent in each stage, for one pass or summed over many, see SpeechToTextStream::get_last_timings(). */
+struct stage_timings {
+	double resample_ms = 0.0; // downmix and resampling in add_audio_buffer
+	double vad_ms = 0.0; // noise suppression, VAD and segmenter in add_audio_buffer
+	double queue_wait_ms = 0.0; // from the stream becoming ready to a worker taking it
+	double mel_ms = 0.0;
+	double encode_ms = 0.0;
+	double decode_ms = 0.0; // decoder graphs, single token steps, draft checks and prompts together
+	double sample_ms = 0.0;
+	double postprocess_ms = 0.0; // tokens to a TranscriptionResult after whisper_full returned
+	uint64_t passes = 0;
+
+	void add(const stage_timings &p_timings);
+	Dictionary to_dictionary() const;
+};
+
+/* Phrases a stream scores instead of decoding text, see SpeechToTextStream::set_command_phrases() and set_wake_phrases(). */
+struct scored_phrases {
+	std::vector<std::string> texts;
+	std::vector<std::vector<whisper_token>> tokens; // of texts, tokenized for context
+	whisper_context *context = nullptr; // reset by SpeechToText when the context changes
+
+	void set_texts(const PackedStringArray &p_phrases);
+	/* A no-op when they already are tokenized for p_context. */
+	void tokenize(whisper_context *p_context);
+	/* whisper_score_sequences_with_state on the mel of p_state, returns its error code. */
+	int score(whisper_context *p_context, whisper_state *p_state, const whisper_full_params &p_params, int p_lang_id, bool p_add_eot, std::vector<float> &r_log_probs) const;
+};
+
+class SpeechToText;
+
+/**
+ * One audio source being transcribed, e.g. one speaker of a voice chat. Each
+ * stream has its own audio queue, VAD and whisper_state, the weights and the
+ * decoding settings are shared through the SpeechToText singleton and
+ * picked up at the start of the next pass.
+ */
+class SpeechToTextStream : public RefCounted {
+	GDCLASS(SpeechToTextStream, RefCounted);
+
+	friend class SpeechToText;
+	friend class TranscriptionScheduler;
+	friend class AudioEffectWhisperCaptureInstance;
+	friend class MicrophoneCapture;
+	friend class SharedMemoryCapture;
+	friend class TranscriptionJob;
+	friend class SpeechToTextBenchmark;
+
+	AudioResampler resampler;
+#ifdef REAL_T_IS_DOUBLE
+	std::vector<float> stereo_scratch; // add_audio_buffer input narrowed to float frames, only grows
+#endif
+	std::vector<float> ingest_scratch; // downmixed input before resampling, only grows
+	std::vector<float> resample_scratch; // resampled input before it is queued, only grows
+	/* Stereo frames of the last chunk the fused 3:1 path could not use yet. */
+	float decimate_carry[4];
+	uint32_t decimate_carry_frames = 0;
+	OpusPacketDecoder opus_decoder; // producer side, only used by add_audio_opus
+	AudioRecording recording; // of the add_audio_buffer calls, between start_recording and stop_recording
+	EchoCanceller ingest_echo_canceller; // producer side, before ingest_suppressor, reset when it is turned on
+	NoiseSuppressor ingest_suppressor; // producer side, reset when it is turned on
+	/* Producer side VAD, rebuilt when SpeechToText.vad_mode changes. */
+	std::unique_ptr<VadEngine> ingest_vad;
+	int ingest_vad_mode = -1;
+	bool restored_ingest = false; // restore_state() set the ingest VAD, the suppressor and the endpoint, the next start_listen keeps them
+	std::vector<float> speech_probabilities; // per 10 ms frame of the last add_audio_buffer
+	std::vector<float> vad_filter_scratch; // the chunk through the high-pass of add_audio_batch, only grows
+	/**
+	 * With realtime_ingest, the callers of add_audio_buffer and the capture threads only copy their chunks
+	 * to these slots, and the front-end thread, in the audio class of the platform, runs the resampler, the
+	 * filters and the VAD on them. The callers never lock, frontend_head and frontend_tail hand the slots over.
+	 */
+	struct FrontendChunk {
+		std::vector<float> samples; // only grows
+		uint32_t frames = 0;
+		uint32_t rate = 0;
+		bool is_stereo = false;
+		bool may_block = false;
+		uint64_t captured_usec = 0;
+	};
+	static const int FRONTEND_SLOTS = 32;
+	FrontendChunk frontend_chunks[FRONTEND_SLOTS];
+	std::atomic<uint64_t> frontend_head{ 0 }; // chunks handed over
+	std::atomic<uint64_t> frontend_tail{ 0 }; // chunks the front-end thread is done with
+	std::atomic<uint64_t> frontend_dropped_frames{ 0 }; // of chunks that found every slot taken
+	bool realtime_ingest = false;
+	std::atomic<bool> frontend_running{ false };
+	std::atomic<bool> frontend_realtime{ false }; // the platform raised the thread
+	std::thread::id frontend_thread_id; // set before frontend_running
+	uint64_t frontend_captured_usec = 0; // front-end thread, of the chunk it ingests
+	std::thread frontend_thread;
+	std::mutex frontend_mutex;
+	std::condition_variable frontend_cond;
+	bool frontend_exit = false; // under frontend_mutex
+	SpeechSegmenter segmenter; // only its voiced runs are queued
+	EndpointPolicy endpoint; // producer side, tracks the speaking rate from the pauses of the segmenter
+	uint64_t endpoint_voiced_frames = 0; // voiced frames of the segmenter when the last utterance ended
+	uint64_t endpoint_pause_count = 0;
+	/* Set by the producer when an utterance ended, the next pass closes the segment without waiting for a second without passes. */
+	std::atomic<bool> endpoint_pending{ false };
+	/* Queue position after the last chunk the segmenter found speech in, the audio after it was only pre-roll and hang-over. */
+	std::atomic<uint64_t> voiced_queue_end{ 0 };
+	std::vector<float> voiced_scratch;
+	std::vector<SpeechSegmenter::Segment> segment_scratch;
+	/* Ingest time in microseconds since the last pass, taken by it. Atomic, the audio thread never locks. */
+	std::atomic<uint64_t> ingest_resample_usec{ 0 };
+	std::atomic<uint64_t> ingest_vad_usec{ 0 };
+	AudioRingBuffer audio_queue; // add_audio_buffer is the only producer, _process() the only consumer
+	float audio_queue_seconds = 30.0f;
+	int audio_queue_format = AudioRingBuffer::FORMAT_F32;
+	int audio_queue_overflow_policy = AudioRingBuffer::OVERFLOW_DROP_OLDEST;
+	float max_backlog_seconds = 0.0f; // 0 only bounds the queue by audio_queue_seconds
+	uint64_t reported_dropped_frames = 0; // decoder side, dropped frames audio_dropped was emitted for
+	std::atomic<size_t> wake_threshold_frames; // queued audio that makes the stream ready for a pass, SpeechToText.pass_trigger_ms
+	std::atomic<bool> is_running = false;
+	// Decoding buffers, created by _process() on demand and released by SpeechToText when the context changes.
+	whisper_state *state_instance = nullptr;
+	whisper_state *draft_state_instance = nullptr; // same for SpeechToText::draft_context_instance
+	bool state_encoder_offloaded = false; // state_instance encodes with Core ML or OpenVINO, on the full audio context and on its own
+	int t_last_iter;
+	/* Where the voiced runs start in the queue and in the input, to map decoded audio back to input time. */
+	struct segment_marker {
+		uint64_t queue_position;
+		uint64_t input_position;
+	};
+	std::deque<segment_marker> s_segment_markers;
+	/* Input position a chunk of voiced input ended at and the Time ticks it was captured at, for the latency of the results. */
+	struct capture_marker {
+		uint64_t input_position;
+		uint64_t usec;
+	};
+	std::deque<capture_marker> s_capture_markers;
+	LatencyHistogram latency_histogram; // capture of the latest sample of a result to its delivery
+	/* Stage times of the last pass and of all passes since reset_timings(), the whisper ones moved out of the states. */
+	stage_timings s_last_timings;
+	stage_timings s_timings;
+	Mutex s_mutex; // for accessing shared variables from both main thread and worker thread
+
+	/* Decoder side, only touched by the scheduler worker running the pass. */
+	std::shared_ptr<const SpeechToTextParams> settings; // snapshot whisper_params was made from, kept for the whole pass
+	whisper_full_params whisper_params;
+	SampleWindow pcmf32; // audio of the open segment
+	uint64_t pcmf32_end_position = 0; // queue position right after the last sample of pcmf32
+	uint64_t pcmf32_mel_offset = 0; // samples trimmed off pcmf32 so far, keys the mel cache of the state
+	VoiceActivityDetector vad; // fed with every sample appended to pcmf32
+	MelVad mel_vad; // fed with the mel frames of every pass instead, with SpeechToText.mel_vad
+	bool pass_mel_vad = false;
+	/* Tokens of the current iteration, and the last committed ones, at most half the text context. */
+	std::vector<whisper_token> iter_tokens;
+	std::vector<whisper_token> committed_tokens;
+	size_t segment_token_count = 0; // last committed tokens of the open segment, the prompt of incremental mode
+	int committed_tokens_n_vocab = 0; // of the model committed_tokens were checked against, 0 after restore_state
+	int restored_n_vocab = 0; // the n_vocab restore_state was given, 0 when unknown
+	std::vector<whisper_token> pass_prompt_tokens; // initial_prompt and the committed context, pass_params points into it
+	/* Result of the last pass while pcmf32 was not trimmed since, verified as draft by the next one. */
+	std::vector<whisper_token> draft_tokens;
+	/* Text tokens of the last partial passes since pcmf32 was trimmed, oldest first, see SpeechToText.local_agreement. */
+	std::vector<std::vector<whisper_token>> agreement_history;
+	pass_scratch scratch;
+	/* Language auto-detection cache, a pinned language is decoded with instead of detecting it again. */
+	int pinned_lang_id = -1;
+	float pinned_lang_prob = 0.0f;
+	int candidate_lang_id = -1; // detected with language_pin_probability on the last passes
+	float candidate_seconds = 0.0f; // new audio of those passes
+
+	/* The pass in flight, see _begin_pass(). */
+	whisper_full_params pass_params;
+	bool pass_close_segment = false;
+	float pass_time_started = 0.0f;
+	double pass_queue_wait_ms = 0.0; // set by the scheduler when it took the stream
+	uint32_t pass_generation = 0; // SpeechToText::cancel_generation when the pass began
+	bool pass_is_restart = false; // a restarted pass is not restarted again for staleness
+	bool pass_pre_encoded = false; // the chunked encoder already filled the state, the pass is not batched
+	bool pass_draft = false; // decoded with the draft model, only reports a partial result and is not batched
+	bool pass_auto_language = false; // SpeechToText.language is auto, the pass detects or uses pinned_lang_id
+	bool pass_language_pinned = false;
+	size_t pass_new_samples = 0;
+	bool pass_command = false; // scores command_set instead of decoding, see set_command_phrases()
+	bool pass_wake = false; // only spots wake_set, the stream is asleep
+	bool pass_remote = false; // the buffer goes to SpeechToText.remote_inference_url instead of whisper_full, not batched
+	std::atomic<bool> pass_restart = false; // set by _abort_pass, the scheduler runs the stream again
+
+	RemoteInference remote; // only used by the worker of the pass
+	uint64_t remote_paused_until_msec = 0; // the server failed or was too slow, the passes decode locally until then
+
+	/**
+	 * Pipelined encoding, see SpeechToText.pipelined_encoding. While a pass decodes, the encoder thread waits
+	 * for the audio that makes the stream ready again and encodes pcmf32 with it on prefetch_state_instance.
+	 * The next pass swaps the two states when it starts from the same buffer. prefetch_stage hands the
+	 * prefetch fields between the worker and the encoder thread, encoder_mutex only lets them sleep.
+	 */
+	enum PrefetchStage {
+		PREFETCH_IDLE, // the fields belong to the worker, nothing is encoded ahead
+		PREFETCH_QUEUED, // they belong to the encoder thread
+		PREFETCH_READY, // back with the worker, prefetch_state_instance holds the encoding of prefetch_pcmf32
+	};
+	whisper_state *prefetch_state_instance = nullptr;
+	bool prefetch_encoder_offloaded = false;
+	SampleWindow prefetch_pcmf32; // pcmf32 of the pass, then the audio queued meanwhile
+	size_t prefetch_base_size = 0; // pcmf32 the prefetch started from
+	uint64_t prefetch_base_end = 0;
+	uint64_t prefetch_mel_offset = 0;
+	uint64_t prefetch_read_position = 0; // queue position of the first frame it appended
+	size_t prefetch_new_samples = 0;
+	int prefetch_audio_ctx = 0;
+	int prefetch_n_threads = 1;
+	std::atomic<int> prefetch_stage{ PREFETCH_IDLE };
+	std::atomic<bool> prefetch_cancel{ false }; // the pass finished, stop waiting for audio
+	std::thread encoder_thread;
+	std::mutex encoder_mutex;
+	std::condition_variable encoder_cond;
+	bool encoder_exit = false; // under encoder_mutex
+
+	/* Command mode and wake phrases. The phrases are set by the main thread under s_mutex, the decoder side takes a copy. */
+	PackedStringArray command_phrases;
+	PackedStringArray wake_phrases;
+	bool phrases_changed = false;
+	scored_phrases command_set;
+	scored_phrases wake_set;
+	float wake_threshold = 0.5f;
+	float wake_seconds = 10.0f;
+	std::atomic<uint64_t> awake_until_msec{ 0 }; // passes transcribe until then, only the wake phrases are spotted after it
+
+	/* Adaptive quality controller, see _update_quality_level(). Decoder side, the level is read by scripts too. */
+	std::atomic<int> quality_level{ 0 };
+	float quality_rtf = 0.0f; // smoothed wall time per second of new audio of the decoded passes
+	int quality_settle_left = 0; // passes to wait before the next step, so the effect of the last one shows
+	int quality_headroom_count = 0; // passes in a row with headroom
+	size_t quality_skipped_samples = 0; // new audio of the partial passes skipped since the last decoded one, for either reason
+
+	/* Results on their way to update_transcribed_msgs, see _queue_result(). */
+	Mutex results_mutex;
+	std::vector<Ref<TranscriptionResult>> pending_results; // under results_mutex, only the last one can be partial
+	std::vector<Ref<TranscriptionResult>> flushed_results; // main thread, swapped with pending_results so both keep their storage
+	Ref<PackedTranscriptionResults> packed_results; // main thread, filled again by every update_transcribed_packed
+	float pending_process_time_ms = 0.0f; // of the newest pending result, under results_mutex
+	bool results_flush_queued = false; // under results_mutex, a _flush_results() call is deferred or on a timer
+	bool _has_queued_results();
+	uint64_t last_results_msec = 0; // main thread, when update_transcribed_msgs was last emitted
+	int results_interval_ms = 0;
+	/* Single producer ring of the results for poll_results(), the scheduler never runs two passes of a stream at once. */
+	std::atomic<int> results_delivery{ 0 };
+	/* Partial results from within the decode, see set_stream_tokens. The text is rebuilt on the decoder side every step. */
+	std::atomic<bool> stream_tokens{ false };
+	std::string streamed_text;
+	size_t streamed_text_size = 0; // of the last streamed result of the pass, steps without new text are not reported
+	std::vector<Ref<TranscriptionResult>> polled_results;
+	std::atomic<uint64_t> polled_write{ 0 }; // written by the pass
+	std::atomic<uint64_t> polled_read{ 0 }; // written by poll_results()
+	std::vector<Ref<TranscriptionResult>> polled_taken; // of the polling thread, see _take_polled_results()
+	void _take_polled_results(int p_max);
+	std::atomic<uint64_t> dropped_results{ 0 };
+	/* See set_delta_partials. delivered_text is on the side of the results, what the last one delivered left tentative. */
+	std::atomic<bool> delta_partials{ false };
+	String delivered_text;
+	void _encode_delta(const Ref<TranscriptionResult> &p_result);
+
+	/* Read by the Performance monitors of SpeechToText. */
+	std::atomic<uint64_t> buffered_frames{ 0 }; // pcmf32 of the last pass
+	std::atomic<uint64_t> state_memory{ 0 }; // bytes of state_instance, draft_state_instance and prefetch_state_instance
+	/* The same split up, see whisper_state_memory. The mel counts towards the audio buffers. */
+	std::atomic<uint64_t> kv_memory{ 0 };
+	std::atomic<uint64_t> compute_memory{ 0 };
+	std::atomic<uint64_t> mel_memory{ 0 };
+	std::atomic<uint64_t> audio_memory{ 0 }; // audio_queue, pcmf32 and prefetch_pcmf32, set after every pass
+
+	/* Scheduling state, guarded by the TranscriptionScheduler mutex. */
+	bool is_ready = false;
+	bool is_processing = false;
+	uint64_t ready_msec = 0;
+	uint64_t last_process_msec = 0;
+	int max_latency_ms = 1000;
+	int priority_class = PRIORITY_CAPTION;
+	uint64_t pass_batch = 0; // serial of the pass in flight, shared by the streams batched into it
+	std::atomic<bool> pass_preempted{ false }; // set by the scheduler for a ready stream of a higher class, see _abort_pass
+	std::atomic<uint64_t> missed_deadlines{ 0 };
+
+	void _init_params();
+	void _apply_settings();
+	bool _refresh_settings();
+	void _update_audio_queue_limit();
+	uint64_t _get_input_position_locked(uint64_t p_queue_position) const;
+	double _get_input_time(size_t p_pcmf32_index);
+	int64_t _get_capture_usec(size_t p_pcmf32_index);
+	void _mark_delivered(const Ref<TranscriptionResult> &p_result, uint64_t p_now);
+	/* A chunk cleaned up for the VAD. SpeechToText::add_audio_batch stops every stream there, runs their high-pass filters together and goes on. */
+	struct IngestChunk {
+		const float *samples = nullptr; // until the chunk is detected, in resample_scratch or the buffer of the caller
+		const float *filtered = nullptr; // samples through the high-pass of the VAD if it ran already, in vad_filter_scratch
+		uint32_t count = 0;
+		uint64_t ingest_started = 0;
+		std::shared_ptr<const SpeechToTextParams> settings;
+	};
+	/* p_mix_rate 0 is the mix rate of the AudioServer. */
+	void _ingest_stereo(const float *p_stereo, uint32_t p_frames, bool p_may_block, uint32_t p_mix_rate = 0, IngestChunk *r_deferred = nullptr);
+	void _add_audio_buffer(const PackedVector2Array &p_buffer, uint32_t p_mix_rate, IngestChunk *r_deferred = nullptr);
+	void _ingest_mono(const float *p_samples, uint32_t p_frames, uint32_t p_rate, bool p_may_block, IngestChunk *r_deferred = nullptr);
+	void _ingest_speech(const float *p_samples, uint32_t p_count, uint64_t p_ingest_started, bool p_may_block, IngestChunk *r_deferred = nullptr);
+	void _detect_speech(const IngestChunk &p_chunk, bool p_may_block);
+	bool _get_high_pass_lane(IngestChunk &p_chunk, AudioHighPassLane &r_lane);
+	void _signal_endpoint();
+	uint32_t _downmix_decimate3(const float *p_stereo, uint32_t p_frames, float *p_dst);
+	whisper_state *_create_state(bool &r_encoder_offloaded);
+	int _fit_audio_ctx(size_t p_n_samples, int p_audio_ctx, whisper_context *p_context) const;
+	bool _begin_pass(bool p_close_segment);
+	/** With the context mutex held. Drop committed_tokens unless they are text tokens of p_context. */
+	void _check_committed_tokens(whisper_context *p_context);
+	bool _start_prefetch();
+	void _finish_prefetch();
+	bool _encode_prefetch();
+	void _encoder_loop();
+	void _stop_encoder_thread();
+	/** Whether the chunk went to the front-end thread, false when the caller ingests it itself. */
+	bool _hand_off(const float *p_samples, uint32_t p_frames, bool p_is_stereo, uint32_t p_rate, bool p_may_block);
+	void _frontend_loop();
+	void _start_frontend_thread();
+	void _stop_frontend_thread();
+	size_t _get_agreed_token_count(const std::string &p_text, const std::vector<whisper_token_data> &p_tokens, const std::vector<size_t> &p_token_ends, int p_passes) const;
+	void _add_agreement_pass(const std::vector<whisper_token_data> &p_tokens, int p_keep);
+	void _finish_pass();
+	bool _finish_remote_pass();
+	void _finish_command_pass();
+	void _finish_wake_pass();
+	int _get_pass_lang_id() const;
+	bool _is_speech_ending(float p_vad_thold) const;
+	float _get_vad_energy(int p_ms) const;
+	void _stay_awake();
+	void _drop_buffer();
+	void _trim_segment_markers();
+	void _process(bool p_close_segment);
+	void _update_quality_level(size_t p_backlog_frames);
+	void _apply_quality_level(whisper_context *p_context);
+	void _update_pinned_language(int p_lang_id, float p_lang_prob, float p_mean_token_probability);
+	void _collect_timings(whisper_state *p_state);
+	String _translate_pass(whisper_context *p_context, whisper_state *p_state, int p_lang_id, int64_t p_split_t);
+	void _update_state_memory();
+	void _update_audio_memory();
+	size_t _get_iter_threshold_samples() const;
+	void _add_postprocess_time(double p_ms);
+	void _queue_result(float p_process_time_ms, const Ref<TranscriptionResult> &p_result);
+	void _flush_results();
+	bool _push_polled_result(const Ref<TranscriptionResult> &p_result, size_t p_keep_free = 0);
+	static bool _abort_pass(void *p_stream);
+	static bool _encoder_begin(whisper_context *p_context, whisper_state *p_state, void *p_stream);
+	static void _filter_logits(whisper_context *p_context, whisper_state *p_state, const whisper_token_data *p_tokens, int p_n_tokens, float *p_logits, void *p_suppress_ids);
+	static void _on_new_tokens(whisper_context *p_context, whisper_state *p_state, const whisper_token_data *p_tokens, int p_n_tokens, void *p_stream);
+	static void _process_batch(SpeechToTextStream *const *p_streams, int p_count);
+
+protected:
+	static void _bind_methods();
+
+public:
+	/* What the adaptive quality controller gave up, each level includes the ones before it. See SpeechToText.adaptive_quality. */
+	enum QualityLevel {
+		QUALITY_FULL,
+		QUALITY_FIT_AUDIO_CTX, // audio_ctx fitted to the buffer without the audio_ctx_min floor
+		QUALITY_FEWER_TOKENS, // half of max_tokens
+		QUALITY_NO_FALLBACK, // no temperature fallback and greedy sampling
+		QUALITY_DRAFT_MODEL, // the passes that commit text decode with the draft model too, when it shares the vocabulary
+		QUALITY_NO_PARTIALS, // passes that cannot commit text are skipped
+		QUALITY_MAX = QUALITY_NO_PARTIALS,
+	};
+
+	void set_resampler_quality(int p_quality);
+	int get_resampler_quality();
+
+	void set_audio_queue_seconds(float p_seconds);
+	_FORCE_INLINE_ float get_audio_queue_seconds() { return audio_queue_seconds; }
+
+	/** AudioRingBuffer::SampleFormat of the queued audio, 16-bit halves its memory. Applied on the next start_listen while listening. */
+	void set_audio_queue_format(int p_format);
+	_FORCE_INLINE_ int get_audio_queue_format() { return audio_queue_format; }
+
+	void set_audio_queue_overflow_policy(int p_policy);
+	_FORCE_INLINE_ int get_audio_queue_overflow_policy() { return audio_queue_overflow_policy; }
+
+	/** Queued audio above this is handled by the overflow policy, so a stream that falls behind never decodes more than this backlog. 0 allows the whole audio_queue_seconds. */
+	void set_max_backlog_seconds(float p_seconds);
+	_FORCE_INLINE_ float get_max_backlog_seconds() { return max_backlog_seconds; }
+
+	_FORCE_INLINE_ int64_t get_dropped_audio_frames() { return audio_queue.get_dropped_frames() + frontend_dropped_frames.load(std::memory_order_relaxed); }
+
+	/**
+	 * Run the ingest, the resampler, the filters and the VAD, on a thread of the stream in the real-time class
+	 * of the platform's audio threads instead of on the callers of add_audio_buffer. Applied on the next start_listen while listening.
+	 */
+	_FORCE_INLINE_ void set_realtime_ingest(bool p_enabled) { realtime_ingest = p_enabled; }
+	_FORCE_INLINE_ bool is_realtime_ingest() { return realtime_ingest; }
+	/** Whether the platform gave the front-end thread of realtime_ingest its real-time class, MMCSS on Windows or a time constraint on Apple platforms. */
+	_FORCE_INLINE_ bool is_ingest_thread_realtime() { return frontend_realtime.load(std::memory_order_relaxed); }
+
+	/** Speech probability of every 10 ms frame of the last add_audio_buffer call. */
+	PackedFloat32Array get_speech_probabilities();
+
+	/** Used to order the streams when there are more ready than decoding workers. */
+	_FORCE_INLINE_ void set_max_latency_ms(int p_max_latency_ms) { max_latency_ms = MAX(0, p_max_latency_ms); }
+	_FORCE_INLINE_ int get_max_latency_ms() { return max_latency_ms; }
+	/* Order of the streams in the shared scheduler, a ready stream is decoded before the streams of a lower class. */
+	enum PriorityClass {
+		PRIORITY_INTERACTIVE, // e.g. the voice commands of the local player
+		PRIORITY_CAPTION, // live captions
+		PRIORITY_BACKGROUND, // e.g. transcripts of remote chat
+		PRIORITY_MAX,
+	};
+	/**
+	 * Ready streams are decoded class by class, by max_latency_ms within one. A stream that finds no idle worker
+	 * aborts the pass of a lower class at its next graph node, which runs again afterwards.
+	 */
+	_FORCE_INLINE_ void set_priority_class(int p_class) { priority_class = CLAMP(p_class, 0, PRIORITY_MAX - 1); }
+	_FORCE_INLINE_ int get_priority_class() { return priority_class; }
+	/** Passes that started later than max_latency_ms after the audio was ready. */
+	_FORCE_INLINE_ int64_t get_missed_deadlines() { return missed_deadlines.load(std::memory_order_relaxed); }
+
+	/**
+	 * Milliseconds the last pass spent per stage: resample_ms and vad_ms of the audio it took in, queue_wait_ms,
+	 * mel_ms, encode_ms, decode_ms, sample_ms and postprocess_ms, and passes (1 once a pass ran).
+	 */
+	Dictionary get_last_timings();
+	/** Same keys summed over the passes since reset_timings(). */
+	Dictionary get_timings();
+	void reset_timings();
+	/** Latency of the results from the capture of their latest sample to their delivery since start, see LatencyHistogram::to_dictionary(). Cleared by reset_timings(). */
+	Dictionary get_latency_histogram() const { return latency_histogram.to_dictionary(); }
+
+	/**
+	 * Least time between two update_transcribed_msgs of the stream. Results of the passes in between are
+	 * emitted together, partials that a newer result replaces are dropped. 0 emits once per frame.
+	 */
+	_FORCE_INLINE_ void set_results_interval_ms(int p_interval_ms) { results_interval_ms = MAX(0, p_interval_ms); }
+	_FORCE_INLINE_ int get_results_interval_ms() { return results_interval_ms; }
+
+	enum ResultDelivery {
+		RESULTS_SIGNAL, // update_transcribed_msgs
+		RESULTS_POLL, // poll_results()
+		RESULTS_PACKED_SIGNAL, // update_transcribed_packed
+	};
+	_FORCE_INLINE_ void set_results_delivery(int p_delivery) { results_delivery.store(p_delivery, std::memory_order_relaxed); }
+	_FORCE_INLINE_ int get_results_delivery() { return results_delivery.load(std::memory_order_relaxed); }
+	/**
+	 * With RESULTS_POLL delivery: take up to p_max of the results queued since the last call, oldest first, all of them
+	 * when p_max is 0 or less. Partials a newer result replaces are skipped. Takes no lock, any thread may poll but only
+	 * one at a time.
+	 */
+	Array poll_results(int p_max = 0);
+	/** poll_results() into the packed arrays of p_results, which it fills again, without an Object per result. Returns how many it took. */
+	int poll_packed_results(const Ref<PackedTranscriptionResults> &p_results, int p_max = 0);
+	/**
+	 * Report a partial result after every decoding step that added text, from within the pass, instead of only
+	 * once it decoded everything. Its tentative_text is what the decoder has so far, without token times or words;
+	 * the result of the pass follows as usual. With RESULTS_POLL they only take the first half of the queue.
+	 */
+	_FORCE_INLINE_ void set_stream_tokens(bool p_stream_tokens) { stream_tokens.store(p_stream_tokens, std::memory_order_relaxed); }
+	_FORCE_INLINE_ bool is_stream_tokens() { return stream_tokens.load(std::memory_order_relaxed); }
+	/**
+	 * Deliver partial results as the change from the tentative text of the result delivered before them: is_delta(),
+	 * the length of the prefix that stays and the text after it, instead of the whole tentative_text. Results that
+	 * commit text are delivered whole, their tentative_text is what the next delta applies to.
+	 */
+	_FORCE_INLINE_ void set_delta_partials(bool p_delta_partials) { delta_partials.store(p_delta_partials, std::memory_order_relaxed); }
+	_FORCE_INLINE_ bool is_delta_partials() { return delta_partials.load(std::memory_order_relaxed); }
+	/** Results lost because poll_results() was not called often enough to keep the queue from filling up. */
+	_FORCE_INLINE_ int64_t get_dropped_results() { return dropped_results.load(std::memory_order_relaxed); }
+
+	/** QualityLevel the last pass was decoded at. */
+	_FORCE_INLINE_ int get_quality_level() { return quality_level.load(std::memory_order_relaxed); }
+
+	_FORCE_INLINE_ bool is_listening() { return is_running; }
+
+	/**
+	 * Command mode: with phrases set, every utterance is matched against them instead of being transcribed,
+	 * and reported with command_recognized. The phrases are scored in one decoder pass over their shared
+	 * token prefixes, no text is generated, so a list of a few hundred short commands fits.
+	 * An empty array goes back to transcription.
+	 */
+	void set_command_phrases(const PackedStringArray &p_phrases);
+	PackedStringArray get_command_phrases();
+
+	/**
+	 * Wake phrases: with phrases set, the stream sleeps and each utterance is only checked for one of them,
+	 * with the draft model when there is one. A match emits keyword_detected and keeps the stream awake for
+	 * wake_seconds after its last text, the utterance with the phrase is transcribed too.
+	 */
+	void set_wake_phrases(const PackedStringArray &p_phrases);
+	PackedStringArray get_wake_phrases();
+	/** Geometric mean of the token probabilities of a wake phrase that wakes the stream. */
+	_FORCE_INLINE_ void set_wake_threshold(float p_wake_threshold) { wake_threshold = CLAMP(p_wake_threshold, 0.0f, 1.0f); }
+	_FORCE_INLINE_ float get_wake_threshold() { return wake_threshold; }
+	_FORCE_INLINE_ void set_wake_seconds(float p_wake_seconds) { wake_seconds = MAX(0.0f, p_wake_seconds); }
+	_FORCE_INLINE_ float get_wake_seconds() { return wake_seconds; }
+	/** Whether the passes transcribe, always without wake phrases. */
+	bool is_awake();
+
+	void add_audio_buffer(PackedVector2Array buffer);
+	void add_audio_mono_f32(const PackedFloat32Array &p_samples, int p_rate);
+	void add_audio_pcm16(const PackedByteArray &p_pcm, int p_rate, int p_channels);
+	Error add_audio_opus(const PackedByteArray &p_packet);
+	/** Record every add_audio_buffer call with its timing into p_path, which SpeechToTextBenchmark.start replays. */
+	Error start_recording(const String &p_path);
+	void stop_recording();
+	_FORCE_INLINE_ bool is_recording() const { return recording.is_recording(); }
+	void start_listen();
+	void stop_listen();
+
+	/**
+	 * What a stopped stream needs to go on elsewhere, e.g. on another node of a cluster or after a pause of
+	 * the session: the audio of the open segment and the queued one, the committed context, the pinned
+	 * language and the state of the VADs, the noise suppressor and the endpoint. restore_state() of a stopped
+	 * stream takes it back, start_listen then goes on where the other stream stopped.
+	 */
+	PackedByteArray serialize_state();
+	Error restore_state(const PackedByteArray &p_state);
+
+	SpeechToTextStream();
+	~SpeechToTextStream();
+};
+
+VARIANT_ENUM_CAST(SpeechToTextStream::QualityLevel);
+VARIANT_ENUM_CAST(SpeechToTextStream::ResultDelivery);
+VARIANT_ENUM_CAST(SpeechToTextStream::PriorityClass);
+
+#endif // SPEECH_TO_TEXT_STREAM_H
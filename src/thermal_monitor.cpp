@@ -0,0 +1,138 @@
+#include "thermal_monitor.h"
+
+#include <godot_cpp/classes/time.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ANDROID__)
+#include <dlfcn.h>
+#elif defined(__APPLE__)
+#include <objc/message.h>
+#include <objc/runtime.h>
+#endif
+
+using namespace godot;
+
+/* The platforms refresh their state every few seconds, and Android rate limits the headroom to once a second. */
+static const uint64_t sample_interval_msec = 2000;
+
+std::atomic<int> ThermalMonitor::state{ THERMAL_NOMINAL };
+std::atomic<float> ThermalMonitor::headroom{ -1.0f };
+std::atomic<uint64_t> ThermalMonitor::sampled_msec{ 0 };
+
+#if defined(__ANDROID__)
+
+/* Seconds ahead Android forecasts the headroom for, about how long the controller takes to cool a pass down. */
+static const int headroom_forecast_seconds = 10;
+/* Forecast headroom from which the state is at least fair, and at least serious. 1 is where severe throttling starts. */
+static const float headroom_fair = 0.85f;
+static const float headroom_serious = 1.0f;
+
+/* AThermal_getCurrentThermalStatus, ATHERMAL_STATUS_* of android/thermal.h. */
+enum {
+	ANDROID_THERMAL_LIGHT = 1,
+	ANDROID_THERMAL_MODERATE = 2,
+	ANDROID_THERMAL_SEVERE = 3,
+};
+
+struct AThermalManager;
+
+/* AThermal is only there from Android 11 on, it is looked up at runtime so the library still loads on older versions. */
+struct AThermalApi {
+	AThermalManager *(*acquire_manager)() = nullptr;
+	int (*get_current_status)(AThermalManager *) = nullptr;
+	float (*get_headroom)(AThermalManager *, int) = nullptr; // Android 12, optional
+	AThermalManager *manager = nullptr;
+};
+
+template <typename T>
+static bool _load_symbol(void *p_library, const char *p_name, T &r_function) {
+	r_function = reinterpret_cast<T>(dlsym(p_library, p_name));
+	return r_function != nullptr;
+}
+
+static const AThermalApi &_get_athermal() {
+	static const AThermalApi api = []() {
+		AThermalApi loaded_api;
+		void *library = dlopen("libandroid.so", RTLD_NOW);
+		if (library == nullptr) {
+			return loaded_api;
+		}
+		if (_load_symbol(library, "AThermal_acquireManager", loaded_api.acquire_manager) &&
+				_load_symbol(library, "AThermal_getCurrentThermalStatus", loaded_api.get_current_status)) {
+			_load_symbol(library, "AThermal_getThermalHeadroom", loaded_api.get_headroom);
+			// Kept for the lifetime of the process, like the library.
+			loaded_api.manager = loaded_api.acquire_manager();
+		}
+		return loaded_api;
+	}();
+	return api;
+}
+
+void ThermalMonitor::_sample() {
+	const AThermalApi &api = _get_athermal();
+	if (api.manager == nullptr) {
+		return;
+	}
+	const int status = api.get_current_status(api.manager);
+	int new_state = THERMAL_NOMINAL;
+	if (status >= ANDROID_THERMAL_SEVERE) {
+		new_state = THERMAL_CRITICAL;
+	} else if (status == ANDROID_THERMAL_MODERATE) {
+		new_state = THERMAL_SERIOUS;
+	} else if (status == ANDROID_THERMAL_LIGHT) {
+		new_state = THERMAL_FAIR;
+	}
+	if (api.get_headroom != nullptr) {
+		// NaN while the device has no forecast yet or when asked too often, the last one stays then.
+		const float forecast = api.get_headroom(api.manager, headroom_forecast_seconds);
+		if (!std::isnan(forecast)) {
+			headroom.store(forecast, std::memory_order_relaxed);
+		}
+		const float current = headroom.load(std::memory_order_relaxed);
+		if (current >= headroom_serious) {
+			new_state = std::max(new_state, int(THERMAL_SERIOUS));
+		} else if (current >= headroom_fair) {
+			new_state = std::max(new_state, int(THERMAL_FAIR));
+		}
+	}
+	state.store(new_state, std::memory_order_relaxed);
+}
+
+#elif defined(__APPLE__)
+
+void ThermalMonitor::_sample() {
+	// NSProcessInfoThermalState has the same four levels as ThermalState.
+	static const SEL process_info_selector = sel_registerName("processInfo");
+	static const SEL thermal_state_selector = sel_registerName("thermalState");
+	Class process_info_class = objc_getClass("NSProcessInfo");
+	if (process_info_class == nullptr) {
+		return;
+	}
+	id process_info = reinterpret_cast<id (*)(Class, SEL)>(objc_msgSend)(process_info_class, process_info_selector);
+	const long thermal_state = reinterpret_cast<long (*)(id, SEL)>(objc_msgSend)(process_info, thermal_state_selector);
+	state.store(std::clamp(int(thermal_state), int(THERMAL_NOMINAL), int(THERMAL_CRITICAL)), std::memory_order_relaxed);
+}
+
+#else
+
+void ThermalMonitor::_sample() {
+}
+
+#endif
+
+int ThermalMonitor::get_state() {
+	const uint64_t now = Time::get_singleton()->get_ticks_msec();
+	uint64_t last = sampled_msec.load(std::memory_order_relaxed);
+	// One thread samples, the others keep the state it had.
+	if ((last == 0 || now >= last + sample_interval_msec) && sampled_msec.compare_exchange_strong(last, MAX(now, uint64_t(1)), std::memory_order_relaxed)) {
+		_sample();
+	}
+	return state.load(std::memory_order_relaxed);
+}
+
+float ThermalMonitor::get_headroom() {
+	get_state();
+	return headroom.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,43 @@
+#ifndef THERMAL_MONITOR_H
+#define THERMAL_MONITOR_H
+
+#include <godot_cpp/core/defs.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * How hot the device runs, from the thermal status of Android's
+ * PowerManager (AThermal, Android 11 and later) and the thermalState of
+ * NSProcessInfo on iOS and macOS. Sustained inference heats a phone until
+ * it throttles the CPU and GPU, and the game's frame rate drops with the
+ * clocks, so the adaptive quality controller backs off as the state rises
+ * instead of waiting for the passes to fall behind. Android 12 also
+ * forecasts its headroom, which raises the state before the status does.
+ * The state is sampled at most every few seconds by whichever thread asks.
+ * Other platforms always report THERMAL_NOMINAL.
+ */
+class ThermalMonitor {
+public:
+	enum ThermalState {
+		THERMAL_NOMINAL,
+		THERMAL_FAIR, // warmer than usual, no throttling yet
+		THERMAL_SERIOUS, // the device throttles or is about to
+		THERMAL_CRITICAL, // throttled hard, the OS may close apps
+	};
+
+private:
+	static std::atomic<int> state;
+	static std::atomic<float> headroom;
+	static std::atomic<uint64_t> sampled_msec;
+
+	static void _sample();
+
+public:
+	/** The state, sampled again when the last sample is old. */
+	static int get_state();
+	/** Android's forecast of the thermal headroom a few seconds ahead, 1 is where severe throttling starts. Negative where the platform does not tell. */
+	static float get_headroom();
+};
+
+#endif // THERMAL_MONITOR_H
@@ -0,0 +1,252 @@
+#include "thread_affinity.h"
+#include "worker_pool_executor.h"
+
+#include <whisper.cpp/ggml.h>
+#include <godot_cpp/core/math.hpp>
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <pthread/qos.h>
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+using namespace godot;
+
+std::atomic<int> ThreadAffinity::core_class{ ThreadAffinity::CORES_ANY };
+std::atomic<uint32_t> ThreadAffinity::generation{ 0 };
+
+/* Generation this thread last applied, 0 while it runs with the affinity it was started with. */
+static thread_local uint32_t thread_generation = 0;
+
+#if defined(__linux__)
+
+/* Logical processors of the CPU, and the ones not in its slowest class when there is more than one. */
+struct CpuClasses {
+	int cpu_count = 0;
+	std::vector<int> performance_cpus;
+};
+
+static long _read_cpu_value(int p_cpu, const char *p_file) {
+	char path[128];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", p_cpu, p_file);
+	FILE *file = fopen(path, "r");
+	if (file == nullptr) {
+		return -1;
+	}
+	long value = -1;
+	if (fscanf(file, "%ld", &value) != 1) {
+		value = -1;
+	}
+	fclose(file);
+	return value;
+}
+
+static const CpuClasses &_get_cpu_classes() {
+	static const CpuClasses classes = []() {
+		CpuClasses ret;
+		ret.cpu_count = MAX(1, int(sysconf(_SC_NPROCESSORS_CONF)));
+		// cpu_capacity is what the ARM scheduler itself goes by, the maximum frequency tells Intel P and E-cores apart.
+		std::vector<long> values(ret.cpu_count);
+		for (int cpu = 0; cpu < ret.cpu_count; cpu++) {
+			values[cpu] = _read_cpu_value(cpu, "cpu_capacity");
+			if (values[cpu] <= 0) {
+				values[cpu] = _read_cpu_value(cpu, "cpufreq/cpuinfo_max_freq");
+			}
+		}
+		long slowest = -1;
+		for (long value : values) {
+			if (value > 0 && (slowest < 0 || value < slowest)) {
+				slowest = value;
+			}
+		}
+		for (int cpu = 0; cpu < ret.cpu_count; cpu++) {
+			if (values[cpu] > slowest) {
+				ret.performance_cpus.push_back(cpu);
+			}
+		}
+		return ret;
+	}();
+	return classes;
+}
+
+int ThreadAffinity::get_performance_core_count() {
+	const CpuClasses &classes = _get_cpu_classes();
+	return classes.performance_cpus.empty() ? classes.cpu_count : int(classes.performance_cpus.size());
+}
+
+void ThreadAffinity::_apply(int p_core_class) {
+	const CpuClasses &classes = _get_cpu_classes();
+	if (classes.performance_cpus.empty()) {
+		return;
+	}
+	cpu_set_t *cpus = CPU_ALLOC(classes.cpu_count);
+	const size_t set_size = CPU_ALLOC_SIZE(classes.cpu_count);
+	CPU_ZERO_S(set_size, cpus);
+	if (p_core_class == CORES_PERFORMANCE) {
+		for (int cpu : classes.performance_cpus) {
+			CPU_SET_S(cpu, set_size, cpus);
+		}
+	} else {
+		for (int cpu = 0; cpu < classes.cpu_count; cpu++) {
+			CPU_SET_S(cpu, set_size, cpus);
+		}
+	}
+	// 0 is the calling thread, bionic has no pthread_setaffinity_np.
+	sched_setaffinity(0, set_size, cpus);
+	CPU_FREE(cpus);
+}
+
+#elif defined(_WIN32)
+
+/* Cores of the processor group the performance cores are in, and the ones not in its slowest efficiency class. */
+struct CpuClasses {
+	WORD group = 0;
+	KAFFINITY all_mask = 0;
+	KAFFINITY performance_mask = 0;
+	int cpu_count = 0;
+	int performance_count = 0;
+};
+
+static int _count_bits(KAFFINITY p_mask) {
+	int count = 0;
+	for (; p_mask != 0; p_mask &= p_mask - 1) {
+		count++;
+	}
+	return count;
+}
+
+static const CpuClasses &_get_cpu_classes() {
+	static const CpuClasses classes = []() {
+		CpuClasses ret;
+		DWORD length = 0;
+		GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+		std::vector<char> buffer(length);
+		SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data());
+		if (length == 0 || !GetLogicalProcessorInformationEx(RelationProcessorCore, info, &length)) {
+			return ret;
+		}
+		struct Core {
+			BYTE efficiency_class;
+			GROUP_AFFINITY mask;
+		};
+		std::vector<Core> cores;
+		BYTE slowest = 0xff;
+		BYTE fastest = 0;
+		for (DWORD offset = 0; offset < length;) {
+			const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *entry = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data() + offset);
+			// Higher efficiency classes are the faster cores, all of them are 0 on CPUs with a single class.
+			cores.push_back({ entry->Processor.EfficiencyClass, entry->Processor.GroupMask[0] });
+			slowest = MIN(slowest, entry->Processor.EfficiencyClass);
+			fastest = MAX(fastest, entry->Processor.EfficiencyClass);
+			offset += entry->Size;
+		}
+		if (cores.empty() || slowest == fastest) {
+			return ret;
+		}
+		for (const Core &core : cores) {
+			if (core.efficiency_class > slowest) {
+				ret.group = core.mask.Group;
+				break;
+			}
+		}
+		for (const Core &core : cores) {
+			if (core.mask.Group != ret.group) {
+				continue;
+			}
+			ret.all_mask |= core.mask.Mask;
+			if (core.efficiency_class > slowest) {
+				ret.performance_mask |= core.mask.Mask;
+			}
+		}
+		ret.cpu_count = _count_bits(ret.all_mask);
+		ret.performance_count = _count_bits(ret.performance_mask);
+		return ret;
+	}();
+	return classes;
+}
+
+int ThreadAffinity::get_performance_core_count() {
+	const CpuClasses &classes = _get_cpu_classes();
+	if (classes.performance_mask == 0) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return int(info.dwNumberOfProcessors);
+	}
+	return classes.performance_count;
+}
+
+void ThreadAffinity::_apply(int p_core_class) {
+	const CpuClasses &classes = _get_cpu_classes();
+	if (classes.performance_mask == 0) {
+		return;
+	}
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = classes.group;
+	affinity.Mask = p_core_class == CORES_PERFORMANCE ? classes.performance_mask : classes.all_mask;
+	SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+}
+
+#elif defined(__APPLE__)
+
+int ThreadAffinity::get_performance_core_count() {
+	int count = 0;
+	size_t size = sizeof(count);
+	// perflevel0 are the P-cores of Apple silicon, Intel Macs only have hw.logicalcpu.
+	if (sysctlbyname("hw.perflevel0.logicalcpu", &count, &size, nullptr, 0) != 0 || count <= 0) {
+		size = sizeof(count);
+		if (sysctlbyname("hw.logicalcpu", &count, &size, nullptr, 0) != 0) {
+			count = 1;
+		}
+	}
+	return MAX(1, count);
+}
+
+void ThreadAffinity::_apply(int p_core_class) {
+	// Threads cannot pick cores here, user interactive work is what the scheduler keeps on the P-cores.
+	pthread_set_qos_class_self_np(p_core_class == CORES_PERFORMANCE ? QOS_CLASS_USER_INTERACTIVE : QOS_CLASS_DEFAULT, 0);
+}
+
+#else
+
+int ThreadAffinity::get_performance_core_count() {
+	return MAX(1, int(std::thread::hardware_concurrency()));
+}
+
+void ThreadAffinity::_apply(int p_core_class) {
+}
+
+#endif
+
+void ThreadAffinity::set_core_class(int p_core_class) {
+	if (core_class.exchange(p_core_class, std::memory_order_relaxed) != p_core_class) {
+		generation.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void ThreadAffinity::update_current_thread() {
+	if (WorkerPoolExecutor::is_enabled()) {
+		// Threads of the engine's pool run its jobs too, they keep the affinity it gave them.
+		return;
+	}
+	const uint32_t current = generation.load(std::memory_order_relaxed);
+	if (thread_generation == current) {
+		return;
+	}
+	thread_generation = current;
+	_apply(core_class.load(std::memory_order_relaxed));
+}
+
+void ThreadAffinity::install() {
+	ggml_set_compute_thread_callback(&ThreadAffinity::update_current_thread);
+}
@@ -0,0 +1,45 @@
+#ifndef THREAD_AFFINITY_H
+#define THREAD_AFFINITY_H
+
+#include <godot_cpp/core/defs.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Keeps the inference threads, the decoding workers and the ggml threads of
+ * their graphs, on the performance cores of hybrid CPUs such as Android
+ * big.LITTLE or Intel P/E-core parts, so no graph barrier waits for a thread
+ * on an efficiency core and those cores stay free for the game. Linux and
+ * Android pin with sched_setaffinity, Windows with SetThreadGroupAffinity,
+ * and Apple platforms, which do not let threads pick cores, raise the QoS
+ * class instead. Other platforms, and CPUs with a single core class, run the
+ * threads wherever the OS puts them.
+ */
+class ThreadAffinity {
+public:
+	enum CoreClass {
+		CORES_ANY,
+		CORES_PERFORMANCE,
+	};
+
+private:
+	static std::atomic<int> core_class;
+	static std::atomic<uint32_t> generation; // bumped on every change, threads apply it on their next graph
+
+	static void _apply(int p_core_class);
+
+public:
+	/** Applies to every inference thread from its next graph on. */
+	static void set_core_class(int p_core_class);
+	_FORCE_INLINE_ static int get_core_class() { return core_class.load(std::memory_order_relaxed); }
+	/** Logical processors of the fastest core classes, all of them on CPUs with only one class. */
+	static int get_performance_core_count();
+
+	/** Give the calling thread the affinity of the current core class, a no-op when it already has it. */
+	static void update_current_thread();
+	/** Installed with ggml_set_compute_thread_callback, so the ggml threads follow too. */
+	static void install();
+};
+
+#endif // THREAD_AFFINITY_H
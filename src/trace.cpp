@@ -0,0 +1,119 @@
+#include "trace.h"
+
+#ifdef GODOT_WHISPER_TRACE
+
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/packed_string_array.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace godot;
+
+/* Zones a thread keeps before it stops recording, about 24 MiB. */
+static const size_t MAX_THREAD_EVENTS = 1 << 20;
+
+struct TraceEvent {
+	const char *name;
+	int64_t begin_ns;
+	int64_t end_ns;
+};
+
+/**
+ * The zones of one thread. Only its own thread appends to it, the mutex is
+ * only ever contended by trace_save, so recording does not serialize the
+ * threads it is meant to observe.
+ */
+struct TraceThread {
+	uint32_t tid = 0;
+	std::mutex mutex;
+	std::vector<TraceEvent> events;
+	std::vector<TraceEvent> open; // zones begun and not ended yet, innermost last
+	bool is_full = false;
+};
+
+static std::mutex threads_mutex;
+// Kept after their thread exited, what it recorded is still saved.
+static std::vector<std::shared_ptr<TraceThread>> threads;
+static std::atomic<uint32_t> next_tid{ 1 };
+static const std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+static int64_t _trace_now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+static TraceThread *_get_trace_thread() {
+	thread_local std::shared_ptr<TraceThread> thread;
+	if (!thread) {
+		thread = std::make_shared<TraceThread>();
+		thread->tid = next_tid.fetch_add(1, std::memory_order_relaxed);
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		threads.push_back(thread);
+	}
+	return thread.get();
+}
+
+extern "C" void godot_whisper_trace_begin(const char *p_name) {
+	TraceThread *thread = _get_trace_thread();
+	thread->open.push_back({ p_name, _trace_now_ns(), 0 });
+}
+
+extern "C" void godot_whisper_trace_end() {
+	const int64_t end_ns = _trace_now_ns();
+	TraceThread *thread = _get_trace_thread();
+	if (thread->open.empty()) {
+		return;
+	}
+	TraceEvent event = thread->open.back();
+	thread->open.pop_back();
+	event.end_ns = end_ns;
+	std::lock_guard<std::mutex> lock(thread->mutex);
+	if (thread->events.size() >= MAX_THREAD_EVENTS) {
+		thread->is_full = true;
+		return;
+	}
+	thread->events.push_back(event);
+}
+
+Error trace_save(const String &p_path, bool p_clear) {
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::WRITE);
+	ERR_FAIL_COND_V_MSG(file.is_null(), FileAccess::get_open_error(), vformat("Cannot open \"%s\" for writing.", p_path));
+	std::vector<std::shared_ptr<TraceThread>> saved_threads;
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		saved_threads = threads;
+	}
+	file->store_string("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool is_first = true;
+	for (const std::shared_ptr<TraceThread> &thread : saved_threads) {
+		std::vector<TraceEvent> events;
+		{
+			std::lock_guard<std::mutex> lock(thread->mutex);
+			if (p_clear) {
+				events.swap(thread->events);
+				if (thread->is_full) {
+					WARN_PRINT(vformat("Trace thread %d stopped recording after %d zones.", thread->tid, (int64_t)MAX_THREAD_EVENTS));
+				}
+				thread->is_full = false;
+			} else {
+				events = thread->events;
+			}
+		}
+		// Complete events in microseconds, which is what the format uses for ts and dur.
+		PackedStringArray lines;
+		for (const TraceEvent &event : events) {
+			lines.push_back(vformat("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", is_first ? "" : ",\n", event.name, thread->tid, event.begin_ns / 1000.0, (event.end_ns - event.begin_ns) / 1000.0));
+			is_first = false;
+		}
+		file->store_string(String().join(lines));
+	}
+	file->store_string("\n]}\n");
+	return OK;
+}
+
+#endif // GODOT_WHISPER_TRACE
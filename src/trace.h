@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * Trace zones of the hot paths, only compiled in with `scons tracing=yes`.
+ * Without it TRACE_ZONE expands to nothing. The zones of every thread are
+ * written as Chrome trace JSON by SpeechToText.save_trace, which opens in
+ * chrome://tracing or https://ui.perfetto.dev. whisper.cpp reports its
+ * zones through the same hooks.
+ */
+#ifdef GODOT_WHISPER_TRACE
+
+#include <godot_cpp/variant/string.hpp>
+
+extern "C" void godot_whisper_trace_begin(const char *p_name);
+extern "C" void godot_whisper_trace_end();
+
+/** Write the zones recorded so far to p_path, then forget them when p_clear is set. */
+godot::Error trace_save(const godot::String &p_path, bool p_clear);
+
+class TraceZone {
+public:
+	_FORCE_INLINE_ TraceZone(const char *p_name) { godot_whisper_trace_begin(p_name); }
+	_FORCE_INLINE_ ~TraceZone() { godot_whisper_trace_end(); }
+};
+
+#define TRACE_CONCAT_INNER(m_a, m_b) m_a##m_b
+#define TRACE_CONCAT(m_a, m_b) TRACE_CONCAT_INNER(m_a, m_b)
+/* Zone from here to the end of the enclosing scope, m_name must be a string literal. */
+#define TRACE_ZONE(m_name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(m_name)
+
+#else
+
+#define TRACE_ZONE(m_name)
+
+#endif // GODOT_WHISPER_TRACE
+
+/* m_mutex.lock(), with the wait for it as a zone so lock contention shows in the trace. */
+#define TRACE_LOCK(m_mutex, m_name) do { TRACE_ZONE(m_name); (m_mutex).lock(); } while (0)
+
+#endif // TRACE_H
@@ -0,0 +1,146 @@
+#include "transcript_cache.h"
+#include "transcription_result.h"
+
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/packed_string_array.hpp>
+
+#include <cstring>
+
+/* Samples copied into the PackedByteArray hashed at once. */
+static const size_t key_block_samples = 65536;
+static const char *entry_extension = "transcript";
+
+void TranscriptCache::_insert(const std::string &p_key, const Array &p_results) {
+	auto it = index.find(p_key);
+	if (it != index.end()) {
+		entries.erase(it->second);
+		index.erase(it);
+	}
+	if (capacity == 0) {
+		return;
+	}
+	entries.push_front({ p_key, p_results });
+	index[p_key] = entries.begin();
+	while (entries.size() > capacity) {
+		index.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
+
+String TranscriptCache::_get_file(const std::string &p_key) const {
+	return directory.path_join(vformat("%s.%s", String(p_key.c_str()), entry_extension));
+}
+
+void TranscriptCache::set_capacity(int p_capacity) {
+	std::lock_guard<std::mutex> lock(mutex);
+	capacity = size_t(MAX(0, p_capacity));
+	while (entries.size() > capacity) {
+		index.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
+
+void TranscriptCache::set_directory(const String &p_directory) {
+	std::lock_guard<std::mutex> lock(mutex);
+	directory = p_directory;
+}
+
+String TranscriptCache::get_directory() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return directory;
+}
+
+bool TranscriptCache::is_enabled() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return capacity > 0 || !directory.is_empty();
+}
+
+Ref<HashingContext> TranscriptCache::begin_key(const String &p_salt) {
+	Ref<HashingContext> hashing;
+	hashing.instantiate();
+	hashing->start(HashingContext::HASH_SHA256);
+	hashing->update(p_salt.to_utf8_buffer());
+	return hashing;
+}
+
+void TranscriptCache::add_key_samples(const Ref<HashingContext> &p_hashing, const float *p_samples, size_t p_count) {
+	PackedByteArray bytes;
+	for (size_t done = 0; done < p_count; done += key_block_samples) {
+		const size_t count = MIN(key_block_samples, p_count - done);
+		bytes.resize(count * sizeof(float));
+		memcpy(bytes.ptrw(), p_samples + done, count * sizeof(float));
+		p_hashing->update(bytes);
+	}
+}
+
+std::string TranscriptCache::finish_key(const Ref<HashingContext> &p_hashing) {
+	return p_hashing->finish().hex_encode().utf8().get_data();
+}
+
+bool TranscriptCache::lookup(const std::string &p_key, Array &r_results) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = index.find(p_key);
+	if (it != index.end()) {
+		entries.splice(entries.begin(), entries, it->second);
+		r_results = it->second->results;
+		return true;
+	}
+	if (directory.is_empty()) {
+		return false;
+	}
+	const String path = _get_file(p_key);
+	if (!FileAccess::file_exists(path)) {
+		return false;
+	}
+	Ref<FileAccess> file = FileAccess::open(path, FileAccess::READ);
+	ERR_FAIL_COND_V_MSG(file.is_null(), false, vformat("Cannot read the cached transcript \"%s\".", path));
+	const Variant stored = file->get_var();
+	ERR_FAIL_COND_V_MSG(stored.get_type() != Variant::ARRAY, false, vformat("The cached transcript \"%s\" is corrupt.", path));
+	const Array dictionaries = stored;
+	Array results;
+	for (int i = 0; i < dictionaries.size(); i++) {
+		results.push_back(TranscriptionResult::from_dictionary(dictionaries[i]));
+	}
+	_insert(p_key, results);
+	r_results = results;
+	return true;
+}
+
+void TranscriptCache::store(const std::string &p_key, const Array &p_results) {
+	std::lock_guard<std::mutex> lock(mutex);
+	_insert(p_key, p_results);
+	if (directory.is_empty()) {
+		return;
+	}
+	if (!DirAccess::dir_exists_absolute(directory)) {
+		ERR_FAIL_COND_MSG(DirAccess::make_dir_recursive_absolute(directory) != OK, vformat("Cannot create the transcript cache \"%s\".", directory));
+	}
+	Array dictionaries;
+	for (int i = 0; i < p_results.size(); i++) {
+		const Ref<TranscriptionResult> result = p_results[i];
+		dictionaries.push_back(result->to_dictionary());
+	}
+	const String path = _get_file(p_key);
+	Ref<FileAccess> file = FileAccess::open(path, FileAccess::WRITE);
+	ERR_FAIL_COND_MSG(file.is_null(), vformat("Cannot write the cached transcript \"%s\".", path));
+	file->store_var(dictionaries);
+}
+
+void TranscriptCache::clear(bool p_files) {
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.clear();
+	index.clear();
+	if (!p_files || directory.is_empty() || !DirAccess::dir_exists_absolute(directory)) {
+		return;
+	}
+	const PackedStringArray files = DirAccess::get_files_at(directory);
+	for (int i = 0; i < files.size(); i++) {
+		if (files[i].get_extension() == entry_extension) {
+			DirAccess::remove_absolute(directory.path_join(files[i]));
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#ifndef TRANSCRIPT_CACHE_H
+#define TRANSCRIPT_CACHE_H
+
+#include <godot_cpp/classes/hashing_context.hpp>
+#include <godot_cpp/variant/array.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace godot;
+
+/**
+ * Results of the offline jobs by a hash of their 16 kHz samples, the model
+ * and the options that change the text, so a clip submitted again is not
+ * decoded again. The last entries used are kept in memory, and with a
+ * directory set every entry is also written there as a file, which outlives
+ * the session and the memory limit.
+ */
+class TranscriptCache {
+	struct Entry {
+		std::string key;
+		Array results; // TranscriptionResult, shared by the jobs that hit it
+	};
+
+	std::mutex mutex;
+	std::list<Entry> entries; // most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+	size_t capacity = 0;
+	String directory;
+
+	/* With mutex held. */
+	void _insert(const std::string &p_key, const Array &p_results);
+	String _get_file(const std::string &p_key) const;
+
+public:
+	/** Entries kept in memory, 0 disables the cache unless a directory is set. */
+	void set_capacity(int p_capacity);
+	int get_capacity() const { return int(capacity); }
+	/** Where every entry is also saved, e.g. "user://transcripts". Empty keeps the cache in memory. */
+	void set_directory(const String &p_directory);
+	String get_directory();
+	bool is_enabled();
+
+	/**
+	 * Hash the samples of a job, p_salt holds the model and the options.
+	 * Works in steps so a file can be hashed block by block.
+	 */
+	static Ref<HashingContext> begin_key(const String &p_salt);
+	static void add_key_samples(const Ref<HashingContext> &p_hashing, const float *p_samples, size_t p_count);
+	static std::string finish_key(const Ref<HashingContext> &p_hashing);
+
+	/** The results stored with p_key, in memory or on disk. False on a miss. */
+	bool lookup(const std::string &p_key, Array &r_results);
+	void store(const std::string &p_key, const Array &p_results);
+	/** Drop the entries in memory, and the files of the directory with p_files. */
+	void clear(bool p_files);
+};
+
+#endif // TRANSCRIPT_CACHE_H
@@ -0,0 +1,541 @@
+#include "transcription_job.h"
+#include "audio_file_reader.h"
+#include "audio_resampler.h"
+#include "speech_to_text.h"
+#include "transcription_result.h"
+#include <godot_cpp/classes/audio_stream_wav.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#include <shared_mutex>
+
+/* Whisper's window. Shorter parallel chunks only cost accuracy at their edges, and files are decoded one window at a time. */
+static const int window_s = 30;
+
+/** Validate and keep the input and the options, called on the main thread. */
+bool TranscriptionJob::_setup(const Variant &p_audio, const Dictionary &p_options) {
+	if (p_audio.get_type() == Variant::PACKED_FLOAT32_ARRAY) {
+		input_samples = p_audio;
+		input_rate = p_options.get("sample_rate", WHISPER_SAMPLE_RATE);
+	} else {
+		Ref<AudioStreamWAV> wav = p_audio;
+		ERR_FAIL_COND_V_MSG(wav.is_null(), false, "The audio must be a PackedFloat32Array of mono samples or an AudioStreamWAV.");
+		ERR_FAIL_COND_V_MSG(wav->get_format() != AudioStreamWAV::FORMAT_8_BITS && wav->get_format() != AudioStreamWAV::FORMAT_16_BITS, false, "Only 8 and 16 bit PCM AudioStreamWAV can be transcribed.");
+		input_wav_data = wav->get_data();
+		input_wav_format = wav->get_format();
+		input_stereo = wav->is_stereo();
+		input_rate = wav->get_mix_rate();
+	}
+	ERR_FAIL_COND_V_MSG(input_rate <= 0, false, "The sample rate must be positive.");
+	return _setup_options(p_options);
+}
+
+bool TranscriptionJob::_setup_file(const String &p_path, const Dictionary &p_options) {
+	ERR_FAIL_COND_V_MSG(!FileAccess::file_exists(p_path), false, vformat("\"%s\" does not exist.", p_path));
+	input_path = p_path;
+	return _setup_options(p_options);
+}
+
+bool TranscriptionJob::_setup_options(const Dictionary &p_options) {
+	const SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	language = String(p_options.get("language", String(speech_to_text_obj->params.language.c_str()))).utf8().get_data();
+	ERR_FAIL_COND_V_MSG(language != "auto" && whisper_lang_id(language.c_str()) < 0, false, vformat("Unknown language \"%s\".", language.c_str()));
+	allowed_lang_ids = speech_to_text_obj->params.allowed_lang_ids;
+	translate = p_options.get("translate", speech_to_text_obj->params.translate);
+	n_processors = MAX(0, int(p_options.get("n_processors", 0)));
+	long_form = p_options.get("long_form", false);
+	pack_speech = p_options.get("pack_speech", false);
+	priority = p_options.get("priority", 0);
+	// Nobody waits on a job token by token, so it can afford beam search even when the streams decode greedily.
+	sampling_strategy = CLAMP(int(p_options.get("sampling_strategy", speech_to_text_obj->params.sampling_strategy)), int(WHISPER_SAMPLING_GREEDY), int(WHISPER_SAMPLING_BEAM_SEARCH));
+	beam_size = CLAMP(int(p_options.get("beam_size", speech_to_text_obj->params.beam_size)), 1, 8);
+	best_of = CLAMP(int(p_options.get("best_of", speech_to_text_obj->params.best_of)), 1, 8);
+	decode_budget_ms = MAX(0, int(p_options.get("decode_budget_ms", speech_to_text_obj->params.decode_budget_ms)));
+	token_timestamps = p_options.get("token_timestamps", speech_to_text_obj->params.token_timestamps);
+	speaker_turns = p_options.get("speaker_turns", speech_to_text_obj->params.speaker_turns);
+	initial_prompt = p_options.get("initial_prompt", speech_to_text_obj->initial_prompt);
+	if (bool(p_options.get("use_cache", true)) && SpeechToText::get_singleton()->transcript_cache.is_enabled() && speech_to_text_obj->model.is_valid()) {
+		cache_salt = _get_cache_salt();
+	}
+	return true;
+}
+
+/** What else than the samples the transcript depends on, read on the main thread. */
+String TranscriptionJob::_get_cache_salt() const {
+	const SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	const SpeechToTextParams &settings = speech_to_text_obj->params;
+	// A model exported again under the same path is told apart by its time.
+	const String model_file = speech_to_text_obj->model->get_file();
+	String salt = vformat("1|%s|%d|%s|%d|%d|%d", model_file, int64_t(FileAccess::get_modified_time(model_file)), language.c_str(), int(translate), n_processors, int(long_form));
+	salt += vformat("|%d|%d|%d|%d|%d|%d|%s", sampling_strategy, beam_size, best_of, decode_budget_ms, int(token_timestamps), int(speaker_turns), initial_prompt);
+	salt += vformat("|%f|%f|%d|%d|%d", settings.entropy_threshold, settings.no_fallback ? 0.0f : settings.temperature_inc, settings.max_fallbacks, settings.repetition_limit, int(speech_to_text_obj->context_parameters.dtw_token_timestamps));
+	salt += vformat("|%s|%s|%f|%s|%s", speech_to_text_obj->grammar, speech_to_text_obj->grammar_start_rule, speech_to_text_obj->grammar_penalty, String(",").join(speech_to_text_obj->suppressed_tokens), speech_to_text_obj->suppress_regex);
+	if (pack_speech) {
+		salt += vformat("|packed|%d|%f|%f|%d|%d", settings.vad_mode, settings.freq_thold, settings.speech_threshold, settings.speech_pre_roll_ms, settings.speech_hang_over_ms);
+	}
+	return salt;
+}
+
+/* Finish the key of the input and look it up, on a hit the job has its results. */
+bool TranscriptionJob::_lookup_cache(const Ref<HashingContext> &p_hashing) {
+	cache_key = TranscriptCache::finish_key(p_hashing);
+	is_from_cache = SpeechToText::get_singleton()->transcript_cache.lookup(cache_key, pending_results);
+	return is_from_cache;
+}
+
+/** The input as 16 kHz mono samples. */
+std::vector<float> TranscriptionJob::_get_pcmf32() {
+	std::vector<float> mono;
+	if (input_wav_format < 0) {
+		mono.assign(input_samples.ptr(), input_samples.ptr() + input_samples.size());
+	} else {
+		const int channels = input_stereo ? 2 : 1;
+		const int bytes_per_sample = input_wav_format == AudioStreamWAV::FORMAT_16_BITS ? 2 : 1;
+		const uint8_t *data = input_wav_data.ptr();
+		const size_t frames = input_wav_data.size() / (channels * bytes_per_sample);
+		mono.resize(frames);
+		for (size_t i = 0; i < frames; i++) {
+			float sum = 0.0f;
+			for (int c = 0; c < channels; c++) {
+				const uint8_t *sample = data + (i * channels + c) * bytes_per_sample;
+				// Godot keeps 8 bit samples signed and 16 bit ones little endian.
+				sum += bytes_per_sample == 2 ? int16_t(sample[0] | (sample[1] << 8)) / 32768.0f : int8_t(sample[0]) / 128.0f;
+			}
+			mono[i] = sum / channels;
+		}
+	}
+	if (input_rate == WHISPER_SAMPLE_RATE || mono.empty()) {
+		return mono;
+	}
+	// Nothing waits for the result in real time, so the resampler can afford a better filter.
+	AudioResampler resampler;
+	resampler.set_quality(SRC_SINC_MEDIUM_QUALITY);
+	std::vector<float> pcmf32(AudioResampler::get_max_output_frames(mono.size(), input_rate, WHISPER_SAMPLE_RATE));
+	pcmf32.resize(resampler.process(mono.data(), mono.size(), input_rate, WHISPER_SAMPLE_RATE, pcmf32.data(), pcmf32.size()));
+	return pcmf32;
+}
+
+/** Read the input on the first pass, off the main thread. */
+bool TranscriptionJob::_prepare_input() {
+	if (is_input_ready) {
+		return true;
+	}
+	is_input_ready = true;
+	if (pack_speech) {
+		// The VAD settings of the streams, the runs keep their pre-roll and hang-over as the pauses between them.
+		const std::shared_ptr<const SpeechToTextParams> settings = SpeechToText::get_singleton()->_get_params_snapshot();
+		packer.setup(settings->vad_mode, settings->freq_thold, settings->speech_threshold, settings->speech_pre_roll_ms, settings->speech_hang_over_ms);
+	}
+	if (!input_path.is_empty()) {
+		if (!cache_salt.is_empty()) {
+			// Read once more to hash it, which costs far less than decoding it.
+			if (!reader.open(input_path)) {
+				return false;
+			}
+			const Ref<HashingContext> hashing = TranscriptCache::begin_key(cache_salt);
+			while (reader.read_block(read_scratch) > 0) {
+				TranscriptCache::add_key_samples(hashing, read_scratch.data(), read_scratch.size());
+				read_scratch.clear();
+			}
+			reader.close();
+			if (_lookup_cache(hashing)) {
+				return true;
+			}
+		}
+		if (!reader.open(input_path)) {
+			return false;
+		}
+		total_samples = reader.get_output_frames();
+	} else {
+		clip_pcmf32 = _get_pcmf32();
+		total_samples = clip_pcmf32.size();
+		if (!cache_salt.is_empty()) {
+			const Ref<HashingContext> hashing = TranscriptCache::begin_key(cache_salt);
+			TranscriptCache::add_key_samples(hashing, clip_pcmf32.data(), clip_pcmf32.size());
+			if (_lookup_cache(hashing)) {
+				clip_pcmf32 = std::vector<float>();
+				input_samples = PackedFloat32Array();
+				input_wav_data = PackedByteArray();
+				return true;
+			}
+		}
+		if (pack_speech) {
+			std::vector<float> packed;
+			packer.process(clip_pcmf32.data(), clip_pcmf32.size(), packed);
+			clip_pcmf32.swap(packed);
+			total_samples = clip_pcmf32.size();
+		}
+		input_samples = PackedFloat32Array();
+		input_wav_data = PackedByteArray();
+	}
+	return true;
+}
+
+/* The state the sequential windows share, taken again when the model or the state parameters changed since the last window. */
+whisper_state *TranscriptionJob::_get_window_state(whisper_context *p_context) {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	if (window_state != nullptr && window_state_context == p_context && window_state_generation == speech_to_text_obj->job_state_generation.load(std::memory_order_relaxed)) {
+		return window_state;
+	}
+	_free_window_state();
+	window_state = speech_to_text_obj->_acquire_job_state(p_context, window_state_generation);
+	window_state_context = window_state != nullptr ? p_context : nullptr;
+	return window_state;
+}
+
+void TranscriptionJob::_free_window_state() {
+	if (window_state != nullptr) {
+		SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+		if (speech_to_text_obj != nullptr) {
+			speech_to_text_obj->_release_job_state(window_state_context, window_state, window_state_generation);
+		} else {
+			whisper_free_state(window_state);
+		}
+		window_state = nullptr;
+		window_state_context = nullptr;
+	}
+}
+
+bool TranscriptionJob::_abort(void *p_job) {
+	const TranscriptionJob *job = static_cast<const TranscriptionJob *>(p_job);
+	const SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	// Streams waiting for a worker and model swaps take over, the window is decoded again later.
+	return job->is_cancelled.load(std::memory_order_relaxed) || speech_to_text_obj->scheduler.is_preempting_jobs() || speech_to_text_obj->cancel_generation.load(std::memory_order_relaxed) != job->generation.load(std::memory_order_relaxed);
+}
+
+/* whisper_full reports the progress of the first chunk of the window, about that of the whole window. */
+void TranscriptionJob::_on_progress(whisper_context *p_context, whisper_state *p_state, int p_progress, void *p_job) {
+	TranscriptionJob *job = static_cast<TranscriptionJob *>(p_job);
+	if (job->total_samples == 0) {
+		return;
+	}
+	const float value = MIN(1.0f, float((job->position + job->pass_samples * p_progress / 100.0) / job->total_samples));
+	job->progress.store(value, std::memory_order_relaxed);
+	job->call_deferred("emit_signal", "progress_changed", value);
+}
+
+whisper_full_params TranscriptionJob::_get_params() {
+	const SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	const std::shared_ptr<const SpeechToTextParams> settings = speech_to_text_obj->_get_params_snapshot();
+	whisper_full_params params = whisper_full_default_params(whisper_sampling_strategy(sampling_strategy));
+	params.print_progress = false;
+	params.print_special = false;
+	params.print_realtime = false;
+	params.print_timestamps = false;
+	params.translate = translate;
+	params.language = language.c_str();
+	params.detect_lang_ids = allowed_lang_ids.data();
+	params.n_detect_lang_ids = allowed_lang_ids.size();
+	if (language == "auto" && allowed_lang_ids.size() == 1) {
+		params.language = whisper_lang_str(allowed_lang_ids[0]);
+	}
+	params.n_threads = settings->n_threads;
+	params.token_timestamps = token_timestamps;
+	params.tdrz_enable = speaker_turns;
+	params.suppress_non_speech_tokens = true;
+	params.suppress_blank = true;
+	params.entropy_thold = settings->entropy_threshold;
+	params.temperature_inc = settings->no_fallback ? 0.0f : settings->temperature_inc;
+	params.max_fallbacks = settings->max_fallbacks;
+	params.beam_search.beam_size = beam_size;
+	params.greedy.best_of = best_of;
+	params.decode_budget_ms = decode_budget_ms;
+	params.repetition_limit = settings->repetition_limit;
+	// The subset of prune_vocabulary leaves out tokens of other languages.
+	params.vocab_subset = language == settings->language;
+	params.abort_callback = &TranscriptionJob::_abort;
+	params.abort_callback_user_data = this;
+	params.progress_callback = &TranscriptionJob::_on_progress;
+	params.progress_callback_user_data = this;
+	speech_to_text_obj->_apply_grammar(params);
+	if (!speech_to_text_obj->suppress_ids.empty()) {
+		// The ids stay valid while the context lock is held, i.e. for the whole pass.
+		params.logits_filter_callback = &SpeechToTextStream::_filter_logits;
+		params.logits_filter_callback_user_data = (void *)&speech_to_text_obj->suppress_ids;
+	}
+	return params;
+}
+
+/* Time in the input of p_seconds into the decoded audio, which only differ with pack_speech. */
+double TranscriptionJob::_to_input_seconds(double p_seconds) const {
+	return pack_speech ? packer.to_source_seconds(p_seconds) : p_seconds;
+}
+
+/**
+ * One TranscriptionResult per segment with text, times p_time_offset seconds
+ * later than in the state. The text tokens become the prompt of the next pass.
+ */
+void TranscriptionJob::_append_results(whisper_context *p_context, whisper_state *p_state, int p_n_segments, double p_time_offset, int p_n_samples, bool p_align, Array &r_results) {
+	const whisper_token token_eot = whisper_token_eot(p_context);
+	const String lang = whisper_lang_str(whisper_full_lang_id_from_state(p_state));
+	const float lang_prob = whisper_full_lang_prob_from_state(p_state);
+	const bool repetition_aborted = whisper_full_repetition_aborted_from_state(p_state);
+	if (repetition_aborted) {
+		SpeechToText::get_singleton()->repetition_aborts.fetch_add(1, std::memory_order_relaxed);
+	}
+	Ref<TranscriptionResult> last_result;
+	// The text tokens of every segment of the window, also the ones decoded again with the next window.
+	const int n_all_segments = whisper_full_n_segments_from_state(p_state);
+	std::vector<std::string> segment_texts(n_all_segments);
+	std::vector<std::vector<whisper_token_data>> segment_tokens(n_all_segments);
+	std::vector<std::vector<size_t>> segment_token_ends(n_all_segments);
+	std::vector<whisper_token_data> all_tokens;
+	for (int i = 0; i < n_all_segments; i++) {
+		int bracket_depth = 0;
+		const int n_tokens = whisper_full_n_tokens_from_state(p_state, i);
+		const int64_t segment_t0 = whisper_full_get_segment_t0_from_state(p_state, i);
+		const int64_t segment_t1 = whisper_full_get_segment_t1_from_state(p_state, i);
+		for (int j = 0; j < n_tokens; j++) {
+			whisper_token_data token = whisper_full_get_token_data_from_state(p_state, i, j);
+			if (!token_timestamps) {
+				// Only the segments are timed then.
+				token.t0 = segment_t0;
+				token.t1 = segment_t1;
+			}
+			if (token.id < token_eot && TranscriptionResult::append_token_text(segment_texts[i], whisper_full_get_token_text_from_state(p_context, p_state, i, j), bracket_depth) > 0) {
+				segment_tokens[i].push_back(token);
+				segment_token_ends[i].push_back(segment_texts[i].size());
+				all_tokens.push_back(token);
+			}
+		}
+	}
+	// The whole text of the window is aligned at once, DTW spreads what it is given over all of the audio.
+	if (p_align && SpeechToText::_align_tokens(p_context, p_state, all_tokens, p_n_samples, SpeechToText::get_singleton()->_get_params_snapshot()->n_threads)) {
+		size_t k = 0;
+		for (std::vector<whisper_token_data> &tokens : segment_tokens) {
+			for (whisper_token_data &token : tokens) {
+				token = all_tokens[k++];
+			}
+		}
+	}
+	for (int i = 0; i < p_n_segments; i++) {
+		const std::string &text = segment_texts[i];
+		const std::vector<whisper_token_data> &text_tokens = segment_tokens[i];
+		if (text_tokens.empty()) {
+			// e.g. a segment of only [BLANK_AUDIO].
+			continue;
+		}
+		Ref<TranscriptionResult> result;
+		result.instantiate();
+		result->partial = false;
+		result->committed_text = String::utf8(text.data(), text.size());
+		result->start_time = _to_input_seconds(p_time_offset + whisper_full_get_segment_t0_from_state(p_state, i) / 100.0);
+		result->end_time = _to_input_seconds(p_time_offset + whisper_full_get_segment_t1_from_state(p_state, i) / 100.0);
+		result->token_ids.resize(text_tokens.size());
+		result->token_start_times.resize(text_tokens.size());
+		result->token_end_times.resize(text_tokens.size());
+		result->token_probabilities.resize(text_tokens.size());
+		for (size_t k = 0; k < text_tokens.size(); k++) {
+			result->token_ids.set(k, text_tokens[k].id);
+			result->token_start_times.set(k, _to_input_seconds(p_time_offset + text_tokens[k].t0 / 100.0));
+			result->token_end_times.set(k, _to_input_seconds(p_time_offset + text_tokens[k].t1 / 100.0));
+			result->token_probabilities.set(k, text_tokens[k].p);
+			prompt_tokens.push_back(text_tokens[k].id);
+		}
+		result->committed_token_count = text_tokens.size();
+		if (speaker_turns && whisper_full_get_segment_speaker_turn_next_from_state(p_state, i)) {
+			// tinydiarize marks the turn at the end of the segment.
+			result->speaker_turn_token_indices.push_back(text_tokens.size());
+			result->speaker_turn_times.push_back(result->end_time);
+		}
+		result->set_words_from_tokens(text, segment_token_ends[i]);
+		result->language = lang;
+		result->language_probability = lang_prob;
+		r_results.push_back(result);
+		last_result = result;
+	}
+	if (last_result.is_valid()) {
+		// The loop is cut at the end of the window, in its last segment.
+		last_result->repetition_aborted = repetition_aborted;
+	}
+	const size_t max_prompt = whisper_n_text_ctx(p_context) / 2;
+	if (prompt_tokens.size() > max_prompt) {
+		prompt_tokens.erase(prompt_tokens.begin(), prompt_tokens.end() - max_prompt);
+	}
+}
+
+/**
+ * Decode the next window of the input, called by a scheduler worker. The
+ * last segment of a window may be cut off by its end, it is decoded again
+ * with the audio after it. Only a window of a file is ever in memory, and
+ * sequential windows never hand more than one window to whisper_full.
+ */
+TranscriptionJob::PassResult TranscriptionJob::_process() {
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	if (is_cancelled || !_prepare_input()) {
+		return PASS_FAILED;
+	}
+	if (is_from_cache) {
+		if (!pending_results.is_empty()) {
+			call_deferred("emit_signal", "segments_transcribed", pending_results);
+		}
+		progress.store(1.0f, std::memory_order_relaxed);
+		call_deferred("emit_signal", "progress_changed", 1.0f);
+		return PASS_DONE;
+	}
+	std::shared_lock<std::shared_mutex> context_lock(speech_to_text_obj->context_mutex);
+	whisper_context *context = speech_to_text_obj->context_instance;
+	if (context == nullptr) {
+		ERR_PRINT("No model is loaded to transcribe with.");
+		return PASS_FAILED;
+	}
+	// A model swap before this pass is fine, the window is decoded with the new model.
+	generation = speech_to_text_obj->cancel_generation.load(std::memory_order_relaxed);
+	if (cache_context == nullptr) {
+		cache_context = context;
+	} else if (cache_context != context) {
+		// The transcript is of two models, the key only names one of them.
+		cache_key.clear();
+	}
+	whisper_full_params params_base = _get_params();
+	params_base.no_timestamps = whisper_model_is_distilled(context);
+	int processors = 1;
+	if (input_path.is_empty() && !long_form) {
+		processors = n_processors;
+		if (processors == 0) {
+			// Every chunk runs n_threads threads, use each core once.
+			processors = OS::get_singleton()->get_processor_count() / MAX(1, params_base.n_threads);
+			processors = MIN(processors, int((clip_pcmf32.size() - position) / (window_s * WHISPER_SAMPLE_RATE)));
+		}
+		processors = MAX(1, processors);
+	}
+	const size_t window_samples = size_t(processors) * window_s * WHISPER_SAMPLE_RATE;
+	const float *samples = nullptr;
+	bool is_end = false;
+	if (input_path.is_empty()) {
+		samples = clip_pcmf32.data() + position;
+		pass_samples = MIN(window_samples, clip_pcmf32.size() - position);
+		is_end = position + pass_samples >= clip_pcmf32.size();
+	} else {
+		while (pcmf32.size() < window_samples && !is_file_end) {
+			if (!pack_speech) {
+				is_file_end = reader.read_block(pcmf32) == 0;
+				continue;
+			}
+			// Packed block by block, only the voiced audio of the file is kept.
+			read_scratch.clear();
+			is_file_end = reader.read_block(read_scratch) == 0;
+			input_read += read_scratch.size();
+			packer.process(read_scratch.data(), read_scratch.size(), pcmf32);
+		}
+		samples = pcmf32.data();
+		pass_samples = pcmf32.size();
+		is_end = is_file_end;
+	}
+	if (pass_samples == 0) {
+		return PASS_DONE;
+	}
+
+	const bool is_sequential = processors == 1;
+	uint64_t state_generation = 0;
+	whisper_state *state = is_sequential ? _get_window_state(context) : speech_to_text_obj->_acquire_job_state(context, state_generation);
+	if (state == nullptr) {
+		ERR_PRINT("Failed to create whisper state");
+		return PASS_FAILED;
+	}
+	const auto release_state = [&]() {
+		if (!is_sequential) {
+			speech_to_text_obj->_release_job_state(context, state, state_generation);
+		}
+	};
+	// The window starts at a segment time, a multiple of the hop, so the frames it shares with the last window are copied.
+	if (is_sequential && whisper_pcm_to_mel_cached_with_state(context, state, samples, pass_samples, position, params_base.n_threads) != 0) {
+		ERR_PRINT("Failed to compute the log mel spectrogram.");
+		return PASS_FAILED;
+	}
+	whisper_full_params params = params_base;
+	if (position == 0 && prompt_tokens.empty()) {
+		// Ids of the model the first window is decoded with, the prompt then rolls on with the decoded text.
+		prompt_tokens = speech_to_text_obj->_compile_prompt_ids(context, initial_prompt);
+	}
+	if (processors == 1 && !prompt_tokens.empty()) {
+		// The text of the windows before conditions the decoder, as whisper_full does between its own windows.
+		params.prompt_tokens = prompt_tokens.data();
+		params.prompt_n_tokens = prompt_tokens.size();
+	}
+	const int ret = whisper_full_parallel_with_state(context, state, params, samples, pass_samples, processors);
+	if (is_cancelled || (ret != 0 && _abort(this))) {
+		release_state();
+		return is_cancelled ? PASS_FAILED : PASS_PREEMPTED;
+	}
+	if (ret != 0) {
+		release_state();
+		ERR_PRINT(vformat("Failed to transcribe the audio, returned %d.", ret));
+		return PASS_FAILED;
+	}
+	int n_segments = whisper_full_n_segments_from_state(state);
+	size_t n_consumed = pass_samples;
+	if (!is_end && n_segments > 1) {
+		const int64_t t0 = whisper_full_get_segment_t0_from_state(state, n_segments - 1);
+		if (t0 > 0 && size_t(t0) * WHISPER_SAMPLE_RATE / 100 < pass_samples) {
+			n_consumed = size_t(t0) * WHISPER_SAMPLE_RATE / 100;
+			n_segments--;
+		}
+	}
+	Array window_results;
+	// whisper_full_parallel leaves the mel of the last chunk only in the state, those windows keep the times of whisper_full.
+	const bool align = processors == 1 && speech_to_text_obj->context_parameters.dtw_token_timestamps;
+	_append_results(context, state, n_segments, double(position) / WHISPER_SAMPLE_RATE, pass_samples, align, window_results);
+	release_state();
+	if (!window_results.is_empty()) {
+		pending_results.append_array(window_results);
+		call_deferred("emit_signal", "segments_transcribed", window_results);
+	}
+	if (!input_path.is_empty()) {
+		pcmf32.erase(pcmf32.begin(), pcmf32.begin() + n_consumed);
+	}
+	position += n_consumed;
+	if (is_end && !cache_key.empty()) {
+		speech_to_text_obj->transcript_cache.store(cache_key, pending_results);
+	}
+	// The share of a packed file is of the input read so far, its voiced length is only known at the end.
+	const uint64_t decoded = pack_speech && !input_path.is_empty() ? input_read : position;
+	const float value = is_end ? 1.0f : MIN(1.0f, float(double(decoded) / MAX(uint64_t(1), total_samples)));
+	progress.store(value, std::memory_order_relaxed);
+	call_deferred("emit_signal", "progress_changed", value);
+	return is_end ? PASS_DONE : PASS_CONTINUE;
+}
+
+void TranscriptionJob::_finish(bool p_success) {
+	if (done) {
+		return;
+	}
+	SpeechToText *speech_to_text_obj = SpeechToText::get_singleton();
+	if (speech_to_text_obj != nullptr) {
+		speech_to_text_obj->_unregister_job(this);
+	}
+	done = true;
+	succeeded = p_success;
+	if (p_success) {
+		results = pending_results;
+	}
+	pending_results = Array();
+	clip_pcmf32 = std::vector<float>();
+	pcmf32 = std::vector<float>();
+	read_scratch = std::vector<float>();
+	reader.close();
+	_free_window_state();
+	// Released last, a script may hold no other reference.
+	Ref<TranscriptionJob> keep_alive = self;
+	self.unref();
+	emit_signal("completed", p_success, results);
+}
+
+TranscriptionJob::~TranscriptionJob() {
+	_free_window_state();
+}
+
+void TranscriptionJob::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("_finish", "success"), &TranscriptionJob::_finish);
+	ClassDB::bind_method(D_METHOD("cancel"), &TranscriptionJob::cancel);
+	ClassDB::bind_method(D_METHOD("is_done"), &TranscriptionJob::is_done);
+	ClassDB::bind_method(D_METHOD("is_succeeded"), &TranscriptionJob::is_succeeded);
+	ClassDB::bind_method(D_METHOD("get_priority"), &TranscriptionJob::get_priority);
+	ClassDB::bind_method(D_METHOD("get_progress"), &TranscriptionJob::get_progress);
+	ClassDB::bind_method(D_METHOD("is_cached"), &TranscriptionJob::is_cached);
+	ClassDB::bind_method(D_METHOD("get_results"), &TranscriptionJob::get_results);
+
+	ADD_SIGNAL(MethodInfo("progress_changed", PropertyInfo(Variant::FLOAT, "progress")));
+	ADD_SIGNAL(MethodInfo("segments_transcribed", PropertyInfo(Variant::ARRAY, "results", PROPERTY_HINT_ARRAY_TYPE, "TranscriptionResult")));
+	ADD_SIGNAL(MethodInfo("completed", PropertyInfo(Variant::BOOL, "success"), PropertyInfo(Variant::ARRAY, "results", PROPERTY_HINT_ARRAY_TYPE, "TranscriptionResult")));
+}
@@ -0,0 +1,145 @@
+#ifndef TRANSCRIPTION_JOB_H
+#define TRANSCRIPTION_JOB_H
+
+#include "audio_file_reader.h"
+#include "speech_packer.h"
+
+#include <whisper.cpp/whisper.h>
+#include <godot_cpp/classes/hashing_context.hpp>
+#include <godot_cpp/classes/ref_counted.hpp>
+#include <godot_cpp/variant/array.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/packed_float32_array.hpp>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * Offline transcription of a whole clip, see SpeechToText::transcribe_async.
+ * Jobs are queued on the workers of the TranscriptionScheduler and decoded
+ * there while no stream is waiting, one window at a time, without the VAD
+ * and the real time pacing of the streams. A window of an in-memory clip is
+ * split into chunks decoded in parallel by whisper_full_parallel. A file,
+ * or a clip with the long_form option, is walked 30 seconds at a time
+ * instead: each window starts at the last segment the previous one cut
+ * off, is prompted with the text before it and decoded on one state that
+ * is kept for the whole job, so the mel frames of the overlap are copied
+ * from the previous window rather than computed again. With pack_speech
+ * the silence is cut out as the input is read, the windows only hold the
+ * voiced runs, and the times are mapped back to the input.
+ */
+class TranscriptionJob : public RefCounted {
+	GDCLASS(TranscriptionJob, RefCounted);
+
+	friend class SpeechToText;
+	friend class TranscriptionScheduler;
+
+public:
+	enum PassResult {
+		PASS_CONTINUE,
+		PASS_PREEMPTED, // a stream or a model swap took over, the window is decoded again
+		PASS_DONE,
+		PASS_FAILED,
+	};
+
+private:
+	/* Audio as given, converted to 16 kHz mono by the first pass. */
+	PackedFloat32Array input_samples;
+	PackedByteArray input_wav_data;
+	int input_wav_format = -1; // AudioStreamWAV::Format of input_wav_data, -1 when input_samples is used
+	bool input_stereo = false;
+	int input_rate = WHISPER_SAMPLE_RATE;
+	String input_path; // read with AudioFileReader when not empty
+
+	std::string language;
+	std::vector<int> allowed_lang_ids; // SpeechToText.allowed_languages when the job started
+	bool translate = false;
+	int n_processors = 0; // 0 picks it from the core count and the clip length
+	bool long_form = false; // an in-memory clip is walked window by window like a file
+	bool pack_speech = false; // decode only the voiced runs, see SpeechPacker
+	String cache_salt; // model and options the transcript depends on, empty when the cache is not used
+	int priority = 0;
+	int sampling_strategy = WHISPER_SAMPLING_GREEDY;
+	int beam_size = 5;
+	int best_of = 5;
+	int decode_budget_ms = 0;
+	bool token_timestamps = true;
+	bool speaker_turns = false;
+	String initial_prompt; // seeds prompt_tokens before the first window
+
+	/* Decoder side, only touched by the worker running the pass. */
+	bool is_input_ready = false;
+	std::vector<float> clip_pcmf32; // the whole in-memory clip
+	AudioFileReader reader;
+	std::vector<float> pcmf32; // the window of the file being decoded
+	std::vector<float> read_scratch; // a block of the file before it is packed
+	uint64_t input_read = 0; // 16 kHz samples of the file packed so far
+	SpeechPacker packer;
+	bool is_file_end = false;
+	uint64_t position = 0; // 16 kHz samples decoded and reported
+	uint64_t total_samples = 0;
+	size_t pass_samples = 0;
+	std::vector<whisper_token> prompt_tokens;
+	Array pending_results;
+	std::string cache_key; // of the input and cache_salt, cleared when the model changes in the middle of the job
+	whisper_context *cache_context = nullptr; // the model the first window was decoded with
+	bool is_from_cache = false;
+	/* State of the sequential windows, its mel cache holds the frames of the last one. */
+	whisper_state *window_state = nullptr;
+	whisper_context *window_state_context = nullptr;
+	uint64_t window_state_generation = 0; // SpeechToText::job_state_generation when it was taken
+
+	/* Scheduling state, guarded by the TranscriptionScheduler mutex. */
+	bool is_processing = false;
+	uint64_t queue_serial = 0; // first come first served within a priority
+
+	Ref<TranscriptionJob> self; // keeps the job alive until _finish ran on the main thread
+	std::atomic<uint32_t> generation{ 0 }; // SpeechToText::cancel_generation when the pass began
+	std::atomic<bool> is_cancelled = false;
+	bool done = false;
+	bool succeeded = false;
+	std::atomic<float> progress{ 0.0f };
+	Array results;
+
+	bool _setup(const Variant &p_audio, const Dictionary &p_options);
+	bool _setup_file(const String &p_path, const Dictionary &p_options);
+	bool _setup_options(const Dictionary &p_options);
+	String _get_cache_salt() const;
+	bool _lookup_cache(const Ref<HashingContext> &p_hashing);
+	bool _prepare_input();
+	whisper_state *_get_window_state(whisper_context *p_context);
+	void _free_window_state();
+	std::vector<float> _get_pcmf32();
+	whisper_full_params _get_params();
+	double _to_input_seconds(double p_seconds) const;
+	void _append_results(whisper_context *p_context, whisper_state *p_state, int p_n_segments, double p_time_offset, int p_n_samples, bool p_align, Array &r_results);
+	PassResult _process();
+	void _finish(bool p_success);
+	static bool _abort(void *p_job);
+	static void _on_progress(whisper_context *p_context, whisper_state *p_state, int p_progress, void *p_job);
+
+protected:
+	static void _bind_methods();
+
+public:
+	/** Stop decoding or drop the job from the queue, completed is then emitted without results. */
+	_FORCE_INLINE_ void cancel() { is_cancelled = true; }
+	_FORCE_INLINE_ bool is_done() const { return done; }
+	_FORCE_INLINE_ bool is_succeeded() const { return succeeded; }
+	/** Jobs with a higher priority are decoded first. */
+	_FORCE_INLINE_ int get_priority() const { return priority; }
+	/** Share of the input decoded so far, from 0 to 1. */
+	_FORCE_INLINE_ float get_progress() const { return progress.load(std::memory_order_relaxed); }
+	/** The results were those of an earlier job on the same audio, see SpeechToText.transcript_cache_size. */
+	_FORCE_INLINE_ bool is_cached() const { return is_from_cache; }
+	/** One TranscriptionResult per segment, empty until the job is done. */
+	_FORCE_INLINE_ Array get_results() const { return results; }
+
+	~TranscriptionJob();
+};
+
+#endif // TRANSCRIPTION_JOB_H
@@ -0,0 +1,163 @@
+#include "transcription_result.h"
+
+size_t TranscriptionResult::append_token_text(std::string &r_text, const char *p_token_text, int &r_bracket_depth) {
+	const size_t size_before = r_text.size();
+	for (const char *c = p_token_text; *c != '\0'; c++) {
+		if (*c == '[' || *c == '<') {
+			r_bracket_depth++;
+		} else if ((*c == ']' || *c == '>') && r_bracket_depth > 0) {
+			r_bracket_depth--;
+		} else if (r_bracket_depth == 0) {
+			r_text += *c;
+		}
+	}
+	return r_text.size() - size_before;
+}
+
+void TranscriptionResult::set_words_from_tokens(const std::string &p_text, const std::vector<size_t> &p_token_ends) {
+	words.clear();
+	word_start_times.clear();
+	word_end_times.clear();
+	// Words are runs of p_text, only their start is looked at per token.
+	size_t word_start = 0;
+	size_t word_end = 0;
+	bool has_word = false;
+	size_t start = 0;
+	for (int i = 0; i < committed_token_count && i < (int)p_token_ends.size(); i++) {
+		const size_t end = MIN(p_token_ends[i], p_text.size());
+		const size_t piece_start = start;
+		start = MAX(start, end);
+		if (end <= piece_start) {
+			continue;
+		}
+		const bool is_word_start = p_text[piece_start] == ' ';
+		if (is_word_start || !has_word) {
+			if (has_word) {
+				words.push_back(String::utf8(p_text.data() + word_start, word_end - word_start));
+			}
+			word_start = is_word_start ? piece_start + 1 : piece_start;
+			has_word = true;
+			word_start_times.push_back(token_start_times[i]);
+			word_end_times.push_back(token_end_times[i]);
+		}
+		word_end = end;
+		word_end_times.set(word_end_times.size() - 1, token_end_times[i]);
+	}
+	if (has_word) {
+		words.push_back(String::utf8(p_text.data() + word_start, word_end - word_start));
+	}
+}
+
+Dictionary TranscriptionResult::to_dictionary() const {
+	Dictionary ret;
+	ret["partial"] = partial;
+	ret["committed_text"] = committed_text;
+	ret["tentative_text"] = tentative_text;
+	ret["translated_text"] = translated_text;
+	ret["start_time"] = start_time;
+	ret["end_time"] = end_time;
+	ret["token_ids"] = token_ids;
+	ret["token_start_times"] = token_start_times;
+	ret["token_end_times"] = token_end_times;
+	ret["token_probabilities"] = token_probabilities;
+	ret["committed_token_count"] = committed_token_count;
+	ret["words"] = words;
+	ret["word_start_times"] = word_start_times;
+	ret["word_end_times"] = word_end_times;
+	ret["language"] = language;
+	ret["language_probability"] = language_probability;
+	ret["speaker_turn_token_indices"] = speaker_turn_token_indices;
+	ret["speaker_turn_times"] = speaker_turn_times;
+	ret["repetition_aborted"] = repetition_aborted;
+	ret["delta"] = delta;
+	ret["delta_prefix_length"] = delta_prefix_length;
+	ret["delta_text"] = delta_text;
+	ret["capture_usec"] = capture_usec;
+	ret["delivery_usec"] = delivery_usec;
+	return ret;
+}
+
+Ref<TranscriptionResult> TranscriptionResult::from_dictionary(const Dictionary &p_dictionary) {
+	Ref<TranscriptionResult> result;
+	result.instantiate();
+	result->partial = p_dictionary.get("partial", result->partial);
+	result->committed_text = p_dictionary.get("committed_text", result->committed_text);
+	result->tentative_text = p_dictionary.get("tentative_text", result->tentative_text);
+	result->translated_text = p_dictionary.get("translated_text", result->translated_text);
+	result->start_time = p_dictionary.get("start_time", result->start_time);
+	result->end_time = p_dictionary.get("end_time", result->end_time);
+	result->token_ids = p_dictionary.get("token_ids", result->token_ids);
+	result->token_start_times = p_dictionary.get("token_start_times", result->token_start_times);
+	result->token_end_times = p_dictionary.get("token_end_times", result->token_end_times);
+	result->token_probabilities = p_dictionary.get("token_probabilities", result->token_probabilities);
+	result->committed_token_count = p_dictionary.get("committed_token_count", result->committed_token_count);
+	result->words = p_dictionary.get("words", result->words);
+	result->word_start_times = p_dictionary.get("word_start_times", result->word_start_times);
+	result->word_end_times = p_dictionary.get("word_end_times", result->word_end_times);
+	result->language = p_dictionary.get("language", result->language);
+	result->language_probability = p_dictionary.get("language_probability", result->language_probability);
+	result->speaker_turn_token_indices = p_dictionary.get("speaker_turn_token_indices", result->speaker_turn_token_indices);
+	result->speaker_turn_times = p_dictionary.get("speaker_turn_times", result->speaker_turn_times);
+	result->repetition_aborted = p_dictionary.get("repetition_aborted", result->repetition_aborted);
+	result->delta = p_dictionary.get("delta", result->delta);
+	result->delta_prefix_length = p_dictionary.get("delta_prefix_length", result->delta_prefix_length);
+	result->delta_text = p_dictionary.get("delta_text", result->delta_text);
+	result->capture_usec = p_dictionary.get("capture_usec", result->capture_usec);
+	result->delivery_usec = p_dictionary.get("delivery_usec", result->delivery_usec);
+	return result;
+}
+
+void TranscriptionResult::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("is_partial"), &TranscriptionResult::is_partial);
+	ClassDB::bind_method(D_METHOD("get_committed_text"), &TranscriptionResult::get_committed_text);
+	ClassDB::bind_method(D_METHOD("get_tentative_text"), &TranscriptionResult::get_tentative_text);
+	ClassDB::bind_method(D_METHOD("get_text"), &TranscriptionResult::get_text);
+	ClassDB::bind_method(D_METHOD("get_start_time"), &TranscriptionResult::get_start_time);
+	ClassDB::bind_method(D_METHOD("get_end_time"), &TranscriptionResult::get_end_time);
+	ClassDB::bind_method(D_METHOD("get_token_ids"), &TranscriptionResult::get_token_ids);
+	ClassDB::bind_method(D_METHOD("get_token_start_times"), &TranscriptionResult::get_token_start_times);
+	ClassDB::bind_method(D_METHOD("get_token_end_times"), &TranscriptionResult::get_token_end_times);
+	ClassDB::bind_method(D_METHOD("get_token_probabilities"), &TranscriptionResult::get_token_probabilities);
+	ClassDB::bind_method(D_METHOD("get_committed_token_count"), &TranscriptionResult::get_committed_token_count);
+	ClassDB::bind_method(D_METHOD("get_words"), &TranscriptionResult::get_words);
+	ClassDB::bind_method(D_METHOD("get_word_start_times"), &TranscriptionResult::get_word_start_times);
+	ClassDB::bind_method(D_METHOD("get_word_end_times"), &TranscriptionResult::get_word_end_times);
+	ClassDB::bind_method(D_METHOD("get_language"), &TranscriptionResult::get_language);
+	ClassDB::bind_method(D_METHOD("get_language_probability"), &TranscriptionResult::get_language_probability);
+	ClassDB::bind_method(D_METHOD("get_speaker_turn_token_indices"), &TranscriptionResult::get_speaker_turn_token_indices);
+	ClassDB::bind_method(D_METHOD("get_speaker_turn_times"), &TranscriptionResult::get_speaker_turn_times);
+	ClassDB::bind_method(D_METHOD("is_repetition_aborted"), &TranscriptionResult::is_repetition_aborted);
+	ClassDB::bind_method(D_METHOD("get_translated_text"), &TranscriptionResult::get_translated_text);
+	ClassDB::bind_method(D_METHOD("is_delta"), &TranscriptionResult::is_delta);
+	ClassDB::bind_method(D_METHOD("get_delta_prefix_length"), &TranscriptionResult::get_delta_prefix_length);
+	ClassDB::bind_method(D_METHOD("get_delta_text"), &TranscriptionResult::get_delta_text);
+	ClassDB::bind_method(D_METHOD("get_capture_usec"), &TranscriptionResult::get_capture_usec);
+	ClassDB::bind_method(D_METHOD("get_delivery_usec"), &TranscriptionResult::get_delivery_usec);
+	ClassDB::bind_method(D_METHOD("get_latency_ms"), &TranscriptionResult::get_latency_ms);
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "partial"), "", "is_partial");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "committed_text"), "", "get_committed_text");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "tentative_text"), "", "get_tentative_text");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "text"), "", "get_text");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "start_time"), "", "get_start_time");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "end_time"), "", "get_end_time");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "token_ids"), "", "get_token_ids");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "token_start_times"), "", "get_token_start_times");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "token_end_times"), "", "get_token_end_times");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "token_probabilities"), "", "get_token_probabilities");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "committed_token_count"), "", "get_committed_token_count");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_STRING_ARRAY, "words"), "", "get_words");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "word_start_times"), "", "get_word_start_times");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "word_end_times"), "", "get_word_end_times");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "language"), "", "get_language");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "language_probability"), "", "get_language_probability");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_INT32_ARRAY, "speaker_turn_token_indices"), "", "get_speaker_turn_token_indices");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_FLOAT32_ARRAY, "speaker_turn_times"), "", "get_speaker_turn_times");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "repetition_aborted"), "", "is_repetition_aborted");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "translated_text"), "", "get_translated_text");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "delta"), "", "is_delta");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "delta_prefix_length"), "", "get_delta_prefix_length");
+	ADD_PROPERTY(PropertyInfo(Variant::STRING, "delta_text"), "", "get_delta_text");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "capture_usec"), "", "get_capture_usec");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "delivery_usec"), "", "get_delivery_usec");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "latency_ms"), "", "get_latency_ms");
+}
@@ -0,0 +1,112 @@
+#ifndef TRANSCRIPTION_RESULT_H
+#define TRANSCRIPTION_RESULT_H
+
+#include <godot_cpp/classes/ref_counted.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_float32_array.hpp>
+#include <godot_cpp/variant/packed_int32_array.hpp>
+#include <godot_cpp/variant/packed_string_array.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace godot;
+
+/**
+ * Result of one decoding pass. The committed text left the audio buffer and
+ * is final, the tentative text is decoded again by the next pass. The token
+ * arrays hold the text tokens of both, committed ones first.
+ */
+class TranscriptionResult : public RefCounted {
+	GDCLASS(TranscriptionResult, RefCounted);
+
+	friend class SpeechToTextStream;
+	friend class TranscriptionJob;
+
+	bool partial = true;
+	String committed_text;
+	String tentative_text;
+	String translated_text;
+	/* Seconds of audio given to add_audio_buffer since start_listen, silence cut by the segmenter included. */
+	double start_time = 0.0;
+	double end_time = 0.0;
+	PackedInt32Array token_ids;
+	PackedFloat32Array token_start_times;
+	PackedFloat32Array token_end_times;
+	PackedFloat32Array token_probabilities;
+	int committed_token_count = 0;
+	/* Words of the committed text, a token starting with a space starts a new one. */
+	PackedStringArray words;
+	PackedFloat32Array word_start_times;
+	PackedFloat32Array word_end_times;
+	String language;
+	float language_probability = 1.0f;
+	/* Where tinydiarize marked a new speaker: the index of the first token after the turn, and its time. */
+	PackedInt32Array speaker_turn_token_indices;
+	PackedFloat32Array speaker_turn_times;
+	bool repetition_aborted = false;
+	/* A partial of SpeechToTextStream.delta_partials: the tentative text is that of the result before it up to delta_prefix_length, then delta_text. */
+	bool delta = false;
+	int delta_prefix_length = 0;
+	String delta_text;
+	/* Time ticks when the latest sample the result was decoded from was captured, and when the result was delivered. 0 if unknown. */
+	int64_t capture_usec = 0;
+	int64_t delivery_usec = 0;
+
+protected:
+	static void _bind_methods();
+
+public:
+	/**
+	 * Append the text of a token without what is inside [..] or <..>, e.g.
+	 * [BLANK_AUDIO]. r_bracket_depth carries over between tokens, since whisper
+	 * spells such annotations with several of them. Returns the bytes appended.
+	 */
+	static size_t append_token_text(std::string &r_text, const char *p_token_text, int &r_bracket_depth);
+	/** Group the first committed_token_count tokens into words, token i ends at p_token_ends[i] in p_text. */
+	void set_words_from_tokens(const std::string &p_text, const std::vector<size_t> &p_token_ends);
+	/** Every field by name, e.g. to save a transcript, from_dictionary() reads it back. */
+	Dictionary to_dictionary() const;
+	static Ref<TranscriptionResult> from_dictionary(const Dictionary &p_dictionary);
+
+	/** True while nothing was committed, the whole text is decoded again by the next pass. */
+	_FORCE_INLINE_ bool is_partial() const { return partial; }
+	_FORCE_INLINE_ String get_committed_text() const { return committed_text; }
+	_FORCE_INLINE_ String get_tentative_text() const { return tentative_text; }
+	_FORCE_INLINE_ String get_text() const { return committed_text + tentative_text; }
+	/** English translation of the committed text with SpeechToText.dual_translation, empty otherwise and on partial results. */
+	_FORCE_INLINE_ String get_translated_text() const { return translated_text; }
+	_FORCE_INLINE_ double get_start_time() const { return start_time; }
+	_FORCE_INLINE_ double get_end_time() const { return end_time; }
+	_FORCE_INLINE_ PackedInt32Array get_token_ids() const { return token_ids; }
+	_FORCE_INLINE_ PackedFloat32Array get_token_start_times() const { return token_start_times; }
+	_FORCE_INLINE_ PackedFloat32Array get_token_end_times() const { return token_end_times; }
+	_FORCE_INLINE_ PackedFloat32Array get_token_probabilities() const { return token_probabilities; }
+	/** The first tokens of the arrays that belong to the committed text. */
+	_FORCE_INLINE_ int get_committed_token_count() const { return committed_token_count; }
+	/** With SpeechToText.dtw_word_timestamps the times come from the alignment of the committing pass. */
+	_FORCE_INLINE_ PackedStringArray get_words() const { return words; }
+	_FORCE_INLINE_ PackedFloat32Array get_word_start_times() const { return word_start_times; }
+	_FORCE_INLINE_ PackedFloat32Array get_word_end_times() const { return word_end_times; }
+	/** Code of the language decoded with, e.g. "en". Its probability is 1.0 unless it was auto-detected. */
+	_FORCE_INLINE_ String get_language() const { return language; }
+	_FORCE_INLINE_ float get_language_probability() const { return language_probability; }
+	/** Empty unless SpeechToText.speaker_turns is on and the model is a tinydiarize one. */
+	_FORCE_INLINE_ PackedInt32Array get_speaker_turn_token_indices() const { return speaker_turn_token_indices; }
+	_FORCE_INLINE_ PackedFloat32Array get_speaker_turn_times() const { return speaker_turn_times; }
+	/** The decoder looped on the same words and was stopped, see SpeechToText.repetition_limit. The text keeps their first copy. */
+	_FORCE_INLINE_ bool is_repetition_aborted() const { return repetition_aborted; }
+	/** A partial with SpeechToTextStream.delta_partials, its tentative_text is empty: keep the first delta_prefix_length characters of the last tentative text and append delta_text. */
+	_FORCE_INLINE_ bool is_delta() const { return delta; }
+	_FORCE_INLINE_ int get_delta_prefix_length() const { return delta_prefix_length; }
+	_FORCE_INLINE_ String get_delta_text() const { return delta_text; }
+	/** Time.get_ticks_usec() when the latest sample the result was decoded from entered add_audio_buffer, or whichever method fed it, backdated by where it was in its chunk. */
+	_FORCE_INLINE_ int64_t get_capture_usec() const { return capture_usec; }
+	/** Time.get_ticks_usec() when update_transcribed_msgs emitted the result or poll_results() returned it. */
+	_FORCE_INLINE_ int64_t get_delivery_usec() const { return delivery_usec; }
+	/** From the capture of the latest sample to the delivery, what a player waits for the text. 0 for the results of offline jobs. */
+	_FORCE_INLINE_ double get_latency_ms() const { return capture_usec > 0 && delivery_usec > capture_usec ? (delivery_usec - capture_usec) / 1000.0 : 0.0; }
+};
+
+#endif // TRANSCRIPTION_RESULT_H
@@ -0,0 +1,593 @@
+#include "transcription_scheduler.h"
+#include "simulation_clock.h"
+#include "speech_to_text_stream.h"
+#include "thread_affinity.h"
+#include "trace.h"
+#include "transcription_job.h"
+#include "worker_pool_executor.h"
+
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+/* How often idle workers look for segments to close. */
+static const int idle_tick_ms = 100;
+
+static uint64_t _now_msec() {
+	return SimulationClock::get_ticks_msec();
+}
+
+static_assert(TranscriptionScheduler::PRIORITY_CLASSES == SpeechToTextStream::PRIORITY_MAX, "One budget per priority class");
+
+bool TranscriptionScheduler::_is_within_budget(const SpeechToTextStream *p_stream) const {
+	const int budget = class_budget[p_stream->priority_class];
+	return budget == 0 || class_busy[p_stream->priority_class] < budget;
+}
+
+/* Higher class first, then the earlier deadline. */
+bool TranscriptionScheduler::_is_before(const SpeechToTextStream *p_stream, const SpeechToTextStream *p_other) {
+	if (p_stream->priority_class != p_other->priority_class) {
+		return p_stream->priority_class < p_other->priority_class;
+	}
+	return p_stream->ready_msec + p_stream->max_latency_ms < p_other->ready_msec + p_other->max_latency_ms;
+}
+
+SpeechToTextStream *TranscriptionScheduler::_pick_stream(uint64_t p_now, bool &r_close_segment) {
+	SpeechToTextStream *best = nullptr;
+	for (SpeechToTextStream *stream : streams) {
+		if (!stream->is_ready || stream->is_processing || !_is_within_budget(stream)) {
+			continue;
+		}
+		if (best == nullptr || _is_before(stream, best)) {
+			best = stream;
+		}
+	}
+	if (best != nullptr) {
+		// Its utterance ended, the pass that takes the rest of it closes the segment too.
+		r_close_segment = best->endpoint_pending.load(std::memory_order_acquire);
+		return best;
+	}
+	// Nothing ready, finish segments whose speaker went quiet.
+	for (SpeechToTextStream *stream : streams) {
+		if (stream->is_processing || !_is_within_budget(stream)) {
+			continue;
+		}
+		if (stream->endpoint_pending.load(std::memory_order_acquire)) {
+			// Less than a pass of audio may be queued, e.g. a short "yes".
+			if (!stream->pcmf32.empty() || stream->audio_queue.size() > 0) {
+				r_close_segment = true;
+				return stream;
+			}
+			stream->endpoint_pending.store(false, std::memory_order_relaxed);
+		}
+		// Without a producer that saw the silence, e.g. when the input stopped, no new pass of audio for as long as one takes to queue.
+		const uint64_t close_segment_ms = stream->wake_threshold_frames.load(std::memory_order_relaxed) * 1000 / WHISPER_SAMPLE_RATE;
+		if (!stream->pcmf32.empty() && p_now - stream->last_process_msec >= close_segment_ms) {
+			r_close_segment = true;
+			return stream;
+		}
+	}
+	return nullptr;
+}
+
+void TranscriptionScheduler::_pick_batch(std::vector<SpeechToTextStream *> &r_batch) {
+	// Of the class of the first stream only, a background stream would slow down the pass of an interactive one.
+	const int priority_class = r_batch[0]->priority_class;
+	while ((int)r_batch.size() < max_batch) {
+		SpeechToTextStream *best = nullptr;
+		for (SpeechToTextStream *stream : streams) {
+			if (!stream->is_ready || stream->is_processing || stream->priority_class != priority_class || std::find(r_batch.begin(), r_batch.end(), stream) != r_batch.end()) {
+				continue;
+			}
+			if (best == nullptr || _is_before(stream, best)) {
+				best = stream;
+			}
+		}
+		if (best == nullptr) {
+			return;
+		}
+		r_batch.push_back(best);
+	}
+}
+
+TranscriptionJob *TranscriptionScheduler::_pick_job() {
+	if (preempt_jobs.load(std::memory_order_relaxed)) {
+		return nullptr;
+	}
+	TranscriptionJob *best = nullptr;
+	for (TranscriptionJob *job : jobs) {
+		if (job->is_processing) {
+			continue;
+		}
+		if (best == nullptr || job->priority > best->priority || (job->priority == best->priority && job->queue_serial < best->queue_serial)) {
+			best = job;
+		}
+	}
+	return best;
+}
+
+/*
+ * Abort passes of lower classes until the p_runnable ready streams of each
+ * class, highest first, find a worker. A pass frees one worker however many
+ * streams were batched into it, those already aborting count as freed.
+ */
+void TranscriptionScheduler::_preempt_lower_classes(const int *p_runnable, int p_idle) {
+	std::vector<uint64_t> preempted;
+	for (const SpeechToTextStream *stream : streams) {
+		if (stream->is_processing && stream->pass_preempted.load(std::memory_order_relaxed) && std::find(preempted.begin(), preempted.end(), stream->pass_batch) == preempted.end()) {
+			preempted.push_back(stream->pass_batch);
+		}
+	}
+	int demand = 0;
+	for (int priority_class = 0; priority_class < PRIORITY_CLASSES - 1; priority_class++) {
+		demand += p_runnable[priority_class];
+		while (demand > p_idle + (int)preempted.size()) {
+			// The pass of the lowest class goes first.
+			SpeechToTextStream *victim = nullptr;
+			for (SpeechToTextStream *stream : streams) {
+				if (stream->is_processing && !stream->pass_preempted.load(std::memory_order_relaxed) && stream->priority_class > priority_class && (victim == nullptr || stream->priority_class > victim->priority_class)) {
+					victim = stream;
+				}
+			}
+			if (victim == nullptr) {
+				return;
+			}
+			for (SpeechToTextStream *stream : streams) {
+				if (stream->is_processing && stream->pass_batch == victim->pass_batch) {
+					stream->pass_preempted.store(true, std::memory_order_relaxed);
+				}
+			}
+			preempted.push_back(victim->pass_batch);
+		}
+	}
+}
+
+/* Call with the mutex held, whenever a stream became ready or a worker became busy or idle. */
+void TranscriptionScheduler::_update_preemption() {
+	int waiting = 0;
+	int runnable[PRIORITY_CLASSES] = {}; // waiting streams their class budget lets take a worker
+	bool has_lower_class = false;
+	for (const SpeechToTextStream *stream : streams) {
+		if (stream->is_ready && !stream->is_processing) {
+			waiting++;
+			if (_is_within_budget(stream)) {
+				runnable[stream->priority_class]++;
+			}
+		}
+		if (stream->is_processing && stream->priority_class > 0) {
+			has_lower_class = true;
+		}
+	}
+	const int idle = _get_started_workers() - busy_workers;
+	waiting_streams.store(waiting, std::memory_order_relaxed);
+	preempt_jobs.store(waiting > idle, std::memory_order_relaxed);
+	if (has_lower_class && waiting > idle) {
+		_preempt_lower_classes(runnable, idle);
+	}
+}
+
+bool TranscriptionScheduler::_take_work(Work &r_work) {
+	r_work.batch.clear();
+	r_work.job = nullptr;
+	r_work.close_segment = false;
+	SpeechToTextStream *stream = _pick_stream(_now_msec(), r_work.close_segment);
+	if (stream == nullptr) {
+		TranscriptionJob *job = _pick_job();
+		if (job == nullptr) {
+			return false;
+		}
+		job->is_processing = true;
+		busy_workers++;
+		_update_preemption();
+		r_work.job = job;
+		return true;
+	}
+	r_work.batch.push_back(stream);
+	if (!r_work.close_segment) {
+		_pick_batch(r_work.batch);
+	}
+	const uint64_t now = _now_msec();
+	batch_serial++;
+	for (SpeechToTextStream *batched : r_work.batch) {
+		batched->pass_batch = batch_serial;
+		batched->pass_preempted.store(false, std::memory_order_relaxed);
+		if (batched->is_ready && now > batched->ready_msec + batched->max_latency_ms) {
+			batched->missed_deadlines++;
+		}
+		batched->pass_queue_wait_ms = batched->is_ready && now > batched->ready_msec ? double(now - batched->ready_msec) : 0.0;
+		batched->is_ready = false;
+		batched->is_processing = true;
+	}
+	busy_workers++;
+	class_busy[stream->priority_class]++;
+	_update_preemption();
+	return true;
+}
+
+void TranscriptionScheduler::_run_work(Work &p_work) {
+	// Before the pass, so on Linux the mel threads whisper starts inherit the affinity.
+	ThreadAffinity::update_current_thread();
+	if (p_work.job != nullptr) {
+		TRACE_ZONE("job_pass");
+		p_work.job_result = p_work.job->_process();
+	} else if (p_work.batch.size() > 1) {
+		SpeechToTextStream::_process_batch(p_work.batch.data(), p_work.batch.size());
+	} else {
+		p_work.batch[0]->_process(p_work.close_segment);
+	}
+}
+
+void TranscriptionScheduler::_finish_work(Work &p_work) {
+	if (p_work.job != nullptr) {
+		TranscriptionJob *job = p_work.job;
+		job->is_processing = false;
+		busy_workers--;
+		if (p_work.job_result == TranscriptionJob::PASS_DONE || p_work.job_result == TranscriptionJob::PASS_FAILED) {
+			jobs.erase(std::remove(jobs.begin(), jobs.end(), job), jobs.end());
+			job->call_deferred("_finish", p_work.job_result == TranscriptionJob::PASS_DONE);
+		}
+		_update_preemption();
+		idle_cond.notify_all();
+		return;
+	}
+	const uint64_t finished = _now_msec();
+	for (SpeechToTextStream *batched : p_work.batch) {
+		batched->is_processing = false;
+		batched->pass_preempted.store(false, std::memory_order_relaxed);
+		batched->last_process_msec = finished;
+		if (batched->pass_restart) {
+			// Aborted to start again, it keeps the deadline it had.
+			batched->is_ready = true;
+		} else if (batched->audio_queue.size() >= batched->wake_threshold_frames) {
+			// More audio arrived during the pass.
+			batched->is_ready = true;
+			batched->ready_msec = finished;
+		}
+	}
+	busy_workers--;
+	class_busy[p_work.batch[0]->priority_class]--;
+	_update_preemption();
+	idle_cond.notify_all();
+}
+
+void TranscriptionScheduler::_worker() {
+	Work work;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!is_stopping) {
+		if (!_take_work(work)) {
+			idle_looks++;
+			idle_cond.notify_all();
+			work_cond.wait_for(lock, std::chrono::milliseconds(idle_tick_ms));
+			continue;
+		}
+		lock.unlock();
+		_run_work(work);
+		TRACE_LOCK(lock, "scheduler mutex wait");
+		_finish_work(work);
+	}
+}
+
+void TranscriptionScheduler::_pool_task(void *p_work) {
+	Work *work = (Work *)p_work;
+	TranscriptionScheduler *scheduler = work->scheduler;
+	scheduler->_run_work(*work);
+	{
+		std::unique_lock<std::mutex> lock(scheduler->mutex);
+		scheduler->_finish_work(*work);
+		work->is_done = true;
+	}
+	WorkerPoolExecutor::release(1);
+	// The dispatcher takes the next work, as a worker would right after its pass.
+	scheduler->work_cond.notify_all();
+}
+
+void TranscriptionScheduler::_reap_pool_work(bool p_all) {
+	std::vector<Work *> reaped;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (Work *work : pool_work) {
+			if (p_all || work->is_done) {
+				reaped.push_back(work);
+			}
+		}
+		for (Work *work : reaped) {
+			pool_work.erase(std::find(pool_work.begin(), pool_work.end(), work));
+		}
+	}
+	for (Work *work : reaped) {
+		// Every task has to be waited for, the pool frees it then.
+		WorkerThreadPool::get_singleton()->wait_for_task_completion(work->task_id);
+		delete work;
+	}
+}
+
+void TranscriptionScheduler::_dispatcher() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!is_stopping) {
+		bool is_idle = false;
+		// A pass takes a pool thread, the threads of its graphs take more of them.
+		while (busy_workers < worker_count && WorkerPoolExecutor::try_reserve(1)) {
+			Work *work = new Work;
+			work->scheduler = this;
+			if (!_take_work(*work)) {
+				WorkerPoolExecutor::release(1);
+				delete work;
+				is_idle = true;
+				break;
+			}
+			pool_work.push_back(work);
+			work->task_id = WorkerThreadPool::get_singleton()->add_native_task(&TranscriptionScheduler::_pool_task, work, true, "whisper pass");
+		}
+		if (is_idle) {
+			idle_looks++;
+			idle_cond.notify_all();
+		}
+		work_cond.wait_for(lock, std::chrono::milliseconds(idle_tick_ms));
+		lock.unlock();
+		_reap_pool_work(false);
+		lock.lock();
+	}
+}
+
+void TranscriptionScheduler::_helper() {
+	ThreadAffinity::update_current_thread();
+	std::unique_lock<std::mutex> lock(helper_mutex);
+	while (true) {
+		helper_cond.wait(lock, [this]() { return helpers_stopping || !helper_calls.empty(); });
+		if (helper_calls.empty()) {
+			return;
+		}
+		ParallelCall *call = helper_calls.front();
+		const uint32_t index = call->next++;
+		if (call->next == call->count) {
+			helper_calls.pop_front();
+		}
+		lock.unlock();
+		call->task(call->data, index);
+		lock.lock();
+		call->done++;
+		helper_done_cond.notify_all();
+	}
+}
+
+void TranscriptionScheduler::_stop_helpers() {
+	{
+		std::lock_guard<std::mutex> lock(helper_mutex);
+		helpers_stopping = true;
+	}
+	helper_cond.notify_all();
+	for (std::thread &helper : helpers) {
+		helper.join();
+	}
+	helpers.clear();
+	helpers_stopping = false;
+}
+
+void TranscriptionScheduler::_run_parallel_element(void *p_call, uint32_t p_index) {
+	ThreadAffinity::update_current_thread();
+	const ParallelCall *call = (const ParallelCall *)p_call;
+	call->task(call->data, p_index + 1);
+}
+
+void TranscriptionScheduler::run_parallel(void (*p_task)(void *, uint32_t), void *p_data, uint32_t p_count) {
+	if (p_count <= 1) {
+		if (p_count == 1) {
+			p_task(p_data, 0);
+		}
+		return;
+	}
+	ParallelCall call;
+	call.task = p_task;
+	call.data = p_data;
+	call.count = p_count;
+	if (use_thread_pool) {
+		// Every task takes a pool thread, as a pass does, the graph threads of each of them take more.
+		if (!WorkerPoolExecutor::try_reserve(p_count - 1)) {
+			for (uint32_t i = 0; i < p_count; i++) {
+				p_task(p_data, i);
+			}
+			return;
+		}
+		const WorkerThreadPool::GroupID group = WorkerThreadPool::get_singleton()->add_native_group_task(&TranscriptionScheduler::_run_parallel_element, &call, p_count - 1, p_count - 1, true, "whisper batch pass");
+		p_task(p_data, 0);
+		WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group);
+		WorkerPoolExecutor::release(p_count - 1);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(helper_mutex);
+		helper_demand += p_count - 1;
+		// At most worker count times max batch minus one of them, the calls of all workers at once.
+		while ((int)helpers.size() < helper_demand) {
+			helpers.emplace_back(&TranscriptionScheduler::_helper, this);
+		}
+		helper_calls.push_back(&call);
+	}
+	helper_cond.notify_all();
+	p_task(p_data, 0);
+	std::unique_lock<std::mutex> lock(helper_mutex);
+	helper_done_cond.wait(lock, [&call]() { return call.done == call.count; });
+	helper_demand -= p_count - 1;
+}
+
+void TranscriptionScheduler::_start_workers() {
+	is_stopping = false;
+	if (use_thread_pool) {
+		if (workers.empty()) {
+			workers.emplace_back(&TranscriptionScheduler::_dispatcher, this);
+		}
+		return;
+	}
+	for (int i = workers.size(); i < worker_count; i++) {
+		workers.emplace_back(&TranscriptionScheduler::_worker, this);
+	}
+}
+
+void TranscriptionScheduler::_stop_workers() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_stopping = true;
+	}
+	work_cond.notify_all();
+	idle_cond.notify_all();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+	// The passes in flight on the thread pool finish on their own.
+	_reap_pool_work(true);
+	// No worker is left to queue a parallel call.
+	_stop_helpers();
+	workers.clear();
+}
+
+void TranscriptionScheduler::set_worker_count(int p_count) {
+	p_count = std::max(1, p_count);
+	if (p_count == worker_count) {
+		return;
+	}
+	const bool was_started = !workers.empty();
+	_stop_workers();
+	worker_count = p_count;
+	if (was_started) {
+		std::lock_guard<std::mutex> lock(mutex);
+		_start_workers();
+	}
+}
+
+void TranscriptionScheduler::set_use_thread_pool(bool p_use_thread_pool) {
+	if (p_use_thread_pool == use_thread_pool) {
+		return;
+	}
+	const bool was_started = !workers.empty();
+	_stop_workers();
+	use_thread_pool = p_use_thread_pool;
+	if (was_started) {
+		std::lock_guard<std::mutex> lock(mutex);
+		_start_workers();
+	}
+}
+
+void TranscriptionScheduler::set_max_batch(int p_max_batch) {
+	std::lock_guard<std::mutex> lock(mutex);
+	max_batch = std::max(1, p_max_batch);
+}
+
+void TranscriptionScheduler::set_class_budget(int p_class, int p_workers) {
+	ERR_FAIL_INDEX(p_class, PRIORITY_CLASSES);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		class_budget[p_class] = std::max(0, p_workers);
+		_update_preemption();
+	}
+	// A stream held back by the old budget may run now.
+	work_cond.notify_all();
+}
+
+int TranscriptionScheduler::get_class_budget(int p_class) {
+	ERR_FAIL_INDEX_V(p_class, PRIORITY_CLASSES, 0);
+	std::lock_guard<std::mutex> lock(mutex);
+	return class_budget[p_class];
+}
+
+void TranscriptionScheduler::add_stream(SpeechToTextStream *p_stream) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (std::find(streams.begin(), streams.end(), p_stream) != streams.end()) {
+		return;
+	}
+	p_stream->is_ready = false;
+	p_stream->last_process_msec = _now_msec();
+	streams.push_back(p_stream);
+	if (workers.empty()) {
+		_start_workers();
+	}
+}
+
+void TranscriptionScheduler::remove_stream(SpeechToTextStream *p_stream) {
+	std::unique_lock<std::mutex> lock(mutex);
+	streams.erase(std::remove(streams.begin(), streams.end(), p_stream), streams.end());
+	p_stream->is_ready = false;
+	_update_preemption();
+	idle_cond.wait(lock, [&] { return !p_stream->is_processing; });
+}
+
+void TranscriptionScheduler::notify_ready(SpeechToTextStream *p_stream) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (p_stream->is_ready) {
+			return;
+		}
+		p_stream->is_ready = true;
+		p_stream->ready_msec = _now_msec();
+		_update_preemption();
+	}
+	work_cond.notify_one();
+}
+
+void TranscriptionScheduler::notify_endpoint(SpeechToTextStream *p_stream) {
+	{
+		// Under the mutex, so a worker about to wait does not miss it.
+		std::lock_guard<std::mutex> lock(mutex);
+		if (p_stream->is_processing) {
+			// Picked up when the pass in flight is done.
+			return;
+		}
+	}
+	work_cond.notify_one();
+}
+
+bool TranscriptionScheduler::is_stream_idle(const SpeechToTextStream *p_stream) {
+	std::lock_guard<std::mutex> lock(mutex);
+	// pcmf32 is only written by passes, which hold is_processing.
+	return !p_stream->is_ready && !p_stream->is_processing && p_stream->pcmf32.empty() && !p_stream->endpoint_pending.load(std::memory_order_relaxed);
+}
+
+void TranscriptionScheduler::wait_until_quiet() {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (workers.empty()) {
+		return;
+	}
+	const uint64_t looks = idle_looks;
+	// Wake a worker now instead of at its next idle tick.
+	work_cond.notify_all();
+	idle_cond.wait(lock, [&] {
+		if (is_stopping) {
+			return true;
+		}
+		if (idle_looks == looks || busy_workers > 0) {
+			return false;
+		}
+		for (const SpeechToTextStream *stream : streams) {
+			if (stream->is_ready) {
+				return false;
+			}
+		}
+		return true;
+	});
+}
+
+void TranscriptionScheduler::add_job(TranscriptionJob *p_job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		p_job->queue_serial = job_serial++;
+		jobs.push_back(p_job);
+		if (workers.empty()) {
+			_start_workers();
+		}
+	}
+	work_cond.notify_one();
+}
+
+void TranscriptionScheduler::remove_job(TranscriptionJob *p_job) {
+	std::unique_lock<std::mutex> lock(mutex);
+	jobs.erase(std::remove(jobs.begin(), jobs.end(), p_job), jobs.end());
+	idle_cond.wait(lock, [&] { return !p_job->is_processing; });
+}
+
+void TranscriptionScheduler::stop() {
+	_stop_workers();
+}
+
+TranscriptionScheduler::~TranscriptionScheduler() {
+	stop();
+}
@@ -0,0 +1,169 @@
+#ifndef TRANSCRIPTION_SCHEDULER_H
+#define TRANSCRIPTION_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class SpeechToTextStream;
+class TranscriptionJob;
+
+/**
+ * Fixed pool of decoding workers shared by every listening stream. A stream
+ * is marked ready once it queued enough audio, and idle workers pick the
+ * ready stream with the earliest deadline (ready time plus the stream's
+ * latency budget). A stream is never decoded by two workers at once. With
+ * a max batch above one, a worker takes the next ready streams as well and
+ * encodes them in a single pass.
+ *
+ * Streams are ordered by their priority class first. A class may be limited
+ * to a number of workers, so a flood of background streams leaves workers to
+ * the interactive ones. When a ready stream finds no idle worker, the pass of
+ * a lower class aborts at its next graph node and runs again later.
+ *
+ * Offline jobs are queued by priority and only decoded by workers that have
+ * no stream to decode. As soon as more streams are ready than workers are
+ * idle, the jobs in flight abort their window and give their workers back.
+ *
+ * With the thread pool on, the workers are not threads of their own: one
+ * thread picks the work as they would and runs every pass or job window as a
+ * task of Godot's WorkerThreadPool, at most worker count of them at once.
+ */
+class TranscriptionScheduler {
+public:
+	static const int PRIORITY_CLASSES = 3; // SpeechToTextStream::PriorityClass
+
+private:
+	std::vector<SpeechToTextStream *> streams; // listening streams
+	std::vector<TranscriptionJob *> jobs; // queued offline jobs
+	uint64_t job_serial = 0;
+	int busy_workers = 0;
+	std::atomic<bool> preempt_jobs{ false };
+	std::atomic<int> waiting_streams{ 0 }; // ready and waiting for a worker
+	std::vector<std::thread> workers;
+	int worker_count = 1;
+	int max_batch = 1; // streams sharing one encoder pass
+	uint64_t batch_serial = 0;
+	int class_busy[PRIORITY_CLASSES] = {}; // workers decoding a stream of the class
+	int class_budget[PRIORITY_CLASSES] = {}; // workers a class may take at most, 0 for all of them
+	bool is_stopping = false;
+	uint64_t idle_looks = 0; // times a worker found nothing to do, see wait_until_quiet
+	std::mutex mutex;
+	std::condition_variable work_cond; // a stream became ready, or the pool stops
+	std::condition_variable idle_cond; // a stream finished a pass, or a worker found nothing to do
+
+	/* A pass of streams or a window of a job, taken by a worker. */
+	struct Work {
+		TranscriptionScheduler *scheduler = nullptr;
+		std::vector<SpeechToTextStream *> batch;
+		bool close_segment = false;
+		TranscriptionJob *job = nullptr;
+		int job_result = 0; // TranscriptionJob::PassResult
+		int64_t task_id = -1; // with the thread pool
+		bool is_done = false; // under the mutex
+	};
+	bool use_thread_pool = false;
+	std::vector<Work *> pool_work; // tasks in flight or not waited for yet
+
+	/* The tasks of a run_parallel after the first, which its worker runs itself. */
+	struct ParallelCall {
+		void (*task)(void *, uint32_t) = nullptr;
+		void *data = nullptr;
+		uint32_t count = 0;
+		uint32_t next = 1; // under helper_mutex
+		uint32_t done = 1;
+	};
+	/* Without the thread pool, the threads of the parallel calls. Started as they are needed, kept until the workers stop. */
+	std::vector<std::thread> helpers;
+	std::deque<ParallelCall *> helper_calls; // with tasks not taken yet
+	int helper_demand = 0; // tasks of the calls in flight, run or not
+	bool helpers_stopping = false;
+	std::mutex helper_mutex;
+	std::condition_variable helper_cond; // a call was queued, or the helpers stop
+	std::condition_variable helper_done_cond; // a task of a call finished
+
+	bool _is_within_budget(const SpeechToTextStream *p_stream) const;
+	static bool _is_before(const SpeechToTextStream *p_stream, const SpeechToTextStream *p_other);
+	void _preempt_lower_classes(const int *p_runnable, int p_idle);
+	SpeechToTextStream *_pick_stream(uint64_t p_now, bool &r_close_segment);
+	void _pick_batch(std::vector<SpeechToTextStream *> &r_batch);
+	TranscriptionJob *_pick_job();
+	void _update_preemption();
+	int _get_started_workers() const { return workers.empty() ? 0 : worker_count; }
+	/** With the mutex held, mark the next pass or job window busy, false when there is nothing to do. */
+	bool _take_work(Work &r_work);
+	/** Without the mutex. */
+	void _run_work(Work &p_work);
+	/** With the mutex held, after _run_work. */
+	void _finish_work(Work &p_work);
+	void _start_workers();
+	void _stop_workers();
+	void _worker();
+	void _dispatcher();
+	void _helper();
+	static void _run_parallel_element(void *p_call, uint32_t p_index);
+	void _stop_helpers();
+	static void _pool_task(void *p_work);
+	/** Wait for the tasks that are done, or for all of them. Call without the mutex. */
+	void _reap_pool_work(bool p_all);
+
+public:
+	/** Restarts the pool, waiting for the passes in flight. */
+	void set_worker_count(int p_count);
+	int get_worker_count() const { return worker_count; }
+
+	/** Run the passes as WorkerThreadPool tasks instead of on threads of the scheduler. Restarts the pool like set_worker_count. */
+	void set_use_thread_pool(bool p_use_thread_pool);
+	bool is_using_thread_pool() const { return use_thread_pool; }
+
+	/**
+	 * Called by a worker, runs p_task(p_data, 0) to p_task(p_data, p_count - 1) at once and returns when all of
+	 * them are done: the first on the worker, the others on helper threads kept for it, or as tasks of the
+	 * thread pool when it is on. In the pool they run one after the other on the worker when it has no
+	 * threads left. For the passes of a batch whose decoder steps run as one graph.
+	 */
+	void run_parallel(void (*p_task)(void *, uint32_t), void *p_data, uint32_t p_count);
+
+	void set_max_batch(int p_max_batch);
+	int get_max_batch() const { return max_batch; }
+
+	/** Workers the streams of p_class may decode on at once, 0 lets them take all of them. */
+	void set_class_budget(int p_class, int p_workers);
+	int get_class_budget(int p_class);
+
+	/** Start scheduling p_stream, the pool is started with the first stream. */
+	void add_stream(SpeechToTextStream *p_stream);
+	/** Stop scheduling p_stream, returns once its pass in flight, if any, has finished. */
+	void remove_stream(SpeechToTextStream *p_stream);
+	/** Called by the producer when p_stream queued enough audio for a pass. */
+	void notify_ready(SpeechToTextStream *p_stream);
+	/** Called by the producer when the utterance of p_stream ended, an idle worker closes its segment. */
+	void notify_endpoint(SpeechToTextStream *p_stream);
+	/** True while p_stream has no pass in flight, none waiting and no open segment or ended utterance left to close. */
+	bool is_stream_idle(const SpeechToTextStream *p_stream);
+	/**
+	 * Returns once no pass or job runs or waits, and a worker looked for work after the call, so also
+	 * for segments to close at the time of SimulationClock now. A simulation moves the clock on after it.
+	 */
+	void wait_until_quiet();
+
+	/** Queue p_job, it is done once it emitted completed. */
+	void add_job(TranscriptionJob *p_job);
+	/** Drop p_job from the queue, returns once its pass in flight, if any, has finished. */
+	void remove_job(TranscriptionJob *p_job);
+	/** Polled by the jobs in flight, true while a ready stream waits for a worker. */
+	bool is_preempting_jobs() const { return preempt_jobs.load(std::memory_order_relaxed); }
+	/** Streams that queued enough audio for a pass and wait for a worker, the depth of the ready queue. */
+	int get_waiting_streams() const { return waiting_streams.load(std::memory_order_relaxed); }
+
+	void stop();
+
+	TranscriptionScheduler() {}
+	~TranscriptionScheduler();
+};
+
+#endif // TRANSCRIPTION_SCHEDULER_H
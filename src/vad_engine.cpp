@@ -0,0 +1,100 @@
+#include "vad_engine.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cmath>
+
+using namespace godot;
+
+/* Mean amplitude below which audio counts as silence whatever the engine. */
+static const float silence_level = 0.0001f;
+
+/* Adaptive engine tuning, in dB of mean amplitude. */
+static const float noise_rise_db_per_frame = 0.02f; // about 2 dB/s, speech does not lift the floor
+static const float speech_snr_db = 6.0f; // half probability this far above the floor
+static const float snr_slope_db = 1.5f;
+static const float attack = 0.3f; // two loud frames in a row to cross one half
+static const float release = 0.93f; // about 100 ms to fall back below one half
+
+std::unique_ptr<VadEngine> VadEngine::create(Mode p_mode, int p_sample_rate) {
+	switch (p_mode) {
+		case MODE_ADAPTIVE:
+			return std::unique_ptr<VadEngine>(new AdaptiveVadEngine(p_sample_rate));
+		case MODE_ENERGY:
+		default:
+			return std::unique_ptr<VadEngine>(new EnergyVadEngine(p_sample_rate));
+	}
+}
+
+EnergyVadEngine::EnergyVadEngine(int p_sample_rate) {
+	detector.setup(p_sample_rate, HISTORY_MS);
+}
+
+float EnergyVadEngine::process(const float *p_samples, size_t p_count, bool p_is_filtered, std::vector<float> &r_probabilities) {
+	const float energy = _push_frames(detector, p_samples, p_count, p_is_filtered, [&](float p_energy) {
+		r_probabilities.push_back(p_energy < silence_level ? 0.0f : 1.0f);
+	});
+	// The whole chunk decides, like vad_simple with last_ms = 0.
+	return energy < silence_level ? 0.0f : 1.0f;
+}
+
+AdaptiveVadEngine::AdaptiveVadEngine(int p_sample_rate) {
+	detector.setup(p_sample_rate, HISTORY_MS);
+}
+
+void AdaptiveVadEngine::reset() {
+	detector.reset();
+	noise_floor_db = 0.0f;
+	probability = 0.0f;
+	has_noise_floor = false;
+}
+
+void AdaptiveVadEngine::get_state(State &r_state) const {
+	detector.get_state(r_state.detector);
+	r_state.noise_floor_db = noise_floor_db;
+	r_state.probability = probability;
+	r_state.has_noise_floor = has_noise_floor;
+}
+
+bool AdaptiveVadEngine::set_state(const State &p_state) {
+	if (!detector.set_state(p_state.detector)) {
+		return false;
+	}
+	noise_floor_db = p_state.noise_floor_db;
+	probability = CLAMP(p_state.probability, 0.0f, 1.0f);
+	has_noise_floor = p_state.has_noise_floor;
+	return true;
+}
+
+float AdaptiveVadEngine::_frame_probability(float p_energy) {
+	const float level_db = 20.0f * log10f(p_energy + 1e-7f);
+	if (!has_noise_floor || level_db < noise_floor_db) {
+		noise_floor_db = level_db;
+		has_noise_floor = true;
+	} else {
+		noise_floor_db += noise_rise_db_per_frame;
+	}
+	float target = 0.0f;
+	if (p_energy >= silence_level) {
+		target = 1.0f / (1.0f + expf(-(level_db - noise_floor_db - speech_snr_db) / snr_slope_db));
+	}
+	if (target > probability) {
+		probability += attack * (target - probability);
+	} else {
+		probability = MAX(target, probability * release);
+	}
+	return probability;
+}
+
+float AdaptiveVadEngine::process(const float *p_samples, size_t p_count, bool p_is_filtered, std::vector<float> &r_probabilities) {
+	// A chunk shorter than a frame keeps the last decision.
+	float chunk_probability = probability;
+	bool has_frames = false;
+	_push_frames(detector, p_samples, p_count, p_is_filtered, [&](float p_energy) {
+		const float frame_probability = _frame_probability(p_energy);
+		r_probabilities.push_back(frame_probability);
+		chunk_probability = has_frames ? MAX(chunk_probability, frame_probability) : frame_probability;
+		has_frames = true;
+	});
+	return chunk_probability;
+}
@@ -0,0 +1,114 @@
+#ifndef VAD_ENGINE_H
+#define VAD_ENGINE_H
+
+#include "voice_activity_detector.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * Decides which incoming audio is worth sending to whisper. An engine gets
+ * the 16 kHz mono chunks in order and reports one speech probability per
+ * 10 ms frame, plus one for the whole chunk that gates whether it is queued.
+ */
+class VadEngine {
+public:
+	enum Mode {
+		MODE_ENERGY, // mean amplitude against a fixed silence level
+		MODE_ADAPTIVE, // level above a tracked noise floor, smoothed over frames
+	};
+
+	/** The history of an engine, the adaptive values stay at their defaults for the energy one. */
+	struct State {
+		VoiceActivityDetector::State detector;
+		float noise_floor_db = 0.0f;
+		float probability = 0.0f;
+		bool has_noise_floor = false;
+	};
+
+	/**
+	 * Appends one probability per completed frame to r_probabilities, returns the chunk probability.
+	 * p_is_filtered when the high-pass of get_detector() already ran on p_samples, see audio_high_pass_batch.
+	 */
+	virtual float process(const float *p_samples, size_t p_count, bool p_is_filtered, std::vector<float> &r_probabilities) = 0;
+	/** Cutoff of the high-pass filter applied before measuring, 0 disables it. */
+	virtual void set_high_pass(float p_cutoff) = 0;
+	/** The detector that filters and measures the frames. */
+	virtual VoiceActivityDetector &get_detector() = 0;
+	/** Drop all history, e.g. when a new recording starts. */
+	virtual void reset() = 0;
+	virtual void get_state(State &r_state) const = 0;
+	/** False and unchanged when p_state does not fit the detector. */
+	virtual bool set_state(const State &p_state) = 0;
+
+	static std::unique_ptr<VadEngine> create(Mode p_mode, int p_sample_rate);
+
+	virtual ~VadEngine() {}
+
+protected:
+	/* Frame history of the detectors, chunks are pushed in slices no longer than this. */
+	static const int HISTORY_MS = 1000;
+
+	/**
+	 * Push p_samples through p_detector and call p_on_frame with the energy of
+	 * every completed frame, in order. Returns the mean absolute amplitude of
+	 * the whole chunk after filtering.
+	 */
+	template <typename F>
+	static float _push_frames(VoiceActivityDetector &p_detector, const float *p_samples, size_t p_count, bool p_is_filtered, F p_on_frame) {
+		const size_t slice = size_t(p_detector.get_sample_rate()) * HISTORY_MS / 1000;
+		float sum = 0.0f;
+		for (size_t done = 0; done < p_count; done += slice) {
+			const size_t count = p_count - done < slice ? p_count - done : slice;
+			const uint64_t frames_before = p_detector.get_frame_count();
+			sum += (p_is_filtered ? p_detector.push_filtered(p_samples + done, count) : p_detector.push(p_samples + done, count)) * count;
+			for (int i = int(p_detector.get_frame_count() - frames_before) - 1; i >= 0; i--) {
+				p_on_frame(p_detector.get_frame_energy(i));
+			}
+		}
+		return p_count > 0 ? sum / p_count : 0.0f;
+	}
+};
+
+/** The energy check of vad_simple, 1 when a frame is above the silence level and 0 otherwise. */
+class EnergyVadEngine : public VadEngine {
+	VoiceActivityDetector detector;
+
+public:
+	float process(const float *p_samples, size_t p_count, bool p_is_filtered, std::vector<float> &r_probabilities) override;
+	void set_high_pass(float p_cutoff) override { detector.set_high_pass(p_cutoff); }
+	VoiceActivityDetector &get_detector() override { return detector; }
+	void reset() override { detector.reset(); }
+	void get_state(State &r_state) const override { detector.get_state(r_state.detector); }
+	bool set_state(const State &p_state) override { return detector.set_state(p_state.detector); }
+
+	EnergyVadEngine(int p_sample_rate);
+};
+
+/**
+ * Compares each frame to a noise floor that follows the quietest recent
+ * frames, so steady fan or room noise reads as silence however loud it is.
+ * The probability rises over a few frames and decays slowly, which keeps
+ * single clicks out and does not cut the tails of words.
+ */
+class AdaptiveVadEngine : public VadEngine {
+	VoiceActivityDetector detector;
+	float noise_floor_db = 0.0f;
+	float probability = 0.0f;
+	bool has_noise_floor = false;
+
+	float _frame_probability(float p_energy);
+
+public:
+	float process(const float *p_samples, size_t p_count, bool p_is_filtered, std::vector<float> &r_probabilities) override;
+	void set_high_pass(float p_cutoff) override { detector.set_high_pass(p_cutoff); }
+	VoiceActivityDetector &get_detector() override { return detector; }
+	void reset() override;
+	void get_state(State &r_state) const override;
+	bool set_state(const State &p_state) override;
+
+	AdaptiveVadEngine(int p_sample_rate);
+};
+
+#endif // VAD_ENGINE_H
@@ -0,0 +1,216 @@
+#include "voice_activity_detector.h"
+
+#include <godot_cpp/core/math.hpp>
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VAD_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define VAD_NEON
+#endif
+
+using namespace godot;
+
+/* Filtered samples are produced in blocks of this size on the stack. */
+static const size_t filter_block_samples = 256;
+
+float VoiceActivityDetector::abs_sum(const float *p_samples, size_t p_count) {
+	size_t i = 0;
+	float sum = 0.0f;
+#if defined(VAD_SSE2)
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	for (; i + 8 <= p_count; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_and_ps(_mm_loadu_ps(p_samples + i), abs_mask));
+		acc1 = _mm_add_ps(acc1, _mm_and_ps(_mm_loadu_ps(p_samples + i + 4), abs_mask));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(VAD_NEON)
+	float32x4_t acc0 = vdupq_n_f32(0.0f);
+	float32x4_t acc1 = vdupq_n_f32(0.0f);
+	for (; i + 8 <= p_count; i += 8) {
+		acc0 = vaddq_f32(acc0, vabsq_f32(vld1q_f32(p_samples + i)));
+		acc1 = vaddq_f32(acc1, vabsq_f32(vld1q_f32(p_samples + i + 4)));
+	}
+	const float32x4_t acc = vaddq_f32(acc0, acc1);
+	sum = (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#endif
+	for (; i < p_count; i++) {
+		sum += fabsf(p_samples[i]);
+	}
+	return sum;
+}
+
+VoiceActivityDetector::VoiceActivityDetector() {
+	setup(sample_rate, 1000);
+}
+
+void VoiceActivityDetector::setup(int p_sample_rate, int p_window_ms) {
+	sample_rate = MAX(1, p_sample_rate);
+	frame_samples = MAX(1, sample_rate * FRAME_MS / 1000);
+	frame_energy.assign(MAX(1, p_window_ms / FRAME_MS), 0.0f);
+	set_high_pass(cutoff);
+	reset();
+}
+
+void VoiceActivityDetector::set_high_pass(float p_cutoff) {
+	if (p_cutoff <= 0.0f) {
+		cutoff = 0.0f;
+		alpha = 1.0f;
+		return;
+	}
+	if (p_cutoff == cutoff) {
+		return;
+	}
+	cutoff = p_cutoff;
+	const float rc = 1.0f / (2.0f * Math_PI * cutoff);
+	const float dt = 1.0f / sample_rate;
+	alpha = dt / (rc + dt);
+	// The history of the previous cutoff would add a step to the output.
+	has_prev = false;
+}
+
+void VoiceActivityDetector::reset() {
+	frame_count = 0;
+	frame_acc = 0.0f;
+	frame_fill = 0;
+	has_prev = false;
+}
+
+void VoiceActivityDetector::get_state(State &r_state) const {
+	r_state.frame_energy = frame_energy;
+	r_state.frame_count = frame_count;
+	r_state.frame_acc = frame_acc;
+	r_state.frame_fill = frame_fill;
+	r_state.cutoff = cutoff;
+	r_state.prev_out = prev_out;
+	r_state.has_prev = has_prev;
+}
+
+bool VoiceActivityDetector::set_state(const State &p_state) {
+	if (p_state.frame_energy.size() != frame_energy.size() || p_state.frame_fill < 0 || p_state.frame_fill >= frame_samples) {
+		return false;
+	}
+	// Before the filter state, a new cutoff would drop it.
+	set_high_pass(p_state.cutoff);
+	frame_energy = p_state.frame_energy;
+	frame_count = p_state.frame_count;
+	frame_acc = p_state.frame_acc;
+	frame_fill = p_state.frame_fill;
+	prev_out = p_state.prev_out;
+	has_prev = p_state.has_prev && cutoff > 0.0f;
+	return true;
+}
+
+void VoiceActivityDetector::_filter_block(const float *p_src, size_t p_count, float *p_dst) {
+	size_t i = 0;
+	if (!has_prev) {
+		// Like the batch filter, the first sample passes unchanged.
+		prev_out = p_src[0];
+		p_dst[0] = p_src[0];
+		has_prev = true;
+		i = 1;
+	}
+	// Same recurrence as the in-place filter of the whisper.cpp examples, where
+	// the previous input has already been overwritten by its output when it is
+	// read. vad_thold and the silence level are tuned against that response.
+	float y = prev_out;
+	for (; i < p_count; i++) {
+		y = alpha * (y + p_src[i] - y);
+		p_dst[i] = y;
+	}
+	prev_out = y;
+}
+
+/* Absolute sums of filtered samples into the frames, returns their total. */
+float VoiceActivityDetector::_add_frames(const float *p_samples, size_t p_count) {
+	float total = 0.0f;
+	for (size_t i = 0; i < p_count;) {
+		// Split at frame edges so every frame gets its own sum.
+		const size_t take = MIN(p_count - i, size_t(frame_samples - frame_fill));
+		const float sum = abs_sum(p_samples + i, take);
+		frame_acc += sum;
+		total += sum;
+		frame_fill += take;
+		i += take;
+		if (frame_fill == frame_samples) {
+			frame_energy[frame_count % frame_energy.size()] = frame_acc;
+			frame_count++;
+			frame_acc = 0.0f;
+			frame_fill = 0;
+		}
+	}
+	return total;
+}
+
+float VoiceActivityDetector::push(const float *p_samples, size_t p_count) {
+	if (p_count == 0) {
+		return 0.0f;
+	}
+	float filtered[filter_block_samples];
+	float total = 0.0f;
+	for (size_t done = 0; done < p_count;) {
+		const size_t count = MIN(filter_block_samples, p_count - done);
+		const float *samples = p_samples + done;
+		if (cutoff > 0.0f) {
+			_filter_block(samples, count, filtered);
+			samples = filtered;
+		}
+		total += _add_frames(samples, count);
+		done += count;
+	}
+	return total / p_count;
+}
+
+float VoiceActivityDetector::push_filtered(const float *p_filtered, size_t p_count) {
+	if (p_count == 0) {
+		return 0.0f;
+	}
+	// The next push() goes on from the last output, as if it had filtered these.
+	prev_out = p_filtered[p_count - 1];
+	has_prev = true;
+	// Same blocks as push(), so the sums are rounded alike.
+	float total = 0.0f;
+	for (size_t done = 0; done < p_count; done += filter_block_samples) {
+		total += _add_frames(p_filtered + done, MIN(filter_block_samples, p_count - done));
+	}
+	return total / p_count;
+}
+
+float VoiceActivityDetector::_frames_sum(int p_frames) const {
+	float sum = 0.0f;
+	for (int i = 1; i <= p_frames; i++) {
+		sum += frame_energy[(frame_count - i) % frame_energy.size()];
+	}
+	return sum;
+}
+
+float VoiceActivityDetector::get_frame_energy(int p_frames_ago) const {
+	if (uint64_t(p_frames_ago) >= MIN(frame_count, uint64_t(frame_energy.size()))) {
+		return 0.0f;
+	}
+	return frame_energy[(frame_count - 1 - p_frames_ago) % frame_energy.size()] / frame_samples;
+}
+
+float VoiceActivityDetector::get_energy(int p_ms) const {
+	const int frames = MIN(uint64_t(p_ms / FRAME_MS), MIN(frame_count, uint64_t(frame_energy.size())));
+	if (frames <= 0) {
+		return 0.0f;
+	}
+	return _frames_sum(frames) / (float(frames) * frame_samples);
+}
+
+bool VoiceActivityDetector::is_speech_ending(int p_window_ms, int p_last_ms, float p_vad_thold) const {
+	const float energy_all = get_energy(p_window_ms);
+	const float energy_last = p_last_ms > 0 ? get_energy(p_last_ms) : 0.0f;
+	if ((energy_all < 0.0001f && energy_last < 0.0001f) == false || energy_last > p_vad_thold * energy_all) {
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,93 @@
+#ifndef VOICE_ACTIVITY_DETECTOR_H
+#define VOICE_ACTIVITY_DETECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Streaming version of the energy VAD from the whisper.cpp stream example.
+ * The high-pass filter state carries over between pushes and the mean
+ * absolute amplitude is kept per 10 ms frame, so asking whether speech ended
+ * costs a walk over a few hundred frame sums instead of filtering a copy of
+ * the whole window on every pass.
+ */
+class VoiceActivityDetector {
+public:
+	static const int FRAME_MS = 10;
+
+	/** What the detector carries between pushes, to resume a stream on another node. */
+	struct State {
+		std::vector<float> frame_energy;
+		uint64_t frame_count = 0;
+		float frame_acc = 0.0f;
+		int frame_fill = 0;
+		float cutoff = 0.0f;
+		float prev_out = 0.0f;
+		bool has_prev = false;
+	};
+
+private:
+	int sample_rate = 16000;
+	int frame_samples = 160;
+	std::vector<float> frame_energy; // ring of per-frame absolute sums
+	uint64_t frame_count = 0; // frames completed so far, the slot is frame_count % size
+	float frame_acc = 0.0f; // absolute sum of the frame being filled
+	int frame_fill = 0;
+
+	/* First-order high-pass, 0 cutoff disables it. */
+	float cutoff = 0.0f;
+	float alpha = 1.0f;
+	float prev_out = 0.0f;
+	bool has_prev = false;
+
+	void _filter_block(const float *p_src, size_t p_count, float *p_dst);
+	float _add_frames(const float *p_samples, size_t p_count);
+	float _frames_sum(int p_frames) const;
+
+public:
+	/** Keeps p_window_ms of frame energies. Drops the history. */
+	void setup(int p_sample_rate, int p_window_ms);
+	/** Cutoff of the high-pass filter in Hz, 0 disables it. */
+	void set_high_pass(float p_cutoff);
+
+	/** Drop the filter state and the frame history, e.g. when a new recording starts. */
+	void reset();
+
+	void get_state(State &r_state) const;
+	/** False and unchanged when p_state comes from a detector set up with another window. */
+	bool set_state(const State &p_state);
+
+	/** Feed new samples, returns the mean absolute amplitude of them after filtering. */
+	float push(const float *p_samples, size_t p_count);
+
+	/* The filter run ahead by audio_high_pass_batch for several streams, then the samples are pushed filtered. */
+	/** Whether the filter is on and past its first sample, which passes unchanged. */
+	bool can_filter_ahead() const { return cutoff > 0.0f && has_prev; }
+	float get_high_pass_alpha() const { return alpha; }
+	float get_high_pass_output() const { return prev_out; }
+	/** push() of samples the high-pass already ran on, from get_high_pass_output() on. */
+	float push_filtered(const float *p_filtered, size_t p_count);
+
+	int get_sample_rate() const { return sample_rate; }
+	/** Frames completed since the last reset. */
+	uint64_t get_frame_count() const { return frame_count; }
+	/** Mean absolute amplitude of a completed frame, 0 is the most recent one. */
+	float get_frame_energy(int p_frames_ago) const;
+
+	/** Mean absolute amplitude of the last p_ms of completed frames, 0 with nothing pushed. */
+	float get_energy(int p_ms) const;
+
+	/**
+	 * Same decision as vad_simple of the stream example does here: the whole window is close to silent and
+	 * its last p_last_ms is not louder than p_vad_thold times the window.
+	 */
+	bool is_speech_ending(int p_window_ms, int p_last_ms, float p_vad_thold) const;
+
+	/** Sum of absolute values, vectorised where the target allows it. */
+	static float abs_sum(const float *p_samples, size_t p_count);
+
+	VoiceActivityDetector();
+};
+
+#endif // VOICE_ACTIVITY_DETECTOR_H
@@ -0,0 +1,849 @@
+#include "webgpu_backend.h"
+
+#include "host_backend_tensors.h"
+
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/core/math.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <emscripten/em_js.h>
+#include <emscripten/emscripten.h>
+#include <emscripten/proxying.h>
+#include <emscripten/threading.h>
+#endif
+
+using namespace godot;
+
+std::mutex WebGPUCompute::instance_mutex;
+std::weak_ptr<WebGPUCompute> WebGPUCompute::instance;
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+
+/* Same thresholds as the RenderingDevice kernels, the copies cost about the same. */
+static const int64_t min_mul_mat_size = 32;
+static const int64_t min_row_op_elements = 1 << 16;
+/* maxComputeWorkgroupsPerDimension every adapter has, more rows go to y. */
+static const uint32_t max_groups_x = 65535;
+static const uint32_t min_scratch_size = 1 << 16;
+/* The adapter prompt or a busy GPU process may take a while, a build without WebGPU answers at once. */
+static const double init_timeout_ms = 30000.0;
+
+/* The kernels of rendering_device_backend.cpp in WGSL. WGSL has no preprocessor, the type of Src0 and load0() are put in front. */
+static const char *mul_mat_f32_prefix = R"(
+alias Src0Type = f32;
+fn load0(i: u32) -> f32 {
+	return src0[i];
+}
+)";
+
+static const char *mul_mat_f16_prefix = R"(
+alias Src0Type = u32;
+fn load0(i: u32) -> f32 {
+	let pair = unpack2x16float(src0[i >> 1u]);
+	return select(pair.y, pair.x, (i & 1u) == 0u);
+}
+)";
+
+static const char *mul_mat_shader = R"(
+struct Params {
+	ne00: u32, ne01: u32, ne11: u32, ne12: u32,
+	r2: u32, r3: u32, nb01: u32, nb02: u32,
+	nb03: u32, nb11: u32, nb12: u32, nb13: u32,
+	off0: u32, off1: u32, pad0: u32, pad1: u32,
+}
+
+@group(0) @binding(0) var<storage, read> src0: array<Src0Type>;
+@group(0) @binding(1) var<storage, read> src1: array<f32>;
+@group(0) @binding(2) var<storage, read_write> dst: array<f32>;
+@group(0) @binding(3) var<uniform> p: Params;
+
+var<workgroup> tile0: array<array<f32, 17>, 16>;
+var<workgroup> tile1: array<array<f32, 17>, 16>;
+
+@compute @workgroup_size(16, 16, 1)
+fn main(@builtin(local_invocation_id) lid: vec3<u32>, @builtin(workgroup_id) wid: vec3<u32>) {
+	let lx = lid.x;
+	let ly = lid.y;
+	let row0 = wid.x * 16u;
+	let row1 = wid.y * 16u;
+	let i12 = wid.z % p.ne12;
+	let i13 = wid.z / p.ne12;
+	let base0 = p.off0 + (i12 / p.r2) * p.nb02 + (i13 / p.r3) * p.nb03;
+	let base1 = p.off1 + i12 * p.nb12 + i13 * p.nb13;
+	var sum = 0.0;
+	for (var k0 = 0u; k0 < p.ne00; k0 += 16u) {
+		let k = k0 + lx;
+		var a = 0.0;
+		if (row0 + ly < p.ne01 && k < p.ne00) {
+			a = load0(base0 + (row0 + ly) * p.nb01 + k);
+		}
+		var b = 0.0;
+		if (row1 + ly < p.ne11 && k < p.ne00) {
+			b = src1[base1 + (row1 + ly) * p.nb11 + k];
+		}
+		tile0[ly][lx] = a;
+		tile1[ly][lx] = b;
+		workgroupBarrier();
+		for (var kk = 0u; kk < 16u; kk++) {
+			sum += tile0[lx][kk] * tile1[ly][kk];
+		}
+		workgroupBarrier();
+	}
+	if (row0 + lx < p.ne01 && row1 + ly < p.ne11) {
+		dst[(wid.z * p.ne11 + row1 + ly) * p.ne01 + row0 + lx] = sum;
+	}
+}
+)";
+
+// WGSL may assume there are no infinities, the masked out -INFINITY is caught as anything below lowest.
+static const char *soft_max_shader = R"(
+struct Params {
+	nc: u32, nrows: u32, ne11: u32, has_mask: u32,
+	nb01: u32, nb11: u32, off0: u32, off1: u32,
+	groups_x: u32, scale: f32, pad0: u32, pad1: u32,
+}
+
+@group(0) @binding(0) var<storage, read> src0: array<f32>;
+@group(0) @binding(1) var<storage, read> mask: array<f32>;
+@group(0) @binding(2) var<storage, read_write> dst: array<f32>;
+@group(0) @binding(3) var<uniform> p: Params;
+
+const lowest = -3.0e38;
+
+var<workgroup> lanes: array<f32, 128>;
+
+@compute @workgroup_size(128, 1, 1)
+fn main(@builtin(local_invocation_id) lid3: vec3<u32>, @builtin(workgroup_id) wid: vec3<u32>) {
+	let row = wid.y * p.groups_x + wid.x;
+	if (row >= p.nrows) {
+		return;
+	}
+	let lid = lid3.x;
+	let src_row = p.off0 + row * p.nb01;
+	let mask_row = p.off1 + (row % p.ne11) * p.nb11;
+	let dst_row = row * p.nc;
+	var row_max = lowest;
+	for (var i = lid; i < p.nc; i += 128u) {
+		var v = src0[src_row + i] * p.scale;
+		if (p.has_mask != 0u) {
+			v += mask[mask_row + i];
+		}
+		dst[dst_row + i] = v;
+		row_max = max(row_max, v);
+	}
+	lanes[lid] = row_max;
+	workgroupBarrier();
+	for (var s = 64u; s > 0u; s >>= 1u) {
+		if (lid < s) {
+			lanes[lid] = max(lanes[lid], lanes[lid + s]);
+		}
+		workgroupBarrier();
+	}
+	row_max = lanes[0];
+	workgroupBarrier();
+	var sum = 0.0;
+	for (var i = lid; i < p.nc; i += 128u) {
+		let v = dst[dst_row + i];
+		let e = select(exp(v - row_max), 0.0, v <= lowest);
+		dst[dst_row + i] = e;
+		sum += e;
+	}
+	lanes[lid] = sum;
+	workgroupBarrier();
+	for (var s = 64u; s > 0u; s >>= 1u) {
+		if (lid < s) {
+			lanes[lid] += lanes[lid + s];
+		}
+		workgroupBarrier();
+	}
+	let inv_sum = select(0.0, 1.0 / lanes[0], lanes[0] > 0.0);
+	for (var i = lid; i < p.nc; i += 128u) {
+		dst[dst_row + i] *= inv_sum;
+	}
+}
+)";
+
+static const char *norm_shader = R"(
+struct Params {
+	ne00: u32, nrows: u32, off0: u32, groups_x: u32,
+	eps: f32, pad0: u32, pad1: u32, pad2: u32,
+}
+
+@group(0) @binding(0) var<storage, read> src0: array<f32>;
+@group(0) @binding(1) var<storage, read_write> dst: array<f32>;
+@group(0) @binding(2) var<uniform> p: Params;
+
+var<workgroup> lanes: array<f32, 128>;
+
+fn row_sum(lid: u32, value: f32) -> f32 {
+	lanes[lid] = value;
+	workgroupBarrier();
+	for (var s = 64u; s > 0u; s >>= 1u) {
+		if (lid < s) {
+			lanes[lid] += lanes[lid + s];
+		}
+		workgroupBarrier();
+	}
+	let sum = lanes[0];
+	workgroupBarrier();
+	return sum;
+}
+
+@compute @workgroup_size(128, 1, 1)
+fn main(@builtin(local_invocation_id) lid3: vec3<u32>, @builtin(workgroup_id) wid: vec3<u32>) {
+	let row = wid.y * p.groups_x + wid.x;
+	if (row >= p.nrows) {
+		return;
+	}
+	let lid = lid3.x;
+	let src_row = p.off0 + row * p.ne00;
+	let dst_row = row * p.ne00;
+	var sum = 0.0;
+	for (var i = lid; i < p.ne00; i += 128u) {
+		sum += src0[src_row + i];
+	}
+	let mean = row_sum(lid, sum) / f32(p.ne00);
+	var sum2 = 0.0;
+	for (var i = lid; i < p.ne00; i += 128u) {
+		let v = src0[src_row + i] - mean;
+		sum2 += v * v;
+	}
+	let scale = inverseSqrt(row_sum(lid, sum2) / f32(p.ne00) + p.eps);
+	for (var i = lid; i < p.ne00; i += 128u) {
+		dst[dst_row + i] = (src0[src_row + i] - mean) * scale;
+	}
+}
+)";
+
+struct MulMatParams {
+	uint32_t ne00, ne01, ne11, ne12;
+	uint32_t r2, r3, nb01, nb02;
+	uint32_t nb03, nb11, nb12, nb13;
+	uint32_t off0, off1, pad0, pad1;
+};
+
+struct SoftMaxParams {
+	uint32_t nc, nrows, ne11, has_mask;
+	uint32_t nb01, nb11, off0, off1;
+	uint32_t groups_x;
+	float scale;
+	uint32_t pad0, pad1;
+};
+
+struct NormParams {
+	uint32_t ne00, nrows, off0, groups_x;
+	float eps;
+	uint32_t pad0, pad1, pad2;
+};
+
+/*
+ * The JavaScript side, run on the device thread. EM_JS rather than emscripten's webgpu.h, whose library would have
+ * to be linked into Godot's main module. The device, the pipelines and the buffers by id live in
+ * globalThis.godotWhisperWebGPU of that worker. Completion is stored in the job's done flag and notified with
+ * Atomics, which the waiting pass sleeps on with emscripten_futex_wait().
+ */
+
+EM_JS(void, _webgpu_init, (const char *const *p_shaders, int p_count, uint32_t *r_max_binding_size, int32_t *p_done), {
+	const finish = (value) => {
+		Atomics.store(HEAP32, p_done >> 2, value);
+		Atomics.notify(HEAP32, p_done >> 2);
+	};
+	if (typeof navigator === "undefined" || !navigator.gpu) {
+		finish(2);
+		return;
+	}
+	const codes = [];
+	for (let i = 0; i < p_count; i++) {
+		codes.push(UTF8ToString(HEAPU32[(p_shaders >> 2) + i]));
+	}
+	(async () => {
+		const adapter = await navigator.gpu.requestAdapter({ powerPreference: "high-performance" });
+		if (!adapter) {
+			finish(2);
+			return;
+		}
+		const limits = {
+			maxStorageBufferBindingSize: adapter.limits.maxStorageBufferBindingSize,
+			maxBufferSize: adapter.limits.maxBufferSize,
+		};
+		const device = await adapter.requestDevice({ requiredLimits: limits });
+		const pipelines = [];
+		for (const code of codes) {
+			const module = device.createShaderModule({ code: code });
+			pipelines.push(await device.createComputePipelineAsync({ layout: "auto", compute: { module: module, entryPoint: "main" } }));
+		}
+		const uniforms = device.createBuffer({ size: 64, usage: GPUBufferUsage.UNIFORM | GPUBufferUsage.COPY_DST });
+		globalThis.godotWhisperWebGPU = { device: device, pipelines: pipelines, uniforms: uniforms, staging: null, buffers: [null], free: [] };
+		device.lost.then((info) => console.error("WebGPU device lost: " + info.message));
+		HEAPU32[r_max_binding_size >> 2] = Math.min(limits.maxStorageBufferBindingSize, limits.maxBufferSize, 0xfffffffc);
+		finish(1);
+	})().catch((error) => {
+		console.error("WebGPU initialization failed: " + error);
+		finish(2);
+	});
+});
+
+EM_JS(int32_t, _webgpu_buffer_create, (uint32_t p_size), {
+	const gpu = globalThis.godotWhisperWebGPU;
+	const buffer = gpu.device.createBuffer({ size: p_size, usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_DST | GPUBufferUsage.COPY_SRC });
+	const id = gpu.free.length > 0 ? gpu.free.pop() : gpu.buffers.length;
+	gpu.buffers[id] = buffer;
+	return id;
+});
+
+EM_JS(void, _webgpu_buffer_write, (int32_t p_buffer, const void *p_data, uint32_t p_size), {
+	const gpu = globalThis.godotWhisperWebGPU;
+	gpu.device.queue.writeBuffer(gpu.buffers[p_buffer], 0, HEAPU8, p_data, p_size);
+});
+
+EM_JS(void, _webgpu_buffer_free, (int32_t p_buffer), {
+	const gpu = globalThis.godotWhisperWebGPU;
+	gpu.buffers[p_buffer].destroy();
+	gpu.buffers[p_buffer] = null;
+	gpu.free.push(p_buffer);
+});
+
+/* The last of p_buffers is the destination, p_size bytes of it are copied to p_dst once the kernel is done. */
+EM_JS(void, _webgpu_dispatch, (int p_kernel, const int32_t *p_buffers, int p_count, const void *p_params, uint32_t p_params_size, uint32_t p_x, uint32_t p_y, uint32_t p_z, void *p_dst, uint32_t p_size, int32_t *p_done), {
+	const finish = (value) => {
+		Atomics.store(HEAP32, p_done >> 2, value);
+		Atomics.notify(HEAP32, p_done >> 2);
+	};
+	const gpu = globalThis.godotWhisperWebGPU;
+	const device = gpu.device;
+	const pipeline = gpu.pipelines[p_kernel];
+	device.queue.writeBuffer(gpu.uniforms, 0, HEAPU8, p_params, p_params_size);
+	const entries = [];
+	for (let i = 0; i < p_count; i++) {
+		entries.push({ binding: i, resource: { buffer: gpu.buffers[HEAP32[(p_buffers >> 2) + i]] } });
+	}
+	entries.push({ binding: p_count, resource: { buffer: gpu.uniforms } });
+	const bind_group = device.createBindGroup({ layout: pipeline.getBindGroupLayout(0), entries: entries });
+	const size = (p_size + 3) & ~3;
+	if (gpu.staging === null || gpu.staging.size < size) {
+		if (gpu.staging !== null) {
+			gpu.staging.destroy();
+		}
+		gpu.staging = device.createBuffer({ size: size, usage: GPUBufferUsage.MAP_READ | GPUBufferUsage.COPY_DST });
+	}
+	const staging = gpu.staging;
+	const encoder = device.createCommandEncoder();
+	const pass = encoder.beginComputePass();
+	pass.setPipeline(pipeline);
+	pass.setBindGroup(0, bind_group);
+	pass.dispatchWorkgroups(p_x, p_y, p_z);
+	pass.end();
+	encoder.copyBufferToBuffer(gpu.buffers[HEAP32[(p_buffers >> 2) + p_count - 1]], 0, staging, 0, size);
+	device.queue.submit([encoder.finish()]);
+	staging.mapAsync(GPUMapMode.READ, 0, size).then(() => {
+		HEAPU8.set(new Uint8Array(staging.getMappedRange(0, size), 0, p_size), p_dst);
+		staging.unmap();
+		finish(1);
+	}, (error) => {
+		console.error("WebGPU kernel failed: " + error);
+		finish(2);
+	});
+});
+
+EM_JS(void, _webgpu_shutdown, (), {
+	const gpu = globalThis.godotWhisperWebGPU;
+	if (gpu) {
+		gpu.device.destroy();
+		delete globalThis.godotWhisperWebGPU;
+	}
+});
+
+static void _finish(std::atomic<int32_t> *p_done, int32_t p_value) {
+	p_done->store(p_value);
+	emscripten_futex_wake(p_done, INT32_MAX);
+}
+
+/* Waits for the device thread to store the outcome in p_done, true if it succeeded. */
+static bool _wait(std::atomic<int32_t> &p_done, double p_timeout_ms) {
+	const double deadline = emscripten_get_now() + p_timeout_ms;
+	int32_t value = p_done.load();
+	while (value == 0) {
+		const double remaining = deadline - emscripten_get_now();
+		if (remaining <= 0.0) {
+			return false;
+		}
+		emscripten_futex_wait(&p_done, 0, remaining);
+		value = p_done.load();
+	}
+	return value == 1;
+}
+
+static void *_device_thread_main(void *p_arg) {
+	// Back to the event loop of the worker, which runs the proxied jobs and resolves their promises.
+	emscripten_exit_with_live_runtime();
+	return nullptr;
+}
+
+/* The init job, on the device thread. */
+struct InitJob {
+	const char *shaders[WebGPUCompute::KERNEL_MAX];
+	std::string sources[WebGPUCompute::KERNEL_MAX];
+	uint32_t max_binding_size = 0;
+	std::atomic<int32_t> done{ 0 };
+};
+
+static void _init_job(void *p_job) {
+	InitJob *job = (InitJob *)p_job;
+	_webgpu_init(job->shaders, WebGPUCompute::KERNEL_MAX, &job->max_binding_size, (int32_t *)&job->done);
+}
+
+bool WebGPUCompute::_init() {
+	if (pthread_create(&device_thread, nullptr, _device_thread_main, nullptr) != 0) {
+		return false;
+	}
+	has_device_thread = true;
+	// Shared by the acquire() that waits and the job, which may still run after a timeout.
+	std::shared_ptr<InitJob> job = std::make_shared<InitJob>();
+	job->sources[KERNEL_MUL_MAT_F32] = std::string(mul_mat_f32_prefix) + mul_mat_shader;
+	job->sources[KERNEL_MUL_MAT_F16] = std::string(mul_mat_f16_prefix) + mul_mat_shader;
+	job->sources[KERNEL_SOFT_MAX] = soft_max_shader;
+	job->sources[KERNEL_NORM] = norm_shader;
+	for (int i = 0; i < KERNEL_MAX; i++) {
+		job->shaders[i] = job->sources[i].c_str();
+	}
+	std::shared_ptr<InitJob> *kept = new std::shared_ptr<InitJob>(job);
+	if (!emscripten_proxy_async(emscripten_proxy_get_system_queue(), device_thread, [](void *p_kept) {
+			_init_job(((std::shared_ptr<InitJob> *)p_kept)->get());
+		}, kept)) {
+		delete kept;
+		return false;
+	}
+	const bool done = _wait(job->done, init_timeout_ms);
+	if (job->done.load() != 0) {
+		delete kept;
+	}
+	// Otherwise the job may still run, and the copy keeps the InitJob alive for it. Leaked once per process at most.
+	if (!done) {
+		return false;
+	}
+	max_binding_size = job->max_binding_size;
+	return max_binding_size > 0;
+}
+
+bool WebGPUCompute::_run(Job &p_job, void (*p_function)(void *)) {
+	p_job.compute = this;
+	if (!emscripten_proxy_async(emscripten_proxy_get_system_queue(), device_thread, p_function, &p_job)) {
+		return false;
+	}
+	return _wait(p_job.done, INFINITY);
+}
+
+bool WebGPUCompute::supports_op(const ggml_tensor *p_node) const {
+	if (p_node->type != GGML_TYPE_F32 || !ggml_is_contiguous(p_node) || ggml_nbytes(p_node) > max_binding_size) {
+		return false;
+	}
+	const ggml_tensor *src0 = p_node->src[0];
+	const ggml_tensor *src1 = p_node->src[1];
+	if (host_backend_tensor_span(src0) + 4 > max_binding_size || (src1 != nullptr && host_backend_tensor_span(src1) + 4 > max_binding_size)) {
+		// Larger than a binding, even when copied for the kernel.
+		return false;
+	}
+	switch (p_node->op) {
+		case GGML_OP_MUL_MAT:
+			return (src0->type == GGML_TYPE_F32 || src0->type == GGML_TYPE_F16) && src1->type == GGML_TYPE_F32 &&
+					host_backend_has_element_strides(src0) && host_backend_has_element_strides(src1) &&
+					src0->ne[0] >= min_mul_mat_size && src0->ne[1] >= min_mul_mat_size && src1->ne[1] >= min_mul_mat_size &&
+					src1->ne[2] % src0->ne[2] == 0 && src1->ne[3] % src0->ne[3] == 0 && src1->ne[2] * src1->ne[3] <= max_groups_x;
+		case GGML_OP_SOFT_MAX:
+			return src0->type == GGML_TYPE_F32 && ggml_is_contiguous(src0) && ggml_nelements(src0) >= min_row_op_elements &&
+					(src1 == nullptr || (src1->type == GGML_TYPE_F32 && src1->ne[0] == src0->ne[0] && host_backend_has_element_strides(src1)));
+		case GGML_OP_NORM:
+			return src0->type == GGML_TYPE_F32 && ggml_is_contiguous(src0) && ggml_nelements(src0) >= min_row_op_elements;
+		default:
+			return false;
+	}
+}
+
+void WebGPUCompute::_invalidate(uintptr_t p_begin, uintptr_t p_end) {
+	auto it = uploads.upper_bound(p_begin);
+	if (it != uploads.begin()) {
+		--it;
+	}
+	while (it != uploads.end() && it->first < p_end) {
+		if (it->first + it->second.size <= p_begin) {
+			++it;
+			continue;
+		}
+		if (it->second.buffer != 0) {
+			// The host threads cannot reach the device, the next job destroys it.
+			stale_buffers.push_back(it->second.buffer);
+		}
+		it = uploads.erase(it);
+	}
+}
+
+void WebGPUCompute::track_upload(const void *p_data, size_t p_size) {
+	const uintptr_t begin = uintptr_t(p_data);
+	std::lock_guard<std::mutex> lock(mutex);
+	_invalidate(begin, begin + p_size);
+	uploads[begin].size = p_size;
+}
+
+void WebGPUCompute::invalidate(const void *p_data, size_t p_size) {
+	std::lock_guard<std::mutex> lock(mutex);
+	_invalidate(uintptr_t(p_data), uintptr_t(p_data) + p_size);
+}
+
+int32_t WebGPUCompute::_get_scratch(ScratchSlot p_slot, size_t p_size) {
+	Scratch &slot = scratch[p_slot];
+	if (slot.size < p_size) {
+		if (slot.buffer != 0) {
+			_webgpu_buffer_free(slot.buffer);
+		}
+		slot.size = MIN(max_binding_size, MAX(min_scratch_size, uint32_t(next_power_of_2(uint32_t(p_size)))));
+		slot.buffer = _webgpu_buffer_create(slot.size);
+	}
+	return slot.buffer;
+}
+
+int32_t WebGPUCompute::_bind_source(const ggml_tensor *p_tensor, ScratchSlot p_slot, uint32_t &r_offset) {
+	const size_t type_size = ggml_type_size(p_tensor->type);
+	const uintptr_t begin = uintptr_t(p_tensor->data);
+	const uintptr_t end = begin + host_backend_tensor_span(p_tensor);
+	auto it = uploads.upper_bound(begin);
+	if (it != uploads.begin() && (--it)->first <= begin && end <= it->first + it->second.size && it->second.size + 3 <= max_binding_size) {
+		Upload &upload = it->second;
+		if (upload.buffer == 0) {
+			const uint32_t size = uint32_t((upload.size + 3) & ~size_t(3));
+			upload.buffer = _webgpu_buffer_create(size);
+			// Rounded up to whole words, the bytes past the range are never read by the kernels.
+			_webgpu_buffer_write(upload.buffer, reinterpret_cast<const void *>(it->first), size);
+		}
+		r_offset = uint32_t((begin - it->first) / type_size);
+		return upload.buffer;
+	}
+	// Written by the graph, e.g. the activations or the KV cache, copied for this kernel only.
+	const uintptr_t aligned = begin & ~uintptr_t(3);
+	const uint32_t size = uint32_t((end - aligned + 3) & ~size_t(3));
+	const int32_t buffer = _get_scratch(p_slot, size);
+	_webgpu_buffer_write(buffer, reinterpret_cast<const void *>(aligned), size);
+	r_offset = uint32_t((begin - aligned) / type_size);
+	return buffer;
+}
+
+void WebGPUCompute::_dispatch(Kernel p_kernel, const int32_t *p_buffers, int p_count, const void *p_params, uint32_t p_params_size, uint32_t p_x, uint32_t p_y, uint32_t p_z, ggml_tensor *p_dst, std::atomic<int32_t> *p_done) {
+	_webgpu_dispatch(p_kernel, p_buffers, p_count, p_params, p_params_size, p_x, p_y, p_z, p_dst->data, uint32_t(ggml_nbytes(p_dst)), (int32_t *)p_done);
+}
+
+void WebGPUCompute::_mul_mat(ggml_tensor *p_node, std::atomic<int32_t> *p_done) {
+	const ggml_tensor *src0 = p_node->src[0];
+	const ggml_tensor *src1 = p_node->src[1];
+	const size_t size0 = ggml_type_size(src0->type);
+	const size_t size1 = ggml_type_size(src1->type);
+	MulMatParams params = {};
+	params.ne00 = uint32_t(src0->ne[0]);
+	params.ne01 = uint32_t(src0->ne[1]);
+	params.ne11 = uint32_t(src1->ne[1]);
+	params.ne12 = uint32_t(src1->ne[2]);
+	params.r2 = uint32_t(src1->ne[2] / src0->ne[2]);
+	params.r3 = uint32_t(src1->ne[3] / src0->ne[3]);
+	params.nb01 = uint32_t(src0->nb[1] / size0);
+	params.nb02 = uint32_t(src0->nb[2] / size0);
+	params.nb03 = uint32_t(src0->nb[3] / size0);
+	params.nb11 = uint32_t(src1->nb[1] / size1);
+	params.nb12 = uint32_t(src1->nb[2] / size1);
+	params.nb13 = uint32_t(src1->nb[3] / size1);
+	int32_t buffers[3];
+	buffers[0] = _bind_source(src0, SCRATCH_SRC0, params.off0);
+	buffers[1] = _bind_source(src1, SCRATCH_SRC1, params.off1);
+	buffers[2] = _get_scratch(SCRATCH_DST, ggml_nbytes(p_node));
+	const Kernel kernel = src0->type == GGML_TYPE_F16 ? KERNEL_MUL_MAT_F16 : KERNEL_MUL_MAT_F32;
+	_dispatch(kernel, buffers, 3, &params, sizeof(params), (params.ne01 + 15) / 16, (params.ne11 + 15) / 16, uint32_t(src1->ne[2] * src1->ne[3]), p_node, p_done);
+}
+
+void WebGPUCompute::_soft_max(ggml_tensor *p_node, std::atomic<int32_t> *p_done) {
+	const ggml_tensor *src0 = p_node->src[0];
+	const ggml_tensor *src1 = p_node->src[1];
+	SoftMaxParams params = {};
+	params.nc = uint32_t(src0->ne[0]);
+	params.nrows = uint32_t(ggml_nrows(src0));
+	params.nb01 = uint32_t(src0->nb[1] / sizeof(float));
+	params.groups_x = MIN(params.nrows, max_groups_x);
+	memcpy(&params.scale, p_node->op_params, sizeof(float));
+	int32_t buffers[3];
+	buffers[0] = _bind_source(src0, SCRATCH_SRC0, params.off0);
+	if (src1 != nullptr) {
+		params.has_mask = 1;
+		params.ne11 = uint32_t(src1->ne[1]);
+		params.nb11 = uint32_t(src1->nb[1] / sizeof(float));
+		buffers[1] = _bind_source(src1, SCRATCH_SRC1, params.off1);
+	} else {
+		params.ne11 = 1;
+		buffers[1] = buffers[0];
+	}
+	buffers[2] = _get_scratch(SCRATCH_DST, ggml_nbytes(p_node));
+	_dispatch(KERNEL_SOFT_MAX, buffers, 3, &params, sizeof(params), params.groups_x, (params.nrows + params.groups_x - 1) / params.groups_x, 1, p_node, p_done);
+}
+
+void WebGPUCompute::_norm(ggml_tensor *p_node, std::atomic<int32_t> *p_done) {
+	const ggml_tensor *src0 = p_node->src[0];
+	NormParams params = {};
+	params.ne00 = uint32_t(src0->ne[0]);
+	params.nrows = uint32_t(ggml_nrows(src0));
+	params.groups_x = MIN(params.nrows, max_groups_x);
+	memcpy(&params.eps, p_node->op_params, sizeof(float));
+	int32_t buffers[2];
+	buffers[0] = _bind_source(src0, SCRATCH_SRC0, params.off0);
+	buffers[1] = _get_scratch(SCRATCH_DST, ggml_nbytes(p_node));
+	_dispatch(KERNEL_NORM, buffers, 2, &params, sizeof(params), params.groups_x, (params.nrows + params.groups_x - 1) / params.groups_x, 1, p_node, p_done);
+}
+
+void WebGPUCompute::_compute_job(void *p_job) {
+	Job *job = (Job *)p_job;
+	WebGPUCompute *compute = job->compute;
+	for (int32_t buffer : compute->stale_buffers) {
+		_webgpu_buffer_free(buffer);
+	}
+	compute->stale_buffers.clear();
+	switch (job->node->op) {
+		case GGML_OP_MUL_MAT:
+			compute->_mul_mat(job->node, &job->done);
+			break;
+		case GGML_OP_SOFT_MAX:
+			compute->_soft_max(job->node, &job->done);
+			break;
+		case GGML_OP_NORM:
+			compute->_norm(job->node, &job->done);
+			break;
+		default:
+			_finish(&job->done, 2);
+			break;
+	}
+}
+
+void WebGPUCompute::compute(ggml_tensor *p_node) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Job job;
+	job.node = p_node;
+	if (!_run(job, _compute_job)) {
+		ERR_PRINT("The WebGPU kernel of this node failed, its result is undefined.");
+	}
+	_invalidate(uintptr_t(p_node->data), uintptr_t(p_node->data) + ggml_nbytes(p_node));
+}
+
+void WebGPUCompute::_shutdown_job(void *p_job) {
+	Job *job = (Job *)p_job;
+	WebGPUCompute *compute = job->compute;
+	// Destroying the device frees its buffers.
+	_webgpu_shutdown();
+	compute->stale_buffers.clear();
+	_finish(&job->done, 1);
+	pthread_exit(nullptr);
+}
+
+WebGPUCompute::~WebGPUCompute() {
+	if (!has_device_thread) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	Job job;
+	_run(job, _shutdown_job);
+	pthread_join(device_thread, nullptr);
+}
+
+/* The ggml side, the same as that of the RenderingDevice: a host memory buffer type that tells the GPU which ranges the host wrote, and a backend that runs the nodes without a kernel on the CPU. */
+
+static const size_t buffer_alignment = 64;
+
+struct WebGPUBufferContext {
+	void *data = nullptr;
+	std::shared_ptr<WebGPUCompute> compute;
+};
+
+struct WebGPUBackendContext {
+	std::shared_ptr<WebGPUCompute> compute;
+	ggml_backend_t cpu = nullptr;
+};
+
+static void _buffer_free(ggml_backend_buffer_t p_buffer) {
+	WebGPUBufferContext *context = (WebGPUBufferContext *)p_buffer->context;
+	// The memory may come back as another buffer, whose tensors were not uploaded.
+	context->compute->invalidate(context->data, p_buffer->size);
+	free(context->data);
+	delete context;
+}
+
+static void *_buffer_get_base(ggml_backend_buffer_t p_buffer) {
+	return (uint8_t *)((WebGPUBufferContext *)p_buffer->context)->data;
+}
+
+static void _buffer_set_tensor(ggml_backend_buffer_t p_buffer, ggml_tensor *p_tensor, const void *p_data, size_t p_offset, size_t p_size) {
+	memcpy((uint8_t *)p_tensor->data + p_offset, p_data, p_size);
+	((WebGPUBufferContext *)p_buffer->context)->compute->track_upload((uint8_t *)p_tensor->data + p_offset, p_size);
+}
+
+static void _buffer_get_tensor(ggml_backend_buffer_t p_buffer, const ggml_tensor *p_tensor, void *p_data, size_t p_offset, size_t p_size) {
+	memcpy(p_data, (const uint8_t *)p_tensor->data + p_offset, p_size);
+}
+
+static void _buffer_clear(ggml_backend_buffer_t p_buffer, uint8_t p_value) {
+	WebGPUBufferContext *context = (WebGPUBufferContext *)p_buffer->context;
+	memset(context->data, p_value, p_buffer->size);
+	context->compute->invalidate(context->data, p_buffer->size);
+}
+
+static const ggml_backend_buffer_i buffer_interface = {
+	/* .free_buffer     = */ _buffer_free,
+	/* .get_base        = */ _buffer_get_base,
+	/* .init_tensor     = */ nullptr,
+	/* .set_tensor      = */ _buffer_set_tensor,
+	/* .get_tensor      = */ _buffer_get_tensor,
+	/* .cpy_tensor_from = */ nullptr,
+	/* .cpy_tensor_to   = */ nullptr,
+	/* .clear           = */ _buffer_clear,
+};
+
+static ggml_backend_buffer_t _buffer_type_alloc_buffer(ggml_backend_buffer_type_t p_buffer_type, size_t p_size) {
+	WebGPUCompute *compute = (WebGPUCompute *)p_buffer_type->context;
+	WebGPUBufferContext *context = new WebGPUBufferContext;
+	// Aligned for the SIMD128 kernels of the nodes left to the CPU.
+	const size_t size = MAX(size_t(1), (p_size + buffer_alignment - 1) / buffer_alignment * buffer_alignment);
+	context->data = aligned_alloc(buffer_alignment, size);
+	if (context->data == nullptr) {
+		delete context;
+		return nullptr;
+	}
+	context->compute = compute->get_shared();
+	return ggml_backend_buffer_init(p_buffer_type, buffer_interface, context, p_size);
+}
+
+static size_t _buffer_type_get_alignment(ggml_backend_buffer_type_t p_buffer_type) {
+	return buffer_alignment;
+}
+
+static const char *_backend_get_name(ggml_backend_t p_backend) {
+	return "WebGPU";
+}
+
+static bool _buffer_type_supports_backend(ggml_backend_buffer_type_t p_buffer_type, ggml_backend_t p_backend) {
+	return ggml_backend_is_cpu(p_backend) || p_backend->iface.get_name == _backend_get_name;
+}
+
+static bool _buffer_type_is_host(ggml_backend_buffer_type_t p_buffer_type) {
+	return true;
+}
+
+static void _backend_free(ggml_backend_t p_backend) {
+	WebGPUBackendContext *context = (WebGPUBackendContext *)p_backend->context;
+	ggml_backend_free(context->cpu);
+	delete context;
+	delete p_backend;
+}
+
+static ggml_backend_buffer_type_t _backend_get_default_buffer_type(ggml_backend_t p_backend) {
+	return ((WebGPUBackendContext *)p_backend->context)->compute->get_buffer_type();
+}
+
+/* Nodes [p_begin, p_end) of p_graph on the CPU. */
+static void _compute_on_cpu(WebGPUBackendContext *p_context, ggml_cgraph *p_graph, int p_begin, int p_end) {
+	ggml_cgraph view = ggml_graph_view(p_graph, p_begin, p_end);
+	ggml_backend_graph_compute(p_context->cpu, &view);
+	for (int i = p_begin; i < p_end; i++) {
+		const ggml_tensor *node = p_graph->nodes[i];
+		if (!host_backend_is_view_op(node)) {
+			p_context->compute->invalidate(node->data, host_backend_tensor_span(node));
+		}
+	}
+}
+
+static bool _backend_graph_compute(ggml_backend_t p_backend, ggml_cgraph *p_graph) {
+	WebGPUBackendContext *context = (WebGPUBackendContext *)p_backend->context;
+	int cpu_begin = 0;
+	for (int i = 0; i < p_graph->n_nodes; i++) {
+		ggml_tensor *node = p_graph->nodes[i];
+		if (!context->compute->supports_op(node)) {
+			continue;
+		}
+		if (cpu_begin < i) {
+			_compute_on_cpu(context, p_graph, cpu_begin, i);
+		}
+		context->compute->compute(node);
+		cpu_begin = i + 1;
+	}
+	if (cpu_begin < p_graph->n_nodes) {
+		_compute_on_cpu(context, p_graph, cpu_begin, p_graph->n_nodes);
+	}
+	return true;
+}
+
+static bool _backend_supports_op(ggml_backend_t p_backend, const ggml_tensor *p_node) {
+	// What the GPU has no kernel for runs on the CPU.
+	return ggml_backend_supports_op(((WebGPUBackendContext *)p_backend->context)->cpu, p_node);
+}
+
+static const ggml_backend_i backend_interface = {
+	/* .get_name                = */ _backend_get_name,
+	/* .free                    = */ _backend_free,
+	/* .get_default_buffer_type = */ _backend_get_default_buffer_type,
+	/* .set_tensor_async        = */ nullptr,
+	/* .get_tensor_async        = */ nullptr,
+	/* .cpy_tensor_from_async   = */ nullptr,
+	/* .cpy_tensor_to_async     = */ nullptr,
+	/* .synchronize             = */ nullptr,
+	/* .graph_plan_create       = */ nullptr,
+	/* .graph_plan_free         = */ nullptr,
+	/* .graph_plan_compute      = */ nullptr,
+	/* .graph_compute           = */ _backend_graph_compute,
+	/* .supports_op             = */ _backend_supports_op,
+};
+
+std::shared_ptr<WebGPUCompute> WebGPUCompute::acquire() {
+	std::lock_guard<std::mutex> lock(instance_mutex);
+	std::shared_ptr<WebGPUCompute> compute = instance.lock();
+	if (compute) {
+		return compute;
+	}
+	compute = std::make_shared<WebGPUCompute>();
+	if (!compute->_init()) {
+		return nullptr;
+	}
+	compute->self = compute;
+	compute->buffer_type = {
+		/* .iface = */ {
+				/* .alloc_buffer     = */ _buffer_type_alloc_buffer,
+				/* .get_alignment    = */ _buffer_type_get_alignment,
+				/* .get_alloc_size   = */ nullptr,
+				/* .supports_backend = */ _buffer_type_supports_backend,
+				/* .is_host          = */ _buffer_type_is_host,
+		},
+		/* .context = */ compute.get(),
+	};
+	instance = compute;
+	return compute;
+}
+
+ggml_backend_t WebGPUCompute::create_backend(int p_n_threads) {
+	std::shared_ptr<WebGPUCompute> compute = acquire();
+	if (!compute) {
+		return nullptr;
+	}
+	WebGPUBackendContext *context = new WebGPUBackendContext;
+	context->compute = compute;
+	context->cpu = ggml_backend_cpu_init();
+	ggml_backend_cpu_set_n_threads(context->cpu, MAX(1, p_n_threads));
+	return new ggml_backend{ backend_interface, context };
+}
+
+#else // !__EMSCRIPTEN_PTHREADS__
+
+std::shared_ptr<WebGPUCompute> WebGPUCompute::acquire() {
+	return nullptr;
+}
+
+ggml_backend_t WebGPUCompute::create_backend(int p_n_threads) {
+	return nullptr;
+}
+
+WebGPUCompute::~WebGPUCompute() {
+}
+
+#endif // __EMSCRIPTEN_PTHREADS__
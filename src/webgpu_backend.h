@@ -0,0 +1,121 @@
+#ifndef WEBGPU_BACKEND_H
+#define WEBGPU_BACKEND_H
+
+#include <whisper.cpp/ggml-backend-impl.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <pthread.h>
+#endif
+
+/**
+ * ggml backend on the browser's WebGPU for the web export, which has no
+ * RenderingDevice. It works like RenderingDeviceCompute: the tensors stay in
+ * host memory, the matrix multiplications, soft_max and norm large enough to
+ * pay for the copies run as WGSL compute shaders and the nodes in between on
+ * ggml's CPU backend, and the ranges the host wrote stay on the GPU once a
+ * kernel read them.
+ *
+ * A GPUDevice belongs to the Web Worker that requested it, and reading a
+ * buffer back resolves a promise, which a worker blocked in a pass never gets
+ * to. So one pthread owns the device and stays in its event loop, and the
+ * passes proxy each kernel to it and wait until its result is in their
+ * memory. Needs a build with threads, without them create_backend() fails.
+ */
+class WebGPUCompute {
+public:
+	enum Kernel {
+		KERNEL_MUL_MAT_F32,
+		KERNEL_MUL_MAT_F16,
+		KERNEL_SOFT_MAX,
+		KERNEL_NORM,
+		KERNEL_MAX,
+	};
+
+private:
+	/* A range the host wrote, and the id of its copy on the GPU once a kernel read it. */
+	struct Upload {
+		size_t size = 0;
+		int32_t buffer = 0;
+	};
+
+	enum ScratchSlot {
+		SCRATCH_SRC0,
+		SCRATCH_SRC1,
+		SCRATCH_DST,
+		SCRATCH_MAX,
+	};
+
+	struct Scratch {
+		int32_t buffer = 0;
+		uint32_t size = 0;
+	};
+
+	/* A node handed to the device thread, done turns 1 once its result is in, 2 if it failed. */
+	struct Job {
+		WebGPUCompute *compute = nullptr;
+		ggml_tensor *node = nullptr;
+		std::atomic<int32_t> done{ 0 };
+	};
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+	pthread_t device_thread;
+#endif
+	bool has_device_thread = false;
+	uint32_t max_binding_size = 0; // maxStorageBufferBindingSize of the device
+	std::map<uintptr_t, Upload> uploads; // by host address, the ranges do not overlap
+	std::vector<int32_t> stale_buffers; // dropped by the host threads, destroyed by the next job
+	Scratch scratch[SCRATCH_MAX];
+	std::mutex mutex;
+	struct ggml_backend_buffer_type buffer_type;
+	std::weak_ptr<WebGPUCompute> self;
+
+	static std::mutex instance_mutex;
+	static std::weak_ptr<WebGPUCompute> instance;
+
+	bool _init();
+	/* Runs p_job on the device thread and waits for it. With mutex held. */
+	bool _run(Job &p_job, void (*p_function)(void *));
+	static void _compute_job(void *p_job);
+	static void _shutdown_job(void *p_job);
+
+	/* The rest runs on the device thread. */
+	void _invalidate(uintptr_t p_begin, uintptr_t p_end);
+	int32_t _get_scratch(ScratchSlot p_slot, size_t p_size);
+	/* Buffer holding p_tensor, and the index of its first element in it. */
+	int32_t _bind_source(const ggml_tensor *p_tensor, ScratchSlot p_slot, uint32_t &r_offset);
+	void _dispatch(Kernel p_kernel, const int32_t *p_buffers, int p_count, const void *p_params, uint32_t p_params_size, uint32_t p_x, uint32_t p_y, uint32_t p_z, ggml_tensor *p_dst, std::atomic<int32_t> *p_done);
+	void _mul_mat(ggml_tensor *p_node, std::atomic<int32_t> *p_done);
+	void _soft_max(ggml_tensor *p_node, std::atomic<int32_t> *p_done);
+	void _norm(ggml_tensor *p_node, std::atomic<int32_t> *p_done);
+
+public:
+	/** Whether p_node runs on the GPU, the others are left to the CPU. */
+	bool supports_op(const ggml_tensor *p_node) const;
+	/** Compute p_node, which supports_op() took, into its host memory. */
+	void compute(ggml_tensor *p_node);
+
+	/** The host wrote p_size bytes at p_data, which the kernels may keep on the GPU from now on. */
+	void track_upload(const void *p_data, size_t p_size);
+	/** The host or the CPU wrote p_size bytes at p_data, the GPU copies of them are stale. */
+	void invalidate(const void *p_data, size_t p_size);
+
+	ggml_backend_buffer_type_t get_buffer_type() { return &buffer_type; }
+	std::shared_ptr<WebGPUCompute> get_shared() { return self.lock(); }
+
+	/** The device shared by the backends, requested with the first one. Null outside the web, without threads or when the browser has no WebGPU adapter. */
+	static std::shared_ptr<WebGPUCompute> acquire();
+	/** A ggml backend on the shared device, p_n_threads compute the nodes it has no kernel for. Null without WebGPU. */
+	static ggml_backend_t create_backend(int p_n_threads);
+
+	~WebGPUCompute();
+};
+
+#endif // WEBGPU_BACKEND_H
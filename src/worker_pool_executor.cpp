@@ -0,0 +1,84 @@
+#include "worker_pool_executor.h"
+
+#include <whisper.cpp/ggml.h>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#include <godot_cpp/core/memory.hpp>
+
+using namespace godot;
+
+std::atomic<bool> WorkerPoolExecutor::enabled{ false };
+std::atomic<int> WorkerPoolExecutor::free_slots{ 0 };
+
+/* The graph threads of one ggml generation, as one group task. */
+struct ExecutorCall {
+	void (*task)(int, void *) = nullptr;
+	void *data = nullptr;
+	int tasks = 0;
+	WorkerThreadPool::GroupID group = -1;
+};
+
+static void _run_element(void *p_call, uint32_t p_index) {
+	const ExecutorCall *call = (const ExecutorCall *)p_call;
+	call->task(int(p_index), call->data);
+}
+
+/* Threads of the pool, its default of one per logical processor unless the project set another count. */
+static int _get_pool_threads() {
+	const int max_threads = ProjectSettings::get_singleton()->get_setting("threading/worker_pool/max_threads", -1);
+	return max_threads > 0 ? max_threads : OS::get_singleton()->get_processor_count();
+}
+
+void WorkerPoolExecutor::set_enabled(bool p_enabled) {
+	if (p_enabled == enabled.load(std::memory_order_relaxed)) {
+		return;
+	}
+	if (p_enabled) {
+		// Only once, the graphs of pools made while it was enabled before may still hold slots.
+		static bool has_slots = false;
+		if (!has_slots) {
+			free_slots.store(_get_pool_threads(), std::memory_order_relaxed);
+			has_slots = true;
+		}
+		ggml_set_thread_executor(&WorkerPoolExecutor::_start, &WorkerPoolExecutor::_join, nullptr);
+	} else {
+		// Pools made meanwhile keep calling _start, the slots of their graphs stay counted.
+		ggml_set_thread_executor(nullptr, nullptr, nullptr);
+	}
+	enabled.store(p_enabled, std::memory_order_relaxed);
+}
+
+bool WorkerPoolExecutor::try_reserve(int p_slots) {
+	int slots = free_slots.load(std::memory_order_relaxed);
+	do {
+		if (slots < p_slots) {
+			return false;
+		}
+	} while (!free_slots.compare_exchange_weak(slots, slots - p_slots, std::memory_order_acq_rel));
+	return true;
+}
+
+void WorkerPoolExecutor::release(int p_slots) {
+	free_slots.fetch_add(p_slots, std::memory_order_acq_rel);
+}
+
+void *WorkerPoolExecutor::_start(int p_tasks, void (*p_task)(int, void *), void *p_data, void *p_user_data) {
+	if (!try_reserve(p_tasks)) {
+		return nullptr;
+	}
+	ExecutorCall *call = memnew(ExecutorCall);
+	call->task = p_task;
+	call->data = p_data;
+	call->tasks = p_tasks;
+	// One task per element, each of them waits at the node barriers for the others.
+	call->group = WorkerThreadPool::get_singleton()->add_native_group_task(&_run_element, call, p_tasks, p_tasks, true, "whisper graph");
+	return call;
+}
+
+void WorkerPoolExecutor::_join(void *p_handle, void *p_user_data) {
+	ExecutorCall *call = (ExecutorCall *)p_handle;
+	WorkerThreadPool::get_singleton()->wait_for_group_task_completion(call->group);
+	release(call->tasks);
+	memdelete(call);
+}
@@ -0,0 +1,37 @@
+#ifndef WORKER_POOL_EXECUTOR_H
+#define WORKER_POOL_EXECUTOR_H
+
+#include <godot_cpp/core/defs.hpp>
+
+#include <atomic>
+
+/**
+ * Runs the inference of the extension on Godot's WorkerThreadPool instead of
+ * threads of its own, so whisper work is scheduled alongside the jobs of the
+ * engine rather than competing with them for the cores. The passes of the
+ * TranscriptionScheduler become pool tasks, and the ggml threads of their
+ * graphs and of the mel become group tasks, through ggml_set_thread_executor.
+ *
+ * The ggml threads of a graph wait for each other at every node, so a group
+ * must never queue behind itself. Slots count the pool threads the extension
+ * took, passes and graph threads alike, and a graph that finds too few of
+ * them left runs on threads of its own for that once instead.
+ */
+class WorkerPoolExecutor {
+	static std::atomic<bool> enabled;
+	static std::atomic<int> free_slots;
+
+	static void *_start(int p_tasks, void (*p_task)(int, void *), void *p_data, void *p_user_data);
+	static void _join(void *p_handle, void *p_user_data);
+
+public:
+	/** Applies to the ggml threads of the whisper states created from now on, and to the scheduler once it restarts. */
+	static void set_enabled(bool p_enabled);
+	_FORCE_INLINE_ static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+	/** Take p_slots of the pool threads for tasks that must all run at once, false when fewer are left. */
+	static bool try_reserve(int p_slots);
+	static void release(int p_slots);
+};
+
+#endif // WORKER_POOL_EXECUTOR_H
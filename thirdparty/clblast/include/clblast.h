@@ -714,6 +714,11 @@ StatusCode PUBLIC_API ClearCache();
 // Further CLBlast routine calls will then run at maximum speed.
 StatusCode PUBLIC_API FillCache(const cl_device_id device);
 
+// Compiled binaries can additionally be kept in files in the given directory, so a later process
+// on the same device and driver loads them instead of compiling the kernels again. The directory
+// has to exist. An empty string, the default, disables this.
+StatusCode PUBLIC_API SetBinaryCacheDirectory(const std::string &directory);
+
 // =================================================================================================
 
 // Retrieves current tuning parameters for a specific device-precision-kernel combination
@@ -1689,6 +1689,11 @@ CLBlastStatusCode PUBLIC_API CLBlastClearCache();
 // Further CLBlast routine calls will then run at maximum speed.
 CLBlastStatusCode PUBLIC_API CLBlastFillCache(const cl_device_id device);
 
+// Compiled binaries can additionally be kept in files in the given directory, so a later process
+// on the same device and driver loads them instead of compiling the kernels again. The directory
+// has to exist. An empty string, the default, disables this.
+CLBlastStatusCode PUBLIC_API CLBlastSetBinaryCacheDirectory(const char* directory);
+
 // =================================================================================================
 
 // Overrides tuning parameters for a specific device-precision-kernel combination. The next time
@@ -28,9 +28,21 @@ StatusCode ClearCache() {
   return StatusCode::kSuccess;
 }
 
+// Sets the directory of the on-disk binary cache, which ClearCache leaves alone
+StatusCode SetBinaryCacheDirectory(const std::string &directory) {
+  try {
+    BinaryDiskCache::SetDirectory(directory);
+  } catch (...) { return DispatchException(); }
+  return StatusCode::kSuccess;
+}
+
 template <typename Real, typename Complex>
 void FillCacheForPrecision(Queue &queue) {
   try {
+#ifdef CLBLAST_GEMM_ONLY
+    // Only GEMM is built in
+    Xgemm<Real>(queue, nullptr); Xgemm<Complex>(queue, nullptr);
+#else
 
     // Runs all the level 1 set-up functions
     Xswap<Real>(queue, nullptr); Xswap<Complex>(queue, nullptr);
@@ -84,6 +96,7 @@ void FillCacheForPrecision(Queue &queue) {
 
     // Runs all the non-BLAS set-up functions
     Xomatcopy<Real>(queue, nullptr); Xomatcopy<Complex>(queue, nullptr);
+#endif
 
   } catch(const RuntimeErrorCode &e) {
     if (e.status() != StatusCode::kNoDoublePrecision &&
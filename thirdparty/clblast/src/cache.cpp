@@ -14,6 +14,13 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
 
 #include "database/database.hpp"
 #include "cache.hpp"
@@ -131,5 +138,95 @@ template void ProgramCache::RemoveBySubset<1, 2>(const ProgramKey &); // precisi
 template class Cache<DatabaseKey, Database>;
 template Database DatabaseCache::Get(const DatabaseKeyRef &, bool *) const;
 
+// =================================================================================================
+
+// Written in front of every cached binary, followed by the length of the key and the key itself
+static const std::string kBinaryDiskCacheMagic = "CLBlast binary cache 1\n";
+
+std::mutex BinaryDiskCache::directory_mutex_;
+std::string BinaryDiskCache::directory_;
+
+void BinaryDiskCache::SetDirectory(const std::string &directory) {
+  std::lock_guard<std::mutex> lock(directory_mutex_);
+  directory_ = directory;
+  while (directory_.size() > 1 && (directory_.back() == '/' || directory_.back() == '\\')) {
+    directory_.pop_back();
+  }
+}
+
+bool BinaryDiskCache::IsEnabled() {
+  std::lock_guard<std::mutex> lock(directory_mutex_);
+  return !directory_.empty();
+}
+
+// The 64-bit FNV-1a hash of the key, the file keeps the full key to tell collisions apart
+std::string BinaryDiskCache::FileName(const std::string &key) {
+  auto hash = uint64_t{14695981039346656037ULL};
+  for (const auto c : key) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= uint64_t{1099511628211ULL};
+  }
+  std::lock_guard<std::mutex> lock(directory_mutex_);
+  if (directory_.empty()) { return std::string{}; }
+  auto name = std::ostringstream{};
+  name << directory_ << "/clblast_" << std::hex << std::setw(16) << std::setfill('0') << hash
+       << ".bin";
+  return name.str();
+}
+
+bool BinaryDiskCache::Load(const std::string &key, std::string &binary) {
+  const auto file_name = FileName(key);
+  if (file_name.empty()) { return false; }
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file) { return false; }
+  const auto contents = std::string{std::istreambuf_iterator<char>(file),
+                                    std::istreambuf_iterator<char>()};
+  const auto header_size = kBinaryDiskCacheMagic.size() + sizeof(uint64_t);
+  if (contents.size() < header_size ||
+      contents.compare(0, kBinaryDiskCacheMagic.size(), kBinaryDiskCacheMagic) != 0) {
+    return false;
+  }
+  auto key_size = uint64_t{0};
+  std::memcpy(&key_size, &contents[kBinaryDiskCacheMagic.size()], sizeof(key_size));
+  if (key_size != key.size() || contents.size() <= header_size + key.size() ||
+      contents.compare(header_size, key.size(), key) != 0) {
+    return false;
+  }
+  binary = contents.substr(header_size + key.size());
+  return true;
+}
+
+void BinaryDiskCache::Store(const std::string &key, const std::string &binary) {
+  const auto file_name = FileName(key);
+  if (file_name.empty() || binary.empty()) { return; }
+  // Written next to the final file and renamed, so a reader never sees a partial binary
+  const auto temp_name = file_name + ".tmp";
+  {
+    std::ofstream file(temp_name, std::ios::binary | std::ios::trunc);
+    if (!file) { return; }
+    const auto key_size = static_cast<uint64_t>(key.size());
+    file.write(kBinaryDiskCacheMagic.data(),
+               static_cast<std::streamsize>(kBinaryDiskCacheMagic.size()));
+    file.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+    file.write(key.data(), static_cast<std::streamsize>(key.size()));
+    file.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+    if (!file) {
+      file.close();
+      std::remove(temp_name.c_str());
+      return;
+    }
+  }
+  std::remove(file_name.c_str()); // rename does not replace existing files on Windows
+  if (std::rename(temp_name.c_str(), file_name.c_str()) != 0) {
+    std::remove(temp_name.c_str());
+  }
+}
+
+void BinaryDiskCache::Remove(const std::string &key) {
+  const auto file_name = FileName(key);
+  if (file_name.empty()) { return; }
+  std::remove(file_name.c_str());
+}
+
 // =================================================================================================
 } // namespace clblast
@@ -102,6 +102,30 @@ typedef Cache<DatabaseKey, Database> DatabaseCache;
 extern template class Cache<DatabaseKey, Database>;
 extern template Database DatabaseCache::Get(const DatabaseKeyRef &, bool *) const;
 
+// =================================================================================================
+
+// The persistent counterpart of the binary cache: compiled binaries are also written to files in a
+// directory set by the host application, so they survive restarts of the process. The key is a
+// string describing everything that affects the binary (device, driver, kernel source, options).
+// It is disabled as long as no directory is set.
+class BinaryDiskCache {
+public:
+  static void SetDirectory(const std::string &directory);
+  static bool IsEnabled();
+
+  // Returns false if there is no binary for this key, the file is unreadable or was written for a
+  // different key with the same hash
+  static bool Load(const std::string &key, std::string &binary);
+  static void Store(const std::string &key, const std::string &binary);
+  static void Remove(const std::string &key);
+
+private:
+  static std::string FileName(const std::string &key);
+
+  static std::mutex directory_mutex_;
+  static std::string directory_;
+}; // class BinaryDiskCache
+
 // =================================================================================================
 } // namespace clblast
 
@@ -19,6 +19,7 @@
 #include "clblast.h"
 
 namespace clblast {
+#ifndef CLBLAST_GEMM_ONLY
 
 // =================================================================================================
 // BLAS level-1 (vector-vector) routines
@@ -1642,6 +1643,8 @@ template StatusCode PUBLIC_API Spr2<half>(const Layout, const Triangle,
 // BLAS level-3 (matrix-matrix) routines
 // =================================================================================================
 
+#endif // CLBLAST_GEMM_ONLY
+
 // General matrix-matrix multiplication: SGEMM/DGEMM/CGEMM/ZGEMM/HGEMM
 template <typename T>
 StatusCode Gemm(const Layout layout, const Transpose a_transpose, const Transpose b_transpose,
@@ -1710,6 +1713,7 @@ template StatusCode PUBLIC_API Gemm<half>(const Layout, const Transpose, const T
                                           cl_mem, const size_t, const size_t,
                                           cl_command_queue*, cl_event*, cl_mem);
 
+#ifndef CLBLAST_GEMM_ONLY
 // Symmetric matrix-matrix multiplication: SSYMM/DSYMM/CSYMM/ZSYMM/HSYMM
 template <typename T>
 StatusCode Symm(const Layout layout, const Side side, const Triangle triangle,
@@ -2552,6 +2556,7 @@ template StatusCode PUBLIC_API GemmStridedBatched<half>(const Layout, const Tran
                                                         const size_t,
                                                         cl_command_queue*, cl_event*);
 
+#endif // CLBLAST_GEMM_ONLY
 // =================================================================================================
 
 // Retrieves the required size of the temporary buffer for the GEMM kernel (optional)
@@ -4463,6 +4463,13 @@ CLBlastStatusCode CLBlastFillCache(const cl_device_id device) {
   } catch (...) { return static_cast<CLBlastStatusCode>(clblast::DispatchExceptionForC()); }
 }
 
+// Sets the directory of the on-disk binary cache
+CLBlastStatusCode CLBlastSetBinaryCacheDirectory(const char* directory) {
+  try {
+    return static_cast<CLBlastStatusCode>(clblast::SetBinaryCacheDirectory(std::string{directory}));
+  } catch (...) { return static_cast<CLBlastStatusCode>(clblast::DispatchExceptionForC()); }
+}
+
 // =================================================================================================
 
 // Overrides the tuning parameters for this device-precision-kernel combination
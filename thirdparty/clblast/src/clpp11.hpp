@@ -261,6 +261,7 @@ class Device {
   }
   std::string Vendor() const { return GetInfoString(CL_DEVICE_VENDOR); }
   std::string Name() const { return GetInfoString(CL_DEVICE_NAME); }
+  std::string DriverVersion() const { return GetInfoString(CL_DRIVER_VERSION); }
   std::string Type() const {
     auto type = GetInfo<cl_device_type>(CL_DEVICE_TYPE);
     switch(type) {
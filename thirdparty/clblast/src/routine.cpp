@@ -15,6 +15,7 @@
 #include <vector>
 #include <chrono>
 #include <cstdlib>
+#include <functional>
 
 #include "routine.hpp"
 
@@ -129,14 +130,49 @@ void Routine::InitProgram(std::initializer_list<const char *> source) {
     source_string += s;
   }
 
+  // Queries the on-disk cache, which outlives the process. Its key covers everything the binary
+  // depends on: the driver, the device, the build options and the kernel source itself (which
+  // includes the tuning parameters as defines).
+  auto disk_key = std::string{};
+  if (BinaryDiskCache::IsEnabled()) {
+    disk_key = "CLBlast " + std::to_string(CLBLAST_VERSION_MAJOR) + "." +
+               std::to_string(CLBLAST_VERSION_MINOR) + "." + std::to_string(CLBLAST_VERSION_PATCH) +
+               "\n" + Platform(platform_id).Version() + "\n" + device_name + "\n" +
+               device_.Version() + "\n" + device_.DriverVersion() + "\n" + ToString(precision_) +
+               "\n" + routine_info + "\n";
+    for (const auto &option : options) { disk_key += option + " "; }
+    disk_key += "\n" + std::to_string(std::hash<std::string>{}(source_string)) + "_" +
+                std::to_string(source_string.size());
+    auto disk_binary = std::string{};
+    if (BinaryDiskCache::Load(disk_key, disk_binary)) {
+      try {
+        program_ = std::make_shared<Program>(device_, context_, disk_binary);
+        auto binary_options = options;
+        SetOpenCLKernelStandard(device_, binary_options);
+        program_->Build(device_, binary_options);
+        BinaryCache::Instance().Store(BinaryKey{platform_id, precision_, routine_info, device_name},
+                                      std::move(disk_binary));
+        ProgramCache::Instance().Store(ProgramKey{context_(), device_(), precision_, routine_info},
+                                       std::shared_ptr<Program>{program_});
+        return;
+      } catch (...) {
+        // Stale or corrupt, e.g. written by a driver that reports the same version: rebuild it
+        log_debug("Discarding cached binary of " + routine_info);
+        BinaryDiskCache::Remove(disk_key);
+      }
+    }
+  }
+
   // Completes the source and compiles the kernel
   program_ = CompileFromSource(source_string, precision_, routine_name_,
                                device_, context_, options, 0);
 
 
   // Store the compiled binary and program in the cache
+  auto binary_ir = program_->GetIR();
+  if (!disk_key.empty()) { BinaryDiskCache::Store(disk_key, binary_ir); }
   BinaryCache::Instance().Store(BinaryKey{platform_id, precision_, routine_info, device_name},
-                                program_->GetIR());
+                                std::move(binary_ir));
 
   ProgramCache::Instance().Store(ProgramKey{context_(), device_(), precision_, routine_info},
                                  std::shared_ptr<Program>{program_});
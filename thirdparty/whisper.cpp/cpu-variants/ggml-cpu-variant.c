@@ -0,0 +1,335 @@
+// One ISA level of the hot ggml kernels, see ggml-cpu-variant.h.
+// The build compiles this file once per level with GGML_CPU_VARIANT set to its name (avx2, avx512 or dotprod)
+// and the matching -m flags. The non-static symbols of ggml-quants.c get the name as suffix so the copies can be linked
+// next to the baseline one.
+
+#ifndef GGML_CPU_VARIANT
+#error "GGML_CPU_VARIANT must be defined to the name of the ISA level"
+#endif
+
+#define GGML_CPU_VARIANT_CAT_(a, b) a ## _ ## b
+#define GGML_CPU_VARIANT_CAT(a, b)  GGML_CPU_VARIANT_CAT_(a, b)
+#define GGML_CPU_VARIANT_NAME(name) GGML_CPU_VARIANT_CAT(name, GGML_CPU_VARIANT)
+
+#define quantize_row_q4_0_reference  GGML_CPU_VARIANT_NAME(quantize_row_q4_0_reference)
+#define quantize_row_q4_1_reference  GGML_CPU_VARIANT_NAME(quantize_row_q4_1_reference)
+#define quantize_row_q5_0_reference  GGML_CPU_VARIANT_NAME(quantize_row_q5_0_reference)
+#define quantize_row_q5_1_reference  GGML_CPU_VARIANT_NAME(quantize_row_q5_1_reference)
+#define quantize_row_q8_0_reference  GGML_CPU_VARIANT_NAME(quantize_row_q8_0_reference)
+#define quantize_row_q8_1_reference  GGML_CPU_VARIANT_NAME(quantize_row_q8_1_reference)
+#define quantize_row_q2_K_reference  GGML_CPU_VARIANT_NAME(quantize_row_q2_K_reference)
+#define quantize_row_q3_K_reference  GGML_CPU_VARIANT_NAME(quantize_row_q3_K_reference)
+#define quantize_row_q4_K_reference  GGML_CPU_VARIANT_NAME(quantize_row_q4_K_reference)
+#define quantize_row_q5_K_reference  GGML_CPU_VARIANT_NAME(quantize_row_q5_K_reference)
+#define quantize_row_q6_K_reference  GGML_CPU_VARIANT_NAME(quantize_row_q6_K_reference)
+#define quantize_row_q8_K_reference  GGML_CPU_VARIANT_NAME(quantize_row_q8_K_reference)
+#define quantize_row_q4_0            GGML_CPU_VARIANT_NAME(quantize_row_q4_0)
+#define quantize_row_q4_1            GGML_CPU_VARIANT_NAME(quantize_row_q4_1)
+#define quantize_row_q5_0            GGML_CPU_VARIANT_NAME(quantize_row_q5_0)
+#define quantize_row_q5_1            GGML_CPU_VARIANT_NAME(quantize_row_q5_1)
+#define quantize_row_q8_0            GGML_CPU_VARIANT_NAME(quantize_row_q8_0)
+#define quantize_row_q8_1            GGML_CPU_VARIANT_NAME(quantize_row_q8_1)
+#define quantize_row_q2_K            GGML_CPU_VARIANT_NAME(quantize_row_q2_K)
+#define quantize_row_q3_K            GGML_CPU_VARIANT_NAME(quantize_row_q3_K)
+#define quantize_row_q4_K            GGML_CPU_VARIANT_NAME(quantize_row_q4_K)
+#define quantize_row_q5_K            GGML_CPU_VARIANT_NAME(quantize_row_q5_K)
+#define quantize_row_q6_K            GGML_CPU_VARIANT_NAME(quantize_row_q6_K)
+#define quantize_row_q8_K            GGML_CPU_VARIANT_NAME(quantize_row_q8_K)
+#define dequantize_row_q4_0          GGML_CPU_VARIANT_NAME(dequantize_row_q4_0)
+#define dequantize_row_q4_1          GGML_CPU_VARIANT_NAME(dequantize_row_q4_1)
+#define dequantize_row_q5_0          GGML_CPU_VARIANT_NAME(dequantize_row_q5_0)
+#define dequantize_row_q5_1          GGML_CPU_VARIANT_NAME(dequantize_row_q5_1)
+#define dequantize_row_q8_0          GGML_CPU_VARIANT_NAME(dequantize_row_q8_0)
+#define dequantize_row_q2_K          GGML_CPU_VARIANT_NAME(dequantize_row_q2_K)
+#define dequantize_row_q3_K          GGML_CPU_VARIANT_NAME(dequantize_row_q3_K)
+#define dequantize_row_q4_K          GGML_CPU_VARIANT_NAME(dequantize_row_q4_K)
+#define dequantize_row_q5_K          GGML_CPU_VARIANT_NAME(dequantize_row_q5_K)
+#define dequantize_row_q6_K          GGML_CPU_VARIANT_NAME(dequantize_row_q6_K)
+#define dequantize_row_q8_K          GGML_CPU_VARIANT_NAME(dequantize_row_q8_K)
+#define ggml_vec_dot_q4_0_q8_0       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q4_0_q8_0)
+#define ggml_vec_dot_q4_1_q8_1       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q4_1_q8_1)
+#define ggml_vec_dot_q5_0_q8_0       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q5_0_q8_0)
+#define ggml_vec_dot_q5_1_q8_1       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q5_1_q8_1)
+#define ggml_vec_dot_q8_0_q8_0       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q8_0_q8_0)
+#define ggml_vec_dot_q2_K_q8_K       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q2_K_q8_K)
+#define ggml_vec_dot_q3_K_q8_K       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q3_K_q8_K)
+#define ggml_vec_dot_q4_K_q8_K       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q4_K_q8_K)
+#define ggml_vec_dot_q5_K_q8_K       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q5_K_q8_K)
+#define ggml_vec_dot_q6_K_q8_K       GGML_CPU_VARIANT_NAME(ggml_vec_dot_q6_K_q8_K)
+#define ggml_vec_dot_q4_0_4x4_q8_0   GGML_CPU_VARIANT_NAME(ggml_vec_dot_q4_0_4x4_q8_0)
+#define ggml_vec_dot_q8_0_4x4_q8_0   GGML_CPU_VARIANT_NAME(ggml_vec_dot_q8_0_4x4_q8_0)
+#define ggml_repack_q4_0_4x4         GGML_CPU_VARIANT_NAME(ggml_repack_q4_0_4x4)
+#define ggml_repack_q8_0_4x4         GGML_CPU_VARIANT_NAME(ggml_repack_q8_0_4x4)
+#define ggml_quantize_q2_K           GGML_CPU_VARIANT_NAME(ggml_quantize_q2_K)
+#define ggml_quantize_q3_K           GGML_CPU_VARIANT_NAME(ggml_quantize_q3_K)
+#define ggml_quantize_q4_K           GGML_CPU_VARIANT_NAME(ggml_quantize_q4_K)
+#define ggml_quantize_q5_K           GGML_CPU_VARIANT_NAME(ggml_quantize_q5_K)
+#define ggml_quantize_q6_K           GGML_CPU_VARIANT_NAME(ggml_quantize_q6_K)
+
+#include "../ggml-quants.c"
+#include "ggml-cpu-variant.h"
+
+#if defined(__AVX2__)
+
+#if !defined(__FMA__) || !defined(__F16C__)
+#error "the x86 levels of ggml-cpu-variant.c need AVX2, FMA and F16C"
+#endif
+
+static void ggml_vec_dot_f32_variant(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const float * restrict x = vx;
+    const float * restrict y = vy;
+
+    int i = 0;
+    float sumf = 0.0f;
+#if defined(__AVX512F__)
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    __m512 sum3 = _mm512_setzero_ps();
+    for (; i + 64 <= n; i += 64) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i +  0), _mm512_loadu_ps(y + i +  0), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), sum1);
+        sum2 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 32), _mm512_loadu_ps(y + i + 32), sum2);
+        sum3 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 48), _mm512_loadu_ps(y + i + 48), sum3);
+    }
+    sumf = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3)));
+#else
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    __m256 sum3 = _mm256_setzero_ps();
+    for (; i + 32 <= n; i += 32) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i +  0), _mm256_loadu_ps(y + i +  0), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i +  8), _mm256_loadu_ps(y + i +  8), sum1);
+        sum2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 16), _mm256_loadu_ps(y + i + 16), sum2);
+        sum3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 24), _mm256_loadu_ps(y + i + 24), sum3);
+    }
+    sumf = hsum_float_8(_mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3)));
+#endif
+
+    // leftovers
+    for (; i < n; ++i) {
+        sumf += x[i]*y[i];
+    }
+
+    *s = sumf;
+}
+
+// inlined with a constant n by the fixed size kernels below
+GGML_ALWAYS_INLINE static void ggml_vec_dot_f16_variant_n(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const ggml_fp16_t * restrict x = vx;
+    const ggml_fp16_t * restrict y = vy;
+
+    int i = 0;
+    double sumf = 0.0;
+#if defined(__AVX512F__)
+#define LOAD_F16(p) _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(p)))
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    __m512 sum3 = _mm512_setzero_ps();
+    for (; i + 64 <= n; i += 64) {
+        sum0 = _mm512_fmadd_ps(LOAD_F16(x + i +  0), LOAD_F16(y + i +  0), sum0);
+        sum1 = _mm512_fmadd_ps(LOAD_F16(x + i + 16), LOAD_F16(y + i + 16), sum1);
+        sum2 = _mm512_fmadd_ps(LOAD_F16(x + i + 32), LOAD_F16(y + i + 32), sum2);
+        sum3 = _mm512_fmadd_ps(LOAD_F16(x + i + 48), LOAD_F16(y + i + 48), sum3);
+    }
+    // a vector at a time for what is left, e.g. the last 48 of a row of 240
+    for (; i + 16 <= n; i += 16) {
+        sum0 = _mm512_fmadd_ps(LOAD_F16(x + i), LOAD_F16(y + i), sum0);
+    }
+    sumf = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3)));
+#undef LOAD_F16
+#else
+#define LOAD_F16(p) _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(p)))
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    __m256 sum3 = _mm256_setzero_ps();
+    for (; i + 32 <= n; i += 32) {
+        sum0 = _mm256_fmadd_ps(LOAD_F16(x + i +  0), LOAD_F16(y + i +  0), sum0);
+        sum1 = _mm256_fmadd_ps(LOAD_F16(x + i +  8), LOAD_F16(y + i +  8), sum1);
+        sum2 = _mm256_fmadd_ps(LOAD_F16(x + i + 16), LOAD_F16(y + i + 16), sum2);
+        sum3 = _mm256_fmadd_ps(LOAD_F16(x + i + 24), LOAD_F16(y + i + 24), sum3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        sum0 = _mm256_fmadd_ps(LOAD_F16(x + i), LOAD_F16(y + i), sum0);
+    }
+    sumf = hsum_float_8(_mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3)));
+#undef LOAD_F16
+#endif
+
+    // leftovers
+    for (; i < n; ++i) {
+        sumf += (double)(GGML_FP16_TO_FP32(x[i])*GGML_FP16_TO_FP32(y[i]));
+    }
+
+    *s = sumf;
+}
+
+static void ggml_fp16_to_fp32_row_variant(const void * restrict vx, float * restrict y, int n) {
+    const ggml_fp16_t * restrict x = vx;
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i))));
+    }
+    for (; i < n; ++i) {
+        y[i] = GGML_FP16_TO_FP32(x[i]);
+    }
+}
+
+static void ggml_fp32_to_fp16_row_variant(const float * restrict x, void * restrict vy, int n) {
+    ggml_fp16_t * restrict y = vy;
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(y + i), _mm256_cvtps_ph(_mm256_loadu_ps(x + i), 0));
+    }
+    for (; i < n; ++i) {
+        y[i] = GGML_FP32_TO_FP16(x[i]);
+    }
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_DOTPROD) && defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC)
+
+// the quantized dot products of ggml-quants.c use sdot with __ARM_FEATURE_DOTPROD, the F32 one of ggml.c is
+// already as fast as NEON gets
+
+// products are summed in F16 for at most this many elements before they are added up in F32
+#define GGML_F16_ACC_BLOCK 256
+
+// inlined with a constant n by the fixed size kernels below
+GGML_ALWAYS_INLINE static void ggml_vec_dot_f16_variant_n(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const ggml_fp16_t * restrict x = vx;
+    const ggml_fp16_t * restrict y = vy;
+
+    const int np = n & ~31;
+
+    int i = 0;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    while (i < np) {
+        float16x8_t sum0 = vdupq_n_f16(0.0f);
+        float16x8_t sum1 = vdupq_n_f16(0.0f);
+        float16x8_t sum2 = vdupq_n_f16(0.0f);
+        float16x8_t sum3 = vdupq_n_f16(0.0f);
+
+        const int end = MIN(np, i + GGML_F16_ACC_BLOCK);
+        for (; i < end; i += 32) {
+            sum0 = vfmaq_f16(sum0, vld1q_f16(x + i +  0), vld1q_f16(y + i +  0));
+            sum1 = vfmaq_f16(sum1, vld1q_f16(x + i +  8), vld1q_f16(y + i +  8));
+            sum2 = vfmaq_f16(sum2, vld1q_f16(x + i + 16), vld1q_f16(y + i + 16));
+            sum3 = vfmaq_f16(sum3, vld1q_f16(x + i + 24), vld1q_f16(y + i + 24));
+        }
+
+        const float16x8_t sum = vaddq_f16(vaddq_f16(sum0, sum1), vaddq_f16(sum2, sum3));
+        acc0 = vaddq_f32(acc0, vcvt_f32_f16(vget_low_f16(sum)));
+        acc1 = vaddq_f32(acc1, vcvt_high_f32_f16(sum));
+    }
+
+    // a vector at a time for the at most 24 left, e.g. the last 16 of a row of 240
+    if (i + 8 <= n) {
+        float16x8_t sum = vdupq_n_f16(0.0f);
+        for (; i + 8 <= n; i += 8) {
+            sum = vfmaq_f16(sum, vld1q_f16(x + i), vld1q_f16(y + i));
+        }
+        acc0 = vaddq_f32(acc0, vcvt_f32_f16(vget_low_f16(sum)));
+        acc1 = vaddq_f32(acc1, vcvt_high_f32_f16(sum));
+    }
+
+    double sumf = vaddvq_f32(vaddq_f32(acc0, acc1));
+
+    // leftovers
+    for (; i < n; ++i) {
+        sumf += (double)(GGML_FP16_TO_FP32(x[i])*GGML_FP16_TO_FP32(y[i]));
+    }
+
+    *s = sumf;
+}
+
+static void ggml_fp16_to_fp32_row_variant(const void * restrict vx, float * restrict y, int n) {
+    const ggml_fp16_t * restrict x = vx;
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const float16x8_t v = vld1q_f16(x + i);
+        vst1q_f32(y + i + 0, vcvt_f32_f16(vget_low_f16(v)));
+        vst1q_f32(y + i + 4, vcvt_high_f32_f16(v));
+    }
+    for (; i < n; ++i) {
+        y[i] = GGML_FP16_TO_FP32(x[i]);
+    }
+}
+
+static void ggml_fp32_to_fp16_row_variant(const float * restrict x, void * restrict vy, int n) {
+    ggml_fp16_t * restrict y = vy;
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        vst1q_f16(y + i, vcombine_f16(vcvt_f16_f32(vld1q_f32(x + i + 0)), vcvt_f16_f32(vld1q_f32(x + i + 4))));
+    }
+    for (; i < n; ++i) {
+        y[i] = GGML_FP32_TO_FP16(x[i]);
+    }
+}
+
+#else
+#error "ggml-cpu-variant.c is built for AVX2, AVX-512 or Armv8.2 dotprod with FP16"
+#endif
+
+static void ggml_vec_dot_f16_variant(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    ggml_vec_dot_f16_variant_n(n, s, vx, vy);
+}
+
+// the sizes of ggml_vec_dot_size, fully unrolled
+#define GGML_VEC_DOT_F16_VARIANT_FIXED(N) \
+    static void ggml_vec_dot_f16_variant_ ## N(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) { \
+        assert(n == N); \
+        (void) n; \
+        ggml_vec_dot_f16_variant_n(N, s, vx, vy); \
+    }
+
+GGML_VEC_DOT_F16_VARIANT_FIXED(64)
+GGML_VEC_DOT_F16_VARIANT_FIXED(240)
+GGML_VEC_DOT_F16_VARIANT_FIXED(384)
+
+#undef GGML_VEC_DOT_F16_VARIANT_FIXED
+
+void GGML_CPU_VARIANT_CAT(ggml_cpu_variant_init, GGML_CPU_VARIANT)(ggml_type_traits_t * traits) {
+#if defined(__AVX2__)
+    traits[GGML_TYPE_F32].vec_dot = ggml_vec_dot_f32_variant;
+#endif
+
+    traits[GGML_TYPE_F16].to_float   = ggml_fp16_to_fp32_row_variant;
+    traits[GGML_TYPE_F16].from_float = ggml_fp32_to_fp16_row_variant;
+    traits[GGML_TYPE_F16].vec_dot    = ggml_vec_dot_f16_variant;
+    traits[GGML_TYPE_F16].vec_dot_fixed[GGML_VEC_DOT_SIZE_64]  = ggml_vec_dot_f16_variant_64;
+    traits[GGML_TYPE_F16].vec_dot_fixed[GGML_VEC_DOT_SIZE_240] = ggml_vec_dot_f16_variant_240;
+    traits[GGML_TYPE_F16].vec_dot_fixed[GGML_VEC_DOT_SIZE_384] = ggml_vec_dot_f16_variant_384;
+
+#define SET_QUANT(type, name, dot) \
+    traits[type].to_float   = (ggml_to_float_t) dequantize_row_ ## name; \
+    traits[type].from_float = quantize_row_ ## name; \
+    traits[type].vec_dot    = dot;
+
+    SET_QUANT(GGML_TYPE_Q4_0, q4_0, ggml_vec_dot_q4_0_q8_0)
+    SET_QUANT(GGML_TYPE_Q4_1, q4_1, ggml_vec_dot_q4_1_q8_1)
+    SET_QUANT(GGML_TYPE_Q5_0, q5_0, ggml_vec_dot_q5_0_q8_0)
+    SET_QUANT(GGML_TYPE_Q5_1, q5_1, ggml_vec_dot_q5_1_q8_1)
+    SET_QUANT(GGML_TYPE_Q8_0, q8_0, ggml_vec_dot_q8_0_q8_0)
+    SET_QUANT(GGML_TYPE_Q2_K, q2_K, ggml_vec_dot_q2_K_q8_K)
+    SET_QUANT(GGML_TYPE_Q3_K, q3_K, ggml_vec_dot_q3_K_q8_K)
+    SET_QUANT(GGML_TYPE_Q4_K, q4_K, ggml_vec_dot_q4_K_q8_K)
+    SET_QUANT(GGML_TYPE_Q5_K, q5_K, ggml_vec_dot_q5_K_q8_K)
+    SET_QUANT(GGML_TYPE_Q6_K, q6_K, ggml_vec_dot_q6_K_q8_K)
+#undef SET_QUANT
+
+    // the repacked types only have a dot product, they are packed by the baseline ggml_repack_rows()
+    traits[GGML_TYPE_Q4_0_4X4].vec_dot = ggml_vec_dot_q4_0_4x4_q8_0;
+    traits[GGML_TYPE_Q8_0_4X4].vec_dot = ggml_vec_dot_q8_0_4x4_q8_0;
+
+    // activations are quantized to these for the dot products above
+    traits[GGML_TYPE_Q8_1].from_float = quantize_row_q8_1;
+    traits[GGML_TYPE_Q8_K].from_float = quantize_row_q8_K;
+}
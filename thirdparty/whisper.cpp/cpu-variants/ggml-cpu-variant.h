@@ -0,0 +1,21 @@
+#pragma once
+
+#include "../ggml.h"
+
+// Kernels of ggml-quants.c and the F16/F32 dot products compiled once per ISA level by ggml-cpu-variant.c.
+// ggml_init patches the type traits with the best level the CPU and the OS support, the rest of ggml.c stays
+// on the baseline the library was built for.
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+void ggml_cpu_variant_init_avx2  (ggml_type_traits_t * traits);
+void ggml_cpu_variant_init_avx512(ggml_type_traits_t * traits);
+
+// Armv8.2 dotprod and FP16 arithmetic
+void ggml_cpu_variant_init_dotprod(ggml_type_traits_t * traits);
+
+#ifdef  __cplusplus
+}
+#endif
@@ -542,8 +542,22 @@ struct ggml_backend_cpu_context {
     int n_threads;
     void * work_data;
     size_t work_size;
+
+    // kept between graphs, so a decoder loop does not create and join threads for every token
+    struct ggml_threadpool * threadpool;
 };
 
+static struct ggml_threadpool * ggml_backend_cpu_ctx_get_threadpool(struct ggml_backend_cpu_context * cpu_ctx) {
+    if (cpu_ctx->n_threads <= 1) {
+        return NULL;
+    }
+    if (cpu_ctx->threadpool == NULL || ggml_threadpool_n_threads(cpu_ctx->threadpool) != cpu_ctx->n_threads) {
+        ggml_threadpool_free(cpu_ctx->threadpool);
+        cpu_ctx->threadpool = ggml_threadpool_new(cpu_ctx->n_threads);
+    }
+    return cpu_ctx->threadpool;
+}
+
 static const char * ggml_backend_cpu_name(ggml_backend_t backend) {
     return "CPU";
 
@@ -552,6 +566,7 @@ static const char * ggml_backend_cpu_name(ggml_backend_t backend) {
 
 static void ggml_backend_cpu_free(ggml_backend_t backend) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
+    ggml_threadpool_free(cpu_ctx->threadpool);
     free(cpu_ctx->work_data);
     free(cpu_ctx);
     free(backend);
@@ -595,9 +610,9 @@ static void ggml_backend_cpu_graph_plan_free(ggml_backend_t backend, ggml_backen
 static void ggml_backend_cpu_graph_plan_compute(ggml_backend_t backend, ggml_backend_graph_plan_t plan) {
     struct ggml_backend_plan_cpu * cpu_plan = (struct ggml_backend_plan_cpu *)plan;
 
-    ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
+    cpu_plan->cplan.threadpool = ggml_backend_cpu_ctx_get_threadpool((struct ggml_backend_cpu_context *)backend->context);
 
-    GGML_UNUSED(backend);
+    ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
 }
 
 static bool ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_cgraph * cgraph) {
@@ -612,6 +627,7 @@ static bool ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_c
     }
 
     cplan.work_data = cpu_ctx->work_data;
+    cplan.threadpool = ggml_backend_cpu_ctx_get_threadpool(cpu_ctx);
 
     ggml_graph_compute(cgraph, &cplan);
     return true;
@@ -650,6 +666,7 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->n_threads = GGML_DEFAULT_N_THREADS;
     ctx->work_data = NULL;
     ctx->work_size = 0;
+    ctx->threadpool = NULL;
 
     ggml_backend_t cpu_backend = malloc(sizeof(struct ggml_backend));
 
@@ -671,6 +688,12 @@ void ggml_backend_cpu_set_n_threads(ggml_backend_t backend_cpu, int n_threads) {
     ctx->n_threads = n_threads;
 }
 
+struct ggml_threadpool * ggml_backend_cpu_get_threadpool(ggml_backend_t backend_cpu) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    return ggml_backend_cpu_ctx_get_threadpool((struct ggml_backend_cpu_context *)backend_cpu->context);
+}
+
 ggml_backend_buffer_t ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size) {
     return ggml_backend_buffer_init(ggml_backend_cpu_buffer_type(), cpu_backend_buffer_i_from_ptr, ptr, size);
 }
@@ -73,6 +73,9 @@ extern "C" {
 
     GGML_API bool ggml_backend_is_cpu(ggml_backend_t backend);
     GGML_API void ggml_backend_cpu_set_n_threads(ggml_backend_t backend_cpu, int n_threads);
+    // the workers the graphs of the backend run on, for its current n_threads, NULL with a single thread
+    // e.g. for ggml_threadpool_run() of work outside of a graph, never at the same time as a graph of the backend
+    GGML_API struct ggml_threadpool * ggml_backend_cpu_get_threadpool(ggml_backend_t backend_cpu);
 
     // Create a backend buffer from an existing pointer
     GGML_API ggml_backend_buffer_t ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size);
@@ -543,7 +543,8 @@ static void ggml_cuda_set_device(const int device) {
 }
 
 static int g_device_count = -1;
-static int g_main_device = 0;
+// of the calling thread, so backends on different devices compute at the same time
+static thread_local int g_main_device = 0;
 static float g_tensor_split[GGML_CUDA_MAX_DEVICES] = {0};
 
 struct cuda_device_capabilities {
@@ -8399,6 +8400,8 @@ static void ggml_cuda_rms_norm(const ggml_tensor * src0, const ggml_tensor * src
 bool ggml_cuda_can_mul_mat(const struct ggml_tensor * src0, const struct ggml_tensor * src1, struct ggml_tensor * dst) {
     if (!g_cublas_loaded) return false;
 
+    if (!ggml_mul_mat_get_offload(dst)) return false;
+
     const int64_t ne10 = src1->ne[0];
 
     const int64_t ne0 = dst->ne[0];
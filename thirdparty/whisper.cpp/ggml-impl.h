@@ -26,6 +26,13 @@ extern "C" {
 #endif
 #endif
 
+// for the bodies of kernels that are also compiled with a constant size
+#if defined(_MSC_VER)
+#define GGML_ALWAYS_INLINE __forceinline
+#else
+#define GGML_ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
 // __FMA__ and __F16C__ are not defined in MSVC, however they are implied with AVX2/AVX512
 #if defined(_MSC_VER) && (defined(__AVX2__) || defined(__AVX512F__))
 #ifndef __FMA__
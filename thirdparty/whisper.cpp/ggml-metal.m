@@ -7,6 +7,8 @@
 
 #import <Metal/Metal.h>
 
+#include <dlfcn.h>
+
 #undef MIN
 #undef MAX
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -149,6 +151,10 @@ struct ggml_metal_context {
     GGML_METAL_DECL_KERNEL(rope_f16);
     GGML_METAL_DECL_KERNEL(alibi_f32);
     GGML_METAL_DECL_KERNEL(im2col_f16);
+    GGML_METAL_DECL_KERNEL(conv_1d_gelu_f16);
+    GGML_METAL_DECL_KERNEL(conv_1d_gelu_f32);
+    GGML_METAL_DECL_KERNEL(log_mel_f32);
+    GGML_METAL_DECL_KERNEL(log_mel_norm_f32);
     GGML_METAL_DECL_KERNEL(upscale_f32);
     GGML_METAL_DECL_KERNEL(pad_f32);
     GGML_METAL_DECL_KERNEL(argsort_f32_i32_asc);
@@ -259,14 +265,33 @@ struct ggml_metal_context * ggml_metal_init(int n_cb) {
 #endif
         NSError * error = nil;
         NSString * libPath = [bundle pathForResource:@"default" ofType:@"metallib"];
+        if (libPath == nil) {
+            // a plain dylib, as on iOS, has no bundle of its own: look next to the binary
+            Dl_info info;
+            if (dladdr((const void *) ggml_metal_init, &info) != 0 && info.dli_fname != NULL) {
+                NSString * binDir = [[NSString stringWithUTF8String:info.dli_fname] stringByDeletingLastPathComponent];
+                NSString * binLibPath = [binDir stringByAppendingPathComponent:@"default.metallib"];
+                if ([[NSFileManager defaultManager] fileExistsAtPath:binLibPath]) {
+                    libPath = binLibPath;
+                }
+            }
+        }
+        ctx->library = nil;
         if (libPath != nil) {
             // pre-compiled library found
             NSURL * libURL = [NSURL fileURLWithPath:libPath];
             GGML_METAL_LOG_INFO("%s: loading '%s'\n", __func__, [libPath UTF8String]);
             ctx->library = [ctx->device newLibraryWithURL:libURL error:&error];
+            if (error) {
+                // e.g. built for another OS version, the source still compiles
+                GGML_METAL_LOG_WARN("%s: could not load '%s': %s, loading from source\n", __func__, [libPath UTF8String], [[error description] UTF8String]);
+                ctx->library = nil;
+                error = nil;
+            }
         } else {
             GGML_METAL_LOG_INFO("%s: default.metallib not found, loading from source\n", __func__);
-
+        }
+        if (ctx->library == nil) {
             NSString * sourcePath;
             NSString * ggmlMetalPathResources = [[NSProcessInfo processInfo].environment objectForKey:@"GGML_METAL_PATH_RESOURCES"];
 
@@ -442,6 +467,10 @@ struct ggml_metal_context * ggml_metal_init(int n_cb) {
         GGML_METAL_ADD_KERNEL(rope_f16);
         GGML_METAL_ADD_KERNEL(alibi_f32);
         GGML_METAL_ADD_KERNEL(im2col_f16);
+        GGML_METAL_ADD_KERNEL(conv_1d_gelu_f16);
+        GGML_METAL_ADD_KERNEL(conv_1d_gelu_f32);
+        GGML_METAL_ADD_KERNEL(log_mel_f32);
+        GGML_METAL_ADD_KERNEL(log_mel_norm_f32);
         GGML_METAL_ADD_KERNEL(upscale_f32);
         GGML_METAL_ADD_KERNEL(pad_f32);
         GGML_METAL_ADD_KERNEL(argsort_f32_i32_asc);
@@ -565,6 +594,10 @@ void ggml_metal_free(struct ggml_metal_context * ctx) {
     GGML_METAL_DEL_KERNEL(rope_f16);
     GGML_METAL_DEL_KERNEL(alibi_f32);
     GGML_METAL_DEL_KERNEL(im2col_f16);
+    GGML_METAL_DEL_KERNEL(conv_1d_gelu_f16);
+    GGML_METAL_DEL_KERNEL(conv_1d_gelu_f32);
+    GGML_METAL_DEL_KERNEL(log_mel_f32);
+    GGML_METAL_DEL_KERNEL(log_mel_norm_f32);
     GGML_METAL_DEL_KERNEL(upscale_f32);
     GGML_METAL_DEL_KERNEL(pad_f32);
     GGML_METAL_DEL_KERNEL(argsort_f32_i32_asc);
@@ -933,6 +966,8 @@ static bool ggml_metal_supports_op(const struct ggml_tensor * op) {
         case GGML_OP_ALIBI:
         case GGML_OP_ROPE:
         case GGML_OP_IM2COL:
+        case GGML_OP_CONV_1D_GELU:
+        case GGML_OP_LOG_MEL:
         case GGML_OP_UPSCALE:
         case GGML_OP_PAD:
         case GGML_OP_ARGSORT:
@@ -2225,6 +2260,87 @@ bool ggml_metal_graph_compute(
 
                             [encoder dispatchThreadgroups:MTLSizeMake(IC, OH, OW) threadsPerThreadgroup:MTLSizeMake(N, KH, KW)];
                         } break;
+                    case GGML_OP_CONV_1D_GELU:
+                        {
+                            GGML_ASSERT(src1->type == GGML_TYPE_F32);
+                            GGML_ASSERT(dst->src[2]->type == GGML_TYPE_F32);
+                            GGML_ASSERT( dst->type == GGML_TYPE_F32);
+
+                            const int32_t s0 = ((const int32_t *)(dst->op_params))[0];
+                            const int32_t p0 = ((const int32_t *)(dst->op_params))[1];
+
+                            size_t offs_src2 = 0;
+                            id<MTLBuffer> id_src2 = ggml_metal_get_buffer(ctx, dst->src[2], &offs_src2);
+
+                            switch (src0->type) {
+                                case GGML_TYPE_F32: [encoder setComputePipelineState:ctx->pipeline_conv_1d_gelu_f32]; break;
+                                case GGML_TYPE_F16: [encoder setComputePipelineState:ctx->pipeline_conv_1d_gelu_f16]; break;
+                                default: GGML_ASSERT(false);
+                            };
+
+                            [encoder setBuffer:id_src0 offset:offs_src0        atIndex:0];
+                            [encoder setBuffer:id_src1 offset:offs_src1        atIndex:1];
+                            [encoder setBuffer:id_src2 offset:offs_src2        atIndex:2];
+                            [encoder setBuffer:id_dst  offset:offs_dst         atIndex:3];
+                            [encoder setBytes:&ne00    length:sizeof( int64_t) atIndex:4];
+                            [encoder setBytes:&ne01    length:sizeof( int64_t) atIndex:5];
+                            [encoder setBytes:&ne10    length:sizeof( int64_t) atIndex:6];
+                            [encoder setBytes:&ne0     length:sizeof( int64_t) atIndex:7];
+                            [encoder setBytes:&nb00    length:sizeof(uint64_t) atIndex:8];
+                            [encoder setBytes:&nb01    length:sizeof(uint64_t) atIndex:9];
+                            [encoder setBytes:&nb02    length:sizeof(uint64_t) atIndex:10];
+                            [encoder setBytes:&nb11    length:sizeof(uint64_t) atIndex:11];
+                            [encoder setBytes:&nb1     length:sizeof(uint64_t) atIndex:12];
+                            [encoder setBytes:&s0      length:sizeof( int32_t) atIndex:13];
+                            [encoder setBytes:&p0      length:sizeof( int32_t) atIndex:14];
+
+                            const int nth = 32;
+
+                            [encoder dispatchThreadgroups:MTLSizeMake((ne0 + nth - 1)/nth, ne1, 1) threadsPerThreadgroup:MTLSizeMake(nth, 1, 1)];
+                        } break;
+                    case GGML_OP_LOG_MEL:
+                        {
+                            GGML_ASSERT(src0->type == GGML_TYPE_F32);
+                            GGML_ASSERT(src1->type == GGML_TYPE_F32);
+                            GGML_ASSERT(dst->src[2]->type == GGML_TYPE_F32);
+
+                            const int32_t frame_step = ((const int32_t *)(dst->op_params))[0];
+
+                            const int64_t N = dst->src[2]->ne[0];
+
+                            size_t offs_src2 = 0;
+                            id<MTLBuffer> id_src2 = ggml_metal_get_buffer(ctx, dst->src[2], &offs_src2);
+
+                            // one threadgroup per frame, the twiddles, the frame and its power spectrum in threadgroup memory
+                            [encoder setComputePipelineState:ctx->pipeline_log_mel_f32];
+                            [encoder setBuffer:id_src0 offset:offs_src0        atIndex:0];
+                            [encoder setBuffer:id_src1 offset:offs_src1        atIndex:1];
+                            [encoder setBuffer:id_src2 offset:offs_src2        atIndex:2];
+                            [encoder setBuffer:id_dst  offset:offs_dst         atIndex:3];
+                            [encoder setBytes:&ne00    length:sizeof( int64_t) atIndex:4];
+                            [encoder setBytes:&N       length:sizeof( int64_t) atIndex:5];
+                            [encoder setBytes:&ne10    length:sizeof( int64_t) atIndex:6];
+                            [encoder setBytes:&ne11    length:sizeof( int64_t) atIndex:7];
+                            [encoder setBytes:&nb1     length:sizeof(uint64_t) atIndex:8];
+                            [encoder setBytes:&frame_step length:sizeof(int32_t) atIndex:9];
+                            [encoder setThreadgroupMemoryLength:GGML_PAD((3*N + ne10)*sizeof(float), 16) atIndex:0];
+
+                            [encoder dispatchThreadgroups:MTLSizeMake(ne0, 1, 1) threadsPerThreadgroup:MTLSizeMake(256, 1, 1)];
+
+                            // the clamp needs the largest value of all the frames
+                            [encoder memoryBarrierWithScope:MTLBarrierScopeBuffers];
+
+                            const int nth = MIN(1024, (int) ctx->pipeline_log_mel_norm_f32.maxTotalThreadsPerThreadgroup);
+
+                            [encoder setComputePipelineState:ctx->pipeline_log_mel_norm_f32];
+                            [encoder setBuffer:id_dst  offset:offs_dst         atIndex:0];
+                            [encoder setBytes:&ne0     length:sizeof( int64_t) atIndex:1];
+                            [encoder setBytes:&ne1     length:sizeof( int64_t) atIndex:2];
+                            [encoder setBytes:&nb1     length:sizeof(uint64_t) atIndex:3];
+                            [encoder setThreadgroupMemoryLength:32*sizeof(float) atIndex:0];
+
+                            [encoder dispatchThreadgroups:MTLSizeMake(1, 1, 1) threadsPerThreadgroup:MTLSizeMake(nth, 1, 1)];
+                        } break;
                     case GGML_OP_UPSCALE:
                         {
                             GGML_ASSERT(src0->type == GGML_TYPE_F32);
@@ -1808,6 +1808,169 @@ kernel void kernel_im2col_f16(
     }
 }
 
+// one thread per output step of a channel, the taps are read straight from the input
+template<typename T>
+kernel void kernel_conv_1d_gelu(
+        device const char  * src0,
+        device const char  * src1,
+        device const float * src2,
+        device       char  * dst,
+        constant   int64_t & K,
+        constant   int64_t & IC,
+        constant   int64_t & IL,
+        constant   int64_t & OL,
+        constant  uint64_t & nb00,
+        constant  uint64_t & nb01,
+        constant  uint64_t & nb02,
+        constant  uint64_t & nb11,
+        constant  uint64_t & nb1,
+        constant   int32_t & s0,
+        constant   int32_t & p0,
+        uint3 tgpig[[threadgroup_position_in_grid]],
+        uint3 tpitg[[thread_position_in_threadgroup]],
+        uint3   ntg[[threads_per_threadgroup]]) {
+    const int64_t ot = tgpig[0]*ntg[0] + tpitg[0];
+    const int64_t oc = tgpig[1];
+
+    if (ot >= OL) {
+        return;
+    }
+
+    float sum = src2[oc];
+
+    for (int64_t ic = 0; ic < IC; ++ic) {
+        device const char  * w = src0 + oc*nb02 + ic*nb01;
+        device const float * x = (device const float *) (src1 + ic*nb11);
+        for (int64_t k = 0; k < K; ++k) {
+            const int64_t i = ot*s0 + k - p0;
+            if (i >= 0 && i < IL) {
+                sum += (float) *((device const T *) (w + k*nb00)) * x[i];
+            }
+        }
+    }
+
+    ((device float *) (dst + oc*nb1))[ot] = 0.5f*sum*(1.0f + precise::tanh(SQRT_2_OVER_PI*sum*(1.0f + GELU_COEF_A*sum*sum)));
+}
+
+typedef decltype(kernel_conv_1d_gelu<half>) kernel_conv_1d_gelu_t;
+
+template [[host_name("kernel_conv_1d_gelu_f16")]] kernel kernel_conv_1d_gelu_t kernel_conv_1d_gelu<half>;
+template [[host_name("kernel_conv_1d_gelu_f32")]] kernel kernel_conv_1d_gelu_t kernel_conv_1d_gelu<float>;
+
+// one threadgroup per frame: the DFT of the windowed frame, its power spectrum through the filters, log10
+kernel void kernel_log_mel_f32(
+        device const float * src0,
+        device const float * src1,
+        device const float * src2,
+        device       char  * dst,
+        constant   int64_t & n_samples,
+        constant   int64_t & N,
+        constant   int64_t & n_bins,
+        constant   int64_t & n_mel,
+        constant  uint64_t & nb1,
+        constant   int32_t & frame_step,
+        threadgroup float  * buf [[threadgroup(0)]],
+        uint  tgpig[[threadgroup_position_in_grid]],
+        uint  tpitg[[thread_position_in_threadgroup]],
+        uint    ntg[[threads_per_threadgroup]]) {
+    const int64_t i = tgpig;
+
+    threadgroup float * tw_cos = buf;
+    threadgroup float * tw_sin = buf + N;
+    threadgroup float * frame  = buf + 2*N;
+    threadgroup float * power  = buf + 3*N;
+
+    for (int64_t n = tpitg; n < N; n += ntg) {
+        const float angle = 2.0f*M_PI_F*n/N;
+        tw_cos[n] = precise::cos(angle);
+        tw_sin[n] = precise::sin(angle);
+
+        const int64_t is = i*frame_step + n;
+        frame[n] = is < n_samples ? src0[is]*src2[n] : 0.0f;
+    }
+
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    for (int64_t k = tpitg; k < n_bins; k += ntg) {
+        float re = 0.0f;
+        float im = 0.0f;
+
+        // the twiddle of sample n is at (k*n) % N, k < N
+        int64_t t = 0;
+        for (int64_t n = 0; n < N; ++n) {
+            re += frame[n]*tw_cos[t];
+            im -= frame[n]*tw_sin[t];
+            t += k;
+            if (t >= N) {
+                t -= N;
+            }
+        }
+
+        power[k] = re*re + im*im;
+    }
+
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    for (int64_t j = tpitg; j < n_mel; j += ntg) {
+        device const float * filter = src1 + j*n_bins;
+
+        float sum = 0.0f;
+        for (int64_t k = 0; k < n_bins; ++k) {
+            sum += power[k]*filter[k];
+        }
+
+        ((device float *) (dst + j*nb1))[i] = log10(max(sum, 1e-10f));
+    }
+}
+
+// one threadgroup: the largest value of the spectrogram, then the clamp and scale of whisper
+kernel void kernel_log_mel_norm_f32(
+        device       char  * dst,
+        constant   int64_t & n_frames,
+        constant   int64_t & n_mel,
+        constant  uint64_t & nb1,
+        threadgroup float  * buf [[threadgroup(0)]],
+        uint  tpitg[[thread_position_in_threadgroup]],
+        uint  sgitg[[simdgroup_index_in_threadgroup]],
+        uint  tiisg[[thread_index_in_simdgroup]],
+        uint    ntg[[threads_per_threadgroup]]) {
+    float lmax = -INFINITY;
+
+    for (int64_t j = 0; j < n_mel; ++j) {
+        device const float * row = (device const float *) (dst + j*nb1);
+        for (int64_t i = tpitg; i < n_frames; i += ntg) {
+            lmax = MAX(lmax, row[i]);
+        }
+    }
+
+    float max_val = simd_max(lmax);
+    if (ntg > N_SIMDWIDTH) {
+        if (sgitg == 0) {
+            buf[tiisg] = -INFINITY;
+        }
+
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+
+        if (tiisg == 0) {
+            buf[sgitg] = max_val;
+        }
+
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+
+        max_val = buf[tiisg];
+        max_val = simd_max(max_val);
+    }
+
+    const float mmax = max_val - 8.0f;
+
+    for (int64_t j = 0; j < n_mel; ++j) {
+        device float * row = (device float *) (dst + j*nb1);
+        for (int64_t i = tpitg; i < n_frames; i += ntg) {
+            row[i] = (max(row[i], mmax) + 4.0f)/4.0f;
+        }
+    }
+}
+
 kernel void kernel_upscale_f32(
     device  const char * src0,
     device        char * dst,
@@ -3,11 +3,13 @@
 
 #include <array>
 #include <atomic>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <limits>
 #include <sstream>
+#include <string>
 #include <vector>
 
 #define CL_TARGET_OPENCL_VERSION 110
@@ -894,6 +896,129 @@ static cl_kernel dequantize_mul_mat_vec_q2_K_cl, dequantize_mul_mat_vec_q3_K_cl,
 static cl_kernel mul_f32_cl;
 static bool fp16_support;
 
+// directory of the on-disk program cache, empty when it is disabled
+static std::string program_cache_dir;
+
+static const char program_cache_magic[] = "ggml-opencl program cache 1\n";
+
+static uint64_t program_cache_hash(const std::string & data) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (char c : data) {
+        hash ^= (unsigned char) c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string device_info_string(cl_device_id dev, cl_device_info info) {
+    size_t size = 0;
+    if (clGetDeviceInfo(dev, info, 0, NULL, &size) != CL_SUCCESS || size == 0) {
+        return std::string();
+    }
+    std::string value(size, '\0');
+    clGetDeviceInfo(dev, info, size, &value[0], NULL);
+    value.resize(strlen(value.c_str()));
+    return value;
+}
+
+// everything the binary depends on: the device, its driver, the build options and the source
+static std::string program_cache_key(cl_device_id dev, const std::string & compile_opts, const char * program_buffer) {
+    char source_hash[64];
+    snprintf(source_hash, sizeof(source_hash), "%016llx_%zu",
+            (unsigned long long) program_cache_hash(program_buffer), strlen(program_buffer));
+    return device_info_string(dev, CL_DEVICE_NAME) + "\n" + device_info_string(dev, CL_DEVICE_VERSION) + "\n" +
+           device_info_string(dev, CL_DRIVER_VERSION) + "\n" + compile_opts + "\n" + source_hash;
+}
+
+static std::string program_cache_path(const std::string & key) {
+    char name[64];
+    snprintf(name, sizeof(name), "/ggml_%016llx.bin", (unsigned long long) program_cache_hash(key));
+    return program_cache_dir + name;
+}
+
+// the cached binary of the program for this key, empty if there is none
+static std::string program_cache_load(const std::string & key) {
+    FILE * file = fopen(program_cache_path(key).c_str(), "rb");
+    if (file == NULL) {
+        return std::string();
+    }
+    std::string contents;
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.append(buffer, n);
+    }
+    fclose(file);
+    // the key is stored in full, two keys with the same hash do not load each other's binary
+    const std::string header = program_cache_magic + key + '\0';
+    if (contents.size() <= header.size() || contents.compare(0, header.size(), header) != 0) {
+        return std::string();
+    }
+    return contents.substr(header.size());
+}
+
+static void program_cache_store(const std::string & key, cl_program p) {
+    size_t binary_size = 0;
+    if (clGetProgramInfo(p, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL) != CL_SUCCESS || binary_size == 0) {
+        return;
+    }
+    std::vector<unsigned char> binary(binary_size);
+    unsigned char * binary_ptr = binary.data();
+    if (clGetProgramInfo(p, CL_PROGRAM_BINARIES, sizeof(binary_ptr), &binary_ptr, NULL) != CL_SUCCESS) {
+        return;
+    }
+    // written next to the final file and renamed, so a reader never sees half a binary
+    const std::string path = program_cache_path(key);
+    const std::string temp_path = path + ".tmp";
+    FILE * file = fopen(temp_path.c_str(), "wb");
+    if (file == NULL) {
+        return;
+    }
+    const std::string header = program_cache_magic + key + '\0';
+    const bool ok = fwrite(header.data(), 1, header.size(), file) == header.size() &&
+                    fwrite(binary.data(), 1, binary.size(), file) == binary.size();
+    if (fclose(file) != 0 || !ok) {
+        remove(temp_path.c_str());
+        return;
+    }
+    remove(path.c_str()); // rename does not replace files on Windows
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        remove(temp_path.c_str());
+    }
+}
+
+static cl_program build_program_from_cache(cl_context ctx, cl_device_id dev, const std::string & key, const std::string & compile_opts) {
+    const std::string binary = program_cache_load(key);
+    if (binary.empty()) {
+        return NULL;
+    }
+    const unsigned char * binary_ptr = (const unsigned char *) binary.data();
+    const size_t binary_size = binary.size();
+    cl_int binary_status = CL_SUCCESS;
+    cl_int err = CL_SUCCESS;
+    cl_program p = clCreateProgramWithBinary(ctx, 1, &dev, &binary_size, &binary_ptr, &binary_status, &err);
+    if (err == CL_SUCCESS && binary_status == CL_SUCCESS) {
+        err = clBuildProgram(p, 0, NULL, compile_opts.c_str(), NULL, NULL);
+        if (err == CL_SUCCESS) {
+            return p;
+        }
+    }
+    // stale, e.g. a driver update that kept its version string: compile it again
+    if (p != NULL) {
+        clReleaseProgram(p);
+    }
+    remove(program_cache_path(key).c_str());
+    return NULL;
+}
+
+void ggml_cl_set_cache_dir(const char * dir) {
+    program_cache_dir = dir != NULL ? dir : "";
+    while (program_cache_dir.size() > 1 && (program_cache_dir.back() == '/' || program_cache_dir.back() == '\\')) {
+        program_cache_dir.pop_back();
+    }
+    clblast::SetBinaryCacheDirectory(program_cache_dir);
+}
+
 static cl_program build_program_from_source(cl_context ctx, cl_device_id dev, const char* program_buffer) {
     cl_program p;
     char *program_log;
@@ -901,6 +1026,19 @@ static cl_program build_program_from_source(cl_context ctx, cl_device_id dev, co
     size_t log_size;
     int err;
 
+    std::string compile_opts = "-cl-mad-enable -cl-unsafe-math-optimizations -cl-finite-math-only -cl-fast-relaxed-math "
+                               "-DQK4_0=32 -DQR4_0=2 -DQK4_1=32 -DQR4_1=2 -DQK5_0=32 -DQR5_0=2 -DQK5_1=32 -DQR5_1=2 -DQK8_0=32 -DQR8_0=1 "
+                               "-DQK_K=256 -DK_QUANTS_PER_ITERATION=" + std::to_string(K_QUANTS_PER_ITERATION);
+
+    std::string cache_key;
+    if (!program_cache_dir.empty()) {
+        cache_key = program_cache_key(dev, compile_opts, program_buffer);
+        p = build_program_from_cache(ctx, dev, cache_key, compile_opts);
+        if (p != NULL) {
+            return p;
+        }
+    }
+
     program_size = strlen(program_buffer);
 
     p = clCreateProgramWithSource(ctx, 1, (const char**)&program_buffer, &program_size, &err);
@@ -909,10 +1047,6 @@ static cl_program build_program_from_source(cl_context ctx, cl_device_id dev, co
         exit(1);
     }
 
-    std::string compile_opts = "-cl-mad-enable -cl-unsafe-math-optimizations -cl-finite-math-only -cl-fast-relaxed-math "
-                               "-DQK4_0=32 -DQR4_0=2 -DQK4_1=32 -DQR4_1=2 -DQK5_0=32 -DQR5_0=2 -DQK5_1=32 -DQR5_1=2 -DQK8_0=32 -DQR8_0=1 "
-                               "-DQK_K=256 -DK_QUANTS_PER_ITERATION=" + std::to_string(K_QUANTS_PER_ITERATION);
-
     err = clBuildProgram(p, 0, NULL, compile_opts.c_str(), NULL, NULL);
     if(err < 0) {
 
@@ -925,6 +1059,10 @@ static cl_program build_program_from_source(cl_context ctx, cl_device_id dev, co
         exit(1);
     }
 
+    if (!cache_key.empty()) {
+        program_cache_store(cache_key, p);
+    }
+
     return p;
 }
 
@@ -1807,6 +1945,10 @@ bool ggml_cl_can_mul_mat(const struct ggml_tensor * src0, const struct ggml_tens
     const int64_t ne0 = dst->ne[0];
     const int64_t ne1 = dst->ne[1];
 
+    if (!ggml_mul_mat_get_offload(dst)) {
+        return false;
+    }
+
     // TODO: find the optimal values for these
     if ((src0->type == GGML_TYPE_F32 || src0->type == GGML_TYPE_F16 || ggml_is_quantized(src0->type)) &&
         src1->type == GGML_TYPE_F32 &&
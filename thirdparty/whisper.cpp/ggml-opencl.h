@@ -6,6 +6,9 @@
 extern "C" {
 #endif
 
+// directory where compiled kernels are kept between runs, call it before ggml_cl_init
+// an empty string or NULL disables the cache
+GGML_API void ggml_cl_set_cache_dir(const char * dir);
 GGML_API void ggml_cl_init(void);
 
 GGML_API void   ggml_cl_mul(const struct ggml_tensor * src0, const struct ggml_tensor * src1, struct ggml_tensor * dst);
@@ -3556,6 +3556,251 @@ void ggml_vec_dot_q8_0_q8_0(const int n, float * restrict s, const void * restri
 #endif
 }
 
+void ggml_repack_q4_0_4x4(const block_q4_0 * restrict x, block_q4_0x4 * restrict y, int nrows, int n_per_row) {
+    const int nb = n_per_row / QK4_0;
+
+    assert(nrows % 4 == 0);
+    assert(n_per_row % QK4_0 == 0);
+
+    for (int g = 0; g < nrows / 4; ++g) {
+        for (int i = 0; i < nb; ++i) {
+            block_q4_0x4 * restrict out = &y[g*nb + i];
+            for (int r = 0; r < 4; ++r) {
+                const block_q4_0 * restrict in = &x[(g*4 + r)*nb + i];
+                out->d[r] = in->d;
+                for (int c = 0; c < QK4_0/16; ++c) {
+                    memcpy(out->qs + (c*4 + r)*8, in->qs + c*8, 8);
+                }
+            }
+        }
+    }
+}
+
+void ggml_repack_q8_0_4x4(const block_q8_0 * restrict x, block_q8_0x4 * restrict y, int nrows, int n_per_row) {
+    const int nb = n_per_row / QK8_0;
+
+    assert(nrows % 4 == 0);
+    assert(n_per_row % QK8_0 == 0);
+
+    for (int g = 0; g < nrows / 4; ++g) {
+        for (int i = 0; i < nb; ++i) {
+            block_q8_0x4 * restrict out = &y[g*nb + i];
+            for (int r = 0; r < 4; ++r) {
+                const block_q8_0 * restrict in = &x[(g*4 + r)*nb + i];
+                out->d[r] = in->d;
+                for (int c = 0; c < QK8_0/8; ++c) {
+                    memcpy(out->qs + (c*4 + r)*8, in->qs + c*8, 8);
+                }
+            }
+        }
+    }
+}
+
+#if defined(__AVX2__)
+// multiply int8_t, add results pairwise twice, 8 int32 of 4 products each
+static inline __m256i mul_sum_i8_pairs_i32(const __m256i x, const __m256i y) {
+    const __m256i ax = _mm256_sign_epi8(x, x);
+    const __m256i sy = _mm256_sign_epi8(y, x);
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(ax, sy), _mm256_set1_epi16(1));
+}
+
+// the 8 bytes at p in each 64-bit lane: the same quants of y against the 4 interleaved rows
+static inline __m256i load_y8_x4(const int8_t * p) {
+    int64_t v;
+    memcpy(&v, p, sizeof(v));
+    return _mm256_set1_epi64x(v);
+}
+
+// the pairs of lanes of acc belong to the 4 rows
+static inline void store_rows_x4(float * s, const __m256 acc) {
+    _mm_storeu_ps(s, _mm_hadd_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1)));
+}
+
+static inline __m256 scales_x4(const ggml_fp16_t * d, const float dy) {
+    return _mm256_setr_ps(
+            GGML_FP16_TO_FP32(d[0])*dy, GGML_FP16_TO_FP32(d[0])*dy, GGML_FP16_TO_FP32(d[1])*dy, GGML_FP16_TO_FP32(d[1])*dy,
+            GGML_FP16_TO_FP32(d[2])*dy, GGML_FP16_TO_FP32(d[2])*dy, GGML_FP16_TO_FP32(d[3])*dy, GGML_FP16_TO_FP32(d[3])*dy);
+}
+#elif defined(__ARM_NEON)
+// lanes 0 and 1 sum the products of the first 8 bytes, lanes 2 and 3 those of the last 8, which is what sdot
+// does but not the ggml_vdotq_s32 fallback
+static inline int32x4_t vdotq_halves_s32(const int32x4_t acc, const int8x16_t a, const int8x16_t b) {
+#if defined(__ARM_FEATURE_DOTPROD)
+    return vdotq_s32(acc, a, b);
+#else
+    const int32x4_t p0 = vpaddlq_s16(vmull_s8(vget_low_s8 (a), vget_low_s8 (b)));
+    const int32x4_t p1 = vpaddlq_s16(vmull_s8(vget_high_s8(a), vget_high_s8(b)));
+    return vaddq_s32(acc, vcombine_s32(vpadd_s32(vget_low_s32(p0), vget_high_s32(p0)), vpadd_s32(vget_low_s32(p1), vget_high_s32(p1))));
+#endif
+}
+
+// per row: the sum of its two lanes in p01 and p23
+static inline int32x4_t sum_rows_x4(const int32x4_t p01, const int32x4_t p23) {
+    return vcombine_s32(vpadd_s32(vget_low_s32(p01), vget_high_s32(p01)), vpadd_s32(vget_low_s32(p23), vget_high_s32(p23)));
+}
+
+static inline float32x4_t scales_x4(const ggml_fp16_t * d, const float dy) {
+    const float scales[4] = {
+        GGML_FP16_TO_FP32(d[0])*dy, GGML_FP16_TO_FP32(d[1])*dy, GGML_FP16_TO_FP32(d[2])*dy, GGML_FP16_TO_FP32(d[3])*dy,
+    };
+    return vld1q_f32(scales);
+}
+#endif
+
+void ggml_vec_dot_q4_0_4x4_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q4_0x4 * restrict x = vx;
+    const block_q8_0   * restrict y = vy;
+
+#if defined(__AVX2__)
+    const __m256i m4  = _mm256_set1_epi8(0x0F);
+    const __m256i off = _mm256_set1_epi8(8);
+
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        __m256i sumi = _mm256_setzero_si256();
+
+        for (int c = 0; c < 2; ++c) {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i *)(x[i].qs + 32*c));
+
+            const __m256i lo = _mm256_sub_epi8(_mm256_and_si256(bytes, m4), off);
+            const __m256i hi = _mm256_sub_epi8(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), m4), off);
+
+            sumi = _mm256_add_epi32(sumi, mul_sum_i8_pairs_i32(lo, load_y8_x4(y[i].qs +      8*c)));
+            sumi = _mm256_add_epi32(sumi, mul_sum_i8_pairs_i32(hi, load_y8_x4(y[i].qs + 16 + 8*c)));
+        }
+
+        acc = _mm256_fmadd_ps(scales_x4(x[i].d, GGML_FP16_TO_FP32(y[i].d)), _mm256_cvtepi32_ps(sumi), acc);
+    }
+
+    store_rows_x4(s, acc);
+#elif defined(__ARM_NEON)
+    const uint8x16_t m4b = vdupq_n_u8(0x0F);
+    const int8x16_t  s8b = vdupq_n_s8(0x8);
+
+    float32x4_t sumv = vdupq_n_f32(0.0f);
+
+    for (int i = 0; i < nb; ++i) {
+        int32x4_t p01 = vdupq_n_s32(0);
+        int32x4_t p23 = vdupq_n_s32(0);
+
+        for (int c = 0; c < 2; ++c) {
+            const uint8x16_t v01 = vld1q_u8(x[i].qs + 32*c);
+            const uint8x16_t v23 = vld1q_u8(x[i].qs + 32*c + 16);
+
+            const int8x8_t  yl8 = vld1_s8(y[i].qs +      8*c);
+            const int8x8_t  yh8 = vld1_s8(y[i].qs + 16 + 8*c);
+            const int8x16_t yl  = vcombine_s8(yl8, yl8);
+            const int8x16_t yh  = vcombine_s8(yh8, yh8);
+
+            p01 = vdotq_halves_s32(p01, vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v01, m4b)), s8b), yl);
+            p01 = vdotq_halves_s32(p01, vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v01, 4)),  s8b), yh);
+            p23 = vdotq_halves_s32(p23, vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v23, m4b)), s8b), yl);
+            p23 = vdotq_halves_s32(p23, vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v23, 4)),  s8b), yh);
+        }
+
+        sumv = vmlaq_f32(sumv, vcvtq_f32_s32(sum_rows_x4(p01, p23)), scales_x4(x[i].d, GGML_FP16_TO_FP32(y[i].d)));
+    }
+
+    vst1q_f32(s, sumv);
+#else
+    // scalar
+    float sumf[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    for (int i = 0; i < nb; i++) {
+        int sumi[4] = { 0, 0, 0, 0 };
+
+        for (int c = 0; c < 2; ++c) {
+            for (int r = 0; r < 4; ++r) {
+                for (int k = 0; k < 8; ++k) {
+                    const uint8_t q = x[i].qs[(c*4 + r)*8 + k];
+                    sumi[r] += ((q & 0x0F) - 8)*y[i].qs[8*c + k] + ((q >> 4) - 8)*y[i].qs[16 + 8*c + k];
+                }
+            }
+        }
+
+        for (int r = 0; r < 4; ++r) {
+            sumf[r] += sumi[r]*(GGML_FP16_TO_FP32(x[i].d[r])*GGML_FP16_TO_FP32(y[i].d));
+        }
+    }
+
+    memcpy(s, sumf, sizeof(sumf));
+#endif
+}
+
+void ggml_vec_dot_q8_0_4x4_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+
+    const block_q8_0x4 * restrict x = vx;
+    const block_q8_0   * restrict y = vy;
+
+#if defined(__AVX2__)
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+        __m256i sumi = _mm256_setzero_si256();
+
+        for (int c = 0; c < 4; ++c) {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i *)(x[i].qs + 32*c));
+
+            sumi = _mm256_add_epi32(sumi, mul_sum_i8_pairs_i32(bytes, load_y8_x4(y[i].qs + 8*c)));
+        }
+
+        acc = _mm256_fmadd_ps(scales_x4(x[i].d, GGML_FP16_TO_FP32(y[i].d)), _mm256_cvtepi32_ps(sumi), acc);
+    }
+
+    store_rows_x4(s, acc);
+#elif defined(__ARM_NEON)
+    float32x4_t sumv = vdupq_n_f32(0.0f);
+
+    for (int i = 0; i < nb; ++i) {
+        int32x4_t p01 = vdupq_n_s32(0);
+        int32x4_t p23 = vdupq_n_s32(0);
+
+        for (int c = 0; c < 4; ++c) {
+            const int8x8_t  y8 = vld1_s8(y[i].qs + 8*c);
+            const int8x16_t yc = vcombine_s8(y8, y8);
+
+            p01 = vdotq_halves_s32(p01, vld1q_s8(x[i].qs + 32*c),      yc);
+            p23 = vdotq_halves_s32(p23, vld1q_s8(x[i].qs + 32*c + 16), yc);
+        }
+
+        sumv = vmlaq_f32(sumv, vcvtq_f32_s32(sum_rows_x4(p01, p23)), scales_x4(x[i].d, GGML_FP16_TO_FP32(y[i].d)));
+    }
+
+    vst1q_f32(s, sumv);
+#else
+    // scalar
+    float sumf[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    for (int i = 0; i < nb; i++) {
+        int sumi[4] = { 0, 0, 0, 0 };
+
+        for (int c = 0; c < 4; ++c) {
+            for (int r = 0; r < 4; ++r) {
+                for (int k = 0; k < 8; ++k) {
+                    sumi[r] += x[i].qs[(c*4 + r)*8 + k]*y[i].qs[8*c + k];
+                }
+            }
+        }
+
+        for (int r = 0; r < 4; ++r) {
+            sumf[r] += sumi[r]*(GGML_FP16_TO_FP32(x[i].d[r])*GGML_FP16_TO_FP32(y[i].d));
+        }
+    }
+
+    memcpy(s, sumf, sizeof(sumf));
+#endif
+}
+
 #if QK_K == 256
 void ggml_vec_dot_q2_K_q8_K(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
 
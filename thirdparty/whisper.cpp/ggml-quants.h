@@ -157,6 +157,20 @@ typedef struct {
 } block_q6_K;
 static_assert(sizeof(block_q6_K) == sizeof(ggml_fp16_t) + QK_K / 16 + 3*QK_K/4, "wrong q6_K block size/padding");
 
+// q4_0 and q8_0 with the blocks of 4 consecutive rows interleaved 8 bytes at a time, so one pass over the
+// activations computes 4 rows of the product. Only made from the plain types when a model is loaded.
+typedef struct {
+    ggml_fp16_t d[4];      // deltas of the 4 rows
+    uint8_t qs[QK4_0 * 2]; // 8 bytes of nibbles of each row in turn
+} block_q4_0x4;
+static_assert(sizeof(block_q4_0x4) == 4 * sizeof(block_q4_0), "wrong q4_0x4 block size/padding");
+
+typedef struct {
+    ggml_fp16_t d[4];      // deltas of the 4 rows
+    int8_t  qs[QK8_0 * 4]; // 8 quants of each row in turn
+} block_q8_0x4;
+static_assert(sizeof(block_q8_0x4) == 4 * sizeof(block_q8_0), "wrong q8_0x4 block size/padding");
+
 // This is only used for intermediate quantization and dot products
 typedef struct {
     float   d;              // delta
@@ -222,3 +236,11 @@ void ggml_vec_dot_q3_K_q8_K(int n, float * restrict s, const void * restrict vx,
 void ggml_vec_dot_q4_K_q8_K(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
 void ggml_vec_dot_q5_K_q8_K(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
 void ggml_vec_dot_q6_K_q8_K(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
+
+// Interleaving, nrows is a multiple of 4
+void ggml_repack_q4_0_4x4(const block_q4_0 * restrict x, block_q4_0x4 * restrict y, int nrows, int n_per_row);
+void ggml_repack_q8_0_4x4(const block_q8_0 * restrict x, block_q8_0x4 * restrict y, int nrows, int n_per_row);
+
+// Dot products of the 4 rows interleaved at vx with vy, into s[0..3]
+void ggml_vec_dot_q4_0_4x4_q8_0(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
+void ggml_vec_dot_q8_0_4x4_q8_0(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
@@ -250,6 +250,19 @@ inline static void * ggml_aligned_malloc(size_t size) {
 #include "ggml-opencl.h"
 #endif
 
+#if defined(GGML_USE_CPU_VARIANTS)
+#include "cpu-variants/ggml-cpu-variant.h"
+#if defined(__aarch64__) && defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
 // floating point type used to accumulate sums
 typedef double ggml_float;
 
@@ -393,31 +406,39 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 
 static void ggml_vec_dot_f32(const int n, float * restrict s, const float * restrict x, const float * restrict y);
 static void ggml_vec_dot_f16(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y);
+static void ggml_vec_dot_f16_64 (const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y);
+static void ggml_vec_dot_f16_240(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y);
+static void ggml_vec_dot_f16_384(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y);
 
-static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
+// not const, ggml_init patches the kernels of the ISA level picked at runtime in with GGML_USE_CPU_VARIANTS
+static ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
     [GGML_TYPE_I8] = {
         .type_name                = "i8",
         .blck_size                = 1,
         .type_size                = sizeof(int8_t),
         .is_quantized             = false,
+        .nrows                    = 1,
     },
     [GGML_TYPE_I16] = {
         .type_name                = "i16",
         .blck_size                = 1,
         .type_size                = sizeof(int16_t),
         .is_quantized             = false,
+        .nrows                    = 1,
     },
     [GGML_TYPE_I32] = {
         .type_name                = "i32",
         .blck_size                = 1,
         .type_size                = sizeof(int32_t),
         .is_quantized             = false,
+        .nrows                    = 1,
     },
     [GGML_TYPE_F32] = {
         .type_name                = "f32",
         .blck_size                = 1,
         .type_size                = sizeof(float),
         .is_quantized             = false,
+        .nrows                    = 1,
         .vec_dot                  = (ggml_vec_dot_t) ggml_vec_dot_f32,
         .vec_dot_type             = GGML_TYPE_F32,
     },
@@ -426,17 +447,24 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = 1,
         .type_size                = sizeof(ggml_fp16_t),
         .is_quantized             = false,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) ggml_fp16_to_fp32_row,
         .from_float               = (ggml_from_float_t) ggml_fp32_to_fp16_row,
         .from_float_reference     = (ggml_from_float_t) ggml_fp32_to_fp16_row,
         .vec_dot                  = (ggml_vec_dot_t) ggml_vec_dot_f16,
         .vec_dot_type             = GGML_TYPE_F16,
+        .vec_dot_fixed            = {
+            [GGML_VEC_DOT_SIZE_64]  = (ggml_vec_dot_t) ggml_vec_dot_f16_64,
+            [GGML_VEC_DOT_SIZE_240] = (ggml_vec_dot_t) ggml_vec_dot_f16_240,
+            [GGML_VEC_DOT_SIZE_384] = (ggml_vec_dot_t) ggml_vec_dot_f16_384,
+        },
     },
     [GGML_TYPE_Q4_0] = {
         .type_name                = "q4_0",
         .blck_size                = QK4_0,
         .type_size                = sizeof(block_q4_0),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q4_0,
         .from_float               = quantize_row_q4_0,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q4_0_reference,
@@ -448,6 +476,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK4_1,
         .type_size                = sizeof(block_q4_1),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q4_1,
         .from_float               = quantize_row_q4_1,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q4_1_reference,
@@ -459,6 +488,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = 0,
         .type_size                = 0,
         .is_quantized             = false,
+        .nrows                    = 1,
         .to_float                 = NULL,
         .from_float               = NULL,
         .from_float_reference     = NULL,
@@ -470,6 +500,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = 0,
         .type_size                = 0,
         .is_quantized             = false,
+        .nrows                    = 1,
         .to_float                 = NULL,
         .from_float               = NULL,
         .from_float_reference     = NULL,
@@ -481,6 +512,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK5_0,
         .type_size                = sizeof(block_q5_0),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q5_0,
         .from_float               = quantize_row_q5_0,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q5_0_reference,
@@ -492,6 +524,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK5_1,
         .type_size                = sizeof(block_q5_1),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q5_1,
         .from_float               = quantize_row_q5_1,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q5_1_reference,
@@ -503,6 +536,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK8_0,
         .type_size                = sizeof(block_q8_0),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q8_0,
         .from_float               = quantize_row_q8_0,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q8_0_reference,
@@ -514,6 +548,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK8_1,
         .type_size                = sizeof(block_q8_1),
         .is_quantized             = true,
+        .nrows                    = 1,
         .from_float               = quantize_row_q8_1,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q8_1_reference,
         .vec_dot_type             = GGML_TYPE_Q8_1,
@@ -523,6 +558,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK_K,
         .type_size                = sizeof(block_q2_K),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q2_K,
         .from_float               = quantize_row_q2_K,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q2_K_reference,
@@ -534,6 +570,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK_K,
         .type_size                = sizeof(block_q3_K),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q3_K,
         .from_float               = quantize_row_q3_K,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q3_K_reference,
@@ -545,6 +582,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK_K,
         .type_size                = sizeof(block_q4_K),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q4_K,
         .from_float               = quantize_row_q4_K,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q4_K_reference,
@@ -556,6 +594,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK_K,
         .type_size                = sizeof(block_q5_K),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q5_K,
         .from_float               = quantize_row_q5_K,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q5_K_reference,
@@ -567,6 +606,7 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK_K,
         .type_size                = sizeof(block_q6_K),
         .is_quantized             = true,
+        .nrows                    = 1,
         .to_float                 = (ggml_to_float_t) dequantize_row_q6_K,
         .from_float               = quantize_row_q6_K,
         .from_float_reference     = (ggml_from_float_t) quantize_row_q6_K_reference,
@@ -578,10 +618,166 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK_K,
         .type_size                = sizeof(block_q8_K),
         .is_quantized             = true,
+        .nrows                    = 1,
         .from_float               = quantize_row_q8_K,
-    }
+    },
+    [GGML_TYPE_Q4_0_4X4] = {
+        .type_name                = "q4_0_4x4",
+        .blck_size                = QK4_0,
+        .type_size                = sizeof(block_q4_0),
+        .is_quantized             = true,
+        .nrows                    = 4,
+        .vec_dot                  = ggml_vec_dot_q4_0_4x4_q8_0,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+    },
+    [GGML_TYPE_Q8_0_4X4] = {
+        .type_name                = "q8_0_4x4",
+        .blck_size                = QK8_0,
+        .type_size                = sizeof(block_q8_0),
+        .is_quantized             = true,
+        .nrows                    = 4,
+        .vec_dot                  = ggml_vec_dot_q8_0_4x4_q8_0,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+    },
 };
 
+//
+// runtime ISA dispatch
+//
+
+enum ggml_cpu_level {
+    GGML_CPU_LEVEL_BASELINE,
+    GGML_CPU_LEVEL_DOTPROD, // Armv8.2 dotprod + FP16 arithmetic
+    GGML_CPU_LEVEL_AVX2,    // + FMA, F16C
+    GGML_CPU_LEVEL_AVX512,  // F, BW, DQ, VL
+};
+
+static enum ggml_cpu_level ggml_cpu_level = GGML_CPU_LEVEL_BASELINE;
+
+#if defined(GGML_USE_CPU_VARIANTS) && defined(__aarch64__)
+
+#if defined(__APPLE__)
+
+static bool ggml_sysctl_flag(const char * name) {
+    int value = 0;
+    size_t size = sizeof(value);
+    return sysctlbyname(name, &value, &size, NULL, 0) == 0 && value != 0;
+}
+
+static enum ggml_cpu_level ggml_cpu_detect_level(void) {
+    // the FEAT_ names are there since iOS 15 and macOS 12, older systems keep the baseline
+    if (ggml_sysctl_flag("hw.optional.arm.FEAT_DotProd") && ggml_sysctl_flag("hw.optional.arm.FEAT_FP16")) {
+        return GGML_CPU_LEVEL_DOTPROD;
+    }
+    return GGML_CPU_LEVEL_BASELINE;
+}
+
+#else
+
+#ifndef HWCAP_ASIMDHP
+#define HWCAP_ASIMDHP (1 << 10)
+#endif
+#ifndef HWCAP_ASIMDDP
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+
+static enum ggml_cpu_level ggml_cpu_detect_level(void) {
+    const unsigned long hwcap = getauxval(AT_HWCAP);
+    if ((hwcap & HWCAP_ASIMDDP) && (hwcap & HWCAP_ASIMDHP)) {
+        return GGML_CPU_LEVEL_DOTPROD;
+    }
+    return GGML_CPU_LEVEL_BASELINE;
+}
+
+#endif
+
+#elif defined(GGML_USE_CPU_VARIANTS)
+
+static void ggml_cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int) leaf, (int) subleaf);
+    for (int i = 0; i < 4; ++i) {
+        regs[i] = (unsigned int) r[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// the CPU may support AVX while the OS does not save the registers, check XCR0 as well
+static uint64_t ggml_xgetbv(void) {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax;
+    uint32_t edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t) edx << 32) | eax;
+#endif
+}
+
+static enum ggml_cpu_level ggml_cpu_detect_level(void) {
+    unsigned int regs[4];
+
+    ggml_cpuid(0, 0, regs);
+    if (regs[0] < 7) {
+        return GGML_CPU_LEVEL_BASELINE;
+    }
+
+    ggml_cpuid(1, 0, regs);
+    const unsigned int ecx1 = regs[2];
+    const bool osxsave = ecx1 & (1u << 27);
+    if (!osxsave || !(ecx1 & (1u << 28)) || !(ecx1 & (1u << 12)) || !(ecx1 & (1u << 29))) { // AVX, FMA, F16C
+        return GGML_CPU_LEVEL_BASELINE;
+    }
+
+    const uint64_t xcr0 = ggml_xgetbv();
+    if ((xcr0 & 0x6) != 0x6) { // XMM and YMM state
+        return GGML_CPU_LEVEL_BASELINE;
+    }
+
+    ggml_cpuid(7, 0, regs);
+    const unsigned int ebx7 = regs[1];
+    if (!(ebx7 & (1u << 5))) { // AVX2
+        return GGML_CPU_LEVEL_BASELINE;
+    }
+
+    const unsigned int avx512 = (1u << 16) | (1u << 17) | (1u << 30) | (1u << 31); // F, DQ, BW, VL
+    if ((ebx7 & avx512) == avx512 && (xcr0 & 0xe0) == 0xe0) { // opmask and ZMM state
+        return GGML_CPU_LEVEL_AVX512;
+    }
+
+    return GGML_CPU_LEVEL_AVX2;
+}
+
+#endif
+
+static void ggml_cpu_init_variants(void) {
+#if defined(GGML_USE_CPU_VARIANTS)
+    ggml_cpu_level = ggml_cpu_detect_level();
+
+    switch (ggml_cpu_level) {
+#if defined(__aarch64__)
+        case GGML_CPU_LEVEL_DOTPROD:
+            ggml_cpu_variant_init_dotprod(type_traits);
+            break;
+#else
+        case GGML_CPU_LEVEL_AVX512:
+            ggml_cpu_variant_init_avx512(type_traits);
+            break;
+        case GGML_CPU_LEVEL_AVX2:
+            ggml_cpu_variant_init_avx2(type_traits);
+            break;
+#endif
+        default:
+            break;
+    }
+
+    GGML_PRINT_DEBUG("%s: using ISA level %d\n", __func__, (int) ggml_cpu_level);
+#endif
+}
+
 // For internal test use
 ggml_type_traits_t ggml_internal_get_type_traits(enum ggml_type type) {
     GGML_ASSERT(type < GGML_TYPE_COUNT);
@@ -1179,7 +1375,9 @@ static void ggml_vec_dot_f32(const int n, float * restrict s, const float * rest
     *s = sumf;
 }
 
-static void ggml_vec_dot_f16(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) {
+// the body of ggml_vec_dot_f16, the fixed size kernels inline it with a constant n so the loop is unrolled completely
+// and the leftovers go away
+GGML_ALWAYS_INLINE static void ggml_vec_dot_f16_n(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) {
     ggml_float sumf = 0.0;
 
 #if defined(GGML_SIMD)
@@ -1215,9 +1413,26 @@ static void ggml_vec_dot_f16(const int n, float * restrict s, ggml_fp16_t * rest
     *s = sumf;
 }
 
+static void ggml_vec_dot_f16(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) {
+    ggml_vec_dot_f16_n(n, s, x, y);
+}
+
+#define GGML_VEC_DOT_F16_FIXED(N) \
+    static void ggml_vec_dot_f16_ ## N(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y) { \
+        assert(n == N); \
+        UNUSED(n); \
+        ggml_vec_dot_f16_n(N, s, x, y); \
+    }
+
+GGML_VEC_DOT_F16_FIXED(64)
+GGML_VEC_DOT_F16_FIXED(240)
+GGML_VEC_DOT_F16_FIXED(384)
+
+#undef GGML_VEC_DOT_F16_FIXED
+
 // compute GGML_VEC_DOT_UNROLL dot products at once
 // xs - x row stride in bytes
-inline static void ggml_vec_dot_f16_unroll(const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y) {
+GGML_ALWAYS_INLINE static void ggml_vec_dot_f16_unroll(const int n, const int xs, float * restrict s, void * restrict xv, ggml_fp16_t * restrict y) {
     ggml_float sumf[GGML_VEC_DOT_UNROLL] = { 0.0 };
 
     ggml_fp16_t * restrict x[GGML_VEC_DOT_UNROLL];
@@ -1619,6 +1834,8 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "CLAMP",
     "CONV_TRANSPOSE_1D",
     "IM2COL",
+    "CONV_1D_GELU",
+    "LOG_MEL",
     "CONV_TRANSPOSE_2D",
     "POOL_1D",
     "POOL_2D",
@@ -1652,7 +1869,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "CROSS_ENTROPY_LOSS_BACK",
 };
 
-static_assert(GGML_OP_COUNT == 72, "GGML_OP_COUNT != 72");
+static_assert(GGML_OP_COUNT == 74, "GGML_OP_COUNT != 74");
 
 static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "none",
@@ -1705,6 +1922,8 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "clamp(x)",
     "conv_transpose_1d(x)",
     "im2col(x)",
+    "conv_1d_gelu(x)",
+    "log_mel(x)",
     "conv_transpose_2d(x)",
     "pool_1d(x)",
     "pool_2d(x)",
@@ -1738,7 +1957,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "cross_entropy_loss_back(x,y)",
 };
 
-static_assert(GGML_OP_COUNT == 72, "GGML_OP_COUNT != 72");
+static_assert(GGML_OP_COUNT == 74, "GGML_OP_COUNT != 74");
 
 static_assert(GGML_OP_POOL_COUNT == 2, "GGML_OP_POOL_COUNT != 2");
 
@@ -1789,12 +2008,14 @@ static void ggml_setup_op_has_task_pass(void) {
         p[GGML_OP_FLASH_ATTN_BACK        ] = true;
         p[GGML_OP_CROSS_ENTROPY_LOSS     ] = true;
         p[GGML_OP_ADD_REL_POS            ] = true;
+        p[GGML_OP_LOG_MEL                ] = true;
     }
 
     {   // FINALIZE
         bool * p = GGML_OP_HAS_FINALIZE;
 
         p[GGML_OP_CROSS_ENTROPY_LOSS     ] = true;
+        p[GGML_OP_LOG_MEL                ] = true;
     }
 }
 
@@ -2268,6 +2489,8 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
 
         ggml_setup_op_has_task_pass();
 
+        ggml_cpu_init_variants();
+
         is_first_call = false;
     }
 
@@ -4061,10 +4284,11 @@ struct ggml_tensor * ggml_group_norm_inplace(
 
 // ggml_mul_mat
 
-struct ggml_tensor * ggml_mul_mat(
+static struct ggml_tensor * ggml_mul_mat_impl(
         struct ggml_context * ctx,
         struct ggml_tensor  * a,
-        struct ggml_tensor  * b) {
+        struct ggml_tensor  * b,
+        enum   ggml_type      type) {
     GGML_ASSERT(ggml_can_mul_mat(a, b));
     GGML_ASSERT(!ggml_is_transposed(a));
 
@@ -4075,7 +4299,7 @@ struct ggml_tensor * ggml_mul_mat(
     }
 
     const int64_t ne[4] = { a->ne[1], b->ne[1], b->ne[2], b->ne[3] };
-    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, ne);
+    struct ggml_tensor * result = ggml_new_tensor(ctx, type, 4, ne);
 
     result->op   = GGML_OP_MUL_MAT;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
@@ -4085,6 +4309,22 @@ struct ggml_tensor * ggml_mul_mat(
     return result;
 }
 
+struct ggml_tensor * ggml_mul_mat(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    return ggml_mul_mat_impl(ctx, a, b, GGML_TYPE_F32);
+}
+
+struct ggml_tensor * ggml_mul_mat_f16(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    GGML_ASSERT(!a->grad && !b->grad); // TODO: implement backward
+
+    return ggml_mul_mat_impl(ctx, a, b, GGML_TYPE_F16);
+}
+
 void ggml_mul_mat_set_prec(
         struct ggml_tensor * a,
         enum ggml_prec       prec) {
@@ -4093,6 +4333,19 @@ void ggml_mul_mat_set_prec(
     ggml_set_op_params_i32(a, 0, prec_i32);
 }
 
+void ggml_mul_mat_set_offload(
+        struct ggml_tensor * a,
+        bool                 offload) {
+    GGML_ASSERT(a->op == GGML_OP_MUL_MAT);
+
+    // op_params[0] is the precision
+    ggml_set_op_params_i32(a, 1, offload ? 0 : 1);
+}
+
+bool ggml_mul_mat_get_offload(const struct ggml_tensor * a) {
+    return a->op != GGML_OP_MUL_MAT || ggml_get_op_params_i32(a, 1) == 0;
+}
+
 // ggml_mul_mat_id
 
 struct ggml_tensor * ggml_mul_mat_id(
@@ -5365,6 +5618,74 @@ struct ggml_tensor * ggml_im2col(
     return result;
 }
 
+// ggml_conv_1d_ph_gelu
+
+struct ggml_tensor * ggml_conv_1d_ph_gelu(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        int                   s) {
+    GGML_ASSERT(a->ne[1] == b->ne[1]);
+    GGML_ASSERT(b->ne[2] == 1 && b->ne[3] == 1);
+    GGML_ASSERT(ggml_nelements(c) == a->ne[2]);
+    bool is_node = false;
+
+    if (a->grad || b->grad || c->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    const int p = a->ne[0] / 2;
+
+    const int64_t ne[2] = { ggml_calc_conv_output_size(b->ne[0], a->ne[0], s, p, 1), a->ne[2] };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 2, ne);
+
+    int32_t params[] = { s, p };
+    ggml_set_op_params(result, params, sizeof(params));
+
+    result->op     = GGML_OP_CONV_1D_GELU;
+    result->grad   = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = a;
+    result->src[1] = b;
+    result->src[2] = c;
+
+    return result;
+}
+
+// ggml_log_mel
+
+struct ggml_tensor * ggml_log_mel(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        int                   frame_step,
+        int                   n_frames) {
+    GGML_ASSERT(a->type == GGML_TYPE_F32 && ggml_is_vector(a) && ggml_is_contiguous(a));
+    GGML_ASSERT(c->type == GGML_TYPE_F32 && ggml_is_vector(c) && ggml_is_contiguous(c));
+    GGML_ASSERT(b->type == GGML_TYPE_F32 && ggml_is_contiguous(b));
+    GGML_ASSERT(b->ne[0] == c->ne[0]/2 + 1);
+    GGML_ASSERT(frame_step > 0 && n_frames > 0);
+
+    if (a->grad || b->grad || c->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+    }
+
+    struct ggml_tensor * result = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_frames, b->ne[1]);
+
+    int32_t params[] = { frame_step };
+    ggml_set_op_params(result, params, sizeof(params));
+
+    result->op     = GGML_OP_LOG_MEL;
+    result->grad   = NULL;
+    result->src[0] = a;
+    result->src[1] = b;
+    result->src[2] = c;
+
+    return result;
+}
+
 // a: [OC，IC, KH, KW]
 // b: [N, IC, IH, IW]
 // result: [N, OC, OH, OW]
@@ -6387,6 +6708,31 @@ void ggml_set_param(
     ggml_format_name(tensor->grad, "%s (grad)", tensor->name);
 }
 
+struct ggml_compute_state_shared {
+    const struct ggml_cgraph * cgraph;
+    const struct ggml_cplan  * cplan;
+
+    int64_t perf_node_start_cycles;
+    int64_t perf_node_start_time_us;
+
+    const int n_threads;
+
+    // synchronization primitives
+    atomic_int n_active; // num active threads
+    atomic_int node_n;   // active graph node
+
+    atomic_int current_chunk; // next chunk of the active node, for the ops that split their work dynamically
+
+    bool (*abort_callback)(void * data); // abort ggml_graph_compute when true
+    void * abort_callback_data;
+};
+
+// the next chunk of the work of the node for the thread of params, the first nth chunks are taken by the
+// threads in order without it
+static inline int ggml_compute_next_chunk(const struct ggml_compute_params * params) {
+    return atomic_fetch_add(&params->shared->current_chunk, 1);
+}
+
 // ggml_compute_forward_dup
 
 static void ggml_compute_forward_dup_same_cont(
@@ -7195,12 +7541,15 @@ static void ggml_compute_forward_add_f32(
     }
 }
 
+// the F16 rows of the element-wise ops below go through F32 rows of the work buffer, converted by the F16 type
+// traits, which the CPU variants replace with F16C or NEON kernels on the CPUs that have them
+
 static void ggml_compute_forward_add_f16_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
-    GGML_ASSERT(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(ggml_can_repeat(src1, src0) && ggml_are_same_shape(src0, dst));
 
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
@@ -7226,6 +7575,12 @@ static void ggml_compute_forward_add_f16_f32(
 
     GGML_ASSERT(nb00 == sizeof(ggml_fp16_t));
 
+    // src1 is not contiguous
+    GGML_ASSERT(nb10 == sizeof(float));
+
+    ggml_to_float_t   const to_float   = type_traits[GGML_TYPE_F16].to_float;
+    ggml_from_float_t const from_float = type_traits[GGML_TYPE_F16].from_float;
+
     // rows per thread
     const int dr = (nr + nth - 1)/nth;
 
@@ -7233,43 +7588,34 @@ static void ggml_compute_forward_add_f16_f32(
     const int ir0 = dr*ith;
     const int ir1 = MIN(ir0 + dr, nr);
 
-    if (nb10 == sizeof(float)) {
+    float * wdata = (float *) params->wdata + 2*(ne00 + CACHE_LINE_SIZE_F32)*ith;
+
+    for (int ir = ir0; ir < ir1; ++ir) {
+        // src1 is broadcastable across src0 and dst in i1, i2, i3
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const int64_t i13 = i03 % ne13;
+        const int64_t i12 = i02 % ne12;
+        const int64_t i11 = i01 % ne11;
+        const int64_t nr0 = ne00 / ne10;
+
+        char        * dst_ptr  = (char *)        dst->data  + i03*nb3  + i02*nb2  + i01*nb1;
+        ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01);
+        float       * src1_ptr = (float *)       ((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11);
+
+        // an F32 dst is summed into directly
+        float * row = dst->type == GGML_TYPE_F32 ? (float *) dst_ptr : wdata;
+
+        to_float(src0_ptr, row, ne00);
+        for (int64_t r = 0; r < nr0; ++r) {
+            ggml_vec_acc_f32(ne10, row + r*ne10, src1_ptr);
+        }
         if (dst->type == GGML_TYPE_F16) {
-            for (int ir = ir0; ir < ir1; ++ir) {
-                // src0, src1 and dst are same shape => same indices
-                const int i3 = ir/(ne2*ne1);
-                const int i2 = (ir - i3*ne2*ne1)/ne1;
-                const int i1 = (ir - i3*ne2*ne1 - i2*ne1);
-
-                ggml_fp16_t * dst_ptr  = (ggml_fp16_t *) ((char *) dst->data  + i3*nb3  + i2*nb2  + i1*nb1);
-                ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01);
-                float *       src1_ptr = (float *)       ((char *) src1->data + i3*nb13 + i2*nb12 + i1*nb11);
-
-                for (int i = 0; i < ne0; i++) {
-                    dst_ptr[i] = GGML_FP32_TO_FP16(GGML_FP16_TO_FP32(src0_ptr[i]) + src1_ptr[i]);
-                }
-            }
-        } else {
-            for (int ir = ir0; ir < ir1; ++ir) {
-                // src0, src1 and dst are same shape => same indices
-                const int i3 = ir/(ne2*ne1);
-                const int i2 = (ir - i3*ne2*ne1)/ne1;
-                const int i1 = (ir - i3*ne2*ne1 - i2*ne1);
-
-                float *       dst_ptr  = (float *)       ((char *) dst->data  + i3*nb3  + i2*nb2  + i1*nb1);
-                ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01);
-                float *       src1_ptr = (float *)       ((char *) src1->data + i3*nb13 + i2*nb12 + i1*nb11);
-
-                for (int i = 0; i < ne0; i++) {
-                    dst_ptr[i] = GGML_FP16_TO_FP32(src0_ptr[i]) + src1_ptr[i];
-                }
-            }
+            from_float(row, dst_ptr, ne00);
         }
     }
-    else {
-        // src1 is not contiguous
-        GGML_ASSERT(false);
-    }
 }
 
 static void ggml_compute_forward_add_f16_f16(
@@ -7297,6 +7643,12 @@ static void ggml_compute_forward_add_f16_f16(
     GGML_ASSERT( nb0 == sizeof(ggml_fp16_t));
     GGML_ASSERT(nb00 == sizeof(ggml_fp16_t));
 
+    // src1 is not contiguous
+    GGML_ASSERT(nb10 == sizeof(ggml_fp16_t));
+
+    ggml_to_float_t   const to_float   = type_traits[GGML_TYPE_F16].to_float;
+    ggml_from_float_t const from_float = type_traits[GGML_TYPE_F16].from_float;
+
     // rows per thread
     const int dr = (nr + nth - 1)/nth;
 
@@ -7304,25 +7656,23 @@ static void ggml_compute_forward_add_f16_f16(
     const int ir0 = dr*ith;
     const int ir1 = MIN(ir0 + dr, nr);
 
-    if (nb10 == sizeof(ggml_fp16_t)) {
-        for (int ir = ir0; ir < ir1; ++ir) {
-            // src0, src1 and dst are same shape => same indices
-            const int i3 = ir/(ne2*ne1);
-            const int i2 = (ir - i3*ne2*ne1)/ne1;
-            const int i1 = (ir - i3*ne2*ne1 - i2*ne1);
+    float * wdata0 = (float *) params->wdata + 2*(ne00 + CACHE_LINE_SIZE_F32)*ith;
+    float * wdata1 = wdata0 + ne00 + CACHE_LINE_SIZE_F32;
 
-            ggml_fp16_t * dst_ptr  = (ggml_fp16_t *) ((char *) dst->data  + i3*nb3  + i2*nb2  + i1*nb1);
-            ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01);
-            ggml_fp16_t * src1_ptr = (ggml_fp16_t *) ((char *) src1->data + i3*nb13 + i2*nb12 + i1*nb11);
+    for (int ir = ir0; ir < ir1; ++ir) {
+        // src0, src1 and dst are same shape => same indices
+        const int i3 = ir/(ne2*ne1);
+        const int i2 = (ir - i3*ne2*ne1)/ne1;
+        const int i1 = (ir - i3*ne2*ne1 - i2*ne1);
 
-            for (int i = 0; i < ne0; i++) {
-                dst_ptr[i] = GGML_FP32_TO_FP16(GGML_FP16_TO_FP32(src0_ptr[i]) + GGML_FP16_TO_FP32(src1_ptr[i]));
-            }
-        }
-    }
-    else {
-        // src1 is not contiguous
-        GGML_ASSERT(false);
+        ggml_fp16_t * dst_ptr  = (ggml_fp16_t *) ((char *) dst->data  + i3*nb3  + i2*nb2  + i1*nb1);
+        ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01);
+        ggml_fp16_t * src1_ptr = (ggml_fp16_t *) ((char *) src1->data + i3*nb13 + i2*nb12 + i1*nb11);
+
+        to_float(src0_ptr, wdata0, ne00);
+        to_float(src1_ptr, wdata1, ne00);
+        ggml_vec_acc_f32(ne00, wdata0, wdata1);
+        from_float(wdata0, dst_ptr, ne00);
     }
 }
 
@@ -7985,6 +8335,59 @@ static void ggml_compute_forward_mul_f32(
     }
 }
 
+static void ggml_compute_forward_mul_f16_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_can_repeat(src1, src0) && ggml_are_same_shape(src0, dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t nr = ggml_nrows(src0);
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    GGML_ASSERT(dst->type == GGML_TYPE_F16);
+
+    GGML_ASSERT( nb0 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nb00 == sizeof(ggml_fp16_t));
+
+    // src1 is not contiguous
+    GGML_ASSERT(nb10 == sizeof(float));
+
+    ggml_to_float_t   const to_float   = type_traits[GGML_TYPE_F16].to_float;
+    ggml_from_float_t const from_float = type_traits[GGML_TYPE_F16].from_float;
+
+    float * wdata = (float *) params->wdata + (ne00 + CACHE_LINE_SIZE_F32)*ith;
+
+    for (int64_t ir = ith; ir < nr; ir += nth) {
+        // src0 and dst are same shape => same indices
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const int64_t i13 = i03 % ne13;
+        const int64_t i12 = i02 % ne12;
+        const int64_t i11 = i01 % ne11;
+        const int64_t nr0 = ne00 / ne10;
+
+        ggml_fp16_t * dst_ptr  = (ggml_fp16_t *) ((char *) dst->data  + i03*nb3  + i02*nb2  + i01*nb1 );
+        ggml_fp16_t * src0_ptr = (ggml_fp16_t *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01);
+        float       * src1_ptr = (float *)       ((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11);
+
+        to_float(src0_ptr, wdata, ne00);
+        for (int64_t r = 0 ; r < nr0; ++r) {
+            ggml_vec_mul_f32(ne10, wdata + r*ne10, wdata + r*ne10, src1_ptr);
+        }
+        from_float(wdata, dst_ptr, ne00);
+    }
+}
+
 static void ggml_compute_forward_mul(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
@@ -7997,6 +8400,10 @@ static void ggml_compute_forward_mul(
             {
                 ggml_compute_forward_mul_f32(params, src0, src1, dst);
             } break;
+        case GGML_TYPE_F16:
+            {
+                ggml_compute_forward_mul_f16_f32(params, src0, src1, dst);
+            } break;
         default:
             {
                 GGML_ASSERT(false);
@@ -9054,18 +9461,56 @@ static void ggml_compute_forward_gelu_f32(
     }
 }
 
-static void ggml_compute_forward_gelu(
+// the same table ggml_vec_gelu_f32 reads with GGML_GELU_FP16, without the conversions
+static void ggml_compute_forward_gelu_f16(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         struct ggml_tensor * dst) {
-    switch (src0->type) {
-        case GGML_TYPE_F32:
-            {
-                ggml_compute_forward_gelu_f32(params, src0, dst);
-            } break;
-        default:
-            {
-                GGML_ASSERT(false);
+    GGML_ASSERT(ggml_is_contiguous_except_dim_1(src0));
+    GGML_ASSERT(ggml_is_contiguous_except_dim_1(dst));
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+    GGML_ASSERT(dst->type == GGML_TYPE_F16);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nc = src0->ne[0];
+    const int nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int i1 = ir0; i1 < ir1; i1++) {
+        ggml_vec_gelu_f16(nc,
+                (ggml_fp16_t *) ((char *) dst->data  + i1*( dst->nb[1])),
+                (ggml_fp16_t *) ((char *) src0->data + i1*(src0->nb[1])));
+    }
+}
+
+static void ggml_compute_forward_gelu(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_gelu_f32(params, src0, dst);
+            } break;
+        case GGML_TYPE_F16:
+            {
+                ggml_compute_forward_gelu_f16(params, src0, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
             } break;
     }
 }
@@ -9351,6 +9796,65 @@ static void ggml_compute_forward_norm_f32(
     }
 }
 
+// the row in F32 in the work buffer, see ggml_compute_forward_add_f16_f32
+static void ggml_compute_forward_norm_f16(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, dst));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    GGML_ASSERT(src0->nb[0] == sizeof(ggml_fp16_t));
+    GGML_ASSERT(dst->type == GGML_TYPE_F16);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    float eps;
+    memcpy(&eps, dst->op_params, sizeof(float));
+
+    GGML_ASSERT(eps > 0.0f);
+
+    ggml_to_float_t   const to_float   = type_traits[GGML_TYPE_F16].to_float;
+    ggml_from_float_t const from_float = type_traits[GGML_TYPE_F16].from_float;
+
+    float * y = (float *) params->wdata + (ne00 + CACHE_LINE_SIZE_F32)*ith;
+
+    for (int64_t i03 = 0; i03 < ne03; i03++) {
+        for (int64_t i02 = 0; i02 < ne02; i02++) {
+            for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
+                to_float((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03, y, ne00);
+
+                ggml_float sum = 0.0;
+                for (int64_t i00 = 0; i00 < ne00; i00++) {
+                    sum += (ggml_float)y[i00];
+                }
+
+                float mean = sum/ne00;
+
+                ggml_float sum2 = 0.0;
+                for (int64_t i00 = 0; i00 < ne00; i00++) {
+                    float v = y[i00] - mean;
+                    y[i00] = v;
+                    sum2 += (ggml_float)(v*v);
+                }
+
+                float variance = sum2/ne00;
+                const float scale = 1.0f/sqrtf(variance + eps);
+
+                ggml_vec_scale_f32(ne00, y, scale);
+
+                from_float(y, (char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3, ne00);
+            }
+        }
+    }
+}
+
 static void ggml_compute_forward_norm(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
@@ -9360,6 +9864,10 @@ static void ggml_compute_forward_norm(
             {
                 ggml_compute_forward_norm_f32(params, src0, dst);
             } break;
+        case GGML_TYPE_F16:
+            {
+                ggml_compute_forward_norm_f16(params, src0, dst);
+            } break;
         default:
             {
                 GGML_ASSERT(false);
@@ -9719,11 +10227,14 @@ static bool ggml_compute_forward_mul_mat_use_blas(
     // NOTE: with GGML_OP_MUL_MAT_ID we don't want to go through the BLAS branch because it will dequantize (to_float)
     //       all the experts for each batch element and the processing would become incredibly slow
     // TODO: find the optimal values for these
+    // NOTE: repacked types have no to_float, their rows only make sense to their own vec_dot
     if (dst->op != GGML_OP_MUL_MAT_ID &&
+        type_traits[src0->type].nrows == 1 &&
         ggml_is_contiguous(src0) &&
         ggml_is_contiguous(src1) &&
       //src0->type == GGML_TYPE_F32 &&
         src1->type == GGML_TYPE_F32 &&
+        dst->type == GGML_TYPE_F32 &&
         (ne0 >= 32 && ne1 >= 32 && ne10 >= 32)) {
 
         /*printf("BLAS: %d %d %d %d %d\n", ne0, ne1, ne10, ne00, ne01);*/
@@ -9734,6 +10245,105 @@ static bool ggml_compute_forward_mul_mat_use_blas(
 }
 #endif
 
+static const int64_t ggml_vec_dot_fixed_sizes[GGML_VEC_DOT_SIZE_COUNT] = {
+    [GGML_VEC_DOT_SIZE_64]  = 64,
+    [GGML_VEC_DOT_SIZE_240] = 240,
+    [GGML_VEC_DOT_SIZE_384] = 384,
+};
+
+// the dot product of rows of n elements of type, one of vec_dot_fixed when n is one of their sizes
+static ggml_vec_dot_t ggml_get_vec_dot(enum ggml_type type, int64_t n) {
+    for (int i = 0; i < GGML_VEC_DOT_SIZE_COUNT; ++i) {
+        if (n == ggml_vec_dot_fixed_sizes[i] && type_traits[type].vec_dot_fixed[i] != NULL) {
+            return type_traits[type].vec_dot_fixed[i];
+        }
+    }
+    return type_traits[type].vec_dot;
+}
+
+// the mul_mat of src0 rows [ir0_start, ir0_end) and src1 rows [ir1_start, ir1_end), after GGML_TASK_INIT
+static void ggml_compute_forward_mul_mat_one_chunk(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst,
+        const int64_t ir0_start,
+        const int64_t ir0_end,
+        const int64_t ir1_start,
+        const int64_t ir1_end) {
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const enum ggml_type type = src0->type;
+
+    const bool src1_cont = ggml_is_contiguous(src1);
+
+    ggml_vec_dot_t const vec_dot      = ggml_get_vec_dot(type, ne00);
+    enum ggml_type const vec_dot_type = type_traits[type].vec_dot_type;
+    int64_t        const nrows_dot    = type_traits[type].nrows; // src0 rows per vec_dot call
+
+    // broadcast factors
+    const int64_t r2 = ne12/ne02;
+    const int64_t r3 = ne13/ne03;
+
+    const void * wdata    = (src1->type == vec_dot_type) ? src1->data : params->wdata;
+    const size_t row_size = ggml_row_size(vec_dot_type, ne10);
+
+    // block-tiling attempt
+    const int64_t blck_0 = 16;
+    const int64_t blck_1 = 16;
+
+    // attempt to reduce false-sharing (does not seem to make a difference)
+    float tmp[16];
+
+    // an F16 dst gets the F32 sums of tmp converted
+    ggml_from_float_t const from_float_to_dst = dst->type == GGML_TYPE_F16 ? type_traits[GGML_TYPE_F16].from_float : NULL;
+
+    for (int64_t iir1 = ir1_start; iir1 < ir1_end; iir1 += blck_1) {
+        for (int64_t iir0 = ir0_start; iir0 < ir0_end; iir0 += blck_0) {
+            for (int64_t ir1 = iir1; ir1 < iir1 + blck_1 && ir1 < ir1_end; ++ir1) {
+                const int64_t i13 = (ir1/(ne12*ne1));
+                const int64_t i12 = (ir1 - i13*ne12*ne1)/ne1;
+                const int64_t i11 = (ir1 - i13*ne12*ne1 - i12*ne1);
+
+                // broadcast src0 into src1
+                const int64_t i03 = i13/r3;
+                const int64_t i02 = i12/r2;
+
+                const int64_t i1 = i11;
+                const int64_t i2 = i12;
+                const int64_t i3 = i13;
+
+                const char * src0_row = (const char *) src0->data + (0 + i02*nb02 + i03*nb03);
+
+                // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
+                //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
+                //       the original src1 data pointer, so we should index using the indices directly
+                // TODO: this is a bit of a hack, we should probably have a better way to handle this
+                const char * src1_col = (const char *) wdata +
+                    (src1_cont || src1->type != vec_dot_type
+                     ? (i11      + i12*ne11 + i13*ne12*ne11)*row_size
+                     : (i11*nb11 + i12*nb12 + i13*nb13));
+
+                char * dst_col = (char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3);
+
+                //for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir0_end; ++ir0) {
+                //    vec_dot(ne00, &dst_col[ir0], src0_row + ir0*nb01, src1_col);
+                //}
+
+                // a vec_dot of nrows_dot rows writes that many results, blck_0 and dr0 are multiples of it
+                for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir0_end; ir0 += nrows_dot) {
+                    vec_dot(ne00, &tmp[ir0 - iir0], src0_row + ir0*nb01, src1_col);
+                }
+                if (from_float_to_dst) {
+                    from_float_to_dst(tmp, dst_col + iir0*nb0, MIN(iir0 + blck_0, ir0_end) - iir0);
+                } else {
+                    memcpy(dst_col + iir0*nb0, tmp, (MIN(iir0 + blck_0, ir0_end) - iir0)*sizeof(float));
+                }
+            }
+        }
+    }
+}
+
 static void ggml_compute_forward_mul_mat(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
@@ -9749,11 +10359,9 @@ static void ggml_compute_forward_mul_mat(
 
     const enum ggml_type type = src0->type;
 
-    const bool src1_cont = ggml_is_contiguous(src1);
-
-    ggml_vec_dot_t    const vec_dot               = type_traits[type].vec_dot;
     enum ggml_type    const vec_dot_type          = type_traits[type].vec_dot_type;
     ggml_from_float_t const from_float_to_vec_dot = type_traits[vec_dot_type].from_float;
+    int64_t           const nrows_dot             = type_traits[type].nrows; // src0 rows per vec_dot call
 
     GGML_ASSERT(ne0 == ne01);
     GGML_ASSERT(ne1 == ne11);
@@ -9764,21 +10372,18 @@ static void ggml_compute_forward_mul_mat(
     GGML_ASSERT(nb00 == ggml_type_size(type));
     GGML_ASSERT(nb10 == ggml_type_size(src1->type));
 
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
+    // dst cannot be transposed or permuted, ggml_mul_mat_f16 makes it F16
+    GGML_ASSERT(dst->type == GGML_TYPE_F32 || dst->type == GGML_TYPE_F16);
+    GGML_ASSERT(nb0 == ggml_type_size(dst->type));
     GGML_ASSERT(nb0 <= nb1);
     GGML_ASSERT(nb1 <= nb2);
     GGML_ASSERT(nb2 <= nb3);
 
-    // broadcast factors
-    const int64_t r2 = ne12/ne02;
-    const int64_t r3 = ne13/ne03;
-
     // nb01 >= nb00 - src0 is not transposed
     //   compute by src0 rows
 
 #if defined(GGML_USE_CLBLAST)
-    if (ggml_cl_can_mul_mat(src0, src1, dst)) {
+    if (nrows_dot == 1 && ggml_cl_can_mul_mat(src0, src1, dst)) {
         if (params->ith == 0 && params->type == GGML_TASK_COMPUTE) {
             ggml_cl_mul_mat(src0, src1, dst, params->wdata, params->wsize);
         }
@@ -9800,6 +10405,10 @@ static void ggml_compute_forward_mul_mat(
             return;
         }
 
+        // broadcast factors
+        const int64_t r2 = ne12/ne02;
+        const int64_t r3 = ne13/ne03;
+
         for (int64_t i13 = 0; i13 < ne13; i13++) {
             for (int64_t i12 = 0; i12 < ne12; i12++) {
                 // broadcast src0 into src1 across 2nd,3rd dimension
@@ -9863,87 +10472,54 @@ static void ggml_compute_forward_mul_mat(
         return;
     }
 
-    const void * wdata    = (src1->type == vec_dot_type) ? src1->data : params->wdata;
-    const size_t row_size = ggml_row_size(vec_dot_type, ne10);
-
     const int64_t nr0 = ne01;          // src0 rows
     const int64_t nr1 = ne1*ne12*ne13; // src1 rows
 
     //printf("nr0 = %lld, nr1 = %lld\n", nr0, nr1);
 
-    // distribute the thread work across the inner or outer loop based on which one is larger
-
-    const int64_t nth0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
-    const int64_t nth1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
-
-    const int64_t ith0 = ith % nth0;
-    const int64_t ith1 = ith / nth0;
-
-    const int64_t dr0 = (nr0 + nth0 - 1)/nth0;
-    const int64_t dr1 = (nr1 + nth1 - 1)/nth1;
-
-    const int64_t ir010 = dr0*ith0;
-    const int64_t ir011 = MIN(ir010 + dr0, nr0);
-
-    const int64_t ir110 = dr1*ith1;
-    const int64_t ir111 = MIN(ir110 + dr1, nr1);
-
-    //printf("ir010 = %6lld, ir011 = %6lld, ir110 = %6lld, ir111 = %6lld\n", ir010, ir011, ir110, ir111);
-
-    // threads with no work simply yield (not sure if it helps)
-    if (ir010 >= ir011 || ir110 >= ir111) {
-        sched_yield();
-        return;
-    }
-
     assert(ne12 % ne02 == 0);
     assert(ne13 % ne03 == 0);
+    assert(nr0 % nrows_dot == 0);
 
-    // block-tiling attempt
-    const int64_t blck_0 = 16;
-    const int64_t blck_1 = 16;
+    // the work is split into chunks of rows that the threads claim one at a time, so on cores of different
+    // speed the faster ones take more of them instead of all of them waiting for the slowest
+    const int64_t chunk_size = (nr0 == 1 || nr1 == 1) ? 64 : 16;
 
-    // attempt to reduce false-sharing (does not seem to make a difference)
-    float tmp[16];
+    int64_t nchunk0 = (nr0 + chunk_size - 1)/chunk_size;
+    int64_t nchunk1 = (nr1 + chunk_size - 1)/chunk_size;
 
-    for (int64_t iir1 = ir110; iir1 < ir111; iir1 += blck_1) {
-        for (int64_t iir0 = ir010; iir0 < ir011; iir0 += blck_0) {
-            for (int64_t ir1 = iir1; ir1 < iir1 + blck_1 && ir1 < ir111; ++ir1) {
-                const int64_t i13 = (ir1/(ne12*ne1));
-                const int64_t i12 = (ir1 - i13*ne12*ne1)/ne1;
-                const int64_t i11 = (ir1 - i13*ne12*ne1 - i12*ne1);
+    // too few chunks to balance anything, one per thread across the inner or outer loop based on which one is larger
+    if (nchunk0*nchunk1 < nth*4) {
+        nchunk0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
+        nchunk1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
+    }
 
-                // broadcast src0 into src1
-                const int64_t i03 = i13/r3;
-                const int64_t i02 = i12/r2;
+    // the src0 rows of a chunk start at a group of nrows_dot rows
+    const int64_t dr0 = ((nr0 + nchunk0 - 1)/nchunk0 + nrows_dot - 1)/nrows_dot*nrows_dot;
+    const int64_t dr1 = (nr1 + nchunk1 - 1)/nchunk1;
 
-                const int64_t i1 = i11;
-                const int64_t i2 = i12;
-                const int64_t i3 = i13;
+    // the first chunk of each thread is its own, the counter starts after them
+    int64_t current_chunk = ith;
 
-                const char * src0_row = (const char *) src0->data + (0 + i02*nb02 + i03*nb03);
+    while (current_chunk < nchunk0*nchunk1) {
+        const int64_t ith0 = current_chunk % nchunk0;
+        const int64_t ith1 = current_chunk / nchunk0;
 
-                // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
-                //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
-                //       the original src1 data pointer, so we should index using the indices directly
-                // TODO: this is a bit of a hack, we should probably have a better way to handle this
-                const char * src1_col = (const char *) wdata +
-                    (src1_cont || src1->type != vec_dot_type
-                     ? (i11      + i12*ne11 + i13*ne12*ne11)*row_size
-                     : (i11*nb11 + i12*nb12 + i13*nb13));
+        const int64_t ir0_start = dr0*ith0;
+        const int64_t ir0_end   = MIN(ir0_start + dr0, nr0);
 
-                float * dst_col = (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3));
+        const int64_t ir1_start = dr1*ith1;
+        const int64_t ir1_end   = MIN(ir1_start + dr1, nr1);
 
-                //for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
-                //    vec_dot(ne00, &dst_col[ir0], src0_row + ir0*nb01, src1_col);
-                //}
+        if (ir0_start < ir0_end && ir1_start < ir1_end) {
+            ggml_compute_forward_mul_mat_one_chunk(params, src0, src1, dst, ir0_start, ir0_end, ir1_start, ir1_end);
+        }
 
-                for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
-                    vec_dot(ne00, &tmp[ir0 - iir0], src0_row + ir0*nb01, src1_col);
-                }
-                memcpy(&dst_col[iir0], tmp, (MIN(iir0 + blck_0, ir011) - iir0)*sizeof(float));
-            }
+        if (nth >= nchunk0*nchunk1) {
+            break;
         }
+
+        current_chunk = ggml_compute_next_chunk(params);
     }
 }
 
@@ -9970,6 +10546,9 @@ static void ggml_compute_forward_mul_mat_id(
     enum ggml_type    const vec_dot_type          = type_traits[type].vec_dot_type;
     ggml_from_float_t const from_float_to_vec_dot = type_traits[vec_dot_type].from_float;
 
+    // the experts are not repacked
+    GGML_ASSERT(type_traits[type].nrows == 1);
+
     GGML_ASSERT(ne0 == ne01);
     GGML_ASSERT(ne1 == ne11);
     GGML_ASSERT(ne2 == ne12);
@@ -11463,6 +12042,8 @@ static void ggml_compute_forward_alibi(
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0_4X4:
+        case GGML_TYPE_Q8_0_4X4:
         case GGML_TYPE_COUNT:
             {
                 GGML_ASSERT(false);
@@ -11537,6 +12118,8 @@ static void ggml_compute_forward_clamp(
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0_4X4:
+        case GGML_TYPE_Q8_0_4X4:
         case GGML_TYPE_COUNT:
             {
                 GGML_ASSERT(false);
@@ -12285,6 +12868,268 @@ static void ggml_compute_forward_im2col(
     }
 }
 
+// ggml_compute_forward_conv_1d_gelu
+
+// output steps of a tile, its taps of every input channel stay in the L2 cache while all output channels are computed
+#define GGML_CONV_1D_GELU_TILE 32
+// output channels summed at once, one register each per vector of the tile
+#define GGML_CONV_1D_GELU_OC_BLOCK 8
+
+// floats of the work buffer of a thread: the taps of a tile, the weights of a block of output channels and their sums
+static size_t ggml_conv_1d_gelu_work_floats(int64_t IC, int64_t K) {
+    return IC*K*(GGML_CONV_1D_GELU_TILE + GGML_CONV_1D_GELU_OC_BLOCK) + GGML_CONV_1D_GELU_OC_BLOCK*GGML_CONV_1D_GELU_TILE + CACHE_LINE_SIZE_F32;
+}
+
+// sums[j][t] = sum over r of taps[r][t]*weights[r][j], for the n_taps rows of the tile
+static void ggml_conv_1d_gelu_block(const int64_t n_taps, const float * restrict taps, const float * restrict weights, float * restrict sums) {
+    const int64_t T  = GGML_CONV_1D_GELU_TILE;
+    const int64_t OB = GGML_CONV_1D_GELU_OC_BLOCK;
+
+#if defined(GGML_SIMD)
+    static_assert(GGML_CONV_1D_GELU_TILE % GGML_F32_EPR == 0, "the tile must be a whole number of vectors");
+
+    for (int64_t t = 0; t < T; t += GGML_F32_EPR) {
+        GGML_F32_VEC sum[GGML_CONV_1D_GELU_OC_BLOCK];
+        for (int64_t j = 0; j < OB; ++j) {
+            sum[j] = GGML_F32_VEC_ZERO;
+        }
+
+        for (int64_t r = 0; r < n_taps; ++r) {
+            const GGML_F32_VEC x = GGML_F32_VEC_LOAD(taps + r*T + t);
+            const float * w = weights + r*OB;
+            for (int64_t j = 0; j < OB; ++j) {
+                sum[j] = GGML_F32_VEC_FMA(sum[j], x, GGML_F32_VEC_SET1(w[j]));
+            }
+        }
+
+        for (int64_t j = 0; j < OB; ++j) {
+            GGML_F32_VEC_STORE(sums + j*T + t, sum[j]);
+        }
+    }
+#else
+    for (int64_t i = 0; i < OB*T; ++i) {
+        sums[i] = 0.0f;
+    }
+    for (int64_t r = 0; r < n_taps; ++r) {
+        for (int64_t j = 0; j < OB; ++j) {
+            ggml_vec_mad_f32(T, sums + j*T, taps + r*T, weights[r*OB + j]);
+        }
+    }
+#endif
+}
+
+static void ggml_compute_forward_conv_1d_gelu_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
+              struct ggml_tensor * dst) {
+    GGML_ASSERT(src1->type == GGML_TYPE_F32);
+    GGML_ASSERT(src2->type == GGML_TYPE_F32);
+    GGML_ASSERT( dst->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_is_contiguous(src2));
+    GGML_ASSERT(src1->nb[0] == sizeof(float));
+
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+
+    const int32_t s0 = ((const int32_t *)(dst->op_params))[0];
+    const int32_t p0 = ((const int32_t *)(dst->op_params))[1];
+
+    const int64_t K  = ne00;
+    const int64_t IC = ne01;
+    const int64_t OC = ne02;
+    const int64_t IL = ne10;
+    const int64_t OL = ne0;
+
+    const int64_t T  = GGML_CONV_1D_GELU_TILE;
+    const int64_t OB = GGML_CONV_1D_GELU_OC_BLOCK;
+
+    float * taps    = (float *) params->wdata + ith*ggml_conv_1d_gelu_work_floats(IC, K);
+    float * weights = taps + IC*K*T;
+    float * sums    = weights + IC*K*OB;
+
+    const float * bias = (const float *) src2->data;
+
+    const int64_t ntile = (OL + T - 1)/T;
+
+    for (int64_t tile = ith; tile < ntile; tile = ggml_compute_next_chunk(params)) {
+        const int64_t it0 = tile*T;
+        const int64_t nt  = MIN(T, OL - it0);
+
+        // the im2col rows of this tile only, one per input channel and tap, zero in the padding
+        for (int64_t ic = 0; ic < IC; ++ic) {
+            const float * x = (const float *) ((const char *) src1->data + ic*nb11);
+            for (int64_t k = 0; k < K; ++k) {
+                float * tap = taps + (ic*K + k)*T;
+                for (int64_t t = 0; t < T; ++t) {
+                    const int64_t i = (it0 + t)*s0 + k - p0;
+                    tap[t] = t < nt && i >= 0 && i < IL ? x[i] : 0.0f;
+                }
+            }
+        }
+
+        for (int64_t oc0 = 0; oc0 < OC; oc0 += OB) {
+            const int64_t nob = MIN(OB, OC - oc0);
+
+            // the weights of the block interleaved by output channel, for one broadcast load each
+            for (int64_t j = 0; j < OB; ++j) {
+                const char * w = (const char *) src0->data + MIN(oc0 + j, OC - 1)*nb02;
+                for (int64_t ic = 0; ic < IC; ++ic) {
+                    for (int64_t k = 0; k < K; ++k) {
+                        const char * wk = w + ic*nb01 + k*nb00;
+                        const float v = src0->type == GGML_TYPE_F16 ? GGML_FP16_TO_FP32(*(const ggml_fp16_t *) wk) : *(const float *) wk;
+                        weights[(ic*K + k)*OB + j] = j < nob ? v : 0.0f;
+                    }
+                }
+            }
+
+            ggml_conv_1d_gelu_block(IC*K, taps, weights, sums);
+
+            for (int64_t j = 0; j < nob; ++j) {
+                float * sum = sums + j*T;
+                ggml_vec_acc1_f32(nt, sum, bias[oc0 + j]);
+                ggml_vec_gelu_f32(nt, (float *) ((char *) dst->data + (oc0 + j)*nb1) + it0, sum);
+            }
+        }
+    }
+}
+
+static void ggml_compute_forward_conv_1d_gelu(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
+              struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F16:
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_conv_1d_gelu_f32(params, src0, src1, src2, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_log_mel
+
+// floats of the work buffer: the twiddles, then a windowed frame and its power spectrum per thread
+static size_t ggml_log_mel_work_floats(int64_t N, int n_tasks) {
+    return 2*N + n_tasks*(N + (N/2 + 1) + CACHE_LINE_SIZE_F32);
+}
+
+static void ggml_compute_forward_log_mel_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
+              struct ggml_tensor * dst) {
+    GGML_ASSERT(dst->type == GGML_TYPE_F32);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int32_t frame_step = ((const int32_t *)(dst->op_params))[0];
+
+    const int64_t N         = src2->ne[0];
+    const int64_t n_bins    = src1->ne[0];
+    const int64_t n_mel     = src1->ne[1];
+    const int64_t n_samples = src0->ne[0];
+    const int64_t n_frames  = dst->ne[0];
+
+    float * twiddle = params->wdata;
+
+    if (params->type == GGML_TASK_INIT) {
+        // cos and sin of 2*pi*t/N, the DFT reads them at (k*n) % N
+        for (int64_t t = 0; t < N; ++t) {
+            const double angle = 2.0*M_PI*(double) t/(double) N;
+            twiddle[t]     = (float) cos(angle);
+            twiddle[N + t] = (float) sin(angle);
+        }
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        // the dynamic range of whisper, over all the frames
+        float mmax = -1e20f;
+        for (int64_t j = 0; j < n_mel; ++j) {
+            const float * row = (const float *) ((const char *) dst->data + j*dst->nb[1]);
+            for (int64_t i = 0; i < n_frames; ++i) {
+                mmax = MAX(mmax, row[i]);
+            }
+        }
+        mmax -= 8.0f;
+
+        for (int64_t j = 0; j < n_mel; ++j) {
+            float * row = (float *) ((char *) dst->data + j*dst->nb[1]);
+            for (int64_t i = 0; i < n_frames; ++i) {
+                row[i] = (MAX(row[i], mmax) + 4.0f)/4.0f;
+            }
+        }
+        return;
+    }
+
+    const float * x      = (const float *) src0->data;
+    const float * window = (const float *) src2->data;
+
+    float * frame = twiddle + 2*N + ith*(N + n_bins + CACHE_LINE_SIZE_F32);
+    float * power = frame + N;
+
+    for (int64_t i = ith; i < n_frames; i += nth) {
+        for (int64_t n = 0; n < N; ++n) {
+            const int64_t is = i*frame_step + n;
+            frame[n] = is < n_samples ? x[is]*window[n] : 0.0f;
+        }
+
+        for (int64_t k = 0; k < n_bins; ++k) {
+            float re = 0.0f;
+            float im = 0.0f;
+            for (int64_t n = 0, t = 0; n < N; ++n, t = (t + k) % N) {
+                re += frame[n]*twiddle[t];
+                im -= frame[n]*twiddle[N + t];
+            }
+            power[k] = re*re + im*im;
+        }
+
+        for (int64_t j = 0; j < n_mel; ++j) {
+            float sum = 0.0f;
+            ggml_vec_dot_f32(n_bins, &sum, power, (const float *) ((const char *) src1->data + j*src1->nb[1]));
+
+            float * row = (float *) ((char *) dst->data + j*dst->nb[1]);
+            row[i] = log10f(MAX(sum, 1e-10f));
+        }
+    }
+}
+
+static void ggml_compute_forward_log_mel(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
+              struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_log_mel_f32(params, src0, src1, src2, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
 // ggml_compute_forward_conv_transpose_2d
 
 static void ggml_compute_forward_conv_transpose_2d(
@@ -12773,128 +13618,132 @@ static void ggml_compute_forward_flash_attn_f32(
     // total rows in q
     const int nr = neq1*neq2*neq3;
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    // rows per chunk, the threads claim chunks until none are left so faster cores take more of them
+    const int dr = MAX(1, MIN(16, nr/(4*nth)));
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    const int nchunk = (nr + dr - 1)/dr;
 
     const float scale = 1.0f/sqrtf(D);
 
-    //printf("P=%d N=%d D=%d ir0=%d ir1=%d scale = %f\n", P, N, D, ir0, ir1, scale);
+    //printf("P=%d N=%d D=%d dr=%d nchunk=%d scale = %f\n", P, N, D, dr, nchunk, scale);
 
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+    for (int chunk = ith; chunk < nchunk; chunk = ggml_compute_next_chunk(params)) {
+        // row range of this chunk
+        const int ir0 = dr*chunk;
+        const int ir1 = MIN(ir0 + dr, nr);
 
-        float * S = (float *) params->wdata + ith*(Mup + CACHE_LINE_SIZE_F32);
+        for (int ir = ir0; ir < ir1; ++ir) {
+            // q indices
+            const int iq3 = ir/(neq2*neq1);
+            const int iq2 = (ir - iq3*neq2*neq1)/neq1;
+            const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
 
-        for (int i = M; i < Mup; ++i) {
-            S[i] = -INFINITY;
-        }
+            float * S = (float *) params->wdata + ith*(Mup + CACHE_LINE_SIZE_F32);
 
-        const int64_t masked_begin = masked ? (P + iq1 + 1) : M;
-        for (int64_t ic = 0; ic < masked_begin; ++ic) {
-            // k indices
-            const int ik3 = iq3;
-            const int ik2 = iq2 % nek2;
-            const int ik1 = ic;
+            for (int i = M; i < Mup; ++i) {
+                S[i] = -INFINITY;
+            }
 
-            // S indices
-            const int i1 = ik1;
+            const int64_t masked_begin = masked ? (P + iq1 + 1) : M;
+            for (int64_t ic = 0; ic < masked_begin; ++ic) {
+                // k indices
+                const int ik3 = iq3;
+                const int ik2 = iq2 % nek2;
+                const int ik1 = ic;
 
-            ggml_vec_dot_f32(neq0,
-                    S + i1,
-                    (float *) ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)),
-                    (float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3)));
-        }
+                // S indices
+                const int i1 = ik1;
 
-        // scale
-        ggml_vec_scale_f32(masked_begin, S, scale);
+                ggml_vec_dot_f32(neq0,
+                        S + i1,
+                        (float *) ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)),
+                        (float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3)));
+            }
 
-        for (int64_t i = masked_begin; i < M; i++) {
-            S[i] = -INFINITY;
-        }
+            // scale
+            ggml_vec_scale_f32(masked_begin, S, scale);
 
-        // softmax
-        // exclude known -INF S[..] values from max and loop
-        // dont forget to set their SW values to zero
-        {
-            float max = -INFINITY;
-            ggml_vec_max_f32(masked_begin, &max, S);
+            for (int64_t i = masked_begin; i < M; i++) {
+                S[i] = -INFINITY;
+            }
 
-            ggml_float sum = 0.0;
+            // softmax
+            // exclude known -INF S[..] values from max and loop
+            // dont forget to set their SW values to zero
             {
+                float max = -INFINITY;
+                ggml_vec_max_f32(masked_begin, &max, S);
+
+                ggml_float sum = 0.0;
+                {
 #ifdef GGML_SOFT_MAX_ACCELERATE
-                max = -max;
-                vDSP_vsadd(S, 1, &max, S, 1, Mup);
-                vvexpf(S, S, &Mup);
-                ggml_vec_sum_f32(Mup, &sum, S);
+                    max = -max;
+                    vDSP_vsadd(S, 1, &max, S, 1, Mup);
+                    vvexpf(S, S, &Mup);
+                    ggml_vec_sum_f32(Mup, &sum, S);
 #else
-                uint16_t   scvt[GGML_SOFT_MAX_UNROLL]; UNUSED(scvt);
-                ggml_float sump[GGML_SOFT_MAX_UNROLL] = { 0.0 };
+                    uint16_t   scvt[GGML_SOFT_MAX_UNROLL]; UNUSED(scvt);
+                    ggml_float sump[GGML_SOFT_MAX_UNROLL] = { 0.0 };
 
-                for (int i = 0; i < Mup; i += GGML_SOFT_MAX_UNROLL) {
-                    if (i >= masked_begin) {
-                        break;
-                    }
-                    float * SS = S + i;
-
-                    for (int j = 0; j < GGML_SOFT_MAX_UNROLL; ++j) {
-                        if (i + j >= masked_begin) {
+                    for (int i = 0; i < Mup; i += GGML_SOFT_MAX_UNROLL) {
+                        if (i >= masked_begin) {
                             break;
-                        } else if (SS[j] == -INFINITY) {
-                            SS[j] = 0.0f;
-                        } else {
+                        }
+                        float * SS = S + i;
+
+                        for (int j = 0; j < GGML_SOFT_MAX_UNROLL; ++j) {
+                            if (i + j >= masked_begin) {
+                                break;
+                            } else if (SS[j] == -INFINITY) {
+                                SS[j] = 0.0f;
+                            } else {
 #ifndef GGML_FLASH_ATTN_EXP_FP16
-                            const float val = expf(SS[j] - max);
+                                const float val = expf(SS[j] - max);
 #else
-                            ggml_fp16_t s = GGML_FP32_TO_FP16(SS[j] - max);
-                            memcpy(&scvt[j], &s, sizeof(uint16_t));
-                            const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt[j]]);
+                                ggml_fp16_t s = GGML_FP32_TO_FP16(SS[j] - max);
+                                memcpy(&scvt[j], &s, sizeof(uint16_t));
+                                const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt[j]]);
 #endif
-                            sump[j] += (ggml_float)val;
-                            SS[j] = val;
+                                sump[j] += (ggml_float)val;
+                                SS[j] = val;
+                            }
                         }
                     }
-                }
 
-                for (int i = 0; i < GGML_SOFT_MAX_UNROLL; i++) {
-                    sum += sump[i];
-                }
+                    for (int i = 0; i < GGML_SOFT_MAX_UNROLL; i++) {
+                        sum += sump[i];
+                    }
 #endif
-            }
+                }
 
-            assert(sum > 0.0);
+                assert(sum > 0.0);
 
-            sum = 1.0/sum;
-            ggml_vec_scale_f32(masked_begin, S, sum);
+                sum = 1.0/sum;
+                ggml_vec_scale_f32(masked_begin, S, sum);
 
 #ifndef NDEBUG
-            for (int i = 0; i < masked_begin; ++i) {
-                assert(!isnan(S[i]));
-                assert(!isinf(S[i]));
-            }
+                for (int i = 0; i < masked_begin; ++i) {
+                    assert(!isnan(S[i]));
+                    assert(!isinf(S[i]));
+                }
 #endif
-        }
+            }
 
-        for (int64_t ic = 0; ic < nev1; ++ic) {
-            // dst indices
-            const int i1 = iq1;
-            const int i2 = iq2;
-            const int i3 = iq3;
+            for (int64_t ic = 0; ic < nev1; ++ic) {
+                // dst indices
+                const int i1 = iq1;
+                const int i2 = iq2;
+                const int i3 = iq3;
 
-            // v indices
-            const int iv2 = iq2 % nev2;
-            const int iv3 = iq3;
+                // v indices
+                const int iv2 = iq2 % nev2;
+                const int iv3 = iq3;
 
-            ggml_vec_dot_f32(masked_begin,
-                    (float *) ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2   + i3*nb3)),
-                    (float *) ((char *) v->data   + (         ic*nbv1 + iv2*nbv2 + iv3*nbv3)),
-                    S);
+                ggml_vec_dot_f32(masked_begin,
+                        (float *) ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2   + i3*nb3)),
+                        (float *) ((char *) v->data   + (         ic*nbv1 + iv2*nbv2 + iv3*nbv3)),
+                        S);
+            }
         }
     }
 }
@@ -12963,163 +13812,173 @@ static void ggml_compute_forward_flash_attn_f16(
     // total rows in q
     const int nr = neq1*neq2*neq3;
 
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
+    // rows per chunk, the threads claim chunks until none are left so faster cores take more of them
+    const int dr = MAX(1, MIN(16, nr/(4*nth)));
 
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
+    const int nchunk = (nr + dr - 1)/dr;
 
     const float scale = 1.0f/sqrtf(D);
 
-    //printf("P=%d N=%d D=%d ir0=%d ir1=%d scale = %f\n", P, N, D, ir0, ir1, scale);
-
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+    // the q*k dot products of the heads of 64 have their loop unrolled
+    void (* const dot_qk)(const int, float * restrict, ggml_fp16_t * restrict, ggml_fp16_t * restrict) = D == 64 ? ggml_vec_dot_f16_64 : ggml_vec_dot_f16;
 
-        float * S = (float *) params->wdata + ith*(2*Mup + CACHE_LINE_SIZE_F32);
+    //printf("P=%d N=%d D=%d dr=%d nchunk=%d scale = %f\n", P, N, D, dr, nchunk, scale);
 
-        for (int i = M; i < Mup; ++i) {
-            S[i] = -INFINITY;
-        }
+    for (int chunk = ith; chunk < nchunk; chunk = ggml_compute_next_chunk(params)) {
+        // row range of this chunk
+        const int ir0 = dr*chunk;
+        const int ir1 = MIN(ir0 + dr, nr);
 
-        if (GGML_VEC_DOT_UNROLL > 2 || nek1 % GGML_VEC_DOT_UNROLL != 0) {
-            for (int64_t ic = 0; ic < nek1; ++ic) {
-                // k indices
-                const int ik3 = iq3;
-                const int ik2 = iq2 % nek2;
-                const int ik1 = ic;
+        for (int ir = ir0; ir < ir1; ++ir) {
+            // q indices
+            const int iq3 = ir/(neq2*neq1);
+            const int iq2 = (ir - iq3*neq2*neq1)/neq1;
+            const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
 
-                // S indices
-                const int i1 = ik1;
+            float * S = (float *) params->wdata + ith*(2*Mup + CACHE_LINE_SIZE_F32);
 
-                ggml_vec_dot_f16(neq0,
-                        S + i1,
-                        (ggml_fp16_t *) ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)),
-                        (ggml_fp16_t *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3)));
+            for (int i = M; i < Mup; ++i) {
+                S[i] = -INFINITY;
             }
-        } else {
-            for (int64_t ic = 0; ic < nek1; ic += GGML_VEC_DOT_UNROLL) {
-                // k indices
-                const int ik3 = iq3;
-                const int ik2 = iq2 % nek2;
-                const int ik1 = ic;
 
-                // S indices
-                const int i1 = ik1;
+            if (GGML_VEC_DOT_UNROLL > 2 || nek1 % GGML_VEC_DOT_UNROLL != 0) {
+                for (int64_t ic = 0; ic < nek1; ++ic) {
+                    // k indices
+                    const int ik3 = iq3;
+                    const int ik2 = iq2 % nek2;
+                    const int ik1 = ic;
+
+                    // S indices
+                    const int i1 = ik1;
 
-                ggml_vec_dot_f16_unroll(neq0, nbk1,
-                        S + i1,
-                        ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)),
-                        (ggml_fp16_t *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3)));
-            }
-        }
+                    dot_qk(neq0,
+                            S + i1,
+                            (ggml_fp16_t *) ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)),
+                            (ggml_fp16_t *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3)));
+                }
+            } else {
+                for (int64_t ic = 0; ic < nek1; ic += GGML_VEC_DOT_UNROLL) {
+                    // k indices
+                    const int ik3 = iq3;
+                    const int ik2 = iq2 % nek2;
+                    const int ik1 = ic;
 
-        // scale
-        ggml_vec_scale_f32(nek1, S, scale);
+                    // S indices
+                    const int i1 = ik1;
 
-        if (masked) {
-            for (int64_t i = P; i < M; i++) {
-                if (i > P + iq1) {
-                    S[i] = -INFINITY;
+                    ggml_fp16_t * q_row = (ggml_fp16_t *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
+                    if (D == 64) {
+                        // both rows of k against the row of q held in registers, unrolled for the heads of 64
+                        ggml_vec_dot_f16_unroll(64, nbk1, S + i1, ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)), q_row);
+                    } else {
+                        ggml_vec_dot_f16_unroll(neq0, nbk1, S + i1, ((char *) k->data + (ik1*nbk1 + ik2*nbk2 + ik3*nbk3)), q_row);
+                    }
                 }
             }
-        }
 
-        // softmax
-        // todo: exclude known -INF S[..] values from max and loop, assuming their results to be zero.
-        // dont forget to set their S values to zero
-        {
-            float max = -INFINITY;
-            ggml_vec_max_f32(M, &max, S);
+            // scale
+            ggml_vec_scale_f32(nek1, S, scale);
 
-            ggml_float sum = 0.0;
+            if (masked) {
+                for (int64_t i = P; i < M; i++) {
+                    if (i > P + iq1) {
+                        S[i] = -INFINITY;
+                    }
+                }
+            }
+
+            // softmax
+            // todo: exclude known -INF S[..] values from max and loop, assuming their results to be zero.
+            // dont forget to set their S values to zero
             {
+                float max = -INFINITY;
+                ggml_vec_max_f32(M, &max, S);
+
+                ggml_float sum = 0.0;
+                {
 #ifdef GGML_SOFT_MAX_ACCELERATE
-                max = -max;
-                vDSP_vsadd(S, 1, &max, S, 1, Mup);
-                vvexpf(S, S, &Mup);
-                ggml_vec_sum_f32(Mup, &sum, S);
+                    max = -max;
+                    vDSP_vsadd(S, 1, &max, S, 1, Mup);
+                    vvexpf(S, S, &Mup);
+                    ggml_vec_sum_f32(Mup, &sum, S);
 #else
-                uint16_t   scvt[GGML_SOFT_MAX_UNROLL];
-                ggml_float sump[GGML_SOFT_MAX_UNROLL] = { 0.0 };
-
-                for (int i = 0; i < Mup; i += GGML_SOFT_MAX_UNROLL) {
-                    float * SS = S + i;
-
-                    for (int j = 0; j < GGML_SOFT_MAX_UNROLL; ++j) {
-                        if (SS[j] == -INFINITY) {
-                            SS[j] = 0.0f;
-                        } else {
-                            ggml_fp16_t s = GGML_FP32_TO_FP16(SS[j] - max);
-                            memcpy(&scvt[j], &s, sizeof(uint16_t));
-                            const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt[j]]);
-                            sump[j] += (ggml_float)val;
-                            SS[j] = val;
+                    uint16_t   scvt[GGML_SOFT_MAX_UNROLL];
+                    ggml_float sump[GGML_SOFT_MAX_UNROLL] = { 0.0 };
+
+                    for (int i = 0; i < Mup; i += GGML_SOFT_MAX_UNROLL) {
+                        float * SS = S + i;
+
+                        for (int j = 0; j < GGML_SOFT_MAX_UNROLL; ++j) {
+                            if (SS[j] == -INFINITY) {
+                                SS[j] = 0.0f;
+                            } else {
+                                ggml_fp16_t s = GGML_FP32_TO_FP16(SS[j] - max);
+                                memcpy(&scvt[j], &s, sizeof(uint16_t));
+                                const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt[j]]);
+                                sump[j] += (ggml_float)val;
+                                SS[j] = val;
+                            }
                         }
                     }
-                }
 
-                for (int i = 0; i < GGML_SOFT_MAX_UNROLL; i++) {
-                    sum += sump[i];
-                }
+                    for (int i = 0; i < GGML_SOFT_MAX_UNROLL; i++) {
+                        sum += sump[i];
+                    }
 #endif
-            }
+                }
 
-            assert(sum > 0.0);
+                assert(sum > 0.0);
 
-            sum = 1.0/sum;
-            ggml_vec_scale_f32(M, S, sum);
+                sum = 1.0/sum;
+                ggml_vec_scale_f32(M, S, sum);
 
 #ifndef NDEBUG
-            for (int i = 0; i < M; ++i) {
-                assert(!isnan(S[i]));
-                assert(!isinf(S[i]));
-            }
+                for (int i = 0; i < M; ++i) {
+                    assert(!isnan(S[i]));
+                    assert(!isinf(S[i]));
+                }
 #endif
-        }
-
-        ggml_fp16_t * S16 = (ggml_fp16_t *) ((float *) params->wdata + ith*(2*Mup + CACHE_LINE_SIZE_F32) + Mup);
-
-        for (int64_t i = 0; i < M; i++) {
-            S16[i] = GGML_FP32_TO_FP16(S[i]);
-        }
-
-        // todo: exclude known zero S[..] values from dot (reducing nev0 and increasing begin of v and S16).
-        if (GGML_VEC_DOT_UNROLL == 1 || (nev1 % GGML_VEC_DOT_UNROLL != 0)) {
-            for (int64_t ic = 0; ic < nev1; ++ic) {
-                // dst indices
-                const int i1 = iq1;
-                const int i2 = iq2;
-                const int i3 = iq3;
+            }
 
-                // v indices
-                const int iv2 = iq2 % nev2;
-                const int iv3 = iq3;
+            ggml_fp16_t * S16 = (ggml_fp16_t *) ((float *) params->wdata + ith*(2*Mup + CACHE_LINE_SIZE_F32) + Mup);
 
-                ggml_vec_dot_f16(nev0,
-                        (float *)       ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2   + i3*nb3)),
-                        (ggml_fp16_t *) ((char *) v->data   + (         ic*nbv1 + iv2*nbv2 + iv3*nbv3)),
-                        S16);
+            for (int64_t i = 0; i < M; i++) {
+                S16[i] = GGML_FP32_TO_FP16(S[i]);
             }
-        } else {
-            for (int64_t ic = 0; ic < nev1; ic += GGML_VEC_DOT_UNROLL) {
-                // dst indices
-                const int i1 = iq1;
-                const int i2 = iq2;
-                const int i3 = iq3;
-
-                // v indices
-                const int iv2 = iq2 % nev2;
-                const int iv3 = iq3;
 
-                ggml_vec_dot_f16_unroll(nev0, nbv1,
-                        (float *) ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2   + i3*nb3)),
-                        ((char *)             v->data + (         ic*nbv1 + iv2*nbv2 + iv3*nbv3)),
-                        S16);
+            // todo: exclude known zero S[..] values from dot (reducing nev0 and increasing begin of v and S16).
+            if (GGML_VEC_DOT_UNROLL == 1 || (nev1 % GGML_VEC_DOT_UNROLL != 0)) {
+                for (int64_t ic = 0; ic < nev1; ++ic) {
+                    // dst indices
+                    const int i1 = iq1;
+                    const int i2 = iq2;
+                    const int i3 = iq3;
+
+                    // v indices
+                    const int iv2 = iq2 % nev2;
+                    const int iv3 = iq3;
+
+                    ggml_vec_dot_f16(nev0,
+                            (float *)       ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2   + i3*nb3)),
+                            (ggml_fp16_t *) ((char *) v->data   + (         ic*nbv1 + iv2*nbv2 + iv3*nbv3)),
+                            S16);
+                }
+            } else {
+                for (int64_t ic = 0; ic < nev1; ic += GGML_VEC_DOT_UNROLL) {
+                    // dst indices
+                    const int i1 = iq1;
+                    const int i2 = iq2;
+                    const int i3 = iq3;
+
+                    // v indices
+                    const int iv2 = iq2 % nev2;
+                    const int iv3 = iq3;
+
+                    ggml_vec_dot_f16_unroll(nev0, nbv1,
+                            (float *) ((char *) dst->data + (ic*nb0 + i1*nb1  + i2*nb2   + i3*nb3)),
+                            ((char *)             v->data + (         ic*nbv1 + iv2*nbv2 + iv3*nbv3)),
+                            S16);
+                }
             }
         }
     }
@@ -14618,6 +15477,14 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_im2col(params, tensor->src[0], tensor->src[1], tensor);
             } break;
+        case GGML_OP_CONV_1D_GELU:
+            {
+                ggml_compute_forward_conv_1d_gelu(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor);
+            } break;
+        case GGML_OP_LOG_MEL:
+            {
+                ggml_compute_forward_log_mel(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor);
+            } break;
         case GGML_OP_CONV_TRANSPOSE_2D:
             {
                 ggml_compute_forward_conv_transpose_2d(params, tensor->src[0], tensor->src[1], tensor);
@@ -15617,6 +16484,8 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
         case GGML_OP_IM2COL:
+        case GGML_OP_CONV_1D_GELU:
+        case GGML_OP_LOG_MEL:
             {
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
@@ -16199,27 +17068,17 @@ static void set_numa_thread_affinity(int thread_n, int n_threads) { UNUSED(threa
 static void clear_numa_thread_affinity(void) {}
 #endif
 
-struct ggml_compute_state_shared {
-    const struct ggml_cgraph * cgraph;
-    const struct ggml_cplan  * cplan;
-
-    int64_t perf_node_start_cycles;
-    int64_t perf_node_start_time_us;
-
-    const int n_threads;
-
-    // synchronization primitives
-    atomic_int n_active; // num active threads
-    atomic_int node_n;   // active graph node
+static ggml_compute_thread_callback g_compute_thread_callback = NULL;
 
-    bool (*abort_callback)(void * data); // abort ggml_graph_compute when true
-    void * abort_callback_data;
-};
+void ggml_set_compute_thread_callback(ggml_compute_thread_callback callback) {
+    g_compute_thread_callback = callback;
+}
 
 struct ggml_compute_state {
     ggml_thread_t thrd;
     int ith;
     struct ggml_compute_state_shared * shared;
+    struct ggml_threadpool * pool; // NULL for the threads of a single graph
 };
 
 static void ggml_graph_compute_perf_stats_node(struct ggml_tensor * node, const struct ggml_compute_state_shared * st) {
@@ -16367,6 +17226,8 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
                 n_tasks = n_threads;
             } break;
         case GGML_OP_IM2COL:
+        case GGML_OP_CONV_1D_GELU:
+        case GGML_OP_LOG_MEL:
             {
                 n_tasks = n_threads;
             } break;
@@ -16484,6 +17345,10 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
 
     set_numa_thread_affinity(state->ith, n_threads);
 
+    if (g_compute_thread_callback) {
+        g_compute_thread_callback();
+    }
+
     int node_n = -1;
 
     while (true) {
@@ -16495,11 +17360,12 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
             // all other threads are finished and spinning
             // do finalize and init here so we don't have synchronize again
             struct ggml_compute_params params = {
-                /*.type  =*/ GGML_TASK_FINALIZE,
-                /*.ith   =*/ 0,
-                /*.nth   =*/ 0,
-                /*.wsize =*/ cplan->work_size,
-                /*.wdata =*/ cplan->work_data,
+                /*.type   =*/ GGML_TASK_FINALIZE,
+                /*.ith    =*/ 0,
+                /*.nth    =*/ 0,
+                /*.wsize  =*/ cplan->work_size,
+                /*.wdata  =*/ cplan->work_data,
+                /*.shared =*/ state->shared,
             };
 
             if (node_n != -1) {
@@ -16524,6 +17390,9 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
 
                 params.nth = n_tasks;
 
+                // the first chunks go to the threads in order, seen by them once node_n is stored
+                atomic_store(&state->shared->current_chunk, n_tasks);
+
                 /* INIT */
                 if (GGML_OP_HAS_INIT[node->op]) {
                     params.type = GGML_TASK_INIT;
@@ -16578,11 +17447,12 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         const int n_tasks = ggml_get_n_tasks(node, n_threads);
 
         struct ggml_compute_params params = {
-            /*.type  =*/ GGML_TASK_COMPUTE,
-            /*.ith   =*/ state->ith,
-            /*.nth   =*/ n_tasks,
-            /*.wsize =*/ cplan->work_size,
-            /*.wdata =*/ cplan->work_data,
+            /*.type   =*/ GGML_TASK_COMPUTE,
+            /*.ith    =*/ state->ith,
+            /*.nth    =*/ n_tasks,
+            /*.wsize  =*/ cplan->work_size,
+            /*.wdata  =*/ cplan->work_data,
+            /*.shared =*/ state->shared,
         };
 
         if (state->ith < n_tasks) {
@@ -16624,6 +17494,16 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                 {
                     if (ggml_is_quantized(node->src[0]->type)) {
                         cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
+                    } else if (node->op == GGML_OP_ADD && node->src[0]->type == GGML_TYPE_F16) {
+                        // a row of each source
+                        cur = 2 * ggml_type_size(GGML_TYPE_F32) * (node->src[0]->ne[0] + CACHE_LINE_SIZE_F32) * n_tasks;
+                    }
+                } break;
+            case GGML_OP_MUL:
+            case GGML_OP_NORM:
+                {
+                    if (node->src[0]->type == GGML_TYPE_F16) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * (node->src[0]->ne[0] + CACHE_LINE_SIZE_F32) * n_tasks;
                     }
                 } break;
             case GGML_OP_ACC:
@@ -16715,6 +17595,15 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
                     cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02*ne03;
                     cur += sizeof(ggml_fp16_t)*ne10*ne11*ne12;
                 } break;
+            case GGML_OP_CONV_1D_GELU:
+                {
+                    // a tile of the input per thread rather than the im2col matrix of all of it
+                    cur = sizeof(float)*n_tasks*ggml_conv_1d_gelu_work_floats(node->src[0]->ne[1], node->src[0]->ne[0]);
+                } break;
+            case GGML_OP_LOG_MEL:
+                {
+                    cur = sizeof(float)*ggml_log_mel_work_floats(node->src[2]->ne[0], n_tasks);
+                } break;
             case GGML_OP_FLASH_ATTN:
                 {
                     const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
@@ -16777,6 +17666,337 @@ struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
     return cplan;
 }
 
+//
+// persistent thread pool
+//
+// the workers outlive the graphs: after one they spin on the generation counter for a while, so the next graph of a
+// decoder loop starts without a wake up, and then park on a condition variable until ggml_graph_compute() bumps it
+//
+
+#if defined(_WIN32)
+
+typedef SRWLOCK            ggml_mutex_t;
+typedef CONDITION_VARIABLE ggml_cond_t;
+
+#define ggml_mutex_init(m)    InitializeSRWLock(m)
+#define ggml_mutex_destroy(m) UNUSED(m)
+#define ggml_mutex_lock(m)    AcquireSRWLockExclusive(m)
+#define ggml_mutex_unlock(m)  ReleaseSRWLockExclusive(m)
+#define ggml_cond_init(c)     InitializeConditionVariable(c)
+#define ggml_cond_destroy(c)  UNUSED(c)
+#define ggml_cond_wait(c, m)  SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define ggml_cond_broadcast(c) WakeAllConditionVariable(c)
+
+#else
+
+typedef pthread_mutex_t ggml_mutex_t;
+typedef pthread_cond_t  ggml_cond_t;
+
+#define ggml_mutex_init(m)    pthread_mutex_init(m, NULL)
+#define ggml_mutex_destroy(m) pthread_mutex_destroy(m)
+#define ggml_mutex_lock(m)    pthread_mutex_lock(m)
+#define ggml_mutex_unlock(m)  pthread_mutex_unlock(m)
+#define ggml_cond_init(c)     pthread_cond_init(c, NULL)
+#define ggml_cond_destroy(c)  pthread_cond_destroy(c)
+#define ggml_cond_wait(c, m)  pthread_cond_wait(c, m)
+#define ggml_cond_broadcast(c) pthread_cond_broadcast(c)
+
+#endif
+
+// polls of the generation counter before an idle worker parks, well below a millisecond
+#define GGML_THREADPOOL_SPIN 4096
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h> // _mm_pause, ggml-impl.h only includes it for F16C builds
+#endif
+
+static inline void ggml_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+struct ggml_threadpool {
+    ggml_mutex_t mutex;
+    ggml_cond_t  cond;
+
+    int n_workers; // the caller is not one of them
+    struct ggml_compute_state * workers;
+
+    // the graph in flight, or the task of ggml_threadpool_run() when set, published before generation is bumped
+    struct ggml_compute_state_shared * shared;
+    ggml_threadpool_task_t task;
+    void * task_data;
+    int n_threads_cur;
+    bool stop;
+
+    atomic_int generation;
+    atomic_int n_busy; // workers that did not finish the current generation yet
+
+    // no threads of its own, every generation runs its workers on the executor, or on threads of the call when it is busy
+    bool external;
+    ggml_thread_executor_start_t executor_start;
+    ggml_thread_executor_join_t  executor_join;
+    void * executor_user_data;
+    void * executor_handle;
+    ggml_thread_t * call_threads;
+};
+
+static ggml_thread_executor_start_t g_executor_start     = NULL;
+static ggml_thread_executor_join_t  g_executor_join      = NULL;
+static void *                       g_executor_user_data = NULL;
+
+void ggml_set_thread_executor(ggml_thread_executor_start_t start, ggml_thread_executor_join_t join, void * user_data) {
+    g_executor_start     = start;
+    g_executor_join      = join;
+    g_executor_user_data = user_data;
+}
+
+// the share of a worker in the current generation
+static void ggml_threadpool_work(struct ggml_compute_state * state) {
+    struct ggml_threadpool * pool = state->pool;
+
+    // workers beyond the threads of this graph only check in
+    if (state->ith < pool->n_threads_cur) {
+        if (pool->task != NULL) {
+            pool->task(state->ith, pool->n_threads_cur, pool->task_data);
+        } else {
+            state->shared = pool->shared;
+            ggml_graph_compute_thread(state);
+        }
+    }
+
+    atomic_fetch_sub(&pool->n_busy, 1);
+}
+
+static void ggml_threadpool_executor_task(int i, void * data) {
+    struct ggml_threadpool * pool = (struct ggml_threadpool *) data;
+    ggml_threadpool_work(&pool->workers[i]);
+}
+
+static thread_ret_t ggml_threadpool_call_thread(void * data) {
+    ggml_threadpool_work((struct ggml_compute_state *) data);
+    return 0;
+}
+
+static thread_ret_t ggml_threadpool_worker(void * data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    struct ggml_threadpool * pool = state->pool;
+
+    int last = 0;
+
+    while (true) {
+        int gen = atomic_load(&pool->generation);
+        for (int i = 0; i < GGML_THREADPOOL_SPIN && gen == last; ++i) {
+            ggml_cpu_relax();
+            gen = atomic_load(&pool->generation);
+        }
+        if (gen == last) {
+            ggml_mutex_lock(&pool->mutex);
+            while ((gen = atomic_load(&pool->generation)) == last) {
+                ggml_cond_wait(&pool->cond, &pool->mutex);
+            }
+            ggml_mutex_unlock(&pool->mutex);
+        }
+        last = gen;
+
+        if (pool->stop) {
+            break;
+        }
+
+        ggml_threadpool_work(state);
+    }
+
+    return 0;
+}
+
+static void ggml_threadpool_kick(struct ggml_threadpool * pool) {
+    if (pool->external) {
+        // only the workers of this graph, there are no parked ones to check in
+        const int n_tasks = pool->n_threads_cur - 1;
+        atomic_store(&pool->n_busy, n_tasks);
+
+        pool->executor_handle = pool->executor_start(n_tasks, ggml_threadpool_executor_task, pool, pool->executor_user_data);
+        if (pool->executor_handle == NULL) {
+            for (int j = 0; j < n_tasks; ++j) {
+                const int rc = ggml_thread_create(&pool->call_threads[j], NULL, ggml_threadpool_call_thread, &pool->workers[j]);
+                GGML_ASSERT(rc == 0);
+                UNUSED(rc);
+            }
+        }
+        return;
+    }
+
+    atomic_store(&pool->n_busy, pool->n_workers);
+
+    // under the mutex, so a worker about to park cannot miss the new generation
+    ggml_mutex_lock(&pool->mutex);
+    atomic_fetch_add(&pool->generation, 1);
+    ggml_cond_broadcast(&pool->cond);
+    ggml_mutex_unlock(&pool->mutex);
+}
+
+// until every worker is done with the current generation
+static void ggml_threadpool_wait(struct ggml_threadpool * pool) {
+    for (int i = 0; atomic_load(&pool->n_busy) > 0; ++i) {
+        if (i < GGML_THREADPOOL_SPIN) {
+            ggml_cpu_relax();
+        } else {
+            // more threads than cores, the workers need this one to finish
+            sched_yield();
+        }
+    }
+
+    if (pool->external) {
+        if (pool->executor_handle != NULL) {
+            pool->executor_join(pool->executor_handle, pool->executor_user_data);
+            pool->executor_handle = NULL;
+        } else {
+            for (int j = 0; j < pool->n_threads_cur - 1; ++j) {
+                const int rc = ggml_thread_join(pool->call_threads[j], NULL);
+                GGML_ASSERT(rc == 0);
+                UNUSED(rc);
+            }
+        }
+    }
+}
+
+struct ggml_threadpool * ggml_threadpool_new(int n_threads) {
+    GGML_ASSERT(n_threads > 0);
+
+    struct ggml_threadpool * pool = malloc(sizeof(struct ggml_threadpool));
+
+    ggml_mutex_init(&pool->mutex);
+    ggml_cond_init(&pool->cond);
+
+    pool->n_workers     = n_threads - 1;
+    pool->workers       = pool->n_workers > 0 ? malloc(sizeof(struct ggml_compute_state)*pool->n_workers) : NULL;
+    pool->shared        = NULL;
+    pool->task          = NULL;
+    pool->task_data     = NULL;
+    pool->n_threads_cur = 0;
+    pool->stop          = false;
+
+    pool->external           = g_executor_start != NULL && g_executor_join != NULL;
+    pool->executor_start     = g_executor_start;
+    pool->executor_join      = g_executor_join;
+    pool->executor_user_data = g_executor_user_data;
+    pool->executor_handle    = NULL;
+    pool->call_threads    = pool->external && pool->n_workers > 0 ? malloc(sizeof(ggml_thread_t)*pool->n_workers) : NULL;
+
+    atomic_store(&pool->generation, 0);
+    atomic_store(&pool->n_busy, 0);
+
+    for (int j = 0; j < pool->n_workers; ++j) {
+        pool->workers[j] = (struct ggml_compute_state) {
+            .thrd   = 0,
+            .ith    = j + 1,
+            .shared = NULL,
+            .pool   = pool,
+        };
+
+        if (pool->external) {
+            continue;
+        }
+
+        const int rc = ggml_thread_create(&pool->workers[j].thrd, NULL, ggml_threadpool_worker, &pool->workers[j]);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+
+    return pool;
+}
+
+void ggml_threadpool_free(struct ggml_threadpool * pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    if (!pool->external) {
+        pool->stop = true;
+        ggml_threadpool_kick(pool);
+
+        for (int j = 0; j < pool->n_workers; ++j) {
+            const int rc = ggml_thread_join(pool->workers[j].thrd, NULL);
+            GGML_ASSERT(rc == 0);
+            UNUSED(rc);
+        }
+    }
+
+    ggml_cond_destroy(&pool->cond);
+    ggml_mutex_destroy(&pool->mutex);
+
+    free(pool->workers);
+    free(pool->call_threads);
+    free(pool);
+}
+
+int ggml_threadpool_n_threads(const struct ggml_threadpool * pool) {
+    return pool->n_workers + 1;
+}
+
+struct ggml_threadpool_task_state {
+    ggml_thread_t thrd;
+    ggml_threadpool_task_t task;
+    void * data;
+    int ith;
+    int nth;
+};
+
+static thread_ret_t ggml_threadpool_task_thread(void * data) {
+    struct ggml_threadpool_task_state * state = (struct ggml_threadpool_task_state *) data;
+    state->task(state->ith, state->nth, state->data);
+    return 0;
+}
+
+void ggml_threadpool_run(struct ggml_threadpool * pool, int n_threads, ggml_threadpool_task_t task, void * data) {
+    GGML_ASSERT(n_threads > 0);
+
+    if (n_threads == 1) {
+        task(0, 1, data);
+        return;
+    }
+
+    if (pool != NULL && n_threads <= ggml_threadpool_n_threads(pool)) {
+        pool->task          = task;
+        pool->task_data     = data;
+        pool->n_threads_cur = n_threads;
+        ggml_threadpool_kick(pool);
+
+        task(0, n_threads, data);
+
+        ggml_threadpool_wait(pool);
+        pool->task      = NULL;
+        pool->task_data = NULL;
+        return;
+    }
+
+    struct ggml_threadpool_task_state * workers = alloca(sizeof(struct ggml_threadpool_task_state)*n_threads);
+    for (int j = 1; j < n_threads; ++j) {
+        workers[j] = (struct ggml_threadpool_task_state) {
+            .thrd = 0,
+            .task = task,
+            .data = data,
+            .ith  = j,
+            .nth  = n_threads,
+        };
+
+        const int rc = ggml_thread_create(&workers[j].thrd, NULL, ggml_threadpool_task_thread, &workers[j]);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+
+    task(0, n_threads, data);
+
+    for (int j = 1; j < n_threads; ++j) {
+        const int rc = ggml_thread_join(workers[j].thrd, NULL);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+}
+
 int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     {
         GGML_ASSERT(cplan);
@@ -16797,13 +18017,23 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
         /*.n_threads               =*/ n_threads,
         /*.n_active                =*/ n_threads,
         /*.node_n                  =*/ -1,
+        /*.current_chunk           =*/ 0,
         /*.abort_callback          =*/ NULL,
         /*.abort_callback_data     =*/ NULL,
     };
     struct ggml_compute_state * workers = alloca(sizeof(struct ggml_compute_state)*n_threads);
 
-    // create thread pool
-    if (n_threads > 1) {
+    struct ggml_threadpool * pool = cplan->threadpool;
+    if (pool != NULL && (n_threads == 1 || n_threads > ggml_threadpool_n_threads(pool))) {
+        pool = NULL;
+    }
+
+    if (pool != NULL) {
+        pool->shared        = &state_shared;
+        pool->n_threads_cur = n_threads;
+        ggml_threadpool_kick(pool);
+    } else if (n_threads > 1) {
+        // create thread pool
         for (int j = 1; j < n_threads; ++j) {
             workers[j] = (struct ggml_compute_state) {
                 .thrd   = 0,
@@ -16819,6 +18049,7 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
 
     workers[0].ith = 0;
     workers[0].shared = &state_shared;
+    workers[0].pool = NULL;
 
     const int64_t perf_start_cycles  = ggml_perf_cycles();
     const int64_t perf_start_time_us = ggml_perf_time_us();
@@ -16830,7 +18061,10 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
     clear_numa_thread_affinity();
 
     // join or kill thread pool
-    if (n_threads > 1) {
+    if (pool != NULL) {
+        // state_shared lives on this stack, every worker has to be done with it
+        ggml_threadpool_wait(pool);
+    } else if (n_threads > 1) {
         for (int j = 1; j < n_threads; j++) {
             const int rc = ggml_thread_join(workers[j].thrd, NULL);
             GGML_ASSERT(rc == 0);
@@ -18679,6 +19913,36 @@ size_t ggml_quantize_chunk(enum ggml_type type, const float * src, void * dst, i
     return result;
 }
 
+enum ggml_type ggml_repack_type(enum ggml_type type) {
+#if !defined(__AVX2__) && !defined(__ARM_NEON)
+    // the scalar kernels of the repacked types are no faster than the ones of the plain types
+    if (ggml_cpu_level == GGML_CPU_LEVEL_BASELINE) {
+        return GGML_TYPE_COUNT;
+    }
+#endif
+    switch (type) {
+        case GGML_TYPE_Q4_0: return GGML_TYPE_Q4_0_4X4;
+        case GGML_TYPE_Q8_0: return GGML_TYPE_Q8_0_4X4;
+        default:             return GGML_TYPE_COUNT;
+    }
+}
+
+void ggml_repack_rows(enum ggml_type type, const void * src, void * dst, int64_t nrows, int64_t n_per_row) {
+    GGML_ASSERT(nrows % type_traits[ggml_repack_type(type)].nrows == 0);
+    switch (type) {
+        case GGML_TYPE_Q4_0:
+            {
+                ggml_repack_q4_0_4x4((const block_q4_0 *) src, (block_q4_0x4 *) dst, (int) nrows, (int) n_per_row);
+            } break;
+        case GGML_TYPE_Q8_0:
+            {
+                ggml_repack_q8_0_4x4((const block_q8_0 *) src, (block_q8_0x4 *) dst, (int) nrows, (int) n_per_row);
+            } break;
+        default:
+            GGML_ASSERT(false);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct gguf_str {
@@ -19792,7 +21056,7 @@ int ggml_cpu_has_avx(void) {
 #if defined(__AVX__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_level >= GGML_CPU_LEVEL_AVX2;
 #endif
 }
 
@@ -19808,7 +21072,7 @@ int ggml_cpu_has_avx2(void) {
 #if defined(__AVX2__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_level >= GGML_CPU_LEVEL_AVX2;
 #endif
 }
 
@@ -19816,7 +21080,7 @@ int ggml_cpu_has_avx512(void) {
 #if defined(__AVX512F__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_level >= GGML_CPU_LEVEL_AVX512;
 #endif
 }
 
@@ -19840,7 +21104,7 @@ int ggml_cpu_has_fma(void) {
 #if defined(__FMA__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_level >= GGML_CPU_LEVEL_AVX2;
 #endif
 }
 
@@ -19872,7 +21136,7 @@ int ggml_cpu_has_f16c(void) {
 #if defined(__F16C__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_level >= GGML_CPU_LEVEL_AVX2;
 #endif
 }
 
@@ -19880,7 +21144,7 @@ int ggml_cpu_has_fp16_va(void) {
 #if defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_level == GGML_CPU_LEVEL_DOTPROD;
 #endif
 }
 
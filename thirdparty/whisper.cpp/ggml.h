@@ -342,6 +342,9 @@ extern "C" {
         GGML_TYPE_I8,
         GGML_TYPE_I16,
         GGML_TYPE_I32,
+        // q4_0 and q8_0 with the blocks of 4 rows interleaved, see ggml_repack_rows(). Never stored in a file
+        GGML_TYPE_Q4_0_4X4,
+        GGML_TYPE_Q8_0_4X4,
         GGML_TYPE_COUNT,
     };
 
@@ -427,6 +430,8 @@ extern "C" {
         GGML_OP_CLAMP,
         GGML_OP_CONV_TRANSPOSE_1D,
         GGML_OP_IM2COL,
+        GGML_OP_CONV_1D_GELU,
+        GGML_OP_LOG_MEL,
         GGML_OP_CONV_TRANSPOSE_2D,
         GGML_OP_POOL_1D,
         GGML_OP_POOL_2D,
@@ -549,12 +554,17 @@ extern "C" {
 
     // the compute plan that needs to be prepared for ggml_graph_compute()
     // since https://github.com/ggerganov/ggml/issues/287
+    struct ggml_threadpool;
+
     struct ggml_cplan {
         size_t    work_size; // size of work buffer, calculated by `ggml_graph_plan()`
         uint8_t * work_data; // work buffer, to be allocated by caller before calling to `ggml_graph_compute()`
 
         int n_threads;
 
+        // persistent worker threads to run the graph on, NULL creates and joins n_threads - 1 threads for this graph
+        struct ggml_threadpool * threadpool;
+
         // abort ggml_graph_compute when true
         bool (*abort_callback)(void * data);
         void * abort_callback_data;
@@ -625,6 +635,9 @@ extern "C" {
         // work buffer for all threads
         size_t wsize;
         void * wdata;
+
+        // state of the graph computation shared by the threads, NULL outside of ggml_graph_compute
+        struct ggml_compute_state_shared * shared;
     };
 
     // misc
@@ -640,6 +653,11 @@ extern "C" {
     GGML_API void    ggml_numa_init(void); // call once for better performance on NUMA systems
     GGML_API bool    ggml_is_numa(void); // true if init detected that system has >1 NUMA node
 
+    // called on every thread of a graph computed on the CPU before it starts, e.g. to set its core affinity
+    // NULL by default, set it before any graph runs
+    typedef void (*ggml_compute_thread_callback)(void);
+    GGML_API void    ggml_set_compute_thread_callback(ggml_compute_thread_callback callback);
+
     GGML_API void    ggml_print_object (const struct ggml_object * obj);
     GGML_API void    ggml_print_objects(const struct ggml_context * ctx);
 
@@ -1066,12 +1084,28 @@ extern "C" {
             struct ggml_tensor  * a,
             struct ggml_tensor  * b);
 
+    // ggml_mul_mat with an F16 result, the dot products are still summed in F32
+    // CPU backend only, without BLAS
+    GGML_API struct ggml_tensor * ggml_mul_mat_f16(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b);
+
     // change the precision of a matrix multiplication
     // set to GGML_PREC_F32 for higher precision (useful for phi-2)
     GGML_API void ggml_mul_mat_set_prec(
             struct ggml_tensor * a,
             enum ggml_prec       prec);
 
+    // in builds that offload the large matrix multiplications of CPU graphs to CLBlast or cuBLAS,
+    // false keeps this one on the CPU (default true)
+    GGML_API void ggml_mul_mat_set_offload(
+            struct ggml_tensor * a,
+            bool                 offload);
+
+    // true for every tensor that is not a GGML_OP_MUL_MAT
+    GGML_API bool ggml_mul_mat_get_offload(const struct ggml_tensor * a);
+
     // indirect matrix multiplication
     //  ggml_mul_mat_id(ctx, as, ids, id, b) ~= ggml_mul_mat(as[ids[id]], b)
     GGML_API struct ggml_tensor * ggml_mul_mat_id(
@@ -1490,6 +1524,33 @@ extern "C" {
             int                   s,
             int                   d);
 
+    // gelu(conv_1d_ph(a, b, s, 1) + c) in one op, without the im2col matrix of the whole input
+    // a: [OC, IC, K] kernel, F16 or F32
+    // b: [IC, L] input, F32
+    // c: OC biases, F32
+    // result: [OC, OL] F32
+    GGML_API struct ggml_tensor * ggml_conv_1d_ph_gelu(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * c,
+            int                   s);
+
+    // the log mel spectrogram of whisper: n_frames frames of the samples a, frame i is a[i*frame_step, i*frame_step + N)
+    // times the window c, zero past the end of a. The power spectrum of a frame through the filters b,
+    // log10(max(x, 1e-10)), then clamped to 8 below the largest value and mapped to (x + 4)/4
+    // a: samples, F32
+    // b: [N/2 + 1, n_mel] filters, F32
+    // c: N window, F32
+    // result: [n_frames, n_mel] F32
+    GGML_API struct ggml_tensor * ggml_log_mel(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * c,
+            int                   frame_step,
+            int                   n_frames);
+
     GGML_API struct ggml_tensor * ggml_conv_transpose_1d(
             struct ggml_context * ctx,
             struct ggml_tensor  * a,
@@ -1850,6 +1911,28 @@ extern "C" {
     GGML_API struct ggml_cplan ggml_graph_plan   (struct ggml_cgraph * cgraph, int n_threads /*= GGML_DEFAULT_N_THREADS*/);
     GGML_API int               ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan);
 
+    // n_threads - 1 workers that stay alive between graphs, the thread calling ggml_graph_compute() is the first of the n_threads
+    // idle workers spin for a short while for the next graph, then park on a condition variable
+    // a graph with more threads than the pool was made for runs without it
+    GGML_API struct ggml_threadpool * ggml_threadpool_new      (int n_threads);
+    GGML_API void                     ggml_threadpool_free     (struct ggml_threadpool * threadpool);
+    GGML_API int                      ggml_threadpool_n_threads(const struct ggml_threadpool * threadpool);
+
+    // runs task(ith, n_threads, data) for ith in [0, n_threads) on the workers of the pool, the calling thread is ith 0
+    // returns when all of them are done. Without a pool of at least n_threads, threads are created and joined for the call
+    typedef void (*ggml_threadpool_task_t)(int ith, int nth, void * data);
+    GGML_API void                     ggml_threadpool_run      (struct ggml_threadpool * threadpool, int n_threads, ggml_threadpool_task_t task, void * data);
+
+    // runs task(i, data) for i in [0, n_tasks) at the same time on threads of the application, e.g. the thread pool of an
+    // engine, and returns without waiting for them. The calls wait for each other, so none of them may queue behind another:
+    // returns NULL when they cannot all run at once right now, ggml then creates threads for them
+    typedef void * (*ggml_thread_executor_start_t)(int n_tasks, void (*task)(int i, void * data), void * data, void * user_data);
+    // returns once the calls of the start that returned handle are done
+    typedef void   (*ggml_thread_executor_join_t)(void * handle, void * user_data);
+    // the pools created from now on have no threads of their own, each graph runs its workers on the executor, which has to
+    // stay valid until they are freed. Pools created before keep their threads. NULL start and join for threads again
+    GGML_API void                     ggml_set_thread_executor (ggml_thread_executor_start_t start, ggml_thread_executor_join_t join, void * user_data);
+
     // same as ggml_graph_compute() but the work data is allocated as a part of the context
     // note: the drawback of this API is that you must have ensured that the context has enough memory for the work data
     GGML_API void ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads);
@@ -2070,6 +2153,12 @@ extern "C" {
 
     GGML_API size_t ggml_quantize_chunk(enum ggml_type type, const float * src, void * dst, int start, int n, int64_t * hist);
 
+    // the type ggml_repack_rows() turns rows of type into, GGML_TYPE_COUNT if it has none that is faster on this CPU
+    // the repacked rows take the same space, groups of ggml_type_traits_t.nrows rows are interleaved in place of the plain ones
+    // they can only be the src0 of a GGML_OP_MUL_MAT on the CPU
+    GGML_API enum ggml_type ggml_repack_type(enum ggml_type type);
+    GGML_API void           ggml_repack_rows(enum ggml_type type, const void * src, void * dst, int64_t nrows, int64_t n_per_row);
+
     //
     // gguf
     //
@@ -2232,16 +2321,26 @@ extern "C" {
     typedef void (*ggml_from_float_t)(const float * GGML_RESTRICT x, void  * GGML_RESTRICT y, int k);
     typedef void (*ggml_vec_dot_t)   (const int n, float * GGML_RESTRICT s, const void * GGML_RESTRICT x, const void * GGML_RESTRICT y);
 
+    // row sizes with a dot product unrolled for them in ggml_type_traits_t::vec_dot_fixed
+    enum ggml_vec_dot_size {
+        GGML_VEC_DOT_SIZE_64,  // the attention heads of every whisper model
+        GGML_VEC_DOT_SIZE_240, // im2col rows of the first convolution, 80 mel bins times a kernel of 3
+        GGML_VEC_DOT_SIZE_384, // same with 128 mel bins, also the width of the tiny models
+        GGML_VEC_DOT_SIZE_COUNT,
+    };
+
     typedef struct {
         const char      * type_name;
         int               blck_size;
         size_t            type_size;
         bool              is_quantized;
+        int64_t           nrows;        // rows of x vec_dot computes at once, more than 1 when they are interleaved
         ggml_to_float_t   to_float;
         ggml_from_float_t from_float;
         ggml_from_float_t from_float_reference;
         ggml_vec_dot_t    vec_dot;
         enum ggml_type    vec_dot_type;
+        ggml_vec_dot_t    vec_dot_fixed[GGML_VEC_DOT_SIZE_COUNT]; // vec_dot of rows of exactly that size, NULL uses vec_dot
     } ggml_type_traits_t;
 
     GGML_API ggml_type_traits_t ggml_internal_get_type_traits(enum ggml_type type);
@@ -0,0 +1,125 @@
+#include "nnapi/whisper-nnapi-encoder.h"
+#include "ggml.h"
+#include <tensorflow/lite/c/c_api.h>
+#include <tensorflow/lite/delegates/nnapi/nnapi_delegate_c_api.h>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+struct whisper_nnapi_context {
+    TfLiteModel * model = nullptr;
+    TfLiteDelegate * delegate = nullptr;
+    TfLiteInterpreter * interpreter = nullptr;
+
+    // the delegate keeps pointers to them
+    std::string accelerator;
+    std::string cache_dir;
+    std::string model_token;
+};
+
+void whisper_nnapi_free(struct whisper_nnapi_context * ctx) {
+    if (!ctx) {
+        return;
+    }
+    // the interpreter before the delegate it runs on
+    if (ctx->interpreter) {
+        TfLiteInterpreterDelete(ctx->interpreter);
+    }
+    if (ctx->delegate) {
+        TfLiteNnapiDelegateDelete(ctx->delegate);
+    }
+    if (ctx->model) {
+        TfLiteModelDelete(ctx->model);
+    }
+    delete ctx;
+}
+
+struct whisper_nnapi_context * whisper_nnapi_init(const char * path_model,
+    const char * accelerator,
+    const char * cache_dir)
+{
+    if (!path_model) {
+        fprintf(stderr, "%s: path_model is null\n", __func__);
+        return nullptr;
+    }
+
+    fprintf(stderr, "%s: path_model = %s, accelerator = %s, cache_dir = %s\n",
+        __func__, path_model, accelerator ? accelerator : "(any)", cache_dir ? cache_dir : "(not set)");
+
+    whisper_nnapi_context * context = new whisper_nnapi_context;
+
+    context->model = TfLiteModelCreateFromFile(path_model);
+    if (!context->model) {
+        fprintf(stderr, "%s: failed to read the model '%s'\n", __func__, path_model);
+        whisper_nnapi_free(context);
+        return nullptr;
+    }
+
+    TfLiteNnapiDelegateOptions options = TfLiteNnapiDelegateOptionsDefault();
+    // the encoder is in f32, the accelerators run it in f16
+    options.allow_fp16 = 1;
+    if (accelerator && accelerator[0]) {
+        context->accelerator = accelerator;
+        options.accelerator_name = context->accelerator.c_str();
+    }
+    if (cache_dir) {
+        // the compilation is cached per model file, the first one for an accelerator takes a while
+        context->cache_dir = cache_dir;
+        context->model_token = std::to_string(std::hash<std::string>()(path_model));
+        options.cache_dir = context->cache_dir.c_str();
+        options.model_token = context->model_token.c_str();
+    }
+    context->delegate = TfLiteNnapiDelegateCreate(&options);
+
+    TfLiteInterpreterOptions * interpreter_options = TfLiteInterpreterOptionsCreate();
+    if (context->delegate) {
+        TfLiteInterpreterOptionsAddDelegate(interpreter_options, context->delegate);
+    } else {
+        fprintf(stderr, "%s: NNAPI is not available, the encoder runs on the TensorFlow Lite CPU kernels\n", __func__);
+    }
+    context->interpreter = TfLiteInterpreterCreate(context->model, interpreter_options);
+    TfLiteInterpreterOptionsDelete(interpreter_options);
+
+    if (!context->interpreter || TfLiteInterpreterAllocateTensors(context->interpreter) != kTfLiteOk) {
+        fprintf(stderr, "%s: failed to create the interpreter of '%s'\n", __func__, path_model);
+        whisper_nnapi_free(context);
+        return nullptr;
+    }
+
+    return context;
+}
+
+int whisper_nnapi_encode(
+    whisper_nnapi_context * ctx,
+    ggml_tensor * mel,
+    ggml_tensor * out) {
+
+    if (!ctx || !mel || !out) {
+        fprintf(stderr, "%s: Error! ctx / mel / out is null\n", __func__);
+        return 0;
+    }
+
+    // [1, n_mels, 3000] in and [1, 1500, n_state] out, in the row-major order of the ggml tensors
+    TfLiteTensor * input_tensor = TfLiteInterpreterGetInputTensor(ctx->interpreter, 0);
+    if (!input_tensor || TfLiteTensorType(input_tensor) != kTfLiteFloat32 || TfLiteTensorByteSize(input_tensor) != ggml_nbytes(mel)) {
+        fprintf(stderr, "%s: Error! the model takes %zu bytes of input, the mel has %zu\n",
+            __func__, input_tensor ? TfLiteTensorByteSize(input_tensor) : 0, ggml_nbytes(mel));
+        return 0;
+    }
+
+    const TfLiteTensor * output_tensor = TfLiteInterpreterGetOutputTensor(ctx->interpreter, 0);
+    if (!output_tensor || TfLiteTensorType(output_tensor) != kTfLiteFloat32 || TfLiteTensorByteSize(output_tensor) != ggml_nbytes(out)) {
+        fprintf(stderr, "%s: Error! the model gives %zu bytes of output, the encoder has %zu\n",
+            __func__, output_tensor ? TfLiteTensorByteSize(output_tensor) : 0, ggml_nbytes(out));
+        return 0;
+    }
+
+    if (TfLiteTensorCopyFromBuffer(input_tensor, mel->data, ggml_nbytes(mel)) != kTfLiteOk ||
+        TfLiteInterpreterInvoke(ctx->interpreter) != kTfLiteOk ||
+        TfLiteTensorCopyToBuffer(output_tensor, out->data, ggml_nbytes(out)) != kTfLiteOk) {
+        fprintf(stderr, "%s: Error! inference failed\n", __func__);
+        return 0;
+    }
+
+    return 1;
+}
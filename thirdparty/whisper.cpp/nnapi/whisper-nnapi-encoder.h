@@ -0,0 +1,32 @@
+// Wrapper of the TensorFlow Lite Whisper Encoder model, run through the NNAPI delegate on Android
+//
+
+#if __cplusplus
+extern "C" {
+#endif
+
+struct whisper_nnapi_context;
+
+// initialize the encoder, given path to the .tflite model, the NNAPI accelerator (e.g. "qti-dsp", null
+// lets NNAPI pick) and path to cache_dir, where NNAPI keeps the model compiled for the device.
+// The ops NNAPI cannot run stay on the TensorFlow Lite CPU kernels. Returns null upon failure.
+struct whisper_nnapi_context * whisper_nnapi_init(const char * path_model,
+                                                  const char * accelerator,
+                                                  const char * cache_dir);
+
+// clean up a ctx previously returned from whisper_nnapi_init()
+void whisper_nnapi_free(struct whisper_nnapi_context * ctx);
+
+struct ggml_tensor;
+
+// Perform encode using NNAPI.
+// Returns 1 on success
+// Returns 0 on failure
+int whisper_nnapi_encode(
+    struct whisper_nnapi_context * ctx,
+    struct ggml_tensor * mel,
+    struct ggml_tensor * out);
+
+#if __cplusplus
+}
+#endif
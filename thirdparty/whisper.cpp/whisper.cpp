@@ -16,13 +16,21 @@
 #include "openvino/whisper-openvino-encoder.h"
 #endif
 
+#ifdef WHISPER_USE_NNAPI
+#include "nnapi/whisper-nnapi-encoder.h"
+#endif
+
 #include "ggml.h"
 #include "ggml-alloc.h"
 #include "ggml-backend.h"
 
 #include <atomic>
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <cstdio>
@@ -30,6 +38,7 @@
 #include <cstring>
 #include <fstream>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
@@ -42,6 +51,33 @@
 #pragma warning(disable: 4244 4267) // possible loss of data
 #endif
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define WHISPER_FFT_SSE
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WHISPER_FFT_SSE2
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define WHISPER_FFT_NEON
+#endif
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(GGML_BIG_ENDIAN)
 #include <bit>
 
@@ -143,11 +179,29 @@ static void whisper_log_callback_default(ggml_log_level level, const char * text
         } \
     } while (0)
 
+// makes whisper_context_params::flash_attn default to true
 //#define WHISPER_USE_FLASH_ATTN
 //#define WHISPER_USE_FLASH_FF
 #define WHISPER_MAX_DECODERS 8
 #define WHISPER_MAX_NODES 4096
 
+// trace zones, implemented by the host (src/trace.cpp) when built with GODOT_WHISPER_TRACE
+#ifdef GODOT_WHISPER_TRACE
+extern "C" void godot_whisper_trace_begin(const char * name);
+extern "C" void godot_whisper_trace_end(void);
+
+struct whisper_trace_zone {
+    whisper_trace_zone(const char * name) { godot_whisper_trace_begin(name); }
+    ~whisper_trace_zone() { godot_whisper_trace_end(); }
+};
+
+#define WHISPER_TRACE_CONCAT_INNER(a, b) a##b
+#define WHISPER_TRACE_CONCAT(a, b) WHISPER_TRACE_CONCAT_INNER(a, b)
+#define WHISPER_TRACE_ZONE(name) whisper_trace_zone WHISPER_TRACE_CONCAT(whisper_trace_zone_, __LINE__)(name)
+#else
+#define WHISPER_TRACE_ZONE(name)
+#endif
+
 //
 // ggml helpers
 //
@@ -158,6 +212,7 @@ static bool ggml_graph_compute_helper(
                          int   n_threads,
       whisper_abort_callback   abort_callback,
                         void * abort_callback_data) {
+    WHISPER_TRACE_ZONE("ggml_graph_compute");
     struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
 
     plan.abort_callback = abort_callback;
@@ -175,6 +230,7 @@ static bool ggml_graph_compute_helper(
        struct ggml_backend * backend,
         struct ggml_cgraph * graph,
                        int   n_threads) {
+    WHISPER_TRACE_ZONE("ggml_backend_graph_compute");
     if (ggml_backend_is_cpu(backend)) {
         ggml_backend_cpu_set_n_threads(backend, n_threads);
     }
@@ -244,6 +300,21 @@ static const std::map<e_model, std::string> g_model_name = {
     { MODEL_LARGE,    "large"    },
 };
 
+// [layer, head] of the decoder cross-attention heads that follow the audio, by whisper_alignment_heads_preset
+static const std::map<whisper_alignment_heads_preset, std::vector<std::pair<int, int>>> g_aheads = {
+    { WHISPER_AHEADS_TINY_EN,   { {1, 0}, {2, 0}, {2, 5}, {3, 0}, {3, 1}, {3, 2}, {3, 3}, {3, 4} } },
+    { WHISPER_AHEADS_TINY,      { {2, 2}, {3, 0}, {3, 2}, {3, 3}, {3, 4}, {3, 5} } },
+    { WHISPER_AHEADS_BASE_EN,   { {3, 3}, {4, 7}, {5, 1}, {5, 5}, {5, 7} } },
+    { WHISPER_AHEADS_BASE,      { {3, 1}, {4, 2}, {4, 3}, {4, 7}, {5, 1}, {5, 2}, {5, 4}, {5, 6} } },
+    { WHISPER_AHEADS_SMALL_EN,  { {6, 6}, {7, 0}, {7, 3}, {7, 8}, {8, 2}, {8, 5}, {8, 7}, {9, 0}, {9, 4}, {9, 8}, {9, 10}, {10, 0}, {10, 1}, {10, 2}, {10, 3}, {10, 6}, {10, 11}, {11, 2}, {11, 4} } },
+    { WHISPER_AHEADS_SMALL,     { {5, 3}, {5, 9}, {8, 0}, {8, 4}, {8, 7}, {8, 8}, {9, 0}, {9, 7}, {9, 9}, {10, 5} } },
+    { WHISPER_AHEADS_MEDIUM_EN, { {11, 4}, {14, 1}, {14, 12}, {14, 14}, {15, 4}, {16, 0}, {16, 4}, {16, 9}, {17, 12}, {17, 14}, {18, 7}, {18, 10}, {18, 15}, {20, 0}, {20, 3}, {20, 9}, {20, 14}, {21, 12} } },
+    { WHISPER_AHEADS_MEDIUM,    { {13, 15}, {15, 4}, {15, 15}, {16, 1}, {20, 0}, {23, 4} } },
+    { WHISPER_AHEADS_LARGE_V1,  { {9, 19}, {11, 2}, {11, 4}, {11, 17}, {22, 7}, {22, 11}, {22, 17}, {23, 2}, {23, 15} } },
+    { WHISPER_AHEADS_LARGE_V2,  { {10, 12}, {13, 17}, {16, 11}, {16, 12}, {16, 13}, {17, 15}, {17, 16}, {18, 4}, {18, 11}, {18, 19}, {19, 11}, {21, 2}, {21, 3}, {22, 3}, {22, 9}, {22, 12}, {23, 5}, {23, 7}, {23, 13}, {25, 5}, {26, 1}, {26, 12}, {27, 15} } },
+    { WHISPER_AHEADS_LARGE_V3,  { {7, 0}, {10, 17}, {12, 18}, {13, 12}, {16, 1}, {17, 14}, {19, 11}, {21, 4}, {24, 1}, {25, 6} } },
+};
+
 static const std::map<std::string, std::pair<int, std::string>> g_lang = {
     { "en",  { 0,  "english",         } },
     { "zh",  { 1,  "chinese",         } },
@@ -355,11 +426,44 @@ struct whisper_mel {
     std::vector<float> data;
 };
 
+// encoder output of the chunks of the previous whisper_encode_chunked_with_state() call
+struct whisper_encoder_chunk {
+    int begin = 0; // first position encoded, the overlap
+    int end   = 0;
+
+    std::vector<float> mel;  // conv input the chunk was encoded from, [n_mels][2*(end - begin)]
+    std::vector<float> embd; // [n_positions][n_state], without the overlap
+};
+
+struct whisper_encoder_cache {
+    int n_chunk   = 0;
+    int n_overlap = 0;
+
+    std::vector<whisper_encoder_chunk> chunks;
+
+    std::vector<float> embd; // the window spliced from the chunks, input of the cross graph
+};
+
+// log10 mel frames of the previous whisper_pcm_to_mel_cached_with_state() call, before clamping and
+// normalization - that part depends on the whole spectrogram. Only frames whose window was all audio,
+// without the reflection or the zero padding, are kept.
+struct whisper_mel_cache {
+    int64_t offset   = 0; // stream position of the first sample of the window of frame 0
+    int     n_frames = 0;
+    int     n_mel    = 0;
+
+    std::vector<float> data; // [n_frames][n_mel]
+};
+
 struct whisper_filters {
     int32_t n_mel;
     int32_t n_fft;
 
     std::vector<float> data;
+
+    // the weights of filter j are zero outside of bins [bin_begin[j], bin_end[j]), set when the filters are loaded
+    std::vector<int32_t> bin_begin;
+    std::vector<int32_t> bin_end;
 };
 
 struct whisper_vocab {
@@ -368,8 +472,58 @@ struct whisper_vocab {
 
     int n_vocab = 51864;
 
-    std::map<token, id> token_to_id;
-    std::map<id, token> id_to_token;
+    // the strings of the tokens back to back, each followed by '\0' so token_text() is a C string
+    std::vector<char>     token_pool;
+    std::vector<uint32_t> token_offset = { 0 }; // where the string of each id starts, then where the last one ends
+    std::vector<id>       token_sorted;         // the ids by their strings, find_token() searches it
+
+    int n_tokens() const {
+        return (int) token_offset.size() - 1;
+    }
+
+    const char * token_text(id token) const {
+        return token_pool.data() + token_offset[token];
+    }
+
+    size_t token_size(id token) const {
+        return token_offset[token + 1] - token_offset[token] - 1;
+    }
+
+    // the next id is the string of size bytes at text
+    void add_token(const char * text, size_t size) {
+        token_pool.insert(token_pool.end(), text, text + size);
+        token_pool.push_back('\0');
+        token_offset.push_back((uint32_t) token_pool.size());
+    }
+
+    // sorts the ids once every token was added, the ones with the same string by id
+    void build_index() {
+        token_sorted.resize(n_tokens());
+        for (id i = 0; i < n_tokens(); ++i) {
+            token_sorted[i] = i;
+        }
+        std::stable_sort(token_sorted.begin(), token_sorted.end(), [this](id a, id b) {
+            return compare(a, token_text(b), token_size(b)) < 0;
+        });
+    }
+
+    // the id of text, or -1. Of the tokens with the same string it is the last, like a map filled in id order
+    id find_token(const std::string & text) const {
+        auto it = std::upper_bound(token_sorted.begin(), token_sorted.end(), text, [this](const std::string & t, id b) {
+            return compare(b, t.data(), t.size()) > 0;
+        });
+        if (it == token_sorted.begin()) {
+            return -1;
+        }
+        --it;
+        return compare(*it, text.data(), text.size()) == 0 ? *it : -1;
+    }
+
+    int compare(id a, const char * text, size_t size) const {
+        const size_t size_a = token_size(a);
+        const int cmp = memcmp(token_text(a), text, std::min(size_a, size));
+        return cmp != 0 ? cmp : (size_a < size ? -1 : (size_a > size ? 1 : 0));
+    }
 
     // reference: https://github.com/openai/whisper/blob/248b6cb124225dd263bb9bd32d060b6517e067f8/whisper/tokenizer.py#L334-L349
     id token_eot        = 50256;
@@ -457,6 +611,15 @@ static void whisper_batch_prep_legacy(whisper_batch & batch, const whisper_token
     batch.logits[n_tokens - 1] = 1;
 }
 
+// index of the first token of the batch that needs logits, the decoder computes them from there on
+static int whisper_batch_first_logits(const whisper_batch & batch) {
+    int i = 0;
+    while (i < batch.n_tokens - 1 && !batch.logits[i]) {
+        ++i;
+    }
+    return i;
+}
+
 // replace std::pair by using customized pair struct (reason: std::pair is very slow)
 template<typename A, typename B>
 struct whisper_pair {
@@ -476,6 +639,11 @@ struct whisper_allocr {
     std::vector<uint8_t> meta;
 
     ggml_backend_buffer_t buffer;
+
+    // the last graph built in meta and allocated in buffer, reused as long as the next one has the same key
+    // only the inputs are set again, see whisper_allocr_graph_get()
+    ggml_cgraph * graph = nullptr;
+    std::array<int32_t, 6> graph_key;
 };
 
 static size_t whisper_allocr_size(struct whisper_allocr & allocr) {
@@ -494,6 +662,32 @@ static void whisper_allocr_graph_init(struct whisper_allocr & allocr, ggml_backe
     ggml_allocr_alloc_graph(alloc, get_graph());
 }
 
+// returns the cached graph if it was built for the same key, otherwise builds and allocates a new one in its place
+// r_built tells the caller that graphs reading the tensors of the previous one must be rebuilt too
+static struct ggml_cgraph * whisper_allocr_graph_get(
+        struct whisper_allocr & allocr,
+        const std::array<int32_t, 6> & key,
+        bool & r_built,
+        const std::function<struct ggml_cgraph *()> & build_graph) {
+    r_built = allocr.graph == nullptr || allocr.graph_key != key;
+
+    if (r_built) {
+        ggml_allocr_reset(allocr.alloc);
+
+        allocr.graph     = build_graph();
+        allocr.graph_key = key;
+
+        ggml_allocr_alloc_graph(allocr.alloc, allocr.graph);
+    }
+
+    return allocr.graph;
+}
+
+// the next whisper_allocr_graph_get() builds again, for code that builds other graphs in the same buffers
+static void whisper_allocr_graph_drop(struct whisper_allocr & allocr) {
+    allocr.graph = nullptr;
+}
+
 static void whisper_allocr_graph_realloc(struct whisper_allocr & allocr, ggml_backend_t backend) {
     if (allocr.alloc == nullptr) {
         // this can be null if we use external encoder like CoreML or OpenVINO
@@ -517,6 +711,8 @@ static void whisper_allocr_free(struct whisper_allocr & allocr) {
         ggml_backend_buffer_free(allocr.buffer);
         allocr.alloc = nullptr;
     }
+
+    allocr.graph = nullptr;
 }
 
 // medium
@@ -703,6 +899,15 @@ struct whisper_model {
     // the model backend data is read-only and can be shared between processors
     struct ggml_backend_buffer * buffer;
 
+    // the pages of buffer pinned with whisper_context_params::lock_model_memory
+    void * locked_data = nullptr;
+    size_t locked_size = 0;
+
+    // the model file mapped with whisper_context_params::mmap_path, and the buffer of the weights used in place
+    void * mapping      = nullptr;
+    size_t mapping_size = 0;
+    struct ggml_backend_buffer * buffer_mapping = nullptr;
+
     // tensors
     int n_loaded;
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -738,6 +943,8 @@ struct whisper_sequence {
     double avg_logprobs;     // the average log probability of the tokens
     double entropy;          // the entropy of the tokens
     double score;            // likelihood rank score
+
+    bool repetition_aborted; // stopped by repetition_limit
 };
 
 // TAGS: WHISPER_DECODER_INIT
@@ -760,12 +967,22 @@ struct whisper_decoder {
     std::vector<float> logits;
     std::vector<float> logprobs;
 
+    // the next token of the fast greedy path, sampled by whisper_process_logits instead of probs and logprobs
+    whisper_token_data token_best;
+
     // work container used to avoid memory allocations
     std::vector<whisper_pair<double, whisper_vocab::id>> logits_id;
 
     mutable std::mt19937 rng; // used for sampling at t > 0.0
 };
 
+// see whisper_ctx_set_gpu_submit_budget(), read by the states while they compute
+struct whisper_gpu_pacing {
+    std::atomic<int32_t> max_submit_us { 0 };
+    std::atomic<whisper_gpu_yield_callback> yield_callback { nullptr };
+    std::atomic<void *> yield_callback_user_data { nullptr };
+};
+
 struct whisper_state {
     int64_t t_sample_us = 0;
     int64_t t_encode_us = 0;
@@ -781,6 +998,11 @@ struct whisper_state {
     int32_t n_prompt = 0; // number of decoder calls with n_tokens >  1  (prompt encoding)
     int32_t n_fail_p = 0; // number of logprob threshold failures
     int32_t n_fail_h = 0; // number of entropy threshold failures
+    int32_t n_fail_r = 0; // number of repetition loops cut short
+
+    bool repetition_aborted = false; // by the best decoder of the last whisper_full call
+
+    int32_t n_draft_accepted = 0; // number of draft tokens that did not need their own decoder call
 
     // unified self-attention KV cache for all decoders
     whisper_kv_cache kv_self;
@@ -789,6 +1011,9 @@ struct whisper_state {
     // shared between all decoders
     whisper_kv_cache kv_cross;
 
+    // encoder output kept per chunk, so kv_cross can be rebuilt without encoding unchanged audio again
+    whisper_encoder_cache encoder_cache;
+
     whisper_mel mel;
 
     whisper_batch batch;
@@ -797,6 +1022,43 @@ struct whisper_state {
 
     ggml_backend_t backend = nullptr;
 
+    // stages placed on the CPU, see whisper_context_params::encoder_device
+    // backend_cpu computes them when backend is a GPU backend, fixed at init
+    bool encoder_on_cpu = false;
+    bool decoder_on_cpu = false;
+    ggml_backend_t backend_cpu = nullptr;
+
+    // the workers of log_mel_spectrogram() when neither backend is the CPU, the workers of that backend otherwise
+    ggml_threadpool * threadpool_mel = nullptr;
+
+    // of the context, and the measured GPU time of a node of the encoder [0] and decoder [1] graphs
+    const whisper_gpu_pacing * gpu_pacing = nullptr;
+    float gpu_us_per_node[2] = { 0.0f, 0.0f };
+
+    // encoder self-attention with ggml_flash_attn, see whisper_context_params::flash_attn
+    // fixed at init, the measured graph allocations depend on it
+    bool flash_attn = false;
+
+    // the encoder convolutions with ggml_conv_1d_ph_gelu instead of im2col + mul_mat + add + gelu,
+    // on the backends with a kernel for it, fixed at init like flash_attn
+    bool fused_conv = false;
+
+    // see whisper_context_params::quantize_activations, fixed at init like flash_attn
+    bool quantize_activations = false;
+
+    // see whisper_context_params::f16_activations, fixed at init like flash_attn
+    bool f16_activations = false;
+
+    // see whisper_context_params::gpu_mel, fixed at init like flash_attn
+    bool gpu_mel = false;
+
+    // [layer, head] of the alignment heads, empty without dtw_token_timestamps
+    std::vector<std::pair<int, int>> aheads;
+    // while set, the decoder graph copies the cross-attention weights of the alignment heads out, one
+    // [n_audio_ctx, n_tokens] tensor per head in aheads_cross_QKs
+    bool aheads_capture = false;
+    std::vector<struct ggml_tensor *> aheads_cross_QKs;
+
     // ggml-alloc:
     // - stores meta info about the intermediate tensors into the `meta` buffers
     // - stores the actual tensor data into the `data` buffers
@@ -805,6 +1067,22 @@ struct whisper_state {
     whisper_allocr alloc_cross;
     whisper_allocr alloc_decode;
 
+    // batched encoder, see whisper_encode_batch_with_states()
+    // measured lazily for the largest batch and audio context seen so far
+    whisper_allocr alloc_encode_batch;
+    int32_t n_encode_batch_measured = 0;
+    int32_t n_encode_batch_ctx_measured = 0;
+    std::vector<float> inp_embd_batch;
+
+    // tensors of the cached decoder graph that write the new keys and values, at kv_store_head cells into kv_self
+    struct whisper_kv_store {
+        struct ggml_tensor * tensor;
+        size_t nb_head; // bytes per cell
+    };
+
+    std::vector<whisper_kv_store> kv_store;
+    int32_t kv_store_head = 0;
+
     // result of the encoder
     struct ggml_tensor * embd_conv = nullptr;
     struct ggml_tensor * embd_enc  = nullptr;
@@ -816,10 +1094,15 @@ struct whisper_state {
     // decode output (2-dimensional array: [n_tokens][n_vocab])
     std::vector<float> logits;
 
+    // the decoder projects onto the vocabulary subset of the context, during whisper_full calls with vocab_subset
+    bool use_vocab_subset = false;
+    std::vector<float> logits_subset; // one row of the projection, scattered into logits
+
     std::vector<whisper_segment> result_all;
     std::vector<whisper_token>   prompt_past;
 
     int lang_id = 0; // english by default
+    float lang_prob = 1.0f; // probability of lang_id when it was auto-detected
 
     std::string path_model; // populated by whisper_init_from_file_with_params()
 
@@ -831,6 +1114,10 @@ struct whisper_state {
     whisper_openvino_context * ctx_openvino = nullptr;
 #endif
 
+#ifdef WHISPER_USE_NNAPI
+    whisper_nnapi_context * ctx_nnapi = nullptr;
+#endif
+
     // [EXPERIMENTAL] token-level timestamps data
     int64_t t_beg  = 0;
     int64_t t_last = 0;
@@ -840,7 +1127,93 @@ struct whisper_state {
     std::vector<float> energy; // PCM signal energy
 
     // [EXPERIMENTAL] speed-up techniques
-    int32_t exp_n_audio_ctx = 0; // 0 - use default
+    int32_t exp_n_audio_ctx = 0; // 0 - use default, n_audio_ctx_max
+    int32_t exp_n_audio_layer = 0; // 0 - all of them, only set while whisper_full encodes, see whisper_full_params::encoder_layers
+
+    // positions the cross-attention cache and the encoder compute buffers are sized for
+    int32_t n_audio_ctx_max = 0;
+
+    // set by whisper_encode_batch_with_states(): the mel and the cross-attention memory already
+    // hold these samples encoded with this audio context, so whisper_full can skip the first encode
+    const float * pre_encoded_samples   = nullptr;
+    int32_t       pre_encoded_n_samples = 0;
+    int32_t       pre_encoded_n_ctx     = -1;
+
+    // mel frame the cross-attention memory was encoded from, -1 before the first encode
+    int32_t cross_mel_offset = -1;
+
+    // set by whisper_pcm_to_mel_cached_with_state(): mel holds the spectrogram of these samples,
+    // so the next whisper_full or batched encode can skip computing it
+    const float * mel_samples   = nullptr;
+    int32_t       mel_n_samples = 0;
+
+    // whether the mel is computed time compressed 2x, and whether it was
+    bool speed_up     = false;
+    bool mel_speed_up = false;
+
+    whisper_mel_cache mel_cache;
+
+    // with gpu_mel, the samples of the last whisper_pcm_to_mel_with_state() call, whose spectrogram the conv
+    // graph computes. mel only has its size until whisper_mel_to_host() computes it for the code reading it
+    std::vector<float>      mel_pending;
+    const whisper_filters * mel_pending_filters   = nullptr;
+    int32_t                 mel_pending_n_threads = 0;
+
+    // inside whisper_full_with_state(), whose decoder steps may join the decode group of the context
+    bool decode_group_member = false;
+};
+
+// rows of the token embedding the decoder projects onto instead of the whole vocabulary
+struct whisper_vocab_subset {
+    struct ggml_context * ctx = nullptr;
+    ggml_backend_buffer_t buffer = nullptr;
+
+    struct ggml_tensor * d_te = nullptr; // [n_text_state, ids.size()]
+
+    std::vector<whisper_token> ids; // ascending, column i of the logits is token ids[i]
+
+    int32_t n_set = 0; // changes with every subset, keys the decoder graphs built on it
+};
+
+static void whisper_vocab_subset_free(struct whisper_vocab_subset & subset) {
+    if (subset.ctx) {
+        ggml_free(subset.ctx);
+    }
+    if (subset.buffer) {
+        ggml_backend_buffer_free(subset.buffer);
+    }
+    subset.ctx    = nullptr;
+    subset.buffer = nullptr;
+    subset.d_te   = nullptr;
+    subset.ids.clear();
+}
+
+// a decoder step posted to the decode group, status is set by the state that computed the step
+struct whisper_decode_request {
+    whisper_state       * state;
+    const whisper_batch * batch;
+    int                   n_threads;
+
+    int status = 0; // 1 decoded with the others, -1 the state decodes the step alone
+};
+
+// continuous batching of the decoder steps of the states decoding at the same time, see whisper_ctx_set_decode_batching()
+struct whisper_decode_group {
+    std::atomic<int32_t> max_states { 0 }; // 0 or 1 disables it
+    std::atomic<int32_t> wait_us    { 0 };
+
+    std::mutex              mutex;
+    std::condition_variable cond;
+
+    bool busy = false; // a merged step is computing
+
+    std::vector<whisper_decode_request *> pending;
+    std::vector<whisper_state *>          expected; // posted a step before and still decode, the next step waits for them
+
+    // only touched by the state computing a merged step, busy keeps it to one at a time
+    ggml_backend_t        backend = nullptr;
+    ggml_backend_buffer_t buffer  = nullptr;
+    std::vector<uint8_t>  meta;
 };
 
 struct whisper_context {
@@ -860,6 +1233,13 @@ struct whisper_context {
     ggml_backend_t backend = nullptr;
 
     std::string path_model; // populated by whisper_init_from_file_with_params()
+
+    // see whisper_ctx_set_vocab_subset()
+    whisper_vocab_subset vocab_subset;
+
+    whisper_gpu_pacing gpu_pacing;
+
+    whisper_decode_group decode_group;
 };
 
 struct whisper_global {
@@ -880,7 +1260,8 @@ static bool kv_cache_init(
         const struct whisper_hparams & hparams,
              struct whisper_kv_cache & cache,
                       ggml_backend_t   backend,
-                           ggml_type   wtype,
+                           ggml_type   type_k,
+                           ggml_type   type_v,
                                  int   n_ctx) {
     const int64_t n_text_state = hparams.n_text_state;
     const int64_t n_text_layer = hparams.n_text_layer;
@@ -907,8 +1288,8 @@ static bool kv_cache_init(
         return false;
     }
 
-    cache.k = ggml_new_tensor_1d(cache.ctx, wtype, n_elements);
-    cache.v = ggml_new_tensor_1d(cache.ctx, wtype, n_elements);
+    cache.k = ggml_new_tensor_1d(cache.ctx, type_k, n_elements);
+    cache.v = ggml_new_tensor_1d(cache.ctx, type_v, n_elements);
 
     const size_t mem_bytes = ggml_nbytes(cache.k) + ggml_nbytes(cache.v);
 
@@ -924,6 +1305,9 @@ static bool kv_cache_init(
         ggml_allocr_free(alloc);
     }
 
+    // the decoder attends to a padded window of cells, keep the ones never written finite
+    ggml_backend_buffer_clear(cache.buffer, 0);
+
     return true;
 }
 
@@ -1053,14 +1437,61 @@ static void whisper_kv_cache_seq_cp(
     }
 }
 
+// sequence j of the cache becomes what sequence src[j] was, for the j with src[j] >= 0, in one pass over the
+// cells. the sequences only relabel the cells they share, a cell no sequence refers to any more is freed and
+// nothing is copied, so beams with a common prefix keep sharing it however they are reordered
+static void whisper_kv_cache_seq_remap(
+          struct whisper_kv_cache & cache,
+    const std::vector<whisper_seq_id> & src) {
+    uint32_t new_head = cache.size;
+
+    std::set<whisper_seq_id> seq_id;
+
+    for (uint32_t i = 0; i < cache.size; ++i) {
+        auto & cell = cache.cells[i];
+        if (cell.pos < 0) {
+            continue;
+        }
+
+        seq_id.clear();
+        for (const whisper_seq_id id : cell.seq_id) {
+            if (id >= (whisper_seq_id) src.size() || src[id] < 0) {
+                seq_id.insert(id);
+            }
+        }
+        for (int j = 0; j < (int) src.size(); ++j) {
+            if (src[j] >= 0 && cell.has_seq_id(src[j])) {
+                seq_id.insert(j);
+            }
+        }
+        cell.seq_id.swap(seq_id);
+
+        if (cell.seq_id.empty()) {
+            cell.pos = -1;
+            if (new_head == cache.size) new_head = i;
+        }
+    }
+
+    if (new_head != cache.size) cache.head = new_head;
+}
+
 static ggml_backend_t whisper_backend_init(const whisper_context_params & params) {
     ggml_backend_t backend_gpu = NULL;
 
+    if (params.use_gpu && params.backend_init) {
+        backend_gpu = params.backend_init(params.backend_init_user_data);
+        if (backend_gpu) {
+            WHISPER_LOG_INFO("%s: using %s backend\n", __func__, ggml_backend_name(backend_gpu));
+            return backend_gpu;
+        }
+        WHISPER_LOG_ERROR("%s: the backend of the host failed to initialize\n", __func__);
+    }
+
     // initialize the backends
 #ifdef GGML_USE_CUBLAS
     if (params.use_gpu && ggml_cublas_loaded()) {
-        WHISPER_LOG_INFO("%s: using CUDA backend\n", __func__);
-        backend_gpu = ggml_backend_cuda_init(0);
+        WHISPER_LOG_INFO("%s: using CUDA backend on device %d\n", __func__, params.gpu_device);
+        backend_gpu = ggml_backend_cuda_init(params.gpu_device);
         if (!backend_gpu) {
             WHISPER_LOG_ERROR("%s: ggml_backend_cuda_init() failed\n", __func__);
         }
@@ -1099,84 +1530,437 @@ static ggml_backend_t whisper_backend_init(const whisper_context_params & params
 //
 // see the convert-pt-to-ggml.py script for details
 //
-static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
-    WHISPER_LOG_INFO("%s: loading model\n", __func__);
+static size_t whisper_page_size() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#elif defined(__unix__) || defined(__APPLE__)
+    return (size_t) sysconf(_SC_PAGESIZE);
+#else
+    return 4096;
+#endif
+}
 
-    const int64_t t_start_us = ggml_time_us();
+// transparent huge pages for the weights in host memory, asked for before they are first written
+static void whisper_model_advise_huge_pages(whisper_model & model) {
+#if defined(MADV_HUGEPAGE)
+    // only the pages the buffer has to itself, the kernel maps the 2 MB aligned runs of them
+    const size_t page_size = whisper_page_size();
+    const uintptr_t data = (uintptr_t) ggml_backend_buffer_get_base(model.buffer);
+    const uintptr_t begin = (data + page_size - 1) & ~(page_size - 1);
+    const uintptr_t end = (data + ggml_backend_buffer_get_size(model.buffer)) & ~(page_size - 1);
+    if (end > begin && madvise((void *) begin, end - begin, MADV_HUGEPAGE) != 0) {
+        WHISPER_LOG_WARN("%s: madvise(MADV_HUGEPAGE) failed: %s\n", __func__, strerror(errno));
+    }
+#else
+    GGML_UNUSED(model);
+#endif
+}
 
-    wctx.t_start_us = t_start_us;
+// pins the weights in host memory, a warning when the system does not let the process lock that much
+static void whisper_model_lock_memory(whisper_model & model) {
+    const size_t page_size = whisper_page_size();
+    const uintptr_t data = (uintptr_t) ggml_backend_buffer_get_base(model.buffer);
+    const uintptr_t begin = data & ~(page_size - 1);
+    const uintptr_t end = (data + ggml_backend_buffer_get_size(model.buffer) + page_size - 1) & ~(page_size - 1);
+    const size_t size = end - begin;
+#if defined(_WIN32)
+    // VirtualLock is limited to the minimum working set, grown by the size of the weights
+    SIZE_T min_size = 0;
+    SIZE_T max_size = 0;
+    if (!GetProcessWorkingSetSize(GetCurrentProcess(), &min_size, &max_size) ||
+        !SetProcessWorkingSetSize(GetCurrentProcess(), min_size + size, std::max(max_size, min_size + size)) ||
+        !VirtualLock((void *) begin, size)) {
+        WHISPER_LOG_WARN("%s: failed to lock %.2f MB of weights in memory, error %lu\n", __func__, size/1e6, (unsigned long) GetLastError());
+        return;
+    }
+#elif defined(__unix__) || defined(__APPLE__)
+    if (mlock((void *) begin, size) != 0) {
+        WHISPER_LOG_WARN("%s: failed to lock %.2f MB of weights in memory: %s, try raising ulimit -l\n", __func__, size/1e6, strerror(errno));
+        return;
+    }
+#else
+    WHISPER_LOG_WARN("%s: locking the weights in memory is not supported on this platform\n", __func__);
+    return;
+#endif
+    model.locked_data = (void *) begin;
+    model.locked_size = size;
+    WHISPER_LOG_INFO("%s: locked %.2f MB of weights in memory\n", __func__, size/1e6);
+}
 
-    auto & model = wctx.model;
-    auto & vocab = wctx.vocab;
+static void whisper_model_unlock_memory(whisper_model & model) {
+    if (model.locked_size == 0) {
+        return;
+    }
+#if defined(_WIN32)
+    VirtualUnlock(model.locked_data, model.locked_size);
+#elif defined(__unix__) || defined(__APPLE__)
+    munlock(model.locked_data, model.locked_size);
+#endif
+    model.locked_data = nullptr;
+    model.locked_size = 0;
+}
 
-    // verify magic
-    {
-        uint32_t magic;
-        read_safe(loader, magic);
-        if (magic != GGML_FILE_MAGIC) {
-            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
-            return false;
-        }
+// maps the model file read-only, see whisper_context_params::mmap_path
+static bool whisper_model_map(whisper_model & model, const char * path) {
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(GGML_BIG_ENDIAN)
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        WHISPER_LOG_WARN("%s: failed to open '%s': %s, reading the weights instead\n", __func__, path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    void * data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // the mapping keeps the file
+    close(fd);
+    if (data == MAP_FAILED) {
+        WHISPER_LOG_WARN("%s: failed to map '%s': %s, reading the weights instead\n", __func__, path, strerror(errno));
+        return false;
     }
+    model.mapping      = data;
+    model.mapping_size = (size_t) st.st_size;
+    return true;
+#else
+    GGML_UNUSED(model);
+    GGML_UNUSED(path);
+    WHISPER_LOG_WARN("%s: mapping the model is not supported on this platform, reading the weights instead\n", __func__);
+    return false;
+#endif
+}
 
-    //load hparams
-    {
-        auto & hparams = model.hparams;
+static void whisper_model_unmap(whisper_model & model) {
+    if (model.buffer_mapping) {
+        ggml_backend_buffer_free(model.buffer_mapping);
+        model.buffer_mapping = nullptr;
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    if (model.mapping) {
+        munmap(model.mapping, model.mapping_size);
+    }
+#endif
+    model.mapping      = nullptr;
+    model.mapping_size = 0;
+}
 
-        read_safe(loader, hparams.n_vocab);
-        read_safe(loader, hparams.n_audio_ctx);
-        read_safe(loader, hparams.n_audio_state);
-        read_safe(loader, hparams.n_audio_head);
-        read_safe(loader, hparams.n_audio_layer);
-        read_safe(loader, hparams.n_text_ctx);
-        read_safe(loader, hparams.n_text_state);
-        read_safe(loader, hparams.n_text_head);
-        read_safe(loader, hparams.n_text_layer);
-        read_safe(loader, hparams.n_mels);
-        read_safe(loader, hparams.ftype);
+// whisper_context_params::read_at over the mapped file
+static size_t whisper_model_mapping_read_at(void * user_data, size_t offset, void * output, size_t read_size) {
+    const whisper_model & model = *(const whisper_model *) user_data;
+    if (offset >= model.mapping_size) {
+        return 0;
+    }
+    read_size = std::min(read_size, model.mapping_size - offset);
+    memcpy(output, (const char *) model.mapping + offset, read_size);
+    return read_size;
+}
 
-        assert(hparams.n_text_state == hparams.n_audio_state);
+// the offset in the model file of what the wrapped loader reads next, where whisper_context_params::read_at
+// picks up the weights
+struct whisper_offset_loader {
+    whisper_model_loader * loader;
+    size_t offset = 0;
+};
 
-        std::string mver = "";
+static size_t whisper_offset_loader_read(void * ctx, void * output, size_t read_size) {
+    auto * offset_loader = (whisper_offset_loader *) ctx;
+    const size_t n_read = offset_loader->loader->read(offset_loader->loader->context, output, read_size);
+    offset_loader->offset += n_read;
+    return n_read;
+}
 
-        if (hparams.n_audio_layer == 4) {
-            model.type = e_model::MODEL_TINY;
-        }
+static bool whisper_offset_loader_eof(void * ctx) {
+    auto * offset_loader = (whisper_offset_loader *) ctx;
+    return offset_loader->loader->eof(offset_loader->loader->context);
+}
 
-        if (hparams.n_audio_layer == 6) {
-            model.type = e_model::MODEL_BASE;
-        }
+// the tensor of the model a tensor header of the file names, nullptr when it does not match one
+// the NULs a name ends with are padding, which files can use to align the data after it, see mmap_path
+static ggml_tensor * whisper_model_find_tensor(whisper_model & model, const std::string & name, int32_t n_dims, const int32_t ne[4], int32_t ttype) {
+    const auto it = model.tensors.find(name.substr(0, name.find_last_not_of('\0') + 1));
+    if (it == model.tensors.end()) {
+        WHISPER_LOG_ERROR("%s: unknown tensor '%s' in model file\n", __func__, name.data());
+        return nullptr;
+    }
 
-        if (hparams.n_audio_layer == 12) {
-            model.type = e_model::MODEL_SMALL;
-        }
+    auto tensor = it->second;
 
-        if (hparams.n_audio_layer == 24) {
-            model.type = e_model::MODEL_MEDIUM;
-        }
+    int32_t nelements = 1;
+    for (int i = 0; i < n_dims; ++i) {
+        nelements *= ne[i];
+    }
 
-        if (hparams.n_audio_layer == 32) {
-            model.type = e_model::MODEL_LARGE;
+    if (ggml_nelements(tensor) != nelements) {
+        WHISPER_LOG_ERROR("%s: tensor '%s' has wrong size in model file\n", __func__, name.data());
+        WHISPER_LOG_ERROR("%s: shape: [%d, %d, %d], expected: [%d, %d, %d]\n",
+                __func__, ne[0], ne[1], ne[2], (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2]);
+        return nullptr;
+    }
 
-            if (hparams.n_vocab == 51866) {
-                mver = " v3";
-            }
-        }
+    if (tensor->ne[0] != ne[0] || tensor->ne[1] != ne[1] || tensor->ne[2] != ne[2]) {
+        WHISPER_LOG_ERROR("%s: tensor '%s' has wrong shape in model file: got [%d, %d, %d], expected [%d, %d, %d]\n",
+                __func__, name.data(), (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2], ne[0], ne[1], ne[2]);
+        return nullptr;
+    }
 
-        const int32_t qntvr = hparams.ftype / GGML_QNT_VERSION_FACTOR;
+    const size_t bpe = ggml_type_size(ggml_type(ttype));
 
-        hparams.ftype %= GGML_QNT_VERSION_FACTOR;
+    if ((nelements*bpe)/ggml_blck_size(tensor->type) != ggml_nbytes(tensor)) {
+        WHISPER_LOG_ERROR("%s: tensor '%s' has wrong size in model file: got %zu, expected %zu\n",
+                __func__, name.data(), ggml_nbytes(tensor), nelements*bpe);
+        return nullptr;
+    }
 
-        // for the big tensors, we have the option to store the data in 16-bit floats or quantized
-        // in order to save memory and also to speed up the computation
-        wctx.wtype = ggml_ftype_to_ggml_type((ggml_ftype) (model.hparams.ftype));
-        if (wctx.wtype == GGML_TYPE_COUNT) {
-            WHISPER_LOG_ERROR("%s: invalid model (bad ftype value %d)\n", __func__, model.hparams.ftype);
+    return tensor;
+}
+
+// for the CPU and Metal backend, we can read directly into the tensor
+static bool whisper_model_reads_into_tensors(ggml_backend_t backend) {
+    return ggml_backend_is_cpu(backend)
+#ifdef GGML_USE_METAL
+        || ggml_backend_is_metal(backend)
+#endif
+        ;
+}
+
+// interleaves the rows of a tensor the loader read into host memory, see whisper_context_params::repack_weights
+// only the matrix multiplications of the blocks, the embeddings are read by get_rows
+static bool whisper_model_repack_tensor(ggml_tensor * tensor, const std::string & name, int32_t n_dims, std::vector<char> & read_buf) {
+    const ggml_type repack_type = ggml_repack_type(tensor->type);
+    if (repack_type == GGML_TYPE_COUNT || n_dims != 2 || tensor->ne[1] % 4 != 0 ||
+        (name.rfind("encoder.blocks.", 0) != 0 && name.rfind("decoder.blocks.", 0) != 0)) {
+        return false;
+    }
+    read_buf.assign((const char *) tensor->data, (const char *) tensor->data + ggml_nbytes(tensor));
+    ggml_repack_rows(tensor->type, read_buf.data(), tensor->data, tensor->ne[1], tensor->ne[0]);
+    tensor->type = repack_type;
+    return true;
+}
+
+typedef size_t (*whisper_read_at_t)(void * user_data, size_t offset, void * output, size_t read_size);
+
+// a tensor of the model and where its data is in the file
+struct whisper_tensor_range {
+    ggml_tensor * tensor;
+    std::string name;
+    int32_t n_dims;
+    size_t offset;
+};
+
+// the tensor headers of the file from offset, where the weights start, with read_at
+static bool whisper_model_read_tensor_ranges(
+        whisper_model & model,
+    whisper_read_at_t   read_at,
+               void * read_at_user_data,
+               size_t   offset,
+        std::vector<whisper_tensor_range> & ranges) {
+    // the headers, each one right after the data of the tensor before it
+    while (true) {
+        int32_t header[3]; // n_dims, length, ttype
+        if (read_at(read_at_user_data, offset, header, sizeof(header)) != sizeof(header)) {
+            break;
+        }
+        offset += sizeof(header);
+        int32_t n_dims = header[0];
+        int32_t length = header[1];
+        int32_t ttype  = header[2];
+        BYTESWAP_VALUE(n_dims);
+        BYTESWAP_VALUE(length);
+        BYTESWAP_VALUE(ttype);
+        if (n_dims < 0 || n_dims > 4 || length <= 0) {
+            WHISPER_LOG_ERROR("%s: invalid tensor header in model file\n", __func__);
             return false;
         }
 
-        WHISPER_LOG_INFO("%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
-        WHISPER_LOG_INFO("%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
+        int32_t ne[4] = { 1, 1, 1, 1 };
+        if (read_at(read_at_user_data, offset, ne, n_dims*sizeof(int32_t)) != n_dims*sizeof(int32_t)) {
+            WHISPER_LOG_ERROR("%s: truncated tensor header in model file\n", __func__);
+            return false;
+        }
+        offset += n_dims*sizeof(int32_t);
+        for (int i = 0; i < n_dims; ++i) {
+            BYTESWAP_VALUE(ne[i]);
+        }
+
+        std::string name(length, '\0');
+        if (read_at(read_at_user_data, offset, &name[0], length) != (size_t) length) {
+            WHISPER_LOG_ERROR("%s: truncated tensor header in model file\n", __func__);
+            return false;
+        }
+        offset += length;
+
+        ggml_tensor * tensor = whisper_model_find_tensor(model, name, n_dims, ne, ttype);
+        if (tensor == nullptr) {
+            return false;
+        }
+        ranges.push_back({ tensor, name, n_dims, offset });
+        offset += ggml_nbytes(tensor);
+    }
+
+    return true;
+}
+
+// reads the weights of ranges with read_at, on several threads
+static bool whisper_model_load_tensors_parallel(
+        whisper_context & wctx,
+        const std::vector<whisper_tensor_range> & ranges,
+      whisper_read_at_t   read_at,
+                 void * read_at_user_data,
+                   bool   repack,
+                  int & n_repacked) {
+    size_t total_size = 0;
+    for (const auto & range : ranges) {
+        total_size += ggml_nbytes(range.tensor);
+    }
+
+    const int n_threads = std::max(1, std::min((int) ranges.size(), wctx.params.n_load_threads > 0 ?
+            wctx.params.n_load_threads : std::min(4, (int) std::thread::hardware_concurrency())));
+    const bool into_tensors = whisper_model_reads_into_tensors(wctx.backend);
+
+    std::atomic<bool> failed { false };
+    std::atomic<int> n_repacked_all { 0 };
+
+    // every thread reads a contiguous part of the file, about the same number of bytes
+    auto load_range = [&](size_t i0, size_t i1) {
+        std::vector<char> read_buf;
+        for (size_t i = i0; i < i1 && !failed; ++i) {
+            const whisper_tensor_range & range = ranges[i];
+            ggml_tensor * tensor = range.tensor;
+            const size_t size = ggml_nbytes(tensor);
+            void * data = tensor->data;
+            if (!into_tensors) {
+                // read into a staging buffer of this thread first, then copy to device memory
+                read_buf.resize(size);
+                data = read_buf.data();
+            }
+            if (read_at(read_at_user_data, range.offset, data, size) != size) {
+                WHISPER_LOG_ERROR("%s: tensor '%s' is truncated in model file\n", __func__, range.name.c_str());
+                failed = true;
+                return;
+            }
+            if (into_tensors) {
+                BYTESWAP_TENSOR(tensor);
+                if (repack && whisper_model_repack_tensor(tensor, range.name, range.n_dims, read_buf)) {
+                    n_repacked_all++;
+                }
+            } else {
+                ggml_backend_tensor_set(tensor, read_buf.data(), 0, size);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t i0 = 0;
+    size_t bytes_before = 0;
+    for (int t = 0; t < n_threads; ++t) {
+        const size_t bytes_end = total_size*(t + 1)/n_threads;
+        size_t i1 = i0;
+        while (i1 < ranges.size() && (t == n_threads - 1 || bytes_before < bytes_end)) {
+            bytes_before += ggml_nbytes(ranges[i1].tensor);
+            i1++;
+        }
+        if (t == n_threads - 1) {
+            load_range(i0, i1);
+        } else {
+            threads.emplace_back(load_range, i0, i1);
+        }
+        i0 = i1;
+    }
+    for (auto & thread : threads) {
+        thread.join();
+    }
+
+    n_repacked = n_repacked_all;
+    return !failed;
+}
+
+static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
+    WHISPER_LOG_INFO("%s: loading model\n", __func__);
+
+    // with read_at or mmap_path the weights are read from where the loader would be once it read the vocabulary
+    whisper_offset_loader offset_loader = { loader };
+    whisper_model_loader offset_model_loader = { &offset_loader, whisper_offset_loader_read, whisper_offset_loader_eof, nullptr };
+    if (wctx.params.read_at || wctx.params.mmap_path) {
+        loader = &offset_model_loader;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    wctx.t_start_us = t_start_us;
+
+    auto & model = wctx.model;
+    auto & vocab = wctx.vocab;
+
+    // verify magic
+    {
+        uint32_t magic;
+        read_safe(loader, magic);
+        if (magic != GGML_FILE_MAGIC) {
+            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
+            return false;
+        }
+    }
+
+    //load hparams
+    {
+        auto & hparams = model.hparams;
+
+        read_safe(loader, hparams.n_vocab);
+        read_safe(loader, hparams.n_audio_ctx);
+        read_safe(loader, hparams.n_audio_state);
+        read_safe(loader, hparams.n_audio_head);
+        read_safe(loader, hparams.n_audio_layer);
+        read_safe(loader, hparams.n_text_ctx);
+        read_safe(loader, hparams.n_text_state);
+        read_safe(loader, hparams.n_text_head);
+        read_safe(loader, hparams.n_text_layer);
+        read_safe(loader, hparams.n_mels);
+        read_safe(loader, hparams.ftype);
+
+        assert(hparams.n_text_state == hparams.n_audio_state);
+
+        std::string mver = "";
+
+        if (hparams.n_audio_layer == 4) {
+            model.type = e_model::MODEL_TINY;
+        }
+
+        if (hparams.n_audio_layer == 6) {
+            model.type = e_model::MODEL_BASE;
+        }
+
+        if (hparams.n_audio_layer == 12) {
+            model.type = e_model::MODEL_SMALL;
+        }
+
+        if (hparams.n_audio_layer == 24) {
+            model.type = e_model::MODEL_MEDIUM;
+        }
+
+        if (hparams.n_audio_layer == 32) {
+            model.type = e_model::MODEL_LARGE;
+
+            if (hparams.n_vocab == 51866) {
+                mver = " v3";
+            }
+        }
+
+        const int32_t qntvr = hparams.ftype / GGML_QNT_VERSION_FACTOR;
+
+        hparams.ftype %= GGML_QNT_VERSION_FACTOR;
+
+        // for the big tensors, we have the option to store the data in 16-bit floats or quantized
+        // in order to save memory and also to speed up the computation
+        wctx.wtype = ggml_ftype_to_ggml_type((ggml_ftype) (model.hparams.ftype));
+        if (wctx.wtype == GGML_TYPE_COUNT) {
+            WHISPER_LOG_ERROR("%s: invalid model (bad ftype value %d)\n", __func__, model.hparams.ftype);
+            return false;
+        }
+
+        WHISPER_LOG_INFO("%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
+        WHISPER_LOG_INFO("%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
         WHISPER_LOG_INFO("%s: n_audio_state = %d\n", __func__, hparams.n_audio_state);
         WHISPER_LOG_INFO("%s: n_audio_head  = %d\n", __func__, hparams.n_audio_head);
         WHISPER_LOG_INFO("%s: n_audio_layer = %d\n", __func__, hparams.n_audio_layer);
@@ -1200,6 +1984,23 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         filters.data.resize(filters.n_mel * filters.n_fft);
         loader->read(loader->context, filters.data.data(), filters.data.size() * sizeof(float));
         BYTESWAP_FILTERS(filters);
+
+        // each triangular filter covers a few bins, the mel spectrogram only goes over those
+        filters.bin_begin.assign(filters.n_mel, 0);
+        filters.bin_end.assign(filters.n_mel, 0);
+        for (int j = 0; j < filters.n_mel; j++) {
+            const float * weights = filters.data.data() + (size_t) j * filters.n_fft;
+            int k0 = 0;
+            int k1 = filters.n_fft;
+            while (k0 < k1 && weights[k0] == 0.0f) {
+                k0++;
+            }
+            while (k1 > k0 && weights[k1 - 1] == 0.0f) {
+                k1--;
+            }
+            filters.bin_begin[j] = k0;
+            filters.bin_end[j]   = k1;
+        }
     }
 
     // load vocab
@@ -1218,6 +2019,10 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
         tmp.reserve(128);
 
+        // the strings average less than 8 bytes with their '\0'
+        vocab.token_pool.reserve((size_t) std::max(n_vocab, model.hparams.n_vocab)*8);
+        vocab.token_offset.reserve((size_t) std::max(n_vocab, model.hparams.n_vocab) + 1);
+
         for (int i = 0; i < n_vocab; i++) {
             uint32_t len;
             read_safe(loader, len);
@@ -1232,8 +2037,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 word = "";
             }
 
-            vocab.token_to_id[word] = i;
-            vocab.id_to_token[i] = word;
+            vocab.add_token(word.data(), word.size());
 
             //printf("%s: vocab[%d] = '%s'\n", __func__, i, word.c_str());
         }
@@ -1283,11 +2087,12 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 } else {
                     word = "[_extra_token_" + std::to_string(i) + "]";
                 }
-                vocab.token_to_id[word] = i;
-                vocab.id_to_token[i] = word;
+                vocab.add_token(word.data(), word.size());
             }
         }
 
+        vocab.build_index();
+
         WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
     }
 
@@ -1514,24 +2319,75 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
     wctx.backend = whisper_backend_init(wctx.params);
 
+    // the offloading CPU backends of these builds would hand the repacked weights to their own kernels
+#if defined(GGML_USE_CUBLAS) || defined(GGML_USE_CLBLAST)
+    const bool repack = false;
+#else
+    const bool repack = wctx.params.repack_weights && ggml_backend_is_cpu(wctx.backend);
+#endif
+
+    // the tensors of the mapped file, the aligned ones point into it
+    std::vector<whisper_tensor_range> ranges;
+
+    if (wctx.params.mmap_path && !repack && whisper_model_reads_into_tensors(wctx.backend) && whisper_model_map(model, wctx.params.mmap_path)) {
+        if (!whisper_model_read_tensor_ranges(model, whisper_model_mapping_read_at, &model, offset_loader.offset, ranges)) {
+            return false;
+        }
+
+        // the buffer spans the whole file, the mapping starts on a page
+        size_t max_size = 0;
+        for (const auto & range : ranges) {
+            max_size = std::max(max_size, ggml_nbytes(range.tensor));
+        }
+#ifdef GGML_USE_METAL
+        if (ggml_backend_is_metal(wctx.backend)) {
+            model.buffer_mapping = ggml_backend_metal_buffer_from_ptr(model.mapping, model.mapping_size, max_size);
+        }
+#endif
+        if (ggml_backend_is_cpu(wctx.backend)) {
+            model.buffer_mapping = ggml_backend_cpu_buffer_from_ptr(model.mapping, model.mapping_size);
+        }
+
+        size_t size_mapped = 0;
+        for (const auto & range : ranges) {
+            if (model.buffer_mapping && range.offset % 32 == 0) {
+                range.tensor->data   = (char *) model.mapping + range.offset;
+                range.tensor->buffer = model.buffer_mapping;
+                size_mapped += ggml_nbytes(range.tensor);
+            }
+        }
+
+        WHISPER_LOG_INFO("%s: %8s mapped size = %8.2f MB of %d tensors\n", __func__, ggml_backend_name(wctx.backend), size_mapped / 1e6, (int) ranges.size());
+    }
+
     {
         size_t size_main = 0;
 
         for (const auto & t : model.tensors) {
-            size_main += ggml_nbytes(t.second) + ggml_tensor_overhead();
+            if (t.second->buffer == nullptr) {
+                size_main += ggml_nbytes(t.second) + ggml_tensor_overhead();
+            }
         }
 
-        model.buffer = ggml_backend_alloc_buffer(wctx.backend, size_main);
+        // the mapping can cover all of them
+        model.buffer = ggml_backend_alloc_buffer(wctx.backend, std::max(size_main, (size_t) ggml_tensor_overhead()));
 
         WHISPER_LOG_INFO("%s: %8s buffer size = %8.2f MB\n", __func__, ggml_backend_name(wctx.backend), size_main / 1e6);
     }
 
+    const bool weights_in_host_memory = ggml_backend_buffer_is_host(model.buffer);
+    if (wctx.params.use_huge_pages && weights_in_host_memory) {
+        whisper_model_advise_huge_pages(model);
+    }
+
     ggml_allocr * alloc = ggml_allocr_new_from_buffer(model.buffer);
 
     // allocate tensors in the backend buffers
     {
         for (const auto & t : model.tensors) {
-            ggml_allocr_alloc(alloc, t.second);
+            if (t.second->buffer == nullptr) {
+                ggml_allocr_alloc(alloc, t.second);
+            }
         }
     }
 
@@ -1543,7 +2399,35 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
         std::vector<char> read_buf;
 
-        while (true) {
+        int n_repacked = 0;
+
+        if (model.mapping) {
+            // the tensors not used in place are copied out of the mapping
+            std::vector<whisper_tensor_range> copied;
+            for (const auto & range : ranges) {
+                total_size += ggml_nbytes(range.tensor);
+                if (range.tensor->buffer != model.buffer_mapping) {
+                    copied.push_back(range);
+                }
+            }
+            if (!whisper_model_load_tensors_parallel(wctx, copied, whisper_model_mapping_read_at, &model, false, n_repacked)) {
+                return false;
+            }
+            model.n_loaded = (int) ranges.size();
+        } else if (wctx.params.read_at) {
+            const int64_t t_start_load_us = ggml_time_us();
+            if (!whisper_model_read_tensor_ranges(model, wctx.params.read_at, wctx.params.read_at_user_data, offset_loader.offset, ranges) ||
+                !whisper_model_load_tensors_parallel(wctx, ranges, wctx.params.read_at, wctx.params.read_at_user_data, repack, n_repacked)) {
+                return false;
+            }
+            for (const auto & range : ranges) {
+                total_size += ggml_nbytes(range.tensor);
+            }
+            model.n_loaded = (int) ranges.size();
+            WHISPER_LOG_INFO("%s: read the tensors in %.2f ms\n", __func__, (ggml_time_us() - t_start_load_us)/1000.0);
+        }
+
+        while (!model.mapping && !wctx.params.read_at) {
             int32_t n_dims;
             int32_t length;
             int32_t ttype;
@@ -1568,46 +2452,18 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
             loader->read(loader->context, &tmp[0], tmp.size()); // read to buffer
             name.assign(&tmp[0], tmp.size());
 
-            if (model.tensors.find(name) == model.tensors.end()) {
-                WHISPER_LOG_ERROR("%s: unknown tensor '%s' in model file\n", __func__, name.data());
-                return false;
-            }
-
-            auto tensor = model.tensors[name.data()];
-
-            if (ggml_nelements(tensor) != nelements) {
-                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong size in model file\n", __func__, name.data());
-                WHISPER_LOG_ERROR("%s: shape: [%d, %d, %d], expected: [%d, %d, %d]\n",
-                        __func__, ne[0], ne[1], ne[2], (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2]);
-                return false;
-            }
-
-            if (tensor->ne[0] != ne[0] || tensor->ne[1] != ne[1] || tensor->ne[2] != ne[2]) {
-                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong shape in model file: got [%d, %d, %d], expected [%d, %d, %d]\n",
-                        __func__, name.data(), (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2], ne[0], ne[1], ne[2]);
-                return false;
-            }
-
-            const size_t bpe = ggml_type_size(ggml_type(ttype));
-
-            if ((nelements*bpe)/ggml_blck_size(tensor->type) != ggml_nbytes(tensor)) {
-                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong size in model file: got %zu, expected %zu\n",
-                        __func__, name.data(), ggml_nbytes(tensor), nelements*bpe);
+            auto tensor = whisper_model_find_tensor(model, name, n_dims, ne, ttype);
+            if (tensor == nullptr) {
                 return false;
             }
 
-            ggml_backend_t backend = wctx.backend;
-
-            //printf("%s: [%5.5s] %s\n", __func__, ggml_backend_name(backend), name.c_str());
-
-            if ((ggml_backend_is_cpu(backend)
-#ifdef GGML_USE_METAL
-                || ggml_backend_is_metal(backend)
-#endif
-                )) {
-                // for the CPU and Metal backend, we can read directly into the tensor
+            if (whisper_model_reads_into_tensors(wctx.backend)) {
                 loader->read(loader->context, tensor->data, ggml_nbytes(tensor));
                 BYTESWAP_TENSOR(tensor);
+
+                if (repack && whisper_model_repack_tensor(tensor, name, n_dims, read_buf)) {
+                    n_repacked++;
+                }
             } else {
                 // read into a temporary buffer first, then copy to device memory
                 read_buf.resize(ggml_nbytes(tensor));
@@ -1623,6 +2479,9 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         }
 
         WHISPER_LOG_INFO("%s: model size    = %7.2f MB\n", __func__, total_size/1e6);
+        if (n_repacked > 0) {
+            WHISPER_LOG_INFO("%s: repacked %d weight tensors into 4-row blocks\n", __func__, n_repacked);
+        }
 
         if (model.n_loaded == 0) {
             WHISPER_LOG_WARN("%s: WARN no tensors loaded from model file - assuming empty model for testing\n", __func__);
@@ -1634,6 +2493,10 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
     ggml_allocr_free(alloc);
 
+    if (wctx.params.lock_model_memory && weights_in_host_memory) {
+        whisper_model_lock_memory(model);
+    }
+
     wctx.t_load_us = ggml_time_us() - t_start_us;
 
     return true;
@@ -1654,18 +2517,111 @@ static bool whisper_encode_external(const whisper_state & wstate) {
     const bool use_openvino = wstate.ctx_openvino != nullptr;
 #endif
 
-    return use_coreml || use_openvino;
+#ifndef WHISPER_USE_NNAPI
+    const bool use_nnapi = false;
+#else
+    const bool use_nnapi = wstate.ctx_nnapi != nullptr;
+#endif
+
+    return use_coreml || use_openvino || use_nnapi;
+}
+
+static void whisper_mel_to_host(whisper_state & wstate);
+static bool whisper_mel_pending_fits(const whisper_state & wstate, int n_ctx);
+static void whisper_set_input_mel_pcm(whisper_state & wstate, struct ggml_cgraph * gf);
+
+// gathers the 2*n_ctx mel frames from mel_offset into the input of the conv graph, zero padded past the end
+static void whisper_set_input_mel(
+          whisper_state & wstate,
+     struct ggml_tensor * mel,
+              const int   mel_offset) {
+    whisper_mel_to_host(wstate);
+
+    const auto & mel_inp = wstate.mel;
+
+    const int n_len = mel->ne[0];
+
+    assert(mel_inp.n_mel == mel->ne[1]);
+
+    wstate.inp_mel.resize(ggml_nelements(mel));
+
+    float * dst = wstate.inp_mel.data();
+    memset(dst, 0, ggml_nbytes(mel));
+
+    const int i0 = std::min(mel_offset,         mel_inp.n_len);
+    const int i1 = std::min(mel_offset + n_len, mel_inp.n_len);
+
+    for (int j = 0; j < mel_inp.n_mel; ++j) {
+        for (int i = i0; i < i1; ++i) {
+            dst[j*n_len + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
+        }
+    }
+
+    ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
+}
+
+// ggml_mul_mat(w, cur) in the encoder stage
+//
+// with wstate.quantize_activations and quantized weights, cur is first converted to the type of the dot products
+// with w by a ggml_cpy, which all the threads of the graph compute, and the mul_mat skips its own conversion,
+// which runs on one thread. cur_vec_dot keeps the conversion for the next mul_mat with cur, when its weights
+// take the same type
+//
+// the F16 activations of wstate.f16_activations give an F16 result. F16 weights read them as they are, the
+// others a conversion shared the same way, which ggml_mul_mat only makes from F32
+static struct ggml_tensor * whisper_mul_mat_enc(
+        struct ggml_context  * ctx,
+        const whisper_state  & wstate,
+        struct ggml_tensor   * w,
+        struct ggml_tensor   * cur,
+        struct ggml_tensor  ** cur_vec_dot = nullptr) {
+    if (cur->type == GGML_TYPE_F16) {
+        const ggml_type type = ggml_internal_get_type_traits(w->type).vec_dot_type;
+
+        struct ggml_tensor * x = cur;
+        if (type != GGML_TYPE_F16) {
+            x = cur_vec_dot && *cur_vec_dot && (*cur_vec_dot)->type == type ? *cur_vec_dot : nullptr;
+            if (!x) {
+                x = ggml_cpy(ctx, cur, ggml_new_tensor(ctx, type, ggml_n_dims(cur), cur->ne));
+                if (cur_vec_dot) {
+                    *cur_vec_dot = x;
+                }
+            }
+        }
+
+        return ggml_mul_mat_f16(ctx, w, x);
+    }
+
+    if (!wstate.quantize_activations || !ggml_is_quantized(w->type)) {
+        return ggml_mul_mat(ctx, w, cur);
+    }
+
+    const ggml_type type = ggml_internal_get_type_traits(w->type).vec_dot_type;
+    if (!ggml_is_quantized(type) || cur->ne[0] % ggml_blck_size(type) != 0) {
+        return ggml_mul_mat(ctx, w, cur);
+    }
+
+    struct ggml_tensor * x = cur_vec_dot && *cur_vec_dot && (*cur_vec_dot)->type == type ? *cur_vec_dot : nullptr;
+    if (!x) {
+        x = ggml_cpy(ctx, cur, ggml_new_tensor(ctx, type, ggml_n_dims(cur), cur->ne));
+        if (cur_vec_dot) {
+            *cur_vec_dot = x;
+        }
+    }
+
+    return ggml_mul_mat(ctx, w, x);
 }
 
+// from_pcm: the mel is computed in the graph with ggml_log_mel, from the samples whisper_set_input_mel_pcm() sets
 static struct ggml_cgraph * whisper_build_graph_conv(
         whisper_context & wctx,
           whisper_state & wstate,
-              const int   mel_offset) {
+              const int   mel_offset,
+             const bool   from_pcm = false) {
     const auto & model   = wctx.model;
-    const auto & mel_inp = wstate.mel;
     const auto & hparams = model.hparams;
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wstate.n_audio_ctx_max;
     const int n_state = hparams.n_audio_state; GGML_UNUSED(n_state);
 
     const int n_mels = hparams.n_mels;
@@ -1682,35 +2638,40 @@ static struct ggml_cgraph * whisper_build_graph_conv(
 
     ggml_allocr * alloc = wstate.alloc_conv.alloc;
 
-    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
-    ggml_allocr_alloc(alloc, mel);
-
-    assert(mel->type == GGML_TYPE_F32);
-    if (!ggml_allocr_is_measure(alloc)) {
-        assert(mel_inp.n_mel == n_mels);
-
-        wstate.inp_mel.resize(ggml_nelements(mel));
+    struct ggml_tensor * mel = nullptr;
 
-        float * dst = wstate.inp_mel.data();
-        memset(dst, 0, ggml_nbytes(mel));
+    if (from_pcm) {
+        // the padded samples of the 2*n_ctx frames
+        struct ggml_tensor * pcm = ggml_new_tensor_1d(ctx0, GGML_TYPE_F32, (2*n_ctx - 1)*WHISPER_HOP_LENGTH + WHISPER_N_FFT);
+        ggml_allocr_alloc(alloc, pcm);
+        ggml_set_name(pcm, "mel_pcm");
 
-        const int i0 = std::min(mel_offset,           mel_inp.n_len);
-        const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
+        struct ggml_tensor * filters = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, WHISPER_N_FFT/2 + 1, n_mels);
+        ggml_allocr_alloc(alloc, filters);
+        ggml_set_name(filters, "mel_filters");
 
-        for (int j = 0; j < mel_inp.n_mel; ++j) {
-            for (int i = i0; i < i1; ++i) {
-                dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
-            }
-        }
+        struct ggml_tensor * window = ggml_new_tensor_1d(ctx0, GGML_TYPE_F32, WHISPER_N_FFT);
+        ggml_allocr_alloc(alloc, window);
+        ggml_set_name(window, "mel_window");
 
-        ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
+        mel = ggml_log_mel(ctx0, pcm, filters, window, WHISPER_HOP_LENGTH, 2*n_ctx);
+    } else {
+        mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
+        ggml_allocr_alloc(alloc, mel);
     }
+    ggml_set_name(mel, "mel");
+
+    assert(mel->type == GGML_TYPE_F32);
 
     struct ggml_tensor * cur = nullptr;
 
     if (!whisper_encode_external(wstate)) {
         // convolution + gelu
-        {
+        if (wstate.fused_conv) {
+            // a tile of the input at a time, rather than the im2col matrices of all of it in the compute buffer
+            cur = ggml_conv_1d_ph_gelu(ctx0, model.e_conv_1_w, mel, model.e_conv_1_b, 1);
+            cur = ggml_conv_1d_ph_gelu(ctx0, model.e_conv_2_w, cur, model.e_conv_2_b, 2);
+        } else {
             cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
             cur = ggml_add(ctx0, cur, model.e_conv_1_b);
 
@@ -1725,6 +2686,10 @@ static struct ggml_cgraph * whisper_build_graph_conv(
         ggml_set_name(cur, "embd_conv");
         wstate.embd_conv = cur;
     } else {
+        // the external encoders run while the graph is built, the graph is never cached
+        if (!ggml_allocr_is_measure(alloc)) {
+            whisper_set_input_mel(wstate, mel, mel_offset);
+        }
 #ifdef WHISPER_USE_COREML
         cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
         ggml_allocr_alloc(alloc, cur);
@@ -1741,6 +2706,14 @@ static struct ggml_cgraph * whisper_build_graph_conv(
             whisper_openvino_encode(wstate.ctx_openvino, mel, cur);
         }
 #endif
+#ifdef WHISPER_USE_NNAPI
+        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
+        ggml_allocr_alloc(alloc, cur);
+
+        if (!ggml_allocr_is_measure(alloc)) {
+            whisper_nnapi_encode(wstate.ctx_nnapi, mel, cur);
+        }
+#endif
 
         ggml_set_name(cur, "embd_enc");
         wstate.embd_enc = cur;
@@ -1755,14 +2728,15 @@ static struct ggml_cgraph * whisper_build_graph_conv(
 
 static struct ggml_cgraph * whisper_build_graph_encoder(
         whisper_context & wctx,
-          whisper_state & wstate) {
+          whisper_state & wstate,
+              const int   pe_offset) {
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wstate.n_audio_ctx_max;
     const int n_state = hparams.n_audio_state;
     const int n_head  = hparams.n_audio_head;
-    const int n_layer = hparams.n_audio_layer;
+    const int n_layer = wstate.exp_n_audio_layer > 0 ? std::min(wstate.exp_n_audio_layer, hparams.n_audio_layer) : hparams.n_audio_layer;
 
     struct ggml_init_params params = {
         /*.mem_size   =*/ wstate.alloc_encode.meta.size(),
@@ -1798,14 +2772,20 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
     //    memset(model.memory_cross_v->data, 0, ggml_nbytes(model.memory_cross_v));
     //}
 
-    static int iter = 0;
+    //static int iter = 0;
 
+    // pe_offset > 0 when the window is a chunk further into the audio
     const size_t e_pe_stride = model.e_pe->ne[0]*ggml_element_size(model.e_pe);
-    const size_t e_pe_offset = model.e_pe->ne[0]*ggml_element_size(model.e_pe)*n_ctx*iter;
+    const size_t e_pe_offset = model.e_pe->ne[0]*ggml_element_size(model.e_pe)*pe_offset;
 
     struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, e_pe_offset);
     cur = ggml_add(ctx0, e_pe, ggml_cont(ctx0, ggml_transpose(ctx0, cur)));
 
+    // the layers keep the residual stream and the tensors between their ops in F16
+    if (wstate.f16_activations) {
+        cur = ggml_cpy(ctx0, cur, ggml_new_tensor_2d(ctx0, GGML_TYPE_F16, n_state, n_ctx));
+    }
+
     // ===================================================================
 
     // original:
@@ -1828,100 +2808,99 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
         // self-attention
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
-                    layer.attn_q_w,
-                    cur);
+            // Q, K and V read the same normalized input
+            struct ggml_tensor * cur_vec_dot = nullptr;
+
+            struct ggml_tensor * Qcur = whisper_mul_mat_enc(ctx0, wstate, layer.attn_q_w, cur, &cur_vec_dot);
 
             Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
 
             //Qcur = ggml_scale(ctx0, Qcur, pow(float(n_state)/n_head, -0.25));
 
             // note: no bias for Key
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
-                    layer.attn_k_w,
-                    cur);
+            struct ggml_tensor * Kcur = whisper_mul_mat_enc(ctx0, wstate, layer.attn_k_w, cur, &cur_vec_dot);
 
             //Kcur = ggml_scale(ctx0, Kcur, pow(float(n_state)/n_head, -0.25));
 
-            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
-                    layer.attn_v_w,
-                    cur);
+            struct ggml_tensor * Vcur = whisper_mul_mat_enc(ctx0, wstate, layer.attn_v_w, cur, &cur_vec_dot);
 
             Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
 
             // ------
 
-#ifdef WHISPER_USE_FLASH_ATTN
-            struct ggml_tensor * Q =
-                ggml_permute(ctx0,
-                        ggml_cpy(ctx0,
-                            Qcur,
-                            ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
-                        0, 2, 1, 3);
+            struct ggml_tensor * KQV = nullptr;
+
+            if (wstate.flash_attn) {
+                // one row of the attention matrix at a time, the whole [n_ctx, n_ctx] matrix is never written
+                struct ggml_tensor * Q =
+                    ggml_permute(ctx0,
+                            ggml_cpy(ctx0,
+                                Qcur,
+                                ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
+                            0, 2, 1, 3);
+
+                struct ggml_tensor * K =
+                    ggml_permute(ctx0,
+                            ggml_cpy(ctx0,
+                                Kcur,
+                                ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
+                            0, 2, 1, 3);
+
+                struct ggml_tensor * V =
+                    ggml_cpy(ctx0,
+                            ggml_permute(ctx0,
+                                ggml_reshape_3d(ctx0,
+                                    Vcur,
+                                    n_state/n_head, n_head, n_ctx),
+                                1, 2, 0, 3),
+                            ggml_new_tensor_3d(ctx0, wctx.itype, n_ctx, n_state/n_head, n_head));
+
+                KQV = ggml_flash_attn(ctx0, Q, K, V, false);
+            } else {
+                struct ggml_tensor * Q =
+                    ggml_permute(ctx0,
+                            ggml_cpy(ctx0,
+                                Qcur,
+                                ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_state/n_head, n_head, n_ctx)),
+                            0, 2, 1, 3);
+
+                struct ggml_tensor * K =
+                    ggml_permute(ctx0,
+                            ggml_cpy(ctx0,
+                                Kcur,
+                                ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
+                            0, 2, 1, 3);
+
+                // K * Q
+                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+
+                struct ggml_tensor * KQ_scaled = ggml_scale(ctx0, KQ, KQscale);
+
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ_scaled);
+
+                struct ggml_tensor * V =
+                    ggml_cpy(ctx0,
+                            ggml_permute(ctx0,
+                                ggml_reshape_3d(ctx0,
+                                    Vcur,
+                                    n_state/n_head, n_head, n_ctx),
+                                1, 2, 0, 3),
+                            ggml_new_tensor_3d(ctx0, wctx.itype, n_ctx, n_state/n_head, n_head)
+                            );
+
+                KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+            }
 
-            struct ggml_tensor * K =
-                ggml_permute(ctx0,
-                        ggml_cpy(ctx0,
-                            Kcur,
-                            ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
-                        0, 2, 1, 3);
-
-            struct ggml_tensor * V =
-                ggml_cpy(ctx0,
-                        ggml_permute(ctx0,
-                            ggml_reshape_3d(ctx0,
-                                Vcur,
-                                n_state/n_head, n_head, n_ctx),
-                            1, 2, 0, 3),
-                        ggml_new_tensor_3d(ctx0, wctx.itype, n_ctx, n_state/n_head, n_head));
-
-            struct ggml_tensor * KQV = ggml_flash_attn(ctx0, Q, K, V, false);
-#else
-            struct ggml_tensor * Q =
-                ggml_permute(ctx0,
-                        ggml_cpy(ctx0,
-                            Qcur,
-                            ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_state/n_head, n_head, n_ctx)),
-                        0, 2, 1, 3);
-
-            struct ggml_tensor * K =
-                ggml_permute(ctx0,
-                        ggml_cpy(ctx0,
-                            Kcur,
-                            ggml_new_tensor_3d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx)),
-                        0, 2, 1, 3);
-
-            // K * Q
-            struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
-
-            struct ggml_tensor * KQ_scaled = ggml_scale(ctx0, KQ, KQscale);
-
-            struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ_scaled);
-
-            struct ggml_tensor * V =
-                ggml_cpy(ctx0,
-                        ggml_permute(ctx0,
-                            ggml_reshape_3d(ctx0,
-                                Vcur,
-                                n_state/n_head, n_head, n_ctx),
-                            1, 2, 0, 3),
-                        ggml_new_tensor_3d(ctx0, wctx.itype, n_ctx, n_state/n_head, n_head)
-                        );
-
-            struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
-#endif
-            struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+            struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
 
             cur = ggml_cpy(ctx0,
                     KQV_merged,
-                    ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx));
+                    ggml_new_tensor_2d(ctx0, inpL->type, n_state, n_ctx));
         }
 
         // projection
         {
-            cur = ggml_mul_mat(ctx0,
-                    layer.attn_ln_1_w,
-                    cur);
+            cur = whisper_mul_mat_enc(ctx0, wstate, layer.attn_ln_1_w, cur);
 
             cur = ggml_add(ctx0, cur, layer.attn_ln_1_b);
         }
@@ -1949,9 +2928,7 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
                     layer.mlp_0_w, layer.mlp_0_b, layer.mlp_1_w, layer.mlp_1_b);
 #else
             // fully connected
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_0_w,
-                    cur);
+            cur = whisper_mul_mat_enc(ctx0, wstate, layer.mlp_0_w, cur);
 
             cur = ggml_add(ctx0, cur, layer.mlp_0_b);
 
@@ -1959,9 +2936,7 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
             cur = ggml_gelu(ctx0, cur);
 
             // projection
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_1_w,
-                    cur);
+            cur = whisper_mul_mat_enc(ctx0, wstate, layer.mlp_1_w, cur);
 
             cur = ggml_add(ctx0, cur, layer.mlp_1_b);
 #endif
@@ -1972,6 +2947,11 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
     cur = inpL;
 
+    // the cross-attention and the encoder cache read the output in F32
+    if (cur->type != GGML_TYPE_F32) {
+        cur = ggml_cpy(ctx0, cur, ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx));
+    }
+
     // norm
     {
         cur = ggml_norm(ctx0, cur, hparams.eps);
@@ -2002,14 +2982,263 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
     return gf;
 }
 
+// same as whisper_build_graph_encoder() for n_batch sequences of n_ctx positions at once
+//
+// the sequences are laid out one after another along the position axis, so the
+// per-position operations (norms, projections, MLP) run as single large matrix
+// multiplications, and only the self-attention is computed per sequence
+//
+//   - states: the n_batch states whose embd_conv is the input, nullptr while measuring
+//   - r_embd: receives one [n_state, n_ctx] view of the output per sequence
+//
+// copies the conv outputs of the states one after the other into the input of the batched encoder graph
+static void whisper_set_input_embd_batch(
+                  whisper_state & wstate,
+             struct ggml_tensor * inp,
+          whisper_state * const * states,
+                      const int   n_batch) {
+    const size_t n_per_state = (size_t) inp->ne[0]*inp->ne[1];
+
+    wstate.inp_embd_batch.resize(n_per_state*n_batch);
+
+    for (int ib = 0; ib < n_batch; ++ib) {
+        ggml_backend_tensor_get(states[ib]->embd_conv, wstate.inp_embd_batch.data() + ib*n_per_state, 0, n_per_state*sizeof(float));
+    }
+
+    ggml_backend_tensor_set(inp, wstate.inp_embd_batch.data(), 0, ggml_nbytes(inp));
+}
+
+static struct ggml_cgraph * whisper_build_graph_encoder_batch(
+                whisper_context & wctx,
+                  whisper_state & wstate,
+                      const int   n_batch,
+                      const int   n_ctx,
+           struct ggml_tensor  ** r_embd) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+    const int n_layer = hparams.n_audio_layer;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.alloc_encode_batch.meta.size(),
+        /*.mem_buffer =*/ wstate.alloc_encode_batch.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    ggml_allocr * alloc = wstate.alloc_encode_batch.alloc;
+
+    // the conv outputs of all states, [n_ctx, n_state] each
+    // set by whisper_set_input_embd_batch() after allocation
+    struct ggml_tensor * inp = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_ctx, n_state, n_batch);
+    ggml_allocr_alloc(alloc, inp);
+    ggml_set_name(inp, "inp_embd_batch");
+
+    const float KQscale = 1.0f/sqrtf(float(n_state)/n_head);
+
+    const size_t e_pe_stride = model.e_pe->ne[0]*ggml_element_size(model.e_pe);
+
+    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, 0);
+
+    // [n_state, n_ctx, n_batch], the positional embedding is broadcast over the batch
+    struct ggml_tensor * cur = ggml_add(ctx0, ggml_cont(ctx0, ggml_permute(ctx0, inp, 1, 0, 2, 3)), e_pe);
+
+    cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_batch);
+
+    // see whisper_build_graph_encoder()
+    if (wstate.f16_activations) {
+        cur = ggml_cpy(ctx0, cur, ggml_new_tensor_2d(ctx0, GGML_TYPE_F16, n_state, n_ctx*n_batch));
+    }
+
+    struct ggml_tensor * inpL = cur;
+
+    for (int il = 0; il < n_layer; ++il) {
+        const auto & layer = model.layers_encoder[il];
+
+        // norm
+        {
+            cur = ggml_norm(ctx0, inpL, hparams.eps);
+
+            // cur = ln_0_w*cur + ln_0_b
+            cur = ggml_add(ctx0,
+                    ggml_mul(ctx0, cur, layer.attn_ln_0_w),
+                    layer.attn_ln_0_b);
+        }
+
+        // self-attention, per sequence
+        {
+            // Q, K and V read the same normalized input
+            struct ggml_tensor * cur_vec_dot = nullptr;
+
+            struct ggml_tensor * Qcur = whisper_mul_mat_enc(ctx0, wstate, layer.attn_q_w, cur, &cur_vec_dot);
+
+            Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
+
+            // note: no bias for Key
+            struct ggml_tensor * Kcur = whisper_mul_mat_enc(ctx0, wstate, layer.attn_k_w, cur, &cur_vec_dot);
+
+            struct ggml_tensor * Vcur = whisper_mul_mat_enc(ctx0, wstate, layer.attn_v_w, cur, &cur_vec_dot);
+
+            Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
+
+            struct ggml_tensor * KQV = nullptr;
+
+            if (wstate.flash_attn) {
+                // [n_state/n_head, n_ctx, n_head, n_batch]
+                struct ggml_tensor * Q =
+                    ggml_permute(ctx0,
+                            ggml_cpy(ctx0,
+                                Qcur,
+                                ggml_new_tensor_4d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx, n_batch)),
+                            0, 2, 1, 3);
+
+                struct ggml_tensor * K =
+                    ggml_permute(ctx0,
+                            ggml_cpy(ctx0,
+                                Kcur,
+                                ggml_new_tensor_4d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx, n_batch)),
+                            0, 2, 1, 3);
+
+                // [n_ctx, n_state/n_head, n_head, n_batch]
+                struct ggml_tensor * V =
+                    ggml_cpy(ctx0,
+                            ggml_permute(ctx0,
+                                ggml_reshape_4d(ctx0,
+                                    Vcur,
+                                    n_state/n_head, n_head, n_ctx, n_batch),
+                                1, 2, 0, 3),
+                            ggml_new_tensor_4d(ctx0, wctx.itype, n_ctx, n_state/n_head, n_head, n_batch));
+
+                KQV = ggml_flash_attn(ctx0, Q, K, V, false);
+            } else {
+                // [n_state/n_head, n_ctx, n_head, n_batch]
+                struct ggml_tensor * Q =
+                    ggml_permute(ctx0,
+                            ggml_cpy(ctx0,
+                                Qcur,
+                                ggml_new_tensor_4d(ctx0, GGML_TYPE_F32, n_state/n_head, n_head, n_ctx, n_batch)),
+                            0, 2, 1, 3);
+
+                struct ggml_tensor * K =
+                    ggml_permute(ctx0,
+                            ggml_cpy(ctx0,
+                                Kcur,
+                                ggml_new_tensor_4d(ctx0, wctx.itype, n_state/n_head, n_head, n_ctx, n_batch)),
+                            0, 2, 1, 3);
+
+                // K * Q
+                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+
+                struct ggml_tensor * KQ_scaled = ggml_scale(ctx0, KQ, KQscale);
+
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ_scaled);
+
+                // [n_ctx, n_state/n_head, n_head, n_batch]
+                struct ggml_tensor * V =
+                    ggml_cpy(ctx0,
+                            ggml_permute(ctx0,
+                                ggml_reshape_4d(ctx0,
+                                    Vcur,
+                                    n_state/n_head, n_head, n_ctx, n_batch),
+                                1, 2, 0, 3),
+                            ggml_new_tensor_4d(ctx0, wctx.itype, n_ctx, n_state/n_head, n_head, n_batch)
+                            );
+
+                KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+            }
+
+            struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+
+            cur = ggml_cpy(ctx0,
+                    KQV_merged,
+                    ggml_new_tensor_2d(ctx0, inpL->type, n_state, n_ctx*n_batch));
+        }
+
+        // projection
+        {
+            cur = whisper_mul_mat_enc(ctx0, wstate, layer.attn_ln_1_w, cur);
+
+            cur = ggml_add(ctx0, cur, layer.attn_ln_1_b);
+        }
+
+        // add the input
+        cur = ggml_add(ctx0, cur, inpL);
+
+        struct ggml_tensor * inpFF = cur;
+
+        // feed-forward network
+        {
+            // norm
+            {
+                cur = ggml_norm(ctx0, inpFF, hparams.eps);
+
+                // cur = mlp_ln_w*cur + mlp_ln_b
+                cur = ggml_add(ctx0,
+                        ggml_mul(ctx0, cur, layer.mlp_ln_w),
+                        layer.mlp_ln_b);
+            }
+
+            // fully connected
+            cur = whisper_mul_mat_enc(ctx0, wstate, layer.mlp_0_w, cur);
+
+            cur = ggml_add(ctx0, cur, layer.mlp_0_b);
+
+            // GELU activation
+            cur = ggml_gelu(ctx0, cur);
+
+            // projection
+            cur = whisper_mul_mat_enc(ctx0, wstate, layer.mlp_1_w, cur);
+
+            cur = ggml_add(ctx0, cur, layer.mlp_1_b);
+        }
+
+        inpL = ggml_add(ctx0, cur, inpFF);
+    }
+
+    cur = inpL;
+
+    if (cur->type != GGML_TYPE_F32) {
+        cur = ggml_cpy(ctx0, cur, ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx*n_batch));
+    }
+
+    // norm
+    {
+        cur = ggml_norm(ctx0, cur, hparams.eps);
+
+        // cur = ln_f_g*cur + ln_f_b
+        cur = ggml_add(ctx0,
+                ggml_mul(ctx0, cur, model.e_ln_w),
+                model.e_ln_b);
+    }
+
+    ggml_build_forward_expand(gf, cur);
+
+    // the views are part of the graph so that they get their data assigned by the allocator
+    for (int ib = 0; ib < n_batch; ++ib) {
+        r_embd[ib] = ggml_view_2d(ctx0, cur, n_state, n_ctx, cur->nb[1], ib*n_ctx*cur->nb[1]);
+        ggml_build_forward_expand(gf, r_embd[ib]);
+    }
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
 // pre-compute cross-attention memory
+// with host_input, the encoder output is read from wstate.encoder_cache.embd instead of wstate.embd_enc
 static struct ggml_cgraph * whisper_build_graph_cross(
         whisper_context & wctx,
-          whisper_state & wstate) {
+          whisper_state & wstate,
+             const bool   host_input) {
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wstate.n_audio_ctx_max;
     const int n_state = hparams.n_audio_state;
     const int n_head  = hparams.n_audio_head;
 
@@ -2023,30 +3252,32 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
     ggml_cgraph * gf = ggml_new_graph(ctx0);
 
-    //ggml_allocr * alloc = wstate.alloc_cross.alloc;
+    struct ggml_tensor * cur = nullptr;
 
-    //struct ggml_tensor * cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
-    //ggml_allocr_alloc(alloc, cur);
+    if (host_input) {
+        ggml_allocr * alloc = wstate.alloc_cross.alloc;
 
-    //if (!ggml_allocr_is_measure(alloc)) {
-    //    ggml_backend_tensor_copy(wstate.embd_enc, cur);
-    //}
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_enc);
+        // set from wstate.encoder_cache.embd after allocation
+        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
+        ggml_allocr_alloc(alloc, cur);
+        ggml_set_name(cur, "inp_cross");
+    } else {
+        cur = ggml_view_tensor(ctx0, wstate.embd_enc);
+    }
 
     const float  Kscale = pow(float(n_state) / n_head, -0.25);
 
+    // the K and V of all the layers read the output of the encoder
+    struct ggml_tensor * cur_vec_dot = nullptr;
+
     for (int il = 0; il < model.hparams.n_text_layer; ++il) {
         auto & layer = model.layers_decoder[il];
 
-        struct ggml_tensor* Kcross = ggml_mul_mat(ctx0,
-                layer.cross_attn_k_w,
-                cur);
+        struct ggml_tensor* Kcross = whisper_mul_mat_enc(ctx0, wstate, layer.cross_attn_k_w, cur, &cur_vec_dot);
 
         Kcross = ggml_scale(ctx0, Kcross, Kscale);
 
-        struct ggml_tensor* Vcross = ggml_mul_mat(ctx0,
-                layer.cross_attn_v_w,
-                cur);
+        struct ggml_tensor* Vcross = whisper_mul_mat_enc(ctx0, wstate, layer.cross_attn_v_w, cur, &cur_vec_dot);
 
         Vcross = ggml_add(ctx0,
                     Vcross,
@@ -2054,9 +3285,10 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
         Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
 
+        // offsets in rows, the keys may be quantized, see whisper_context_params::kv_type
         struct ggml_tensor * k = ggml_view_1d(ctx0, wstate.kv_cross.k,
                 n_state*n_ctx,
-                (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx));
+                ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx));
 
         struct ggml_tensor * v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
                 (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
@@ -2073,6 +3305,53 @@ static struct ggml_cgraph * whisper_build_graph_cross(
     return gf;
 }
 
+// compute a graph of the encoder or of the decoder where the state placed that stage
+static bool whisper_graph_compute(
+            whisper_state & wstate,
+                     bool   decoder,
+       struct ggml_cgraph * graph,
+                      int   n_threads) {
+    const bool on_cpu = decoder ? wstate.decoder_on_cpu : wstate.encoder_on_cpu;
+    ggml_backend_t backend = on_cpu && wstate.backend_cpu ? wstate.backend_cpu : wstate.backend;
+    if (ggml_backend_is_cpu(backend)) {
+        // the CLBlast and cuBLAS builds offload the large matrix multiplications unless the stage is on the CPU
+        for (int i = 0; i < graph->n_nodes; ++i) {
+            if (graph->nodes[i]->op == GGML_OP_MUL_MAT) {
+                ggml_mul_mat_set_offload(graph->nodes[i], !on_cpu);
+            }
+        }
+    }
+
+    // the stage shares the GPU with the application, unless ggml computes all of it on the CPU
+    const bool on_gpu = !on_cpu && (!ggml_backend_is_cpu(backend) || ggml_cpu_has_gpublas());
+    const int max_submit_us = on_gpu && wstate.gpu_pacing ? wstate.gpu_pacing->max_submit_us.load(std::memory_order_relaxed) : 0;
+    if (max_submit_us <= 0) {
+        return ggml_graph_compute_helper(backend, graph, n_threads);
+    }
+
+    // as submissions of about max_submit_us, sized from the time the nodes of this stage took so far
+    float & us_per_node = wstate.gpu_us_per_node[decoder ? 1 : 0];
+    for (int i0 = 0; i0 < graph->n_nodes;) {
+        const int n = us_per_node > 0.0f ? std::max(1, int(max_submit_us / us_per_node)) : 16;
+        const int i1 = std::min(graph->n_nodes, i0 + n);
+
+        ggml_cgraph view = ggml_graph_view(graph, i0, i1);
+        const int64_t t_start_us = ggml_time_us();
+        if (!ggml_graph_compute_helper(backend, &view, n_threads)) {
+            return false;
+        }
+        const float us = float(ggml_time_us() - t_start_us) / (i1 - i0);
+        us_per_node = us_per_node > 0.0f ? 0.75f*us_per_node + 0.25f*us : us;
+
+        i0 = i1;
+        const whisper_gpu_yield_callback yield_callback = wstate.gpu_pacing->yield_callback.load();
+        if (i0 < graph->n_nodes && yield_callback) {
+            yield_callback(wstate.gpu_pacing->yield_callback_user_data.load());
+        }
+    }
+    return true;
+}
+
 // evaluate the encoder with the given state
 //
 // given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
@@ -2090,20 +3369,34 @@ static bool whisper_encode_internal(
               const int   n_threads,
  whisper_abort_callback   abort_callback,
                    void * abort_callback_data) {
+    WHISPER_TRACE_ZONE("whisper_encode");
     const int64_t t_start_us = ggml_time_us();
 
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wstate.n_audio_ctx_max;
+
+    // the graphs only change with the audio context, each one reads the output tensor of the one before it
+    bool built = false;
+
     // conv
     {
-        auto & alloc = wstate.alloc_conv.alloc;
-
-        ggml_allocr_reset(alloc);
+        if (whisper_encode_external(wstate)) {
+            whisper_allocr_graph_drop(wstate.alloc_conv);
+        }
 
-        ggml_cgraph * gf = whisper_build_graph_conv(wctx, wstate, mel_offset);
+        // the first window of audio it covers whole, with the spectrogram left to the graph
+        const bool from_pcm = mel_offset == 0 && whisper_mel_pending_fits(wstate, n_ctx);
 
-        ggml_allocr_alloc_graph(alloc, gf);
+        ggml_cgraph * gf = whisper_allocr_graph_get(wstate.alloc_conv, { n_ctx, from_pcm, 0, 0 }, built,
+                [&]() { return whisper_build_graph_conv(wctx, wstate, mel_offset, from_pcm); });
 
         if (!whisper_encode_external(wstate)) {
-            if (!ggml_graph_compute_helper(wstate.backend, gf, n_threads)) {
+            if (from_pcm) {
+                whisper_set_input_mel_pcm(wstate, gf);
+            } else {
+                whisper_set_input_mel(wstate, ggml_graph_get_tensor(gf, "mel"), mel_offset);
+            }
+
+            if (!whisper_graph_compute(wstate, false, gf, n_threads)) {
                 return false;
             }
         }
@@ -2111,121 +3404,256 @@ static bool whisper_encode_internal(
 
     // encoder
     if (!whisper_encode_external(wstate)) {
-        auto & alloc = wstate.alloc_encode.alloc;
-
-        ggml_allocr_reset(alloc);
-
-        ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate);
+        if (built) {
+            whisper_allocr_graph_drop(wstate.alloc_encode);
+        }
 
-        ggml_allocr_alloc_graph(alloc, gf);
+        ggml_cgraph * gf = whisper_allocr_graph_get(wstate.alloc_encode, { n_ctx, 0, wstate.exp_n_audio_layer, 0 }, built,
+                [&]() { return whisper_build_graph_encoder(wctx, wstate, 0); });
 
-        if (!ggml_graph_compute_helper(wstate.backend, gf, n_threads)) {
+        if (!whisper_graph_compute(wstate, false, gf, n_threads)) {
             return false;
         }
     }
 
     // cross
     {
-        auto & alloc = wstate.alloc_cross.alloc;
-
-        ggml_allocr_reset(alloc);
-
-        ggml_cgraph * gf = whisper_build_graph_cross(wctx, wstate);
+        if (built) {
+            whisper_allocr_graph_drop(wstate.alloc_cross);
+        }
 
-        ggml_allocr_alloc_graph(alloc, gf);
+        ggml_cgraph * gf = whisper_allocr_graph_get(wstate.alloc_cross, { n_ctx, false, 0, 0 }, built,
+                [&]() { return whisper_build_graph_cross(wctx, wstate, false); });
 
-        if (!ggml_graph_compute_helper(wstate.backend, gf, n_threads)) {
+        if (!whisper_graph_compute(wstate, false, gf, n_threads)) {
             return false;
         }
     }
 
     wstate.t_encode_us += ggml_time_us() - t_start_us;
     wstate.n_encode++;
+    wstate.cross_mel_offset = mel_offset;
 
     return !(abort_callback && abort_callback(abort_callback_data));
 }
 
-static struct ggml_cgraph * whisper_build_graph_decoder(
-         whisper_context & wctx,
-         whisper_state   & wstate,
-     const whisper_batch & batch) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+// evaluate the encoder on the first n_ctx positions of the mel spectrogram as chunks of n_chunk positions
+//
+// every chunk is encoded on its own together with the n_overlap positions before it, whose outputs are
+// dropped. a chunk whose conv input is the same as in the previous call reuses its previous output, so
+// when the audio only grew at the end, only the chunks at the end are encoded again. the outputs are
+// spliced into one window and the cross-attention memory is computed from it as usual
+//
+static bool whisper_encode_chunked_internal(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   n_ctx,
+              const int   n_chunk,
+              const int   n_overlap,
+              const int   n_threads) {
+    const int64_t t_start_us = ggml_time_us();
 
-    auto & kv_self = wstate.kv_self;
+    const int n_state = wctx.model.hparams.n_audio_state;
 
-    WHISPER_ASSERT(!!kv_self.ctx);
+    auto & cache = wstate.encoder_cache;
 
-    ggml_allocr * alloc = wstate.alloc_decode.alloc;
+    if (cache.n_chunk != n_chunk || cache.n_overlap != n_overlap) {
+        cache.chunks.clear();
+        cache.n_chunk   = n_chunk;
+        cache.n_overlap = n_overlap;
+    }
 
-    const int n_ctx   = kv_self.size;
-    const int n_state = hparams.n_text_state;
-    const int n_head  = hparams.n_text_head;
-    const int n_layer = hparams.n_text_layer;
+    const int n_chunks = (n_ctx + n_chunk - 1)/n_chunk;
+    cache.chunks.resize(n_chunks);
+    cache.embd.resize((size_t) n_ctx*n_state);
 
-    const int n_tokens    = batch.n_tokens;
-    const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    bool ok = true;
 
-    const int32_t n_kv     = ggml_allocr_is_measure(alloc) ? n_ctx            : kv_self.n;
-    const int32_t kv_head  = ggml_allocr_is_measure(alloc) ? n_ctx - n_tokens : kv_self.head;
+    for (int ic = 0; ic < n_chunks && ok; ++ic) {
+        auto & chunk = cache.chunks[ic];
 
-    //WHISPER_LOG_DEBUG("%s: n_past = %d, n_tokens = %d, n_audio_ctx = %d, n_ctx = %d\n", __func__, n_past, n_tokens, n_audio_ctx, n_ctx);
+        const int i0    = ic*n_chunk;
+        const int i1    = std::min(i0 + n_chunk, n_ctx);
+        const int begin = std::max(0, i0 - n_overlap);
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.alloc_decode.meta.size(),
-        /*.mem_buffer =*/ wstate.alloc_decode.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+        wstate.exp_n_audio_ctx = i1 - begin;
 
-    struct ggml_context * ctx0 = ggml_init(params);
+        // the input of the conv graph, gathered into wstate.inp_mel, tells whether the chunk changed
+        bool built = false;
 
-    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+        ggml_cgraph * gf_conv = whisper_allocr_graph_get(wstate.alloc_conv, { i1 - begin, 0, 0, 0 }, built,
+                [&]() { return whisper_build_graph_conv(wctx, wstate, 2*begin); });
 
-    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_allocr_alloc(alloc, embd);
+        whisper_set_input_mel(wstate, ggml_graph_get_tensor(gf_conv, "mel"), 2*begin);
 
-    if (!ggml_allocr_is_measure(alloc)) {
-        ggml_backend_tensor_set(embd, batch.token, 0, n_tokens*ggml_element_size(embd));
-    }
+        if (built) {
+            whisper_allocr_graph_drop(wstate.alloc_encode);
+        }
 
-    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
-    ggml_allocr_alloc(alloc, position);
+        if (chunk.begin != begin || chunk.end != i1 || chunk.mel != wstate.inp_mel) {
+            if (!whisper_graph_compute(wstate, false, gf_conv, n_threads)) {
+                ok = false;
+                break;
+            }
+
+            ggml_cgraph * gf = whisper_allocr_graph_get(wstate.alloc_encode, { i1 - begin, begin, 0, 0 }, built,
+                    [&]() { return whisper_build_graph_encoder(wctx, wstate, begin); });
+
+            if (!whisper_graph_compute(wstate, false, gf, n_threads)) {
+                ok = false;
+                break;
+            }
+
+            chunk.begin = begin;
+            chunk.end   = i1;
+            chunk.mel   = wstate.inp_mel;
+            chunk.embd.resize((size_t) (i1 - i0)*n_state);
 
-    if (!ggml_allocr_is_measure(alloc)) {
-        for (int i = 0; i < n_tokens; ++i) {
-            const int32_t val = batch.pos[i];
-            ggml_backend_tensor_set(position, &val, i*sizeof(int32_t), sizeof(int32_t));
+            ggml_backend_tensor_get(wstate.embd_enc, chunk.embd.data(), (size_t) (i0 - begin)*n_state*sizeof(float), chunk.embd.size()*sizeof(float));
         }
+
+        memcpy(cache.embd.data() + (size_t) i0*n_state, chunk.embd.data(), chunk.embd.size()*sizeof(float));
     }
 
-    const float KQscale = pow(float(n_state)/n_head, -0.25);
+    wstate.exp_n_audio_ctx = n_ctx;
 
-    struct ggml_tensor * KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_kv, n_tokens, 1);
-    ggml_allocr_alloc(alloc, KQ_mask);
+    if (!ok) {
+        // a chunk may be half written
+        cache.chunks.clear();
+        return false;
+    }
 
-    if (!ggml_allocr_is_measure(alloc)) {
-        wstate.inp_mask.resize(n_kv*n_tokens);
+    // cross
+    {
+        bool built = false;
 
-        float * data = wstate.inp_mask.data();
-        memset(data, 0, ggml_nbytes(KQ_mask));
+        ggml_cgraph * gf = whisper_allocr_graph_get(wstate.alloc_cross, { n_ctx, true, 0, 0 }, built,
+                [&]() { return whisper_build_graph_cross(wctx, wstate, true); });
 
-        for (int h = 0; h < 1; ++h) {
-            for (int j = 0; j < n_tokens; ++j) {
-                const whisper_pos    pos    = batch.pos[j];
-                const whisper_seq_id seq_id = batch.seq_id[j][0];
+        ggml_backend_tensor_set(ggml_graph_get_tensor(gf, "inp_cross"), cache.embd.data(), 0, cache.embd.size()*sizeof(float));
 
-                for (int i = 0; i < n_kv; ++i) {
-                    if (!kv_self.cells[i].has_seq_id(seq_id) || kv_self.cells[i].pos > pos) {
-                        data[h*(n_kv*n_tokens) + j*n_kv + i] = -INFINITY;
-                    }
-                }
-            }
+        if (!whisper_graph_compute(wstate, false, gf, n_threads)) {
+            return false;
         }
-
-        ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
     }
 
-    // token encoding + position encoding
+    wstate.t_encode_us += ggml_time_us() - t_start_us;
+    wstate.n_encode++;
+    wstate.cross_mel_offset = 0;
+
+    return true;
+}
+
+// the self-attention mask of the batch over the first kv_self.n cells, [n_tokens, n_kv]
+static void whisper_fill_kq_mask(
+    const whisper_kv_cache & kv_self,
+       const whisper_batch & batch,
+        std::vector<float> & mask) {
+    const int n_tokens = batch.n_tokens;
+    const int n_kv     = kv_self.n;
+
+    mask.assign(n_kv*n_tokens, 0.0f);
+
+    for (int j = 0; j < n_tokens; ++j) {
+        const whisper_pos    pos    = batch.pos[j];
+        const whisper_seq_id seq_id = batch.seq_id[j][0];
+
+        for (int i = 0; i < n_kv; ++i) {
+            if (!kv_self.cells[i].has_seq_id(seq_id) || kv_self.cells[i].pos > pos) {
+                mask[j*n_kv + i] = -INFINITY;
+            }
+        }
+    }
+}
+
+// sets the tokens, positions and attention mask of the batch, and points the graph's writes to the kv cache at kv_self.head
+static void whisper_set_inputs_decoder(
+         whisper_state   & wstate,
+     struct ggml_cgraph  * gf,
+     const whisper_batch & batch) {
+    auto & kv_self = wstate.kv_self;
+
+    const int n_tokens = batch.n_tokens;
+
+    struct ggml_tensor * embd     = ggml_graph_get_tensor(gf, "embd");
+    struct ggml_tensor * position = ggml_graph_get_tensor(gf, "position");
+    struct ggml_tensor * KQ_mask  = ggml_graph_get_tensor(gf, "KQ_mask");
+
+    ggml_backend_tensor_set(embd,     batch.token, 0, n_tokens*ggml_element_size(embd));
+    ggml_backend_tensor_set(position, batch.pos,   0, n_tokens*ggml_element_size(position));
+
+    whisper_fill_kq_mask(kv_self, batch, wstate.inp_mask);
+    ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
+
+    const int32_t delta = kv_self.head - wstate.kv_store_head;
+
+    if (delta != 0) {
+        for (auto & store : wstate.kv_store) {
+            store.tensor->data = (char *) store.tensor->data + (int64_t) delta*store.nb_head;
+            store.tensor->view_offs += (int64_t) delta*store.nb_head;
+        }
+
+        wstate.kv_store_head = kv_self.head;
+    }
+}
+
+static struct ggml_cgraph * whisper_build_graph_decoder(
+         whisper_context & wctx,
+         whisper_state   & wstate,
+     const whisper_batch & batch) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    auto & kv_self = wstate.kv_self;
+
+    WHISPER_ASSERT(!!kv_self.ctx);
+
+    ggml_allocr * alloc = wstate.alloc_decode.alloc;
+
+    const int n_ctx   = kv_self.size;
+    const int n_state = hparams.n_text_state;
+    const int n_head  = hparams.n_text_head;
+    const int n_layer = hparams.n_text_layer;
+
+    const int n_tokens    = batch.n_tokens;
+    const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wstate.n_audio_ctx_max;
+
+    const int32_t n_kv     = ggml_allocr_is_measure(alloc) ? n_ctx            : kv_self.n;
+    const int32_t kv_head  = ggml_allocr_is_measure(alloc) ? n_ctx - n_tokens : kv_self.head;
+
+    //WHISPER_LOG_DEBUG("%s: n_past = %d, n_tokens = %d, n_audio_ctx = %d, n_ctx = %d\n", __func__, n_past, n_tokens, n_audio_ctx, n_ctx);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.alloc_decode.meta.size(),
+        /*.mem_buffer =*/ wstate.alloc_decode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    // the inputs are set by whisper_set_inputs_decoder() after allocation
+    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_allocr_alloc(alloc, embd);
+    ggml_set_name(embd, "embd");
+
+    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_allocr_alloc(alloc, position);
+    ggml_set_name(position, "position");
+
+    const float KQscale = pow(float(n_state)/n_head, -0.25);
+
+    struct ggml_tensor * KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_kv, n_tokens, 1);
+    ggml_allocr_alloc(alloc, KQ_mask);
+    ggml_set_name(KQ_mask, "KQ_mask");
+
+    wstate.kv_store.clear();
+    wstate.kv_store_head = kv_head;
+
+    wstate.aheads_cross_QKs.clear();
+
+    // token encoding + position encoding
     struct ggml_tensor * cur =
         ggml_add(ctx0,
                 ggml_get_rows(ctx0, model.d_te, embd),
@@ -2279,13 +3707,22 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
                 Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
 
-                struct ggml_tensor * k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state, (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                struct ggml_tensor * k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state, ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
                 struct ggml_tensor * v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
                         (   n_ctx)*ggml_element_size(kv_self.v),
                         (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
 
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, k));
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, v));
+                struct ggml_tensor * k_cpy = ggml_cpy(ctx0, Kcur, k);
+                struct ggml_tensor * v_cpy = ggml_cpy(ctx0, Vcur, v);
+
+                ggml_build_forward_expand(gf, k_cpy);
+                ggml_build_forward_expand(gf, v_cpy);
+
+                // moved to the next kv_head when the graph is reused
+                wstate.kv_store.push_back({ k,     ggml_row_size(kv_self.k->type, n_state) });
+                wstate.kv_store.push_back({ k_cpy, ggml_row_size(kv_self.k->type, n_state) });
+                wstate.kv_store.push_back({ v,     ggml_element_size(kv_self.v) });
+                wstate.kv_store.push_back({ v_cpy, ggml_element_size(kv_self.v) });
             }
 
             // ------
@@ -2298,9 +3735,9 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * K =
                 ggml_view_3d(ctx0, kv_self.k,
                         n_state/n_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state/n_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+                        ggml_row_size(kv_self.k->type, n_state),
+                        ggml_row_size(kv_self.k->type, n_state/n_head),
+                        ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
 
             // K * Q
             struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
@@ -2370,9 +3807,9 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * Kcross =
                 ggml_view_3d(ctx0, wstate.kv_cross.k,
                         n_state/n_head, n_audio_ctx, n_head,
-                        ggml_element_size(wstate.kv_cross.k)*n_state,
-                        ggml_element_size(wstate.kv_cross.k)*n_state/n_head,
-                        ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
+                        ggml_row_size(wstate.kv_cross.k->type, n_state),
+                        ggml_row_size(wstate.kv_cross.k->type, n_state/n_head),
+                        ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx*il);
 
             //struct ggml_tensor * Vcross =
             //    ggml_reshape_3d(ctx0,
@@ -2412,6 +3849,22 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
             struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ);
 
+            // the copies have no children, the allocator keeps them until the next graph
+            if (wstate.aheads_capture) {
+                for (const auto & ahead : wstate.aheads) {
+                    if (ahead.first != il) {
+                        continue;
+                    }
+
+                    struct ggml_tensor * QK = ggml_cpy(ctx0,
+                            ggml_view_2d(ctx0, KQ_soft_max, n_audio_ctx, n_tokens, KQ_soft_max->nb[1], ahead.second*KQ_soft_max->nb[2]),
+                            ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_audio_ctx, n_tokens));
+
+                    ggml_build_forward_expand(gf, QK);
+                    wstate.aheads_cross_QKs.push_back(QK);
+                }
+            }
+
             struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
 
             struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
@@ -2490,12 +3943,19 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 model.d_ln_b);
     }
 
-    // compute logits only for the last token
-    // comment this line to compute logits for all n_tokens
-    // might be useful in the future
-    //cur = ggml_view_2d(ctx0, cur, cur->ne[0], 1, cur->nb[1], (cur->ne[1] - 1)*cur->nb[1]);
+    // compute logits only from the first token that needs them, e.g. not for the prompt
+    // measured for all n_tokens
+    {
+        const int i_logits = ggml_allocr_is_measure(alloc) ? 0 : whisper_batch_first_logits(batch);
+        if (i_logits > 0) {
+            cur = ggml_view_2d(ctx0, cur, cur->ne[0], n_tokens - i_logits, cur->nb[1], i_logits*cur->nb[1]);
+        }
+    }
 
-    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+    // measured with the whole vocabulary, the subset is never larger
+    const bool use_subset = wstate.use_vocab_subset && wctx.vocab_subset.d_te && !ggml_allocr_is_measure(alloc);
+
+    struct ggml_tensor * logits = ggml_mul_mat(ctx0, use_subset ? wctx.vocab_subset.d_te : model.d_te, cur);
 
     ggml_build_forward_expand(gf, logits);
 
@@ -2504,1006 +3964,3231 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     return gf;
 }
 
-// evaluate the decoder
-//
-// given text prompt + audio features -> computes the logits for the next token
-//
-//   - model:      the model
-//   - n_threads:  number of threads to use
-//   - tokens:     text prompt
-//   - n_tokens:   number of tokens in the prompt
-//   - n_past:     number of past tokens to prefix the prompt with
-//
-static bool whisper_decode_internal(
-        whisper_context & wctx,
-          whisper_state & wstate,
-    const whisper_batch & batch,
-              const int   n_threads,
- whisper_abort_callback   abort_callback,
-                   void * abort_callback_data) {
-    const int64_t t_start_us = ggml_time_us();
-
+// the decoder steps of several states as one graph: the projections, the MLP and the logits multiply the
+// weights once for the tokens of all of them, the self-attention and the cross-attention of every state
+// read its own caches. the tokens of request i are the columns [offs[i], offs[i] + n_tokens) of the graph
+static struct ggml_cgraph * whisper_build_graph_decoder_group(
+                                 whisper_context & wctx,
+    const std::vector<whisper_decode_request *> & requests,
+                                     ggml_allocr * alloc,
+                                          size_t   n_nodes) {
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
-    const int n_vocab  = hparams.n_vocab;
-    const int n_tokens = batch.n_tokens;
+    const int n_state = hparams.n_text_state;
+    const int n_head  = hparams.n_text_head;
+    const int n_layer = hparams.n_text_layer;
 
-    auto & logits_out = wstate.logits;
+    auto & meta = wctx.decode_group.meta;
 
-    struct ggml_tensor * logits;
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ meta.size(),
+        /*.mem_buffer =*/ meta.data(),
+        /*.no_alloc   =*/ true,
+    };
 
-    // find KV slot for the batch
-    {
-        auto & kv_self = wstate.kv_self;
+    struct ggml_context * ctx0 = ggml_init(params);
 
-        if (!whisper_kv_cache_find_slot(kv_self, batch)) {
-            return false;
-        }
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, n_nodes, false);
 
-        kv_self.n = whisper_kv_cache_cell_max(kv_self);
-        //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
-        //printf("n_tokens = %5d, kv_self.head = %5d, kv_self.n = %5d, seq_id = %5d\n", batch.n_tokens, kv_self.head, kv_self.n, batch.seq_id[0][0]);
+    std::vector<int> offs;
+    int n_tokens = 0;
+    for (const auto * request : requests) {
+        offs.push_back(n_tokens);
+        n_tokens += request->batch->n_tokens;
     }
 
-    // decoder
-    {
-        auto & alloc = wstate.alloc_decode.alloc;
+    // the inputs are set by whisper_set_inputs_decoder_group() after allocation
+    struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_allocr_alloc(alloc, embd);
+    ggml_set_name(embd, "embd");
 
-        ggml_allocr_reset(alloc);
+    struct ggml_tensor * position = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    ggml_allocr_alloc(alloc, position);
+    ggml_set_name(position, "position");
 
-        ggml_cgraph * gf = whisper_build_graph_decoder(wctx, wstate, batch);
+    std::vector<struct ggml_tensor *> KQ_masks;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        struct ggml_tensor * KQ_mask = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, requests[i]->state->kv_self.n, requests[i]->batch->n_tokens, 1);
+        ggml_allocr_alloc(alloc, KQ_mask);
+        ggml_format_name(KQ_mask, "KQ_mask_%d", (int) i);
+        KQ_masks.push_back(KQ_mask);
+    }
 
-        ggml_allocr_alloc_graph(alloc, gf);
+    const float KQscale = pow(float(n_state)/n_head, -0.25);
 
-        logits = gf->nodes[gf->n_nodes - 1];
+    // columns of request i in a [n_state, n_tokens] tensor
+    const auto columns = [&](struct ggml_tensor * t, size_t i) {
+        return ggml_view_2d(ctx0, t, n_state, requests[i]->batch->n_tokens, t->nb[1], offs[i]*t->nb[1]);
+    };
 
-        if (!ggml_graph_compute_helper(wstate.backend, gf, n_threads)) {
-            return false;
+    // the attention outputs of the requests one after the other, as [n_state, n_tokens]
+    const auto merge = [&](const std::vector<struct ggml_tensor *> & outs) {
+        struct ggml_tensor * merged = outs[0];
+        for (size_t i = 1; i < outs.size(); ++i) {
+            merged = ggml_concat(ctx0, merged, outs[i]);
         }
-    }
+        return ggml_reshape_2d(ctx0, merged, n_state, n_tokens);
+    };
 
-    logits_out.resize(n_tokens*n_vocab);
-    for (int i = 0; i < n_tokens; i++) {
-        if (batch.logits[i] == 0) {
-            continue;
-        }
-        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
-    }
+    // token encoding + position encoding
+    struct ggml_tensor * cur =
+        ggml_add(ctx0,
+                ggml_get_rows(ctx0, model.d_te, embd),
+                ggml_get_rows(ctx0, model.d_pe, position));
 
-    if (batch.n_tokens > 1) {
-        //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
-        //        ggml_used_mem(ctx0)/1e6,
-        //        wstate.get_buf_max_mem(0)/1e6,
-        //        wstate.get_buf_max_mem(1)/1e6,
-        //        wstate.get_buf_max_mem(2)/1e6,
-        //        wstate.get_buf_max_mem(3)/1e6);
-    }
+    struct ggml_tensor * inpL = cur;
 
-    if (batch.n_tokens == 1) {
-        wstate.t_decode_us += ggml_time_us() - t_start_us;
-        wstate.n_decode++;
-    } else if (batch.n_tokens < 16) {
-        wstate.t_batchd_us += ggml_time_us() - t_start_us;
-        wstate.n_batchd += n_tokens;
-    } else {
-        wstate.t_prompt_us += ggml_time_us() - t_start_us;
-        wstate.n_prompt += n_tokens;
-    }
+    std::vector<struct ggml_tensor *> outs(requests.size());
 
-    return !(abort_callback && abort_callback(abort_callback_data));
-}
+    for (int il = 0; il < n_layer; ++il) {
+        const auto & layer = model.layers_decoder[il];
 
-//  500 -> 00:05.000
-// 6000 -> 01:00.000
-static std::string to_timestamp(int64_t t, bool comma = false) {
-    int64_t msec = t * 10;
-    int64_t hr = msec / (1000 * 60 * 60);
-    msec = msec - hr * (1000 * 60 * 60);
-    int64_t min = msec / (1000 * 60);
-    msec = msec - min * (1000 * 60);
-    int64_t sec = msec / 1000;
-    msec = msec - sec * 1000;
+        // norm
+        {
+            cur = ggml_norm(ctx0, inpL, hparams.eps);
 
-    char buf[32];
-    snprintf(buf, sizeof(buf), "%02d:%02d:%02d%s%03d", (int) hr, (int) min, (int) sec, comma ? "," : ".", (int) msec);
+            cur = ggml_add(ctx0,
+                    ggml_mul(ctx0,
+                        cur,
+                        layer.attn_ln_0_w),
+                    layer.attn_ln_0_b);
+        }
 
-    return std::string(buf);
-}
+        // self-attention
+        {
+            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0, layer.attn_q_w, cur);
+            Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
+            Qcur = ggml_scale(ctx0, Qcur, KQscale);
 
-#define SIN_COS_N_COUNT WHISPER_N_FFT
-static float sin_vals[SIN_COS_N_COUNT];
-static float cos_vals[SIN_COS_N_COUNT];
+            // note: no bias for Key
+            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0, layer.attn_k_w, cur);
+            Kcur = ggml_scale(ctx0, Kcur, KQscale);
 
-// In FFT, we frequently use sine and cosine operations with the same values.
-// We can use precalculated values to speed up the process.
-static void fill_sin_cos_table() {
-    static bool is_filled = false;
-    if (is_filled) return;
-    for (int i = 0; i < SIN_COS_N_COUNT; i++) {
-        double theta = (2*M_PI*i)/SIN_COS_N_COUNT;
-        sin_vals[i] = sinf(theta);
-        cos_vals[i] = cosf(theta);
-    }
-    is_filled = true;
-}
+            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0, layer.attn_v_w, cur);
+            Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
 
-// naive Discrete Fourier Transform
-// input is real-valued
-// output is complex-valued
-static void dft(const std::vector<float> & in, std::vector<float> & out) {
-    int N = in.size();
+            for (size_t i = 0; i < requests.size(); ++i) {
+                const auto & kv_self = requests[i]->state->kv_self;
 
-    out.resize(N*2);
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
+                const int n_ctx       = kv_self.size;
+                const int n_kv        = kv_self.n;
+                const int kv_head     = kv_self.head;
+                const int n_tokens_i  = requests[i]->batch->n_tokens;
 
-    for (int k = 0; k < N; k++) {
-        float re = 0;
-        float im = 0;
+                // store key and value to memory
+                {
+                    struct ggml_tensor * k = ggml_view_1d(ctx0, kv_self.k, n_tokens_i*n_state, ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
+                    struct ggml_tensor * v = ggml_view_2d(ctx0, kv_self.v, n_tokens_i, n_state,
+                            (   n_ctx)*ggml_element_size(kv_self.v),
+                            (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
 
-        for (int n = 0; n < N; n++) {
-            int idx = (k * n * sin_cos_step) % (SIN_COS_N_COUNT); // t = 2*M_PI*k*n/N
-            re += in[n]*cos_vals[idx]; // cos(t)
-            im -= in[n]*sin_vals[idx]; // sin(t)
-        }
+                    ggml_build_forward_expand(gf, ggml_cpy(ctx0, columns(Kcur, i), k));
+                    ggml_build_forward_expand(gf, ggml_cpy(ctx0, ggml_transpose(ctx0, columns(Vcur, i)), v));
+                }
 
-        out[k*2 + 0] = re;
-        out[k*2 + 1] = im;
-    }
-}
+                struct ggml_tensor * Q =
+                    ggml_permute(ctx0,
+                            ggml_reshape_3d(ctx0, columns(Qcur, i), n_state/n_head, n_head, n_tokens_i),
+                            0, 2, 1, 3);
 
-// Cooley-Tukey FFT
-// poor man's implementation - use something better
-// input is real-valued
-// output is complex-valued
-static void fft(const std::vector<float> & in, std::vector<float> & out) {
-    out.resize(in.size()*2);
+                struct ggml_tensor * K =
+                    ggml_view_3d(ctx0, kv_self.k,
+                            n_state/n_head, n_kv, n_head,
+                            ggml_row_size(kv_self.k->type, n_state),
+                            ggml_row_size(kv_self.k->type, n_state/n_head),
+                            ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
 
-    int N = in.size();
+                struct ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
 
-    if (N == 1) {
-        out[0] = in[0];
-        out[1] = 0;
-        return;
-    }
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, ggml_add(ctx0, KQ, KQ_masks[i]));
 
-    if (N%2 == 1) {
-        dft(in, out);
-        return;
-    }
+                struct ggml_tensor * V =
+                    ggml_view_3d(ctx0, kv_self.v,
+                            n_kv, n_state/n_head, n_head,
+                            n_ctx*ggml_element_size(kv_self.v),
+                            n_ctx*ggml_element_size(kv_self.v)*n_state/n_head,
+                            n_ctx*ggml_element_size(kv_self.v)*n_state*il);
 
-    std::vector<float> even;
-    std::vector<float> odd;
+                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
 
-    even.reserve(N/2);
-    odd.reserve(N/2);
+                // [n_state, 1, n_tokens_i], ggml_concat() joins the requests on dim 2
+                outs[i] = ggml_cpy(ctx0,
+                        ggml_permute(ctx0, KQV, 0, 2, 1, 3),
+                        ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_state, 1, n_tokens_i));
+            }
 
-    for (int i = 0; i < N; i++) {
-        if (i % 2 == 0) {
-            even.push_back(in[i]);
-        } else {
-            odd.push_back(in[i]);
+            cur = merge(outs);
         }
-    }
 
-    std::vector<float> even_fft;
-    std::vector<float> odd_fft;
+        // projection
+        {
+            cur = ggml_mul_mat(ctx0, layer.attn_ln_1_w, cur);
+            cur = ggml_add(ctx0, cur, layer.attn_ln_1_b);
+        }
 
-    fft(even, even_fft);
-    fft(odd, odd_fft);
+        // add the input
+        struct ggml_tensor * inpCA = ggml_add(ctx0, cur, inpL);
 
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-    for (int k = 0; k < N/2; k++) {
-        int idx = k * sin_cos_step; // t = 2*M_PI*k/N
-        float re = cos_vals[idx]; // cos(t)
-        float im = -sin_vals[idx]; // sin(t)
+        // norm
+        {
+            cur = ggml_norm(ctx0, inpCA, hparams.eps); // note: we use inpCA here
 
-        float re_odd = odd_fft[2*k + 0];
-        float im_odd = odd_fft[2*k + 1];
+            cur = ggml_add(ctx0,
+                    ggml_mul(ctx0,
+                        cur,
+                        layer.cross_attn_ln_0_w),
+                    layer.cross_attn_ln_0_b);
+        }
 
-        out[2*k + 0] = even_fft[2*k + 0] + re*re_odd - im*im_odd;
-        out[2*k + 1] = even_fft[2*k + 1] + re*im_odd + im*re_odd;
+        // cross-attention
+        {
+            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0, layer.cross_attn_q_w, cur);
+            Qcur = ggml_add(ctx0, Qcur, layer.cross_attn_q_b);
+            Qcur = ggml_scale(ctx0, Qcur, KQscale);
 
-        out[2*(k + N/2) + 0] = even_fft[2*k + 0] - re*re_odd + im*im_odd;
-        out[2*(k + N/2) + 1] = even_fft[2*k + 1] - re*im_odd - im*re_odd;
-    }
-}
+            for (size_t i = 0; i < requests.size(); ++i) {
+                const auto & wstate = *requests[i]->state;
 
-static bool hann_window(int length, bool periodic, std::vector<float> & output) {
-    if (output.size() < static_cast<size_t>(length)) {
-        output.resize(length);
-    }
-    int offset = -1;
-    if (periodic) {
-        offset = 0;
-    }
-    for (int i = 0; i < length; i++) {
-        output[i] = 0.5*(1.0 - cosf((2.0*M_PI*i)/(length + offset)));
-    }
+                const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wstate.n_audio_ctx_max;
+                const int n_tokens_i  = requests[i]->batch->n_tokens;
 
-    return true;
-}
+                // Kcross is already scaled
+                struct ggml_tensor * Kcross =
+                    ggml_view_3d(ctx0, wstate.kv_cross.k,
+                            n_state/n_head, n_audio_ctx, n_head,
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state/n_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx*il);
 
-static void log_mel_spectrogram_worker_thread(int ith, const std::vector<float> & hann, const std::vector<float> & samples,
-                                              int n_samples, int frame_size, int frame_step, int n_threads,
-                                              const whisper_filters & filters, whisper_mel & mel) {
-    std::vector<float> fft_in(frame_size, 0.0);
-    std::vector<float> fft_out(2 * frame_step);
-    // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
-    int n_fft = 1 + (frame_size / 2);
-    int i = ith;
+                struct ggml_tensor * V =
+                    ggml_view_3d(ctx0, wstate.kv_cross.v,
+                            n_audio_ctx, n_state/n_head, n_head,
+                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v),
+                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state/n_head,
+                            n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state*il);
 
-    // calculate FFT only when fft_in are not all zero
-    for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
-        const int offset = i * frame_step;
+                struct ggml_tensor * Q =
+                    ggml_permute(ctx0,
+                            ggml_reshape_3d(ctx0, columns(Qcur, i), n_state/n_head, n_head, n_tokens_i),
+                            0, 2, 1, 3);
 
-        // apply Hanning window (~10% faster)
-        for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
-            fft_in[j] = hann[j] * samples[offset + j];
+                // no masking for cross-attention
+                struct ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, ggml_mul_mat(ctx0, Kcross, Q));
+
+                struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+
+                outs[i] = ggml_cpy(ctx0,
+                        ggml_permute(ctx0, KQV, 0, 2, 1, 3),
+                        ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_state, 1, n_tokens_i));
+            }
+
+            cur = merge(outs);
         }
-        // fill the rest with zeros
-        if (n_samples - offset < frame_size) {
-            std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
+
+        // projection
+        {
+            cur = ggml_mul_mat(ctx0, layer.cross_attn_ln_1_w, cur);
+            cur = ggml_add(ctx0, cur, layer.cross_attn_ln_1_b);
         }
 
-        // FFT
-        fft(fft_in, fft_out);
+        // add the input
+        cur = ggml_add(ctx0, cur, inpCA);
 
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < frame_size; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
-        }
+        struct ggml_tensor * inpFF = cur;
 
-        // mel spectrogram
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
+        // feed-forward network
+        {
+            // norm
+            {
+                cur = ggml_norm(ctx0, inpFF, hparams.eps);
 
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
+                cur = ggml_add(ctx0,
+                        ggml_mul(ctx0,
+                            cur,
+                            layer.mlp_ln_w),
+                        layer.mlp_ln_b);
             }
 
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
+            // fully connected
+            cur = ggml_mul_mat(ctx0, layer.mlp_0_w, cur);
+            cur = ggml_add(ctx0, cur, layer.mlp_0_b);
 
-            sum = log10(std::max(sum, 1e-10));
+            // GELU activation
+            cur = ggml_gelu(ctx0, cur);
 
-            mel.data[j * mel.n_len + i] = sum;
+            // projection
+            cur = ggml_mul_mat(ctx0, layer.mlp_1_w, cur);
+            cur = ggml_add(ctx0, cur, layer.mlp_1_b);
         }
-    }
 
-    // Otherwise fft_out are all zero
-    double sum = log10(1e-10);
-    for (; i < mel.n_len; i += n_threads) {
-        for (int j = 0; j < mel.n_mel; j++) {
-            mel.data[j * mel.n_len + i] = sum;
-        }
+        inpL = ggml_add(ctx0, cur, inpFF);
     }
-}
-
-// ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L110-L157
-static bool log_mel_spectrogram(
-              whisper_state & wstate,
-              const float * samples,
-              const int   n_samples,
-              const int   /*sample_rate*/,
-              const int   frame_size,
-              const int   frame_step,
-              const int   n_mel,
-              const int   n_threads,
-              const whisper_filters & filters,
-              const bool   debug,
-              whisper_mel & mel) {
-    const int64_t t_start_us = ggml_time_us();
 
-    // Hanning window (Use cosf to eliminate difference)
-    // ref: https://pytorch.org/docs/stable/generated/torch.hann_window.html
-    // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L147
-    std::vector<float> hann;
-    hann_window(frame_size, true, hann);
+    cur = inpL;
 
+    // norm
+    {
+        cur = ggml_norm(ctx0, cur, hparams.eps);
 
-    // Calculate the length of padding
-    int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
-    int64_t stage_2_pad = frame_size / 2;
+        cur = ggml_add(ctx0,
+                ggml_mul(ctx0,
+                    cur,
+                    model.d_ln_w),
+                model.d_ln_b);
+    }
 
-    // Initialize a vector and copy data from C array to it.
-    std::vector<float> samples_padded;
-    samples_padded.resize(n_samples + stage_1_pad + stage_2_pad * 2);
-    std::copy(samples, samples + n_samples, samples_padded.begin() + stage_2_pad);
+    // every token of a grouped step needs its logits, see whisper_decode_group_eligible()
+    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
 
-    // pad 30 seconds of zeros at the end of audio (480,000 samples) + reflective pad 200 samples at the end of audio
-    std::fill(samples_padded.begin() + n_samples + stage_2_pad, samples_padded.begin() + n_samples + stage_1_pad + 2 * stage_2_pad, 0);
+    ggml_build_forward_expand(gf, logits);
 
-    // reflective pad 200 samples at the beginning of audio
-    std::reverse_copy(samples + 1, samples + 1 + stage_2_pad, samples_padded.begin());
+    ggml_free(ctx0);
 
-    mel.n_mel     = n_mel;
-    // https://github.com/pytorch/pytorch/blob/main/aten/src/ATen/native/SpectralOps.cpp#L936
-    // Calculate number of frames + remove the last frame
-    mel.n_len     = (samples_padded.size() - frame_size) / frame_step;
-    // Calculate semi-padded sample length to ensure compatibility
-    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
-    mel.data.resize(mel.n_mel * mel.n_len);
+    return gf;
+}
 
+static void whisper_set_inputs_decoder_group(
+    const std::vector<whisper_decode_request *> & requests,
+                              struct ggml_cgraph * gf) {
+    std::vector<whisper_token> tokens;
+    std::vector<whisper_pos>   positions;
 
-    {
-        std::vector<std::thread> workers(n_threads - 1);
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw] = std::thread(
-                    log_mel_spectrogram_worker_thread, iw + 1, std::cref(hann), samples_padded,
-                    n_samples + stage_2_pad, frame_size, frame_step, n_threads,
-                    std::cref(filters), std::ref(mel));
-        }
+    for (size_t i = 0; i < requests.size(); ++i) {
+        const whisper_batch & batch = *requests[i]->batch;
+        auto & wstate = *requests[i]->state;
 
-        // main thread
-        log_mel_spectrogram_worker_thread(0, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, mel);
+        tokens.insert(tokens.end(), batch.token, batch.token + batch.n_tokens);
+        positions.insert(positions.end(), batch.pos, batch.pos + batch.n_tokens);
 
-        for (int iw = 0; iw < n_threads - 1; ++iw) {
-            workers[iw].join();
-        }
-    }
+        // the state waits for the step, its scratch is free
+        whisper_fill_kq_mask(wstate.kv_self, batch, wstate.inp_mask);
 
-    // clamping and normalization
-    double mmax = -1e20;
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] > mmax) {
-            mmax = mel.data[i];
-        }
+        char name[GGML_MAX_NAME];
+        snprintf(name, sizeof(name), "KQ_mask_%d", (int) i);
+        ggml_backend_tensor_set(ggml_graph_get_tensor(gf, name), wstate.inp_mask.data(), 0, wstate.inp_mask.size()*sizeof(float));
     }
 
-    mmax -= 8.0;
+    ggml_backend_tensor_set(ggml_graph_get_tensor(gf, "embd"),     tokens.data(),    0, tokens.size()*sizeof(whisper_token));
+    ggml_backend_tensor_set(ggml_graph_get_tensor(gf, "position"), positions.data(), 0, positions.size()*sizeof(whisper_pos));
+}
 
-    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
-        if (mel.data[i] < mmax) {
-            mel.data[i] = mmax;
-        }
+// single token steps of the states decoding in whisper_full_with_state() on the CPU, the others and the
+// prompts decode alone
+static bool whisper_decode_group_eligible(
+        whisper_context & wctx,
+    const whisper_state & wstate,
+    const whisper_batch & batch) {
+    if (wctx.decode_group.max_states.load(std::memory_order_relaxed) <= 1 || !wstate.decode_group_member) {
+        return false;
+    }
 
-        mel.data[i] = (mel.data[i] + 4.0)/4.0;
+    // the graph of a group only reads host memory, computed by the CPU backend of the group: the decoder
+    // stage placed on the CPU, or the weights and caches of the CPU backend, also of its CLBlast and cuBLAS builds
+    if (!wstate.decoder_on_cpu && !ggml_backend_is_cpu(wstate.backend)) {
+        return false;
     }
 
-    wstate.t_mel_us += ggml_time_us() - t_start_us;
+    // the alignment heads and the vocabulary subset are per state
+    if (wstate.aheads_capture || (wstate.use_vocab_subset && wctx.vocab_subset.d_te)) {
+        return false;
+    }
 
-    // Dump log_mel_spectrogram
-    if (debug) {
-        std::ofstream outFile("log_mel_spectrogram.json");
-        outFile << "[";
-        for (uint64_t i = 0; i < mel.data.size() - 1; i++) {
-            outFile << mel.data[i] << ", ";
+    // one token for each decoder of the state, as in the steps after the prompt
+    if (batch.n_tokens > WHISPER_MAX_DECODERS) {
+        return false;
+    }
+    for (int i = 0; i < batch.n_tokens; ++i) {
+        if (!batch.logits[i]) {
+            return false;
         }
-        outFile << mel.data[mel.data.size() - 1] << "]";
-        outFile.close();
     }
 
     return true;
 }
 
-// split text into tokens
-//
-// ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
-//
-// Regex (Python):
-// r"""'s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+"""
-//
-// Regex (C++):
-// R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)"
-//
-static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
-    std::vector<std::string> words;
-
-    // first split the text into words
-    {
-        std::string str = text;
-        std::string pat = R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)";
+// computes the step of requests as one graph and fills the logits of their states
+static bool whisper_decode_group_compute(
+                                 whisper_context & wctx,
+    const std::vector<whisper_decode_request *> & requests,
+                                             int   n_threads) {
+    WHISPER_TRACE_ZONE("whisper_decode_group");
 
-        std::regex re(pat);
-        std::smatch m;
+    auto & group = wctx.decode_group;
 
-        while (std::regex_search(str, m, re)) {
-            for (auto x : m) {
-                words.push_back(x);
-            }
-            str = m.suffix();
+    if (!group.backend) {
+        group.backend = ggml_backend_cpu_init();
+        if (!group.backend) {
+            return false;
         }
     }
 
-    // find the longest tokens that form the words:
-    std::vector<whisper_vocab::id> tokens;
-    for (const auto & word : words) {
-        if (word.empty()) continue;
+    // the attention of every state adds about 32 nodes per layer
+    const size_t n_nodes = WHISPER_MAX_NODES + 32*wctx.model.hparams.n_text_layer*requests.size();
+    group.meta.resize(ggml_tensor_overhead()*n_nodes + ggml_graph_overhead_custom(n_nodes, false));
 
-        int i = 0;
-        int n = word.size();
-        while (i < n) {
-            int j = n;
-            bool found = false;
-            while (j > i) {
-                auto sub = word.substr(i, j-i);
-                auto it = vocab.token_to_id.find(sub);
-                if (it != vocab.token_to_id.end()) {
-                    tokens.push_back(it->second);
-                    i = j;
-                    found = true;
-                    break;
-                }
-                --j;
+    // measured for these states, the buffer only grows
+    {
+        ggml_allocr * measure = ggml_allocr_new_measure_from_backend(group.backend);
+        ggml_allocr_alloc_graph(measure, whisper_build_graph_decoder_group(wctx, requests, measure, n_nodes));
+        const size_t size = ggml_allocr_max_size(measure);
+        ggml_allocr_free(measure);
+
+        if (!group.buffer || ggml_backend_buffer_get_size(group.buffer) < size) {
+            if (group.buffer) {
+                ggml_backend_buffer_free(group.buffer);
             }
-            if (!found) {
-                WHISPER_LOG_ERROR("unknown token\n");
-                ++i;
+            // with some room, so the next larger step does not allocate again
+            group.buffer = ggml_backend_alloc_buffer(group.backend, size + size/4);
+            if (!group.buffer) {
+                return false;
             }
         }
     }
 
-    return tokens;
-}
+    ggml_allocr * alloc = ggml_allocr_new_from_buffer(group.buffer);
 
-//
-// interface implementation
-//
+    ggml_cgraph * gf = whisper_build_graph_decoder_group(wctx, requests, alloc, n_nodes);
+    ggml_allocr_alloc_graph(alloc, gf);
 
-#ifdef WHISPER_USE_COREML
-// replace .bin with -encoder.mlmodelc
-static std::string whisper_get_coreml_path_encoder(std::string path_bin) {
-    auto pos = path_bin.rfind('.');
-    if (pos != std::string::npos) {
-        path_bin = path_bin.substr(0, pos);
-    }
+    whisper_set_inputs_decoder_group(requests, gf);
 
-    // match "-qx_x"
-    pos = path_bin.rfind('-');
-    if (pos != std::string::npos) {
-        auto sub = path_bin.substr(pos);
-        if (sub.size() == 5 && sub[1] == 'q' && sub[3] == '_') {
-            path_bin = path_bin.substr(0, pos);
+    struct ggml_tensor * logits = gf->nodes[gf->n_nodes - 1];
+
+    // as in whisper_graph_compute(), the GPU BLAS builds offload the large matrix multiplications unless the
+    // decoder stage is on the CPU, the states share the placement of the context
+    const bool on_cpu = requests[0]->state->decoder_on_cpu;
+    for (int i = 0; i < gf->n_nodes; ++i) {
+        if (gf->nodes[i]->op == GGML_OP_MUL_MAT) {
+            ggml_mul_mat_set_offload(gf->nodes[i], !on_cpu);
         }
     }
 
-    path_bin += "-encoder.mlmodelc";
+    const bool ok = ggml_graph_compute_helper(group.backend, gf, n_threads);
 
-    return path_bin;
-}
-#endif
+    if (ok) {
+        const int n_vocab = wctx.model.hparams.n_vocab;
 
-#ifdef WHISPER_USE_OPENVINO
-// replace .bin with-encoder-openvino.xml
-static std::string whisper_openvino_get_path_encoder(std::string path_bin) {
-    auto pos = path_bin.rfind('.');
-    if (pos != std::string::npos) {
-        path_bin = path_bin.substr(0, pos);
+        int off = 0;
+        for (auto * request : requests) {
+            const int n_tokens = request->batch->n_tokens;
+
+            auto & logits_out = request->state->logits;
+            logits_out.resize(n_tokens*n_vocab);
+            ggml_backend_tensor_get(logits, logits_out.data(), sizeof(float)*n_vocab*off, sizeof(float)*n_vocab*n_tokens);
+
+            off += n_tokens;
+        }
     }
 
-    path_bin += "-encoder-openvino.xml";
+    ggml_allocr_free(alloc);
 
-    return path_bin;
+    return ok;
 }
 
-static std::string whisper_openvino_get_path_cache(std::string path_bin) {
-    auto pos = path_bin.rfind('.');
-    if (pos != std::string::npos) {
-        path_bin = path_bin.substr(0, pos);
+// posts the step of wstate to the decode group of the context, true once the logits are in, false when
+// the state has to decode the step alone. the oldest request computes the next step, after waiting up to
+// wait_us for the states of the steps before. the states that come in time join, one that did not is no
+// longer waited for until it posts again
+static bool whisper_decode_group_submit(
+        whisper_context & wctx,
+          whisper_state & wstate,
+    const whisper_batch & batch,
+                    int   n_threads) {
+    auto & group = wctx.decode_group;
+
+    whisper_decode_request request = { &wstate, &batch, n_threads };
+
+    std::unique_lock<std::mutex> lock(group.mutex);
+
+    group.pending.push_back(&request);
+    if (std::find(group.expected.begin(), group.expected.end(), &wstate) == group.expected.end()) {
+        group.expected.push_back(&wstate);
     }
+    group.cond.notify_all();
 
-    path_bin += "-encoder-openvino-cache";
+    group.cond.wait(lock, [&]() {
+        return request.status != 0 || (!group.busy && group.pending.front() == &request);
+    });
+    if (request.status != 0) {
+        return request.status > 0;
+    }
 
-    return path_bin;
-}
-#endif
+    const int max_states = std::max(1, group.max_states.load(std::memory_order_relaxed));
 
-struct whisper_state * whisper_init_state(whisper_context * ctx) {
-    fill_sin_cos_table();
+    const auto is_pending = [&](const whisper_state * state) {
+        return std::any_of(group.pending.begin(), group.pending.end(), [&](const whisper_decode_request * r) { return r->state == state; });
+    };
 
-    whisper_state * state = new whisper_state;
+    group.cond.wait_for(lock, std::chrono::microseconds(group.wait_us.load(std::memory_order_relaxed)), [&]() {
+        return (int) group.pending.size() >= max_states || std::all_of(group.expected.begin(), group.expected.end(), is_pending);
+    });
 
-    state->backend = whisper_backend_init(ctx->params);
+    group.expected.erase(std::remove_if(group.expected.begin(), group.expected.end(), [&](const whisper_state * state) { return !is_pending(state); }), group.expected.end());
 
-    // at this point, we don't know yet how many decoders will be used, so we overallocate 3x ctx
-    // in theory, there can be a case where this is not enough, but in practice it should always be enough
-    const int factor = 3;
+    const size_t n_requests = std::min(group.pending.size(), (size_t) max_states);
+    std::vector<whisper_decode_request *> requests(group.pending.begin(), group.pending.begin() + n_requests);
+    group.pending.erase(group.pending.begin(), group.pending.begin() + n_requests);
 
-    if (!kv_cache_init(ctx->model.hparams, state->kv_self, ctx->backend, ctx->itype, factor*ctx->model.hparams.n_text_ctx)) {
-        WHISPER_LOG_ERROR("%s: kv_cache_init() failed for self-attention cache\n", __func__);
-        delete state;
-        return nullptr;
-    }
+    group.busy = true;
+    lock.unlock();
 
-    {
-        const size_t memory_size = ggml_nbytes(state->kv_self.k) + ggml_nbytes(state->kv_self.v);
-        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
+    // the states of the other requests wait for the step, it runs on the threads of all of them
+    int n_threads_group = 0;
+    for (const auto * r : requests) {
+        n_threads_group += r->n_threads;
     }
 
-    if (!kv_cache_init(ctx->model.hparams, state->kv_cross, ctx->backend, ctx->itype, ctx->model.hparams.n_audio_ctx)) {
-        WHISPER_LOG_ERROR("%s: kv_cache_init() failed for cross-attention cache\n", __func__);
-        delete state;
-        return nullptr;
-    }
+    // alone, the state's own graph is cached and faster
+    const bool ok = requests.size() > 1 && whisper_decode_group_compute(wctx, requests, n_threads_group);
 
-    {
-        const size_t memory_size = ggml_nbytes(state->kv_cross.k) + ggml_nbytes(state->kv_cross.v);
-        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
+    lock.lock();
+    for (auto * r : requests) {
+        r->status = ok ? 1 : -1;
     }
+    group.busy = false;
+    group.cond.notify_all();
 
-#ifdef WHISPER_USE_COREML
-    const auto path_coreml = whisper_get_coreml_path_encoder(ctx->path_model);
+    return ok;
+}
 
-    WHISPER_LOG_INFO("%s: loading Core ML model from '%s'\n", __func__, path_coreml.c_str());
-    WHISPER_LOG_INFO("%s: first run on a device may take a while ...\n", __func__);
+// wstate stops decoding, the steps no longer wait for it
+static void whisper_decode_group_leave(whisper_context & wctx, whisper_state & wstate) {
+    auto & group = wctx.decode_group;
 
-    state->ctx_coreml = whisper_coreml_init(path_coreml.c_str());
-    if (!state->ctx_coreml) {
-        WHISPER_LOG_ERROR("%s: failed to load Core ML model from '%s'\n", __func__, path_coreml.c_str());
-#ifndef WHISPER_COREML_ALLOW_FALLBACK
-        delete state;
-        return nullptr;
+    std::lock_guard<std::mutex> lock(group.mutex);
+    group.expected.erase(std::remove(group.expected.begin(), group.expected.end(), &wstate), group.expected.end());
+    group.cond.notify_all();
+}
+
+// evaluate the decoder
+//
+// given text prompt + audio features -> computes the logits for the next token
+//
+//   - model:      the model
+//   - n_threads:  number of threads to use
+//   - tokens:     text prompt
+//   - n_tokens:   number of tokens in the prompt
+//   - n_past:     number of past tokens to prefix the prompt with
+//
+static bool whisper_decode_internal(
+        whisper_context & wctx,
+          whisper_state & wstate,
+    const whisper_batch & batch,
+              const int   n_threads,
+ whisper_abort_callback   abort_callback,
+                   void * abort_callback_data) {
+    WHISPER_TRACE_ZONE("whisper_decode");
+    const int64_t t_start_us = ggml_time_us();
+
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_vocab  = hparams.n_vocab;
+    const int n_tokens = batch.n_tokens;
+
+    auto & logits_out = wstate.logits;
+
+    struct ggml_tensor * logits;
+
+    // find KV slot for the batch
+    {
+        auto & kv_self = wstate.kv_self;
+
+        if (!whisper_kv_cache_find_slot(kv_self, batch)) {
+            return false;
+        }
+
+        // padded so that the decoder graph is reused for the next tokens, the extra cells are masked
+        kv_self.n = std::min((int32_t) kv_self.size, GGML_PAD(whisper_kv_cache_cell_max(kv_self), 32));
+        //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
+        //printf("n_tokens = %5d, kv_self.head = %5d, kv_self.n = %5d, seq_id = %5d\n", batch.n_tokens, kv_self.head, kv_self.n, batch.seq_id[0][0]);
+    }
+
+    const auto & subset = wctx.vocab_subset;
+    const bool use_subset = wstate.use_vocab_subset && subset.d_te;
+
+    // together with the steps that other states post at the same time, the logits are in when it returns true
+    const bool grouped = whisper_decode_group_eligible(wctx, wstate, batch) && whisper_decode_group_submit(wctx, wstate, batch, n_threads);
+
+    // decoder
+    if (!grouped) {
+        const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wstate.n_audio_ctx_max;
+
+        bool built = false;
+
+        ggml_cgraph * gf = whisper_allocr_graph_get(wstate.alloc_decode, { n_tokens, (int32_t) wstate.kv_self.n, n_audio_ctx, whisper_batch_first_logits(batch), wstate.aheads_capture, use_subset ? subset.n_set : 0 }, built,
+                [&]() { return whisper_build_graph_decoder(wctx, wstate, batch); });
+
+        whisper_set_inputs_decoder(wstate, gf, batch);
+
+        logits = gf->nodes[gf->n_nodes - 1];
+
+        if (!whisper_graph_compute(wstate, true, gf, n_threads)) {
+            return false;
+        }
+    }
+
+    // the logits tensor starts at the first token that needs them
+    const int i_logits = whisper_batch_first_logits(batch);
+
+    logits_out.resize(n_tokens*n_vocab);
+    for (int i = 0; i < n_tokens && !grouped; i++) {
+        if (batch.logits[i] == 0) {
+            continue;
+        }
+        if (use_subset) {
+            const int n_subset = subset.ids.size();
+
+            wstate.logits_subset.resize(n_subset);
+            ggml_backend_tensor_get(logits, wstate.logits_subset.data(), sizeof(float)*(n_subset*(i - i_logits)), sizeof(float)*n_subset);
+
+            float * row = logits_out.data() + (n_vocab*i);
+            std::fill(row, row + n_vocab, -INFINITY);
+            for (int k = 0; k < n_subset; ++k) {
+                row[subset.ids[k]] = wstate.logits_subset[k];
+            }
+            continue;
+        }
+        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*(i - i_logits)), sizeof(float)*n_vocab);
+    }
+
+    if (batch.n_tokens > 1) {
+        //printf("%s: used_mem = %f MB, %f MB, %f MB %f MB %f MB\n", __func__,
+        //        ggml_used_mem(ctx0)/1e6,
+        //        wstate.get_buf_max_mem(0)/1e6,
+        //        wstate.get_buf_max_mem(1)/1e6,
+        //        wstate.get_buf_max_mem(2)/1e6,
+        //        wstate.get_buf_max_mem(3)/1e6);
+    }
+
+    if (batch.n_tokens == 1) {
+        wstate.t_decode_us += ggml_time_us() - t_start_us;
+        wstate.n_decode++;
+    } else if (batch.n_tokens < 16) {
+        wstate.t_batchd_us += ggml_time_us() - t_start_us;
+        wstate.n_batchd += n_tokens;
+    } else {
+        wstate.t_prompt_us += ggml_time_us() - t_start_us;
+        wstate.n_prompt += n_tokens;
+    }
+
+    return !(abort_callback && abort_callback(abort_callback_data));
+}
+
+//  500 -> 00:05.000
+// 6000 -> 01:00.000
+static std::string to_timestamp(int64_t t, bool comma = false) {
+    int64_t msec = t * 10;
+    int64_t hr = msec / (1000 * 60 * 60);
+    msec = msec - hr * (1000 * 60 * 60);
+    int64_t min = msec / (1000 * 60);
+    msec = msec - min * (1000 * 60);
+    int64_t sec = msec / 1000;
+    msec = msec - sec * 1000;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%02d:%02d:%02d%s%03d", (int) hr, (int) min, (int) sec, comma ? "," : ".", (int) msec);
+
+    return std::string(buf);
+}
+
+// Mixed-radix FFT for the mel spectrogram
+//
+// The frame is real, so the N point transform runs as an N/2 point complex one over the (even, odd)
+// sample pairs followed by a split step. N/2 factors into radix 4, 2, 3 and 5 stages, e.g. 200 = 4*2*5*5
+// for WHISPER_N_FFT. Everything that only depends on N - the digit reversal, the twiddles of every stage
+// and the split factors - lives in a plan computed once, a frame then runs in place over two scratch
+// arrays owned by the caller. Real and imaginary parts are kept apart so the butterflies of a stage work
+// on unit stride columns, 4 at a time with SSE or NEON.
+
+struct whisper_fft_stage {
+    int radix;
+    int span; // length of the sub-transforms this stage combines
+
+    // (radix - 1)*span twiddles, [(q - 1)*span + j] = exp(-2*pi*i*j*q/(span*radix))
+    std::vector<float> tw_re;
+    std::vector<float> tw_im;
+};
+
+struct whisper_fft_plan {
+    int n = 0; // real input length
+    int m = 0; // complex transform length, n/2
+
+    std::vector<int> perm; // digit reversal, sample pair loaded into each slot of the scratch arrays
+    std::vector<whisper_fft_stage> stages;
+
+    // split factors exp(-2*pi*i*k/n), k = 0 .. m
+    std::vector<float> split_re;
+    std::vector<float> split_im;
+
+    // sizes that do not factor run a naive DFT over these instead, exp(-2*pi*i*k/n), k = 0 .. n - 1
+    std::vector<float> dft_re;
+    std::vector<float> dft_im;
+
+    explicit whisper_fft_plan(int n);
+};
+
+whisper_fft_plan::whisper_fft_plan(int n) : n(n), m(n/2) {
+    std::vector<int> radices;
+    int rem = m;
+    for (int radix : { 4, 2, 3, 5 }) {
+        while (rem > 1 && rem % radix == 0) {
+            radices.push_back(radix);
+            rem /= radix;
+        }
+    }
+
+    if (n % 2 != 0 || rem != 1) {
+        dft_re.resize(n);
+        dft_im.resize(n);
+        for (int k = 0; k < n; k++) {
+            dft_re[k] =  cos((2*M_PI*k)/n);
+            dft_im[k] = -sin((2*M_PI*k)/n);
+        }
+        return;
+    }
+
+    perm.resize(m);
+    for (int i = 0; i < m; i++) {
+        int idx  = 0;
+        int digits = i;
+        int mult = m;
+        for (int radix : radices) {
+            mult /= radix;
+            idx += (digits % radix)*mult;
+            digits /= radix;
+        }
+        perm[i] = idx;
+    }
+
+    int span = 1;
+    for (int radix : radices) {
+        whisper_fft_stage stage;
+        stage.radix = radix;
+        stage.span  = span;
+        stage.tw_re.resize((radix - 1)*span);
+        stage.tw_im.resize((radix - 1)*span);
+        for (int q = 1; q < radix; q++) {
+            for (int j = 0; j < span; j++) {
+                const double theta = (2*M_PI*j*q)/(span*radix);
+                stage.tw_re[(q - 1)*span + j] =  cos(theta);
+                stage.tw_im[(q - 1)*span + j] = -sin(theta);
+            }
+        }
+        stages.push_back(std::move(stage));
+        span *= radix;
+    }
+
+    split_re.resize(m + 1);
+    split_im.resize(m + 1);
+    for (int k = 0; k <= m; k++) {
+        split_re[k] =  cos((2*M_PI*k)/n);
+        split_im[k] = -sin((2*M_PI*k)/n);
+    }
+}
+
+// one lane, for narrow stages and the columns left over after the vector loop
+struct whisper_fft_f1 {
+    float v;
+
+    static const int width = 1;
+
+    static whisper_fft_f1 load(const float * p) { return { *p }; }
+    static whisper_fft_f1 set1(float x) { return { x }; }
+    void store(float * p) const { *p = v; }
+
+    whisper_fft_f1 operator+(whisper_fft_f1 b) const { return { v + b.v }; }
+    whisper_fft_f1 operator-(whisper_fft_f1 b) const { return { v - b.v }; }
+    whisper_fft_f1 operator*(whisper_fft_f1 b) const { return { v * b.v }; }
+    whisper_fft_f1 operator/(whisper_fft_f1 b) const { return { v / b.v }; }
+    whisper_fft_f1 max(whisper_fft_f1 b) const { return { std::max(v, b.v) }; }
+
+    // v = mantissa*2^exponent with the mantissa in [1, 2), for positive normal v
+    void frexp2(whisper_fft_f1 & mantissa, whisper_fft_f1 & exponent) const {
+        uint32_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        exponent.v = (float) ((int32_t) (bits >> 23) - 127);
+        bits = (bits & 0x007fffff) | 0x3f800000;
+        memcpy(&mantissa.v, &bits, sizeof(bits));
+    }
+};
+
+#if defined(WHISPER_FFT_SSE)
+struct whisper_fft_f4 {
+    __m128 v;
+
+    static const int width = 4;
+
+    static whisper_fft_f4 load(const float * p) { return { _mm_loadu_ps(p) }; }
+    static whisper_fft_f4 set1(float x) { return { _mm_set1_ps(x) }; }
+    void store(float * p) const { _mm_storeu_ps(p, v); }
+
+    whisper_fft_f4 operator+(whisper_fft_f4 b) const { return { _mm_add_ps(v, b.v) }; }
+    whisper_fft_f4 operator-(whisper_fft_f4 b) const { return { _mm_sub_ps(v, b.v) }; }
+    whisper_fft_f4 operator*(whisper_fft_f4 b) const { return { _mm_mul_ps(v, b.v) }; }
+    whisper_fft_f4 operator/(whisper_fft_f4 b) const { return { _mm_div_ps(v, b.v) }; }
+    whisper_fft_f4 max(whisper_fft_f4 b) const { return { _mm_max_ps(v, b.v) }; }
+
+    void frexp2(whisper_fft_f4 & mantissa, whisper_fft_f4 & exponent) const {
+#if defined(WHISPER_FFT_SSE2)
+        const __m128i bits = _mm_castps_si128(v);
+        exponent.v = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+        mantissa.v = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000)));
+#else
+        float lanes[4], m[4], e[4];
+        _mm_storeu_ps(lanes, v);
+        for (int l = 0; l < 4; l++) {
+            whisper_fft_f1 lm, le;
+            whisper_fft_f1 { lanes[l] }.frexp2(lm, le);
+            m[l] = lm.v;
+            e[l] = le.v;
+        }
+        mantissa.v = _mm_loadu_ps(m);
+        exponent.v = _mm_loadu_ps(e);
+#endif
+    }
+};
+#elif defined(WHISPER_FFT_NEON)
+struct whisper_fft_f4 {
+    float32x4_t v;
+
+    static const int width = 4;
+
+    static whisper_fft_f4 load(const float * p) { return { vld1q_f32(p) }; }
+    static whisper_fft_f4 set1(float x) { return { vdupq_n_f32(x) }; }
+    void store(float * p) const { vst1q_f32(p, v); }
+
+    whisper_fft_f4 operator+(whisper_fft_f4 b) const { return { vaddq_f32(v, b.v) }; }
+    whisper_fft_f4 operator-(whisper_fft_f4 b) const { return { vsubq_f32(v, b.v) }; }
+    whisper_fft_f4 operator*(whisper_fft_f4 b) const { return { vmulq_f32(v, b.v) }; }
+    whisper_fft_f4 max(whisper_fft_f4 b) const { return { vmaxq_f32(v, b.v) }; }
+
+    whisper_fft_f4 operator/(whisper_fft_f4 b) const {
+#if defined(__aarch64__) || defined(_M_ARM64)
+        return { vdivq_f32(v, b.v) };
+#else
+        // Armv7 has no vector division, the estimate of the reciprocal is refined twice
+        float32x4_t r = vrecpeq_f32(b.v);
+        r = vmulq_f32(vrecpsq_f32(b.v, r), r);
+        r = vmulq_f32(vrecpsq_f32(b.v, r), r);
+        return { vmulq_f32(v, r) };
+#endif
+    }
+
+    void frexp2(whisper_fft_f4 & mantissa, whisper_fft_f4 & exponent) const {
+        const int32x4_t bits = vreinterpretq_s32_f32(v);
+        exponent.v = vcvtq_f32_s32(vsubq_s32(vshrq_n_s32(bits, 23), vdupq_n_s32(127)));
+        mantissa.v = vreinterpretq_f32_s32(vorrq_s32(vandq_s32(bits, vdupq_n_s32(0x007fffff)), vdupq_n_s32(0x3f800000)));
+    }
+};
+#else
+typedef whisper_fft_f1 whisper_fft_f4;
+#endif
+
+// twiddle, then radix point DFT of columns j .. j + V::width - 1 of one block
+template <typename V>
+static inline void whisper_fft_butterfly(const whisper_fft_stage & stage, float * re, float * im, int base, int j) {
+    const int span = stage.span;
+
+    V xr[5];
+    V xi[5];
+    for (int q = 0; q < stage.radix; q++) {
+        xr[q] = V::load(re + base + q*span + j);
+        xi[q] = V::load(im + base + q*span + j);
+    }
+
+    if (span > 1) {
+        for (int q = 1; q < stage.radix; q++) {
+            const V wr = V::load(stage.tw_re.data() + (q - 1)*span + j);
+            const V wi = V::load(stage.tw_im.data() + (q - 1)*span + j);
+            const V tr = xr[q]*wr - xi[q]*wi;
+            xi[q] = xr[q]*wi + xi[q]*wr;
+            xr[q] = tr;
+        }
+    }
+
+    V yr[5];
+    V yi[5];
+    switch (stage.radix) {
+        case 2:
+            {
+                yr[0] = xr[0] + xr[1]; yi[0] = xi[0] + xi[1];
+                yr[1] = xr[0] - xr[1]; yi[1] = xi[0] - xi[1];
+            } break;
+        case 3:
+            {
+                const V c = V::set1(-0.5f);
+                const V s = V::set1(0.86602540378443864676f);
+
+                const V tr = xr[1] + xr[2], ti = xi[1] + xi[2];
+                const V dr = xr[1] - xr[2], di = xi[1] - xi[2];
+                const V mr = xr[0] + c*tr,  mi = xi[0] + c*ti;
+
+                yr[0] = xr[0] + tr; yi[0] = xi[0] + ti;
+                yr[1] = mr + s*di;  yi[1] = mi - s*dr;
+                yr[2] = mr - s*di;  yi[2] = mi + s*dr;
+            } break;
+        case 4:
+            {
+                const V t0r = xr[0] + xr[2], t0i = xi[0] + xi[2];
+                const V t1r = xr[0] - xr[2], t1i = xi[0] - xi[2];
+                const V t2r = xr[1] + xr[3], t2i = xi[1] + xi[3];
+                const V t3r = xr[1] - xr[3], t3i = xi[1] - xi[3];
+
+                yr[0] = t0r + t2r; yi[0] = t0i + t2i;
+                yr[1] = t1r + t3i; yi[1] = t1i - t3r;
+                yr[2] = t0r - t2r; yi[2] = t0i - t2i;
+                yr[3] = t1r - t3i; yi[3] = t1i + t3r;
+            } break;
+        case 5:
+            {
+                const V c1 = V::set1( 0.30901699437494742410f);
+                const V c2 = V::set1(-0.80901699437494742410f);
+                const V s1 = V::set1( 0.95105651629515357212f);
+                const V s2 = V::set1( 0.58778525229247312917f);
+
+                const V t1r = xr[1] + xr[4], t1i = xi[1] + xi[4];
+                const V t2r = xr[2] + xr[3], t2i = xi[2] + xi[3];
+                const V d1r = xr[1] - xr[4], d1i = xi[1] - xi[4];
+                const V d2r = xr[2] - xr[3], d2i = xi[2] - xi[3];
+
+                const V m1r = xr[0] + c1*t1r + c2*t2r, m1i = xi[0] + c1*t1i + c2*t2i;
+                const V m2r = xr[0] + c2*t1r + c1*t2r, m2i = xi[0] + c2*t1i + c1*t2i;
+                const V n1r = s1*d1r + s2*d2r,         n1i = s1*d1i + s2*d2i;
+                const V n2r = s2*d1r - s1*d2r,         n2i = s2*d1i - s1*d2i;
+
+                yr[0] = xr[0] + t1r + t2r; yi[0] = xi[0] + t1i + t2i;
+                yr[1] = m1r + n1i;         yi[1] = m1i - n1r;
+                yr[4] = m1r - n1i;         yi[4] = m1i + n1r;
+                yr[2] = m2r + n2i;         yi[2] = m2i - n2r;
+                yr[3] = m2r - n2i;         yi[3] = m2i + n2r;
+            } break;
+        default:
+            GGML_ASSERT(false && "unsupported FFT radix");
+    }
+
+    for (int q = 0; q < stage.radix; q++) {
+        yr[q].store(re + base + q*span + j);
+        yi[q].store(im + base + q*span + j);
+    }
+}
+
+// in: n real values
+// out: bins 0 .. n/2 of the spectrum, interleaved complex
+// re, im: scratch of n/2 floats each
+static void fft(const whisper_fft_plan & plan, const float * in, float * out, float * re, float * im) {
+    const int n = plan.n;
+    const int m = plan.m;
+
+    if (plan.stages.empty()) {
+        for (int k = 0; k <= n/2; k++) {
+            float sum_re = 0;
+            float sum_im = 0;
+            for (int j = 0; j < n; j++) {
+                const int idx = (int) (((int64_t) k*j) % n);
+                sum_re += in[j]*plan.dft_re[idx];
+                sum_im += in[j]*plan.dft_im[idx];
+            }
+            out[2*k + 0] = sum_re;
+            out[2*k + 1] = sum_im;
+        }
+        return;
+    }
+
+    for (int i = 0; i < m; i++) {
+        re[i] = in[2*plan.perm[i] + 0];
+        im[i] = in[2*plan.perm[i] + 1];
+    }
+
+    for (const whisper_fft_stage & stage : plan.stages) {
+        const int block = stage.span*stage.radix;
+        for (int base = 0; base < m; base += block) {
+            int j = 0;
+            for (; j + whisper_fft_f4::width <= stage.span; j += whisper_fft_f4::width) {
+                whisper_fft_butterfly<whisper_fft_f4>(stage, re, im, base, j);
+            }
+            for (; j < stage.span; j++) {
+                whisper_fft_butterfly<whisper_fft_f1>(stage, re, im, base, j);
+            }
+        }
+    }
+
+    // X[k] = E[k] + exp(-2*pi*i*k/n)*O[k], with E = (Z[k] + conj(Z[m - k]))/2 and O = -i*(Z[k] - conj(Z[m - k]))/2
+    for (int k = 0; k <= m; k++) {
+        const int k0 = k == m ? 0 : k;
+        const int k1 = k == 0 ? 0 : m - k;
+
+        const float er = 0.5f*(re[k0] + re[k1]);
+        const float ei = 0.5f*(im[k0] - im[k1]);
+        const float or_ = 0.5f*(im[k0] + im[k1]);
+        const float oi = -0.5f*(re[k0] - re[k1]);
+
+        out[2*k + 0] = er + plan.split_re[k]*or_ - plan.split_im[k]*oi;
+        out[2*k + 1] = ei + plan.split_re[k]*oi  + plan.split_im[k]*or_;
+    }
+}
+
+static bool hann_window(int length, bool periodic, std::vector<float> & output) {
+    if (output.size() < static_cast<size_t>(length)) {
+        output.resize(length);
+    }
+    int offset = -1;
+    if (periodic) {
+        offset = 0;
+    }
+    for (int i = 0; i < length; i++) {
+        output[i] = 0.5*(1.0 - cosf((2.0*M_PI*i)/(length + offset)));
+    }
+
+    return true;
+}
+
+// sum of x[k]*w[k] over the bins [k0, k1) of a filter
+static double log_mel_filter_dot(const float * x, const float * w, int k0, int k1) {
+    typedef whisper_fft_f4 V;
+
+    V acc = V::set1(0.0f);
+    int k = k0;
+    for (; k + V::width <= k1; k += V::width) {
+        acc = acc + V::load(x + k) * V::load(w + k);
+    }
+
+    float lanes[4];
+    acc.store(lanes);
+
+    double sum = 0.0;
+    for (int l = 0; l < V::width; l++) {
+        sum += lanes[l];
+    }
+    for (; k < k1; k++) {
+        sum += x[k] * w[k];
+    }
+
+    return sum;
+}
+
+// log10(x) for positive normal x, within 1.5e-6 of the exact value: with x = m*2^e and m in [1, 2),
+// ln(m) = 2*atanh(s) for s = (m - 1)/(m + 1) in [0, 1/3), whose series is cut after s^11
+template <typename V>
+static inline V log_mel_log10(V x) {
+    V m, e;
+    x.frexp2(m, e);
+    const V one = V::set1(1.0f);
+    const V s  = (m - one)/(m + one);
+    const V s2 = s*s;
+
+    V p = V::set1(2.0f/11);
+    p = p*s2 + V::set1(2.0f/9);
+    p = p*s2 + V::set1(2.0f/7);
+    p = p*s2 + V::set1(2.0f/5);
+    p = p*s2 + V::set1(2.0f/3);
+    p = p*s2 + V::set1(2.0f);
+
+    return p*s*V::set1(0.43429448190325182765f) + e*V::set1(0.30102999566398119521f);
+}
+
+// log10 of the filter sums of a frame in place, the largest of them into vmax and max
+static void log_mel_log10_frame(float * frame, int n_mel, whisper_fft_f4 & vmax, float & max) {
+    typedef whisper_fft_f4 V;
+
+    int j = 0;
+    for (; j + V::width <= n_mel; j += V::width) {
+        const V y = log_mel_log10(V::load(frame + j));
+        vmax = vmax.max(y);
+        y.store(frame + j);
+    }
+    for (; j < n_mel; j++) {
+        const whisper_fft_f1 y = log_mel_log10(whisper_fft_f1::load(frame + j));
+        max = std::max(max, y.v);
+        y.store(frame + j);
+    }
+}
+
+static void log_mel_spectrogram_worker_thread(int ith, const std::vector<float> & hann, const std::vector<float> & samples,
+                                              int n_samples, int frame_size, int frame_step, int n_threads,
+                                              const whisper_fft_plan & fft_plan,
+                                              const whisper_mel_cache * cache, int64_t sample_offset,
+                                              const whisper_filters & filters, whisper_mel & mel, float & mel_max) {
+    // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
+    int n_fft = 1 + (frame_size / 2);
+    std::vector<float> fft_in(frame_size, 0.0);
+    std::vector<float> fft_out(2 * n_fft);
+    std::vector<float> fft_re(frame_size / 2);
+    std::vector<float> fft_im(frame_size / 2);
+    std::vector<float> frame_mel(mel.n_mel);
+    int i = ith;
+
+    // the largest log10 value of the frames of this thread, for the clamping after all of them are done
+    whisper_fft_f4 vmax = whisper_fft_f4::set1(-1e20f);
+    float max = -1e20f;
+
+    // calculate FFT only when fft_in are not all zero
+    for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
+        const int offset = i * frame_step;
+
+        // reuse the frame if the previous call saw the same window, i.e. it is all audio in both
+        if (cache && offset >= frame_size / 2 && offset + frame_size <= n_samples) {
+            const int64_t pos = sample_offset + offset - frame_size / 2 - cache->offset;
+            if (pos >= 0 && pos % frame_step == 0 && pos / frame_step < cache->n_frames && cache->n_mel == mel.n_mel) {
+                const float * frame = cache->data.data() + (pos / frame_step) * mel.n_mel;
+                for (int j = 0; j < mel.n_mel; j++) {
+                    mel.data[j * mel.n_len + i] = frame[j];
+                    max = std::max(max, frame[j]);
+                }
+                continue;
+            }
+        }
+
+        // apply Hanning window (~10% faster)
+        for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
+            fft_in[j] = hann[j] * samples[offset + j];
+        }
+        // fill the rest with zeros
+        if (n_samples - offset < frame_size) {
+            std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
+        }
+
+        // FFT
+        fft(fft_plan, fft_in.data(), fft_out.data(), fft_re.data(), fft_im.data());
+
+        // Calculate modulus^2 of complex numbers
+        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
+        for (int j = 0; j < n_fft; j++) {
+            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
+        }
+
+        // mel spectrogram, each filter over the bins it covers
+        const int n_bins = std::min(n_fft, (int) filters.n_fft);
+        for (int j = 0; j < mel.n_mel; j++) {
+            const float * weights = filters.data.data() + (size_t) j * filters.n_fft;
+
+            const double sum = log_mel_filter_dot(fft_out.data(), weights, filters.bin_begin[j], std::min((int) filters.bin_end[j], n_bins));
+
+            frame_mel[j] = (float) std::max(sum, 1e-10);
+        }
+
+        // the logarithms of the whole frame in one vector pass
+        log_mel_log10_frame(frame_mel.data(), mel.n_mel, vmax, max);
+
+        for (int j = 0; j < mel.n_mel; j++) {
+            mel.data[j * mel.n_len + i] = frame_mel[j];
+        }
+    }
+
+    // Otherwise fft_out are all zero
+    const float sum = -10.0f; // log10(1e-10)
+    if (i < mel.n_len) {
+        max = std::max(max, sum);
+    }
+    for (; i < mel.n_len; i += n_threads) {
+        for (int j = 0; j < mel.n_mel; j++) {
+            mel.data[j * mel.n_len + i] = sum;
+        }
+    }
+
+    float lanes[4];
+    vmax.store(lanes);
+    for (int l = 0; l < whisper_fft_f4::width; l++) {
+        max = std::max(max, lanes[l]);
+    }
+    mel_max = max;
+}
+
+struct log_mel_spectrogram_task {
+    const std::vector<float> & hann;
+    const std::vector<float> & samples;
+    int n_samples;
+    int frame_size;
+    int frame_step;
+    const whisper_fft_plan & fft_plan;
+    const whisper_mel_cache * cache;
+    int64_t sample_offset;
+    const whisper_filters & filters;
+    whisper_mel & mel;
+    std::vector<float> & thread_max; // per thread
+};
+
+static void log_mel_spectrogram_run(int ith, int nth, void * data) {
+    const log_mel_spectrogram_task & task = *(const log_mel_spectrogram_task *) data;
+    log_mel_spectrogram_worker_thread(ith, task.hann, task.samples, task.n_samples, task.frame_size, task.frame_step, nth,
+            task.fft_plan, task.cache, task.sample_offset, task.filters, task.mel, task.thread_max[ith]);
+}
+
+struct log_mel_normalize_task {
+    float * data;
+    int64_t n;
+    float   floor;
+};
+
+// clamps to the floor and rescales, each thread a contiguous share of the spectrogram
+static void log_mel_normalize_run(int ith, int nth, void * data) {
+    typedef whisper_fft_f4 V;
+
+    const log_mel_normalize_task & task = *(const log_mel_normalize_task *) data;
+    const int64_t share = ((task.n + nth - 1)/nth + V::width - 1)/V::width*V::width;
+    const int64_t i0 = std::min(task.n, share*ith);
+    const int64_t i1 = std::min(task.n, i0 + share);
+
+    // (x + 4)/4, exact to the same float as in double
+    const V floor = V::set1(task.floor);
+    const V scale = V::set1(0.25f);
+    const V one   = V::set1(1.0f);
+    int64_t i = i0;
+    for (; i + V::width <= i1; i += V::width) {
+        (V::load(task.data + i).max(floor)*scale + one).store(task.data + i);
+    }
+    for (; i < i1; i++) {
+        task.data[i] = std::max(task.data[i], task.floor)*0.25f + 1.0f;
+    }
+}
+
+// the persistent workers the mel spectrogram of the state is computed on, those of its CPU backend when it has one
+static ggml_threadpool * whisper_mel_threadpool(whisper_state & wstate, int n_threads) {
+    ggml_backend_t backend_cpu = ggml_backend_is_cpu(wstate.backend) ? wstate.backend : wstate.backend_cpu;
+    if (backend_cpu) {
+        ggml_backend_cpu_set_n_threads(backend_cpu, n_threads);
+        return ggml_backend_cpu_get_threadpool(backend_cpu);
+    }
+
+    if (n_threads <= 1) {
+        return nullptr;
+    }
+    if (!wstate.threadpool_mel || ggml_threadpool_n_threads(wstate.threadpool_mel) != n_threads) {
+        ggml_threadpool_free(wstate.threadpool_mel);
+        wstate.threadpool_mel = ggml_threadpool_new(n_threads);
+    }
+
+    return wstate.threadpool_mel;
+}
+
+// ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L110-L157
+static bool log_mel_spectrogram(
+              whisper_state & wstate,
+              const float * samples,
+              const int   n_samples,
+              const int   /*sample_rate*/,
+              const int   frame_size,
+              const int   frame_step,
+              const int   n_mel,
+              const int   n_threads,
+              const whisper_filters & filters,
+              const bool   debug,
+              whisper_mel & mel,
+              whisper_mel_cache * cache = nullptr,
+              const int64_t sample_offset = 0) {
+    WHISPER_TRACE_ZONE("log_mel_spectrogram");
+    const int64_t t_start_us = ggml_time_us();
+
+    wstate.mel_pending.clear();
+
+    // Hanning window (Use cosf to eliminate difference)
+    // ref: https://pytorch.org/docs/stable/generated/torch.hann_window.html
+    // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L147
+    std::vector<float> hann;
+    hann_window(frame_size, true, hann);
+
+    // the plans for the two frame sizes whisper uses are built once and kept
+    static const whisper_fft_plan fft_plan_n_fft(WHISPER_N_FFT);
+    static const whisper_fft_plan fft_plan_2_n_fft(2*WHISPER_N_FFT);
+    const bool fft_plan_cached = frame_size == WHISPER_N_FFT || frame_size == 2*WHISPER_N_FFT;
+    const whisper_fft_plan fft_plan_other(fft_plan_cached ? 0 : frame_size);
+    const whisper_fft_plan & fft_plan =
+        frame_size == WHISPER_N_FFT ? fft_plan_n_fft : frame_size == 2*WHISPER_N_FFT ? fft_plan_2_n_fft : fft_plan_other;
+
+
+    // Calculate the length of padding
+    int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
+    int64_t stage_2_pad = frame_size / 2;
+
+    // Initialize a vector and copy data from C array to it.
+    std::vector<float> samples_padded;
+    samples_padded.resize(n_samples + stage_1_pad + stage_2_pad * 2);
+    std::copy(samples, samples + n_samples, samples_padded.begin() + stage_2_pad);
+
+    // pad 30 seconds of zeros at the end of audio (480,000 samples) + reflective pad 200 samples at the end of audio
+    std::fill(samples_padded.begin() + n_samples + stage_2_pad, samples_padded.begin() + n_samples + stage_1_pad + 2 * stage_2_pad, 0);
+
+    // reflective pad 200 samples at the beginning of audio
+    std::reverse_copy(samples + 1, samples + 1 + stage_2_pad, samples_padded.begin());
+
+    mel.n_mel     = n_mel;
+    // https://github.com/pytorch/pytorch/blob/main/aten/src/ATen/native/SpectralOps.cpp#L936
+    // Calculate number of frames + remove the last frame
+    mel.n_len     = (samples_padded.size() - frame_size) / frame_step;
+    // Calculate semi-padded sample length to ensure compatibility
+    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
+    mel.data.resize(mel.n_mel * mel.n_len);
+
+
+    // on the workers the state keeps between calls, this thread is the first of them
+    ggml_threadpool * threadpool = whisper_mel_threadpool(wstate, n_threads);
+    std::vector<float> thread_max(n_threads, -1e20f);
+    {
+        log_mel_spectrogram_task task = {
+            hann, samples_padded, (int) (n_samples + stage_2_pad), frame_size, frame_step,
+            fft_plan, cache, sample_offset, filters, mel, thread_max,
+        };
+
+        ggml_threadpool_run(threadpool, n_threads, log_mel_spectrogram_run, &task);
+    }
+
+    // keep the frames that only cover audio for the next call
+    if (cache) {
+        const int i0 = (stage_2_pad + frame_step - 1) / frame_step;
+        const int i1 = n_samples >= frame_size ? (n_samples - stage_2_pad) / frame_step + 1 : i0;
+
+        cache->offset   = sample_offset + (int64_t) i0 * frame_step - stage_2_pad;
+        cache->n_frames = std::max(0, i1 - i0);
+        cache->n_mel    = n_mel;
+        cache->data.resize(cache->n_frames * n_mel);
+        for (int i = i0; i < i1; i++) {
+            float * frame = cache->data.data() + (i - i0) * n_mel;
+            for (int j = 0; j < n_mel; j++) {
+                frame[j] = mel.data[j * mel.n_len + i];
+            }
+        }
+    }
+
+    // clamping and normalization, the workers found the max of their frames while taking the logarithms
+    {
+        float mmax = -1e20f;
+        for (float m : thread_max) {
+            mmax = std::max(mmax, m);
+        }
+
+        log_mel_normalize_task task = { mel.data.data(), (int64_t) mel.n_mel*mel.n_len, mmax - 8.0f };
+        ggml_threadpool_run(threadpool, n_threads, log_mel_normalize_run, &task);
+    }
+
+    wstate.t_mel_us += ggml_time_us() - t_start_us;
+
+    // Dump log_mel_spectrogram
+    if (debug) {
+        std::ofstream outFile("log_mel_spectrogram.json");
+        outFile << "[";
+        for (uint64_t i = 0; i < mel.data.size() - 1; i++) {
+            outFile << mel.data[i] << ", ";
+        }
+        outFile << mel.data[mel.data.size() - 1] << "]";
+        outFile.close();
+    }
+
+    return true;
+}
+
+// with gpu_mel, keeps the samples for the conv graph instead of computing their spectrogram, when the first
+// encoder window can cover all of them. mel gets the size log_mel_spectrogram() gives it
+static bool whisper_mel_defer(
+        whisper_context & wctx,
+          whisper_state & wstate,
+            const float * samples,
+              const int   n_samples,
+              const int   n_threads) {
+    const int64_t frame_size  = WHISPER_N_FFT;
+    const int64_t frame_step  = WHISPER_HOP_LENGTH;
+    const int64_t stage_1_pad = WHISPER_SAMPLE_RATE * 30;
+    const int64_t stage_2_pad = frame_size / 2;
+
+    if (!wstate.gpu_mel || wstate.speed_up || whisper_encode_external(wstate) ||
+        wctx.model.filters.n_fft != frame_size/2 + 1 || n_samples <= stage_2_pad || n_samples + stage_2_pad > (2*wstate.n_audio_ctx_max - 1)*frame_step) {
+        return false;
+    }
+
+    auto & mel = wstate.mel;
+
+    mel.n_mel     = wctx.model.filters.n_mel;
+    mel.n_len     = (n_samples + stage_1_pad + stage_2_pad * 2 - frame_size) / frame_step;
+    mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
+    mel.data.clear();
+
+    wstate.mel_pending.assign(samples, samples + n_samples);
+    wstate.mel_pending_filters   = &wctx.model.filters;
+    wstate.mel_pending_n_threads = n_threads;
+
+    // the cache is of the spectrogram the last call computed
+    wstate.mel_cache.n_frames = 0;
+
+    return true;
+}
+
+// the frames of the conv graph at offset 0 cover all the pending samples, so the graph normalizes them over the
+// same largest value as log_mel_spectrogram() does over the whole spectrogram
+static bool whisper_mel_pending_fits(const whisper_state & wstate, int n_ctx) {
+    const int64_t n_samples = wstate.mel_pending.size();
+
+    return n_samples > 0 && n_samples + WHISPER_N_FFT/2 <= (int64_t) (2*n_ctx - 1)*WHISPER_HOP_LENGTH;
+}
+
+// computes the spectrogram of the pending samples, for the code reading wstate.mel
+static void whisper_mel_to_host(whisper_state & wstate) {
+    if (wstate.mel_pending.empty()) {
+        return;
+    }
+
+    // log_mel_spectrogram() drops the pending samples
+    const std::vector<float> samples = std::move(wstate.mel_pending);
+    const whisper_filters & filters = *wstate.mel_pending_filters;
+
+    log_mel_spectrogram(wstate, samples.data(), samples.size(), WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH,
+            filters.n_mel, wstate.mel_pending_n_threads, filters, false, wstate.mel);
+}
+
+// the padded pending samples, the filters and the window of the conv graph built from_pcm
+static void whisper_set_input_mel_pcm(whisper_state & wstate, struct ggml_cgraph * gf) {
+    const int64_t stage_2_pad = WHISPER_N_FFT / 2;
+
+    struct ggml_tensor * pcm     = ggml_graph_get_tensor(gf, "mel_pcm");
+    struct ggml_tensor * filters = ggml_graph_get_tensor(gf, "mel_filters");
+    struct ggml_tensor * window  = ggml_graph_get_tensor(gf, "mel_window");
+
+    const auto & samples = wstate.mel_pending;
+
+    // reflective pad at the beginning, zeros after the audio, as in log_mel_spectrogram()
+    wstate.inp_mel.assign(ggml_nelements(pcm), 0.0f);
+    std::reverse_copy(samples.begin() + 1, samples.begin() + 1 + stage_2_pad, wstate.inp_mel.begin());
+    std::copy(samples.begin(), samples.end(), wstate.inp_mel.begin() + stage_2_pad);
+
+    ggml_backend_tensor_set(pcm, wstate.inp_mel.data(), 0, ggml_nbytes(pcm));
+
+    const whisper_filters & mel_filters = *wstate.mel_pending_filters;
+    for (int j = 0; j < mel_filters.n_mel; ++j) {
+        ggml_backend_tensor_set(filters, mel_filters.data.data() + (size_t) j*mel_filters.n_fft, j*filters->nb[1], filters->nb[1]);
+    }
+
+    std::vector<float> hann;
+    hann_window(WHISPER_N_FFT, true, hann);
+    ggml_backend_tensor_set(window, hann.data(), 0, ggml_nbytes(window));
+}
+
+// split text into tokens
+//
+// ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
+//
+// Regex (Python):
+// r"""'s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+"""
+//
+// Regex (C++):
+// R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)"
+//
+static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
+    std::vector<std::string> words;
+
+    // first split the text into words
+    {
+        std::string str = text;
+        std::string pat = R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)";
+
+        std::regex re(pat);
+        std::smatch m;
+
+        while (std::regex_search(str, m, re)) {
+            for (auto x : m) {
+                words.push_back(x);
+            }
+            str = m.suffix();
+        }
+    }
+
+    // find the longest tokens that form the words:
+    std::vector<whisper_vocab::id> tokens;
+    for (const auto & word : words) {
+        if (word.empty()) continue;
+
+        int i = 0;
+        int n = word.size();
+        while (i < n) {
+            int j = n;
+            bool found = false;
+            while (j > i) {
+                auto sub = word.substr(i, j-i);
+                const whisper_vocab::id id = vocab.find_token(sub);
+                if (id >= 0) {
+                    tokens.push_back(id);
+                    i = j;
+                    found = true;
+                    break;
+                }
+                --j;
+            }
+            if (!found) {
+                WHISPER_LOG_ERROR("unknown token\n");
+                ++i;
+            }
+        }
+    }
+
+    return tokens;
+}
+
+//
+// interface implementation
+//
+
+#ifdef WHISPER_USE_COREML
+// replace .bin with -encoder.mlmodelc
+static std::string whisper_get_coreml_path_encoder(std::string path_bin) {
+    auto pos = path_bin.rfind('.');
+    if (pos != std::string::npos) {
+        path_bin = path_bin.substr(0, pos);
+    }
+
+    // match "-qx_x"
+    pos = path_bin.rfind('-');
+    if (pos != std::string::npos) {
+        auto sub = path_bin.substr(pos);
+        if (sub.size() == 5 && sub[1] == 'q' && sub[3] == '_') {
+            path_bin = path_bin.substr(0, pos);
+        }
+    }
+
+    path_bin += "-encoder.mlmodelc";
+
+    return path_bin;
+}
+#endif
+
+#ifdef WHISPER_USE_OPENVINO
+// replace .bin with-encoder-openvino.xml
+static std::string whisper_openvino_get_path_encoder(std::string path_bin) {
+    auto pos = path_bin.rfind('.');
+    if (pos != std::string::npos) {
+        path_bin = path_bin.substr(0, pos);
+    }
+
+    path_bin += "-encoder-openvino.xml";
+
+    return path_bin;
+}
+
+static std::string whisper_openvino_get_path_cache(std::string path_bin) {
+    auto pos = path_bin.rfind('.');
+    if (pos != std::string::npos) {
+        path_bin = path_bin.substr(0, pos);
+    }
+
+    path_bin += "-encoder-openvino-cache";
+
+    return path_bin;
+}
+#endif
+
+#ifdef WHISPER_USE_NNAPI
+// replace .bin with -encoder.tflite
+static std::string whisper_nnapi_get_path_encoder(std::string path_bin) {
+    auto pos = path_bin.rfind('.');
+    if (pos != std::string::npos) {
+        path_bin = path_bin.substr(0, pos);
+    }
+
+    path_bin += "-encoder.tflite";
+
+    return path_bin;
+}
+#endif
+
+// the [layer, head] pairs of the preset, AUTO picks the one of the model type
+static std::vector<std::pair<int, int>> whisper_get_alignment_heads(const whisper_context & ctx, whisper_alignment_heads_preset preset) {
+    const auto & hparams = ctx.model.hparams;
+    const bool multilingual = ctx.vocab.is_multilingual();
+    const bool is_auto = preset == WHISPER_AHEADS_AUTO;
+
+    if (is_auto) {
+        switch (ctx.model.type) {
+            case MODEL_TINY:   preset = multilingual ? WHISPER_AHEADS_TINY   : WHISPER_AHEADS_TINY_EN;   break;
+            case MODEL_BASE:   preset = multilingual ? WHISPER_AHEADS_BASE   : WHISPER_AHEADS_BASE_EN;   break;
+            case MODEL_SMALL:  preset = multilingual ? WHISPER_AHEADS_SMALL  : WHISPER_AHEADS_SMALL_EN;  break;
+            case MODEL_MEDIUM: preset = multilingual ? WHISPER_AHEADS_MEDIUM : WHISPER_AHEADS_MEDIUM_EN; break;
+            // large-v3 has the extra language token
+            case MODEL_LARGE:  preset = hparams.n_vocab >= 51866 ? WHISPER_AHEADS_LARGE_V3 : WHISPER_AHEADS_LARGE_V2; break;
+            default:           preset = WHISPER_AHEADS_N_TOP_MOST; break;
+        }
+    }
+
+    std::vector<std::pair<int, int>> aheads;
+
+    const auto it = g_aheads.find(preset);
+    if (it != g_aheads.end()) {
+        aheads = it->second;
+    }
+
+    // e.g. a distilled model, which has the encoder of its teacher but only a few text layers
+    for (const auto & ahead : aheads) {
+        if (ahead.first >= hparams.n_text_layer || ahead.second >= hparams.n_text_head) {
+            if (!is_auto) {
+                WHISPER_LOG_WARN("%s: the alignment heads of preset %d are not in the model, using the upper half of its text layers\n", __func__, preset);
+            }
+            aheads.clear();
+            break;
+        }
+    }
+
+    if (aheads.empty()) {
+        for (int il = hparams.n_text_layer/2; il < hparams.n_text_layer; ++il) {
+            for (int h = 0; h < hparams.n_text_head; ++h) {
+                aheads.push_back({ il, h });
+            }
+        }
+    }
+
+    return aheads;
+}
+
+// the audio context of a request on the state, 0 or more than it is sized for is all of it
+static int whisper_clamp_audio_ctx(const whisper_state & state, int n_audio_ctx) {
+    return n_audio_ctx <= 0 || n_audio_ctx > state.n_audio_ctx_max ? state.n_audio_ctx_max : n_audio_ctx;
+}
+
+static struct whisper_state * whisper_init_state_impl(whisper_context * ctx, int n_audio_ctx_max) {
+    whisper_state * state = new whisper_state;
+
+    state->backend = whisper_backend_init(ctx->params);
+    state->gpu_pacing = &ctx->gpu_pacing;
+
+    state->encoder_on_cpu = ctx->params.encoder_device == WHISPER_DEVICE_CPU;
+    state->decoder_on_cpu = ctx->params.decoder_device == WHISPER_DEVICE_CPU;
+    if ((state->encoder_on_cpu || state->decoder_on_cpu) && !ggml_backend_is_cpu(state->backend)) {
+#ifdef GGML_USE_METAL
+        // the Metal buffers are host memory, the CPU backend computes on them as they are
+        state->backend_cpu = ggml_backend_is_metal(state->backend) ? ggml_backend_cpu_init() : nullptr;
+#endif
+        // and so are those of a backend of the host
+        if (state->backend_cpu == nullptr && ctx->params.backend_init && ggml_backend_buft_is_host(ggml_backend_get_default_buffer_type(state->backend))) {
+            state->backend_cpu = ggml_backend_cpu_init();
+        }
+        if (state->backend_cpu == nullptr) {
+            WHISPER_LOG_WARN("%s: the weights are in device memory, the stages placed on the CPU stay on %s\n", __func__, ggml_backend_name(state->backend));
+            state->encoder_on_cpu = false;
+            state->decoder_on_cpu = false;
+        }
+    }
+
+    // at this point, we don't know yet how many decoders will be used, so we overallocate 3x ctx
+    // in theory, there can be a case where this is not enough, but in practice it should always be enough
+    const int factor = 3;
+
+    // the values are written one element per head dimension into their transposed layout, which
+    // quantized blocks do not allow, so a quantized cache only quantizes the keys
+    ggml_type type_k = ctx->params.kv_type;
+    if (type_k != GGML_TYPE_F32 && type_k != GGML_TYPE_F16 && type_k != GGML_TYPE_Q8_0) {
+        WHISPER_LOG_WARN("%s: unsupported kv cache type %s, using f16\n", __func__, ggml_type_name(type_k));
+        type_k = GGML_TYPE_F16;
+    }
+    if (type_k == GGML_TYPE_Q8_0 && !ggml_backend_is_cpu(ctx->backend)) {
+        // the GPU kernels expect quantized matrices to be contiguous, the per-head views of the keys are not
+        WHISPER_LOG_WARN("%s: q8_0 kv cache is only supported on the CPU, using f16\n", __func__);
+        type_k = GGML_TYPE_F16;
+    }
+    const ggml_type type_v = type_k == GGML_TYPE_Q8_0 ? GGML_TYPE_F16 : type_k;
+
+    // GGML_OP_FLASH_ATTN only has a CPU kernel, the other backends keep the mul_mat + soft_max graph
+    state->flash_attn = ctx->params.flash_attn && (ggml_backend_is_cpu(state->backend) || state->encoder_on_cpu);
+    if (ctx->params.flash_attn && !state->flash_attn) {
+        WHISPER_LOG_WARN("%s: flash attention is only supported on the CPU, disabling it\n", __func__);
+    }
+
+    // the CLBlast and cuBLAS builds of the CPU backend offload the im2col mul_mat, which the fused op would keep on the CPU
+    state->fused_conv = (ggml_backend_is_cpu(state->backend) && !ggml_cpu_has_gpublas()) || state->encoder_on_cpu;
+#ifdef GGML_USE_METAL
+    state->fused_conv = state->fused_conv || ggml_backend_is_metal(state->backend);
+#endif
+
+    // the GPU kernels and the BLAS sgemm only take f32 activations
+    state->quantize_activations = ctx->params.quantize_activations && !ggml_cpu_has_blas() &&
+        (ggml_backend_is_cpu(state->backend) || state->encoder_on_cpu);
+
+    // ggml_mul_mat_f16 and the F16 element-wise ops are CPU kernels, which only convert the rows as fast as the
+    // F32 ops read them with F16C or the Armv8.2 FP16 arithmetic, built in or picked at runtime by the CPU variants
+    state->f16_activations = ctx->params.f16_activations && !ggml_cpu_has_blas() &&
+        (ggml_cpu_has_f16c() || ggml_cpu_has_fp16_va()) &&
+        (ggml_backend_is_cpu(state->backend) || state->encoder_on_cpu);
+
+    // GGML_OP_LOG_MEL is a direct DFT, only worth it on the GPU
+#ifdef GGML_USE_METAL
+    state->gpu_mel = ctx->params.gpu_mel && ggml_backend_is_metal(state->backend) && !state->encoder_on_cpu;
+#endif
+
+    if (ctx->params.dtw_token_timestamps) {
+        state->aheads = whisper_get_alignment_heads(*ctx, ctx->params.dtw_aheads_preset);
+    }
+
+    if (!kv_cache_init(ctx->model.hparams, state->kv_self, ctx->backend, type_k, type_v, factor*ctx->model.hparams.n_text_ctx)) {
+        WHISPER_LOG_ERROR("%s: kv_cache_init() failed for self-attention cache\n", __func__);
+        delete state;
+        return nullptr;
+    }
+
+    {
+        const size_t memory_size = ggml_nbytes(state->kv_self.k) + ggml_nbytes(state->kv_self.v);
+        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
+    }
+
+#ifdef WHISPER_USE_COREML
+    // without a model path, see whisper_ctx_set_path_model(), the state encodes with ggml
+    if (!ctx->path_model.empty()) {
+        const auto path_coreml = whisper_get_coreml_path_encoder(ctx->path_model);
+
+        WHISPER_LOG_INFO("%s: loading Core ML model from '%s'\n", __func__, path_coreml.c_str());
+        WHISPER_LOG_INFO("%s: first run on a device may take a while ...\n", __func__);
+
+        state->ctx_coreml = whisper_coreml_init(path_coreml.c_str());
+        if (!state->ctx_coreml) {
+            WHISPER_LOG_ERROR("%s: failed to load Core ML model from '%s'\n", __func__, path_coreml.c_str());
+#ifndef WHISPER_COREML_ALLOW_FALLBACK
+            delete state;
+            return nullptr;
+#endif
+        } else {
+            WHISPER_LOG_INFO("%s: Core ML model loaded\n", __func__);
+        }
+    }
+#endif
+
+    // an external encoder always encodes the whole window
+    state->n_audio_ctx_max = ctx->model.hparams.n_audio_ctx;
+    if (n_audio_ctx_max > 0 && n_audio_ctx_max < state->n_audio_ctx_max && !whisper_encode_external(*state)) {
+        state->n_audio_ctx_max = n_audio_ctx_max;
+    }
+
+    if (!kv_cache_init(ctx->model.hparams, state->kv_cross, ctx->backend, type_k, type_v, state->n_audio_ctx_max)) {
+        WHISPER_LOG_ERROR("%s: kv_cache_init() failed for cross-attention cache\n", __func__);
+        delete state;
+        return nullptr;
+    }
+
+    {
+        const size_t memory_size = ggml_nbytes(state->kv_cross.k) + ggml_nbytes(state->kv_cross.v);
+        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
+    }
+
+    state->logits.reserve(ctx->vocab.n_vocab * ctx->model.hparams.n_text_ctx);
+
+    state->batch = whisper_batch_init(ctx->model.hparams.n_text_ctx, WHISPER_MAX_DECODERS);
+
+    // TAGS: WHISPER_DECODER_INIT
+    state->decoders[0].sequence.tokens.reserve(ctx->model.hparams.n_text_ctx);
+
+    state->decoders[0].probs.reserve    (ctx->vocab.n_vocab);
+    state->decoders[0].logits.reserve   (ctx->vocab.n_vocab);
+    state->decoders[0].logprobs.reserve (ctx->vocab.n_vocab);
+    state->decoders[0].logits_id.reserve(ctx->model.hparams.n_vocab);
+
+    state->decoders[0].rng = std::mt19937(0);
+
+    // conv allocator
+    {
+        whisper_allocr_graph_init(state->alloc_conv, ctx->backend,
+                [&]() {
+                    return whisper_build_graph_conv(*ctx, *state, 0);
+                });
+
+        // the measure keeps the largest of the graphs
+        if (state->gpu_mel && !whisper_encode_external(*state)) {
+            ggml_allocr_reset(state->alloc_conv.alloc);
+            ggml_allocr_alloc_graph(state->alloc_conv.alloc, whisper_build_graph_conv(*ctx, *state, 0, true));
+        }
+
+        WHISPER_LOG_INFO("%s: compute buffer (conv)   = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_conv) / 1e6);
+    }
+
+    // encoder allocator
+    if (!whisper_encode_external(*state)) {
+        whisper_allocr_graph_init(state->alloc_encode, ctx->backend,
+                [&]() {
+                    return whisper_build_graph_encoder(*ctx, *state, 0);
+                });
+
+        WHISPER_LOG_INFO("%s: compute buffer (encode) = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_encode) / 1e6);
+    }
+
+    // cross allocator
+    {
+        whisper_allocr_graph_init(state->alloc_cross, ctx->backend,
+                [&]() {
+                    // measured with the host input, the larger of the two graphs
+                    return whisper_build_graph_cross(*ctx, *state, true);
+                });
+
+        WHISPER_LOG_INFO("%s: compute buffer (cross)  = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_cross) / 1e6);
+    }
+
+    // decoder allocator
+    {
+        whisper_allocr_graph_init(state->alloc_decode, ctx->backend,
+                [&]() {
+                    const auto & hparams = ctx->model.hparams;
+
+                    // TODO: make sure this is the worst-case scenario
+                    const int n_tokens = hparams.n_text_ctx;
+                    const int n_past   = 0;
+
+                    whisper_batch_prep_legacy(state->batch, nullptr, n_tokens, n_past, 0);
+
+                    // with the copies of the alignment heads, which whisper_full_align_tokens_dtw_with_state() adds
+                    state->aheads_capture = !state->aheads.empty();
+                    struct ggml_cgraph * gf = whisper_build_graph_decoder(*ctx, *state, state->batch);
+                    state->aheads_capture = false;
+
+                    return gf;
+                });
+
+        WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_decode) / 1e6);
+    }
+
+    whisper_allocr_graph_realloc(state->alloc_conv,   ctx->backend);
+    whisper_allocr_graph_realloc(state->alloc_encode, ctx->backend);
+    whisper_allocr_graph_realloc(state->alloc_cross,  ctx->backend);
+    whisper_allocr_graph_realloc(state->alloc_decode, ctx->backend);
+
+    return state;
+}
+
+struct whisper_state * whisper_init_state(whisper_context * ctx) {
+    return whisper_init_state_impl(ctx, ctx->params.n_audio_ctx_max);
+}
+
+struct whisper_state * whisper_init_state_with_max_audio_ctx(whisper_context * ctx, int n_audio_ctx_max) {
+    return whisper_init_state_impl(ctx, n_audio_ctx_max);
+}
+
+size_t whisper_estimate_state_memory(struct whisper_context * ctx, int n_audio_ctx_max) {
+    whisper_state * state = whisper_init_state_impl(ctx, n_audio_ctx_max);
+    if (state == nullptr) {
+        return 0;
+    }
+
+    const size_t size = whisper_get_state_memory(state);
+    whisper_free_state(state);
+
+    return size;
+}
+
+void whisper_ctx_set_max_audio_ctx(struct whisper_context * ctx, int n_audio_ctx_max) {
+    ctx->params.n_audio_ctx_max = n_audio_ctx_max;
+}
+
+int whisper_ctx_set_vocab_subset(struct whisper_context * ctx, const whisper_token * tokens, int n_tokens) {
+    auto & subset = ctx->vocab_subset;
+
+    whisper_vocab_subset_free(subset);
+    subset.n_set++;
+
+    if (tokens == nullptr || n_tokens <= 0) {
+        return 0;
+    }
+
+    const int n_vocab = ctx->vocab.n_vocab;
+    const whisper_token token_eot = ctx->vocab.token_eot;
+
+    std::vector<bool> keep(n_vocab, false);
+    for (int i = 0; i < n_tokens; ++i) {
+        if (tokens[i] < 0 || tokens[i] >= token_eot) {
+            WHISPER_LOG_ERROR("%s: %d is not a text token\n", __func__, tokens[i]);
+            return -1;
+        }
+        keep[tokens[i]] = true;
+    }
+    for (int id = token_eot; id < n_vocab; ++id) {
+        keep[id] = true;
+    }
+    for (int id = 0; id < n_vocab; ++id) {
+        if (keep[id]) {
+            subset.ids.push_back(id);
+        }
+    }
+
+    const struct ggml_tensor * d_te = ctx->model.d_te;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    subset.ctx    = ggml_init(params);
+    subset.d_te   = ggml_new_tensor_2d(subset.ctx, d_te->type, d_te->ne[0], subset.ids.size());
+    subset.buffer = ggml_backend_alloc_buffer(ctx->backend, ggml_nbytes(subset.d_te));
+
+    if (!subset.buffer) {
+        WHISPER_LOG_ERROR("%s: failed to allocate memory for the vocabulary subset\n", __func__);
+        whisper_vocab_subset_free(subset);
+        return -2;
+    }
+
+    {
+        ggml_allocr * alloc = ggml_allocr_new_from_buffer(subset.buffer);
+
+        ggml_allocr_alloc(alloc, subset.d_te);
+
+        ggml_allocr_free(alloc);
+    }
+
+    // gathered through the host in runs of consecutive rows, the weights may live on a GPU
+    const size_t row_size = d_te->nb[1];
+
+    std::vector<uint8_t> rows(ggml_nbytes(subset.d_te));
+
+    for (size_t i = 0; i < subset.ids.size(); ) {
+        size_t j = i + 1;
+        while (j < subset.ids.size() && subset.ids[j] == subset.ids[j - 1] + 1) {
+            ++j;
+        }
+        ggml_backend_tensor_get(d_te, rows.data() + i*row_size, subset.ids[i]*row_size, (j - i)*row_size);
+        i = j;
+    }
+
+    ggml_backend_tensor_set(subset.d_te, rows.data(), 0, rows.size());
+
+    WHISPER_LOG_INFO("%s: projecting onto %d of %d tokens, %7.2f MB\n", __func__, (int) subset.ids.size(), n_vocab, ggml_nbytes(subset.d_te)/1e6);
+
+    return 0;
+}
+
+void whisper_ctx_set_path_model(struct whisper_context * ctx, const char * path_model) {
+    ctx->path_model = path_model ? path_model : "";
+}
+
+void whisper_ctx_set_kv_type(struct whisper_context * ctx, enum ggml_type kv_type) {
+    ctx->params.kv_type = kv_type;
+}
+
+void whisper_ctx_set_flash_attn(struct whisper_context * ctx, bool flash_attn) {
+    ctx->params.flash_attn = flash_attn;
+}
+
+void whisper_ctx_set_quantize_activations(struct whisper_context * ctx, bool quantize_activations) {
+    ctx->params.quantize_activations = quantize_activations;
+}
+
+void whisper_ctx_set_f16_activations(struct whisper_context * ctx, bool f16_activations) {
+    ctx->params.f16_activations = f16_activations;
+}
+
+void whisper_ctx_set_gpu_mel(struct whisper_context * ctx, bool gpu_mel) {
+    ctx->params.gpu_mel = gpu_mel;
+}
+
+void whisper_ctx_set_dtw(struct whisper_context * ctx, bool dtw_token_timestamps, enum whisper_alignment_heads_preset aheads_preset) {
+    ctx->params.dtw_token_timestamps = dtw_token_timestamps;
+    ctx->params.dtw_aheads_preset    = aheads_preset;
+}
+
+void whisper_ctx_set_devices(struct whisper_context * ctx, enum whisper_device encoder_device, enum whisper_device decoder_device) {
+    ctx->params.encoder_device = encoder_device;
+    ctx->params.decoder_device = decoder_device;
+}
+
+void whisper_ctx_set_gpu_submit_budget(struct whisper_context * ctx, int max_submit_us, whisper_gpu_yield_callback yield_callback, void * user_data) {
+    ctx->gpu_pacing.yield_callback_user_data = user_data;
+    ctx->gpu_pacing.yield_callback = yield_callback;
+    ctx->gpu_pacing.max_submit_us = std::max(0, max_submit_us);
+}
+
+void whisper_ctx_set_decode_batching(struct whisper_context * ctx, int max_states, int wait_us) {
+    ctx->decode_group.wait_us    = std::max(0, wait_us);
+    ctx->decode_group.max_states = std::max(1, max_states);
+}
+
+int whisper_is_encoder_external_with_state(struct whisper_state * state) {
+    return whisper_encode_external(*state) ? 1 : 0;
+}
+
+int whisper_ctx_init_openvino_encoder(
+        struct whisper_context * ctx,
+                    const char * model_path,
+                    const char * device,
+                    const char * cache_dir) {
+    return whisper_ctx_init_openvino_encoder_with_state(ctx, ctx->state, model_path, device, cache_dir);
+}
+
+int whisper_ctx_init_openvino_encoder_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                    const char * model_path,
+                    const char * device,
+                    const char * cache_dir) {
+#ifndef WHISPER_USE_OPENVINO
+    (void)(ctx);
+    (void)(state);
+    (void)(model_path);
+    (void)(device);
+    (void)(cache_dir);
+
+    return 1;
+#else
+    if (!state) {
+        WHISPER_LOG_ERROR("%s: state is nullptr\n", __func__);
+        return 1;
+    }
+
+    // the IR encodes the whole window, the cross-attention cache of the state must hold it
+    if (state->n_audio_ctx_max < ctx->model.hparams.n_audio_ctx) {
+        WHISPER_LOG_ERROR("%s: the state is sized for an audio context of %d, the OpenVINO encoder needs %d\n", __func__, state->n_audio_ctx_max, ctx->model.hparams.n_audio_ctx);
+        return 1;
+    }
+
+    if (!model_path && ctx->path_model.empty()) {
+        WHISPER_LOG_ERROR("%s: model_path is nullptr, and ctx has no model_path set.\n", __func__);
+        return 1;
+    }
+
+    std::string path_encoder;
+    if (!model_path) {
+        //if model_path is not set, attempt to find it in the same directory as ggml-<model>.bin model
+        path_encoder = whisper_openvino_get_path_encoder(ctx->path_model);
+    } else {
+        path_encoder = model_path;
+    }
+
+    std::string path_cache;
+    if (!cache_dir) {
+        //if cache_dir is not set, set it as a dir residing next to ggml-<model>.bin
+        //a model loaded through a whisper_model_loader has no path, it is not cached then
+        if (!ctx->path_model.empty()) {
+            path_cache = whisper_openvino_get_path_cache(ctx->path_model);
+        }
+    } else {
+        path_cache = cache_dir;
+    }
+
+    WHISPER_LOG_INFO("%s: loading OpenVINO model from '%s'\n", __func__, path_encoder.c_str());
+    WHISPER_LOG_INFO("%s: first run on a device may take a while ...\n", __func__);
+
+    if (state->ctx_openvino) {
+        whisper_openvino_free(state->ctx_openvino);
+    }
+
+    state->ctx_openvino = whisper_openvino_init(path_encoder.c_str(), device, path_cache.empty() ? nullptr : path_cache.c_str());
+    if (!state->ctx_openvino) {
+        WHISPER_LOG_ERROR("%s: failed to init OpenVINO encoder from '%s'\n", __func__, path_encoder.c_str());
+        return 1;
+    } else {
+        WHISPER_LOG_INFO("%s: OpenVINO model loaded\n", __func__);
+    }
+
+    return 0;
+#endif
+}
+
+int whisper_ctx_init_nnapi_encoder_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                    const char * model_path,
+                    const char * accelerator,
+                    const char * cache_dir) {
+#ifndef WHISPER_USE_NNAPI
+    (void)(ctx);
+    (void)(state);
+    (void)(model_path);
+    (void)(accelerator);
+    (void)(cache_dir);
+
+    return 1;
+#else
+    if (!state) {
+        WHISPER_LOG_ERROR("%s: state is nullptr\n", __func__);
+        return 1;
+    }
+
+    // the model encodes the whole window, the cross-attention cache of the state must hold it
+    if (state->n_audio_ctx_max < ctx->model.hparams.n_audio_ctx) {
+        WHISPER_LOG_ERROR("%s: the state is sized for an audio context of %d, the NNAPI encoder needs %d\n", __func__, state->n_audio_ctx_max, ctx->model.hparams.n_audio_ctx);
+        return 1;
+    }
+
+    if (!model_path && ctx->path_model.empty()) {
+        WHISPER_LOG_ERROR("%s: model_path is nullptr, and ctx has no model_path set.\n", __func__);
+        return 1;
+    }
+
+    //if model_path is not set, attempt to find it in the same directory as ggml-<model>.bin model
+    const std::string path_encoder = model_path ? model_path : whisper_nnapi_get_path_encoder(ctx->path_model);
+
+    WHISPER_LOG_INFO("%s: loading TensorFlow Lite model from '%s'\n", __func__, path_encoder.c_str());
+
+    if (state->ctx_nnapi) {
+        whisper_nnapi_free(state->ctx_nnapi);
+    }
+
+    state->ctx_nnapi = whisper_nnapi_init(path_encoder.c_str(), accelerator, cache_dir);
+    if (!state->ctx_nnapi) {
+        WHISPER_LOG_ERROR("%s: failed to init NNAPI encoder from '%s'\n", __func__, path_encoder.c_str());
+        return 1;
+    } else {
+        WHISPER_LOG_INFO("%s: NNAPI model loaded\n", __func__);
+    }
+
+    return 0;
+#endif
+}
+
+struct whisper_context_params whisper_context_default_params() {
+    struct whisper_context_params result = {
+        /*.use_gpu    =*/ true,
+        /*.gpu_device =*/ 0,
+        /*.kv_type    =*/ GGML_TYPE_F16,
+#ifdef WHISPER_USE_FLASH_ATTN
+        /*.flash_attn =*/ true,
+#else
+        /*.flash_attn =*/ false,
+#endif
+        /*.quantize_activations =*/ false,
+        /*.f16_activations      =*/ false,
+        /*.gpu_mel              =*/ false,
+        /*.dtw_token_timestamps =*/ false,
+        /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_AUTO,
+        /*.encoder_device       =*/ WHISPER_DEVICE_GPU,
+        /*.decoder_device       =*/ WHISPER_DEVICE_GPU,
+        /*.n_audio_ctx_max      =*/ 0,
+        /*.repack_weights       =*/ false,
+        /*.backend_init         =*/ nullptr,
+        /*.backend_init_user_data =*/ nullptr,
+        /*.read_at              =*/ nullptr,
+        /*.read_at_user_data    =*/ nullptr,
+        /*.n_load_threads       =*/ 0,
+        /*.lock_model_memory    =*/ false,
+        /*.use_huge_pages       =*/ false,
+        /*.mmap_path            =*/ nullptr,
+    };
+    return result;
+}
+
+struct whisper_context * whisper_init_from_file_with_params_no_state(const char * path_model, struct whisper_context_params params) {
+    WHISPER_LOG_INFO("%s: loading model from '%s'\n", __func__, path_model);
+
+    auto fin = std::ifstream(path_model, std::ios::binary);
+    if (!fin) {
+        WHISPER_LOG_ERROR("%s: failed to open '%s'\n", __func__, path_model);
+        return nullptr;
+    }
+
+    whisper_model_loader loader = {};
+
+    loader.context = &fin;
+
+    loader.read = [](void * ctx, void * output, size_t read_size) {
+        std::ifstream * fin = (std::ifstream*)ctx;
+        fin->read((char *)output, read_size);
+        return read_size;
+    };
+
+    loader.eof = [](void * ctx) {
+        std::ifstream * fin = (std::ifstream*)ctx;
+        return fin->eof();
+    };
+
+    loader.close = [](void * ctx) {
+        std::ifstream * fin = (std::ifstream*)ctx;
+        fin->close();
+    };
+
+    auto ctx = whisper_init_with_params_no_state(&loader, params);
+
+    if (ctx) {
+        ctx->path_model = path_model;
+    }
+
+    return ctx;
+}
+
+struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * buffer, size_t buffer_size, struct whisper_context_params params) {
+    struct buf_context {
+        uint8_t* buffer;
+        size_t size;
+        size_t current_offset;
+    };
+
+    buf_context ctx = { reinterpret_cast<uint8_t*>(buffer), buffer_size, 0 };
+
+    WHISPER_LOG_INFO("%s: loading model from buffer\n", __func__);
+
+    whisper_model_loader loader = {};
+
+    loader.context = &ctx;
+
+    loader.read = [](void * ctx, void * output, size_t read_size) {
+        buf_context * buf = reinterpret_cast<buf_context *>(ctx);
+
+        size_t size_to_copy = buf->current_offset + read_size < buf->size ? read_size : buf->size - buf->current_offset;
+
+        memcpy(output, buf->buffer + buf->current_offset, size_to_copy);
+        buf->current_offset += size_to_copy;
+
+        return size_to_copy;
+    };
+
+    loader.eof = [](void * ctx) {
+        buf_context * buf = reinterpret_cast<buf_context *>(ctx);
+
+        return buf->current_offset >= buf->size;
+    };
+
+    loader.close = [](void * /*ctx*/) { };
+
+    return whisper_init_with_params_no_state(&loader, params);
+}
+
+struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
+    ggml_time_init();
+
+    whisper_context * ctx = new whisper_context;
+    ctx->params = params;
+
+    if (!whisper_model_load(loader, *ctx)) {
+        loader->close(loader->context);
+        WHISPER_LOG_ERROR("%s: failed to load model\n", __func__);
+        delete ctx;
+        return nullptr;
+    }
+
+    loader->close(loader->context);
+
+    return ctx;
+}
+
+struct whisper_context * whisper_init_from_file_with_params(const char * path_model, struct whisper_context_params params) {
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(path_model, params);
+    if (!ctx) {
+        return nullptr;
+    }
+
+    ctx->state = whisper_init_state(ctx);
+    if (!ctx->state) {
+        whisper_free(ctx);
+        return nullptr;
+    }
+
+    return ctx;
+}
+
+struct whisper_context * whisper_init_from_buffer_with_params(void * buffer, size_t buffer_size, struct whisper_context_params params) {
+    whisper_context * ctx = whisper_init_from_buffer_with_params_no_state(buffer, buffer_size, params);
+    if (!ctx) {
+        return nullptr;
+    }
+
+    ctx->state = whisper_init_state(ctx);
+    if (!ctx->state) {
+        whisper_free(ctx);
+        return nullptr;
+    }
+
+    return ctx;
+}
+
+struct whisper_context * whisper_init_with_params(struct whisper_model_loader * loader, struct whisper_context_params params) {
+    whisper_context * ctx = whisper_init_with_params_no_state(loader, params);
+    if (!ctx) {
+        return nullptr;
+    }
+
+    ctx->state = whisper_init_state(ctx);
+    if (!ctx->state) {
+        whisper_free(ctx);
+        return nullptr;
+    }
+
+    return ctx;
+}
+
+struct whisper_context * whisper_init_from_file(const char * path_model) {
+    return whisper_init_from_file_with_params(path_model, whisper_context_default_params());
+}
+
+struct whisper_context * whisper_init_from_buffer(void * buffer, size_t buffer_size) {
+    return whisper_init_from_buffer_with_params(buffer, buffer_size, whisper_context_default_params());
+}
+
+struct whisper_context * whisper_init(struct whisper_model_loader * loader) {
+    return whisper_init_with_params(loader, whisper_context_default_params());
+}
+
+struct whisper_context * whisper_init_from_file_no_state(const char * path_model) {
+    return whisper_init_from_file_with_params_no_state(path_model, whisper_context_default_params());
+}
+
+struct whisper_context * whisper_init_from_buffer_no_state(void * buffer, size_t buffer_size) {
+    return whisper_init_from_buffer_with_params_no_state(buffer, buffer_size, whisper_context_default_params());
+}
+
+struct whisper_context * whisper_init_no_state(struct whisper_model_loader * loader) {
+    return whisper_init_with_params_no_state(loader, whisper_context_default_params());
+}
+
+void whisper_free_state(struct whisper_state * state)
+{
+    if (state) {
+        kv_cache_free(state->kv_self);
+        kv_cache_free(state->kv_cross);
+
+#ifdef WHISPER_USE_COREML
+        if (state->ctx_coreml != nullptr) {
+            whisper_coreml_free(state->ctx_coreml);
+            state->ctx_coreml = nullptr;
+        }
 #endif
-    } else {
-        WHISPER_LOG_INFO("%s: Core ML model loaded\n", __func__);
+
+#ifdef WHISPER_USE_OPENVINO
+        if (state->ctx_openvino != nullptr) {
+            whisper_openvino_free(state->ctx_openvino);
+            state->ctx_openvino = nullptr;
+        }
+#endif
+
+#ifdef WHISPER_USE_NNAPI
+        if (state->ctx_nnapi != nullptr) {
+            whisper_nnapi_free(state->ctx_nnapi);
+            state->ctx_nnapi = nullptr;
+        }
+#endif
+
+        whisper_batch_free(state->batch);
+
+        whisper_allocr_free(state->alloc_conv);
+        whisper_allocr_free(state->alloc_encode);
+        whisper_allocr_free(state->alloc_cross);
+        whisper_allocr_free(state->alloc_decode);
+        whisper_allocr_free(state->alloc_encode_batch);
+
+        ggml_backend_free(state->backend);
+        if (state->backend_cpu) {
+            ggml_backend_free(state->backend_cpu);
+        }
+        ggml_threadpool_free(state->threadpool_mel);
+
+        delete state;
+    }
+}
+
+void whisper_free(struct whisper_context * ctx) {
+    if (ctx) {
+        if (ctx->model.ctx) {
+            ggml_free(ctx->model.ctx);
+        }
+
+        if (ctx->model.buffer) {
+            whisper_model_unlock_memory(ctx->model);
+            ggml_backend_buffer_free(ctx->model.buffer);
+        }
+
+        whisper_model_unmap(ctx->model);
+
+        whisper_vocab_subset_free(ctx->vocab_subset);
+
+        whisper_free_state(ctx->state);
+
+        if (ctx->decode_group.buffer) {
+            ggml_backend_buffer_free(ctx->decode_group.buffer);
+        }
+        if (ctx->decode_group.backend) {
+            ggml_backend_free(ctx->decode_group.backend);
+        }
+
+        ggml_backend_free(ctx->backend);
+
+        delete ctx;
+    }
+}
+
+void whisper_free_context_params(struct whisper_context_params * params) {
+    if (params) {
+        delete params;
+    }
+}
+
+void whisper_free_params(struct whisper_full_params * params) {
+    if (params) {
+        delete params;
+    }
+}
+
+// average each pair of frames in place, the odd last frame stays as it is
+static void whisper_mel_speed_up(whisper_mel & mel) {
+    const int n_len = (mel.n_len + 1)/2;
+
+    for (int j = 0; j < mel.n_mel; j++) {
+        const float * src = mel.data.data() + (size_t) j*mel.n_len;
+              float * dst = mel.data.data() + (size_t) j*n_len;
+        for (int i = 0; i < n_len; i++) {
+            const int i0 = 2*i;
+            const int i1 = std::min(i0 + 1, mel.n_len - 1);
+            // dst never runs ahead of src, so the band is read before it is overwritten
+            dst[i] = 0.5f*(src[i0] + src[i1]);
+        }
+    }
+
+    mel.n_len     = n_len;
+    mel.n_len_org = (mel.n_len_org + 1)/2;
+    mel.data.resize((size_t) mel.n_mel*n_len);
+}
+
+void whisper_set_speed_up_with_state(struct whisper_state * state, bool speed_up) {
+    state->speed_up = speed_up;
+}
+
+int whisper_pcm_to_mel_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
+    state->mel_samples = nullptr;
+
+    if (whisper_mel_defer(*ctx, *state, samples, n_samples, n_threads)) {
+        state->mel_speed_up = false;
+        return 0;
+    }
+
+    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
+        WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
+        return -1;
+    }
+
+    state->mel_speed_up = state->speed_up;
+    if (state->speed_up) {
+        whisper_mel_speed_up(state->mel);
+    }
+
+    return 0;
+}
+
+int whisper_pcm_to_mel_cached_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int64_t sample_offset, int n_threads) {
+    state->mel_samples = nullptr;
+
+    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel, &state->mel_cache, sample_offset)) {
+        WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
+        return -1;
+    }
+
+    // the cache keeps the frames at full rate, the next call compresses the spliced spectrogram again
+    state->mel_speed_up = state->speed_up;
+    if (state->speed_up) {
+        whisper_mel_speed_up(state->mel);
+    }
+
+    state->mel_samples   = samples;
+    state->mel_n_samples = n_samples;
+
+    return 0;
+}
+
+const float * whisper_get_mel_cache_with_state(struct whisper_state * state, int * n_frames, int * n_mel, int64_t * offset) {
+    const whisper_mel_cache & cache = state->mel_cache;
+
+    *n_frames = cache.n_frames;
+    *n_mel    = cache.n_mel;
+    *offset   = cache.offset;
+
+    return cache.n_frames > 0 ? cache.data.data() : nullptr;
+}
+
+int whisper_get_mel_filters(struct whisper_context * ctx, float * center_hz, float * peak, int n_mel) {
+    const whisper_filters & filters = ctx->model.filters;
+
+    for (int j = 0; j < std::min(n_mel, (int) filters.n_mel); j++) {
+        const float * weights = filters.data.data() + (size_t) j * filters.n_fft;
+
+        int k_max = 0;
+        for (int k = 1; k < filters.n_fft; k++) {
+            if (weights[k] > weights[k_max]) {
+                k_max = k;
+            }
+        }
+
+        // the filters cover the bins of a WHISPER_N_FFT point transform, bin_0 to bin_nyquist
+        center_hz[j] = (float) k_max * WHISPER_SAMPLE_RATE / WHISPER_N_FFT;
+        peak[j]      = weights[k_max];
+    }
+
+    return filters.n_mel;
+}
+
+int whisper_pcm_to_mel(struct whisper_context * ctx, const float * samples, int n_samples, int n_threads) {
+    return whisper_pcm_to_mel_with_state(ctx, ctx->state, samples, n_samples, n_threads);
+}
+
+// same as whisper_pcm_to_mel, but applies a Phase Vocoder to speed up the audio x2 (PV without phase lock is not good)
+int whisper_pcm_to_mel_phase_vocoder_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
+    state->mel_samples = nullptr;
+
+    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, 2 * WHISPER_N_FFT, 2 * WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
+        WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
+        return -1;
     }
-#endif
 
-    state->logits.reserve(ctx->vocab.n_vocab * ctx->model.hparams.n_text_ctx);
+    return 0;
+}
 
-    state->batch = whisper_batch_init(ctx->model.hparams.n_text_ctx, WHISPER_MAX_DECODERS);
+// same as whisper_pcm_to_mel, but applies a Phase Vocoder to speed up the audio x2 (PV without phase lock is not good)
+int whisper_pcm_to_mel_phase_vocoder(struct whisper_context * ctx, const float * samples, int n_samples, int n_threads) {
+    return whisper_pcm_to_mel_phase_vocoder_with_state(ctx, ctx->state, samples, n_samples, n_threads);
+}
 
-    // TAGS: WHISPER_DECODER_INIT
-    state->decoders[0].sequence.tokens.reserve(ctx->model.hparams.n_text_ctx);
+// same as whisper_pcm_to_mel, but applies WSOLA to speed up the audio x2
+// TODO
 
-    state->decoders[0].probs.reserve    (ctx->vocab.n_vocab);
-    state->decoders[0].logits.reserve   (ctx->vocab.n_vocab);
-    state->decoders[0].logprobs.reserve (ctx->vocab.n_vocab);
-    state->decoders[0].logits_id.reserve(ctx->model.hparams.n_vocab);
+// same as whisper_pcm_to_mel, but applies HPTSM to speed up the audio x2
+// TODO
 
-    state->decoders[0].rng = std::mt19937(0);
+// same as whisper_pcm_to_mel, but applies PV (with phase lock) to speed up the audio x2
+// TODO
 
-    // conv allocator
-    {
-        whisper_allocr_graph_init(state->alloc_conv, ctx->backend,
-                [&]() {
-                    return whisper_build_graph_conv(*ctx, *state, 0);
-                });
+int whisper_set_mel_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                   const float * data,
+                           int   n_len,
+                           int   n_mel) {
+    if (n_mel != ctx->model.filters.n_mel) {
+        WHISPER_LOG_ERROR("%s: invalid number of mel bands: %d (expected %d)\n", __func__, n_mel, ctx->model.filters.n_mel);
+        return -1;
+    }
 
-        WHISPER_LOG_INFO("%s: compute buffer (conv)   = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_conv) / 1e6);
+    state->mel_samples = nullptr;
+    state->mel_pending.clear();
+
+    state->mel.n_len     = n_len;
+    state->mel.n_len_org = n_len;
+    state->mel.n_mel     = n_mel;
+
+    state->mel.data.resize(n_len*n_mel);
+    memcpy(state->mel.data.data(), data, n_len*n_mel*sizeof(float));
+
+    return 0;
+}
+
+int whisper_set_mel(
+        struct whisper_context * ctx,
+        const float * data,
+        int n_len,
+        int n_mel) {
+    return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
+}
+
+int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state * state, int offset, int n_threads) {
+    if (!whisper_encode_internal(*ctx, *state, offset, n_threads, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return -1;
     }
 
-    // encoder allocator
-    if (!whisper_encode_external(*state)) {
-        whisper_allocr_graph_init(state->alloc_encode, ctx->backend,
-                [&]() {
-                    return whisper_build_graph_encoder(*ctx, *state);
-                });
+    return 0;
+}
 
-        WHISPER_LOG_INFO("%s: compute buffer (encode) = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_encode) / 1e6);
+int whisper_encode(struct whisper_context * ctx, int offset, int n_threads) {
+    if (!whisper_encode_internal(*ctx, *ctx->state, offset, n_threads, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return -1;
     }
 
-    // cross allocator
-    {
-        whisper_allocr_graph_init(state->alloc_cross, ctx->backend,
-                [&]() {
-                    return whisper_build_graph_cross(*ctx, *state);
-                });
+    return 0;
+}
 
-        WHISPER_LOG_INFO("%s: compute buffer (cross)  = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_cross) / 1e6);
+int whisper_encode_batch_with_states(
+        struct whisper_context * ctx,
+         struct whisper_state ** states,
+                  const float ** samples,
+                     const int * n_samples,
+                           int   n_states,
+                           int   n_audio_ctx,
+                           int   n_threads) {
+    WHISPER_TRACE_ZONE("whisper_encode_batch");
+    if (n_states <= 0) {
+        return 0;
     }
 
-    // decoder allocator
-    {
-        whisper_allocr_graph_init(state->alloc_decode, ctx->backend,
-                [&]() {
-                    const auto & hparams = ctx->model.hparams;
+    const auto & hparams = ctx->model.hparams;
 
-                    // TODO: make sure this is the worst-case scenario
-                    const int n_tokens = hparams.n_text_ctx;
-                    const int n_past   = 0;
+    if (n_audio_ctx > hparams.n_audio_ctx) {
+        WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, n_audio_ctx, hparams.n_audio_ctx);
+        return -1;
+    }
 
-                    whisper_batch_prep_legacy(state->batch, nullptr, n_tokens, n_past, 0);
+    n_audio_ctx = whisper_clamp_audio_ctx(*states[0], n_audio_ctx);
 
-                    return whisper_build_graph_decoder(*ctx, *state, state->batch);
-                });
+    const int n_ctx = n_audio_ctx;
 
-        WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_allocr_size(state->alloc_decode) / 1e6);
+    // the batch buffers live in the first state
+    whisper_state & wstate = *states[0];
+
+    for (int i = 0; i < n_states; ++i) {
+        if (whisper_encode_external(*states[i])) {
+            WHISPER_LOG_ERROR("%s: batched encoding is not supported with an external encoder\n", __func__);
+            return -2;
+        }
     }
 
-    whisper_allocr_graph_realloc(state->alloc_conv,   ctx->backend);
-    whisper_allocr_graph_realloc(state->alloc_encode, ctx->backend);
-    whisper_allocr_graph_realloc(state->alloc_cross,  ctx->backend);
-    whisper_allocr_graph_realloc(state->alloc_decode, ctx->backend);
+    const int64_t t_start_us = ggml_time_us();
 
-    return state;
-}
+    // mel + conv, per state
+    for (int i = 0; i < n_states; ++i) {
+        whisper_state & state = *states[i];
 
-int whisper_ctx_init_openvino_encoder(
-        struct whisper_context * ctx,
-                    const char * model_path,
-                    const char * device,
-                    const char * cache_dir) {
-#ifndef WHISPER_USE_OPENVINO
-    (void)(ctx);
-    (void)(model_path);
-    (void)(device);
-    (void)(cache_dir);
+        state.pre_encoded_n_ctx = -1;
 
-    return 1;
-#else
-    if (!model_path && ctx->path_model.empty()) {
-        WHISPER_LOG_ERROR("%s: model_path is nullptr, and ctx has no model_path set.\n", __func__);
-        return 1;
-    }
+        const bool has_mel = state.mel_samples == samples[i] && state.mel_n_samples == n_samples[i];
+        state.mel_samples = nullptr;
 
-    std::string path_encoder;
-    if (!model_path) {
-        //if model_path is not set, attempt to find it in the same directory as ggml-<model>.bin model
-        path_encoder = whisper_openvino_get_path_encoder(ctx->path_model);
-    } else {
-        path_encoder = model_path;
-    }
+        if (!has_mel && whisper_pcm_to_mel_with_state(ctx, &state, samples[i], n_samples[i], n_threads) != 0) {
+            WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
+            return -3;
+        }
 
-    std::string path_cache;
-    if (!cache_dir) {
-        //if cache_dir is not set, set it as a dir residing next to ggml-<model>.bin
-        path_cache = whisper_openvino_get_path_cache(ctx->path_model);
-    } else {
-        path_cache = cache_dir;
-    }
+        state.exp_n_audio_ctx = n_audio_ctx;
 
-    WHISPER_LOG_INFO("%s: loading OpenVINO model from '%s'\n", __func__, path_encoder.c_str());
-    WHISPER_LOG_INFO("%s: first run on a device may take a while ...\n", __func__);
+        bool built = false;
 
-    ctx->state->ctx_openvino = whisper_openvino_init(path_encoder.c_str(), device, path_cache.c_str());
-    if (!ctx->state->ctx_openvino) {
-        WHISPER_LOG_ERROR("%s: failed to init OpenVINO encoder from '%s'\n", __func__, path_encoder.c_str());
-        return 1;
-    } else {
-        WHISPER_LOG_INFO("%s: OpenVINO model loaded\n", __func__);
+        ggml_cgraph * gf = whisper_allocr_graph_get(state.alloc_conv, { n_audio_ctx, 0, 0, 0 }, built,
+                [&]() { return whisper_build_graph_conv(*ctx, state, 0); });
+
+        whisper_set_input_mel(state, ggml_graph_get_tensor(gf, "mel"), 0);
+
+        if (!whisper_graph_compute(state, false, gf, n_threads)) {
+            return -4;
+        }
+
+        // the encoder and cross graphs of the state are not used below and embd_enc is cleared at the end
+        whisper_allocr_graph_drop(state.alloc_encode);
+        whisper_allocr_graph_drop(state.alloc_cross);
     }
 
-    return 0;
-#endif
-}
+    std::vector<struct ggml_tensor *> embd(n_states);
 
-struct whisper_context_params whisper_context_default_params() {
-    struct whisper_context_params result = {
-        /*.use_gpu    =*/ true,
-    };
-    return result;
-}
+    // encoder, all states in one graph
+    {
+        auto & allocr = wstate.alloc_encode_batch;
 
-struct whisper_context * whisper_init_from_file_with_params_no_state(const char * path_model, struct whisper_context_params params) {
-    WHISPER_LOG_INFO("%s: loading model from '%s'\n", __func__, path_model);
+        if (n_states > wstate.n_encode_batch_measured || n_ctx > wstate.n_encode_batch_ctx_measured) {
+            whisper_allocr_free(allocr);
 
-    auto fin = std::ifstream(path_model, std::ios::binary);
-    if (!fin) {
-        WHISPER_LOG_ERROR("%s: failed to open '%s'\n", __func__, path_model);
-        return nullptr;
+            const int n_batch_measure = std::max(n_states, wstate.n_encode_batch_measured);
+            const int n_ctx_measure   = std::max(n_ctx,    wstate.n_encode_batch_ctx_measured);
+
+            std::vector<struct ggml_tensor *> embd_measure(n_batch_measure);
+
+            whisper_allocr_graph_init(allocr, ctx->backend,
+                    [&]() {
+                        return whisper_build_graph_encoder_batch(*ctx, wstate, n_batch_measure, n_ctx_measure, embd_measure.data());
+                    });
+
+            whisper_allocr_graph_realloc(allocr, ctx->backend);
+
+            wstate.n_encode_batch_measured     = n_batch_measure;
+            wstate.n_encode_batch_ctx_measured = n_ctx_measure;
+
+            WHISPER_LOG_INFO("%s: compute buffer (encode batch of %d) = %7.2f MB\n", __func__, n_batch_measure, whisper_allocr_size(allocr) / 1e6);
+        }
+
+        bool built = false;
+
+        ggml_cgraph * gf = whisper_allocr_graph_get(allocr, { n_states, n_ctx, 0, 0 }, built,
+                [&]() { return whisper_build_graph_encoder_batch(*ctx, wstate, n_states, n_ctx, embd.data()); });
+
+        // the per state views of the output are the last nodes
+        for (int i = 0; i < n_states; ++i) {
+            embd[i] = gf->nodes[gf->n_nodes - n_states + i];
+        }
+
+        whisper_set_input_embd_batch(wstate, ggml_graph_get_tensor(gf, "inp_embd_batch"), states, n_states);
+
+        if (!whisper_graph_compute(wstate, false, gf, n_threads)) {
+            return -5;
+        }
     }
 
-    whisper_model_loader loader = {};
+    // cross-attention memory, per state
+    for (int i = 0; i < n_states; ++i) {
+        whisper_state & state = *states[i];
 
-    loader.context = &fin;
+        state.embd_enc = embd[i];
 
-    loader.read = [](void * ctx, void * output, size_t read_size) {
-        std::ifstream * fin = (std::ifstream*)ctx;
-        fin->read((char *)output, read_size);
-        return read_size;
-    };
+        // views the output of the batched encoder, so it was dropped above and is always built
+        // the key keeps whisper_encode_internal() from taking it for the one viewing the state's own encoder
+        bool built = false;
 
-    loader.eof = [](void * ctx) {
-        std::ifstream * fin = (std::ifstream*)ctx;
-        return fin->eof();
-    };
+        ggml_cgraph * gf = whisper_allocr_graph_get(state.alloc_cross, { n_ctx, false, n_states, i }, built,
+                [&]() { return whisper_build_graph_cross(*ctx, state, false); });
 
-    loader.close = [](void * ctx) {
-        std::ifstream * fin = (std::ifstream*)ctx;
-        fin->close();
-    };
+        if (!whisper_graph_compute(state, false, gf, n_threads)) {
+            return -6;
+        }
 
-    auto ctx = whisper_init_with_params_no_state(&loader, params);
+        state.embd_enc = nullptr;
 
-    if (ctx) {
-        ctx->path_model = path_model;
+        state.pre_encoded_samples   = samples[i];
+        state.pre_encoded_n_samples = n_samples[i];
+        state.pre_encoded_n_ctx     = n_ctx;
+        state.cross_mel_offset      = 0;
+
+        state.n_encode++;
     }
 
-    return ctx;
-}
+    const int64_t t_encode_us = (ggml_time_us() - t_start_us)/n_states;
 
-struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * buffer, size_t buffer_size, struct whisper_context_params params) {
-    struct buf_context {
-        uint8_t* buffer;
-        size_t size;
-        size_t current_offset;
-    };
+    for (int i = 0; i < n_states; ++i) {
+        states[i]->t_encode_us += t_encode_us;
+    }
 
-    buf_context ctx = { reinterpret_cast<uint8_t*>(buffer), buffer_size, 0 };
+    return 0;
+}
 
-    WHISPER_LOG_INFO("%s: loading model from buffer\n", __func__);
+int whisper_encode_chunked_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                   const float * samples,
+                           int   n_samples,
+                           int   n_audio_ctx,
+                           int   n_chunk_ctx,
+                           int   n_overlap_ctx,
+                           int   n_threads) {
+    WHISPER_TRACE_ZONE("whisper_encode_chunked");
+    const auto & hparams = ctx->model.hparams;
+
+    if (n_audio_ctx > hparams.n_audio_ctx) {
+        WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, n_audio_ctx, hparams.n_audio_ctx);
+        return -1;
+    }
 
-    whisper_model_loader loader = {};
+    n_audio_ctx = whisper_clamp_audio_ctx(*state, n_audio_ctx);
 
-    loader.context = &ctx;
+    if (n_chunk_ctx <= 0 || n_overlap_ctx < 0) {
+        WHISPER_LOG_ERROR("%s: invalid chunk size %d or overlap %d\n", __func__, n_chunk_ctx, n_overlap_ctx);
+        return -1;
+    }
 
-    loader.read = [](void * ctx, void * output, size_t read_size) {
-        buf_context * buf = reinterpret_cast<buf_context *>(ctx);
+    if (whisper_encode_external(*state)) {
+        WHISPER_LOG_ERROR("%s: chunked encoding is not supported with an external encoder\n", __func__);
+        return -2;
+    }
 
-        size_t size_to_copy = buf->current_offset + read_size < buf->size ? read_size : buf->size - buf->current_offset;
+    const int n_ctx = n_audio_ctx;
 
-        memcpy(output, buf->buffer + buf->current_offset, size_to_copy);
-        buf->current_offset += size_to_copy;
+    state->pre_encoded_n_ctx = -1;
 
-        return size_to_copy;
-    };
+    const bool has_mel = state->mel_samples == samples && state->mel_n_samples == n_samples;
+    state->mel_samples = nullptr;
 
-    loader.eof = [](void * ctx) {
-        buf_context * buf = reinterpret_cast<buf_context *>(ctx);
+    if (!has_mel && whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, n_threads) != 0) {
+        WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
+        return -3;
+    }
 
-        return buf->current_offset >= buf->size;
-    };
+    if (!whisper_encode_chunked_internal(*ctx, *state, n_ctx, std::min(n_chunk_ctx, n_ctx), n_overlap_ctx, n_threads)) {
+        WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+        return -4;
+    }
 
-    loader.close = [](void * /*ctx*/) { };
+    state->pre_encoded_samples   = samples;
+    state->pre_encoded_n_samples = n_samples;
+    state->pre_encoded_n_ctx     = n_ctx;
 
-    return whisper_init_with_params_no_state(&loader, params);
+    return 0;
 }
 
-struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
-    ggml_time_init();
+int whisper_encode_samples_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                   const float * samples,
+                           int   n_samples,
+                           int   n_audio_ctx,
+                           int   n_threads) {
+    WHISPER_TRACE_ZONE("whisper_encode_samples");
+    const auto & hparams = ctx->model.hparams;
+
+    if (n_audio_ctx > hparams.n_audio_ctx) {
+        WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, n_audio_ctx, hparams.n_audio_ctx);
+        return -1;
+    }
+
+    n_audio_ctx = whisper_clamp_audio_ctx(*state, n_audio_ctx);
+
+    state->pre_encoded_n_ctx = -1;
+
+    const bool has_mel = state->mel_samples == samples && state->mel_n_samples == n_samples;
+    state->mel_samples = nullptr;
 
-    whisper_context * ctx = new whisper_context;
-    ctx->params = params;
+    if (!has_mel && whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, n_threads) != 0) {
+        WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
+        return -2;
+    }
 
-    if (!whisper_model_load(loader, *ctx)) {
-        loader->close(loader->context);
-        WHISPER_LOG_ERROR("%s: failed to load model\n", __func__);
-        delete ctx;
-        return nullptr;
+    state->exp_n_audio_ctx = n_audio_ctx;
+
+    if (!whisper_encode_internal(*ctx, *state, 0, n_threads, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+        return -3;
     }
 
-    loader->close(loader->context);
+    state->pre_encoded_samples   = samples;
+    state->pre_encoded_n_samples = n_samples;
+    state->pre_encoded_n_ctx     = n_audio_ctx;
 
-    return ctx;
+    return 0;
 }
 
-struct whisper_context * whisper_init_from_file_with_params(const char * path_model, struct whisper_context_params params) {
-    whisper_context * ctx = whisper_init_from_file_with_params_no_state(path_model, params);
-    if (!ctx) {
-        return nullptr;
+int whisper_reuse_encoding_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                   const float * samples,
+                           int   n_samples,
+                           int   n_threads) {
+    if (state->mel.n_len_org <= 0 || state->cross_mel_offset < 0) {
+        WHISPER_LOG_ERROR("%s: nothing was encoded\n", __func__);
+        return -1;
     }
 
-    ctx->state = whisper_init_state(ctx);
-    if (!ctx->state) {
-        whisper_free(ctx);
-        return nullptr;
+    if (state->cross_mel_offset != 0 && !whisper_encode_internal(*ctx, *state, 0, n_threads, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+        return -2;
     }
 
-    return ctx;
+    state->pre_encoded_samples   = samples;
+    state->pre_encoded_n_samples = n_samples;
+    state->pre_encoded_n_ctx     = state->exp_n_audio_ctx > 0 ? state->exp_n_audio_ctx : state->n_audio_ctx_max;
+
+    return 0;
 }
 
-struct whisper_context * whisper_init_from_buffer_with_params(void * buffer, size_t buffer_size, struct whisper_context_params params) {
-    whisper_context * ctx = whisper_init_from_buffer_with_params_no_state(buffer, buffer_size, params);
-    if (!ctx) {
-        return nullptr;
+int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state * state, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
+    whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
+
+    whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+
+    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return 1;
     }
 
-    ctx->state = whisper_init_state(ctx);
-    if (!ctx->state) {
-        whisper_free(ctx);
-        return nullptr;
+    return 0;
+}
+
+int whisper_decode(struct whisper_context * ctx, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
+    if (ctx->state == nullptr) {
+        WHISPER_LOG_ERROR("%s: ERROR state was not loaded.\n", __func__);
+        return -1;
     }
 
-    return ctx;
+    return whisper_decode_with_state(ctx, ctx->state, tokens, n_tokens, n_past, n_threads);
 }
 
-struct whisper_context * whisper_init_with_params(struct whisper_model_loader * loader, struct whisper_context_params params) {
-    whisper_context * ctx = whisper_init_with_params_no_state(loader, params);
-    if (!ctx) {
-        return nullptr;
+int whisper_score_sequences_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                           int   n_audio_ctx,
+                           int   lang_id,
+    const whisper_token * const * sequences,
+                     const int * n_tokens,
+                           int   n_sequences,
+                          bool   add_eot,
+                         float * log_probs,
+                           int   n_threads) {
+    WHISPER_TRACE_ZONE("whisper_score_sequences");
+    const auto & hparams = ctx->model.hparams;
+
+    if (n_sequences <= 0) {
+        WHISPER_LOG_ERROR("%s: no sequences to score\n", __func__);
+        return -1;
     }
 
-    ctx->state = whisper_init_state(ctx);
-    if (!ctx->state) {
-        whisper_free(ctx);
-        return nullptr;
+    if (n_audio_ctx > hparams.n_audio_ctx) {
+        WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, n_audio_ctx, hparams.n_audio_ctx);
+        return -1;
     }
 
-    return ctx;
-}
+    n_audio_ctx = whisper_clamp_audio_ctx(*state, n_audio_ctx);
 
-struct whisper_context * whisper_init_from_file(const char * path_model) {
-    return whisper_init_from_file_with_params(path_model, whisper_context_default_params());
-}
+    if (state->mel.n_len_org <= 0) {
+        WHISPER_LOG_ERROR("%s: no mel spectrogram, call whisper_pcm_to_mel_with_state() first\n", __func__);
+        return -2;
+    }
 
-struct whisper_context * whisper_init_from_buffer(void * buffer, size_t buffer_size) {
-    return whisper_init_from_buffer_with_params(buffer, buffer_size, whisper_context_default_params());
-}
+    // the encoder output is replaced, a following whisper_full_with_state() must not reuse a pre-encoded window
+    state->pre_encoded_n_ctx = -1;
+    state->exp_n_audio_ctx   = n_audio_ctx;
 
-struct whisper_context * whisper_init(struct whisper_model_loader * loader) {
-    return whisper_init_with_params(loader, whisper_context_default_params());
-}
+    if (!whisper_encode_internal(*ctx, *state, 0, n_threads, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+        return -3;
+    }
 
-struct whisper_context * whisper_init_from_file_no_state(const char * path_model) {
-    return whisper_init_from_file_with_params_no_state(path_model, whisper_context_default_params());
-}
+    const bool multilingual = whisper_is_multilingual(ctx);
 
-struct whisper_context * whisper_init_from_buffer_no_state(void * buffer, size_t buffer_size) {
-    return whisper_init_from_buffer_with_params_no_state(buffer, buffer_size, whisper_context_default_params());
-}
+    whisper_kv_cache_clear(state->kv_self);
 
-struct whisper_context * whisper_init_no_state(struct whisper_model_loader * loader) {
-    return whisper_init_with_params_no_state(loader, whisper_context_default_params());
-}
+    if (!multilingual) {
+        lang_id = whisper_lang_id("en");
+    } else if (lang_id < 0) {
+        // same as whisper_lang_auto_detect_with_state(), on the encoder output computed above
+        const whisper_token token_sot = whisper_token_sot(ctx);
+        whisper_batch_prep_legacy(state->batch, &token_sot, 1, 0, 0);
 
-void whisper_free_state(struct whisper_state * state)
-{
-    if (state) {
-        kv_cache_free(state->kv_self);
-        kv_cache_free(state->kv_cross);
+        if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, nullptr, nullptr)) {
+            WHISPER_LOG_ERROR("%s: failed to decode the language\n", __func__);
+            return -4;
+        }
 
-#ifdef WHISPER_USE_COREML
-        if (state->ctx_coreml != nullptr) {
-            whisper_coreml_free(state->ctx_coreml);
-            state->ctx_coreml = nullptr;
+        float best = -INFINITY;
+        for (const auto & kv : g_lang) {
+            const float logit = state->logits[whisper_token_lang(ctx, kv.second.first)];
+            if (logit > best) {
+                best    = logit;
+                lang_id = kv.second.first;
+            }
         }
-#endif
 
-#ifdef WHISPER_USE_OPENVINO
-        if (state->ctx_openvino != nullptr) {
-            whisper_openvino_free(state->ctx_openvino);
-            state->ctx_openvino = nullptr;
+        whisper_kv_cache_clear(state->kv_self);
+    }
+
+    state->lang_id = lang_id;
+
+    std::vector<whisper_token> prompt = { whisper_token_sot(ctx) };
+    if (multilingual) {
+        prompt.push_back(whisper_token_lang(ctx, lang_id));
+        prompt.push_back(whisper_token_transcribe(ctx));
+    }
+    prompt.push_back(whisper_token_not(ctx));
+
+    // the sequences as a token tree, the tokens of a shared prefix are decoded once
+    // a node is decoded after its parent, so ancestors always come first in the node order
+    struct tree_node {
+        whisper_token token;
+        int parent;                      // -1 for the children of the prompt
+        int depth;
+        std::vector<whisper_seq_id> seq; // sequences passing through the node
+    };
+
+    std::vector<tree_node> nodes;
+    std::vector<int> seq_end(n_sequences, -1); // node of the last token of every sequence, -1 when it is empty
+    {
+        std::map<std::pair<int, whisper_token>, int> children;
+        for (int i = 0; i < n_sequences; ++i) {
+            int cur = -1;
+            for (int j = 0; j < n_tokens[i]; ++j) {
+                const auto key = std::make_pair(cur, sequences[i][j]);
+                auto it = children.find(key);
+                if (it == children.end()) {
+                    it = children.emplace(key, (int) nodes.size()).first;
+                    nodes.push_back({ sequences[i][j], cur, cur < 0 ? 0 : nodes[cur].depth + 1, {} });
+                }
+                cur = it->second;
+                nodes[cur].seq.push_back(i);
+            }
+            seq_end[i] = cur;
         }
-#endif
+    }
 
-        whisper_batch_free(state->batch);
+    const int n_prompt = prompt.size();
+    const int n_total  = n_prompt + nodes.size();
 
-        whisper_allocr_free(state->alloc_conv);
-        whisper_allocr_free(state->alloc_encode);
-        whisper_allocr_free(state->alloc_cross);
-        whisper_allocr_free(state->alloc_decode);
+    if (n_total > (int) state->kv_self.size) {
+        WHISPER_LOG_ERROR("%s: %d tokens in the sequence tree do not fit in the kv cache of %d\n", __func__, n_total, state->kv_self.size);
+        return -5;
+    }
 
-        ggml_backend_free(state->backend);
+    // the decoder graph was measured for n_text_ctx tokens with the logits of every token
+    const int n_batch = std::min(n_total, hparams.n_text_ctx);
 
-        delete state;
+    // every token carries the sequences it is a prefix of, its kv cell is then visible to the tokens of
+    // exactly those sequences. The mask only checks seq_id[0] of a token, which is one of its own
+    // sequences, so a token attends to the prompt and to its ancestors but not to the other branches
+    whisper_batch batch = whisper_batch_init(n_batch, n_sequences);
+
+    // log probability of every node given its parent, and of eot after every node, prompt first
+    std::vector<float> logprob_token(nodes.size(), 0.0f);
+    std::vector<float> logprob_eot(n_total, -INFINITY);
+
+    const int n_vocab = hparams.n_vocab;
+    const whisper_token token_eot = whisper_token_eot(ctx);
+
+    // children of every token of the batch, by their position in the prompt + nodes order
+    std::vector<std::vector<int>> children_of(n_total);
+    for (int k = 0; k < (int) nodes.size(); ++k) {
+        children_of[nodes[k].parent < 0 ? n_prompt - 1 : n_prompt + nodes[k].parent].push_back(k);
     }
-}
 
-void whisper_free(struct whisper_context * ctx) {
-    if (ctx) {
-        if (ctx->model.ctx) {
-            ggml_free(ctx->model.ctx);
+    int ret = 0;
+
+    for (int i0 = 0; i0 < n_total && ret == 0; i0 += n_batch) {
+        const int i1 = std::min(i0 + n_batch, n_total);
+
+        batch.n_tokens = i1 - i0;
+        for (int i = i0; i < i1; ++i) {
+            const int b = i - i0;
+            if (i < n_prompt) {
+                batch.token[b]    = prompt[i];
+                batch.pos[b]      = i;
+                batch.n_seq_id[b] = n_sequences;
+                for (int j = 0; j < n_sequences; ++j) {
+                    batch.seq_id[b][j] = j;
+                }
+            } else {
+                const auto & node = nodes[i - n_prompt];
+                batch.token[b]    = node.token;
+                batch.pos[b]      = n_prompt + node.depth;
+                batch.n_seq_id[b] = node.seq.size();
+                for (int j = 0; j < (int) node.seq.size(); ++j) {
+                    batch.seq_id[b][j] = node.seq[j];
+                }
+            }
+            batch.logits[b] = i >= n_prompt - 1;
         }
 
-        if (ctx->model.buffer) {
-            ggml_backend_buffer_free(ctx->model.buffer);
+        if (!whisper_decode_internal(*ctx, *state, batch, n_threads, nullptr, nullptr)) {
+            WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+            ret = -6;
+            break;
         }
 
-        whisper_free_state(ctx->state);
+        for (int i = std::max(i0, n_prompt - 1); i < i1; ++i) {
+            const float * logits = state->logits.data() + (size_t) (i - i0)*n_vocab;
 
-        ggml_backend_free(ctx->backend);
+            float max = -INFINITY;
+            for (int t = 0; t < n_vocab; ++t) {
+                max = std::max(max, logits[t]);
+            }
+            double sum = 0.0;
+            for (int t = 0; t < n_vocab; ++t) {
+                sum += expf(logits[t] - max);
+            }
+            const float log_norm = max + logf(sum);
 
-        delete ctx;
+            for (int k : children_of[i]) {
+                logprob_token[k] = logits[nodes[k].token] - log_norm;
+            }
+            logprob_eot[i] = logits[token_eot] - log_norm;
+        }
     }
-}
 
-void whisper_free_context_params(struct whisper_context_params * params) {
-    if (params) {
-        delete params;
+    whisper_batch_free(batch);
+
+    // the cells hold up to n_sequences ids each, do not leave them to the next decoding
+    whisper_kv_cache_clear(state->kv_self);
+
+    if (ret != 0) {
+        return ret;
     }
-}
 
-void whisper_free_params(struct whisper_full_params * params) {
-    if (params) {
-        delete params;
+    // the parents come first, so the sums of their paths are already there
+    std::vector<float> logprob_path(nodes.size());
+    for (int k = 0; k < (int) nodes.size(); ++k) {
+        logprob_path[k] = logprob_token[k] + (nodes[k].parent < 0 ? 0.0f : logprob_path[nodes[k].parent]);
     }
-}
 
-int whisper_pcm_to_mel_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
-    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
-        WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
-        return -1;
+    for (int i = 0; i < n_sequences; ++i) {
+        const int end = seq_end[i];
+        log_probs[i] = end < 0 ? 0.0f : logprob_path[end];
+        if (add_eot) {
+            log_probs[i] += end < 0 ? logprob_eot[n_prompt - 1] : logprob_eot[n_prompt + end];
+        }
     }
 
     return 0;
 }
 
-int whisper_pcm_to_mel(struct whisper_context * ctx, const float * samples, int n_samples, int n_threads) {
-    return whisper_pcm_to_mel_with_state(ctx, ctx->state, samples, n_samples, n_threads);
+// median of the width values around every element of a row, reflected at the ends
+static void whisper_median_filter(float * row, int n, int width, std::vector<float> & tmp) {
+    const int half = width/2;
+    if (n <= half) {
+        return;
+    }
+
+    tmp.assign(row, row + n);
+
+    std::vector<float> window(width);
+    for (int i = 0; i < n; ++i) {
+        for (int k = -half; k <= half; ++k) {
+            int j = i + k;
+            j = j < 0 ? -j : j;
+            j = j >= n ? 2*(n - 1) - j : j;
+            window[k + half] = tmp[j];
+        }
+        std::nth_element(window.begin(), window.begin() + half, window.end());
+        row[i] = window[half];
+    }
 }
 
-// same as whisper_pcm_to_mel, but applies a Phase Vocoder to speed up the audio x2 (PV without phase lock is not good)
-int whisper_pcm_to_mel_phase_vocoder_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
-    if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, 2 * WHISPER_N_FFT, 2 * WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
-        WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
-        return -1;
+// the cheapest monotonic path through the [n_rows, n_cols] cost matrix x, as the column where each row is entered
+// ref: https://github.com/openai/whisper/blob/main/whisper/timing.py, dtw_cpu()
+static std::vector<int> whisper_dtw_row_starts(const std::vector<float> & x, int n_rows, int n_cols) {
+    const int n_stride = n_cols + 1;
+
+    std::vector<float> cost((size_t) (n_rows + 1)*n_stride, INFINITY);
+    std::vector<uint8_t> trace((size_t) (n_rows + 1)*n_stride, 2);
+    cost[0] = 0.0f;
+
+    for (int j = 1; j <= n_cols; ++j) {
+        for (int i = 1; i <= n_rows; ++i) {
+            const float c0 = cost[(size_t) (i - 1)*n_stride + j - 1];
+            const float c1 = cost[(size_t) (i - 1)*n_stride + j];
+            const float c2 = cost[(size_t) i*n_stride + j - 1];
+
+            float c;
+            uint8_t t;
+            if (c0 < c1 && c0 < c2) {
+                c = c0; t = 0;
+            } else if (c1 < c0 && c1 < c2) {
+                c = c1; t = 1;
+            } else {
+                c = c2; t = 2;
+            }
+
+            cost [(size_t) i*n_stride + j] = x[(size_t) (i - 1)*n_cols + j - 1] + c;
+            trace[(size_t) i*n_stride + j] = t;
+        }
     }
 
-    return 0;
-}
+    for (int i = 1; i <= n_rows; ++i) {
+        trace[(size_t) i*n_stride] = 1;
+    }
 
-// same as whisper_pcm_to_mel, but applies a Phase Vocoder to speed up the audio x2 (PV without phase lock is not good)
-int whisper_pcm_to_mel_phase_vocoder(struct whisper_context * ctx, const float * samples, int n_samples, int n_threads) {
-    return whisper_pcm_to_mel_phase_vocoder_with_state(ctx, ctx->state, samples, n_samples, n_threads);
-}
+    // walked back from the end, the last column a row is seen in while going back is where the path enters it
+    std::vector<int> row_starts(n_rows, 0);
 
-// same as whisper_pcm_to_mel, but applies WSOLA to speed up the audio x2
-// TODO
+    int i = n_rows;
+    int j = n_cols;
+    while (i > 0 || j > 0) {
+        if (i > 0) {
+            row_starts[i - 1] = std::max(0, j - 1);
+        }
 
-// same as whisper_pcm_to_mel, but applies HPTSM to speed up the audio x2
-// TODO
+        switch (trace[(size_t) i*n_stride + j]) {
+            case 0:  --i; --j; break;
+            case 1:  --i;      break;
+            default:      --j; break;
+        }
+    }
 
-// same as whisper_pcm_to_mel, but applies PV (with phase lock) to speed up the audio x2
-// TODO
+    return row_starts;
+}
 
-int whisper_set_mel_with_state(
+int whisper_full_align_tokens_dtw_with_state(
         struct whisper_context * ctx,
           struct whisper_state * state,
-                   const float * data,
-                           int   n_len,
-                           int   n_mel) {
-    if (n_mel != ctx->model.filters.n_mel) {
-        WHISPER_LOG_ERROR("%s: invalid number of mel bands: %d (expected %d)\n", __func__, n_mel, ctx->model.filters.n_mel);
+           const whisper_token * tokens,
+                           int   n_tokens,
+                           int   n_samples,
+                       int64_t * t0,
+                       int64_t * t1,
+                           int   n_threads) {
+    WHISPER_TRACE_ZONE("whisper_align_tokens_dtw");
+    const auto & hparams = ctx->model.hparams;
+
+    if (state->aheads.empty()) {
+        WHISPER_LOG_ERROR("%s: the state was not created with dtw_token_timestamps\n", __func__);
         return -1;
     }
 
-    state->mel.n_len     = n_len;
-    state->mel.n_len_org = n_len;
-    state->mel.n_mel     = n_mel;
+    if (n_tokens <= 0) {
+        return 0;
+    }
 
-    state->mel.data.resize(n_len*n_mel);
-    memcpy(state->mel.data.data(), data, n_len*n_mel*sizeof(float));
+    const bool multilingual = whisper_is_multilingual(ctx);
 
-    return 0;
-}
+    std::vector<whisper_token> seq = { whisper_token_sot(ctx) };
+    if (multilingual) {
+        seq.push_back(whisper_token_lang(ctx, state->lang_id >= 0 ? state->lang_id : whisper_lang_id("en")));
+        seq.push_back(whisper_token_transcribe(ctx));
+    }
+    seq.push_back(whisper_token_not(ctx));
 
-int whisper_set_mel(
-        struct whisper_context * ctx,
-        const float * data,
-        int n_len,
-        int n_mel) {
-    return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
-}
+    const int n_prompt = seq.size();
 
-int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state * state, int offset, int n_threads) {
-    if (!whisper_encode_internal(*ctx, *state, offset, n_threads, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
-        return -1;
+    seq.insert(seq.end(), tokens, tokens + n_tokens);
+    seq.push_back(whisper_token_eot(ctx));
+
+    if ((int) seq.size() > hparams.n_text_ctx) {
+        WHISPER_LOG_ERROR("%s: %d tokens do not fit in the text context of %d\n", __func__, (int) seq.size(), hparams.n_text_ctx);
+        return -2;
     }
 
-    return 0;
-}
+    // an audio position is 2 mel frames, i.e. 20 ms, or 40 ms of a time compressed mel
+    const int time_scale  = state->mel_speed_up ? 2 : 1;
+    const int n_audio_ctx = state->exp_n_audio_ctx > 0 ? state->exp_n_audio_ctx : state->n_audio_ctx_max;
+    const int n_cols      = std::max(1, std::min(n_audio_ctx, (int) ((int64_t) n_samples*50/(WHISPER_SAMPLE_RATE*time_scale))));
 
-int whisper_encode(struct whisper_context * ctx, int offset, int n_threads) {
-    if (!whisper_encode_internal(*ctx, *ctx->state, offset, n_threads, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
-        return -1;
+    // whisper_full moves on to a later window when the first one did not end on the last segment
+    if (state->cross_mel_offset != 0) {
+        if (state->mel.n_len_org <= 0) {
+            WHISPER_LOG_ERROR("%s: nothing was encoded\n", __func__);
+            return -3;
+        }
+
+        state->pre_encoded_n_ctx = -1;
+
+        if (!whisper_encode_internal(*ctx, *state, 0, n_threads, nullptr, nullptr)) {
+            WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+            return -3;
+        }
+    }
+
+    whisper_kv_cache_clear(state->kv_self);
+    whisper_batch_prep_legacy(state->batch, seq.data(), seq.size(), 0, 0);
+
+    state->aheads_capture = true;
+    const bool ok = whisper_decode_internal(*ctx, *state, state->batch, n_threads, nullptr, nullptr);
+    state->aheads_capture = false;
+
+    if (!ok) {
+        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+        return -4;
     }
 
-    return 0;
-}
+    // the attention of the token before each text token, and of the last one before eot, is what it was predicted from
+    const int n_rows = n_tokens + 1;
+    const int n_aheads = state->aheads_cross_QKs.size();
 
-int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state * state, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
-    whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
+    std::vector<float> weights((size_t) n_rows*n_audio_ctx);
+    std::vector<float> matrix((size_t) n_rows*n_cols, 0.0f);
+    std::vector<float> tmp;
 
-    whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+    for (const auto * QK : state->aheads_cross_QKs) {
+        ggml_backend_tensor_get(QK, weights.data(), (size_t) (n_prompt - 1)*n_audio_ctx*sizeof(float), weights.size()*sizeof(float));
 
-    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
-        return 1;
+        // the softmax over the frames of the audio only
+        for (int r = 0; r < n_rows; ++r) {
+            float * row = weights.data() + (size_t) r*n_audio_ctx;
+            double sum = 0.0;
+            for (int c = 0; c < n_cols; ++c) {
+                sum += row[c];
+            }
+            const float scale = sum > 0.0 ? 1.0/sum : 0.0f;
+            for (int c = 0; c < n_cols; ++c) {
+                row[c] *= scale;
+            }
+        }
+
+        // standardized over the tokens, per frame
+        for (int c = 0; c < n_cols; ++c) {
+            double mean = 0.0;
+            for (int r = 0; r < n_rows; ++r) {
+                mean += weights[(size_t) r*n_audio_ctx + c];
+            }
+            mean /= n_rows;
+
+            double var = 0.0;
+            for (int r = 0; r < n_rows; ++r) {
+                const double d = weights[(size_t) r*n_audio_ctx + c] - mean;
+                var += d*d;
+            }
+            const double std = std::sqrt(var/n_rows) + 1e-9;
+
+            for (int r = 0; r < n_rows; ++r) {
+                float & w = weights[(size_t) r*n_audio_ctx + c];
+                w = (w - mean)/std;
+            }
+        }
+
+        for (int r = 0; r < n_rows; ++r) {
+            float * row = weights.data() + (size_t) r*n_audio_ctx;
+            whisper_median_filter(row, n_cols, 7, tmp);
+            for (int c = 0; c < n_cols; ++c) {
+                matrix[(size_t) r*n_cols + c] -= row[c]/n_aheads;
+            }
+        }
     }
 
-    return 0;
-}
+    const std::vector<int> row_starts = whisper_dtw_row_starts(matrix, n_rows, n_cols);
 
-int whisper_decode(struct whisper_context * ctx, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
-    if (ctx->state == nullptr) {
-        WHISPER_LOG_ERROR("%s: ERROR state was not loaded.\n", __func__);
-        return -1;
+    for (int i = 0; i < n_tokens; ++i) {
+        t0[i] = 2*time_scale*row_starts[i];
+        t1[i] = 2*time_scale*row_starts[i + 1];
     }
 
-    return whisper_decode_with_state(ctx, ctx->state, tokens, n_tokens, n_past, n_threads);
+    return 0;
 }
 
 int whisper_tokenize(struct whisper_context * ctx, const char * text, whisper_token * tokens, int n_max_tokens) {
@@ -3572,8 +7257,26 @@ int whisper_lang_auto_detect_with_state(
                            int   offset_ms,
                            int   n_threads,
                          float * lang_probs) {
+    return whisper_lang_auto_detect_subset_with_state(ctx, state, offset_ms, n_threads, nullptr, 0, lang_probs);
+}
+
+int whisper_lang_auto_detect_subset_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                           int   offset_ms,
+                           int   n_threads,
+                     const int * lang_ids,
+                           int   n_lang_ids,
+                         float * lang_probs) {
     const int seek = offset_ms/10;
 
+    for (int i = 0; i < n_lang_ids; ++i) {
+        if (lang_ids[i] < 0 || lang_ids[i] > whisper_lang_max_id()) {
+            WHISPER_LOG_ERROR("%s: unknown language id %d\n", __func__, lang_ids[i]);
+            return -3;
+        }
+    }
+
     if (seek < 0) {
         WHISPER_LOG_ERROR("%s: offset %dms is before the start of the audio\n", __func__, offset_ms);
         return -1;
@@ -3600,9 +7303,15 @@ int whisper_lang_auto_detect_with_state(
     auto & logits_id = state->decoders[0].logits_id;
     logits_id.clear();
 
-    for (const auto & kv : g_lang) {
-        const auto token_lang = whisper_token_lang(ctx, kv.second.first);
-        logits_id.emplace_back(state->logits[token_lang], kv.second.first);
+    if (lang_ids && n_lang_ids > 0) {
+        for (int i = 0; i < n_lang_ids; ++i) {
+            logits_id.emplace_back(state->logits[whisper_token_lang(ctx, lang_ids[i])], lang_ids[i]);
+        }
+    } else {
+        for (const auto & kv : g_lang) {
+            const auto token_lang = whisper_token_lang(ctx, kv.second.first);
+            logits_id.emplace_back(state->logits[token_lang], kv.second.first);
+        }
     }
 
     // sort descending
@@ -3629,6 +7338,11 @@ int whisper_lang_auto_detect_with_state(
     }
 
     {
+        // the languages left out of the subset are not candidates
+        if (lang_probs && lang_ids && n_lang_ids > 0) {
+            std::fill(lang_probs, lang_probs + whisper_lang_max_id() + 1, 0.0f);
+        }
+
         for (const auto & prob : logits_id) {
             if (lang_probs) {
                 lang_probs[prob.second] = prob.first;
@@ -3693,6 +7407,14 @@ int whisper_model_ftype(struct whisper_context * ctx) {
     return ctx->model.hparams.ftype;
 }
 
+bool whisper_model_is_distilled(struct whisper_context * ctx) {
+    // distil-whisper keeps the encoder of its teacher under 2 text layers (distil-medium.en, distil-large),
+    // distil-small.en under 4 of the 12 of small. large-v3-turbo has 4 text layers under 32 audio layers too,
+    // but it is not distilled and was trained with timestamp tokens.
+    const auto & hparams = ctx->model.hparams;
+    return (hparams.n_text_layer == 2 && hparams.n_audio_layer > 2) || (hparams.n_text_layer == 4 && hparams.n_audio_layer == 12);
+}
+
 int whisper_model_type(struct whisper_context * ctx) {
     return ctx->model.type;
 }
@@ -3747,7 +7469,7 @@ float * whisper_get_logits_from_state(struct whisper_state * state) {
 }
 
 const char * whisper_token_to_str(struct whisper_context * ctx, whisper_token token) {
-    return ctx->vocab.id_to_token.at(token).c_str();
+    return ctx->vocab.token_text(token);
 }
 
 whisper_token whisper_token_eot(struct whisper_context * ctx) {
@@ -3817,18 +7539,94 @@ void whisper_print_timings(struct whisper_context * ctx) {
 void whisper_reset_timings(struct whisper_context * ctx) {
     ctx->t_start_us = ggml_time_us();
     if (ctx->state != nullptr) {
-        ctx->state->t_mel_us = 0;
-        ctx->state->t_sample_us = 0;
-        ctx->state->t_encode_us = 0;
-        ctx->state->t_decode_us = 0;
-        ctx->state->t_batchd_us = 0;
-        ctx->state->t_prompt_us = 0;
-        ctx->state->n_sample = 0;
-        ctx->state->n_encode = 0;
-        ctx->state->n_decode = 0;
-        ctx->state->n_batchd = 0;
-        ctx->state->n_prompt = 0;
-    }
+        whisper_reset_timings_from_state(ctx->state);
+    }
+}
+
+struct whisper_timings whisper_get_timings_from_state(struct whisper_state * state) {
+    whisper_timings timings;
+    timings.mel_ms    = 1e-3f * state->t_mel_us;
+    timings.sample_ms = 1e-3f * state->t_sample_us;
+    timings.encode_ms = 1e-3f * state->t_encode_us;
+    timings.decode_ms = 1e-3f * state->t_decode_us;
+    timings.batchd_ms = 1e-3f * state->t_batchd_us;
+    timings.prompt_ms = 1e-3f * state->t_prompt_us;
+    timings.n_sample   = state->n_sample;
+    timings.n_fallback = state->n_fail_p;
+    return timings;
+}
+
+void whisper_reset_timings_from_state(struct whisper_state * state) {
+    state->t_mel_us = 0;
+    state->t_sample_us = 0;
+    state->t_encode_us = 0;
+    state->t_decode_us = 0;
+    state->t_batchd_us = 0;
+    state->t_prompt_us = 0;
+    state->n_sample = 0;
+    state->n_encode = 0;
+    state->n_decode = 0;
+    state->n_batchd = 0;
+    state->n_prompt = 0;
+    state->n_fail_p = 0;
+    state->n_fail_h = 0;
+}
+
+void whisper_reset_state(struct whisper_state * state) {
+    whisper_kv_cache_clear(state->kv_self);
+    whisper_kv_cache_clear(state->kv_cross);
+    state->kv_store_head = 0;
+
+    // the encoder cache is matched by the mel of its chunks, the mel cache and the pre-encoded window only by position
+    state->encoder_cache.chunks.clear();
+    state->mel_cache.n_frames = 0;
+    state->mel_pending.clear();
+    state->mel_samples   = nullptr;
+    state->mel_n_samples = 0;
+    state->pre_encoded_samples   = nullptr;
+    state->pre_encoded_n_samples = 0;
+    state->pre_encoded_n_ctx     = -1;
+    state->cross_mel_offset      = -1;
+
+    state->result_all.clear();
+    state->prompt_past.clear();
+    state->lang_id   = 0;
+    state->lang_prob = 1.0f;
+    state->repetition_aborted = false;
+    state->n_draft_accepted   = 0;
+    state->exp_n_audio_ctx    = 0;
+
+    whisper_reset_timings_from_state(state);
+}
+
+size_t whisper_get_model_memory(struct whisper_context * ctx) {
+    return (ctx->model.buffer ? ggml_backend_buffer_get_size(ctx->model.buffer) : 0) +
+           (ctx->vocab_subset.buffer ? ggml_backend_buffer_get_size(ctx->vocab_subset.buffer) : 0);
+}
+
+struct whisper_state_memory whisper_get_state_memory_breakdown(struct whisper_state * state) {
+    // allocators of graphs that were never measured, e.g. the batched encoder, hold nothing
+    const auto allocr_size = [](whisper_allocr & allocr) -> size_t {
+        return allocr.alloc ? whisper_allocr_size(allocr) : 0;
+    };
+
+    whisper_state_memory memory = {};
+    memory.kv_self  = state->kv_self.buffer  ? ggml_backend_buffer_get_size(state->kv_self.buffer)  : 0;
+    memory.kv_cross = state->kv_cross.buffer ? ggml_backend_buffer_get_size(state->kv_cross.buffer) : 0;
+    memory.compute += allocr_size(state->alloc_conv);
+    memory.compute += allocr_size(state->alloc_encode);
+    memory.compute += allocr_size(state->alloc_cross);
+    memory.compute += allocr_size(state->alloc_decode);
+    memory.compute += allocr_size(state->alloc_encode_batch);
+    memory.mel = state->mel.data.size()*sizeof(float);
+
+    return memory;
+}
+
+size_t whisper_get_state_memory(struct whisper_state * state) {
+    const whisper_state_memory memory = whisper_get_state_memory_breakdown(state);
+
+    return memory.kv_self + memory.kv_cross + memory.compute + memory.mel;
 }
 
 static int whisper_has_coreml(void) {
@@ -3847,6 +7645,25 @@ static int whisper_has_openvino(void) {
 #endif
 }
 
+static int whisper_has_nnapi(void) {
+#ifdef WHISPER_USE_NNAPI
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int whisper_gpu_device_count(void) {
+#if defined(GGML_USE_CUBLAS)
+    ggml_init_cublas();
+    return ggml_cublas_loaded() ? ggml_cuda_get_device_count() : 0;
+#elif defined(GGML_USE_METAL)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 const char * whisper_print_system_info(void) {
     static std::string s;
 
@@ -3868,6 +7685,7 @@ const char * whisper_print_system_info(void) {
     s += "CUDA = "      + std::to_string(ggml_cpu_has_cublas())    + " | ";
     s += "COREML = "    + std::to_string(whisper_has_coreml())     + " | ";
     s += "OPENVINO = "  + std::to_string(whisper_has_openvino())   + " | ";
+    s += "NNAPI = "     + std::to_string(whisper_has_nnapi())      + " | ";
 
     return s.c_str();
 }
@@ -4242,9 +8060,8 @@ static void whisper_suppress_invalid_grammar(
     std::vector<whisper_grammar_candidate>                              candidates_grammar;
 
     for (whisper_token id = 0; id < eot; ++id) {
-        const std::string & text = ctx.vocab.id_to_token[id];
-        if (!text.empty()) {
-            candidates_decoded.push_back(decode_utf8(text.c_str(), grammar.partial_utf8));
+        if (ctx.vocab.token_size(id) > 0) {
+            candidates_decoded.push_back(decode_utf8(ctx.vocab.token_text(id), grammar.partial_utf8));
             candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
         }
     }
@@ -4267,9 +8084,9 @@ static void whisper_grammar_accept_token(whisper_context & ctx, whisper_grammar
         return;
     }
 
-    //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.id_to_token[token].c_str());
+    //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.token_text(token));
 
-    const std::string & text = ctx.vocab.id_to_token[token];
+    const std::string text(ctx.vocab.token_text(token), ctx.vocab.token_size(token));
 
     if (text.rfind("[_", 0) == 0) {
         // fprintf(stderr, " (skipped)\n");
@@ -4336,6 +8153,7 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.speed_up          =*/ false,
         /*.debug_mode        =*/ false,
         /*.audio_ctx         =*/ 0,
+        /*.encoder_layers    =*/ 0,
 
         /*.tdrz_enable       =*/ false,
 
@@ -4343,9 +8161,15 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.prompt_tokens     =*/ nullptr,
         /*.prompt_n_tokens   =*/ 0,
 
+        /*.draft_tokens      =*/ nullptr,
+        /*.draft_n_tokens    =*/ 0,
+
         /*.language          =*/ "en",
         /*.detect_language   =*/ false,
 
+        /*.detect_lang_ids   =*/ nullptr,
+        /*.n_detect_lang_ids =*/ 0,
+
         /*.suppress_blank    =*/ true,
         /*.suppress_non_speech_tokens =*/ false,
 
@@ -4357,6 +8181,7 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.entropy_thold     =*/  2.4f,
         /*.logprob_thold     =*/ -1.0f,
         /*.no_speech_thold   =*/  0.6f,
+        /*.max_fallbacks     =*/ -1,
 
         /*.greedy            =*/ {
             /*.best_of   =*/ -1,
@@ -4368,6 +8193,12 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
             /*.patience  =*/ -1.0f,
         },
 
+        /*.decode_budget_ms =*/ 0,
+
+        /*.repetition_limit =*/ 0,
+
+        /*.vocab_subset =*/ false,
+
         /*.new_segment_callback           =*/ nullptr,
         /*.new_segment_callback_user_data =*/ nullptr,
 
@@ -4383,6 +8214,9 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.logits_filter_callback           =*/ nullptr,
         /*.logits_filter_callback_user_data =*/ nullptr,
 
+        /*.new_token_callback           =*/ nullptr,
+        /*.new_token_callback_user_data =*/ nullptr,
+
         /*.grammar_rules   =*/ nullptr,
         /*.n_grammar_rules =*/ 0,
         /*.i_start_rule    =*/ 0,
@@ -4486,10 +8320,114 @@ static const std::vector<std::string> non_speech_tokens = {
     "♪♪♪","♩", "♪", "♫", "♬", "♭", "♮", "♯"
 };
 
+// greedy decoding at temperature 0 only needs the most likely token and its probabilities,
+// not the full log_softmax over the vocabulary
+static bool whisper_use_fast_greedy(const whisper_full_params & params, float temperature) {
+    return params.strategy == WHISPER_SAMPLING_GREEDY && temperature < 1e-6f && params.n_grammar_rules == 0;
+}
+
+// the max of x[0..n), over 8 independent lanes so the compares vectorize
+static float whisper_max_f32(const float * x, int n) {
+    float lanes[8] = { -INFINITY, -INFINITY, -INFINITY, -INFINITY, -INFINITY, -INFINITY, -INFINITY, -INFINITY, };
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 8; ++k) {
+            lanes[k] = x[i + k] > lanes[k] ? x[i + k] : lanes[k];
+        }
+    }
+
+    float res = -INFINITY;
+    for (; i < n; ++i) {
+        res = x[i] > res ? x[i] : res;
+    }
+    for (int k = 0; k < 8; ++k) {
+        res = lanes[k] > res ? lanes[k] : res;
+    }
+
+    return res;
+}
+
+// first index of the max m of x[0..n)
+static int whisper_index_of_f32(const float * x, int n, float m) {
+    for (int i = 0; i < n; ++i) {
+        if (x[i] == m) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+// whisper_sample_token(best = true) on the filtered logits, with the timestamp rule of whisper_process_logits:
+// one pass of exp over the vocabulary for the normalizer, the probabilities are only computed for the result
+static whisper_token_data whisper_sample_token_best(
+        const whisper_vocab & vocab,
+        const std::vector<float> & logits) {
+    whisper_token_data result = {
+        0, 0, 0.0f, 0.0f, 0.0f, 0.0f, -1, -1, 0.0f,
+    };
+
+    const int n_logits = vocab.n_vocab;
+    const int n_text   = vocab.token_beg;
+    const int n_ts     = n_logits - n_text;
+
+    const float * text = logits.data();
+    const float * ts   = logits.data() + n_text;
+
+    const float max_text = whisper_max_f32(text, n_text);
+    const float max_ts   = whisper_max_f32(ts,   n_ts);
+    const float logit_max = std::max(max_text, max_ts);
+
+    if (logit_max == -INFINITY) {
+        return result;
+    }
+
+    float sum_ts = 0.0f;
+    if (max_ts > -INFINITY) {
+        for (int i = 0; i < n_ts; ++i) {
+            sum_ts += expf(ts[i] - max_ts);
+        }
+    }
+
+    float sum_text = 0.0f;
+    for (int i = 0; i < n_text; ++i) {
+        sum_text += expf(text[i] - logit_max);
+    }
+
+    const float logsumexp    = logf(sum_text + sum_ts*expf(max_ts - logit_max)) + logit_max;
+    const float logsumexp_ts = max_ts > -INFINITY ? logf(sum_ts) + max_ts : -INFINITY;
+
+    // the sum of probability over timestamps is above any other token: sample a timestamp
+    // the text tokens come first, so with no timestamp winning the first max of all logits is a text token
+    if (logsumexp_ts > max_text) {
+        result.id = n_text + whisper_index_of_f32(ts, n_ts, max_ts);
+    } else {
+        result.id = whisper_index_of_f32(text, n_text, max_text);
+    }
+
+    result.plog = logits[result.id] - logsumexp;
+    result.p    = expf(result.plog);
+
+    if (max_ts > -INFINITY) {
+        const float ptsum = expf(logsumexp_ts - logsumexp);
+
+        result.tid   = n_text + whisper_index_of_f32(ts, n_ts, max_ts);
+        result.pt    = expf(max_ts - logsumexp)/(ptsum + 1e-10f);
+        result.ptsum = ptsum;
+    }
+
+    if (result.id >= vocab.token_beg) {
+        result.tid = result.id;
+        result.pt  = result.p;
+    }
+
+    return result;
+}
+
 // process the logits for the selected decoder
 // - applies logit filters
-// - computes logprobs and probs
-// TODO: optimize
+// - computes logprobs and probs, or samples decoder.token_best on the fast greedy path
 static void whisper_process_logits(
               struct whisper_context & ctx,
                struct whisper_state  & state,
@@ -4500,7 +8438,7 @@ static void whisper_process_logits(
     const auto & tokens_cur = decoder.sequence.tokens;
 
     const bool is_initial = tokens_cur.size() == 0;
-    const int  n_logits   = vocab.id_to_token.size();
+    const int  n_logits   = vocab.n_tokens();
 
     WHISPER_ASSERT(n_logits == ctx.vocab.n_vocab);
 
@@ -4532,7 +8470,10 @@ static void whisper_process_logits(
         if (params.suppress_blank) {
             if (is_initial) {
                 logits[vocab.token_eot]           = -INFINITY;
-                logits[vocab.token_to_id.at(" ")] = -INFINITY;
+                const whisper_token token_space = vocab.find_token(" ");
+                if (token_space >= 0) {
+                    logits[token_space] = -INFINITY;
+                }
             }
         }
 
@@ -4577,18 +8518,19 @@ static void whisper_process_logits(
             for (const std::string & token : non_speech_tokens) {
                 const std::string suppress_tokens[] = {token, " " + token};
                 for (const std::string & suppress_token : suppress_tokens) {
-                    if (vocab.token_to_id.find(suppress_token) != vocab.token_to_id.end()) {
-                        logits[vocab.token_to_id.at(suppress_token)] = -INFINITY;
+                    const whisper_token id = vocab.find_token(suppress_token);
+                    if (id >= 0) {
+                        logits[id] = -INFINITY;
                     }
                 }
             }
 
             // allow hyphens "-" and single quotes "'" between words, but not at the beginning of a word
-            if (vocab.token_to_id.find(" -") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" -")] = -INFINITY;
-            }
-            if (vocab.token_to_id.find(" '") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" '")] = -INFINITY;
+            for (const char * token : { " -", " '" }) {
+                const whisper_token id = vocab.find_token(token);
+                if (id >= 0) {
+                    logits[id] = -INFINITY;
+                }
             }
         }
 
@@ -4634,6 +8576,11 @@ static void whisper_process_logits(
             }
         }
 
+        if (whisper_use_fast_greedy(params, temperature)) {
+            decoder.token_best = whisper_sample_token_best(vocab, logits);
+            return;
+        }
+
         // populate the logprobs array (log_softmax)
         {
             const float logit_max = *std::max_element(logits.begin(), logits.end());
@@ -4723,7 +8670,7 @@ static void whisper_process_logits(
 #if 0
     // print first 100 logits - token string : logit
     //for (int i = 0; i < 10; i++) {
-    //    const auto token   = vocab.id_to_token.at(i);
+    //    const auto token   = std::string(vocab.token_text(i));
     //    const auto prob    = probs[i];
     //    const auto logit   = logits[i];
     //    const auto logprob = logprobs[i];
@@ -4743,7 +8690,7 @@ static void whisper_process_logits(
         });
 
         for (int i = 0; i < 10; i++) {
-            const auto token   = vocab.id_to_token.at(pairs[i].second);
+            const auto token   = std::string(vocab.token_text(pairs[i].second));
             const auto prob    = pairs[i].first;
             const auto logit   = logits[pairs[i].second];
             const auto logprob = logprobs[pairs[i].second];
@@ -4754,26 +8701,69 @@ static void whisper_process_logits(
     }
 
     // "And", "and", " And", " and"
-    //printf("logits[\"and\"]  = %f\n", logits[vocab.token_to_id.at("and")]);
-    //printf("logits[\"And\"]  = %f\n", logits[vocab.token_to_id.at("And")]);
-    //printf("logits[\" and\"] = %f\n", logits[vocab.token_to_id.at(" and")]);
-    //printf("logits[\" And\"] = %f\n", logits[vocab.token_to_id.at(" And")]);
-    //printf("logits[\" so\"]  = %f\n", logits[vocab.token_to_id.at(" so")]);
-
-    //printf("logprobs[\"and\"]  = %f\n", logprobs[vocab.token_to_id.at("and")]);
-    //printf("logprobs[\"And\"]  = %f\n", logprobs[vocab.token_to_id.at("And")]);
-    //printf("logprobs[\" and\"] = %f\n", logprobs[vocab.token_to_id.at(" and")]);
-    //printf("logprobs[\" And\"] = %f\n", logprobs[vocab.token_to_id.at(" And")]);
-    //printf("logprobs[\" so\"]  = %f\n", logprobs[vocab.token_to_id.at(" so")]);
-
-    //printf("probs[\"and\"]  = %f\n", probs[vocab.token_to_id.at("and")]);
-    //printf("probs[\"And\"]  = %f\n", probs[vocab.token_to_id.at("And")]);
-    //printf("probs[\" and\"] = %f\n", probs[vocab.token_to_id.at(" and")]);
-    //printf("probs[\" And\"] = %f\n", probs[vocab.token_to_id.at(" And")]);
-    //printf("probs[\" so\"]  = %f\n", probs[vocab.token_to_id.at(" so")]);
+    //printf("logits[\"and\"]  = %f\n", logits[vocab.find_token("and")]);
+    //printf("logits[\"And\"]  = %f\n", logits[vocab.find_token("And")]);
+    //printf("logits[\" and\"] = %f\n", logits[vocab.find_token(" and")]);
+    //printf("logits[\" And\"] = %f\n", logits[vocab.find_token(" And")]);
+    //printf("logits[\" so\"]  = %f\n", logits[vocab.find_token(" so")]);
+
+    //printf("logprobs[\"and\"]  = %f\n", logprobs[vocab.find_token("and")]);
+    //printf("logprobs[\"And\"]  = %f\n", logprobs[vocab.find_token("And")]);
+    //printf("logprobs[\" and\"] = %f\n", logprobs[vocab.find_token(" and")]);
+    //printf("logprobs[\" And\"] = %f\n", logprobs[vocab.find_token(" And")]);
+    //printf("logprobs[\" so\"]  = %f\n", logprobs[vocab.find_token(" so")]);
+
+    //printf("probs[\"and\"]  = %f\n", probs[vocab.find_token("and")]);
+    //printf("probs[\"And\"]  = %f\n", probs[vocab.find_token("And")]);
+    //printf("probs[\" and\"] = %f\n", probs[vocab.find_token(" and")]);
+    //printf("probs[\" And\"] = %f\n", probs[vocab.find_token(" And")]);
+    //printf("probs[\" so\"]  = %f\n", probs[vocab.find_token(" so")]);
 #endif
 }
 
+// the text tokens of the sequence end with limit copies of the same n-gram of up to 8 tokens:
+// the length the sequence is cut to so only the first copy stays, 0 when they do not
+static int whisper_repetition_end(
+        const whisper_context & ctx,
+        const std::vector<whisper_token_data> & tokens,
+        int limit) {
+    const int n_ngram_max = 8;
+    const whisper_token token_eot = ctx.vocab.token_eot;
+
+    if (tokens.empty() || tokens.back().id >= token_eot) {
+        return 0;
+    }
+
+    // positions of the last text tokens, newest first, timestamps in between do not break a loop
+    std::vector<int> pos;
+    pos.reserve(n_ngram_max*limit);
+
+    for (int i = (int) tokens.size() - 1; i >= 0 && (int) pos.size() < n_ngram_max*limit; --i) {
+        if (tokens[i].id < token_eot) {
+            pos.push_back(i);
+        }
+    }
+
+    for (int n = 1; n <= n_ngram_max && n*limit <= (int) pos.size(); ++n) {
+        bool repeated = true;
+
+        for (int r = 1; r < limit && repeated; ++r) {
+            for (int k = 0; k < n; ++k) {
+                if (tokens[pos[k]].id != tokens[pos[k + r*n]].id) {
+                    repeated = false;
+                    break;
+                }
+            }
+        }
+
+        if (repeated) {
+            return pos[n*(limit - 1)] + 1;
+        }
+    }
+
+    return 0;
+}
+
 static whisper_token_data whisper_sample_token(
             whisper_context & ctx,
       const whisper_decoder & decoder,
@@ -4967,18 +8957,52 @@ int whisper_full_with_state(
     auto & result_all = state->result_all;
 
     result_all.clear();
+    state->repetition_aborted = false;
+
+    // only for this call, scoring, alignment and whisper_decode keep the whole vocabulary
+    struct vocab_subset_scope {
+        whisper_state * state;
+        ~vocab_subset_scope() { state->use_vocab_subset = false; }
+    } subset_scope = { state };
+
+    state->use_vocab_subset = params.vocab_subset;
+
+    // the decoder steps of this call may be merged with those of the other states, see whisper_ctx_set_decode_batching()
+    struct decode_group_scope {
+        whisper_context * ctx;
+        whisper_state * state;
+        ~decode_group_scope() {
+            state->decode_group_member = false;
+            whisper_decode_group_leave(*ctx, *state);
+        }
+    } group_scope = { ctx, state };
+
+    state->decode_group_member = true;
+
+    // past it the call gives up on fallbacks and extra decoders, see decode_budget_ms
+    const int64_t t_budget_end_us = params.decode_budget_ms > 0 ? ggml_time_us() + 1000ll*params.decode_budget_ms : 0;
+    const auto is_over_budget = [&]() {
+        return t_budget_end_us > 0 && ggml_time_us() > t_budget_end_us;
+    };
+
+    // work done ahead only counts when it was done with the same time compression
+    const bool same_speed_up = state->mel_speed_up == params.speed_up;
+    state->speed_up = params.speed_up;
 
-    if (n_samples > 0) {
-        // compute log mel spectrogram
-        if (params.speed_up) {
-            // TODO: Replace PV with more advanced algorithm
+    // the first window may already be encoded by whisper_encode_batch_with_states()
+    bool use_pre_encoded = same_speed_up && state->pre_encoded_n_ctx > 0 && samples == state->pre_encoded_samples && n_samples == state->pre_encoded_n_samples;
+    const int pre_encoded_n_ctx = state->pre_encoded_n_ctx;
+    state->pre_encoded_n_ctx = -1;
+
+    // or the mel was computed by whisper_pcm_to_mel_cached_with_state()
+    const bool has_mel = same_speed_up && state->mel_samples == samples && state->mel_n_samples == n_samples;
+    state->mel_samples = nullptr;
+
+    if (n_samples > 0 && !use_pre_encoded && !has_mel) {
+        // compute log mel spectrogram, time compressed with speed_up
+        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
             WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
-            return -1;
-        } else {
-            if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
-                WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
-                return -2;
-            }
+            return -2;
         }
     }
 
@@ -4986,18 +9010,24 @@ int whisper_full_with_state(
     if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
         std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
 
-        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, probs.data());
+        // language detection runs the encoder again and overwrites the pre-encoded window
+        use_pre_encoded = false;
+
+        const auto lang_id = whisper_lang_auto_detect_subset_with_state(ctx, state, 0, params.n_threads, params.detect_lang_ids, params.n_detect_lang_ids, probs.data());
         if (lang_id < 0) {
             WHISPER_LOG_ERROR("%s: failed to auto-detect language\n", __func__);
             return -3;
         }
         state->lang_id = lang_id;
+        state->lang_prob = probs[lang_id];
         params.language = whisper_lang_str(lang_id);
 
         WHISPER_LOG_INFO("%s: auto-detected language: %s (p = %f)\n", __func__, params.language, probs[whisper_lang_id(params.language)]);
         if (params.detect_language) {
             return 0;
         }
+    } else {
+        state->lang_prob = 1.0f;
     }
 
     if (params.token_timestamps) {
@@ -5009,8 +9039,10 @@ int whisper_full_with_state(
         }
     }
 
-    const int seek_start = params.offset_ms/10;
-    const int seek_end = params.duration_ms == 0 ? whisper_n_len_from_state(state) : seek_start + params.duration_ms/10;
+    // a time compressed mel frame is 20 ms of the audio
+    const int ms_per_frame = params.speed_up ? 20 : 10;
+    const int seek_start = params.offset_ms/ms_per_frame;
+    const int seek_end = params.duration_ms == 0 ? whisper_n_len_from_state(state) : seek_start + params.duration_ms/ms_per_frame;
 
     // if length of spectrogram is less than 1.0s (100 frames), then return
     // basically don't process anything that is less than 1.0s
@@ -5030,6 +9062,9 @@ int whisper_full_with_state(
     } else {
         temperatures.push_back(params.temperature);
     }
+    if (params.max_fallbacks >= 0 && (int) temperatures.size() > params.max_fallbacks + 1) {
+        temperatures.resize(params.max_fallbacks + 1);
+    }
 
     // initialize the decoders
     int n_decoders = 1;
@@ -5099,7 +9134,7 @@ int whisper_full_with_state(
         WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, params.audio_ctx, whisper_n_audio_ctx(ctx));
         return -5;
     }
-    state->exp_n_audio_ctx = params.audio_ctx;
+    state->exp_n_audio_ctx = whisper_clamp_audio_ctx(*state, params.audio_ctx);
 
     // these tokens determine the task that will be performed
     std::vector<whisper_token> prompt_init = { whisper_token_sot(ctx), };
@@ -5117,7 +9152,7 @@ int whisper_full_with_state(
 
     // distilled models require the "no_timestamps" token
     {
-        const bool is_distil = ctx->model.hparams.n_text_layer == 2;
+        const bool is_distil = whisper_model_is_distilled(ctx);
         if (is_distil && !params.no_timestamps) {
             WHISPER_LOG_WARN("%s: using distilled model - forcing no_timestamps\n", __func__);
             params.no_timestamps = true;
@@ -5133,6 +9168,9 @@ int whisper_full_with_state(
     std::vector<whisper_token> prompt;
     prompt.reserve(whisper_n_text_ctx(ctx));
 
+    // draft tokens fed after the prompt in the current iteration, see whisper_full_params::draft_tokens
+    int n_draft = 0;
+
     struct beam_candidate {
         int decoder_idx;
         int seek_delta;
@@ -5168,10 +9206,20 @@ int whisper_full_with_state(
         }
 
         // encode audio features starting at offset seek
-        if (!whisper_encode_internal(*ctx, *state, seek, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
-            WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
-            return -6;
+        const int n_ctx_cur = state->exp_n_audio_ctx > 0 ? state->exp_n_audio_ctx : state->n_audio_ctx_max;
+        if (use_pre_encoded && seek == 0 && n_ctx_cur == pre_encoded_n_ctx) {
+            // the cross-attention memory already holds this window
+        } else {
+            // the early exit only applies to this encode, the other entry points keep the full encoder
+            state->exp_n_audio_layer = std::max(0, params.encoder_layers);
+            const bool encoded = whisper_encode_internal(*ctx, *state, seek, params.n_threads, params.abort_callback, params.abort_callback_user_data);
+            state->exp_n_audio_layer = 0;
+            if (!encoded) {
+                WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+                return -6;
+            }
         }
+        use_pre_encoded = false;
 
         // if there is a very short audio segment left to process, we remove any past prompt since it tends
         // to confuse the decoder and often make it repeat or hallucinate stuff
@@ -5205,6 +9253,10 @@ int whisper_full_with_state(
 
             n_decoders_cur = std::max(1, n_decoders_cur);
 
+            if (is_over_budget()) {
+                n_decoders_cur = 1;
+            }
+
             WHISPER_LOG_DEBUG("\n%s: strategy = %d, decoding with %d decoders, temperature = %.2f\n", __func__, params.strategy, n_decoders_cur, t_cur);
 
             // TAGS: WHISPER_DECODER_INIT
@@ -5218,6 +9270,7 @@ int whisper_full_with_state(
                 decoder.sequence.avg_logprobs     = -INFINITY;
                 decoder.sequence.entropy          = 0.0;
                 decoder.sequence.score            = -INFINITY;
+                decoder.sequence.repetition_aborted = false;
 
                 decoder.seek_delta = 100*WHISPER_CHUNK_SIZE;
 
@@ -5251,14 +9304,35 @@ int whisper_full_with_state(
                 // print the prompt
                 WHISPER_LOG_DEBUG("\n\n");
                 for (int i = 0; i < (int) prompt.size(); i++) {
-                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.id_to_token.at(prompt[i]).c_str());
+                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.token_text(prompt[i]));
                 }
                 WHISPER_LOG_DEBUG("\n\n");
 
                 whisper_kv_cache_clear(state->kv_self);
 
+                n_draft = 0;
+                if (params.draft_n_tokens > 0 && seek == seek_start && t_cur < 1e-6f && n_decoders_cur == 1 &&
+                    params.strategy == whisper_sampling_strategy::WHISPER_SAMPLING_GREEDY) {
+                    n_draft = std::min(params.draft_n_tokens, whisper_n_text_ctx(ctx)/2 - 4 - 1);
+                    if (params.max_tokens > 0) {
+                        n_draft = std::min(n_draft, params.max_tokens);
+                    }
+                }
+
                 whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
 
+                // the drafts follow the prompt in the same batch, with the logits after each of them
+                for (int k = 0; k < n_draft; ++k) {
+                    auto & batch = state->batch;
+
+                    batch.token   [batch.n_tokens]    = params.draft_tokens[k];
+                    batch.pos     [batch.n_tokens]    = batch.n_tokens;
+                    batch.n_seq_id[batch.n_tokens]    = 1;
+                    batch.seq_id  [batch.n_tokens][0] = 0;
+                    batch.logits  [batch.n_tokens]    = 1;
+                    batch.n_tokens++;
+                }
+
                 if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
                     WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                     return -7;
@@ -5285,9 +9359,41 @@ int whisper_full_with_state(
                 }
             }
 
+            bool is_collapsed = n_decoders_cur == 1;
+
             for (int i = 0, n_max = whisper_n_text_ctx(ctx)/2 - 4; i < n_max; ++i) {
                 const int64_t t_start_sample_us = ggml_time_us();
 
+                // out of time: keep only the most likely of the running decoders, it goes on alone
+                if (!is_collapsed && is_over_budget()) {
+                    int best_j = -1;
+
+                    for (int j = 0; j < n_decoders_cur; ++j) {
+                        const auto & decoder = state->decoders[j];
+
+                        if (decoder.completed || decoder.failed) {
+                            continue;
+                        }
+
+                        if (best_j < 0 || decoder.sequence.sum_logprobs_all > state->decoders[best_j].sequence.sum_logprobs_all) {
+                            best_j = j;
+                        }
+                    }
+
+                    for (int j = 0; j < n_decoders_cur; ++j) {
+                        auto & decoder = state->decoders[j];
+
+                        if (j != best_j && !decoder.completed && !decoder.failed) {
+                            decoder.failed = true;
+                            whisper_kv_cache_seq_rm(state->kv_self, j, -1, -1);
+                        }
+                    }
+
+                    WHISPER_LOG_DEBUG("%s: decode budget of %d ms exceeded, continuing with decoder %d\n", __func__, params.decode_budget_ms, best_j);
+
+                    is_collapsed = true;
+                }
+
                 if (params.strategy == whisper_sampling_strategy::WHISPER_SAMPLING_BEAM_SEARCH) {
                     for (auto & bc : bc_per_dec) {
                         bc.clear();
@@ -5316,7 +9422,9 @@ int whisper_full_with_state(
                             switch (params.strategy) {
                                 case whisper_sampling_strategy::WHISPER_SAMPLING_GREEDY:
                                     {
-                                        if (t_cur < 1e-6f) {
+                                        if (whisper_use_fast_greedy(params, t_cur)) {
+                                            decoder.sequence.tokens.push_back(decoder.token_best);
+                                        } else if (t_cur < 1e-6f) {
                                             decoder.sequence.tokens.push_back(whisper_sample_token(*ctx, decoder, true));
                                         } else {
                                             decoder.sequence.tokens.push_back(whisper_sample_token(*ctx, decoder, false));
@@ -5377,6 +9485,9 @@ int whisper_full_with_state(
 
                     uint32_t cur_c = 0;
 
+                    // the decoder each of the running ones continues from
+                    std::vector<whisper_seq_id> kv_src(n_decoders_cur, -1);
+
                     for (int j = 0; j < n_decoders_cur; ++j) {
                         auto & decoder = state->decoders[j];
 
@@ -5399,23 +9510,13 @@ int whisper_full_with_state(
                         decoder.sequence   = cur.sequence;
                         decoder.grammar    = cur.grammar;
 
-                        whisper_kv_cache_seq_cp(state->kv_self, cur.decoder_idx, WHISPER_MAX_DECODERS + j, -1, -1);
+                        kv_src[j] = cur.decoder_idx;
 
                         WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
-                                __func__, j, cur.decoder_idx, ctx->vocab.id_to_token.at(decoder.sequence.tokens.back().id).c_str(), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
+                                __func__, j, cur.decoder_idx, ctx->vocab.token_text(decoder.sequence.tokens.back().id), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
                     }
 
-                    for (int j = 0; j < n_decoders_cur; ++j) {
-                        auto & decoder = state->decoders[j];
-
-                        if (decoder.completed || decoder.failed) {
-                            continue;
-                        }
-
-                        whisper_kv_cache_seq_rm(state->kv_self, j,                           -1, -1);
-                        whisper_kv_cache_seq_cp(state->kv_self, WHISPER_MAX_DECODERS + j, j, -1, -1);
-                        whisper_kv_cache_seq_rm(state->kv_self, WHISPER_MAX_DECODERS + j,    -1, -1);
-                    }
+                    whisper_kv_cache_seq_remap(state->kv_self, kv_src);
                 }
 
                 // update the decoder state
@@ -5458,9 +9559,9 @@ int whisper_full_with_state(
 
 #ifdef WHISPER_DEBUG
                         {
-                            const auto tt = token.pt > 0.10 ? ctx->vocab.id_to_token.at(token.tid) : "[?]";
+                            const auto tt = token.pt > 0.10 ? ctx->vocab.token_text(token.tid) : "[?]";
                             WHISPER_LOG_DEBUG("%s: id = %3d, decoder = %d, token = %6d, p = %6.3f, ts = %10s, %6.3f, result_len = %4d '%s'\n",
-                                    __func__, i, j, token.id, token.p, tt.c_str(), token.pt, result_len, ctx->vocab.id_to_token.at(token.id).c_str());
+                                    __func__, i, j, token.id, token.p, tt, token.pt, result_len, ctx->vocab.token_text(token.id));
                         }
 #endif
 
@@ -5497,6 +9598,21 @@ int whisper_full_with_state(
                         }
                     }
 
+                    // a loop on noise, "you you you", stops right away instead of at the token limit
+                    if (params.repetition_limit > 1) {
+                        const int repetition_end = whisper_repetition_end(*ctx, decoder.sequence.tokens, params.repetition_limit);
+
+                        if (repetition_end > 0) {
+                            WHISPER_LOG_DEBUG("%s: decoder %d: repetition loop cut at %d tokens\n", __func__, j, repetition_end);
+                            result_len = repetition_end;
+                            seek_delta = seek_end - seek;
+                            completed = true;
+                            decoder.sequence.repetition_aborted = true;
+                            state->n_fail_r++;
+                            continue;
+                        }
+                    }
+
                     // sometimes, the decoding can get stuck in a repetition loop
                     // this is an attempt to mitigate such cases - we flag the decoding as failed and use a fallback strategy
                     if (i == n_max - 1 && (result_len == 0 || seek_delta < 100*WHISPER_CHUNK_SIZE/2)) {
@@ -5506,6 +9622,28 @@ int whisper_full_with_state(
                     }
                 }
 
+                // report what the most likely decoder has so far
+                if (params.new_token_callback) {
+                    int best_j = -1;
+
+                    for (int j = 0; j < n_decoders_cur; ++j) {
+                        const auto & decoder = state->decoders[j];
+
+                        if (decoder.failed || decoder.sequence.tokens.empty()) {
+                            continue;
+                        }
+
+                        if (best_j < 0 || decoder.sequence.sum_logprobs_all > state->decoders[best_j].sequence.sum_logprobs_all) {
+                            best_j = j;
+                        }
+                    }
+
+                    if (best_j >= 0) {
+                        const auto & tokens = state->decoders[best_j].sequence.tokens;
+                        params.new_token_callback(ctx, state, tokens.data(), tokens.size(), params.new_token_callback_user_data);
+                    }
+                }
+
                 // check if all decoders have finished (i.e. completed or failed)
                 {
                     bool completed_all = true;
@@ -5527,6 +9665,29 @@ int whisper_full_with_state(
 
                 state->t_sample_us += ggml_time_us() - t_start_sample_us;
 
+                if (n_draft > 0) {
+                    auto & decoder = state->decoders[0];
+
+                    // the token is the draft fed with the prompt, the logits after it are there already
+                    if (i < n_draft && decoder.sequence.tokens.back().id == params.draft_tokens[i]) {
+                        const int64_t t_start_sample_us = ggml_time_us();
+
+                        decoder.i_batch = prompt.size() + i;
+
+                        whisper_process_logits(*ctx, *state, decoder, params, t_cur);
+
+                        state->n_draft_accepted++;
+                        state->t_sample_us += ggml_time_us() - t_start_sample_us;
+
+                        continue;
+                    }
+
+                    // drop the drafts from the first one that was not sampled
+                    whisper_kv_cache_seq_rm(state->kv_self, 0, prompt.size() + i, -1);
+
+                    n_draft = 0;
+                }
+
                 // obtain logits for the next token
                 {
                     auto & batch = state->batch;
@@ -5649,7 +9810,8 @@ int whisper_full_with_state(
             // was the decoding successful for the current temperature?
             // do fallback only if:
             // - we are not at the last temperature
-            if (it != (int) temperatures.size() - 1) {
+            // - the decode budget is not spent
+            if (it != (int) temperatures.size() - 1 && !is_over_budget()) {
                 const auto & decoder = state->decoders[best_decoder_id];
 
                 if (decoder.failed || decoder.sequence.avg_logprobs < params.logprob_thold) {
@@ -5661,7 +9823,7 @@ int whisper_full_with_state(
 
             if (success) {
                 //for (auto & token : ctx->decoders[best_decoder_id].sequence.tokens) {
-                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.id_to_token.at(token.tid).c_str(), ctx->vocab.id_to_token.at(token.id).c_str());
+                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.token_text(token.tid), ctx->vocab.token_text(token.id));
                 //}
 
                 break;
@@ -5674,6 +9836,8 @@ int whisper_full_with_state(
         {
             const auto & best_decoder = state->decoders[best_decoder_id];
 
+            state->repetition_aborted = state->repetition_aborted || best_decoder.sequence.repetition_aborted;
+
             const auto seek_delta = best_decoder.seek_delta;
             const auto result_len = best_decoder.sequence.result_len;
 
@@ -5700,8 +9864,8 @@ int whisper_full_with_state(
 
                 for (int i = 0; i < (int) tokens_cur.size(); i++) {
                     //printf("%s: %18s %6.3f %18s %6.3f\n", __func__,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].p,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].tid].c_str(), tokens_cur[i].pt);
+                    //        ctx->vocab.token_text(tokens_cur[i].id), tokens_cur[i].p,
+                    //        ctx->vocab.token_text(tokens_cur[i].tid), tokens_cur[i].pt);
 
                     if (params.print_special || tokens_cur[i].id < whisper_token_eot(ctx)) {
                         text += whisper_token_to_str(ctx, tokens_cur[i].id);
@@ -5728,7 +9892,7 @@ int whisper_full_with_state(
                                 }
                             }
 
-                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].id, tokens_cur[i].tid);
+                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.token_text(tokens_cur[i].id), tokens_cur[i].id, tokens_cur[i].tid);
 
                             result_all.push_back({ tt0, tt1, text, {}, speaker_turn_next });
                             for (int j = i0; j <= i; j++) {
@@ -5814,14 +9978,15 @@ int whisper_full(
     return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
 }
 
-int whisper_full_parallel(
+int whisper_full_parallel_with_state(
         struct whisper_context * ctx,
+          struct whisper_state * state,
         struct whisper_full_params params,
         const float * samples,
         int n_samples,
         int n_processors) {
     if (n_processors == 1) {
-        return whisper_full(ctx, params, samples, n_samples);
+        return whisper_full_with_state(ctx, state, params, samples, n_samples);
     }
     int ret = 0;
 
@@ -5854,6 +10019,9 @@ int whisper_full_parallel(
         params_cur.progress_callback = nullptr;
         params_cur.progress_callback_user_data = nullptr;
 
+        params_cur.new_token_callback = nullptr;
+        params_cur.new_token_callback_user_data = nullptr;
+
         workers[i] = std::thread(whisper_full_with_state, ctx, states[i], std::move(params_cur), samples + start_samples, n_samples_cur);
     }
 
@@ -5863,8 +10031,8 @@ int whisper_full_parallel(
         // We need to disable the print real-time for this one as well, otherwise it will show only for the first chunk.
         params_cur.print_realtime = false;
 
-        // Run the first transformation using default state but only for the first chunk.
-        ret = whisper_full_with_state(ctx, ctx->state, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
+        // Run the first transformation using the given state but only for the first chunk.
+        ret = whisper_full_with_state(ctx, state, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
     }
 
     for (int i = 0; i < n_processors - 1; ++i) {
@@ -5883,40 +10051,40 @@ int whisper_full_parallel(
             result.t1 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
 
             // make sure that segments are not overlapping
-            if (!ctx->state->result_all.empty()) {
-                result.t0 = std::max(result.t0, ctx->state->result_all.back().t1);
+            if (!state->result_all.empty()) {
+                result.t0 = std::max(result.t0, state->result_all.back().t1);
             }
 
-            ctx->state->result_all.push_back(std::move(result));
+            state->result_all.push_back(std::move(result));
 
             // call the new_segment_callback for each segment
             if (params.new_segment_callback) {
-                params.new_segment_callback(ctx, ctx->state, 1, params.new_segment_callback_user_data);
+                params.new_segment_callback(ctx, state, 1, params.new_segment_callback_user_data);
             }
         }
 
-        ctx->state->t_mel_us += states[i]->t_mel_us;
+        state->t_mel_us += states[i]->t_mel_us;
 
-        ctx->state->t_sample_us += states[i]->t_sample_us;
-        ctx->state->t_encode_us += states[i]->t_encode_us;
-        ctx->state->t_decode_us += states[i]->t_decode_us;
-        ctx->state->t_batchd_us += states[i]->t_batchd_us;
-        ctx->state->t_prompt_us += states[i]->t_prompt_us;
+        state->t_sample_us += states[i]->t_sample_us;
+        state->t_encode_us += states[i]->t_encode_us;
+        state->t_decode_us += states[i]->t_decode_us;
+        state->t_batchd_us += states[i]->t_batchd_us;
+        state->t_prompt_us += states[i]->t_prompt_us;
 
-        ctx->state->n_sample += states[i]->n_sample;
-        ctx->state->n_encode += states[i]->n_encode;
-        ctx->state->n_decode += states[i]->n_decode;
-        ctx->state->n_batchd += states[i]->n_batchd;
-        ctx->state->n_prompt += states[i]->n_prompt;
+        state->n_sample += states[i]->n_sample;
+        state->n_encode += states[i]->n_encode;
+        state->n_decode += states[i]->n_decode;
+        state->n_batchd += states[i]->n_batchd;
+        state->n_prompt += states[i]->n_prompt;
 
         whisper_free_state(states[i]);
     }
 
     // average the timings
-    ctx->state->t_mel_us    /= n_processors;
-    ctx->state->t_sample_us /= n_processors;
-    ctx->state->t_encode_us /= n_processors;
-    ctx->state->t_decode_us /= n_processors;
+    state->t_mel_us    /= n_processors;
+    state->t_sample_us /= n_processors;
+    state->t_encode_us /= n_processors;
+    state->t_decode_us /= n_processors;
 
     // print information about the audio boundaries
     WHISPER_LOG_WARN("\n");
@@ -5929,6 +10097,15 @@ int whisper_full_parallel(
     return ret;
 }
 
+int whisper_full_parallel(
+        struct whisper_context * ctx,
+        struct whisper_full_params params,
+        const float * samples,
+        int n_samples,
+        int n_processors) {
+    return whisper_full_parallel_with_state(ctx, ctx->state, params, samples, n_samples, n_processors);
+}
+
 int whisper_full_n_segments_from_state(struct whisper_state * state) {
     return state->result_all.size();
 }
@@ -5945,6 +10122,14 @@ int whisper_full_lang_id(struct whisper_context * ctx) {
     return ctx->state->lang_id;
 }
 
+float whisper_full_lang_prob_from_state(struct whisper_state * state) {
+    return state->lang_prob;
+}
+
+bool whisper_full_repetition_aborted_from_state(struct whisper_state * state) {
+    return state->repetition_aborted;
+}
+
 int64_t whisper_full_get_segment_t0_from_state(struct whisper_state * state, int i_segment) {
     return state->result_all[i_segment].t0;
 }
@@ -5986,11 +10171,11 @@ int whisper_full_n_tokens(struct whisper_context * ctx, int i_segment) {
 }
 
 const char * whisper_full_get_token_text_from_state(struct whisper_context * ctx, struct whisper_state * state, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.token_text(state->result_all[i_segment].tokens[i_token].id);
 }
 
 const char* whisper_full_get_token_text(struct whisper_context * ctx, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[ctx->state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.token_text(ctx->state->result_all[i_segment].tokens[i_token].id);
 }
 
 whisper_token whisper_full_get_token_id_from_state(struct whisper_state * state, int i_segment, int i_token) {
@@ -6418,7 +10603,8 @@ static void whisper_exp_compute_token_level_timestamps(
             }
         }
 
-        const int64_t tt = t_beg + 2*(token.tid - whisper_token_beg(&ctx));
+        // a timestamp token is 2 frames, 4 of the audio when the mel was time compressed
+        const int64_t tt = t_beg + (state.mel_speed_up ? 4 : 2)*(token.tid - whisper_token_beg(&ctx));
 
         tokens[j].id    = token.id;
         tokens[j].tid   = token.tid;
@@ -84,8 +84,119 @@ extern "C" {
     typedef int32_t whisper_token;
     typedef int32_t whisper_seq_id;
 
+    // cross-attention heads of the decoder that follow the audio, the ones whisper_full_align_tokens_dtw_with_state() uses
+    // ref: _ALIGNMENT_HEADS in whisper/__init__.py of https://github.com/openai/whisper
+    enum whisper_alignment_heads_preset {
+        WHISPER_AHEADS_AUTO,       // the preset of the model type, large-v1 and v2 cannot be told apart and get the v2 heads
+        WHISPER_AHEADS_N_TOP_MOST, // all the heads of the upper half of the text layers, for models without a preset
+        WHISPER_AHEADS_TINY_EN,
+        WHISPER_AHEADS_TINY,
+        WHISPER_AHEADS_BASE_EN,
+        WHISPER_AHEADS_BASE,
+        WHISPER_AHEADS_SMALL_EN,
+        WHISPER_AHEADS_SMALL,
+        WHISPER_AHEADS_MEDIUM_EN,
+        WHISPER_AHEADS_MEDIUM,
+        WHISPER_AHEADS_LARGE_V1,
+        WHISPER_AHEADS_LARGE_V2,
+        WHISPER_AHEADS_LARGE_V3,
+    };
+
+    // where a stage of the states runs, see whisper_context_params::encoder_device
+    enum whisper_device {
+        WHISPER_DEVICE_GPU, // where use_gpu puts the context
+        WHISPER_DEVICE_CPU, // always on the CPU
+    };
+
     struct whisper_context_params {
         bool  use_gpu;
+
+        // with use_gpu, the CUDA device of the weights and of every state made from the context, see
+        // whisper_gpu_device_count(). Contexts on different devices compute at the same time, with a copy
+        // of the weights each. Ignored by the other backends
+        int   gpu_device;
+
+        // type of the self and cross-attention KV caches of the states: GGML_TYPE_F16 (default),
+        // GGML_TYPE_F32, or GGML_TYPE_Q8_0, which stores the keys as q8_0 and the values as f16
+        // q8_0 is only supported by the CPU backend, the others use f16 instead
+        enum ggml_type kv_type;
+
+        // compute the encoder self-attention with ggml_flash_attn, which goes through the keys one
+        // query row at a time instead of writing the whole [n_audio_ctx, n_audio_ctx] matrix per head
+        // only the CPU backend has the kernel, the others ignore it
+        bool flash_attn;
+
+        // with the CPU backend, the encoder and cross-attention matrix multiplications with quantized weights
+        // read the activations converted once to the type of their dot products (q8_0, q8_1 or q8_K) by all the
+        // threads, instead of each converting them on one thread. Q, K and V of a layer, and the cross-attention
+        // K and V of all the decoder layers, share one conversion. BLAS builds keep their sgemm, which needs f32
+        bool quantize_activations;
+
+        // with the CPU backend on CPUs with F16C or the Armv8.2 FP16 arithmetic, the encoder layers keep the
+        // residual stream and the tensors between their ops in F16, which halves the memory they move. The matrix
+        // multiplications and the norms still sum in F32, and F16 weights read the activations without converting
+        // them. The output of the encoder stays F32. BLAS builds and the other CPUs ignore it
+        bool f16_activations;
+
+        // with the Metal backend, whisper_pcm_to_mel_with_state() leaves the spectrogram of audio the first
+        // encoder window covers to the conv graph, which computes it from the samples on the GPU. The mel is
+        // computed on the CPU as before when it is read, for speed_up, or to encode from another offset
+        bool gpu_mel;
+
+        // states can align tokens with whisper_full_align_tokens_dtw_with_state(), their decoder compute buffer
+        // then also holds the cross-attention weights of the alignment heads
+        bool dtw_token_timestamps;
+        enum whisper_alignment_heads_preset dtw_aheads_preset;
+
+        // the encoder (conv, encoder and cross-attention graphs) and the decoder of the states can run on
+        // different devices. WHISPER_DEVICE_GPU keeps the behavior of use_gpu: with the CLBlast and cuBLAS
+        // builds that is the CPU backend offloading the large matrix multiplications, WHISPER_DEVICE_CPU
+        // then keeps them on the CPU. A Metal context computes a stage on the CPU from the same buffers.
+        // A CUDA context holds the weights in device memory, its stages stay on the GPU.
+        enum whisper_device encoder_device;
+        enum whisper_device decoder_device;
+
+        // largest audio context the states are sized for, 0 for the one of the model. The cross-attention
+        // cache and the conv, encoder and cross compute buffers shrink with it, larger audio_ctx requests
+        // are clamped to it. States with a Core ML, OpenVINO or NNAPI encoder always take the whole window.
+        int n_audio_ctx_max;
+
+        // with the CPU backend, interleave the q4_0 and q8_0 weights of the encoder and decoder blocks 4 rows
+        // at a time as they are loaded, so the matrix multiplications compute 4 rows per pass over the
+        // activations. Same memory, only done when ggml has SIMD kernels for it on this CPU. Off by default,
+        // BLAS builds lose the sgemm of the encoder for these weights.
+        bool repack_weights;
+
+        // with use_gpu, creates the backend of the context and of every state instead of the built-in GPU
+        // backends, e.g. one on a device the host application already owns. Its buffers must be host memory,
+        // so the stages placed on the CPU compute on them as they are. NULL, or a NULL result, keeps the
+        // built-in backends
+        struct ggml_backend * (*backend_init)(void * user_data);
+        void * backend_init_user_data;
+
+        // random access to the file the loader streams: reads read_size bytes at offset into output and returns
+        // the bytes read, called from several threads at once. With it the weights are read by n_load_threads
+        // threads (0 for up to 4), each over its own range of the tensors, straight into host buffers or
+        // through its own staging buffer to the device, so the reads of some overlap the uploads of others.
+        // Only called during the load. NULL reads the tensors through the loader one after the other
+        size_t (*read_at)(void * user_data, size_t offset, void * output, size_t read_size);
+        void * read_at_user_data;
+        int32_t n_load_threads;
+
+        // when the weights are in host memory: lock_model_memory pins them in RAM once loaded (mlock,
+        // VirtualLock), so they are never paged out and the first passes after idle do not fault them back
+        // in. It can fail on a low RLIMIT_MEMLOCK, the load goes on with a warning. use_huge_pages asks
+        // Linux for transparent huge pages on the weights before they are read, fewer TLB misses in the
+        // large matrix multiplications. Ignored elsewhere
+        bool lock_model_memory;
+        bool use_huge_pages;
+
+        // path of the model file the loader streams, when it is a file on disk. The CPU and Metal backends then
+        // map the file read-only and keep the weights whose data is 32-byte aligned in it where they are, in a
+        // buffer over the mapping: no copy in host memory, and on Apple unified memory a Metal buffer the GPU
+        // reads in place. The other weights are copied from the mapping. lock_model_memory and use_huge_pages
+        // only apply to the copies. Not with repack_weights, which rewrites the weights. NULL reads them all
+        const char * mmap_path;
     };
 
     typedef struct whisper_token_data {
@@ -184,6 +295,64 @@ extern "C" {
 
     WHISPER_API struct whisper_state * whisper_init_state(struct whisper_context * ctx);
 
+    // Like whisper_init_state(), sized for n_audio_ctx_max instead of the audio context set on ctx, 0 for the full one.
+    WHISPER_API struct whisper_state * whisper_init_state_with_max_audio_ctx(struct whisper_context * ctx, int n_audio_ctx_max);
+
+    // Path of the ggml model the Core ML, OpenVINO and NNAPI encoder paths are derived from, e.g. the
+    // "-encoder.mlmodelc" next to it. Only needed by contexts loaded through a whisper_model_loader,
+    // set it before the states are created.
+    WHISPER_API void whisper_ctx_set_path_model(struct whisper_context * ctx, const char * path_model);
+
+    // KV cache type of the states created from now on, see whisper_context_params::kv_type.
+    WHISPER_API void whisper_ctx_set_kv_type(struct whisper_context * ctx, enum ggml_type kv_type);
+
+    // Encoder flash attention of the states created from now on, see whisper_context_params::flash_attn.
+    WHISPER_API void whisper_ctx_set_flash_attn(struct whisper_context * ctx, bool flash_attn);
+
+    // Encoder activation quantization of the states created from now on, see whisper_context_params::quantize_activations.
+    WHISPER_API void whisper_ctx_set_quantize_activations(struct whisper_context * ctx, bool quantize_activations);
+
+    // Encoder F16 activations of the states created from now on, see whisper_context_params::f16_activations.
+    WHISPER_API void whisper_ctx_set_f16_activations(struct whisper_context * ctx, bool f16_activations);
+
+    // GPU mel spectrogram of the states created from now on, see whisper_context_params::gpu_mel.
+    WHISPER_API void whisper_ctx_set_gpu_mel(struct whisper_context * ctx, bool gpu_mel);
+
+    // DTW token alignment of the states created from now on, see whisper_context_params::dtw_token_timestamps.
+    WHISPER_API void whisper_ctx_set_dtw(struct whisper_context * ctx, bool dtw_token_timestamps, enum whisper_alignment_heads_preset aheads_preset);
+
+    // Audio context the states created from now on are sized for, see whisper_context_params::n_audio_ctx_max.
+    WHISPER_API void whisper_ctx_set_max_audio_ctx(struct whisper_context * ctx, int n_audio_ctx_max);
+
+    // Text tokens the decoder computes logits for in whisper_full calls with vocab_subset, the special and
+    // timestamp tokens are always kept and all others get -INFINITY. Their embedding rows are copied once,
+    // so the output projection of every step only multiplies those. nullptr or 0 tokens drops the subset.
+    // Counted in whisper_get_model_memory(). Must not run while any state of the context decodes.
+    // Returns 0 on success.
+    WHISPER_API int whisper_ctx_set_vocab_subset(struct whisper_context * ctx, const whisper_token * tokens, int n_tokens);
+
+    // Devices of the stages of the states created from now on, see whisper_context_params::encoder_device.
+    WHISPER_API void whisper_ctx_set_devices(struct whisper_context * ctx, enum whisper_device encoder_device, enum whisper_device decoder_device);
+
+    // Called between the GPU submissions of a graph split by whisper_ctx_set_gpu_submit_budget(), e.g. to
+    // wait for the next frame so inference and rendering take turns on the GPU.
+    typedef void (*whisper_gpu_yield_callback)(void * user_data);
+
+    // Splits the graphs of the stages on the GPU into submissions of about max_submit_us each, so a long
+    // encoder graph does not hold the GPU for whole frames. yield_callback, when set, runs between two of
+    // them. 0 submits each graph at once, the default. Applies to the states that are computing too.
+    WHISPER_API void whisper_ctx_set_gpu_submit_budget(struct whisper_context * ctx, int max_submit_us, whisper_gpu_yield_callback yield_callback, void * user_data);
+
+    // Merges the decoder steps that up to max_states states of the context run at the same time in
+    // whisper_full_with_state into one graph, so the weights are read once for all of them. The first
+    // state of a step waits up to wait_us for the others that took part in the last ones. Only the steps
+    // after the prompt of states decoding on the CPU, without DTW or vocab_subset, are merged. 1 decodes
+    // every state alone, the default. Applies to the states that are decoding too.
+    WHISPER_API void whisper_ctx_set_decode_batching(struct whisper_context * ctx, int max_states, int wait_us);
+
+    // Returns 1 when the state encodes with Core ML, OpenVINO or NNAPI instead of ggml.
+    WHISPER_API int whisper_is_encoder_external_with_state(struct whisper_state * state);
+
     // Given a context, enable use of OpenVINO for encode inference.
     // model_path: Optional path to OpenVINO encoder IR model. If set to nullptr,
     //                      the path will be generated from the ggml model path that was passed
@@ -201,6 +370,32 @@ extern "C" {
                     const char * device,
                     const char * cache_dir);
 
+    // Same for a state created with whisper_init_state(), every state runs its own compiled encoder.
+    // With the encoder offloaded, the state always encodes the full audio context and cannot be
+    // used with whisper_encode_chunked_with_state() or whisper_encode_batch_with_states().
+    WHISPER_API int whisper_ctx_init_openvino_encoder_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                    const char * model_path,
+                    const char * device,
+                    const char * cache_dir);
+
+    // Given a state, run its encoder with TensorFlow Lite through the NNAPI delegate, on the NPU, DSP or GPU
+    // of an Android device. Like OpenVINO, the state then always encodes the full audio context.
+    // model_path: Optional path to the .tflite encoder, taking the [1, n_mels, 3000] f32 mel and giving the
+    //                      [1, 1500, n_audio_state] f32 features. If set to nullptr, "/path/to/ggml-base.en-encoder.tflite"
+    //                      next to the ggml model is used.
+    // accelerator: Optional NNAPI device name, e.g. "qti-dsp" or "google-edgetpu". nullptr lets NNAPI pick
+    //                      and partition the graph, the ops no accelerator takes run on the TensorFlow Lite CPU kernels.
+    // cache_dir: Optional directory where NNAPI keeps the model compiled for the device.
+    // Returns 0 on success. If NNAPI is not enabled in build, this simply returns 1.
+    WHISPER_API int whisper_ctx_init_nnapi_encoder_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+                    const char * model_path,
+                    const char * accelerator,
+                    const char * cache_dir);
+
     // Frees all allocated memory
     WHISPER_API void whisper_free      (struct whisper_context * ctx);
     WHISPER_API void whisper_free_state(struct whisper_state * state);
@@ -223,6 +418,44 @@ extern "C" {
                                int   n_samples,
                                int   n_threads);
 
+    // Same as whisper_pcm_to_mel_with_state(), for callers that decode a sliding window of a longer stream.
+    // samples[0] is sample sample_offset of that stream. Frames whose window lies in audio the previous call
+    // on this state already converted are copied from it instead of being computed again, the spectrogram
+    // is the same either way. The next whisper_full_with_state() or whisper_encode_batch_with_states() call
+    // with the same samples uses it instead of converting the audio again.
+    // Returns 0 on success
+    WHISPER_API int whisper_pcm_to_mel_cached_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                       const float * samples,
+                               int   n_samples,
+                           int64_t   sample_offset,
+                               int   n_threads);
+
+    // The log10 mel frames whisper_pcm_to_mel_cached_with_state() kept on the state, [n_frames][n_mel], before
+    // clamping and normalization. Frames are WHISPER_HOP_LENGTH samples apart, *offset is the stream position of
+    // the first sample of the window of frame 0. Valid until the next call on the state, NULL when there are none.
+    WHISPER_API const float * whisper_get_mel_cache_with_state(
+              struct whisper_state * state,
+                               int * n_frames,
+                               int * n_mel,
+                           int64_t * offset);
+
+    // Center frequency in Hz and peak weight of each mel filter of the model, e.g. to turn mel frames back into
+    // band energies. Returns the number of filters, at most n_mel are written.
+    WHISPER_API int whisper_get_mel_filters(
+            struct whisper_context * ctx,
+                             float * center_hz,
+                             float * peak,
+                               int   n_mel);
+
+    // With speed_up the mel spectrogram the following calls compute on the state is time compressed 2x, each
+    // frame the mean of two consecutive ones, so the encoder sees half the frames and half the audio context
+    // covers the same audio. The bands are left as they are, like a time stretch that keeps the pitch.
+    // whisper_full_with_state() sets it from whisper_full_params.speed_up, callers that compute the mel or
+    // encode ahead set it first so whisper_full can reuse their work.
+    WHISPER_API void whisper_set_speed_up_with_state(struct whisper_state * state, bool speed_up);
+
     // Convert RAW PCM audio to log mel spectrogram but applies a Phase Vocoder to speed up the audio x2.
     // The resulting spectrogram is stored inside the default state of the provided whisper context.
     // Returns 0 on success
@@ -271,6 +504,103 @@ extern "C" {
                                int   offset,
                                int   n_threads);
 
+    // Run the Whisper encoder on the audio of several states in one pass.
+    // The states must have been created from ctx. Each one gets the log mel spectrogram of its
+    // samples, and every sequence is padded to n_audio_ctx positions (0 - use default).
+    // A following whisper_full_with_state() call with the same samples and an audio_ctx of
+    // n_audio_ctx reuses the result instead of encoding the first window again.
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_batch_with_states(
+            struct whisper_context * ctx,
+             struct whisper_state ** states,
+                      const float ** samples,
+                         const int * n_samples,
+                               int   n_states,
+                               int   n_audio_ctx,
+                               int   n_threads);
+
+    // Run the Whisper encoder on the audio of samples as chunks of n_chunk_ctx positions, each of which also
+    // sees the n_overlap_ctx positions before it. A chunk whose input did not change since the previous call
+    // on this state is not encoded again, so a buffer that only grew at the end costs about one chunk.
+    // The self-attention does not span chunks, the result is close to but not the same as one encoder pass.
+    // A following whisper_full_with_state() call with the same samples and an audio_ctx of n_audio_ctx
+    // (0 - use default) reuses the result instead of encoding the first window again.
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_chunked_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                       const float * samples,
+                               int   n_samples,
+                               int   n_audio_ctx,
+                               int   n_chunk_ctx,
+                               int   n_overlap_ctx,
+                               int   n_threads);
+
+    // Convert samples to a log mel spectrogram and run the encoder on its first window, so the encoder work of
+    // a later whisper_full_with_state() call can happen ahead of it, e.g. while another state decodes. Unlike
+    // the batched and chunked encoders this also works with an external encoder. A following
+    // whisper_full_with_state() call with the same samples and an audio_ctx of n_audio_ctx (0 - use default)
+    // reuses the result instead of encoding the first window again.
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_samples_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                       const float * samples,
+                               int   n_samples,
+                               int   n_audio_ctx,
+                               int   n_threads);
+
+    // After a whisper_full_with_state() call on samples, let the next call on the same samples reuse the
+    // encoded first window it left in the cross-attention memory, so it only decodes, e.g. to translate the
+    // audio that was just transcribed. The mel must still be the one of these samples and the next call must
+    // use the same audio_ctx, speed_up and encoder_layers and a fixed language, detection encodes again. When the call moved
+    // on to a later window, the first one is encoded again here.
+    // Returns 0 on success
+    WHISPER_API int whisper_reuse_encoding_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                       const float * samples,
+                               int   n_samples,
+                               int   n_threads);
+
+    // Score a fixed set of token sequences as the transcription of the mel of the state, e.g. the phrases of
+    // a voice command list, instead of decoding freely. The encoder runs on the first n_audio_ctx positions
+    // (0 - use default), then the decoder runs on all sequences at once as a token tree that decodes every
+    // shared prefix once, after sot, the language (lang_id, -1 detects it) and the transcribe and no
+    // timestamps tokens. log_probs[i] is the log probability of sequences[i], followed by eot with add_eot,
+    // otherwise of the transcription starting with it.
+    // The tree must fit in the self-attention kv cache of the state, about 3*n_text_ctx tokens.
+    // Returns 0 on success
+    WHISPER_API int whisper_score_sequences_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                               int   n_audio_ctx,
+                               int   lang_id,
+        const whisper_token * const * sequences,
+                         const int * n_tokens,
+                               int   n_sequences,
+                              bool   add_eot,
+                             float * log_probs,
+                               int   n_threads);
+
+    // Time the text tokens of a transcription of the first window of the mel of the state, e.g. the one of the last
+    // whisper_full_with_state() on a clip of up to 30 seconds, more precisely than token_timestamps. The window is
+    // encoded again only when the state last encoded another one. The decoder runs once on the tokens after sot, the
+    // language of the state and the transcribe and no timestamps tokens, then dynamic time warping over the
+    // cross-attention weights of the alignment heads finds when each token is spoken within the first n_samples.
+    // t0[i] and t1[i] are the start and end of tokens[i] in centiseconds, like whisper_token_data::t0 and t1.
+    // Only for states created with dtw_token_timestamps.
+    // Returns 0 on success
+    WHISPER_API int whisper_full_align_tokens_dtw_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+               const whisper_token * tokens,
+                               int   n_tokens,
+                               int   n_samples,
+                           int64_t * t0,
+                           int64_t * t1,
+                               int   n_threads);
+
     // Run the Whisper decoder to obtain the logits and probabilities for the next token.
     // Make sure to call whisper_encode() first.
     // tokens + n_tokens is the provided context for the decoder.
@@ -337,6 +667,18 @@ extern "C" {
                                int   n_threads,
                              float * lang_probs);
 
+    // Same, but only the n_lang_ids languages in lang_ids are candidates. Their probabilities are taken over
+    // them alone and the others get 0, so a subset of a few languages is both more accurate and surer of
+    // its pick. nullptr or 0 languages considers all of them.
+    WHISPER_API int whisper_lang_auto_detect_subset_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                               int   offset_ms,
+                               int   n_threads,
+                         const int * lang_ids,
+                               int   n_lang_ids,
+                             float * lang_probs);
+
     WHISPER_API int whisper_n_len           (struct whisper_context * ctx); // mel length
     WHISPER_API int whisper_n_len_from_state(struct whisper_state * state); // mel length
     WHISPER_API int whisper_n_vocab         (struct whisper_context * ctx);
@@ -357,6 +699,10 @@ extern "C" {
     WHISPER_API int whisper_model_ftype        (struct whisper_context * ctx);
     WHISPER_API int whisper_model_type         (struct whisper_context * ctx);
 
+    // Distilled checkpoints (distil-whisper) keep the encoder of their teacher under 2 decoder layers, 4 for distil-small.en.
+    // Their decoder was not trained on timestamp tokens, they are decoded with no_timestamps, whisper_full forces it.
+    WHISPER_API bool whisper_model_is_distilled(struct whisper_context * ctx);
+
     // Token logits obtained from the last call to whisper_decode()
     // The logits for the last token are stored in the last row
     // Rows: n_tokens
@@ -387,9 +733,50 @@ extern "C" {
     WHISPER_API void whisper_print_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_reset_timings(struct whisper_context * ctx);
 
+    // Time a state spent in each stage since it was created or last reset, in milliseconds
+    struct whisper_timings {
+        float mel_ms;
+        float sample_ms;
+        float encode_ms;
+        float decode_ms;
+        float batchd_ms;
+        float prompt_ms;
+        int   n_sample;   // tokens sampled, by all decoders
+        int   n_fallback; // temperature fallbacks
+    };
+
+    WHISPER_API struct whisper_timings whisper_get_timings_from_state(struct whisper_state * state);
+    WHISPER_API void whisper_reset_timings_from_state(struct whisper_state * state);
+
+    // Forget what earlier calls left on the state: the KV caches, the cached mel frames and encoder output, the
+    // results, the prompt, the language and the timings. The buffers and the measured graph allocations are kept,
+    // so a pooled state decodes unrelated audio next without being created again.
+    WHISPER_API void whisper_reset_state(struct whisper_state * state);
+
+    // Bytes of the weights of a context, and of the KV caches and compute buffers of a state
+    WHISPER_API size_t whisper_get_model_memory(struct whisper_context * ctx);
+    WHISPER_API size_t whisper_get_state_memory(struct whisper_state * state);
+
+    struct whisper_state_memory {
+        size_t kv_self;  // self-attention cache of the decoders
+        size_t kv_cross; // cross-attention cache, n_audio_ctx_max positions
+        size_t compute;  // compute buffers and graph metadata of the conv, encoder, cross and decoder graphs
+        size_t mel;      // the mel spectrogram of the last input
+    };
+
+    // whisper_get_state_memory() by kind, the fields sum to it
+    WHISPER_API struct whisper_state_memory whisper_get_state_memory_breakdown(struct whisper_state * state);
+
+    // Bytes whisper_get_state_memory() would report for a new state sized for n_audio_ctx_max, before any
+    // input. Measured by creating such a state, so it briefly needs that memory.
+    WHISPER_API size_t whisper_estimate_state_memory(struct whisper_context * ctx, int n_audio_ctx_max);
+
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
+    // Devices whisper_context_params::gpu_device can pick: the CUDA devices, 1 with Metal, else 0
+    WHISPER_API int whisper_gpu_device_count(void);
+
     ////////////////////////////////////////////////////////////////////////////
 
     // Available sampling strategies
@@ -427,6 +814,16 @@ extern "C" {
                              float * logits,
                               void * user_data);
 
+    // New token callback
+    // If not NULL, called after every decoding step with the tokens the most likely decoder sampled so far for
+    // the current window, special and timestamp tokens included. A temperature fallback starts them over.
+    typedef void (*whisper_new_token_callback)(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+          const whisper_token_data * tokens,
+                               int   n_tokens,
+                              void * user_data);
+
     // Parameters for the whisper_full() function
     // If you change the order or add new parameters, make sure to update the default values in whisper.cpp:
     // whisper_full_default_params()
@@ -457,9 +854,12 @@ extern "C" {
 
         // [EXPERIMENTAL] speed-up techniques
         // note: these can significantly reduce the quality of the output
-        bool speed_up;          // speed-up the audio by 2x using Phase Vocoder
+        bool speed_up;          // speed-up the audio by 2x by averaging pairs of mel frames, see whisper_set_speed_up_with_state()
         bool debug_mode;        // enable debug_mode provides extra info (eg. Dump log_mel)
         int  audio_ctx;         // overwrite the audio context size (0 = use default)
+        int  encoder_layers;    // encode with the first encoder layers and the final layer norm only (0 = all of them)
+                                // the encoder outputs of whisper_encode_batch_with_states(), whisper_encode_chunked_with_state()
+                                // and the language detection always run all layers
 
         // [EXPERIMENTAL] [TDRZ] tinydiarize
         bool tdrz_enable;       // enable tinydiarize speaker turn detection
@@ -470,10 +870,21 @@ extern "C" {
         const whisper_token * prompt_tokens;
         int prompt_n_tokens;
 
+        // tokens the decoder is expected to produce for the first window, e.g. the result of the previous call
+        // on a buffer that only grew since. they are decoded in one batch together with the prompt and accepted
+        // as long as sampling picks the same tokens, decoding goes on one token at a time from the first one
+        // that differs. only used for greedy sampling at temperature 0, the result is the same without them
+        const whisper_token * draft_tokens;
+        int draft_n_tokens;
+
         // for auto-detection, set to nullptr, "" or "auto"
         const char * language;
         bool detect_language;
 
+        // the languages auto-detection picks from, by whisper_lang_id(), nullptr or 0 for all of them
+        const int * detect_lang_ids;
+        int n_detect_lang_ids;
+
         // common decoding parameters:
         bool suppress_blank;    // ref: https://github.com/openai/whisper/blob/f82bc59f5ea234d4b97fb2860842ed38519f7e65/whisper/decoding.py#L89
         bool suppress_non_speech_tokens; // ref: https://github.com/openai/whisper/blob/7858aa9c08d98f75575035ecd6481f462d66ca27/whisper/tokenizer.py#L224-L253
@@ -488,6 +899,7 @@ extern "C" {
         float entropy_thold;    // similar to OpenAI's "compression_ratio_threshold"
         float logprob_thold;
         float no_speech_thold;  // TODO: not implemented
+        int   max_fallbacks;    // temperatures tried after the first one at most, -1 for all up to 1.0
 
         struct {
             int best_of;    // ref: https://github.com/openai/whisper/blob/f82bc59f5ea234d4b97fb2860842ed38519f7e65/whisper/transcribe.py#L264
@@ -499,6 +911,17 @@ extern "C" {
             float patience; // TODO: not implemented, ref: https://arxiv.org/pdf/2204.05424.pdf
         } beam_search;
 
+        // time into the call after which no more temperature fallbacks are tried and the remaining tokens
+        // are decoded with the best single decoder, greedily, 0 for no limit
+        int decode_budget_ms;
+
+        // a decoder whose last text tokens are the same n-gram of up to 8 tokens this many times in a row is
+        // stopped after the first of them, and the rest of the window is skipped instead of decoded again, 0 never
+        int repetition_limit;
+
+        // project the decoder output onto the vocabulary subset of the context, see whisper_ctx_set_vocab_subset()
+        bool vocab_subset;
+
         // called for every newly generated text segment
         whisper_new_segment_callback new_segment_callback;
         void * new_segment_callback_user_data;
@@ -519,6 +942,10 @@ extern "C" {
         whisper_logits_filter_callback logits_filter_callback;
         void * logits_filter_callback_user_data;
 
+        // called after every decoding step, see whisper_new_token_callback
+        whisper_new_token_callback new_token_callback;
+        void * new_token_callback_user_data;
+
         const whisper_grammar_element ** grammar_rules;
         size_t                           n_grammar_rules;
         size_t                           i_start_rule;
@@ -559,6 +986,16 @@ extern "C" {
                                    int   n_samples,
                                    int   n_processors);
 
+    // Same as whisper_full_parallel(), but the result is stored in the given state
+    // The chunks after the first one are still processed on states of their own
+    WHISPER_API int whisper_full_parallel_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   n_processors);
+
     // Number of generated text segments
     // A segment can be a few words, a sentence, or even a paragraph.
     WHISPER_API int whisper_full_n_segments           (struct whisper_context * ctx);
@@ -570,6 +1007,12 @@ extern "C" {
     // Language id associated with the provided state
     WHISPER_API int whisper_full_lang_id_from_state(struct whisper_state * state);
 
+    // Probability of the language of the provided state, 1.0f when it was not auto-detected
+    WHISPER_API float whisper_full_lang_prob_from_state(struct whisper_state * state);
+
+    // Whether the last whisper_full call cut a repetition loop short, see whisper_full_params::repetition_limit
+    WHISPER_API bool whisper_full_repetition_aborted_from_state(struct whisper_state * state);
+
     // Get the start and end time of the specified segment
     WHISPER_API int64_t whisper_full_get_segment_t0           (struct whisper_context * ctx, int i_segment);
     WHISPER_API int64_t whisper_full_get_segment_t0_from_state(struct whisper_state * state, int i_segment);